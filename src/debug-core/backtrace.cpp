@@ -0,0 +1,225 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <stdio.h>
+#include "backtrace.h"
+#include "target.h"
+#include "memremap.h"
+#include "symtab.h"
+#include "symbol.h"
+#include "inst8051.h"
+
+using namespace std;
+
+Backtrace::Backtrace( DbgSession *session )
+	: mSession(session)
+{
+}
+
+
+Backtrace::~Backtrace()
+{
+}
+
+
+bool Backtrace::unwind( FRAME_VEC &frames, uint32_t max_frames )
+{
+	Target *t = mSession->target();
+	const Target::CPU_CONTEXT &c = t->read_cpu_context();
+	uint8_t stack[0x100];
+	const int bottom = SP_RESET+1;
+	int top = c.sp;
+	int bp = -1;			// value of _bp in the current frame, -1 unknown
+	bool bp_valid = true;	// false once a reentrant frame was found without it
+	PROLOGUE pro;
+	FRAME f;
+
+	frames.clear();
+	f.pc = c.pc;
+	f.sp = c.sp;
+	f.called = false;
+	Symbol *func = describe( f );
+	frames.push_back( f );
+	if( top<bottom )
+		return true;		// nothing pushed
+	if( !t->read_memory( MemRemap::flat( bottom, 'i' ), top-bottom+1,
+						 stack+bottom ) )
+		return false;
+
+	while( frames.size()<max_frames )
+	{
+		int ret_at = -1;	// IDATA address of the return address high byte
+		int saved_bp = -1;
+		if( func )
+		{
+			prologue( func->addr(), f.pc, pro );
+			if( func->is_reentrant() && pro.bp_set )
+			{
+				if( bp_valid && bp==-1 )
+				{
+					// the one DATA read, later frames' _bp are on the stack
+					uint8_t v;
+					if( t->read_memory( MemRemap::flat( pro.bp_addr, 'd' ), 1, &v ) )
+						bp = v;
+				}
+				// push _bp, mov _bp,sp so _bp points at the saved value
+				if( bp_valid && bp>bottom && bp<=top )
+				{
+					ret_at = bp-1;
+					saved_bp = stack[bp];
+				}
+			}
+			else
+				ret_at = top - pro.pushes;
+		}
+		if( ret_at<=bottom || ret_at>top ||
+			!is_return( stack[ret_at]<<8 | stack[ret_at-1], func ) )
+		{
+			// not where the prologue says, search down from the top
+			ret_at = saved_bp = -1;
+			for( int p=top; p>bottom && ret_at==-1; p-- )
+			{
+				if( is_return( stack[p]<<8 | stack[p-1], func ) )
+					ret_at = p;
+			}
+			if( ret_at==-1 )
+				break;
+			if( func && func->is_reentrant() && pro.bp_set )
+				bp_valid = false;
+		}
+		if( saved_bp!=-1 )
+			bp = saved_bp;
+
+		f.called = !( func && func->is_int_handler() );
+		f.pc = stack[ret_at]<<8 | stack[ret_at-1];
+		f.sp = ret_at-2;
+		top = ret_at-2;
+		func = describe( f );
+		frames.push_back( f );
+		if( top<bottom )
+			break;
+	}
+	return true;
+}
+
+
+void Backtrace::print( const FRAME_VEC &frames )
+{
+	for( int i=0; i<frames.size(); i++ )
+	{
+		const FRAME &f = frames[i];
+		bool line_start = !f.called && f.line!=LINE_NUM(-1) &&
+			mSession->symtab()->get_addr( f.file, f.line )==f.pc;
+		printf( "#%-2i ", i );
+		if( !line_start )
+			printf( "0x%04x in ", f.pc );
+		printf( "%s ()", f.function.empty() ? "??" : f.function.c_str() );
+		if( f.line!=LINE_NUM(-1) )
+			printf( " at %s:%u", f.file.c_str(), f.line );
+		printf( "\n" );
+	}
+}
+
+
+/** Work out how much of a function's prologue has run.
+	Handles the PUSHes of interrupt handlers, the register bank switch that
+	follows them and the "push _bp, mov _bp,sp" of reentrant functions.
+*/
+void Backtrace::prologue( ADDR start, ADDR pc, PROLOGUE &pro )
+{
+	uint8_t code[3];
+	int last_push = -1;
+	pro.pushes = 0;
+	pro.bp_addr = -1;
+	pro.bp_set = false;
+
+	// only instructions before pc have run
+	for( int n=0; n<MAX_PROLOGUE && start<pc; n++ )
+	{
+		mSession->target()->read_memory( MemRemap::flat( start, 'c' ),
+										 sizeof(code), code );
+		if( code[0]==0xc0 )							// PUSH direct
+		{
+			pro.pushes++;
+			last_push = code[1];
+			start += 2;
+		}
+		else if( code[0]==0x85 && code[1]==0x81 && code[2]==last_push )
+		{
+			pro.bp_addr = last_push;				// MOV _bp,SP
+			pro.bp_set = true;
+			return;
+		}
+		else if( code[0]==0x75 && code[1]==0xd0 )	// MOV PSW,#bank
+			start += 3;
+		else
+			return;
+	}
+}
+
+
+/** true if ret is a return address into a known function from a call
+	made by func.  Interrupt handlers return to any instruction.
+	\param func	function of the frame being unwound, 0 if unknown so any
+				call is accepted.
+*/
+bool Backtrace::is_return( ADDR ret, Symbol *func )
+{
+	uint8_t code[3+Inst8051::MAX_LENGTH];
+	ADDR target;
+	int len;
+
+	if( func && func->is_int_handler() )
+		return mSession->symtab()->get_function( ret )!=0;
+	if( ret<3 || !mSession->symtab()->get_function( ret-1 ) )
+		return false;
+	// code reads come from the code cache, not the target
+	mSession->target()->read_memory( MemRemap::flat( ret-3, 'c' ),
+									 sizeof(code), code );
+	// LCALL at ret-3 or ACALL at ret-2
+	for( int i=0; i<2; i++ )
+	{
+		if( Inst8051::decode( ret-3+i, &code[i], len, target )==Inst8051::FLOW_CALL &&
+			len==3-i && ( !func || target==ADDR(func->addr()) ) )
+			return true;
+	}
+	return false;
+}
+
+
+/** Fill in the function and line of a frame from its pc.
+	\returns the function symbol, 0 if pc isn't in a known function.
+*/
+Symbol *Backtrace::describe( FRAME &f )
+{
+	SymTab *symtab = mSession->symtab();
+	ADDR start, end;
+	// a call may be the last instruction of its line, or its function
+	ADDR at = f.called ? f.pc-1 : f.pc;
+	Symbol *func = symtab->get_function( at );
+	f.function = func ? func->name() : "";
+	f.interrupt = func && func->is_int_handler();
+	if( !symtab->get_c_block( at, start, end ) ||
+		!symtab->find_c_file_line( start, f.file, f.line ) )
+	{
+		f.file = "";
+		f.line = LINE_NUM(-1);
+	}
+	return func;
+}
@@ -0,0 +1,95 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef BACKTRACE_H
+#define BACKTRACE_H
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "types.h"
+#include "dbgsession.h"
+
+class Symbol;
+
+/**	Call stack unwinder for a halted target.
+	The stack in use, from just above the reset value of SP up to SP, is
+	read with one IDATA transfer and unwound in that copy, so deep stacks
+	cost no more target reads than shallow ones.
+
+	The return address of each frame is checked against the code, it must
+	follow an LCALL or ACALL of the frame's function and be inside another
+	function.  The prologue of the function says where the return address
+	is: interrupt handlers push registers before anything else and reentrant
+	functions, those with locals on the stack in the cdb, save _bp
+	above it.  The chain of saved _bp values locates the frames of
+	reentrant functions, anything else found to be on the stack, eg
+	arguments pushed for a call, is skipped by searching down for the next
+	valid return address.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Backtrace
+{
+public:
+	enum { SP_RESET = 0x07 };		///< SP after reset, the stack starts above
+	enum { MAX_FRAMES = 64 };
+	enum { MAX_PROLOGUE = 16 };		///< instructions looked at in a prologue
+
+	typedef struct
+	{
+		ADDR		pc;			///< next instruction, a return address above frame 0
+		uint8_t		sp;			///< SP within the frame
+		bool		called;		///< pc is the return address of a call
+		std::string	function;	///< empty if pc isn't in a known function
+		std::string	file;
+		LINE_NUM	line;		///< LINE_NUM(-1) if there's no C line
+		bool		interrupt;	///< the function is an interrupt handler
+	} FRAME;
+	typedef std::vector<FRAME> FRAME_VEC;
+
+	Backtrace( DbgSession *session );
+	~Backtrace();
+
+	/** Unwind the stack of the halted target, innermost frame first.
+		Stops at the bottom of the stack, at the first frame whose return
+		address can't be found, or after max_frames frames.
+		\returns false if the stack couldn't be read, frames then only holds
+				the innermost frame.
+	*/
+	bool unwind( FRAME_VEC &frames, uint32_t max_frames=MAX_FRAMES );
+
+	/** Print frames gdb style, "#1  0x0123 in main () at main.c:12".
+	*/
+	void print( const FRAME_VEC &frames );
+
+protected:
+	DbgSession	*mSession;
+
+	typedef struct
+	{
+		int		pushes;		///< PUSHes already executed at the frame's pc
+		int		bp_addr;	///< DATA address of _bp, -1 if not saved
+		bool	bp_set;		///< _bp already points at the frame
+	} PROLOGUE;
+	void prologue( ADDR start, ADDR pc, PROLOGUE &pro );
+	bool is_return( ADDR ret, Symbol *func );
+	Symbol *describe( FRAME &f );
+};
+
+#endif
@@ -20,6 +20,7 @@
 #include <iostream>
 #include <vector>
 #include <stdio.h>
+#include <algorithm>
 #include "target.h"
 #include "breakpointmgr.h"
 #include "symtab.h"
@@ -28,7 +29,8 @@
 using namespace std;
 
 BreakpointMgr::BreakpointMgr( DbgSession *session )
-	: mSession(session)
+	: mSession(session), code_count(0x10000), active_addrs(0),
+	  id_top(1), cur_addr(0), stop_id(BP_ID_INVALID), rotate(0)
 {
 }
 
@@ -44,35 +46,23 @@ BreakpointMgr::~BreakpointMgr()
 */
 BP_ID BreakpointMgr::set_bp( ADDR addr, bool temporary )
 {
-	if( add_target_bp(addr) )
-	{
-		BP_ENTRY ent;
-		ent.id		  = next_id();
-		ent.addr  	  = addr;
-		ent.bTemp 	  = temporary;
-		ent.bDisabled = false;
-		bplist.push_back(ent);
-		return ent.id;
-	}
-	return BP_ID_INVALID;
+	BP_ENTRY ent;
+	ent.addr  	  = addr;
+	ent.bTemp 	  = temporary;
+	ent.bDisabled = false;
+	return add_entry( ent );
 }
 
 BP_ID BreakpointMgr::set_bp( string file, LINE_NUM line )
 {
 	// @TODO lookup address, try and findout what it is, if we can't find it we should fail, since we know which files are involved from the start (nothing is dynamic)
-	if( add_target_bp( 0x1234 ) )
-	{
-		BP_ENTRY ent;
-		ent.id		  = next_id();
-		ent.addr  	  = 0x1234;
-		ent.bTemp 	  = false;
-		ent.bDisabled = false;
-		ent.file	  = file;
-		ent.line	  = line;
-		bplist.push_back(ent);
-		return ent.id;
-	}
-	return BP_ID_INVALID;
+	BP_ENTRY ent;
+	ent.addr  	  = 0x1234;
+	ent.bTemp 	  = false;
+	ent.bDisabled = false;
+	ent.file	  = file;
+	ent.line	  = line;
+	return add_entry( ent );
 }
 
 // @FIXME: shoulden't we remove file and line from the entry and have a generic what field that can be set approprieatly when a breakpoint is created of modified
@@ -83,17 +73,11 @@ BP_ID BreakpointMgr::set_bp( string file, LINE_NUM line )
 */
 BP_ID BreakpointMgr::set_temp_bp( ADDR addr )
 {
-	if( add_target_bp(addr) )
-	{
-		BP_ENTRY ent;
-		ent.id		  = next_id();
-		ent.addr  	  = addr;
-		ent.bTemp 	  = true;
-		ent.bDisabled = false;
-		bplist.push_back(ent);
-		return ent.id;
-	}
-	return BP_ID_INVALID;
+	BP_ENTRY ent;
+	ent.addr  	  = addr;
+	ent.bTemp 	  = true;
+	ent.bDisabled = false;
+	return add_entry( ent );
 }
 
 /** Set a temporary breakpoint.
@@ -104,19 +88,13 @@ BP_ID BreakpointMgr::set_temp_bp( ADDR addr )
 BP_ID BreakpointMgr::set_temp_bp( string file, unsigned int line )
 {
 	// @TODO lookup address, try and findout what it is, if we can't find it we should fail, since we know which files are involved from the start (nothing is dynamic)
-	if( add_target_bp( 0x1234 ) )
-	{
-		BP_ENTRY ent;
-		ent.id		  = next_id();
-		ent.addr  	  = 0x1234;
-		ent.bTemp 	  = true;
-		ent.bDisabled = false;
-		ent.file	  = file;
-		ent.line	  = line;
-		bplist.push_back(ent);
-		return ent.id;
-	}
-	return BP_ID_INVALID;
+	BP_ENTRY ent;
+	ent.addr  	  = 0x1234;
+	ent.bTemp 	  = true;
+	ent.bDisabled = false;
+	ent.file	  = file;
+	ent.line	  = line;
+	return add_entry( ent );
 }
 
 
@@ -127,36 +105,125 @@ void BreakpointMgr::clear_all()
 {
 	cout << "Clearing all breakpoints." << endl;
 	bplist.clear();
+	by_id.clear();
+	by_addr.clear();
+	ADDR_COUNT none = { 0, 0 };
+	code_count.assign( code_count.size(), none );
+	far_count.clear();
+	active_addrs = 0;
+	free_ids.clear();
+	id_top = 1;
 	cout << "Clearing all breakpoints in target." << endl;
 	mSession->target()->clear_all_breakpoints();
+	loaded.clear();
 }
 
 void BreakpointMgr::reload_all()
+{
+	mSession->target()->clear_all_breakpoints();
+	loaded.clear();
+}
+
+void BreakpointMgr::remap()
 {
 	BP_LIST::iterator it;
-	cout << "Reloading breakpoints into the target." << endl;
+	for( it=bplist.begin(); it!=bplist.end(); ++it )
+	{
+		if( it->file.empty() )
+			continue;
+		ADDR addr = mSession->symtab()->get_addr( it->file, it->line );
+		if( addr==-1 )
+		{
+			if( !it->bDisabled )
+				printf( "Breakpoint %i, %s:%i has no code now, disabled.\n",
+						it->id, it->file.c_str(), it->line );
+			set_disabled( it, true );
+		}
+		else if( addr!=it->addr )
+		{
+			printf( "Breakpoint %i, %s:%i moved to 0x%04x.\n",
+					it->id, it->file.c_str(), it->line, addr );
+			move_entry( it, addr );
+		}
+	}
+	reload_all();
+}
 
-	std::vector<ADDR> loaded;
-	std::vector<ADDR>::iterator lit;
 
-	mSession->target()->clear_all_breakpoints();
-	if( bplist.size()>0 )
+/** Add addr to want unless it is already there.
+*/
+static void want_addr( vector<ADDR> &want, ADDR addr )
+{
+	if( find( want.begin(), want.end(), addr )==want.end() )
+		want.push_back( addr );
+}
+
+
+void BreakpointMgr::sync_target()
+{
+	unsigned int slots = mSession->target()->max_breakpoints();
+	vector<ADDR> want( step_bps.begin(), step_bps.end() );
+	vector<ADDR> local, rest;
+	BP_LIST::iterator it;
+	list<ADDR>::iterator lit;
+	string file, func;
+	int32_t func_start = -1, func_end = -1;
+
+	if( mSession->symtab()->get_c_function( cur_addr, file, func ) )
+		mSession->symtab()->get_addr( func, func_start, func_end );
+	for( it=bplist.begin(); it!=bplist.end(); ++it )
 	{
-		for( it=bplist.begin(); it!=bplist.end(); ++it )
+		if( it->bDisabled )
+			continue;
+		if( it->bTemp )
+			want_addr( want, it->addr );
+		else if( it->addr>=func_start && it->addr<=func_end )
+			want_addr( local, it->addr );
+		else
+			want_addr( rest, it->addr );
+	}
+	for( int i=0; i<local.size(); i++ )
+		want_addr( want, local[i] );
+	for( int i=0; i<rest.size(); i++ )
+	{
+		if( find( want.begin(), want.end(), rest[i] )!=want.end() )
+			rest.erase( rest.begin()+i-- );
+	}
+
+	// share any room left between the rest, starting where we left off
+	if( !rest.empty() )
+	{
+		unsigned int room = want.size()<slots ? slots-want.size() : 0;
+		unsigned int n = rest.size()<room ? rest.size() : room;
+		for( unsigned int i=0; i<n; i++ )
+			want.push_back( rest[ (rotate+i) % rest.size() ] );
+		if( n<rest.size() )
+		{
+			rotate = (rotate+n) % rest.size();
+			printf( "%u breakpoints don't fit in the target this run, "
+					"they will be loaded on later runs.\n",
+					(unsigned int)rest.size()-n );
+		}
+	}
+	if( want.size()>slots )
+		want.resize( slots );
+
+	// remove first so the slots are free for the additions
+	for( lit=loaded.begin(); lit!=loaded.end(); )
+	{
+		if( find( want.begin(), want.end(), *lit )==want.end() )
 		{
-			// only reload if we haven't already loaded a bp at that address.
-			//lit = loaded.find( (*it).addr );
-			for(lit=loaded.begin();lit!=loaded.end(); ++lit)
-			{
-				if( (*it).addr==*(lit) )	break;
-			}
-			//lit = find(loaded.begin(),loaded.end),(*it).addr==addr);
-			if( lit == loaded.end() )
-			{
-				mSession->target()->add_breakpoint( (*it).addr );
-				loaded.push_back((*it).addr);
-			}
+			mSession->target()->del_breakpoint( *lit );
+			lit = loaded.erase( lit );
 		}
+		else
+			++lit;
+	}
+	for( int i=0; i<want.size(); i++ )
+	{
+		if( find( loaded.begin(), loaded.end(), want[i] )==loaded.end() &&
+			mSession->target()->add_breakpoint( want[i] ) )
+			loaded.push_back( want[i] );
 	}
 }
 
@@ -182,30 +249,134 @@ void BreakpointMgr::dump()
 		cout << "No breakpoints or watchpoints." << endl;
 }
 
+string BreakpointMgr::mi_bkpt( BP_ID id )
+{
+	char buf[64];
+	BP_LIST::iterator it = find_id( id );
+	if( it==bplist.end() )
+		return "";
+	snprintf( buf, sizeof(buf),
+			  "bkpt={number=\"%i\",type=\"breakpoint\",disp=\"%s\",enabled=\"%c\"",
+			  it->id, it->bTemp ? "del" : "keep", it->bDisabled ? 'n' : 'y' );
+	string rec = buf;
+	snprintf( buf, sizeof(buf), ",addr=\"0x%04x\"", it->addr );
+	rec += buf;
+	if( !it->file.empty() )
+	{
+		rec += ",file=" + DbgSession::mi_quote( it->file );
+		snprintf( buf, sizeof(buf), ",line=\"%i\"", it->line );
+		rec += buf;
+	}
+	rec += ",original-location=" + DbgSession::mi_quote( it->what ) + ",times=\"0\"}";
+	return rec;
+}
+
 /** find the lowest unused breakpoint number and return it
-	This version is ineffificent but it will work 
-	for the numbe of breakpoints we expect.
 */
 int BreakpointMgr::next_id()
 {
-	int lowest;
-	bool ok;
+	if( free_ids.empty() )
+		return id_top++;
+	BP_ID id = *free_ids.begin();
+	free_ids.erase( free_ids.begin() );
+	return id;
+}
 
-	BP_LIST::iterator it;
-	for( lowest=1; lowest<0xffff; lowest++)
+/** Add ent to the list and the indexes under the next free id.
+	\returns the id assigned.
+*/
+BP_ID BreakpointMgr::add_entry( BP_ENTRY &ent )
+{
+	ent.id = next_id();
+	BP_LIST::iterator it = bplist.insert( bplist.end(), ent );
+	by_id[ent.id] = it;
+	by_addr.insert( make_pair( ent.addr, it ) );
+	count( ent.addr, 1, ent.bDisabled ? 0 : 1 );
+	return ent.id;
+}
+
+/** Remove an entry from the list and the indexes, its id becomes free.
+*/
+void BreakpointMgr::erase_entry( BP_LIST::iterator it )
+{
+	pair<ADDR_INDEX::iterator,ADDR_INDEX::iterator> r;
+	r = by_addr.equal_range( it->addr );
+	for( ADDR_INDEX::iterator a=r.first; a!=r.second; ++a )
 	{
-		ok=true;
-		for( it=bplist.begin(); it!=bplist.end(); ++it )
+		if( a->second==it )
+		{
+			by_addr.erase( a );
+			break;
+		}
+	}
+	count( it->addr, -1, it->bDisabled ? 0 : -1 );
+	by_id.erase( it->id );
+	// ids at the top go back to id_top so free_ids stays small
+	if( it->id==id_top-1 )
+	{
+		id_top--;
+		while( !free_ids.empty() && *free_ids.rbegin()==id_top-1 )
+		{
+			free_ids.erase( --free_ids.end() );
+			id_top--;
+		}
+	}
+	else
+		free_ids.insert( it->id );
+	bplist.erase( it );
+}
+
+void BreakpointMgr::set_disabled( BP_LIST::iterator it, bool disabled )
+{
+	if( it->bDisabled==disabled )
+		return;
+	it->bDisabled = disabled;
+	count( it->addr, 0, disabled ? -1 : 1 );
+}
+
+/** Change the address of an entry, keeping the indexes in step.
+*/
+void BreakpointMgr::move_entry( BP_LIST::iterator it, ADDR addr )
+{
+	pair<ADDR_INDEX::iterator,ADDR_INDEX::iterator> r;
+	r = by_addr.equal_range( it->addr );
+	for( ADDR_INDEX::iterator a=r.first; a!=r.second; ++a )
+	{
+		if( a->second==it )
 		{
-			if( (*it).id==lowest )
-			{
-				ok=false;
-				break;
-			}
+			by_addr.erase( a );
+			break;
 		}
-		if( ok )
-			return lowest;
 	}
+	count( it->addr, -1, it->bDisabled ? 0 : -1 );
+	it->addr = addr;
+	by_addr.insert( make_pair( addr, it ) );
+	count( addr, 1, it->bDisabled ? 0 : 1 );
+}
+
+BreakpointMgr::BP_LIST::iterator BreakpointMgr::find_id( BP_ID id )
+{
+	ID_INDEX::iterator it = by_id.find( id );
+	return it==by_id.end() ? bplist.end() : it->second;
+}
+
+BreakpointMgr::ADDR_COUNT &BreakpointMgr::count_at( ADDR addr )
+{
+	if( addr>=0 && addr<(ADDR)code_count.size() )
+		return code_count[addr];
+	return far_count[addr];		// only from addresses that aren't code
+}
+
+/** Adjust the counts of breakpoints at addr.
+*/
+void BreakpointMgr::count( ADDR addr, int all, int enabled )
+{
+	ADDR_COUNT &c = count_at( addr );
+	bool was_active = c.enabled>0;
+	c.all += all;
+	c.enabled += enabled;
+	if( was_active!=(c.enabled>0) )
+		active_addrs += was_active ? -1 : 1;
 }
 
 
@@ -239,97 +410,30 @@ BP_ID BreakpointMgr::set_breakpoint( string cmd, bool temporary )
 		switch( ls.type() )
 		{
 			case LineSpec::LINENO:
-//				ADDR addr = symtab.get_addr( ls.file(), ls.line() );
-				if( ls.addr() !=-1 )
-				{
-					ent.addr	= ls.addr();
-					ent.what	= cmd;
-					ent.bTemp	= temporary;
-					ent.id		= next_id();
-					ent.bDisabled = false;
-					if( add_target_bp(ent.addr) )
-					{
-						printf("Breakpoint %i at 0x%04x: file %s, line %i.\n",
-							   ent.id,
-							   ent.addr,
-							   ls.file().c_str(),
-							   ls.line());
-						   
-						bplist.push_back(ent);
-						return ent.id;
-					}
-				}
-				return BP_ID_INVALID;
-				//return true;	// don't print bad command, was correctly formatted just no addr
-				break;
+				if( ls.addr()==-1 )
+					return BP_ID_INVALID;	// correctly formatted just no addr
+				// fall through
 			case LineSpec::FUNCTION:
-				ent.addr	= ls.addr();
-				ent.what	= cmd;
-				ent.bTemp	= temporary;
-				ent.id		= next_id();
-				ent.bDisabled = false;
-				if( add_target_bp(ent.addr) )
-				{
-					printf("Breakpoint %i at 0x%04x: file %s, line %i.\n",
-						   ent.id,
-						   ent.addr,
-						   ls.file().c_str(),
-						   ls.line() );
-					bplist.push_back(ent);
-					return ent.id;
-				}
-				break;
 			case LineSpec::PLUS_OFFSET:
-				ent.addr	= ls.addr();
-				ent.what	= cmd;
-				ent.bTemp	= temporary;
-				ent.id		= next_id();
-				ent.bDisabled = false;
-				if( add_target_bp(ent.addr) )
-				{
-					printf("Breakpoint %i at 0x%04x: file %s, line %i.\n",
-						   ent.id,
-						   ent.addr,
-						   ls.file().c_str(),
-						   ls.line() );
-					bplist.push_back(ent);
-					return ent.id;
-				}
-				break;
 			case LineSpec::MINUS_OFFSET:
+			case LineSpec::ADDRESS:
 				ent.addr	= ls.addr();
-				ent.what	= cmd;
-				ent.bTemp	= temporary;
-				ent.id		= next_id();
-				ent.bDisabled = false;
-				if( add_target_bp(ent.addr) )
+				if( ls.type()==LineSpec::LINENO || ls.type()==LineSpec::FUNCTION )
 				{
-					printf("Breakpoint %i at 0x%04x: file %s, line %i.\n",
-						   ent.id,
-						   ent.addr,
-						   ls.file().c_str(),
-						   ls.line() );
-					bplist.push_back(ent);
-					return ent.id;
+					// so remap() can find the line again after a reload
+					ent.file	= ls.file();
+					ent.line	= ls.line();
 				}
-				break;
-			case LineSpec::ADDRESS:
-				ent.addr	= ls.addr();
 				ent.what	= cmd;
 				ent.bTemp	= temporary;
-				ent.id		= next_id();
 				ent.bDisabled = false;
-				if( add_target_bp(ent.addr) )
-				{
-					printf("Breakpoint %i at 0x%04x: file %s, line %i.\n",
-						   ent.id,
-						   ent.addr,
-						   ls.file().c_str(),
-						   ls.line() );
-					bplist.push_back(ent);
-					return ent.id;
-				}
-				break;
+				add_entry( ent );
+				printf("Breakpoint %i at 0x%04x: file %s, line %i.\n",
+					   ent.id,
+					   ent.addr,
+					   ls.file().c_str(),
+					   ls.line() );
+				return ent.id;
 			default:
 				return BP_ID_INVALID;	// invalid linespec
 		}
@@ -344,56 +448,48 @@ BP_ID BreakpointMgr::set_breakpoint( string cmd, bool temporary )
  */
 void BreakpointMgr::stopped( ADDR addr )
 {
-	// scan for matching address in breakpoint list.
-	BP_LIST::iterator it;
-
-	for( it=bplist.begin(); it!=bplist.end(); ++it)
+	// callers often report the same stop twice, keep the first hit
+	if( addr!=cur_addr )
+		stop_id = BP_ID_INVALID;
+	cur_addr = addr;
+	if( count_at( addr ).all==0 )
+		return;
+
+	pair<ADDR_INDEX::iterator,ADDR_INDEX::iterator> r;
+	r = by_addr.equal_range( addr );
+	vector<BP_LIST::iterator> temps;
+	for( ADDR_INDEX::iterator a=r.first; a!=r.second; ++a )
 	{
-		if( (*it).addr == addr )
-		{
-			// inform user we stopped on a breakpoint
-			cout <<"Stopped on breakpoint #"<<(*it).id<<endl;
-			if( (*it).bTemp )
-			{
-				// remove temporary breakpoints
-				bplist.erase(it);
-				it = bplist.begin();		// safer, we start again after deleting an object, slow but reliable
-				del_target_bp(addr);
-			}
-		}
+		// inform user we stopped on a breakpoint
+		stop_id = a->second->id;
+		if( mSession->output_mode()==DbgSession::OUT_CLI )
+			cout <<"Stopped on breakpoint #"<<stop_id<<endl;
+		if( a->second->bTemp )
+			temps.push_back( a->second );
 	}
+	// remove temporary breakpoints, the target copy goes at the next
+	// sync_target()
+	for( size_t i=0; i<temps.size(); i++ )
+		erase_entry( temps[i] );
 }
 
 
 bool BreakpointMgr::clear_breakpoint_id( BP_ID id  )
 {
-	BP_LIST::iterator it;
-	for( it=bplist.begin(); it!=bplist.end(); ++it)
-	{
-		if( (*it).id==id)
-		{
-			ADDR addr = (*it).addr;
-			bplist.erase(it);
-			del_target_bp(addr);
-			return true;
-		}
-	}
-	return false;
+	BP_LIST::iterator it = find_id( id );
+	if( it==bplist.end() )
+		return false;
+	erase_entry( it );
+	return true;
 }
 
 bool BreakpointMgr::clear_breakpoint_addr( ADDR addr )
 {
-	BP_LIST::iterator it;
-	for( it=bplist.begin(); it!=bplist.end(); ++it)
-	{
-		if( (*it).addr==addr )
-		{
-			bplist.erase(it);
-			del_target_bp(addr);
-			return true;
-		}
-	}
-	return false;
+	ADDR_INDEX::iterator it = by_addr.find( addr );
+	if( it==by_addr.end() )
+		return false;
+	erase_entry( it->second );
+	return true;
 }
 
 bool BreakpointMgr::clear_breakpoint( string cmd )
@@ -430,87 +526,66 @@ string BreakpointMgr::current_file()
 
 bool BreakpointMgr::enable_bp( BP_ID id )
 {
-	BP_LIST::iterator it;
-	for( it=bplist.begin(); it!=bplist.end(); ++it)
-	{
-		if( (*it).id==id )
-		{
-			if( add_target_bp( (*it).addr ) )
-			{
-				(*it).bDisabled = false;
-				return true;
-			}
-			else
-			{
-				return false;
-			}
-		}
-	}
-	return false;
+	BP_LIST::iterator it = find_id( id );
+	if( it==bplist.end() )
+		return false;
+	set_disabled( it, false );
+	return true;
 }
 
 bool BreakpointMgr::disable_bp( BP_ID id )
 {
-	BP_LIST::iterator it;
-	for( it=bplist.begin(); it!=bplist.end(); ++it)
-	{
-		if( (*it).id==id )
-		{
-			(*it).bDisabled = true;
-			return del_target_bp( (*it).addr );
-		}
-	}
-	return false;
+	BP_LIST::iterator it = find_id( id );
+	if( it==bplist.end() )
+		return false;
+	set_disabled( it, true );
+	return true;
 }
 
 
 bool BreakpointMgr::active_bp_at( ADDR addr )
 {
-	BP_LIST::iterator it;
-	for( it=bplist.begin(); it!=bplist.end(); ++it)
-	{
-		if(	(*it).addr==addr && 
-			!(*it).bDisabled )
-			return true;
-	}
-	return false;	// no breakpoint at the specified address.
+	return count_at( addr ).enabled>0;
 }
 
-// for this to work the bplist entry must be added after this call.
-bool BreakpointMgr::add_target_bp( ADDR addr )
+bool BreakpointMgr::add_step_bp( ADDR addr )
 {
-	if( !active_bp_at(addr) )
-	{
-		return mSession->target()->add_breakpoint(addr);
-	}
-	printf("BP already active at this address\n");
-	return true;	// already a bp at this address in target.
+	if( find( step_bps.begin(), step_bps.end(), addr )!=step_bps.end() ||
+		active_bp_at(addr) )
+		return true;	// already stopping there
+	if( step_bps.size() >= mSession->target()->max_breakpoints() )
+		return false;
+	step_bps.push_back( addr );
+	return true;
 }
 
-// for this to work the bplist entry must be removed before this 
-// function is called.
-bool BreakpointMgr::del_target_bp( ADDR addr )
+
+void BreakpointMgr::clear_step_bps()
 {
-	if( !active_bp_at(addr) )
-	{
-		return mSession->target()->del_breakpoint(addr);
-	}
-	return true;	// already a bp at this address in target.
+	// left in the target until the next sync_target() in case the next
+	// run wants the same addresses
+	step_bps.clear();
 }
 
 
+int BreakpointMgr::free_bps()
+{
+	int used = active_addrs;
+	list<ADDR>::iterator it;
+	for( it=step_bps.begin(); it!=step_bps.end(); ++it )
+		if( !active_bp_at( *it ) )
+			used++;
+	int n = mSession->target()->max_breakpoints() - used;
+	return n>0 ? n : 0;
+}
+
 
 bool BreakpointMgr::get_bp_file_line( BP_ID id, string &file, int &line )
 {
-	BP_LIST::iterator it;
-	for( it=bplist.begin(); it!=bplist.end(); ++it)
-	{
-		if( (*it).id==id )
-		{
-			file = (*it).file;
-			line = (*it).line;
-			return true;
-		}
-	}
-	return false;
+	BP_LIST::iterator it = find_id( id );
+	if( it==bplist.end() )
+		return false;
+	file = it->file;
+	line = it->line;
+	return true;
 }
@@ -20,6 +20,9 @@
 #ifndef BREAKPOINTMGR_H
 #define BREAKPOINTMGR_H
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 #include "types.h"
 #include "dbgsession.h"
 using namespace std;
@@ -29,6 +32,16 @@ Manager class for breakpoints
 handles temporary and normal breakpoints
 supports emulator limits such as limited number of hardware breakpoints etc
 
+The full breakpoint set is kept here, setting and clearing breakpoints
+doesn't touch the target.  sync_target() is called before each run and only
+loads or removes the addresses that differ from what the target already
+holds.  When there are more breakpoints than the target can hold the most
+relevant are loaded and the rest take turns on later runs.
+
+The list is indexed by id and by address, with a count of breakpoints at
+each code address, so the checks made on every stop and every step don't
+search it.
+
 	@author Ricky White <ricky@localhost.localdomain>
 */
 class BreakpointMgr
@@ -62,14 +75,36 @@ public:
 	*/
 	void clear_all();
 	
-	/** clear all breakpoints in the target then reload from our copy.
+	/** Forget what the target holds, eg after a reset.
+		The breakpoints are reloaded by the next sync_target().
 	*/
 	void reload_all();
 	
+	/** Move each breakpoint set on a file:line to the address that line
+		has now, after the symbols were reloaded.  Breakpoints on lines left
+		without code are disabled, those set on an address stay where they
+		are.  What the target holds is forgotten as with reload_all().
+	*/
+	void remap();
+	
+	/** Bring the target's breakpoints into line with ours.
+		Call before every run of the target.  Only the difference from the
+		last sync is written.  Step breakpoints are always loaded, then
+		temporary breakpoints, then those in the function we are stopped
+		in, with any spare slots shared between the rest in turn.
+	*/
+	void sync_target();
+	
 	/** Dump a list of all breakpoints to the console
 	*/
 	void dump();
 	
+	/** Describe one breakpoint as a GDB/MI bkpt={...} tuple, as the
+		result of -break-insert.
+		\returns the tuple, "" if there is no breakpoint id.
+	*/
+	string mi_bkpt( BP_ID id );
+	
 	BP_ID set_breakpoint( string cmd, bool temporary=false );
 	bool clear_breakpoint( string cmd );
 	bool clear_breakpoint_id( BP_ID id  );
@@ -87,6 +122,11 @@ public:
 	string current_file();
 	
 	ADDR	current_addr()	{ return cur_addr; }
+	
+	/** \returns the id of the breakpoint the target last stopped on or
+		BP_ID_INVALID if the last stop wasn't at a breakpoint.
+	*/
+	BP_ID	stopped_bp()	{ return stop_id; }
 
 	/** Returns true if there is a currently active breakpoint at the specified
 		address.  Mainly for use internally to ensure the only 1 active bp in
@@ -108,6 +148,24 @@ public:
 	*/
 	bool get_bp_file_line( BP_ID id, string &file, int &line );
 	
+	/** Add a breakpoint used internally while stepping.
+		Step breakpoints aren't listed or reported when hit, they all stay
+		in the target until clear_step_bps().
+		\param addr	Address to stop at
+		\returns true if the target will stop at addr, false if there is no
+				room left for it.
+	*/
+	bool add_step_bp( ADDR addr );
+	
+	/** Remove every breakpoint added by add_step_bp(), leaving any user
+		breakpoints at the same addresses in place.
+	*/
+	void clear_step_bps();
+	
+	/** \returns the number of further addresses the target can break on.
+	*/
+	int free_bps();
+	
 protected:
 	DbgSession *mSession;
 	typedef struct
@@ -122,12 +180,34 @@ protected:
 	} BP_ENTRY;
 	typedef list<BP_ENTRY> BP_LIST;
 	BP_LIST	bplist;
+	typedef map<BP_ID,BP_LIST::iterator> ID_INDEX;
+	ID_INDEX		by_id;			///< every entry in bplist keyed by id
+	typedef multimap<ADDR,BP_LIST::iterator> ADDR_INDEX;
+	ADDR_INDEX		by_addr;		///< every entry in bplist keyed by address, in the order set
+	typedef struct
+	{
+		uint16_t	all;			///< breakpoints at the address
+		uint16_t	enabled;		///< those of them not disabled
+	} ADDR_COUNT;
+	vector<ADDR_COUNT>		code_count;	///< indexed by code address
+	map<ADDR,ADDR_COUNT>	far_count;	///< any addresses outside code space
+	int				active_addrs;	///< addresses with an enabled breakpoint
+	set<BP_ID>		free_ids;		///< unused ids below id_top
+	BP_ID			id_top;			///< lowest id never used
 	ADDR			cur_addr;		///< address we last stopped at,  this reflects the address we are currently at at any point where we are stopped
+	list<ADDR>		step_bps;		///< addresses from add_step_bp()
+	BP_ID			stop_id;		///< breakpoint reported by stopped()
+	list<ADDR>		loaded;			///< addresses currently set in the target
+	unsigned int	rotate;			///< next of the left over breakpoints to load
 	
 	int next_id();
-
-	bool add_target_bp( ADDR addr );
-	bool del_target_bp( ADDR addr );
+	BP_ID add_entry( BP_ENTRY &ent );
+	void erase_entry( BP_LIST::iterator it );
+	void set_disabled( BP_LIST::iterator it, bool disabled );
+	void move_entry( BP_LIST::iterator it, ADDR addr );
+	BP_LIST::iterator find_id( BP_ID id );
+	ADDR_COUNT &count_at( ADDR addr );
+	void count( ADDR addr, int all, int enabled );
 };
 
 
@@ -21,17 +21,72 @@
 #include <iostream>
 #include <fstream>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <algorithm>
+#include <set>
 #include <sstream>
 #include <string>
 #include "cdbfile.h"
 #include "symbol.h"
 #include "symtypetree.h"
 #include "module.h"
+#include "symcache.h"
+#include "breakpointmgr.h"
 using namespace std;
 
+/// files smaller than this aren't worth starting threads for
+#define CDB_PARALLEL_MIN	(64*1024)
+
+int CdbFile::load_threads = 1;
+bool CdbFile::use_cache = true;
+bool CdbFile::share_symbols = false;
+
 //#define MIN(a,b)	a<?b
 #define MIN(a,b)	(((a)<(b)) ? a : b)
 
+#define FNV_INIT	2166136261u
+
+/// FNV-1a hash of n bytes, continuing from h
+static uint32_t fnv( uint32_t h, const char *p, size_t n )
+{
+	while( n-- )
+		h = ( h ^ (uint8_t)*p++ ) * 16777619u;
+	return h;
+}
+
+/** Map a whole file read only.
+	\param[out] size	size of the file
+	\returns the mapping, 0 if the file is empty or MAP_FAILED if it
+			 couldn't be opened or mapped, the reason is printed.
+*/
+static const char *map_file( const string &filename, size_t &size )
+{
+	struct stat st;
+	const char *map = 0;
+	int fd = ::open( filename.c_str(), O_RDONLY );
+	if( fd<0 || fstat( fd, &st )!=0 )
+	{
+		if( fd>=0 )
+			::close( fd );
+		cout << "ERROR coulden't open file '"<<filename.c_str()<<"'."<<endl;
+		return (const char*)MAP_FAILED;
+	}
+	size = st.st_size;
+	if( size>0 )
+	{
+		map = (const char*)mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if( map==MAP_FAILED )
+			cout << "ERROR coulden't map file '"<<filename.c_str()<<"'."<<endl;
+	}
+	::close( fd );
+	return map;
+}
+
 
 CdbFile::CdbFile( DbgSession *session )
 	: mSession(session)
@@ -43,38 +98,383 @@ CdbFile::~CdbFile()
 {
 }
 
+/** Load a cdb file.
+	If another session in the process has the file loaded and sharing is
+	enabled its symbols are copied, otherwise if there is an up to date
+	symbol cache for the file it is used instead, otherwise the file is
+	parsed and a new cache written.
+	The file is mapped rather than read so records are split in place, only
+	the record being parsed is copied out.
+*/
 bool CdbFile::open( string filename )
 {
+	const char *map;
+	size_t len = 0;
+	SymCache cache( mSession );
+	
 	cout << "Loading "<<filename<<endl;
+	SymCache::release( mSession );		// whatever it had loaded is going
+	if( share_symbols && cache.load_shared( filename ) )
+		cout << "Loaded symbols shared with another session"<<endl;
+	else if( use_cache && cache.load( filename ) )
+	{
+		cout << "Loaded symbols from cache"<<endl;
+		if( share_symbols )
+			cache.publish( filename );
+	}
+	else
+	{
+		map = map_file( filename, len );
+		if( map==MAP_FAILED )
+		{
+			SymCache::release( mSession );	// sessions waiting on us try themselves
+			return false;	// failed to open file
+		}
+		if( load_threads>1 && len>=CDB_PARALLEL_MIN )
+			parse_parallel( map, len, load_threads );
+		else
+			parse_buffer( map, len );
+		mSession->symtab()->build_index();
+		stamp_modules( filename, map, len );
+		if( map )
+			munmap( (void*)map, len );
+		if( use_cache )
+			cache.save( filename );
+		if( share_symbols )
+			cache.publish( filename );
+		//cout << "module dump:"<<endl;
+		//mSession->modulemgr()->dump();
+		return true;
+	}
+	// loaded without parsing, the file is still needed for reload()
+	map = map_file( filename, len );
+	if( map!=MAP_FAILED )
+	{
+		stamp_modules( filename, map, len );
+		if( map )
+			munmap( (void*)map, len );
+	}
+	return true;
+}
+
+bool CdbFile::reload( string filename )
+{
+	ModuleMgr *mods = mSession->modulemgr();
+	ModuleMgr::STAMP_MAP &old = mods->stamps();
+	ModuleMgr::STAMP_MAP::iterator sit;
+	MODULE_HASHES now;
+	MODULE_HASHES::iterator it;
+	set<string> changed;
+	set<string>::iterator cit;
+	const char *map, *p, *end, *eol;
+	size_t len = 0, n;
+	string line, module;
 	
-	ifstream in;
-	string line;
-	int i=0;
+	if( filename.empty() || filename!=mods->loaded_from() )
+		return false;
+	map = map_file( filename, len );
+	if( map==MAP_FAILED )
+		return false;
+	
+	// a module changed if its records did or any of its sources
+	hash_modules( map, len, now );
+	for( sit=old.begin(); sit!=old.end(); ++sit )
+	{
+		it = now.find( sit->first );
+		if( it==now.end() || it->second!=sit->second.records ||
+			source_stamp( sit->first )!=sit->second.sources )
+			changed.insert( sit->first );
+	}
+	for( it=now.begin(); it!=now.end(); ++it )
+		if( old.find( it->first )==old.end() )
+			changed.insert( it->first );
+	cout << "Reloading "<<filename<<", "<<changed.size()<<" of "
+		 <<now.size()<<" modules changed"<<endl;
+	if( changed.empty() )
+	{
+		if( map )
+			munmap( (void*)map, len );
+		return true;
+	}
+	
+	SymCache cache( mSession );
+	SymCache::release( mSession );
+	for( cit=changed.begin(); cit!=changed.end(); ++cit )
+	{
+		if( cit->empty() )
+			continue;
+		mSession->symtab()->remove_lines( *cit );
+		mods->del_module( *cit );
+	}
+	mSession->symtab()->clear_symbols();
+	mSession->symtree()->clear();
+	
+	// every record again except the line records of the modules kept
+	for( p=map, end=map+len; p<end; p=eol+1 )
+	{
+		eol = (const char*)memchr( p, '\n', end-p );
+		if( !eol )
+			eol = end;
+		n = eol-p;
+		if( n>0 && p[n-1]=='\r' )
+			n--;
+		if( n<2 || p[1]!=':' ||
+			( line_record_module( p, n, module ) && !changed.count( module ) ) )
+			continue;
+		line.assign( p, n );
+		parse_record( line );
+	}
+	mSession->symtab()->build_index();
+	stamp_modules( filename, map, len );
+	if( map )
+		munmap( (void*)map, len );
+	if( use_cache )
+		cache.save( filename );
+	if( share_symbols )
+		cache.publish( filename );
+	mSession->bpmgr()->remap();
+	return true;
+}
+
+/** Get the module a linker C or assembly line record belongs to.
+	\returns true if rec is a line record, false for any other record.
+*/
+bool CdbFile::line_record_module( const char *rec, size_t len, string &module )
+{
+	const char *name = rec+4, *end;
+	if( len<5 || rec[0]!='L' || rec[1]!=':' ||
+		( rec[2]!='A' && rec[2]!='C' ) || rec[3]!='$' )
+		return false;
+	end = (const char*)memchr( name, '$', rec+len-name );
+	if( !end )
+		return false;
+	module.assign( name, end-name );
+	if( rec[2]=='C' && module.length()>=2 )
+		module.erase( module.length()-2 );	// less ".c" as add_c_file_entry()
+	return true;
+}
+
+/** Hash the records of each module: its M: record and the records up to
+	the next one, with the module's line records wherever they are.  Other
+	linker records and any records before the first M: come under "".
+*/
+void CdbFile::hash_modules( const char *buf, size_t len, MODULE_HASHES &mods )
+{
+	const char *p, *end, *eol;
+	size_t n;
+	string module, line_module;
+	const string none;
+	const string *owner;
+	MODULE_HASHES::iterator it = mods.end();
+	
+	mods.clear();
+	for( p=buf, end=buf+len; p<end; p=eol+1 )
+	{
+		eol = (const char*)memchr( p, '\n', end-p );
+		if( !eol )
+			eol = end;
+		n = eol-p;
+		if( n>0 && p[n-1]=='\r' )
+			n--;
+		if( n<2 || p[1]!=':' )
+			continue;
+		if( p[0]=='M' )
+			module.assign( p+2, n-2 );
+		if( line_record_module( p, n, line_module ) )
+			owner = &line_module;
+		else
+			owner = p[0]=='L' ? &none : &module;
+		// records of a module mostly come together
+		if( it==mods.end() || it->first!=*owner )
+			it = mods.insert( make_pair( *owner, uint32_t(FNV_INIT) ) ).first;
+		it->second = fnv( fnv( it->second, p, n ), "\n", 1 );
+	}
+}
+
+/** Remember what each module was loaded from, for reload().
+	Call once the modules have been loaded from buf.
+*/
+void CdbFile::stamp_modules( const string &filename, const char *buf,
+							 size_t len )
+{
+	ModuleMgr *mods = mSession->modulemgr();
+	MODULE_HASHES hashes;
+	MODULE_HASHES::iterator it;
 	
-	in.open( filename.c_str() );
-	if( in.is_open() )
+	hash_modules( buf, len, hashes );
+	mods->stamps().clear();
+	for( it=hashes.begin(); it!=hashes.end(); ++it )
 	{
-		while( !in.eof() )
+		ModuleMgr::LOAD_STAMP &st = mods->stamps()[it->first];
+		st.records = it->second;
+		st.sources = source_stamp( it->first );
+	}
+	mods->loaded_from() = filename;
+}
+
+/** \returns a hash of the size and modification time of the source files
+	of a module.
+*/
+uint32_t CdbFile::source_stamp( const string &module )
+{
+	Module *m = mSession->modulemgr()->find_module( module );
+	uint32_t h = FNV_INIT, v[2];
+	struct stat st;
+	if( !m )
+		return h;
+	const string *paths[2] = { &m->get_c_file_path(), &m->get_asm_file_path() };
+	for( int i=0; i<2; i++ )
+	{
+		v[0] = v[1] = 0;
+		if( !paths[i]->empty() && stat( paths[i]->c_str(), &st )==0 )
 		{
-			getline( in, line );
-			//cout <<"Line "<<i<<" : "<<line<<endl;
+			v[0] = st.st_size;
+			v[1] = st.st_mtime;
+		}
+		h = fnv( h, (const char*)v, sizeof(v) );
+	}
+	return h;
+}
+
+void CdbFile::parse_buffer( const char *buf, size_t len )
+{
+	const char *p = buf, *end = buf+len, *eol;
+	size_t n;
+	string line;	// reused so its storage is only allocated once
+	
+	while( p<end )
+	{
+		eol = (const char*)memchr( p, '\n', end-p );
+		if( !eol )
+			eol = end;
+		n = eol-p;
+		if( n>0 && p[n-1]=='\r' )
+			n--;
+		if( n>=2 && p[1]==':' )
+		{
+			line.assign( p, n );
 			parse_record( line );
-		//	m_symtab->dump();
-			i++;
 		}
-		in.close();
+		p = eol+1;
 	}
-	else
+}
+
+void CdbFile::set_load_threads( int n )
+{
+	load_threads = n<1 ? 1 : n;
+}
+
+void CdbFile::set_use_cache( bool enable )
+{
+	use_cache = enable;
+}
+
+void CdbFile::set_share_symbols( bool enable )
+{
+	share_symbols = enable;
+}
+
+/** Split [p,end) into records, parsing the line records as we go.
+	Everything else is left as a slice of the buffer for the merge.
+*/
+void CdbFile::split_records( const char *p, const char *end, RECORD_LIST &recs )
+{
+	const char *eol;
+	size_t n;
+	string line;
+	PARSED_RECORD r;
+	
+	while( p<end )
 	{
-		cout << "ERROR coulden't open file '"<<filename.c_str()<<"'."<<endl;
-		return false;	// failed to open file
+		eol = (const char*)memchr( p, '\n', end-p );
+		if( !eol )
+			eol = end;
+		n = eol-p;
+		if( n>0 && p[n-1]=='\r' )
+			n--;
+		if( n>3 && p[0]=='L' && p[1]==':' && (p[2]=='A' || p[2]=='C') )
+		{
+			line.assign( p, n );
+			if( parse_line_record( line, r ) )
+				recs.push_back( r );
+		}
+		else if( n>=2 && p[1]==':' )
+		{
+			recs.push_back( PARSED_RECORD() );
+			recs.back().kind = 0;
+			recs.back().rec = p;
+			recs.back().len = n;
+		}
+		p = eol+1;
+	}
+}
+
+typedef struct
+{
+	const char				*start;
+	const char				*end;
+	CdbFile::RECORD_LIST	recs;
+} PARSE_CHUNK;
+
+void *CdbFile::parse_chunk( void *arg )
+{
+	PARSE_CHUNK *c = (PARSE_CHUNK*)arg;
+	split_records( c->start, c->end, c->recs );
+	return 0;
+}
+
+/** Parse a buffer using several threads.
+	The buffer is cut into one chunk per thread at record boundaries and the
+	chunks are split and pre-parsed concurrently.  The records are then
+	applied to the symbol table, type tree and modules one chunk at a time in
+	file order, so the result is the same as parse_buffer().
+*/
+void CdbFile::parse_parallel( const char *buf, size_t len, int threads )
+{
+	vector<PARSE_CHUNK> chunks( threads );
+	vector<pthread_t> tid( threads );
+	vector<bool> started( threads, false );
+	const char *p = buf, *end = buf+len, *eol;
+	int i;
+	
+	for( i=0; i<threads; i++ )
+	{
+		chunks[i].start = p;
+		p = (i==threads-1) ? end : min( end, p+len/threads );
+		if( p<end )
+		{
+			eol = (const char*)memchr( p, '\n', end-p );
+			p = eol ? eol+1 : end;
+		}
+		chunks[i].end = p;
+	}
+	for( i=0; i<threads; i++ )
+		started[i] = pthread_create( &tid[i], 0, parse_chunk, &chunks[i] )==0;
+	
+	string line;
+	for( i=0; i<threads; i++ )
+	{
+		if( started[i] )
+			pthread_join( tid[i], 0 );
+		else
+			parse_chunk( &chunks[i] );
+		
+		RECORD_LIST &recs = chunks[i].recs;
+		for( RECORD_LIST::iterator it=recs.begin(); it!=recs.end(); ++it )
+		{
+			if( it->kind )
+				add_line_record( *it );
+			else
+			{
+				line.assign( it->rec, it->len );
+				parse_record( line );
+			}
+		}
+		recs.clear();
 	}
-	//cout << "module dump:"<<endl;
-	//mSession->modulemgr()->dump();
-	return true;
 }
 
-bool CdbFile::parse_record( string line )
+bool CdbFile::parse_record( const string &line )
 {
 	int pos=0, npos=0;
 
@@ -99,10 +499,10 @@ bool CdbFile::parse_record( string line )
 			parse_scope_name( line, sym, pos );
 			pos++;
 			npos = line.find('$',pos);
-			sym.setLevel( strtoul( line.substr( pos, npos-pos ).c_str(),0,16) );
+			sym.setLevel( strtoul( line.c_str()+pos, 0, 16 ) );
 			pos = npos+1;
 			npos = line.find('(',pos);
-			sym.setBlock( strtoul( line.substr( pos, npos-pos ).c_str(),0,16) );
+			sym.setBlock( strtoul( line.c_str()+pos, 0, 16 ) );
 			pos = npos;
 //			cout <<"level="<<sym.level()<<", block="<<sym.block()<<endl;
 //			cout <<"at pos = "<<line[pos]<<endl;
@@ -130,12 +530,12 @@ bool CdbFile::parse_record( string line )
 			pos = npos;		//','
 			pos++;
 			npos = line.find(',',pos);
-			pSym->set_interrupt_num( strtoul( line.substr(pos,npos-pos).c_str(),0,10 ) );
+			pSym->set_interrupt_num( strtoul( line.c_str()+pos, 0, 10 ) );
 //			cout <<"Interrupt number = "<<sym.interrupt_num()<<endl;
 			pos = npos;		//','
 			pos++;
 			npos = line.length();
-			pSym->set_reg_bank( strtoul( line.substr(pos,npos-pos).c_str(),0,10 ) );
+			pSym->set_reg_bank( strtoul( line.c_str()+pos, 0, 10 ) );
 //			cout <<"register bank = "<<sym.reg_bank()<<endl;
 			pSym->setIsFunction( true );
 			pSym->setFile( cur_module+".c" );
@@ -146,17 +546,15 @@ bool CdbFile::parse_record( string line )
 			// <$><Name><$><Level><$><Block><(><TypeRecord><)>
 			// <,><AddressSpace><,><OnStack><,><Stack><,><[><Reg><,>{<Reg><,>}<]> 
 			pos++;	// skip ':'
-			cout <<"%1%";
 			parse_scope_name( line, sym, pos );
-			cout <<"%2%";
 			pos++;
 			npos = line.find('$',pos);
 //			cout <<"level["<<line.substr( pos, npos-pos )<<"]"<<endl;
-			sym.setLevel( strtoul( line.substr( pos, npos-pos ).c_str(),0,16) );
+			sym.setLevel( strtoul( line.c_str()+pos, 0, 16 ) );
 			pos = npos+1;
 			npos = line.find('(',pos);
 //			cout <<"block["<<line.substr( pos, npos-pos )<<"]"<<endl;
-			sym.setBlock( strtoul( line.substr( pos, npos-pos ).c_str(),0,16) );
+			sym.setBlock( strtoul( line.c_str()+pos, 0, 16 ) );
 			pos = npos;
 //			cout <<"level="<<sym.level()<<", block="<<sym.block()<<endl;
 //			cout <<"at pos = "<<line[pos]<<endl;
@@ -165,15 +563,14 @@ bool CdbFile::parse_record( string line )
 			// check if it already exsists
 			pSym = mSession->symtab()->getSymbol( sym );
 			
-			cout <<"%3%";
 			parse_type_chain_record( line, *pSym, pos ); 
-			cout <<"%4%";
 			pos++;	// skip ','
 //			cout <<"["<<line.substr(pos)<<"]"<<endl;
 //			cout <<"addr space = "<<line[pos]<<endl;
 			pSym->setAddrSpace( line[pos] );
 			pos+=2;
 //			cout <<"on stack = "<<line[pos]<<endl;
+			pSym->setStack( line[pos]=='1', strtol( line.c_str()+pos+2, 0, 10 ) );
 			pos+=2;
 			npos = line.find(',',pos);
 //			cout <<"stack = "<<line.substr(pos,npos-pos)<<endl;
@@ -211,7 +608,7 @@ bool CdbFile::parse_record( string line )
 }
 
 
-int CdbFile::parse_type_chain_record( string s )
+int CdbFile::parse_type_chain_record( const string &s )
 {
 	int pos=0, npos=0;
 	cout << "parse_type_record( \""<<s<<"\" )"<<endl;
@@ -259,14 +656,18 @@ int CdbFile::parse_type_chain_record( string s )
 }
 
 
-bool CdbFile::parse_type_chain_record( string line, Symbol &sym, int &pos  )
+/** Take the size and function flag from a symbol's type chain and keep the
+	rest for Symbol::setTypeChain() to decode when the type is first needed.
+	\param pos		position just after the '(' of the chain, receives the
+					position after the closing ')'.
+*/
+bool CdbFile::parse_type_chain_record( const string &line, Symbol &sym, int &pos  )
 {
+	int start = pos-1;
 	int npos;
-	cout << "parse_type_chain_record( \""<<line<<"\", sym, "<<pos<<" )"<<endl;
 	int size;
-	char *endptr;
 	
-	pos = line.find('{',0)+1;
+	pos = line.find('{',pos)+1;
 	npos = line.find('}',pos);
 	istringstream m(line.substr(pos,npos-pos));
 	if( !(m >> size) )
@@ -274,97 +675,20 @@ bool CdbFile::parse_type_chain_record( string line, Symbol &sym, int &pos  )
 //	cout <<"size = "<<size<<endl;
 	sym.setLength(size);
 	
-	string DCLtype;
-	pos = npos + 1;
-	// loop through grabbing <DCLType> until we hit a ':'
-	int limit = line.find(':',pos);
-	
-	char type_char;
-	string type_name = "";
-	int cnt = 0;
-
-	// The last loop will be followed by a sign type if an integer type
+	// <DCLType>s up to the ':', only a function needs to be known now
+	int limit = line.find(':',npos);
+	if( limit==-1 || line[limit+2]!=')' )
+		return false;	// failure
 	while( npos < limit )
 	{
 		pos = npos + 1;
 		npos = line.find(',',pos);
-		npos = (npos>limit) ? limit : npos;
-		cout << "DCLTYPE = ["<<line.substr(pos,npos-pos)<<"]"<<endl;
-		
-		// which type and sign
-		if( line[pos]=='D' )
-		{
-			if(line[pos+1]=='F')
-			{
-				// enter function symbol declaration mode...
-				cout <<"FUNCTION :";
-				sym.setIsFunction(true);
-				// need to have a list of parameters and push then back or similar.
-				// a function symbol is a bit special
-				// also needs to set a retun type
-			}
-			else if( line[pos+1]=='A' )
-			{
-				cout << "================= ARRAY =================" << endl;
-				// DAxxx,
-				// where xxx is the number of elements
-				npos = line.find(',',pos+2);
-				if( npos==-1 )
-					cerr << "BAD CDB FILE format" << endl;
-				else
-				{
-					//cout << "substr = ["<<line.substr(pos+2,npos-pos-2)<<"]"<<endl;
-					int c = strtoul(line.substr(pos+2,npos-pos-2).c_str(),0,10);
-					sym.AddArrayDim(c);
-				}
-			}
-		} else if( line[pos]=='S' )
-		{
-			type_char = line[pos+1];
-			switch( line[pos+1] )
-			{
-				case 'T':	// typedef
-					//sym.setType(line.substr(pos+2,npos-pos));
-					type_name = line.substr(pos+2,npos-pos);
-					break;
-			}
-		}
-		cnt++;
+		npos = (npos==-1 || npos>limit) ? limit : npos;
+		if( line[pos]=='D' && line[pos+1]=='F' )
+			sym.setIsFunction(true);
 	}
-	if(line[npos++]!=':')
-		return false;	// failure
-	
-	bool issigned = line[npos]=='S';
-	switch(type_char)
-	{
-		case 'T':														break;
-		case 'C': type_name = issigned ? "char"	: "unsigned char";		break;
-		case 'S': type_name = issigned ? "short": "unsigned short";		break;
-		case 'I': type_name = issigned ? "int"	: "unsigned int";		break;
-		case 'L': type_name = issigned ? "long"	: "unsigned long";		break;
-		case 'F': type_name = "float";									break;
-		case 'V': type_name = "void";									break;
-		case 'X': type_name = "sbit";									break;
-		case 'B': type_name = "bitfield of n bits???";					break;
-		default:
-			cerr << "ERROR unhandled type" << endl;
-			assert(1==0);
-	}
-	
-	if( type_name!="" )
-	{
-		cout << type_name << endl;
-		if( sym.isFunction() )
-			sym.setReturn( type_name );
-		else
-			sym.setType( type_name );
-	}
-	
-	
-	npos++;
-	if(line[npos++]!=')')
-		return false;	// failure
-	pos = npos;
+	sym.setTypeChain( line.substr( start, limit+3-start ) );
+	pos = limit+3;
 //	cout <<"DONE DONE"<<endl;
 	return true;
 }
@@ -383,13 +707,14 @@ bool CdbFile::parse_type_chain_record( string line, Symbol &sym, int &pos  )
 	
 	
 */
-bool CdbFile::parse_linker( string line )
+bool CdbFile::parse_linker( const string &line )
 {
 //	cout <<"parsing linker record \""<<line<<"\""<<endl;
 	int pos,npos;
 	string filename;
 	Symbol sym(mSession), *pSym;
 	SymTab::SYMLIST::iterator it;
+	PARSED_RECORD lrec;
 
 	pos = 2;	
 	// <L><:>{ <G> | F<filename> | L<function> }<$><name>
@@ -417,54 +742,11 @@ bool CdbFile::parse_linker( string line )
 			
 			break;
 		case 'A':
-			// Linker assembly line record
-			// <L><:><A><$><Filename><$><Line><:><EndAddress>
-//			cout <<"Assembly line record"<<endl;
-			if( line[pos++]!='$' )
-				return false;
-			// grab the filename
-			npos = line.find('$',pos);
-			sym.setFile( line.substr(pos,npos-pos) );
-			pos = npos+1;
-			// line
-			npos = line.find(':',pos);
-			sym.setLine( strtoul(line.substr(pos,npos-pos).c_str(),0,10) );
-			pos = npos+1;
-			npos = line.length();
-			// @FIXME: there is some confusion over the end address / start address thing
-//			cout <<"??endaddr= ["<<line.substr(pos,npos-pos)<<"]"<<endl;
-			sym.setAddr( strtoul(line.substr(pos,npos-pos).c_str(),0,16) );
-			mSession->symtab()->add_asm_file_entry( sym.file(),
-													sym.line(),
-													sym.addr() );
-			break;
 		case 'C':
-			// Linker C record
-			// This isn't a symbol in the normal sense,  we will use a separate table for crecords as thaaea are line to c code mappings
-			// <L><:><C><$><Filename><$><Line><$><Level><$><Block><:><EndAddress>
-			if( line[pos++]!='$' )
+			// Linker assembly / C line record
+			if( !parse_line_record( line, lrec ) )
 				return false;
-			// grab the filename
-			npos = line.find('$',pos);
-			sym.setFile( line.substr(pos,npos-pos) );
-//			cout << "test filemane = "<<sym.file()<<endl;
-			pos = npos+1;
-			npos = line.find('$',pos);
-			sym.setLine( strtoul(line.substr(pos,npos-pos).c_str(),0,10) );
-			pos = npos+1;
-			parse_level_block_addr( line, sym, pos, true );
-			
-//			cout << "C linker record"<<endl;
-//			cout << "\tscope = "<<sym.scope()<<endl;
-//			cout << "\tname = "<<sym.name()<<endl;
-//			cout << "\tlevel = "<<sym.level()<<endl;
-//			cout << "\tblock = "<<sym.block()<<endl;
-			// @FIXME: need to handle block
-			mSession->symtab()->add_c_file_entry(sym.file(),
-												sym.line(),
-												sym.level(),
-												sym.block(),
-												sym.addr() );
+			add_line_record( lrec );
 			break;
 		case 'X':
 			// linker symbol end address record
@@ -496,29 +778,77 @@ bool CdbFile::parse_linker( string line )
 	return true;
 }
 
-bool CdbFile::parse_level_block_addr( string line, Symbol &sym, int &pos, bool bStartAddr )
+/** Parse a linker assembly or C line record.
+	This only touches r so it is safe to call from the loader threads.
+	<pre>
+	<L><:><A><$><Filename><$><Line><:><EndAddress>
+	<L><:><C><$><Filename><$><Line><$><Level><$><Block><:><EndAddress>
+	</pre>
+	\returns true on success, false if the record is malformed.
+*/
+bool CdbFile::parse_line_record( const string &line, PARSED_RECORD &r )
+{
+	int pos = 3, npos;
+	
+	r.kind = line[2];
+	if( line[pos++]!='$' )
+		return false;
+	// grab the filename
+	npos = line.find('$',pos);
+	r.file = line.substr(pos,npos-pos);
+	pos = npos+1;
+	r.line = strtoul( line.c_str()+pos, 0, 10 );
+	if( r.kind=='C' )
+	{
+		npos = line.find('$',pos);
+		pos = npos+1;
+		r.level = strtoul( line.c_str()+pos, 0, 10 );
+		npos = line.find('$',pos);
+		pos = npos+1;
+		r.block = strtoul( line.c_str()+pos, 0, 10 );
+	}
+	else
+		r.level = r.block = 0;
+	npos = line.find(':',pos);
+	pos = npos+1;
+	// @FIXME: there is some confusion over the end address / start address thing
+	r.addr = strtoul( line.c_str()+pos, 0, 16 );
+	return true;
+}
+
+void CdbFile::add_line_record( PARSED_RECORD &r )
+{
+	if( r.kind=='A' )
+		mSession->symtab()->add_asm_file_entry( r.file, r.line, r.addr );
+	else
+		// @FIXME: need to handle block
+		mSession->symtab()->add_c_file_entry( r.file, r.line, r.level,
+											  r.block, r.addr );
+}
+
+bool CdbFile::parse_level_block_addr( const string &line, Symbol &sym, int &pos, bool bStartAddr )
 {
 	int npos;
 	
 	// level
 	npos = line.find('$',pos);
-	sym.setLevel( strtoul(line.substr(pos,npos-pos).c_str(),0,10) );
+	sym.setLevel( strtoul( line.c_str()+pos, 0, 10 ) );
 	pos = npos+1;
 	// block
 	npos = line.find(':',pos);
-	sym.setBlock( strtoul(line.substr(pos,npos-pos).c_str(),0,10) );
+	sym.setBlock( strtoul( line.c_str()+pos, 0, 10 ) );
 	pos = npos+1;
 	npos = line.length();
 	
 	if( bStartAddr )
-		sym.setAddr( strtoul(line.substr(pos,npos-pos).c_str(),0,16) );
+		sym.setAddr( strtoul( line.c_str()+pos, 0, 16 ) );
 	else
-		sym.setEndAddr( strtoul(line.substr(pos,npos-pos).c_str(),0,16) );
+		sym.setEndAddr( strtoul( line.c_str()+pos, 0, 16 ) );
 	return line.length();
 }
 
 // parse { <G> | F<filename> | L<function> }<$><name> 
-bool CdbFile::parse_scope_name( string data, Symbol &sym, int &pos )
+bool CdbFile::parse_scope_name( const string &data, Symbol &sym, int &pos )
 {
 	int npos;
 //	cout <<"int CdbFile::parse_scope_name( "<<data<<", &sym, "<<pos<<" )"<<endl;
@@ -557,41 +887,72 @@ bool CdbFile::parse_scope_name( string data, Symbol &sym, int &pos )
 
 
 
+/** Split the file and name out of a type record.
+	\param spos	receives the position of the first member record.
+	\returns false if it isn't a T:F record.
+*/
+static bool type_record_name( const string &line, string &file, string &name,
+							  int &spos )
+{
+	int epos;
+	spos = 2;
+	if( line.compare(0,3,"T:F")!=0 )
+		return false;
+	spos++;
+	// pull out the file name
+	epos = line.find('$',spos);
+	if( epos==-1 )
+		return false;
+	file = line.substr(spos,epos-spos);
+	spos = epos+1;
+	epos = line.find('[',spos);
+	if( epos==-1 )
+		return false;
+	name = line.substr(spos,epos-spos);
+//	cout << "File = '"<<file<<"'"<<endl;
+//	cout << "Name = '"<<name<<"'"<<endl;
+	spos = epos+1;
+	return true;
+}
+
 /** Parse a type record and load into internal data structures.
+	Only the file and name are taken now, the record is kept by the type
+	tree and passed to decode_type() when the type is first looked up.
 	\param line string of the line from the file containing the type record.
 */
-bool CdbFile::parse_type( string line )
+bool CdbFile::parse_type( const string &line )
 {
-	cout << "Type record ["<<line<<"]"<<endl;
-	cout << "-----------------------------------------------------------"<<endl;
-	int epos, spos;
 	string file,name;
-	spos = 2;
-	epos = 2;
-	if(line[spos++]=='F')
+	int spos;
+	if( !type_record_name( line, file, name, spos ) )
+		return false;	// failure
+	mSession->symtree()->add_type_record( file, name, line );
+	return true;
+}
+
+/** Build the structure described by a type record.
+	\param line	the type record, as kept by parse_type().
+	\returns a type owned by the type tree, not yet added to it, or 0 if
+			the record can't be decoded.
+*/
+SymType *CdbFile::decode_type( const string &line )
+{
+//	cout << "Type record ["<<line<<"]"<<endl;
+	string file,name;
+	int spos;
+	if( !type_record_name( line, file, name, spos ) )
+		return 0;
+//	cout <<"line[spos] = '"<<line[spos]<<"'"<<endl;
+	
+	SymTypeStruct *t = mSession->symtree()->new_type<SymTypeStruct>();
+	t->set_name(name);
+	t->set_file(file);
+	while(line[spos]=='(')
 	{
-		// pull out the file name
-		epos = line.find('$',spos);
-		file = line.substr(spos,epos-spos);
-		spos = epos+1;
-		epos = line.find('[',spos);
-		name = line.substr(spos,epos-spos);
-		cout << "File = '"<<file<<"'"<<endl;
-		cout << "Name = '"<<name<<"'"<<endl;
-		spos = epos+1;
-		cout <<"line[spos] = '"<<line[spos]<<"'"<<endl;
-		
-		SymTypeStruct *t = new SymTypeStruct(mSession);
-		t->set_name(name);
-		t->set_file(file);
-		while(line[spos]=='(')
-		{
-			parse_type_member( line, spos, t );
-		}
-		mSession->symtree()->add_type(t);
+		if( !parse_type_member( line, spos, t ) )
+			break;
 	}
-	cout << "-----------------------------------------------------------"<<endl;
-	return false;	// failure
+	return t;
 }
 
 /** Parse a type member record that in s.
@@ -599,10 +960,10 @@ bool CdbFile::parse_type( string line )
 	\param spos start position in line of the type member to parse, received the position after the record on return
 	\returns success=true, failure = false
 */
-bool CdbFile::parse_type_member( string line, int &spos, SymTypeStruct *t  )
+bool CdbFile::parse_type_member( const string &line, int &spos, SymTypeStruct *t  )
 {
 	size_t epos;
-	cout <<"part line '"<<line.substr(spos)<<"'"<<endl;
+//	cout <<"part line '"<<line.substr(spos)<<"'"<<endl;
 	if( line[spos++]!='(' )
 		return false;
 	
@@ -615,8 +976,8 @@ bool CdbFile::parse_type_member( string line, int &spos, SymTypeStruct *t  )
 			return false;	// failure
 		
 		offset = strtoul(line.substr(spos,epos-spos).c_str(),0,0);
-		cout <<"offset = "<<offset<<endl;
-		cout << "spos = "<<spos<<", epos = "<<epos<<endl;
+//		cout <<"offset = "<<offset<<endl;
+//		cout << "spos = "<<spos<<", epos = "<<epos<<endl;
 		spos = epos+1;
 		
 		if(!parse_symbol_record( line, spos, t ))
@@ -632,13 +993,13 @@ bool CdbFile::parse_type_member( string line, int &spos, SymTypeStruct *t  )
 	Only called in the type parsing code
 	@TODO change the name of this function to reflect the above.
 */
-bool CdbFile::parse_symbol_record( string line, int &spos, SymTypeStruct *t  )
+bool CdbFile::parse_symbol_record( const string &line, int &spos, SymTypeStruct *t  )
 {
 	size_t epos, tmp[2];
 	Symbol sym(mSession);
 	string name;
 	
-	cout <<"^"<<line.substr(spos)<<"^"<<endl;
+//	cout <<"^"<<line.substr(spos)<<"^"<<endl;
 	if( line.substr(spos,2)!="S:" )
 	{
 		cout << "symbol start not found!"<<endl;
@@ -650,29 +1011,29 @@ bool CdbFile::parse_symbol_record( string line, int &spos, SymTypeStruct *t  )
 	switch( line[spos++] )
 	{
 		case 'G':			// Global scope
-			cout << "Scope = Global" << endl;
+//			cout << "Scope = Global" << endl;
 			break;
 		case 'F':			// File scope
 			epos = line.find('$',spos);
-			cout << "Scope = File '" << line.substr(spos,epos-spos) << "'" << endl;
+//			cout << "Scope = File '" << line.substr(spos,epos-spos) << "'" << endl;
 			break;
 		case 'L':			// Function scope
 			epos = line.find('$',spos);
-			cout << "Scope = Function '" << line.substr(spos,epos-spos) << "'" << endl;
+//			cout << "Scope = Function '" << line.substr(spos,epos-spos) << "'" << endl;
 			break;
 		case 'S':			// Symbol definition (part of type record)
 			spos++;
 			epos = line.find('$',spos);
-			cout << "Scope = type symbol record"<<endl;
+//			cout << "Scope = type symbol record"<<endl;
 			name = line.substr(spos,epos-spos);
-			cout <<"\tName = '"<<name<<"'"<<endl;
+//			cout <<"\tName = '"<<name<<"'"<<endl;
 			
 			spos = epos+1;
 			epos = line.find('$',spos);
-			cout <<"\tLevel = '"<<line.substr(spos,epos-spos)<<"'"<<endl;
+//			cout <<"\tLevel = '"<<line.substr(spos,epos-spos)<<"'"<<endl;
 			spos = epos+1;
 			epos = line.find('(',spos);
-			cout <<"\tBlock = '"<<line.substr(spos,epos-spos)<<"'"<<endl;
+//			cout <<"\tBlock = '"<<line.substr(spos,epos-spos)<<"'"<<endl;
 			
 		// ({2}SI:S)
 		// ({16}DA16,SC:S)
@@ -682,11 +1043,11 @@ bool CdbFile::parse_symbol_record( string line, int &spos, SymTypeStruct *t  )
 		// get size
 		spos = line.find('{',spos)+1;
 		epos = line.find('}',spos);
-		cout << "size = "<<line.substr(spos,epos-spos)<<endl;
+//		cout << "size = "<<line.substr(spos,epos-spos)<<endl;
 		spos = epos+1;
 		epos = line.find(')',spos);
 		
-		cout <<"interesting part='"<<line.substr(spos,epos-spos)<<"'"<<endl;
+//		cout <<"interesting part='"<<line.substr(spos,epos-spos)<<"'"<<endl;
 		
 		
 		parse_struct_member_dcl(line,spos,name,t);
@@ -700,15 +1061,15 @@ bool CdbFile::parse_symbol_record( string line, int &spos, SymTypeStruct *t  )
 		if(line[spos]!=',')
 				return false;
 			spos++;
-			cout << "Address space = '"<<line[spos]<<"'"<<endl;
+//			cout << "Address space = '"<<line[spos]<<"'"<<endl;
 			spos+=2;
-			cout << "On stack '"<<line[spos]<<"'"<<endl;
+//			cout << "On stack '"<<line[spos]<<"'"<<endl;
 			spos+=2;
 			tmp[0] = line.find(',',spos);
 			tmp[1] = line.find(')',spos);
 			//epos = tmp[0]<?tmp[1];
 			epos = MIN(tmp[0],tmp[1]);
-			cout << "Stack '"<<line.substr(spos,epos-spos)<<"'"<<endl;
+//			cout << "Stack '"<<line.substr(spos,epos-spos)<<"'"<<endl;
 			if(line[epos]!=')')
 			{
 				// now the registers...
@@ -719,7 +1080,7 @@ bool CdbFile::parse_symbol_record( string line, int &spos, SymTypeStruct *t  )
 					tmp[0] = line.find(',',spos);
 					tmp[1] = line.find(')',spos);
 					epos = MIN(tmp[0],tmp[1]);
-					cout << "Register '"<<line.substr(spos,epos-spos)<<"'";
+//					cout << "Register '"<<line.substr(spos,epos-spos)<<"'";
 					if(line[epos]==')')
 						break;	// done
 				}
@@ -737,9 +1098,9 @@ bool CdbFile::parse_symbol_record( string line, int &spos, SymTypeStruct *t  )
 /** Parse a DCL type record that is part of a struct member
 	updated the type with the information.
 */
-bool CdbFile::parse_struct_member_dcl( string line,
+bool CdbFile::parse_struct_member_dcl( const string &line,
 										 int &spos,
-										 std::string name,
+										 const std::string &name,
 										 SymTypeStruct *t )
 {
 	int epos;
@@ -757,16 +1118,16 @@ bool CdbFile::parse_struct_member_dcl( string line,
 		spos +=2;
 		epos = line.find(',',spos);
 		array_element_cnt = strtoul(line.substr(spos,epos-spos).c_str(),0,10);
-		cout << "Array of " << array_element_cnt << " elements" << endl;
+//		cout << "Array of " << array_element_cnt << " elements" << endl;
 		spos = epos+1;
 		epos = line.find(')',spos);
-		cout <<"***["<<line.substr(spos,epos-spos)<<"]****"<<endl;
+//		cout <<"***["<<line.substr(spos,epos-spos)<<"]****"<<endl;
 		s = line.substr(spos,2);
 		special = SP_ARRAY;
 	}
 	else if( s=="SB" )
 	{
-		cout << "Bit field of <n> bits" << endl;
+//		cout << "Bit field of <n> bits" << endl;
 		special = SP_BITFIELD;
 	}
 	else
@@ -776,44 +1137,42 @@ bool CdbFile::parse_struct_member_dcl( string line,
 	
 	if( s=="DF" )
 	{
-		cout << "Function" << endl;
+//		cout << "Function" << endl;
 	}
 	else if( s=="DG" )
 	{
-		cout << "Generic pointer" << endl;
+//		cout << "Generic pointer" << endl;
 	}
 	else if( s=="DC" )
 	{
-		cout << "Code pointer" << endl;
+//		cout << "Code pointer" << endl;
 	}
 	else if( s=="DX" )
 	{
-		cout << "External ram pointer" << endl;
+//		cout << "External ram pointer" << endl;
 	}
 	else if( s=="DD" )
 	{
-		cout << "Internal ram pointer" << endl;
+//		cout << "Internal ram pointer" << endl;
 	}
 	else if( s=="DP" )
 	{
-		cout << "Paged pointer" << endl;
+//		cout << "Paged pointer" << endl;
 	}
 	else if( s=="DI" )
 	{
-		cout << "Upper 128 byte pointer" << endl;
+//		cout << "Upper 128 byte pointer" << endl;
 	}
 	else if( s=="SL" )
 	{
-		cout << "long" << endl;
+//		cout << "long" << endl;
 		spos +=3;	 // skip "SL:"
 		if( line[spos]=='S' )
 		{
-			SymTypeLong *pt = new SymTypeLong(mSession);
 			t->add_member( name,"long", array_element_cnt );
 		}
 		else if( line[spos]=='U' )
 		{
-			SymTypeULong *pt = new SymTypeULong(mSession);
 			t->add_member( name,"unsigned long", array_element_cnt );
 		}
 		else
@@ -821,17 +1180,15 @@ bool CdbFile::parse_struct_member_dcl( string line,
 	}
 	else if( s=="SI" )
 	{
-		cout << "int" << endl;
+//		cout << "int" << endl;
 		spos +=3;	 // skip "SI:"
 		if( line[spos]=='S' )
 		{
-			SymTypeInt *pt = new SymTypeInt(mSession);
 			//t->add_member( name, pt, array_element_cnt );
 			t->add_member( name,"int", array_element_cnt );
 		}
 		else if( line[spos]=='U' )
 		{
-			SymTypeUInt *pt = new SymTypeUInt(mSession);
 			t->add_member( name,"unsigned int", array_element_cnt );
 		}
 		else
@@ -842,12 +1199,10 @@ bool CdbFile::parse_struct_member_dcl( string line,
 		spos +=3;	 // skip "SI:"
 		if( line[spos]=='S' )
 		{
-			SymTypeChar *pt = new SymTypeChar(mSession);
 			t->add_member( name,"char", array_element_cnt );
 		}
 		else if( line[spos]=='U' )
 		{
-			SymTypeUChar *pt = new SymTypeUChar(mSession);
 			t->add_member( name,"unsigned char", array_element_cnt );
 		}
 		else
@@ -858,13 +1213,11 @@ bool CdbFile::parse_struct_member_dcl( string line,
 		spos +=3;	 // skip "SI:"
 		if( line[spos]=='S' )
 		{
-			SymTypeShort *pt = new SymTypeShort(mSession);
 			//t->add_member( name, pt, array_element_cnt );
 			t->add_member( name,"short", array_element_cnt );
 		}
 		else if( line[spos]=='U' )
 		{
-			SymTypeUShort *pt = new SymTypeUShort(mSession);
 			//t->add_member( name, pt, array_element_cnt );
 			t->add_member( name,"unsigned short", array_element_cnt );
 		}
@@ -873,11 +1226,10 @@ bool CdbFile::parse_struct_member_dcl( string line,
 	}
 	else if( s=="SV" )
 	{
-		cout << "void" << endl;
+//		cout << "void" << endl;
 	}
 	else if( s=="SF" )
 	{
-		SymTypeFloat *pt = new SymTypeFloat(mSession);
 		//t->add_member( name, pt, array_element_cnt );
 		t->add_member( name,"float", array_element_cnt );
 	}
@@ -887,18 +1239,13 @@ bool CdbFile::parse_struct_member_dcl( string line,
 		spos += 2;	 // skip "ST"
 		epos = line.find(':',spos);
 		sname = line.substr(spos,epos-spos);
-		cout << "Structure named '" << name<<","<< sname<< "'" << endl;
-		SymTypeStruct *pt = new SymTypeStruct(mSession);
-		// FIXME this seems wrong.  shoulden't this just be a name to point to the nexct type?
-		
-		pt->set_name(sname);
+//		cout << "Structure named '" << name<<","<< sname<< "'" << endl;
 		//t->add_member( name, pt, array_element_cnt );
 		t->add_member( name,sname, array_element_cnt );
 	}
 	else if( s=="SX" )
 	{
-		cout << "sbit" << endl;
-		SymTypeSbit *pt = new SymTypeSbit(mSession);
+//		cout << "sbit" << endl;
 		//t->add_member( name, pt, array_element_cnt );
 		t->add_member( name,"sbit", array_element_cnt );
 	}
@@ -20,6 +20,8 @@
 #ifndef CDBFILE_H
 #define CDBFILE_H
 #include <string>
+#include <vector>
+#include <map>
 #include "symtab.h"
 #include "symtypetree.h"
 #include "dbgsession.h"
@@ -39,20 +41,85 @@ public:
     CdbFile( DbgSession *session );
     ~CdbFile();
 	bool open( string filename );
-	bool parse_record( string line );
+	
+	/** Load the cdb file the session already has loaded again, after a
+		rebuild.  Only the modules whose records or source files changed
+		have their line tables parsed again, the others and their source
+		line indexes are kept.  The symbol and type records, a small part of
+		the file, are all applied again.  Breakpoints set on a file:line are
+		moved to where that line is now (see BreakpointMgr::remap()).
+		\returns false if filename isn't the file last loaded or can't be
+				 read, nothing is changed and open() should be used instead.
+	*/
+	bool reload( string filename );
+	bool parse_record( const string &line );
+	SymType *decode_type( const string &line );
+	
+	/** Parse every record in a buffer holding the contents of a cdb file.
+		\param buf	start of the buffer, need not be null terminated
+		\param len	number of bytes in buf
+	*/
+	void parse_buffer( const char *buf, size_t len );
+	
+	/** Set the number of threads used to load cdb files.
+		1, the default, parses serially, more split large files into chunks
+		that are parsed concurrently then merged in file order.
+	*/
+	static void set_load_threads( int n );
+	
+	/** Enable or disable the binary symbol cache kept next to each cdb file
+		(see SymCache), enabled by default.
+	*/
+	static void set_use_cache( bool enable );
+	
+	/** Share loaded symbols between the sessions of a process (see
+		SymCache::publish()) so several sessions debugging the same firmware
+		only parse its cdb file once.  Disabled by default as a single
+		session would just be keeping a second copy.
+	*/
+	static void set_share_symbols( bool enable );
+	
+	/// A linker C or assembly line record, the bulk of most cdb files.
+	typedef struct
+	{
+		char		kind;		///< 'C' or 'A', 0 for any other record
+		string		file;
+		LINE_NUM	line;
+		int			level;
+		int			block;
+		uint32_t	addr;
+		const char	*rec;		///< other records, parsed during the merge
+		size_t		len;
+	} PARSED_RECORD;
+	typedef std::vector<PARSED_RECORD> RECORD_LIST;
 	
 protected:
-	int		parse_type_chain_record( string line );
-	bool	parse_type_chain_record( string line, Symbol &sym, int &pos  );
-	bool	parse_linker( string line );
-	bool	parse_level_block_addr( string line, Symbol &sym, int &pos, bool bStartAddr=true );
-	bool	parse_scope_name( string data, Symbol &sym, int &pos );
-	bool	parse_type( string line );
-	bool	parse_type_member( string line, int &spos, SymTypeStruct *t  );
-	bool	parse_symbol_record( string line, int &spos, SymTypeStruct *t  );
-	bool	parse_struct_member_dcl( string line,
+	static int	load_threads;
+	static bool	use_cache;
+	static bool	share_symbols;
+	static bool	parse_line_record( const string &line, PARSED_RECORD &r );
+	static void	split_records( const char *p, const char *end, RECORD_LIST &recs );
+	static void	*parse_chunk( void *arg );
+	
+	/// hash of the records of each module, keyed by module name
+	typedef std::map<string,uint32_t> MODULE_HASHES;
+	static bool	line_record_module( const char *rec, size_t len, string &module );
+	static void	hash_modules( const char *buf, size_t len, MODULE_HASHES &mods );
+	void	stamp_modules( const string &filename, const char *buf, size_t len );
+	uint32_t source_stamp( const string &module );
+	void	add_line_record( PARSED_RECORD &r );
+	void	parse_parallel( const char *buf, size_t len, int threads );
+	int		parse_type_chain_record( const string &line );
+	bool	parse_type_chain_record( const string &line, Symbol &sym, int &pos  );
+	bool	parse_linker( const string &line );
+	bool	parse_level_block_addr( const string &line, Symbol &sym, int &pos, bool bStartAddr=true );
+	bool	parse_scope_name( const string &data, Symbol &sym, int &pos );
+	bool	parse_type( const string &line );
+	bool	parse_type_member( const string &line, int &spos, SymTypeStruct *t  );
+	bool	parse_symbol_record( const string &line, int &spos, SymTypeStruct *t  );
+	bool	parse_struct_member_dcl( const string &line,
 									 int &spos,
-									 std::string name,
+									 const std::string &name,
 									 SymTypeStruct *t );
 	string	cur_module;
 	string	cur_file;
@@ -23,10 +23,13 @@
 #include "contextmgr.h"
 #include "breakpointmgr.h"
 #include "target.h"
+#include "memremap.h"
 
 ContextMgr::ContextMgr( DbgSession *session )
-	: mSession(session)
+	: mSession(session), mMIRegisters(false), m_cache_generation(0)
 {
+	for( int i=0; i<CONTEXT_CACHE_SIZE; i++ )
+		m_cache[i].addr = INVALID_ADDR;
 }
 
 
@@ -34,50 +37,101 @@ ContextMgr::~ContextMgr()
 {
 }
 
-/** Set the current context to that of the specified address.
-	\param addr	Address of instruction to update the context to.
+/** Work out the context of an address from the symbol tables.
 */
-void ContextMgr::set_context( ADDR addr )
+void ContextMgr::resolve( ADDR addr, CACHE_ENTRY &ent )
 {
-	/// \TODO integrate checks with the breakpoint manager for special breakpoints used to detect entry / exit of all functions in mode 'b'
-	string module;
-	LINE_NUM line;
-	if( mSession->modulemgr()->get_c_addr( addr, module, line ) )
+	Context &c = ent.context;
+	const ModuleMgr::ADDR_LINE *src = mSession->modulemgr()->find_addr( addr );
+	ent.addr = addr;
+	ent.found = false;
+	c.addr = addr;	// @FIXME we need this address to be the address of the c line for mapping but the asm addr for asm pc pointer on ddd
+	c.asm_addr = addr;
+	if( src && src->c_module )
 	{
 		string file;
-		mSession->symtab()->get_c_function( addr, file, cur_context.function );
-		cur_context.mode = C;
-		cur_context.module = module;
-		cur_context.line = line;
-		cur_context.c_line = line;
-		if(mSession->symtab()->get_c_block_level(
-									mSession->modulemgr()->module(module).get_c_file_name(),
-									cur_context.c_line,
-									cur_context.block,
-									cur_context.level) )
-			cout <<"found block/level "<<cur_context.block<<endl;
-		else
-			cout <<"coulden't find block/level, file = '"
-					<< mSession->modulemgr()->module(module).get_c_file_name()<<"', "
-					<<cur_context.c_line<<endl;
-		cur_context.addr = addr;	// @FIXME we need this address to be the address of the c line for mapping but the asm addr for asm pc pointer on ddd
-		//cur_context.function
-		cur_context.asm_addr = addr;
+		ent.kind = SRC_C;
+		mSession->symtab()->get_c_function( addr, file, c.function );
+		c.mode = C;
+		c.module = src->c_module->get_name();
+		c.line = src->c_line;
+		c.c_line = src->c_line;
+		ent.found = mSession->symtab()->get_c_block_level(
+									src->c_module->get_c_file_name(),
+									c.c_line,
+									c.block,
+									c.level);
 	}
-	else if( mSession->modulemgr()->get_asm_addr( addr, module, line ) )
+	else if( src && src->asm_module )
 	{
-		cur_context.module = module;
-		cur_context.line = line;
-		cur_context.addr = addr;
-		cur_context.asm_addr = addr;
+		ent.kind = SRC_ASM;
+		c.module = src->asm_module->get_name();
+		c.line = src->asm_line;
 	}
 	else
 	{
-		cout <<"ERROR: Context corrupt!"<<endl;
-		printf("addr = 0x%04x, module='%s', line=%i, pc=0x%04x\n",
-			   addr,
-			   module.c_str(),
-			   line, mSession->target()->read_PC() );
+		// no source here, keep the address so the stop is still reported
+		ent.kind = SRC_NONE;
+		c.module.clear();
+		c.function.clear();
+		c.line = 0;
+		c.mode = ASM;
+	}
+}
+
+/** Set the current context to that of the specified address.
+	Contexts come from a cache of resolved addresses, which is dropped
+	whenever the symbols change.
+	\param addr	Address of instruction to update the context to.
+*/
+void ContextMgr::set_context( ADDR addr )
+{
+	/// \TODO integrate checks with the breakpoint manager for special breakpoints used to detect entry / exit of all functions in mode 'b'
+	uint32_t gen = mSession->symtab()->generation();
+	if( gen!=m_cache_generation )
+	{
+		for( int i=0; i<CONTEXT_CACHE_SIZE; i++ )
+			m_cache[i].addr = INVALID_ADDR;
+		m_cache_generation = gen;
+	}
+	CACHE_ENTRY &ent = m_cache[addr & (CONTEXT_CACHE_SIZE-1)];
+	if( ent.addr!=addr )
+		resolve( addr, ent );
+
+	// the MI stop record says all a front end needs
+	bool cli = mSession->output_mode()==DbgSession::OUT_CLI;
+	switch( ent.kind )
+	{
+		case SRC_C:
+			cur_context = ent.context;
+			if( cli && ent.found )
+				cout <<"found block/level "<<cur_context.block<<endl;
+			else if( cli )
+				cout <<"coulden't find block/level, file = '"
+						<< mSession->modulemgr()->module(cur_context.module).get_c_file_name()<<"', "
+						<<cur_context.c_line<<endl;
+			break;
+		case SRC_ASM:
+			// only the location, the rest is left from the last C line
+			cur_context.module = ent.context.module;
+			cur_context.line = ent.context.line;
+			cur_context.addr = addr;
+			cur_context.asm_addr = addr;
+			break;
+		default:
+			if( cli )
+			{
+				cout <<"ERROR: Context corrupt!"<<endl;
+				printf("addr = 0x%04x, module='', line=0, pc=0x%04x\n",
+					   addr, mSession->target()->read_PC() );
+			}
+			cur_context.module.clear();
+			cur_context.function.clear();
+			cur_context.line = 0;
+			cur_context.mode = ASM;
+			cur_context.addr = addr;
+			cur_context.asm_addr = addr;
+			break;
 	}
 	
 	mSession->bpmgr()->stopped(cur_context.addr);
@@ -88,12 +142,19 @@ void ContextMgr::set_context( ADDR addr )
 */
 void ContextMgr::dump()
 {
+	if( mSession->output_mode()==DbgSession::OUT_MI )
+	{
+		dump_mi();
+		return;
+	}
 	printf("PC = 0x%04x\n",cur_context.addr);
 	printf("Module:\t%s\n",cur_context.module.c_str());
 	printf("Function:\t%s\n",cur_context.function.c_str());
 	printf("Line:\t%i\n",cur_context.line);
 	printf("Block:\t%i\n",cur_context.block);
-	if( cur_context.mode==C )
+	if( cur_context.module.empty() )
+		;	// nothing for ddd to show
+	else if( cur_context.mode==C )
 	{
 		printf("\032\032%s:%d:1:beg:0x%08x\n",
 				mSession->modulemgr()->module(cur_context.module).get_c_file_name().c_str(),
@@ -118,3 +179,52 @@ void ContextMgr::dump()
 #endif
 }
 
+/** Dumps the current context as a single GDB/MI stop record, eg:
+	*stopped,reason="breakpoint-hit",bkptno="1",frame={addr="0x0100",
+	func="main",file="main.c",line="12"},registers={...}
+*/
+void ContextMgr::dump_mi()
+{
+	char buf[64];
+	string rec = "*stopped";
+	BP_ID bp = mSession->bpmgr()->stopped_bp();
+	if( bp!=BP_ID_INVALID )
+	{
+		snprintf( buf, sizeof(buf), ",reason=\"breakpoint-hit\",bkptno=\"%i\"", bp );
+		rec += buf;
+	}
+	else
+		rec += ",reason=\"end-stepping-range\"";
+
+	snprintf( buf, sizeof(buf), ",frame={addr=\"0x%04x\"", cur_context.asm_addr );
+	rec += buf;
+	if( !cur_context.function.empty() )
+		rec += ",func=" + DbgSession::mi_quote( cur_context.function );
+	if( !cur_context.module.empty() )
+	{
+		Module &m = mSession->modulemgr()->module( cur_context.module );
+		rec += ",file=" + DbgSession::mi_quote( cur_context.mode==C ? m.get_c_file_name()
+														: m.get_asm_file_name() );
+		snprintf( buf, sizeof(buf), ",line=\"%i\"", cur_context.line );
+		rec += buf;
+	}
+	rec += "}";
+
+	if( mMIRegisters )
+	{
+		// values as info registers shows them
+		const Target::CPU_CONTEXT &c = mSession->target()->read_cpu_context();
+		snprintf( buf, sizeof(buf), ",registers={pc=\"0x%04x\"", c.pc );
+		rec += buf;
+		for( int i=0; i<8; i++ )
+		{
+			snprintf( buf, sizeof(buf), ",r%i=\"0x%02x\"", i, c.r[i] );
+			rec += buf;
+		}
+		snprintf( buf, sizeof(buf),
+				  ",a=\"0x%02x\",b=\"0x%02x\",dptr=\"0x%04x\",sp=\"0x%02x\",psw=\"0x%02x\"}",
+				  c.acc, c.b, c.dph<<8 | c.dpl, c.sp, c.psw );
+		rec += buf;
+	}
+	cout << rec << endl;
+}
@@ -60,9 +60,36 @@ public:
 	void set_context( ADDR addr );
 	Context get_current()				{ return cur_context; }
 
+	/** Include the registers in MI stop records so front ends don't need
+		to read them back after every stop.
+	*/
+	void set_mi_registers( bool on )	{ mMIRegisters = on; }
+	bool mi_registers()					{ return mMIRegisters; }
+
 protected:
 	DbgSession *mSession;
 	Context cur_context;
+	bool mMIRegisters;
+
+	void dump_mi();
+	
+	/// which part of the source an address resolved to
+	typedef enum { SRC_NONE, SRC_C, SRC_ASM } SRC_KIND;
+	typedef struct
+	{
+		ADDR		addr;		///< INVALID_ADDR for an empty slot
+		SRC_KIND	kind;
+		bool		found;		///< block and level were found
+		Context		context;
+	} CACHE_ENTRY;
+	/** Resolved contexts, direct mapped by address.  The same few hundred
+		addresses come up over and over while stepping and profiling.
+	*/
+	static const int CONTEXT_CACHE_SIZE = 256;	///< a power of two
+	CACHE_ENTRY	m_cache[CONTEXT_CACHE_SIZE];
+	uint32_t	m_cache_generation;		///< SymTab::generation() of m_cache
+	
+	void resolve( ADDR addr, CACHE_ENTRY &ent );
 };
 
 #endif
@@ -0,0 +1,240 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+#include "coverage.h"
+#include "target.h"
+#include "symtab.h"
+#include "breakpointmgr.h"
+
+using namespace std;
+
+Coverage::Coverage( DbgSession *session )
+	: mSession(session)
+{
+	reset();
+}
+
+
+Coverage::~Coverage()
+{
+}
+
+
+void Coverage::reset()
+{
+	m_lines.clear();
+	m_unhit.clear();
+	m_hits = 0;
+	m_loaded = false;
+	m_cursor = 0;
+}
+
+
+void Coverage::load()
+{
+	SymTab::FILE_LINE_MAP files;
+	SymTab::FILE_LINE_MAP::iterator fit;
+	SymTab::LINE_ADDR_MAP::iterator lit;
+
+	reset();
+	mSession->symtab()->get_c_lines( files );
+	for( fit=files.begin(); fit!=files.end(); ++fit )
+	{
+		for( lit=fit->second.begin(); lit!=fit->second.end(); ++lit )
+		{
+			LINE l;
+			l.file = fit->first;
+			l.line = lit->first;
+			l.hit = false;
+			m_unhit[ lit->second ].push_back( m_lines.size() );
+			m_lines.push_back( l );
+		}
+	}
+	m_loaded = true;
+}
+
+
+/** Mark the lines starting at addr as hit.
+	\returns false if no unhit line starts at addr.
+*/
+bool Coverage::mark_hit( ADDR addr )
+{
+	ADDR_LINES::iterator it = m_unhit.find( addr );
+	if( it==m_unhit.end() )
+		return false;
+	for( int i=0; i<it->second.size(); i++ )
+		m_lines[ it->second[i] ].hit = true;
+	m_hits += it->second.size();
+	m_unhit.erase( it );
+	return true;
+}
+
+
+/** Fill armed up to slots addresses of unhit lines, carrying on from
+	where the last call left off so every line gets a turn.
+*/
+void Coverage::arm( list<ADDR> &armed, int slots )
+{
+	ADDR_LINES::iterator it = m_unhit.lower_bound( m_cursor );
+	for( int checked=0; armed.size()<slots && checked<m_unhit.size(); checked++ )
+	{
+		if( it==m_unhit.end() )
+			it = m_unhit.begin();
+		if( find( armed.begin(), armed.end(), it->first )==armed.end() )
+			armed.push_back( it->first );
+		m_cursor = it->first+1;
+		++it;
+	}
+}
+
+
+bool Coverage::run( uint32_t slice_ms )
+{
+	Target *target = mSession->target();
+	BreakpointMgr *bpmgr = mSession->bpmgr();
+	list<ADDR> armed;
+	list<ADDR>::iterator it;
+	uint32_t tried = 0;		// unhit lines tried without a hit
+	uint16_t pc;
+
+	m_error = "";
+	if( !m_loaded )
+		load();
+	if( m_lines.empty() )
+	{
+		m_error = "No C line information.";
+		return false;
+	}
+	mark_hit( target->read_PC() );		// about to run the current line
+	while( !m_unhit.empty() )
+	{
+		bpmgr->clear_step_bps();
+		int slots = bpmgr->free_bps();
+		if( slots==0 )
+		{
+			m_error = "No breakpoints left for coverage, delete one first.";
+			return false;
+		}
+		arm( armed, slots );
+		for( it=armed.begin(); it!=armed.end(); ++it )
+			bpmgr->add_step_bp( *it );
+		bpmgr->sync_target();
+		target->go();
+
+		bool halted = false, timeout = false;
+		for( uint32_t waited=0; ; waited+=POLL_US )
+		{
+			if( target->poll_for_halt() )
+			{
+				halted = true;
+				break;
+			}
+			if( target->check_stop_forced() )
+				break;
+			if( waited>=slice_ms*1000 )
+			{
+				timeout = true;
+				break;
+			}
+			usleep( POLL_US );
+		}
+		if( !halted )
+		{
+			Target::SAMPLE_RESULT r = target->sample_PC( pc, false );
+			if( r==Target::SAMPLE_FAILED )
+			{
+				m_error = "Target can't be halted.";
+				bpmgr->clear_step_bps();
+				return false;
+			}
+			if( r==Target::SAMPLE_OK )
+			{
+				if( !timeout )
+					break;		// stopped by the user
+				// none of the armed lines reached, give others a turn
+				tried += armed.size();
+				if( tried>=m_unhit.size() )
+					break;
+				armed.clear();
+				continue;
+			}
+			// halted by itself as we gave up waiting
+		}
+		pc = target->read_PC();
+		if( !mark_hit( pc ) )
+			break;			// stopped for some other reason
+		armed.remove( pc );
+		tried = 0;
+		if( bpmgr->active_bp_at( pc ) )
+			break;			// a user breakpoint as well
+	}
+	bpmgr->clear_step_bps();
+	return true;
+}
+
+
+void Coverage::print_summary()
+{
+	uint32_t i, first, hit;
+	if( m_lines.empty() )
+	{
+		cout << "No coverage collected." << endl;
+		return;
+	}
+	for( first=0; first<m_lines.size(); first=i )
+	{
+		for( i=first, hit=0; i<m_lines.size() &&
+			 m_lines[i].file==m_lines[first].file; i++ )
+			hit += m_lines[i].hit;
+		printf( "%s: %u of %u lines hit (%.1f%%)\n",
+				m_lines[first].file.c_str(), hit, i-first,
+				100.0 * hit / (i-first) );
+	}
+	printf( "Total: %u of %u lines hit (%.1f%%)\n",
+			m_hits, (uint32_t)m_lines.size(),
+			100.0 * m_hits / m_lines.size() );
+}
+
+
+bool Coverage::write_lcov( string filename )
+{
+	uint32_t i, first, hit;
+	ofstream out( filename.c_str() );
+	if( !out )
+		return false;
+	for( first=0; first<m_lines.size(); first=i )
+	{
+		out << "TN:" << endl << "SF:" << m_lines[first].file << endl;
+		for( i=first, hit=0; i<m_lines.size() &&
+			 m_lines[i].file==m_lines[first].file; i++ )
+		{
+			out << "DA:" << m_lines[i].line << ',' << m_lines[i].hit << endl;
+			hit += m_lines[i].hit;
+		}
+		out << "LF:" << i-first << endl
+			<< "LH:" << hit << endl
+			<< "end_of_record" << endl;
+	}
+	return out.good();
+}
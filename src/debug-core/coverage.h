@@ -0,0 +1,98 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef COVERAGE_H
+#define COVERAGE_H
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <stdint.h>
+#include "types.h"
+#include "dbgsession.h"
+
+/**	C line coverage using the target's breakpoints.
+	Breakpoints are placed on the start of lines that haven't been hit yet
+	and the target run.  Each time one is hit its line is marked and the
+	breakpoint moves on to another unhit line, so code already covered runs
+	at full speed and nothing has to be instrumented.
+	If none of the armed lines is reached within a time slice the target is
+	halted and the breakpoints move to other lines, coverage ends once every
+	unhit line has been tried without a hit.
+
+	Only the first hit of a line is seen so the counts written are 0 or 1.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Coverage
+{
+public:
+	enum { POLL_US = 1000 };	///< delay between halt polls while running
+
+	Coverage( DbgSession *session );
+	~Coverage();
+
+	/** Forget all hits, the line table is read again by the next run().
+	*/
+	void reset();
+
+	/** Run the target collecting coverage.
+		Ends when every line is hit, no further lines are reached, the
+		target stops for some other reason (eg a user breakpoint) or the
+		user stops it.  The target is left halted.
+		\param slice_ms	how long to wait for one set of breakpoints
+		\returns false if coverage can't be collected, error() says why.
+	*/
+	bool run( uint32_t slice_ms );
+
+	std::string error()				{ return m_error; }
+	uint32_t lines()				{ return m_lines.size(); }
+	uint32_t hits()					{ return m_hits; }
+
+	/** Print the lines hit for each module.
+	*/
+	void print_summary();
+
+	/** Write an lcov tracefile with a record per module.
+		\returns false if the file couldn't be written.
+	*/
+	bool write_lcov( std::string filename );
+
+protected:
+	typedef struct
+	{
+		std::string	file;
+		LINE_NUM	line;
+		bool		hit;
+	} LINE;
+	typedef std::map<ADDR, std::vector<int> > ADDR_LINES;
+	DbgSession			*mSession;
+	std::vector<LINE>	m_lines;
+	ADDR_LINES			m_unhit;	///< lines not hit yet by start address
+	uint32_t			m_hits;
+	bool				m_loaded;
+	ADDR				m_cursor;	///< where to look for lines to arm next
+	std::string			m_error;
+
+	void load();
+	bool mark_hit( ADDR addr );
+	void arm( std::list<ADDR> &armed, int slots );
+};
+
+#endif
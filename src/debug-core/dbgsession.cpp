@@ -26,7 +26,9 @@
 #include "targets51.h"
 #include "targetsilabs.h"
 #include "target-dummy.h"
+#include "symcache.h"
 #include <iostream>
+#include <stdio.h>
 #include <stdint.h>
 
 
@@ -41,7 +43,10 @@ DbgSession::DbgSession(
 				ContextMgr *dbg_contextmgr,
 				BreakpointMgr *dbg_bpmgr,
 				ModuleMgr *dbg_modulemgr )
-	: 	mTarget(0)
+	: 	mTarget(0),
+		mOwnSymTab(!dbg_symtab), mOwnSymTree(!dbg_symtypetree),
+		mOwnContextMgr(!dbg_contextmgr), mOwnBpMgr(!dbg_bpmgr),
+		mOwnModuleMgr(!dbg_modulemgr), mOutputMode(OUT_CLI)
 {
 	std::cout << "====================== DbgSession Constructor =========================" << endl;
 	mSymTab = dbg_symtab ? dbg_symtab : new SymTab(this);
@@ -57,8 +62,21 @@ DbgSession::DbgSession(
 	add_target( new TargetSiLabs() );
 }
 
+/** Disconnects the current target and frees the targets along with the
+	objects the constructor created.
+*/
 DbgSession::~DbgSession()
 {
+	if( mTarget && mTarget->is_connected() )
+		mTarget->disconnect();
+	for( TargetMap::iterator i=mTargetMap.begin(); i!=mTargetMap.end(); ++i )
+		delete i->second;
+	SymCache::release( this );
+	if( mOwnBpMgr )			delete mBpMgr;
+	if( mOwnContextMgr )	delete mContextMgr;
+	if( mOwnSymTab )		delete mSymTab;
+	if( mOwnSymTree )		delete mSymTree;
+	if( mOwnModuleMgr )		delete mModuleMgr;
 }
 
 
@@ -81,6 +99,7 @@ bool DbgSession::SelectTarget( std::string name )
 			if(mTarget) target()->disconnect();
 		}
 		// clear out the data structures.
+		SymCache::release( this );
 		mSymTab->clear();
 		mSymTree->clear();
 		//mContextMgr->clear()	@FIXME contextmgr needs a clear or reset
@@ -107,3 +126,30 @@ Target *DbgSession::add_target( Target *t )
 	return t;
 }
 
+std::string DbgSession::mi_quote( const std::string &s )
+{
+	std::string r = "\"";
+	char buf[8];
+	for( size_t i=0; i<s.length(); i++ )
+	{
+		unsigned char c = s[i];
+		switch( c )
+		{
+			case '"':	r += "\\\"";	break;
+			case '\\':	r += "\\\\";	break;
+			case '\n':	r += "\\n";	break;
+			case '\r':	r += "\\r";	break;
+			case '\t':	r += "\\t";	break;
+			default:
+				if( c<0x20 || c==0x7f )
+				{
+					snprintf( buf, sizeof(buf), "\\%03o", c );
+					r += buf;
+				}
+				else
+					r += c;
+				break;
+		}
+	}
+	return r + "\"";
+}
@@ -26,6 +26,7 @@
 #include <iostream>
 #include <vector>
 #include <stdint.h>
+#include "strpool.h"
 class Target;
 class SymTab;
 class SymTypeTree;
@@ -47,7 +48,11 @@ extern const uint64_t ec2debugcore_version;
 
 
 /**
-This class holds data about a single debug session
+This class holds data about a single debug session.
+Sessions are independent of each other, a process may run several, each
+from its own thread, to drive several targets at once.  A session must only
+be used by one thread at a time.  See CdbFile::set_share_symbols() for
+sessions debugging the same firmware.
 
 	@author Ricky White <rickyw@neatstuff.co.nz>
 */
@@ -67,6 +72,8 @@ public:
 	ContextMgr	*contextmgr()	{ assert(mContextMgr);	return mContextMgr; }
 	BreakpointMgr *bpmgr()		{ assert(mBpMgr);		return mBpMgr; }
 	ModuleMgr *modulemgr()		{ assert(mModuleMgr);	return mModuleMgr; }
+	/// names held by the symbol table, see StrPool
+	StrPool *strings()			{ return &mStrings; }
 
 	bool SelectTarget( std::string name );
 	typedef std::map<std::string,Target*>	TargetMap;
@@ -79,6 +86,18 @@ public:
 	typedef std::vector<TargetInfo> TargetInfoVec;
 	TargetInfoVec get_target_info()	{ return mTargetInfoVec; }
 
+	/** How events such as the target stopping are reported.
+		OUT_CLI is the human readable text plus ddd annotations, OUT_MI
+		prints compact GDB/MI style records for front ends instead.
+	*/
+	typedef enum { OUT_CLI, OUT_MI } OUTPUT_MODE;
+	void set_output_mode( OUTPUT_MODE mode )	{ mOutputMode = mode; }
+	OUTPUT_MODE output_mode()					{ return mOutputMode; }
+
+	/** Quote a string as a GDB/MI c-string, control characters escaped.
+	*/
+	static std::string mi_quote( const std::string &s );
+
 
 private:
 	Target			*mTarget;
@@ -88,9 +107,14 @@ private:
 	ContextMgr		*mContextMgr;
 	BreakpointMgr	*mBpMgr;
 	ModuleMgr		*mModuleMgr;
+	StrPool			mStrings;
+	// true for the objects created by the constructor, freed with the session
+	bool			mOwnSymTab, mOwnSymTree, mOwnContextMgr, mOwnBpMgr,
+					mOwnModuleMgr;
 
 	TargetMap		mTargetMap;
 	TargetInfoVec	mTargetInfoVec;
+	OUTPUT_MODE		mOutputMode;
 
 	Target *add_target( Target *t );
 };
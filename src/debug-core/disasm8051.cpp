@@ -0,0 +1,483 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "disasm8051.h"
+#include "target.h"
+
+using namespace std;
+
+typedef enum
+{
+	OP_NONE,
+	OP_OPCODE,		///< the opcode byte itself, for the reserved opcode
+	OP_A,
+	OP_C,
+	OP_AB,
+	OP_DPTR,
+	OP_AT_DPTR,
+	OP_AT_A_DPTR,
+	OP_AT_A_PC,
+	OP_RN,			///< register from the low 3 bits of the opcode
+	OP_AT_RI,		///< @R0 / @R1 from the low bit of the opcode
+	OP_DIR,			///< direct address byte
+	OP_IMM,			///< #data
+	OP_IMM16,		///< #data16
+	OP_BIT,			///< bit address byte
+	OP_NBIT,		///< /bit
+	OP_REL,			///< relative offset byte
+	OP_ADDR11,		///< AJMP / ACALL page address
+	OP_ADDR16
+} OPERAND;
+
+typedef struct
+{
+	const char	*mnemonic;
+	uint8_t		len;
+	uint8_t		operand[3];
+} OPCODE;
+
+static const OPCODE opcodes[256] =
+{
+	{ "nop",   1, { OP_NONE, OP_NONE, OP_NONE } },	// 0x00
+	{ "ajmp",  2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x01
+	{ "ljmp",  3, { OP_ADDR16, OP_NONE, OP_NONE } },	// 0x02
+	{ "rr",    1, { OP_A, OP_NONE, OP_NONE } },	// 0x03
+	{ "inc",   1, { OP_A, OP_NONE, OP_NONE } },	// 0x04
+	{ "inc",   2, { OP_DIR, OP_NONE, OP_NONE } },	// 0x05
+	{ "inc",   1, { OP_AT_RI, OP_NONE, OP_NONE } },	// 0x06
+	{ "inc",   1, { OP_AT_RI, OP_NONE, OP_NONE } },	// 0x07
+	{ "inc",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x08
+	{ "inc",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x09
+	{ "inc",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x0a
+	{ "inc",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x0b
+	{ "inc",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x0c
+	{ "inc",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x0d
+	{ "inc",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x0e
+	{ "inc",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x0f
+	{ "jbc",   3, { OP_BIT, OP_REL, OP_NONE } },	// 0x10
+	{ "acall", 2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x11
+	{ "lcall", 3, { OP_ADDR16, OP_NONE, OP_NONE } },	// 0x12
+	{ "rrc",   1, { OP_A, OP_NONE, OP_NONE } },	// 0x13
+	{ "dec",   1, { OP_A, OP_NONE, OP_NONE } },	// 0x14
+	{ "dec",   2, { OP_DIR, OP_NONE, OP_NONE } },	// 0x15
+	{ "dec",   1, { OP_AT_RI, OP_NONE, OP_NONE } },	// 0x16
+	{ "dec",   1, { OP_AT_RI, OP_NONE, OP_NONE } },	// 0x17
+	{ "dec",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x18
+	{ "dec",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x19
+	{ "dec",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x1a
+	{ "dec",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x1b
+	{ "dec",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x1c
+	{ "dec",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x1d
+	{ "dec",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x1e
+	{ "dec",   1, { OP_RN, OP_NONE, OP_NONE } },	// 0x1f
+	{ "jb",    3, { OP_BIT, OP_REL, OP_NONE } },	// 0x20
+	{ "ajmp",  2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x21
+	{ "ret",   1, { OP_NONE, OP_NONE, OP_NONE } },	// 0x22
+	{ "rl",    1, { OP_A, OP_NONE, OP_NONE } },	// 0x23
+	{ "add",   2, { OP_A, OP_IMM, OP_NONE } },	// 0x24
+	{ "add",   2, { OP_A, OP_DIR, OP_NONE } },	// 0x25
+	{ "add",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x26
+	{ "add",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x27
+	{ "add",   1, { OP_A, OP_RN, OP_NONE } },	// 0x28
+	{ "add",   1, { OP_A, OP_RN, OP_NONE } },	// 0x29
+	{ "add",   1, { OP_A, OP_RN, OP_NONE } },	// 0x2a
+	{ "add",   1, { OP_A, OP_RN, OP_NONE } },	// 0x2b
+	{ "add",   1, { OP_A, OP_RN, OP_NONE } },	// 0x2c
+	{ "add",   1, { OP_A, OP_RN, OP_NONE } },	// 0x2d
+	{ "add",   1, { OP_A, OP_RN, OP_NONE } },	// 0x2e
+	{ "add",   1, { OP_A, OP_RN, OP_NONE } },	// 0x2f
+	{ "jnb",   3, { OP_BIT, OP_REL, OP_NONE } },	// 0x30
+	{ "acall", 2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x31
+	{ "reti",  1, { OP_NONE, OP_NONE, OP_NONE } },	// 0x32
+	{ "rlc",   1, { OP_A, OP_NONE, OP_NONE } },	// 0x33
+	{ "addc",  2, { OP_A, OP_IMM, OP_NONE } },	// 0x34
+	{ "addc",  2, { OP_A, OP_DIR, OP_NONE } },	// 0x35
+	{ "addc",  1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x36
+	{ "addc",  1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x37
+	{ "addc",  1, { OP_A, OP_RN, OP_NONE } },	// 0x38
+	{ "addc",  1, { OP_A, OP_RN, OP_NONE } },	// 0x39
+	{ "addc",  1, { OP_A, OP_RN, OP_NONE } },	// 0x3a
+	{ "addc",  1, { OP_A, OP_RN, OP_NONE } },	// 0x3b
+	{ "addc",  1, { OP_A, OP_RN, OP_NONE } },	// 0x3c
+	{ "addc",  1, { OP_A, OP_RN, OP_NONE } },	// 0x3d
+	{ "addc",  1, { OP_A, OP_RN, OP_NONE } },	// 0x3e
+	{ "addc",  1, { OP_A, OP_RN, OP_NONE } },	// 0x3f
+	{ "jc",    2, { OP_REL, OP_NONE, OP_NONE } },	// 0x40
+	{ "ajmp",  2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x41
+	{ "orl",   2, { OP_DIR, OP_A, OP_NONE } },	// 0x42
+	{ "orl",   3, { OP_DIR, OP_IMM, OP_NONE } },	// 0x43
+	{ "orl",   2, { OP_A, OP_IMM, OP_NONE } },	// 0x44
+	{ "orl",   2, { OP_A, OP_DIR, OP_NONE } },	// 0x45
+	{ "orl",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x46
+	{ "orl",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x47
+	{ "orl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x48
+	{ "orl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x49
+	{ "orl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x4a
+	{ "orl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x4b
+	{ "orl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x4c
+	{ "orl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x4d
+	{ "orl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x4e
+	{ "orl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x4f
+	{ "jnc",   2, { OP_REL, OP_NONE, OP_NONE } },	// 0x50
+	{ "acall", 2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x51
+	{ "anl",   2, { OP_DIR, OP_A, OP_NONE } },	// 0x52
+	{ "anl",   3, { OP_DIR, OP_IMM, OP_NONE } },	// 0x53
+	{ "anl",   2, { OP_A, OP_IMM, OP_NONE } },	// 0x54
+	{ "anl",   2, { OP_A, OP_DIR, OP_NONE } },	// 0x55
+	{ "anl",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x56
+	{ "anl",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x57
+	{ "anl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x58
+	{ "anl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x59
+	{ "anl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x5a
+	{ "anl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x5b
+	{ "anl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x5c
+	{ "anl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x5d
+	{ "anl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x5e
+	{ "anl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x5f
+	{ "jz",    2, { OP_REL, OP_NONE, OP_NONE } },	// 0x60
+	{ "ajmp",  2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x61
+	{ "xrl",   2, { OP_DIR, OP_A, OP_NONE } },	// 0x62
+	{ "xrl",   3, { OP_DIR, OP_IMM, OP_NONE } },	// 0x63
+	{ "xrl",   2, { OP_A, OP_IMM, OP_NONE } },	// 0x64
+	{ "xrl",   2, { OP_A, OP_DIR, OP_NONE } },	// 0x65
+	{ "xrl",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x66
+	{ "xrl",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x67
+	{ "xrl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x68
+	{ "xrl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x69
+	{ "xrl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x6a
+	{ "xrl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x6b
+	{ "xrl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x6c
+	{ "xrl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x6d
+	{ "xrl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x6e
+	{ "xrl",   1, { OP_A, OP_RN, OP_NONE } },	// 0x6f
+	{ "jnz",   2, { OP_REL, OP_NONE, OP_NONE } },	// 0x70
+	{ "acall", 2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x71
+	{ "orl",   2, { OP_C, OP_BIT, OP_NONE } },	// 0x72
+	{ "jmp",   1, { OP_AT_A_DPTR, OP_NONE, OP_NONE } },	// 0x73
+	{ "mov",   2, { OP_A, OP_IMM, OP_NONE } },	// 0x74
+	{ "mov",   3, { OP_DIR, OP_IMM, OP_NONE } },	// 0x75
+	{ "mov",   2, { OP_AT_RI, OP_IMM, OP_NONE } },	// 0x76
+	{ "mov",   2, { OP_AT_RI, OP_IMM, OP_NONE } },	// 0x77
+	{ "mov",   2, { OP_RN, OP_IMM, OP_NONE } },	// 0x78
+	{ "mov",   2, { OP_RN, OP_IMM, OP_NONE } },	// 0x79
+	{ "mov",   2, { OP_RN, OP_IMM, OP_NONE } },	// 0x7a
+	{ "mov",   2, { OP_RN, OP_IMM, OP_NONE } },	// 0x7b
+	{ "mov",   2, { OP_RN, OP_IMM, OP_NONE } },	// 0x7c
+	{ "mov",   2, { OP_RN, OP_IMM, OP_NONE } },	// 0x7d
+	{ "mov",   2, { OP_RN, OP_IMM, OP_NONE } },	// 0x7e
+	{ "mov",   2, { OP_RN, OP_IMM, OP_NONE } },	// 0x7f
+	{ "sjmp",  2, { OP_REL, OP_NONE, OP_NONE } },	// 0x80
+	{ "ajmp",  2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x81
+	{ "anl",   2, { OP_C, OP_BIT, OP_NONE } },	// 0x82
+	{ "movc",  1, { OP_A, OP_AT_A_PC, OP_NONE } },	// 0x83
+	{ "div",   1, { OP_AB, OP_NONE, OP_NONE } },	// 0x84
+	{ "mov",   3, { OP_DIR, OP_DIR, OP_NONE } },	// 0x85
+	{ "mov",   2, { OP_DIR, OP_AT_RI, OP_NONE } },	// 0x86
+	{ "mov",   2, { OP_DIR, OP_AT_RI, OP_NONE } },	// 0x87
+	{ "mov",   2, { OP_DIR, OP_RN, OP_NONE } },	// 0x88
+	{ "mov",   2, { OP_DIR, OP_RN, OP_NONE } },	// 0x89
+	{ "mov",   2, { OP_DIR, OP_RN, OP_NONE } },	// 0x8a
+	{ "mov",   2, { OP_DIR, OP_RN, OP_NONE } },	// 0x8b
+	{ "mov",   2, { OP_DIR, OP_RN, OP_NONE } },	// 0x8c
+	{ "mov",   2, { OP_DIR, OP_RN, OP_NONE } },	// 0x8d
+	{ "mov",   2, { OP_DIR, OP_RN, OP_NONE } },	// 0x8e
+	{ "mov",   2, { OP_DIR, OP_RN, OP_NONE } },	// 0x8f
+	{ "mov",   3, { OP_DPTR, OP_IMM16, OP_NONE } },	// 0x90
+	{ "acall", 2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0x91
+	{ "mov",   2, { OP_BIT, OP_C, OP_NONE } },	// 0x92
+	{ "movc",  1, { OP_A, OP_AT_A_DPTR, OP_NONE } },	// 0x93
+	{ "subb",  2, { OP_A, OP_IMM, OP_NONE } },	// 0x94
+	{ "subb",  2, { OP_A, OP_DIR, OP_NONE } },	// 0x95
+	{ "subb",  1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x96
+	{ "subb",  1, { OP_A, OP_AT_RI, OP_NONE } },	// 0x97
+	{ "subb",  1, { OP_A, OP_RN, OP_NONE } },	// 0x98
+	{ "subb",  1, { OP_A, OP_RN, OP_NONE } },	// 0x99
+	{ "subb",  1, { OP_A, OP_RN, OP_NONE } },	// 0x9a
+	{ "subb",  1, { OP_A, OP_RN, OP_NONE } },	// 0x9b
+	{ "subb",  1, { OP_A, OP_RN, OP_NONE } },	// 0x9c
+	{ "subb",  1, { OP_A, OP_RN, OP_NONE } },	// 0x9d
+	{ "subb",  1, { OP_A, OP_RN, OP_NONE } },	// 0x9e
+	{ "subb",  1, { OP_A, OP_RN, OP_NONE } },	// 0x9f
+	{ "orl",   2, { OP_C, OP_NBIT, OP_NONE } },	// 0xa0
+	{ "ajmp",  2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0xa1
+	{ "mov",   2, { OP_C, OP_BIT, OP_NONE } },	// 0xa2
+	{ "inc",   1, { OP_DPTR, OP_NONE, OP_NONE } },	// 0xa3
+	{ "mul",   1, { OP_AB, OP_NONE, OP_NONE } },	// 0xa4
+	{ ".db",   1, { OP_OPCODE, OP_NONE, OP_NONE } },	// 0xa5
+	{ "mov",   2, { OP_AT_RI, OP_DIR, OP_NONE } },	// 0xa6
+	{ "mov",   2, { OP_AT_RI, OP_DIR, OP_NONE } },	// 0xa7
+	{ "mov",   2, { OP_RN, OP_DIR, OP_NONE } },	// 0xa8
+	{ "mov",   2, { OP_RN, OP_DIR, OP_NONE } },	// 0xa9
+	{ "mov",   2, { OP_RN, OP_DIR, OP_NONE } },	// 0xaa
+	{ "mov",   2, { OP_RN, OP_DIR, OP_NONE } },	// 0xab
+	{ "mov",   2, { OP_RN, OP_DIR, OP_NONE } },	// 0xac
+	{ "mov",   2, { OP_RN, OP_DIR, OP_NONE } },	// 0xad
+	{ "mov",   2, { OP_RN, OP_DIR, OP_NONE } },	// 0xae
+	{ "mov",   2, { OP_RN, OP_DIR, OP_NONE } },	// 0xaf
+	{ "anl",   2, { OP_C, OP_NBIT, OP_NONE } },	// 0xb0
+	{ "acall", 2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0xb1
+	{ "cpl",   2, { OP_BIT, OP_NONE, OP_NONE } },	// 0xb2
+	{ "cpl",   1, { OP_C, OP_NONE, OP_NONE } },	// 0xb3
+	{ "cjne",  3, { OP_A, OP_IMM, OP_REL } },	// 0xb4
+	{ "cjne",  3, { OP_A, OP_DIR, OP_REL } },	// 0xb5
+	{ "cjne",  3, { OP_AT_RI, OP_IMM, OP_REL } },	// 0xb6
+	{ "cjne",  3, { OP_AT_RI, OP_IMM, OP_REL } },	// 0xb7
+	{ "cjne",  3, { OP_RN, OP_IMM, OP_REL } },	// 0xb8
+	{ "cjne",  3, { OP_RN, OP_IMM, OP_REL } },	// 0xb9
+	{ "cjne",  3, { OP_RN, OP_IMM, OP_REL } },	// 0xba
+	{ "cjne",  3, { OP_RN, OP_IMM, OP_REL } },	// 0xbb
+	{ "cjne",  3, { OP_RN, OP_IMM, OP_REL } },	// 0xbc
+	{ "cjne",  3, { OP_RN, OP_IMM, OP_REL } },	// 0xbd
+	{ "cjne",  3, { OP_RN, OP_IMM, OP_REL } },	// 0xbe
+	{ "cjne",  3, { OP_RN, OP_IMM, OP_REL } },	// 0xbf
+	{ "push",  2, { OP_DIR, OP_NONE, OP_NONE } },	// 0xc0
+	{ "ajmp",  2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0xc1
+	{ "clr",   2, { OP_BIT, OP_NONE, OP_NONE } },	// 0xc2
+	{ "clr",   1, { OP_C, OP_NONE, OP_NONE } },	// 0xc3
+	{ "swap",  1, { OP_A, OP_NONE, OP_NONE } },	// 0xc4
+	{ "xch",   2, { OP_A, OP_DIR, OP_NONE } },	// 0xc5
+	{ "xch",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0xc6
+	{ "xch",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0xc7
+	{ "xch",   1, { OP_A, OP_RN, OP_NONE } },	// 0xc8
+	{ "xch",   1, { OP_A, OP_RN, OP_NONE } },	// 0xc9
+	{ "xch",   1, { OP_A, OP_RN, OP_NONE } },	// 0xca
+	{ "xch",   1, { OP_A, OP_RN, OP_NONE } },	// 0xcb
+	{ "xch",   1, { OP_A, OP_RN, OP_NONE } },	// 0xcc
+	{ "xch",   1, { OP_A, OP_RN, OP_NONE } },	// 0xcd
+	{ "xch",   1, { OP_A, OP_RN, OP_NONE } },	// 0xce
+	{ "xch",   1, { OP_A, OP_RN, OP_NONE } },	// 0xcf
+	{ "pop",   2, { OP_DIR, OP_NONE, OP_NONE } },	// 0xd0
+	{ "acall", 2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0xd1
+	{ "setb",  2, { OP_BIT, OP_NONE, OP_NONE } },	// 0xd2
+	{ "setb",  1, { OP_C, OP_NONE, OP_NONE } },	// 0xd3
+	{ "da",    1, { OP_A, OP_NONE, OP_NONE } },	// 0xd4
+	{ "djnz",  3, { OP_DIR, OP_REL, OP_NONE } },	// 0xd5
+	{ "xchd",  1, { OP_A, OP_AT_RI, OP_NONE } },	// 0xd6
+	{ "xchd",  1, { OP_A, OP_AT_RI, OP_NONE } },	// 0xd7
+	{ "djnz",  2, { OP_RN, OP_REL, OP_NONE } },	// 0xd8
+	{ "djnz",  2, { OP_RN, OP_REL, OP_NONE } },	// 0xd9
+	{ "djnz",  2, { OP_RN, OP_REL, OP_NONE } },	// 0xda
+	{ "djnz",  2, { OP_RN, OP_REL, OP_NONE } },	// 0xdb
+	{ "djnz",  2, { OP_RN, OP_REL, OP_NONE } },	// 0xdc
+	{ "djnz",  2, { OP_RN, OP_REL, OP_NONE } },	// 0xdd
+	{ "djnz",  2, { OP_RN, OP_REL, OP_NONE } },	// 0xde
+	{ "djnz",  2, { OP_RN, OP_REL, OP_NONE } },	// 0xdf
+	{ "movx",  1, { OP_A, OP_AT_DPTR, OP_NONE } },	// 0xe0
+	{ "ajmp",  2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0xe1
+	{ "movx",  1, { OP_A, OP_AT_RI, OP_NONE } },	// 0xe2
+	{ "movx",  1, { OP_A, OP_AT_RI, OP_NONE } },	// 0xe3
+	{ "clr",   1, { OP_A, OP_NONE, OP_NONE } },	// 0xe4
+	{ "mov",   2, { OP_A, OP_DIR, OP_NONE } },	// 0xe5
+	{ "mov",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0xe6
+	{ "mov",   1, { OP_A, OP_AT_RI, OP_NONE } },	// 0xe7
+	{ "mov",   1, { OP_A, OP_RN, OP_NONE } },	// 0xe8
+	{ "mov",   1, { OP_A, OP_RN, OP_NONE } },	// 0xe9
+	{ "mov",   1, { OP_A, OP_RN, OP_NONE } },	// 0xea
+	{ "mov",   1, { OP_A, OP_RN, OP_NONE } },	// 0xeb
+	{ "mov",   1, { OP_A, OP_RN, OP_NONE } },	// 0xec
+	{ "mov",   1, { OP_A, OP_RN, OP_NONE } },	// 0xed
+	{ "mov",   1, { OP_A, OP_RN, OP_NONE } },	// 0xee
+	{ "mov",   1, { OP_A, OP_RN, OP_NONE } },	// 0xef
+	{ "movx",  1, { OP_AT_DPTR, OP_A, OP_NONE } },	// 0xf0
+	{ "acall", 2, { OP_ADDR11, OP_NONE, OP_NONE } },	// 0xf1
+	{ "movx",  1, { OP_AT_RI, OP_A, OP_NONE } },	// 0xf2
+	{ "movx",  1, { OP_AT_RI, OP_A, OP_NONE } },	// 0xf3
+	{ "cpl",   1, { OP_A, OP_NONE, OP_NONE } },	// 0xf4
+	{ "mov",   2, { OP_DIR, OP_A, OP_NONE } },	// 0xf5
+	{ "mov",   1, { OP_AT_RI, OP_A, OP_NONE } },	// 0xf6
+	{ "mov",   1, { OP_AT_RI, OP_A, OP_NONE } },	// 0xf7
+	{ "mov",   1, { OP_RN, OP_A, OP_NONE } },	// 0xf8
+	{ "mov",   1, { OP_RN, OP_A, OP_NONE } },	// 0xf9
+	{ "mov",   1, { OP_RN, OP_A, OP_NONE } },	// 0xfa
+	{ "mov",   1, { OP_RN, OP_A, OP_NONE } },	// 0xfb
+	{ "mov",   1, { OP_RN, OP_A, OP_NONE } },	// 0xfc
+	{ "mov",   1, { OP_RN, OP_A, OP_NONE } },	// 0xfd
+	{ "mov",   1, { OP_RN, OP_A, OP_NONE } },	// 0xfe
+	{ "mov",   1, { OP_RN, OP_A, OP_NONE } },	// 0xff
+};
+
+/// names of the standard 8051 / 8052 SFRs, indexed by address-0x80
+static const char *sfr_names[128] =
+{
+	"p0",	"sp",	"dpl",	"dph",	0,		0,		0,		"pcon",		// 0x80
+	"tcon",	"tmod",	"tl0",	"tl1",	"th0",	"th1",	0,		0,			// 0x88
+	"p1",	0,		0,		0,		0,		0,		0,		0,			// 0x90
+	"scon",	"sbuf",	0,		0,		0,		0,		0,		0,			// 0x98
+	"p2",	0,		0,		0,		0,		0,		0,		0,			// 0xa0
+	"ie",	0,		0,		0,		0,		0,		0,		0,			// 0xa8
+	"p3",	0,		0,		0,		0,		0,		0,		0,			// 0xb0
+	"ip",	0,		0,		0,		0,		0,		0,		0,			// 0xb8
+	0,		0,		0,		0,		0,		0,		0,		0,			// 0xc0
+	"t2con",0,		"rcap2l","rcap2h","tl2","th2",	0,		0,			// 0xc8
+	"psw",	0,		0,		0,		0,		0,		0,		0,			// 0xd0
+	0,		0,		0,		0,		0,		0,		0,		0,			// 0xd8
+	"acc",	0,		0,		0,		0,		0,		0,		0,			// 0xe0
+	0,		0,		0,		0,		0,		0,		0,		0,			// 0xe8
+	"b",	0,		0,		0,		0,		0,		0,		0,			// 0xf0
+	0,		0,		0,		0,		0,		0,		0,		0			// 0xf8
+};
+
+static void format_direct( char *s, size_t n, uint8_t addr )
+{
+	if( addr>=0x80 && sfr_names[addr-0x80] )
+		snprintf( s, n, "%s", sfr_names[addr-0x80] );
+	else
+		snprintf( s, n, "0x%02x", addr );
+}
+
+/** Bits 0x00-0x7f are in bytes 0x20-0x2f, the rest in the SFRs at
+	multiples of 8.
+*/
+static void format_bit( char *s, size_t n, uint8_t bit )
+{
+	uint8_t byte = bit<0x80 ? 0x20+(bit>>3) : (bit&0xf8);
+	if( byte>=0x80 && sfr_names[byte-0x80] )
+		snprintf( s, n, "%s.%d", sfr_names[byte-0x80], bit&7 );
+	else
+		snprintf( s, n, "0x%02x.%d", byte, bit&7 );
+}
+
+
+const char *Disasm8051::sfr_name( uint8_t addr )
+{
+	return addr>=0x80 ? sfr_names[addr-0x80] : 0;
+}
+
+int Disasm8051::decode( ADDR pc, const uint8_t *code, string &text,
+						ADDR *dest )
+{
+	uint8_t op = code[0];
+	const OPCODE &o = opcodes[op];
+	int pos = 1;	// next operand byte
+	ADDR d = -1;
+	char s[16];
+
+	text = o.mnemonic;
+	for( int i=0; i<3 && o.operand[i]!=OP_NONE; i++ )
+	{
+		// MOV dir,dir is the only instruction with its operand bytes in
+		// the opposite order to the assembler syntax
+		uint8_t v = code[ op==0x85 ? 2-i : pos ];
+		switch( o.operand[i] )
+		{
+			case OP_OPCODE:		snprintf( s, sizeof(s), "0x%02x", op );		break;
+			case OP_A:			strcpy( s, "a" );							break;
+			case OP_C:			strcpy( s, "c" );							break;
+			case OP_AB:			strcpy( s, "ab" );							break;
+			case OP_DPTR:		strcpy( s, "dptr" );						break;
+			case OP_AT_DPTR:	strcpy( s, "@dptr" );						break;
+			case OP_AT_A_DPTR:	strcpy( s, "@a+dptr" );						break;
+			case OP_AT_A_PC:	strcpy( s, "@a+pc" );						break;
+			case OP_RN:			snprintf( s, sizeof(s), "r%d", op&7 );		break;
+			case OP_AT_RI:		snprintf( s, sizeof(s), "@r%d", op&1 );		break;
+			case OP_DIR:
+				format_direct( s, sizeof(s), v );
+				pos++;
+				break;
+			case OP_IMM:
+				snprintf( s, sizeof(s), "#0x%02x", v );
+				pos++;
+				break;
+			case OP_IMM16:
+				snprintf( s, sizeof(s), "#0x%04x", (code[pos]<<8) | code[pos+1] );
+				pos += 2;
+				break;
+			case OP_BIT:
+				format_bit( s, sizeof(s), v );
+				pos++;
+				break;
+			case OP_NBIT:
+				s[0] = '/';
+				format_bit( s+1, sizeof(s)-1, v );
+				pos++;
+				break;
+			case OP_REL:
+				d = (pc+o.len+int8_t(v)) & 0xffff;
+				snprintf( s, sizeof(s), "0x%04x", d );
+				pos++;
+				break;
+			case OP_ADDR11:
+				d = ((pc+2) & 0xf800) | ((op&0xe0)<<3) | v;
+				snprintf( s, sizeof(s), "0x%04x", d );
+				pos++;
+				break;
+			case OP_ADDR16:
+				d = (code[pos]<<8) | code[pos+1];
+				snprintf( s, sizeof(s), "0x%04x", d );
+				pos += 2;
+				break;
+		}
+		text += i==0 ? "\t" : ",";
+		text += s;
+	}
+	if( dest )
+		*dest = d;
+	return o.len;
+}
+
+
+Disasm8051::Disasm8051()
+	: m_target(0), m_generation(0)
+{
+}
+
+void Disasm8051::disassemble( Target *target, ADDR start, ADDR end,
+							  INST_VEC &insts )
+{
+	if( target!=m_target || target->code_generation()!=m_generation )
+	{
+		m_cache.clear();
+		m_target = target;
+		m_generation = target->code_generation();
+	}
+	insts.clear();
+	if( start<0 || start>0xffff || end<start )
+		return;
+	if( end>0xffff )
+		end = 0xffff;
+
+	vector<uint8_t> code;	// start to end, filled on the first miss
+	ADDR pc = start;
+	while( pc<=end )
+	{
+		INST_MAP::iterator it = m_cache.find( pc );
+		if( it==m_cache.end() )
+		{
+			if( code.empty() )
+			{
+				// erased flash past the end of memory, and room for the
+				// operands of an instruction starting at end
+				code.assign( end-start+1+Inst8051::MAX_LENGTH, 0xff );
+				int len = end-start+Inst8051::MAX_LENGTH;
+				if( start+len>0x10000 )
+					len = 0x10000-start;
+				target->read_code_cache( start, len, &code[0] );
+			}
+			INST inst;
+			inst.addr = pc;
+			inst.len = decode( pc, &code[pc-start], inst.text, &inst.dest );
+			memcpy( inst.bytes, &code[pc-start], inst.len );
+			it = m_cache.insert( make_pair( pc, inst ) ).first;
+		}
+		insts.push_back( (*it).second );
+		pc += (*it).second.len;
+	}
+}
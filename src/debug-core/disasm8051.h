@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef DISASM8051_H
+#define DISASM8051_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "types.h"
+#include "inst8051.h"
+
+class Target;
+
+/**	8051 disassembler.
+	Decodes from a 256 entry opcode table giving the mnemonic, length and
+	operand kinds.  Standard 8051 SFRs are shown by name.
+
+	disassemble() keeps the decoded instructions per address so showing the
+	same code again costs nothing, they are dropped when the target's CODE
+	shadow is invalidated.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Disasm8051
+{
+public:
+	typedef struct
+	{
+		ADDR		addr;
+		int			len;
+		uint8_t		bytes[Inst8051::MAX_LENGTH];
+		std::string	text;		///< eg "mov\ta,#0x01"
+		ADDR		dest;		///< jump / call destination, -1 if none
+	} INST;
+	typedef std::vector<INST> INST_VEC;
+
+	Disasm8051();
+
+	/** Decode one instruction.
+		\param pc		address of the instruction, for relative targets
+		\param code		the instruction bytes, at least Inst8051::MAX_LENGTH
+		\param[out] text	the instruction in assembler syntax
+		\param[out] dest	if not 0, receives the address an ADDR16, ADDR11
+						or REL operand goes to, -1 if there is none
+		\returns the length of the instruction in bytes.
+	*/
+	static int decode( ADDR pc, const uint8_t *code, std::string &text,
+					   ADDR *dest=0 );
+
+	/** \returns the standard 8051 / 8052 name of an SFR, 0 if it has none.
+	*/
+	static const char *sfr_name( uint8_t addr );
+
+	/** Disassemble the instructions that start from start up to and
+		including end.  Code is read through Target::read_code_cache() with
+		at most one call, and only if some instruction isn't cached yet.
+		\param[out] insts	the instructions, in address order
+	*/
+	void disassemble( Target *target, ADDR start, ADDR end, INST_VEC &insts );
+
+	/// Forget all decoded instructions.
+	void invalidate()					{ m_cache.clear(); }
+
+protected:
+	typedef std::map<ADDR,INST> INST_MAP;
+	INST_MAP	m_cache;
+	Target		*m_target;			///< target the cache was filled from
+	uint32_t	m_generation;		///< its code_generation() at the time
+};
+
+#endif
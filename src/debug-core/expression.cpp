@@ -0,0 +1,262 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <iostream>
+#include <stdlib.h>
+#include <ctype.h>
+#include "expression.h"
+#include "symtab.h"
+#include "symtypetree.h"
+#include "memremap.h"
+#include "outformat.h"
+
+using namespace std;
+
+Expression::Expression( DbgSession *session )
+	: mSession(session), m_valid(false),
+	  m_addr(MemRemap::INVALID_FLAT_ADDR), m_type(0)
+{
+}
+
+
+Expression::~Expression()
+{
+}
+
+
+bool Expression::fail( string msg )
+{
+	m_error = msg;
+	m_valid = false;
+	return false;
+}
+
+
+/** Scan an identifier starting at pos.
+	\returns the identifier, empty if there isn't one at pos.
+*/
+static string scan_ident( const string &expr, size_t &pos )
+{
+	size_t start = pos;
+	if( pos<expr.length() && (isalpha(expr[pos]) || expr[pos]=='_') )
+	{
+		while( pos<expr.length() && (isalnum(expr[pos]) || expr[pos]=='_') )
+			pos++;
+	}
+	return expr.substr( start, pos-start );
+}
+
+
+static void skip_space( const string &expr, size_t &pos )
+{
+	while( pos<expr.length() && isspace(expr[pos]) )
+		pos++;
+}
+
+
+bool Expression::compile( string expr, ContextMgr::Context context )
+{
+	size_t pos = 0;
+	SymTab::SYMLIST::iterator sym;
+
+	m_expr = expr;
+	m_valid = false;
+	m_error = "";
+	m_dims.clear();
+
+	skip_space( expr, pos );
+	string name = scan_ident( expr, pos );
+	if( name.empty() )
+		return fail( "A syntax error in expression, near `" +
+					 expr.substr(pos) + "'." );
+	if( !mSession->symtab()->getSymbol( name, context, sym ) )
+		return fail( "No symbol \"" + name + "\" in current context." );
+	m_addr = sym->flat_start_addr();
+	if( m_addr==MemRemap::INVALID_FLAT_ADDR )
+		return fail( "Symbol \"" + name + "\" has no data address." );
+	m_type = mSession->symtree()->get_type( sym->type(), context );
+	if( !m_type )
+		return fail( "No type \"" + sym->type() + "\" for symbol \"" +
+					 name + "\"." );
+	m_dims = sym->array_dims();
+
+	// walk the array indexes and members, moving the address along
+	while( true )
+	{
+		skip_space( expr, pos );
+		if( pos>=expr.length() )
+			break;
+		if( expr[pos]=='[' )
+		{
+			char *endptr;
+			pos++;
+			skip_space( expr, pos );
+			uint32_t index = strtoul( expr.c_str()+pos, &endptr, 0 );
+			if( endptr==expr.c_str()+pos )
+			{
+				if( !scan_ident( expr, pos ).empty() )
+					return fail( "SORRY: index by lookup of another symbol is not supported yet" );
+				return fail( "A syntax error in expression, near `" +
+							 expr.substr(pos) + "'." );
+			}
+			pos = endptr - expr.c_str();
+			skip_space( expr, pos );
+			if( pos>=expr.length() || expr[pos]!=']' )
+				return fail( "A syntax error in expression, near `" +
+							 expr.substr(pos) + "'." );
+			pos++;
+			if( m_dims.empty() )
+				return fail( "cannot subscript something of type `" +
+							 m_type->name() + "'" );
+			// the read that follows is sized from the dimensions left
+			if( index>=m_dims[0] )
+				return fail( "no such vector element" );
+			// step over whole elements of the remaining dimensions
+			uint32_t stride = m_type->size();
+			for( int i=1; i<m_dims.size(); i++ )
+				stride *= m_dims[i];
+			m_addr += index * stride;
+			m_dims.erase( m_dims.begin() );
+		}
+		else if( expr[pos]=='.' )
+		{
+			uint32_t offset;
+			uint16_t count;
+			SymType *member_type;
+			pos++;
+			skip_space( expr, pos );
+			string member = scan_ident( expr, pos );
+			if( member.empty() )
+				return fail( "A syntax error in expression, near `" +
+							 expr.substr(pos) + "'." );
+			if( !m_dims.empty() || m_type->terminal() )
+				return fail( "Attempt to extract a component of a value that is not a structure." );
+			if( !m_type->member( member, offset, member_type, count ) )
+				return fail( "There is no member named " + member + "." );
+			m_addr += offset;
+			m_type = member_type;
+			if( count!=1 )
+				m_dims.push_back( count );
+		}
+		else
+			return fail( "A syntax error in expression, near `" +
+						 expr.substr(pos) + "'." );
+	}
+	m_valid = true;
+	return true;
+}
+
+
+/** Number of bytes the value occupies in target memory.
+*/
+uint32_t Expression::length()
+{
+	if( !m_type )
+		return 0;
+	uint32_t len = m_type->size();
+	for( int i=0; i<m_dims.size(); i++ )
+		len *= m_dims[i];
+	return len;
+}
+
+
+void Expression::print( char format )
+{
+	if( !m_valid )
+	{
+		cout << m_error << endl;
+		return;
+	}
+	// one transfer for the whole value, the types format from the host copy
+	mSession->symtree()->prefetch( m_addr, length() );
+	cout << m_expr << " = " << value( format ) << endl;
+	mSession->symtree()->end_prefetch();
+}
+
+
+string Expression::value( char format )
+{
+	FLAT_ADDR addr = m_addr;
+	if( !m_valid )
+		return m_error;
+	if( m_dims.empty() )
+		return m_type->pretty_print( format, "", addr );
+	return print_array( format, 0, addr );
+}
+
+
+/** Recursive function to print out an complete arrays contents.
+	addr is left just past the part printed.
+*/
+string Expression::print_array( char format, int dim_num, FLAT_ADDR &addr )
+{
+	string s;
+	if( dim_num == (m_dims.size()-1) )
+	{
+		// deapest, print elements
+		// special case default format with char array
+		bool str = format==0 && (m_type->name()=="char" ||
+								 m_type->name()=="unsigned char");
+		if( m_type->scalar() && (str || format!='s') )
+		{
+			// the whole row straight from one read into one string
+			OutFormat of( mSession );
+			char fmt = str ? 's' : format==0 ? m_type->default_format() : format;
+			if( of.print_array( fmt, addr, m_type->size(), m_dims[dim_num], s ) )
+			{
+				addr += m_type->size() * m_dims[dim_num];
+				return s;
+			}
+		}
+		if( str )
+		{
+			s += '"';
+			for( int i=0; i<m_dims[dim_num]; i++ )
+			{
+				s += m_type->pretty_print( 's', "", addr );
+				addr += m_type->size();
+			}
+			s += '"';
+		}
+		else
+		{
+			s += '{';
+			for( int i=0; i<m_dims[dim_num]; i++ )
+			{
+				if( i>0 )
+					s += ',';
+				s += m_type->pretty_print( format, "", addr );
+				addr += m_type->size();
+			}
+			s += '}';
+		}
+	}
+	else
+	{
+		s += '{';
+		for( int i=0; i<m_dims[dim_num]; i++ )
+		{
+			if( i>0 )
+				s += ',';
+			s += print_array( format, dim_num+1, addr );
+		}
+		s += '}';
+	}
+	return s;
+}
@@ -0,0 +1,86 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "types.h"
+#include "dbgsession.h"
+#include "contextmgr.h"
+
+class SymType;
+
+/**	A print / display expression compiled into an access plan.
+	Supports a symbol followed by any number of constant array indexes and
+	structure members, eg cfg.ports[2].mode.
+	compile() resolves the symbol, types and offsets once; afterwards
+	print() only has to read the range the value occupies, in one transfer.
+
+	Plans hold pointers into the type tree and are only valid until the
+	symbols are next loaded, use SymTab::get_expression() to get a cached
+	plan rather than compiling one directly.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Expression
+{
+public:
+	Expression( DbgSession *session );
+	~Expression();
+
+	/** Parse expr and resolve it in context.
+		\returns true on success, otherwise false and error() says why.
+	*/
+	bool compile( std::string expr, ContextMgr::Context context );
+
+	/** Read the value from the target and print it as "expr = value".
+		\param format	GDB print format character, 0 for the type's default.
+	*/
+	void print( char format );
+
+	/** Format the value without the "expr = " prefix.
+		Memory is read through SymTypeTree::read_memory(), so the caller can
+		prefetch the ranges of several expressions first.
+		\returns the formatted value, or the error if the plan isn't valid.
+	*/
+	std::string value( char format );
+
+	bool		valid()				{ return m_valid; }
+	std::string	error()				{ return m_error; }
+	std::string	text()				{ return m_expr; }
+	FLAT_ADDR	addr()				{ return m_addr; }
+	uint32_t	length();
+	SymType		*type()				{ return m_type; }
+
+protected:
+	DbgSession				*mSession;
+	std::string				m_expr;
+	bool					m_valid;
+	std::string				m_error;
+	FLAT_ADDR				m_addr;		///< start of the value
+	SymType					*m_type;	///< element type
+	std::vector<uint16_t>	m_dims;		///< array dimensions not yet indexed
+
+	bool fail( std::string msg );
+	std::string print_array( char format, int dim_num, FLAT_ADDR &addr );
+};
+
+#endif
@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "inst8051.h"
+
+/// instruction length indexed by opcode
+static const uint8_t inst_len[256] =
+{
+//	 0 1 2 3 4 5 6 7 8 9 A B C D E F
+	 1,2,3,1,1,2,1,1,1,1,1,1,1,1,1,1,	// 0x00
+	 3,2,3,1,1,2,1,1,1,1,1,1,1,1,1,1,	// 0x10
+	 3,2,1,1,2,2,1,1,1,1,1,1,1,1,1,1,	// 0x20
+	 3,2,1,1,2,2,1,1,1,1,1,1,1,1,1,1,	// 0x30
+	 2,2,2,3,2,2,1,1,1,1,1,1,1,1,1,1,	// 0x40
+	 2,2,2,3,2,2,1,1,1,1,1,1,1,1,1,1,	// 0x50
+	 2,2,2,3,2,2,1,1,1,1,1,1,1,1,1,1,	// 0x60
+	 2,2,2,1,2,3,2,2,2,2,2,2,2,2,2,2,	// 0x70
+	 2,2,2,1,1,3,2,2,2,2,2,2,2,2,2,2,	// 0x80
+	 3,2,2,1,2,2,1,1,1,1,1,1,1,1,1,1,	// 0x90
+	 2,2,2,1,1,1,2,2,2,2,2,2,2,2,2,2,	// 0xA0
+	 2,2,2,1,3,3,3,3,3,3,3,3,3,3,3,3,	// 0xB0
+	 2,2,2,1,1,2,1,1,1,1,1,1,1,1,1,1,	// 0xC0
+	 2,2,2,1,1,3,1,1,2,2,2,2,2,2,2,2,	// 0xD0
+	 1,2,1,1,1,2,1,1,1,1,1,1,1,1,1,1,	// 0xE0
+	 1,2,1,1,1,2,1,1,1,1,1,1,1,1,1,1		// 0xF0
+};
+
+
+int Inst8051::length( uint8_t opcode )
+{
+	return inst_len[opcode];
+}
+
+
+/** Destination of a relative branch whose offset is the last byte of the
+	instruction.
+*/
+static ADDR rel_target( ADDR pc, const uint8_t *code, int len )
+{
+	return ( pc + len + int8_t(code[len-1]) ) & 0xffff;
+}
+
+
+Inst8051::FLOW Inst8051::decode( ADDR pc, const uint8_t *code, int &len,
+								 ADDR &target )
+{
+	uint8_t op = code[0];
+	len = inst_len[op];
+	target = 0;
+
+	if( (op&0x1f)==0x01 || (op&0x1f)==0x11 )
+	{
+		// AJMP / ACALL, 11 bit address within the current 2K page
+		target = ((pc+2) & 0xf800) | ((op&0xe0)<<3) | code[1];
+		return (op&0x10) ? FLOW_CALL : FLOW_JUMP;
+	}
+	switch( op )
+	{
+		case 0x02:	// LJMP
+			target = (code[1]<<8) | code[2];
+			return FLOW_JUMP;
+		case 0x12:	// LCALL
+			target = (code[1]<<8) | code[2];
+			return FLOW_CALL;
+		case 0x22:	// RET
+		case 0x32:	// RETI
+			return FLOW_RET;
+		case 0x73:	// JMP @A+DPTR
+			return FLOW_INDIRECT;
+		case 0x80:	// SJMP
+			target = rel_target( pc, code, len );
+			return FLOW_JUMP;
+		case 0x10:	// JBC
+		case 0x20:	// JB
+		case 0x30:	// JNB
+		case 0x40:	// JC
+		case 0x50:	// JNC
+		case 0x60:	// JZ
+		case 0x70:	// JNZ
+		case 0xd5:	// DJNZ dir
+			target = rel_target( pc, code, len );
+			return FLOW_BRANCH;
+	}
+	if( (op>=0xb4 && op<=0xbf) ||	// CJNE
+		(op>=0xd8 && op<=0xdf) )	// DJNZ Rn
+	{
+		target = rel_target( pc, code, len );
+		return FLOW_BRANCH;
+	}
+	return FLOW_NEXT;
+}
@@ -0,0 +1,61 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef INST8051_H
+#define INST8051_H
+#include <stdint.h>
+#include "types.h"
+
+/**	Length and control flow of 8051 instructions.
+	Just enough decoding to work out where execution can go from a piece of
+	code, as needed to plan range stepping with breakpoints.  This is not a
+	disassembler.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Inst8051
+{
+public:
+	typedef enum
+	{
+		FLOW_NEXT,		///< always continues with the following instruction
+		FLOW_JUMP,		///< always continues at target
+		FLOW_BRANCH,	///< continues at target or the following instruction
+		FLOW_CALL,		///< calls target, returns to the following instruction
+		FLOW_RET,		///< RET / RETI, continues at the address on the stack
+		FLOW_INDIRECT	///< JMP @A+DPTR, destination unknown until run
+	} FLOW;
+
+	enum { MAX_LENGTH = 3 };	///< longest instruction in bytes
+
+	/** \returns the length in bytes of the instruction starting with opcode.
+	*/
+	static int length( uint8_t opcode );
+
+	/** Decode one instruction.
+		\param pc		address of the instruction
+		\param code		the instruction bytes, at least MAX_LENGTH available
+		\param[out] len		length of the instruction
+		\param[out] target	destination for FLOW_JUMP, FLOW_BRANCH and FLOW_CALL
+		\returns how the instruction affects the flow of execution.
+	*/
+	static FLOW decode( ADDR pc, const uint8_t *code, int &len, ADDR &target );
+};
+
+#endif
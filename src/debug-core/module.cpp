@@ -20,10 +20,131 @@
 #include <assert.h>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "types.h"
 #include "module.h"
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Source files
+///////////////////////////////////////////////////////////////////////////////
+
+SrcFile::SrcFile()
+	: m_map(0), m_size(0), m_indexed(false)
+{
+}
+
+/** Copies only take the path, they map the file again if they need it.
+*/
+SrcFile::SrcFile( const SrcFile &other )
+	: m_path(other.m_path), m_map(0), m_size(0), m_indexed(false)
+{
+}
+
+SrcFile::~SrcFile()
+{
+	unload();
+}
+
+SrcFile &SrcFile::operator=( const SrcFile &other )
+{
+	if( this!=&other )
+		set_path( other.m_path );
+	return *this;
+}
+
+void SrcFile::set_path( const string &path )
+{
+	unload();
+	m_path = path;
+}
+
+void SrcFile::unload()
+{
+	if( m_map )
+		munmap( (void*)m_map, m_size );
+	m_map = 0;
+	m_size = 0;
+	m_indexed = false;
+	m_offsets.clear();
+}
+
+/** Map the file and index its lines, only the first call does any work.
+	\returns true if the file is available.
+*/
+bool SrcFile::load()
+{
+	struct stat st;
+	const char *p, *end;
+	int fd;
+	
+	if( m_indexed )
+		return m_map!=0;
+	m_indexed = true;
+	if( m_path.empty() )
+		return false;
+	fd = open( m_path.c_str(), O_RDONLY );
+	if( fd<0 )
+		return false;
+	if( fstat( fd, &st )==0 && st.st_size>0 )
+	{
+		m_map = (const char*)mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if( m_map==MAP_FAILED )
+			m_map = 0;
+		else
+			m_size = st.st_size;
+	}
+	close( fd );
+	if( !m_map )
+		return false;
+	
+	p = m_map;
+	end = m_map + m_size;
+	while( p<end )
+	{
+		m_offsets.push_back( p-m_map );
+		p = (const char*)memchr( p, '\n', end-p );
+		if( !p )
+			break;
+		p++;
+	}
+	return true;
+}
+
+uint32_t SrcFile::num_lines()
+{
+	load();
+	return m_offsets.size();
+}
+
+const char *SrcFile::line( LINE_NUM line, size_t &len )
+{
+	size_t start, end;
+	load();
+	if( line<1 || line>m_offsets.size() )
+	{
+		len = 0;
+		return 0;
+	}
+	start = m_offsets[line-1];
+	end = line<m_offsets.size() ? m_offsets[line] : m_size;
+	while( end>start && (m_map[end-1]=='\n' || m_map[end-1]=='\r') )
+		end--;
+	len = end-start;
+	return m_map+start;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Module
+///////////////////////////////////////////////////////////////////////////////
+
+
 Module::Module()
 {
 	reset();
@@ -50,7 +171,7 @@ bool Module::load_c_file( string path )
 {
 	c_file_path = path;
 	c_file_name = path.substr( path.rfind('/')+1 );
-	return load_file( path, c_src );
+	return load_file( path, c_file );
 }
 
 /** Load the asm file of the module.
@@ -61,46 +182,50 @@ bool Module::load_asm_file( string path )
 {
 	asm_file_path = path;
 	asm_file_name = path.substr( path.rfind('/')+1 );
-	return load_file( path, asm_src );
+	return load_file( path, asm_file );
 }
 
-/** Load either a c or asm file into the moduel definition.
-	The internal vector will have entries modified as necessary,  it may already
-	have entires for each line if they were setup as the symbol table is loaded
-	if that occurs first.
+/** Attach either a c or asm file to the module.
+	Nothing is read yet, the file is mapped the first time its text or
+	length is needed.
 
 	\param path The path/filename of the file to load.
-	\param srcvec	The vector to recieve the file.
+	\param file	The source file to attach it to.
 	\returns true on success, false on failure
 */
-bool Module::load_file( string path, SrcVec &srcvec )
+bool Module::load_file( string path, SrcFile &file )
 {
-	uint16_t	MAX_LINE_LEN = 4096;
-	char		buf[MAX_LINE_LEN];
-	ifstream	file;
-	SrcLine		src_line;
-	uint32_t i;
-	i=1;
-
-	file.open( path.c_str(), ios::in );
-	if(file)
-	{
-		while( !file.eof() )
-		{
-			file.getline( buf, MAX_LINE_LEN );
-			if( i > (srcvec.size()) )
-				srcvec.resize( i+1 );
-			srcvec[i-1].src = buf;
-			i++;
-		}
-		file.close();
-		return true;
-	}
-	else
+	file.set_path( path );
+	if( access( path.c_str(), R_OK )!=0 )
 	{
 		cout << "ERROR: couldent open \"" << path << "\"" << endl;
 		return false;
 	}
+	return true;
+}
+
+uint32_t Module::get_c_num_lines()
+{
+	return max( uint32_t(c_src.size()), c_file.num_lines() );
+}
+
+uint32_t Module::get_asm_num_lines()
+{
+	return max( uint32_t(asm_src.size()), asm_file.num_lines() );
+}
+
+string Module::get_c_src( LINE_NUM line )
+{
+	size_t len;
+	const char *p = c_file.line( line, len );
+	return p ? string( p, len ) : string();
+}
+
+string Module::get_asm_src( LINE_NUM line )
+{
+	size_t len;
+	const char *p = asm_file.line( line, len );
+	return p ? string( p, len ) : string();
 }
 
 
@@ -138,11 +263,13 @@ void Module::reset()
 	c_file_path.clear();
 	c_src.clear();
 	c_addr_map.clear();
+	c_file.set_path( "" );
 	
 	asm_file_name.clear();
 	asm_file_path.clear();
 	asm_src.clear();
 	asm_addr_map.clear();
+	asm_file.set_path( "" );
 }
 
 
@@ -182,33 +309,46 @@ void Module::set_asm_addr( LINE_NUM line, ADDR addr )
 
 void Module::dump()
 {
-	SrcVec::iterator it;
-	for( it=c_src.begin(); it!=c_src.end(); ++it )
+	LINE_NUM i, n;
+	ADDR a;
+	size_t len;
+	const char *p;
+	n = get_c_num_lines();
+	for( i=1; i<=n; i++ )
 	{
-		ADDR a = (*it).addr;
+		a = get_c_addr( i );
+		if( !(p = c_file.line( i, len )) )
+			p = "";
 		if(a==-1)
-			printf("\t\t[%s]\n",(*it).src.c_str());
+			printf("\t\t[%.*s]\n",(int)len,p);
 		else
-			printf("0x%08x\t[%s]\n",(*it).addr,(*it).src.c_str());
+			printf("0x%08x\t[%.*s]\n",a,(int)len,p);
 	}
-	for( it=asm_src.begin(); it!=asm_src.end(); ++it )
+	n = get_asm_num_lines();
+	for( i=1; i<=n; i++ )
 	{
-		ADDR a = (*it).addr;
+		a = get_asm_addr( i );
+		if( !(p = asm_file.line( i, len )) )
+			p = "";
 		if(a==-1)
-			printf("\t\t[%s]\n",(*it).src.c_str());
+			printf("\t\t[%.*s]\n",(int)len,p);
 		else
-			printf("0x%08x\t[%s]\n",(*it).addr,(*it).src.c_str());
+			printf("0x%08x\t[%.*s]\n",a,(int)len,p);
 	}
 
 }
 
 ADDR Module::get_c_addr( LINE_NUM line )
 {
+	if( line<1 || line>c_src.size() )
+		return -1;
 	return c_src[line-1].addr;
 }
 
 ADDR Module::get_asm_addr( LINE_NUM line )
 {
+	if( line<1 || line>asm_src.size() )
+		return -1;
 	return asm_src[line-1].addr;
 }
 
@@ -241,6 +381,7 @@ LINE_NUM Module::get_asm_line( ADDR addr )
 ///////////////////////////////////////////////////////////////////////////////
 
 ModuleMgr::ModuleMgr()
+	: m_index_valid(false)
 {
 }
 
@@ -251,23 +392,42 @@ ModuleMgr::~ModuleMgr()
 void ModuleMgr::reset()
 {
 	mMap.clear();
+	m_addr_index.clear();
+	m_index_valid = false;
+	m_loaded_from.clear();
+	m_stamps.clear();
 }
 
 Module &ModuleMgr::add_module( string mod_name )
+{
+	// the caller is about to add lines
+	m_index_valid = false;
+	return module( mod_name );
+}
+
+Module &ModuleMgr::module( string mod_name )
 {
 	ModMap::iterator it;
 	it = mMap.find( mod_name );
 	if( it==mMap.end() )
 	{
 		// add new entry.
-		mMap[mod_name].set_name( mod_name );
+		it = mMap.insert( ModMap::value_type( mod_name, Module() ) ).first;
+		it->second.set_name( mod_name );
 	}
-	return mMap[mod_name];
+	return it->second;
+}
+
+Module *ModuleMgr::find_module( string mod_name )
+{
+	ModMap::iterator it = mMap.find( mod_name );
+	return it==mMap.end() ? 0 : &it->second;
 }
 
 bool ModuleMgr::del_module( string mod_name )
 {
-	mMap.erase( mod_name );
+	m_index_valid = false;
+	return mMap.erase( mod_name )>0;
 }
 
 
@@ -294,42 +454,101 @@ const void ModuleMgr::dump()
 }
 
 
-/** scan all modules looking for the speciifed address.
-	\param[in]	addr	Address to search for.
-	\param[out] module	Receives the module name.
-	\param[out]	line	Received the line number
-	\returns true on success, false on filure (not found)
+/** Merge the line start addresses of every module into one sorted index,
+	where two modules claim an address the first by name wins, as the
+	lookups always did.
 */
-bool ModuleMgr::get_asm_addr( ADDR addr, string &module, LINE_NUM &line )
+void ModuleMgr::build_index()
 {
 	ModMap::iterator it;
-	
-	// for each module
+	Module::AddrMap::iterator ait;
+	vector<ADDR_LINE> ents;
+	ADDR_LINE ent;
+
 	for( it=mMap.begin(); it!=mMap.end(); ++it )
 	{
-		line = (*it).second.get_asm_line(addr);
-		if( line != LINE_INVALID )
+		Module &m = it->second;
+		ent.asm_module = 0;
+		ent.asm_line = LINE_INVALID;
+		ent.c_module = &m;
+		for( ait=m.c_addr_map.begin(); ait!=m.c_addr_map.end(); ++ait )
 		{
-			module = (*it).second.get_name();
-			return true;
+			ent.addr = ait->first;
+			ent.c_line = ait->second;
+			ents.push_back( ent );
+		}
+		ent.c_module = 0;
+		ent.c_line = LINE_INVALID;
+		ent.asm_module = &m;
+		for( ait=m.asm_addr_map.begin(); ait!=m.asm_addr_map.end(); ++ait )
+		{
+			ent.addr = ait->first;
+			ent.asm_line = ait->second;
+			ents.push_back( ent );
 		}
 	}
-	return false;
-}
+	stable_sort( ents.begin(), ents.end(), addr_less );
 
-bool ModuleMgr::get_c_addr( ADDR addr, string &module, LINE_NUM &line )
-{
-	ModMap::iterator it;
-	
-	// for each module
-	for( it=mMap.begin(); it!=mMap.end(); ++it )
+	m_addr_index.clear();
+	for( size_t i=0; i<ents.size(); i++ )
 	{
-		line = (*it).second.get_c_line(addr);
-		if( line != LINE_INVALID )
+		if( m_addr_index.empty() || m_addr_index.back().addr!=ents[i].addr )
+		{
+			m_addr_index.push_back( ents[i] );
+			continue;
+		}
+		ADDR_LINE &cur = m_addr_index.back();
+		if( !cur.c_module && ents[i].c_module )
+		{
+			cur.c_module = ents[i].c_module;
+			cur.c_line = ents[i].c_line;
+		}
+		if( !cur.asm_module && ents[i].asm_module )
 		{
-			module = (*it).second.get_name();
-			return true;
+			cur.asm_module = ents[i].asm_module;
+			cur.asm_line = ents[i].asm_line;
 		}
 	}
-	return false;
+	m_index_valid = true;
+}
+
+const ModuleMgr::ADDR_LINE *ModuleMgr::find_addr( ADDR addr )
+{
+	if( !m_index_valid )
+		build_index();
+	ADDR_LINE key;
+	key.addr = addr;
+	ADDR_INDEX::iterator it = lower_bound( m_addr_index.begin(),
+										   m_addr_index.end(), key, addr_less );
+	if( it==m_addr_index.end() || it->addr!=addr )
+		return 0;
+	return &*it;
+}
+
+/** Find the asm line starting at an address.
+	\param[in]	addr	Address to search for.
+	\param[out] module	Receives the module name.
+	\param[out]	line	Received the line number
+	\returns true on success, false on filure (not found)
+*/
+bool ModuleMgr::get_asm_addr( ADDR addr, string &module, LINE_NUM &line )
+{
+	const ADDR_LINE *ent = find_addr( addr );
+	line = LINE_INVALID;
+	if( !ent || !ent->asm_module )
+		return false;
+	module = ent->asm_module->get_name();
+	line = ent->asm_line;
+	return true;
+}
+
+bool ModuleMgr::get_c_addr( ADDR addr, string &module, LINE_NUM &line )
+{
+	const ADDR_LINE *ent = find_addr( addr );
+	line = LINE_INVALID;
+	if( !ent || !ent->c_module )
+		return false;
+	module = ent->c_module->get_name();
+	line = ent->c_line;
+	return true;
 }
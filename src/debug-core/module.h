@@ -25,6 +25,45 @@
 #include "types.h"
 using namespace std;
 
+/** A source file that is only read once something needs its text.
+	The file is mapped on first access and the offset of each line found
+	then, lines are returned as pointers into the mapping.
+*/
+class SrcFile
+{
+public:
+	SrcFile();
+	SrcFile( const SrcFile &other );
+	~SrcFile();
+	SrcFile &operator=( const SrcFile &other );
+	
+	void set_path( const string &path );
+	const string &path()		{ return m_path; }
+	
+	/** Number of lines in the file, 0 if it can't be read.
+	*/
+	uint32_t num_lines();
+	
+	/** Get the text of a line, without the line ending.
+		\param line		line number, starting from 1
+		\param[out] len	length of the text
+		\returns pointer to the text, valid until the path changes or the
+				 object is destroyed, 0 if there is no such line.
+	*/
+	const char *line( LINE_NUM line, size_t &len );
+	
+protected:
+	string				m_path;
+	const char			*m_map;
+	size_t				m_size;
+	bool				m_indexed;	///< set once we have tried to load m_path
+	vector<uint32_t>	m_offsets;	///< start of each line in m_map
+	
+	bool load();
+	void unload();
+};
+
+
 /**
 Holds all information about a single module
 
@@ -32,6 +71,8 @@ Holds all information about a single module
 */
 class Module
 {
+	friend class SymCache;
+	friend class ModuleMgr;
 public:
 	class SrcLine
 	{
@@ -39,7 +80,6 @@ public:
 		SrcLine()	{ addr = -1; block=0; level=0; }
 		ADDR addr;
 		uint32_t block, level;	// scope information
-		string src;				// actual source line
 	};
 	
 	Module();
@@ -71,9 +111,14 @@ public:
 	const string &get_c_file_name()		{ return c_file_name; }
 	const string &get_asm_file_path()	{ return asm_file_path; }
 	const string &get_asm_file_name()	{ return asm_file_name; }
-	uint32_t get_c_num_lines()			{ return c_src.size(); }
-	uint32_t get_asm_num_lines()		{ return asm_src.size(); }
-	string get_asm_src( LINE_NUM line )	{ return asm_src[line-1].src; }
+	uint32_t get_c_num_lines();
+	uint32_t get_asm_num_lines();
+	string get_c_src( LINE_NUM line );
+	string get_asm_src( LINE_NUM line );
+	const char *get_c_src( LINE_NUM line, size_t &len )
+										{ return c_file.line( line, len ); }
+	const char *get_asm_src( LINE_NUM line, size_t &len )
+										{ return asm_file.line( line, len ); }
 	
 protected:
 	typedef vector<SrcLine> SrcVec;
@@ -82,15 +127,17 @@ protected:
 	string		module_name;
 	string		c_file_name;
 	string		c_file_path;
-	SrcVec		c_src;
+	SrcVec		c_src;			///< address / scope of each line
 	AddrMap		c_addr_map;
+	SrcFile		c_file;
 
 	string		asm_file_name;
 	string		asm_file_path;
 	SrcVec		asm_src;
 	AddrMap		asm_addr_map;
+	SrcFile		asm_file;
 	
-	bool load_file( string path, SrcVec &srcvec );
+	bool load_file( string path, SrcFile &file );
 
 
 #if 0
@@ -116,21 +163,69 @@ protected:
 */
 class ModuleMgr
 {
+	friend class SymCache;
 public:
 	ModuleMgr();
 	~ModuleMgr();
 	void reset();
+	/** Get a module, creating it if need be, to add lines to.
+	*/
 	Module &add_module( string mod_name );
-	Module &module( string mod_name )	{ return add_module(mod_name ); }	// fixme need a variant of this that won't create new entries as this quick hack does.
+	Module &module( string mod_name );	// fixme need a variant of this that won't create new entries as this quick hack does.
+	/** \returns the module, 0 if there is none of that name.
+	*/
+	Module *find_module( string mod_name );
 	bool del_module( string mod_name );
 	const void dump();
 	bool get_asm_addr( ADDR addr, string &module, LINE_NUM &line );
 	bool get_c_addr( ADDR addr, string &module, LINE_NUM &line );
 	
+	/// Where an address is in the source, see find_addr().
+	typedef struct
+	{
+		ADDR		addr;
+		Module		*c_module;		///< 0 if no C line starts here
+		LINE_NUM	c_line;
+		Module		*asm_module;	///< 0 if no asm line starts here
+		LINE_NUM	asm_line;
+	} ADDR_LINE;
+	
+	/** Look up the C and asm lines starting at an address.
+		All modules are merged into one index sorted by address, built on
+		the first lookup after lines were added, so this is a binary search
+		whatever the number of modules.
+		\returns the entry, valid until modules are next added or removed,
+				 or 0 if no line starts at addr.
+	*/
+	const ADDR_LINE *find_addr( ADDR addr );
+	
+	/// What a module was loaded from, see CdbFile::reload()
+	typedef struct
+	{
+		uint32_t	records;	///< hash of the module's cdb records
+		uint32_t	sources;	///< hash of its source files' size and mtime
+	} LOAD_STAMP;
+	typedef map<string,LOAD_STAMP> STAMP_MAP;
+	
+	/// cdb file the modules were loaded from, empty if none
+	string &loaded_from()		{ return m_loaded_from; }
+	/// stamp of each module of loaded_from(), "" for records of none
+	STAMP_MAP &stamps()			{ return m_stamps; }
+	
 protected:
 	//void dump_module(const pair<string,Module>& pr);
 	typedef map<string,Module> ModMap;
 	ModMap mMap;
+	
+	typedef vector<ADDR_LINE> ADDR_INDEX;
+	ADDR_INDEX	m_addr_index;
+	bool		m_index_valid;	///< false once lines may have been added
+	string		m_loaded_from;
+	STAMP_MAP	m_stamps;
+	
+	void build_index();
+	static bool addr_less( const ADDR_LINE &a, const ADDR_LINE &b )
+								{ return a.addr < b.addr; }
 };
 
 #endif
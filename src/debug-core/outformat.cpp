@@ -20,9 +20,13 @@
 #include "outformat.h"
 #include <assert.h>
 #include <iostream>
-#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
 #include "memremap.h"
 #include "symtab.h"
+#include "symtypetree.h"
+#include "contextmgr.h"
 #include "target.h"
 
 using std::string;
@@ -37,111 +41,248 @@ OutFormat::~OutFormat()
 {
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Digit writers
+////////////////////////////////////////////////////////////////////////////////
+// Each writes v backwards ending just before end and returns the first
+// character written, so the caller appends [start,end) in one go.
+
+static const char digits[] = "0123456789abcdef";
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/// base 2, 8 or 16 given the number of bits per digit
+static char *put_pow2( char *end, uint32_t v, int bits )
+{
+	uint32_t mask = (1<<bits)-1;
+	do
+	{
+		*--end = digits[v & mask];
+		v >>= bits;
+	} while( v );
+	return end;
+}
+
+static char *put_dec( char *end, uint32_t v )
+{
+	uint32_t r;
+	while( v>=100 )
+	{
+		r = (v % 100) * 2;
+		v /= 100;
+		*--end = digit_pairs[r+1];
+		*--end = digit_pairs[r];
+	}
+	if( v>=10 )
+	{
+		*--end = digit_pairs[v*2+1];
+		*--end = digit_pairs[v*2];
+	}
+	else
+		*--end = '0' + v;
+	return end;
+}
+
+/// \nnn for a character outside 7 bit ASCII, octal with a leading 0 as
+/// showbase would print it.
+static void put_escape( uint32_t v, string &out )
+{
+	char buf[16], *end = buf+sizeof(buf), *p;
+	p = put_pow2( end, v, 3 );
+	if( v )
+		*--p = '0';
+	*--p = '\\';
+	out.append( p, end-p );
+}
+
+
 string OutFormat::print( char fmt, uint32_t flat_addr, uint32_t size )
 {
-	std::ostringstream out;
-	using std::endl;
-	using std::hex;
-	using std::oct;
-	uint32_t i, j;
-	bool active, flag, one;
+	uint8_t buf[4];
+	char err[64];
+	string s;
+	
+	if( size>sizeof(buf) )
+		size = sizeof(buf);		// only 32 bit values are formatted
+	if( fmt!='a' && !mSession->symtree()->read_memory( flat_addr, size, buf ) )
+	{
+		snprintf( err, sizeof(err),
+				  "<error: Cannot access memory at address 0x%x>", flat_addr );
+		return err;
+	}
+	format( fmt, buf, size, flat_addr, s );
+	return s;
+}
+
+
+void OutFormat::format( char fmt, const uint8_t *buf, uint32_t size,
+						uint32_t flat_addr, string &out )
+{
+	char tmp[40], *end = tmp+sizeof(tmp), *p;
+	uint32_t v = fmt=='a' ? 0 : get_uint( buf, size );
+	int32_t sv;
+	float f;
 	
 	switch(fmt)
 	{
 		case 'x':
-			out << showbase << hex << get_uint( flat_addr, size );
+			p = put_pow2( end, v, 4 );
+			if( v )
+			{
+				*--p = 'x';
+				*--p = '0';
+			}
+			break;
+		case 'z':
+			// hex with leading zeros padding it to the size of the value
+			p = put_pow2( end, v, 4 );
+			while( end-p < int(size*2) )
+				*--p = '0';
+			*--p = 'x';
+			*--p = '0';
+			break;
+		case 'd':
+			sv = get_int( buf, size );
+			p = put_dec( end, sv<0 ? 0u-uint32_t(sv) : uint32_t(sv) );
+			if( sv<0 )
+				*--p = '-';
+			break;
+		case 'u':
+			p = put_dec( end, v );
+			break;
+		case 'o':
+			p = put_pow2( end, v, 3 );
+			if( v )
+				*--p = '0';
 			break;
-		case 'd': out << (int32_t)get_int( flat_addr, size );			break;
-		case 'u': out << dec << get_uint( flat_addr, size );			break;
-		case 'o': out << showbase << oct << get_uint( flat_addr, size );break;
 		case 't':
 			// integer in binary. The letter `t' stands for "two"
 			// strips leading zeros
-			j = get_uint( flat_addr, size );
-			active = false;
-			for( i=0; i<size; i++ )
-			{
-				one = j & ( 1<<(size-i-1) );
-				active |= one;
-				out << ( one && active ) ? '1' : '0';
-			}
+			p = put_pow2( end, v, 1 );
 			break;
 		case 'a':
 			// Address
 			// prints the address and the nearest preceding symbol
 			// (gdb) p/a 0x54320
 			// $3 = 0x54320 <_initialize_vx+396>
-			out << hex << flat_addr;
-			out << " <"
-				<< mSession->symtab()->get_symbol_name_closest(flat_addr)
-				<< ">";	/// @FIXME add symbol information
-			break;		// Print as an address, both absolute in hexadecimal and as an offset from the nearest preceding symbol. You can use this format used to discover where (in what function) an unknown address is located:
+			p = put_pow2( end, flat_addr, 4 );
+			out.append( p, end-p );
+			out += " <";
+			out += mSession->symtab()->get_symbol_name_closest(flat_addr);
+			out += '>';		/// @FIXME add symbol information
+			return;
 		case 'c':
 			// Regard as an integer and print it as a character constant.
 			// This prints both the numerical value and its character 
 			// representation. The character representation is replaced with
 			// the octal escape `\nnn' for characters outside the 7-bit ASCII
 			// range.
-			j = get_uint( flat_addr, size );
-			out << j << " '";
-			if( j<0x20 || j>0x7e )
-			{
-				// non printable, use \nnn format
-				out << '\\' << showbase << oct << j;
-			}
+			p = put_dec( end, v );
+			out.append( p, end-p );
+			out += " '";
+			if( v<0x20 || v>0x7e )
+				put_escape( v, out );	// non printable, use \nnn format
 			else
-				out << char(j);	
-			out << "'";
-			break;	// Regard as an integer and print it as a character constant. 
+				out += char(v);
+			out += '\'';
+			return;
 		case 'f':
 			// print as floating point
-			if( size==4)
+			if( size!=4 )
 			{
-				i = get_uint( flat_addr, 4 );
-				out << *((float*)&i);
+				out += "float not supported for this data type!";
+				return;
 			}
-			else
-				out << "float not supported for this data type!";
-			break;
+			memcpy( &f, &v, sizeof(f) );
+			out.append( tmp, snprintf( tmp, sizeof(tmp), "%g", f ) );
+			return;
 		case 0:
 			// Default format specifier for type
-			out << "?";
-			break;
+			out += '?';
+			return;
 		case 's':	// newcdb specific format, string
-			j = get_uint( flat_addr, size );
-			if( (j<0x20 || j>0x7e) && j!=0 )
-				out << '\\' << showbase << oct << j; // use \nnn format
+			if( (v<0x20 || v>0x7e) && v!=0 )
+				put_escape( v, out );	// use \nnn format
 			else
-				out << char(j);	
-			break;
+				out += char(v);
+			return;
 		default:
-			out << "ERROR Unknown format specifier.";
+			out += "ERROR Unknown format specifier.";
+			return;
 	}
-	return out.str();
+	out.append( p, end-p );
 }
 
+
+void OutFormat::format_array( char fmt, const uint8_t *buf, uint32_t elem_size,
+							  uint32_t count, uint32_t flat_addr, string &out )
+{
+	bool str = fmt=='s';
+	out.reserve( out.size() + count*(elem_size*2+3) + 2 );
+	out += str ? '"' : '{';
+	for( uint32_t i=0; i<count; i++ )
+	{
+		if( !str && i>0 )
+			out += ',';
+		format( fmt, buf, elem_size, flat_addr, out );
+		buf += elem_size;
+		flat_addr += elem_size;
+	}
+	out += str ? '"' : '}';
+}
+
+
+bool OutFormat::print_array( char fmt, uint32_t flat_addr, uint32_t elem_size,
+							 uint32_t count, string &out )
+{
+	if( elem_size==0 || elem_size>4 )
+		return false;
+	std::vector<uint8_t> buf( elem_size*count );
+	if( !buf.empty() &&
+		!mSession->symtree()->read_memory( flat_addr, buf.size(), &buf[0] ) )
+		return false;
+	format_array( fmt, buf.empty() ? 0 : &buf[0], elem_size, count,
+				  flat_addr, out );
+	return true;
+}
+
+
 string OutFormat::print( char fmt, uint32_t flat_addr, string type_name )
 {
-	using std::cout;
-	/// @TODO lookup type name and begin rendering the data starting at flat_addr
-	cout << "NOT IMPLEMENTED: "
-		 << "string OutFormat::print( char fmt, uint32_t flat_addr, string "
-		 << "type_name )"
-		 << endl;
-	return "NOT IMPLEMENTED";
+	SymTypeTree *tree = mSession->symtree();
+	SymType *type = tree->get_type( type_name,
+									mSession->contextmgr()->get_current() );
+	uint32_t addr = flat_addr;
+	bool own;
+	string s;
+	
+	if( !type )
+		return "No symbol \"" + type_name + "\" in current context.";
+	// a caller formatting several objects may have fetched them all already
+	own = !tree->prefetched( flat_addr, type->size() );
+	if( own )
+		tree->prefetch( flat_addr, type->size() );
+	s = type->pretty_print( fmt, "", addr );
+	if( own )
+		tree->end_prefetch();
+	return s;
 }
 
 
-uint32_t OutFormat::get_uint( uint32_t flat_addr, char size )
+uint32_t OutFormat::get_uint( const uint8_t *buf, uint32_t size )
 {
 	uint32_t	result;
-	uint8_t		*buf = new uint8_t[size];
-	char		area;
 	int			i;
 	
-	ADDR a = MemRemap::target(flat_addr, area );
-	mSession->target()->read_data( a, size, buf );
-	
 	result = 0;
 	if( mTargetEndian==ENDIAN_LITTLE )
 	{
@@ -159,9 +300,9 @@ uint32_t OutFormat::get_uint( uint32_t flat_addr, char size )
 }
 
 
-int32_t OutFormat::get_int( uint32_t flat_addr, char size )
+int32_t OutFormat::get_int( const uint8_t *buf, uint32_t size )
 {
-	uint32_t v = get_uint( flat_addr, size );	// raw bit pattern
+	uint32_t v = get_uint( buf, size );	// raw bit pattern
 	// Sign extend
 	int32_t mask = 1 << (size*8 - 1);
 	return -(v & mask) | v;
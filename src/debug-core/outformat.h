@@ -40,36 +40,71 @@ public:
 	void set_endian( ENDIAN e );
 
 	/** Print a memory location in GDB output format as specified.
+		The value is read through SymTypeTree::read_memory() so it comes
+		from the prefetched copy when there is one.
 		\param fmt			Format character as per gdb print
 		\param flat_addr	Lowest address of object to print.
-		\param size			Number of bytes
+		\param size			Number of bytes, at most 4
 		\returns 			The formatted string.
 	*/
 	std::string print( char fmt, uint32_t flat_addr, uint32_t size );
 
 	/** print the data at the specified address  as the specified type.
+		The whole object is fetched in one transfer per memory area before
+		formatting, unless it is already prefetched.
 		\param fmt format to use when rendering the data '' results in default
 		\param flat_addr atter to starrt reading the data from.
-		\param type_name type name used to render the data.
+		\param type_name type name used to render the data, looked up in
+						 the current context.
 		\returns The formatted string containing the rendered data.
 	*/
 	std::string print( char fmt, uint32_t flat_addr, std::string type_name );
 	
+	/** Print count consecutive scalars as {v,v,...}, or as "..." for the
+		's' format.
+		The elements are read in one go and formatted straight from the
+		host copy.
+		\param fmt			Format character as per gdb print
+		\param flat_addr	Address of the first element
+		\param elem_size	Bytes per element, at most 4
+		\param count		Number of elements
+		\param[out] out		The formatted array is appended to this.
+		\returns false if the memory couldn't be read, out is unchanged.
+	*/
+	bool print_array( char fmt, uint32_t flat_addr, uint32_t elem_size,
+					  uint32_t count, std::string &out );
+	
+	/** Format a value already copied from the target.
+		\param fmt			Format character as per gdb print
+		\param buf			The value's bytes in target byte order
+		\param size			Number of bytes, at most 4
+		\param flat_addr	Where the value was read from, used by 'a'
+		\param[out] out		The formatted value is appended to this.
+	*/
+	void format( char fmt, const uint8_t *buf, uint32_t size,
+				 uint32_t flat_addr, std::string &out );
+	
+	/** Format count consecutive values already copied from the target,
+		see print_array().
+	*/
+	void format_array( char fmt, const uint8_t *buf, uint32_t elem_size,
+					   uint32_t count, uint32_t flat_addr, std::string &out );
+	
 private:
 	DbgSession	*mSession;
 	ENDIAN mTargetEndian;
 	
-	/** Read an unsigned integer from the device starting at the spcififed 
-		address.
+	/** Assemble an unsigned integer from a buffer holding a value read
+		from the target.
 		The endian flag is obayed and size is the number of bytes.
 	*/
-	uint32_t get_uint( uint32_t flat_addr, char size );
+	uint32_t get_uint( const uint8_t *buf, uint32_t size );
 	
-	/** Read an signed integer from the device starting at the spcififed 
-	address.
-	The endian flag is obayed and size is the number of bytes.
+	/** Assemble a signed integer from a buffer holding a value read
+		from the target.
+		The endian flag is obayed and size is the number of bytes.
 	 */
-	int32_t get_int( uint32_t flat_addr, char size );
+	int32_t get_int( const uint8_t *buf, uint32_t size );
 
 };
 
@@ -0,0 +1,150 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include "recorder.h"
+#include "target.h"
+#include "symtab.h"
+
+using namespace std;
+
+Recorder::Recorder( DbgSession *session, uint32_t size )
+	: mSession(session), m_buf(size)
+{
+	clear();
+}
+
+
+Recorder::~Recorder()
+{
+}
+
+
+void Recorder::clear()
+{
+	m_next = 0;
+	m_count = 0;
+	m_total = 0;
+}
+
+
+void Recorder::set_size( uint32_t size )
+{
+	m_buf.assign( size, 0 );
+	clear();
+}
+
+
+uint32_t Recorder::record( uint32_t count )
+{
+	uint16_t pcs[BATCH];
+	uint32_t done = 0;
+
+	if( m_buf.empty() )
+		return 0;
+	while( done<count )
+	{
+		int n = count-done<BATCH ? count-done : BATCH;
+		int got = mSession->target()->step_n( pcs, n );
+		append( pcs, got );
+		done += got;
+		if( got<n || mSession->target()->check_stop_forced() )
+			break;
+	}
+	return done;
+}
+
+
+void Recorder::append( uint16_t *pcs, int n )
+{
+	for( int i=0; i<n; i++ )
+	{
+		m_buf[m_next] = pcs[i];
+		if( ++m_next==m_buf.size() )
+			m_next = 0;
+	}
+	m_count = m_count+n<m_buf.size() ? m_count+n : m_buf.size();
+	m_total += n;
+}
+
+
+uint16_t Recorder::at( uint32_t i )
+{
+	return m_buf[ (m_next + m_buf.size() - m_count + i) % m_buf.size() ];
+}
+
+
+/** Format entry i as "number  address  function  file:line".
+	Each address is only looked up once per names cache.
+*/
+string Recorder::format( uint32_t i, NAME_CACHE &names )
+{
+	char buf[32];
+	ADDR addr = at(i);
+	NAME_CACHE::iterator it = names.find( addr );
+	if( it==names.end() )
+	{
+		SymTab *symtab = mSession->symtab();
+		string file, func, name;
+		LINE_NUM line;
+		ADDR start, end;
+		if( !symtab->get_c_function( addr, file, func ) )
+			func = "??";
+		name = func;
+		if( symtab->get_c_block( addr, start, end ) &&
+			symtab->find_c_file_line( start, file, line ) )
+		{
+			snprintf( buf, sizeof(buf), ":%u", line );
+			name += "  " + file + buf;
+		}
+		it = names.insert( NAME_CACHE::value_type( addr, name ) ).first;
+	}
+	snprintf( buf, sizeof(buf), "%8llu  0x%04x  ",
+			  (unsigned long long)(m_total - m_count + i), addr );
+	return buf + it->second;
+}
+
+
+void Recorder::print( uint32_t n )
+{
+	NAME_CACHE names;
+	if( m_count==0 )
+	{
+		cout << "Trace buffer is empty." << endl;
+		return;
+	}
+	if( n>m_count )
+		n = m_count;
+	for( uint32_t i=m_count-n; i<m_count; i++ )
+		cout << format( i, names ) << endl;
+}
+
+
+bool Recorder::write( string filename )
+{
+	NAME_CACHE names;
+	ofstream out( filename.c_str() );
+	if( !out )
+		return false;
+	for( uint32_t i=0; i<m_count; i++ )
+		out << format( i, names ) << endl;
+	return out.good();
+}
@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef RECORDER_H
+#define RECORDER_H
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include "types.h"
+#include "dbgsession.h"
+
+/**	Instruction trace recorder.
+	Single steps the target in batches with Target::step_n() and keeps the
+	PC after every step in a ring buffer of 16 bit entries, the oldest are
+	overwritten once it is full.  Nothing is looked up or printed while
+	recording, addresses are only turned into function and line names when
+	the trace is printed or written out.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Recorder
+{
+public:
+	enum
+	{
+		DEFAULT_SIZE	= 65536,	///< entries in the buffer unless set_size()
+		BATCH			= 256		///< steps requested from the target at once
+	};
+
+	Recorder( DbgSession *session, uint32_t size=DEFAULT_SIZE );
+	~Recorder();
+
+	/** Step count instructions recording the PC after each.
+		Breakpoints aren't checked, recording only ends early if the user
+		stops the target or a step fails.
+		\returns the number of instructions recorded.
+	*/
+	uint32_t record( uint32_t count );
+
+	void clear();
+
+	/** Change the number of entries the buffer holds, this clears it.
+	*/
+	void set_size( uint32_t size );
+
+	uint32_t size()				{ return m_buf.size(); }
+	uint32_t count()			{ return m_count; }	///< entries held
+	uint64_t total()			{ return m_total; }	///< recorded since clear()
+
+	/** \returns entry i, 0 being the oldest held.
+	*/
+	uint16_t at( uint32_t i );
+
+	/** Print the newest n entries, oldest first.
+	*/
+	void print( uint32_t n );
+
+	/** Write every entry held to a text file, one instruction per line.
+		\returns false if the file couldn't be written.
+	*/
+	bool write( std::string filename );
+
+protected:
+	typedef std::map<ADDR,std::string> NAME_CACHE;
+	DbgSession				*mSession;
+	std::vector<uint16_t>	m_buf;
+	uint32_t				m_next;		///< index the next PC is stored at
+	uint32_t				m_count;
+	uint64_t				m_total;
+
+	void append( uint16_t *pcs, int n );
+	std::string format( uint32_t i, NAME_CACHE &names );
+};
+
+#endif
@@ -0,0 +1,73 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "runmonitor.h"
+#include "target.h"
+
+RunMonitor::RunMonitor( DbgSession *session )
+	: mSession(session), mRunning(false), mHalted(false), mStop(false),
+	  mHit(false)
+{
+}
+
+
+RunMonitor::~RunMonitor()
+{
+	if( mRunning )
+	{
+		interrupt();
+		collect();
+	}
+}
+
+bool RunMonitor::start()
+{
+	if( mRunning )
+		return false;
+	mHalted = false;
+	mStop = false;
+	mSession->target()->go();
+	mRunning = true;
+	if( pthread_create( &mThread, 0, monitor, this )!=0 )
+	{
+		// no thread, wait here instead
+		mHit = mSession->target()->wait_for_halt( mStop );
+		mHalted = true;
+		mThread = pthread_self();
+	}
+	return true;
+}
+
+bool RunMonitor::collect()
+{
+	if( !mRunning )
+		return mHit;
+	if( !pthread_equal( mThread, pthread_self() ) )
+		pthread_join( mThread, 0 );
+	mRunning = false;
+	return mHit;
+}
+
+void *RunMonitor::monitor( void *arg )
+{
+	RunMonitor *m = (RunMonitor*)arg;
+	m->mHit = m->mSession->target()->wait_for_halt( m->mStop );
+	m->mHalted = true;
+	return 0;
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef RUNMONITOR_H
+#define RUNMONITOR_H
+#include <pthread.h>
+#include "dbgsession.h"
+
+/** Runs the target in the background.
+	start() sets the target running with go() and returns, a monitor thread
+	then waits in Target::wait_for_halt() which for the SiLabs target is the
+	adaptive halt poll of ec2drv.  The session may be used for anything that
+	doesn't touch the target while running() is true, breakpoint changes are
+	host side and reach the target at the next run.  Once halted() is true
+	collect() ends the run and the caller reports the stop.
+
+	Only the thread that called start() may call the other members.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class RunMonitor
+{
+public:
+	RunMonitor( DbgSession *session );
+	~RunMonitor();
+
+	/** Start the target running and return straight away.
+		\returns false if a run is already in progress.
+	*/
+	bool start();
+
+	/// true from start() until collect()
+	bool running()			{ return mRunning; }
+
+	/// true once a running target has halted, collect() won't block
+	bool halted()			{ return mRunning && mHalted; }
+
+	/** Ask the monitor to halt the target, collect() waits for it.
+	*/
+	void interrupt()		{ mStop = true; }
+
+	/** Wait for the target to halt and end the run.
+		\returns true if the target stopped by itself (eg on a breakpoint),
+				 false if it was interrupted.
+	*/
+	bool collect();
+
+protected:
+	DbgSession		*mSession;
+	pthread_t		mThread;
+	volatile bool	mRunning;
+	volatile bool	mHalted;
+	volatile bool	mStop;
+	bool			mHit;
+
+	static void *monitor( void *arg );
+};
+
+#endif
@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <stdio.h>
+#include <unistd.h>
+#include "sampler.h"
+#include "target.h"
+#include "symtab.h"
+#include "breakpointmgr.h"
+
+using namespace std;
+
+Sampler::Sampler( DbgSession *session )
+	: mSession(session), m_halted(false)
+{
+}
+
+
+Sampler::~Sampler()
+{
+}
+
+
+bool Sampler::run( uint32_t count, uint32_t interval_us )
+{
+	Target::SAMPLE_RESULT r = Target::SAMPLE_OK;
+	uint16_t pc;
+	bool last = false;
+
+	clear();
+	m_pcs.reserve( count );
+	mSession->bpmgr()->sync_target();
+	mSession->target()->go();
+	while( !last )
+	{
+		if( interval_us )
+			usleep( interval_us );
+		last = m_pcs.size()+1>=count ||
+			   mSession->target()->check_stop_forced();
+		r = mSession->target()->sample_PC( pc, !last );
+		if( r!=Target::SAMPLE_OK )
+			break;
+		m_pcs.push_back( pc );
+	}
+	m_halted = r==Target::SAMPLE_HALTED;
+	return r!=Target::SAMPLE_FAILED;
+}
+
+
+/** Count the samples by function, by line and by stack.
+	Each distinct address is looked up once.
+*/
+void Sampler::aggregate( COUNT_MAP &funcs, COUNT_MAP &lines, COUNT_MAP &stacks )
+{
+	map<ADDR,uint32_t> hits;
+	map<ADDR,uint32_t>::iterator it;
+	SymTab *symtab = mSession->symtab();
+	string file, func;
+	LINE_NUM line_num;
+	ADDR start, end;
+	char buf[16];
+
+	for( int i=0; i<m_pcs.size(); i++ )
+		hits[ m_pcs[i] ]++;
+	for( it=hits.begin(); it!=hits.end(); ++it )
+	{
+		string line;
+		if( !symtab->get_c_function( it->first, file, func ) )
+			func = "??";
+		if( symtab->get_c_block( it->first, start, end ) &&
+			symtab->find_c_file_line( start, file, line_num ) )
+		{
+			snprintf( buf, sizeof(buf), ":%u", line_num );
+			line = file + buf;
+		}
+		else
+		{
+			snprintf( buf, sizeof(buf), "0x%04x", it->first );
+			line = buf;
+		}
+		funcs[func] += it->second;
+		lines[line] += it->second;
+		stacks[func + ";" + line] += it->second;
+	}
+}
+
+
+void Sampler::print_counts( string heading, COUNT_MAP &counts )
+{
+	vector< pair<uint32_t,string> > sorted;
+	COUNT_MAP::iterator it;
+	for( it=counts.begin(); it!=counts.end(); ++it )
+		sorted.push_back( make_pair( it->second, it->first ) );
+	sort( sorted.begin(), sorted.end(),
+		  greater< pair<uint32_t,string> >() );
+
+	printf( "     %%  samples  %s\n", heading.c_str() );
+	for( int i=0; i<sorted.size(); i++ )
+	{
+		printf( "%6.2f %8u  %s\n",
+				100.0 * sorted[i].first / m_pcs.size(),
+				sorted[i].first, sorted[i].second.c_str() );
+	}
+}
+
+
+void Sampler::print_flat()
+{
+	COUNT_MAP funcs, lines, stacks;
+	if( m_pcs.empty() )
+	{
+		cout << "No samples." << endl;
+		return;
+	}
+	aggregate( funcs, lines, stacks );
+	cout << "Flat profile, " << m_pcs.size() << " samples." << endl;
+	print_counts( "function", funcs );
+	cout << endl;
+	print_counts( "line", lines );
+}
+
+
+bool Sampler::write_collapsed( string filename )
+{
+	COUNT_MAP funcs, lines, stacks;
+	COUNT_MAP::iterator it;
+	ofstream out( filename.c_str() );
+	if( !out )
+		return false;
+	aggregate( funcs, lines, stacks );
+	for( it=stacks.begin(); it!=stacks.end(); ++it )
+		out << it->first << ' ' << it->second << endl;
+	return out.good();
+}
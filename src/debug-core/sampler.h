@@ -0,0 +1,87 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef SAMPLER_H
+#define SAMPLER_H
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include "types.h"
+#include "dbgsession.h"
+
+/**	Statistical profiler.
+	Runs the target and periodically takes a PC sample with
+	Target::sample_PC().  Samples are only stored while running, symbols
+	are looked up afterwards through the SymTab address index, once for each
+	distinct address, when a report is produced.
+
+	There is no frame unwinding so the collapsed stacks are two frames deep,
+	the function and the C line within it.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Sampler
+{
+public:
+	Sampler( DbgSession *session );
+	~Sampler();
+
+	/** Run the target from the current PC, sampling it every interval_us.
+		Runs until count samples have been taken, the target stops by itself
+		or the user stops it, the target is left halted.  Previous samples
+		are discarded.
+		\param count		number of samples to take
+		\param interval_us	delay between samples, 0 to sample back to back
+		\returns false if the target can't be sampled.
+	*/
+	bool run( uint32_t count, uint32_t interval_us );
+
+	void clear()				{ m_pcs.clear(); m_halted = false; }
+
+	/** \returns the number of samples from the last run.
+	*/
+	uint32_t samples()			{ return m_pcs.size(); }
+
+	/** \returns true if the last run ended with the target stopping by
+		itself, eg on a breakpoint.
+	*/
+	bool halted()				{ return m_halted; }
+
+	/** Print the samples per function and per C line, busiest first.
+	*/
+	void print_flat();
+
+	/** Write the samples as collapsed stacks, one "func;file:line count"
+		line per location, as read by flamegraph.pl.
+		\returns false if the file couldn't be written.
+	*/
+	bool write_collapsed( std::string filename );
+
+protected:
+	typedef std::map<std::string,uint32_t> COUNT_MAP;
+	DbgSession				*mSession;
+	std::vector<uint16_t>	m_pcs;		///< raw samples in the order taken
+	bool					m_halted;
+
+	void aggregate( COUNT_MAP &funcs, COUNT_MAP &lines, COUNT_MAP &stacks );
+	void print_counts( std::string heading, COUNT_MAP &counts );
+};
+
+#endif
@@ -0,0 +1,436 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <string.h>
+#include "sim8051.h"
+#include "inst8051.h"
+
+/// machine cycles indexed by opcode
+static const uint8_t inst_cycles[256] =
+{
+//	 0 1 2 3 4 5 6 7 8 9 A B C D E F
+	 1,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x00
+	 2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x10
+	 2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x20
+	 2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x30
+	 2,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x40
+	 2,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x50
+	 2,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x60
+	 2,2,2,2,1,2,1,1,1,1,1,1,1,1,1,1,	// 0x70
+	 2,2,2,2,4,2,2,2,2,2,2,2,2,2,2,2,	// 0x80
+	 2,2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x90
+	 2,2,1,2,4,1,2,2,2,2,2,2,2,2,2,2,	// 0xA0
+	 2,2,1,1,2,2,2,2,2,2,2,2,2,2,2,2,	// 0xB0
+	 2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 0xC0
+	 2,2,1,1,1,2,1,1,2,2,2,2,2,2,2,2,	// 0xD0
+	 2,2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 0xE0
+	 2,2,2,2,1,1,1,1,1,1,1,1,1,1,1,1		// 0xF0
+};
+
+// PSW flags
+static const uint8_t PSW_CY = 0x80;
+static const uint8_t PSW_AC = 0x40;
+static const uint8_t PSW_OV = 0x04;
+static const uint8_t PSW_P  = 0x01;
+static const uint8_t SFR_P2 = 0xa0;
+
+
+Sim8051::Sim8051()
+{
+	memset( m_code, 0xff, sizeof(m_code) );		// erased flash
+	memset( m_xdata, 0, sizeof(m_xdata) );
+	memset( m_iram, 0, sizeof(m_iram) );
+	clear_breakpoints();
+	reset();
+}
+
+
+void Sim8051::reset()
+{
+	memset( m_sfr, 0, sizeof(m_sfr) );
+	m_sfr[0x80-0x80] = 0xff;	// P0
+	m_sfr[0x90-0x80] = 0xff;	// P1
+	m_sfr[0xa0-0x80] = 0xff;	// P2
+	m_sfr[0xb0-0x80] = 0xff;	// P3
+	sp() = 0x07;
+	m_pc = 0;
+	m_cycles = 0;
+	m_inst = 0;
+}
+
+
+bool Sim8051::read_bit( uint8_t bit )
+{
+	uint8_t mask = 1 << (bit&7);
+	if( bit<0x80 )
+		return m_iram[0x20+(bit>>3)] & mask;
+	return m_sfr[(bit&0xf8)-0x80] & mask;
+}
+
+
+void Sim8051::write_bit( uint8_t bit, bool v )
+{
+	uint8_t mask = 1 << (bit&7);
+	uint8_t *p = bit<0x80 ? &m_iram[0x20+(bit>>3)] : &m_sfr[(bit&0xf8)-0x80];
+	*p = v ? (*p|mask) : (*p&~mask);
+}
+
+
+void Sim8051::add( uint8_t v, bool with_carry )
+{
+	int c = (with_carry && carry()) ? 1 : 0;
+	int a = acc();
+	int r = a + v + c;
+	uint8_t f = psw() & ~(PSW_CY|PSW_AC|PSW_OV);
+	if( r>0xff )
+		f |= PSW_CY;
+	if( (a&0x0f)+(v&0x0f)+c > 0x0f )
+		f |= PSW_AC;
+	if( ~(a^v) & (a^r) & 0x80 )
+		f |= PSW_OV;
+	psw() = f;
+	acc() = r;
+}
+
+
+void Sim8051::subb( uint8_t v )
+{
+	int c = carry() ? 1 : 0;
+	int a = acc();
+	int r = a - v - c;
+	uint8_t f = psw() & ~(PSW_CY|PSW_AC|PSW_OV);
+	if( r<0 )
+		f |= PSW_CY;
+	if( (a&0x0f)-(v&0x0f)-c < 0 )
+		f |= PSW_AC;
+	if( (a^v) & (a^r) & 0x80 )
+		f |= PSW_OV;
+	psw() = f;
+	acc() = r;
+}
+
+
+void Sim8051::cjne( uint8_t a, uint8_t b, uint8_t rel )
+{
+	set_carry( a<b );
+	if( a!=b )
+		m_pc += int8_t(rel);
+}
+
+
+int Sim8051::step()
+{
+	uint8_t op = m_code[m_pc];
+	uint8_t a1 = m_code[uint16_t(m_pc+1)];
+	uint8_t a2 = m_code[uint16_t(m_pc+2)];
+	uint16_t next = m_pc + Inst8051::length( op );
+	int lo = op & 0x0f;
+	uint8_t v;
+
+	m_pc = next;
+	if( (op&0x1f)==0x01 || (op&0x1f)==0x11 )
+	{
+		// AJMP / ACALL within the 2K page of the next instruction
+		if( op&0x10 )
+		{
+			push( next&0xff );
+			push( next>>8 );
+		}
+		m_pc = (next&0xf800) | ((op&0xe0)<<3) | a1;
+	}
+	else if( lo>=5 && op!=0xa5 )
+	{
+		// the regular part of the map, low nibble selects the operand
+		uint8_t *p;
+		if( lo==5 )
+			p = a1<0x80 ? &m_iram[a1] : &m_sfr[a1-0x80];
+		else if( lo<8 )
+			p = &m_iram[reg(lo&1)];			// @Ri
+		else
+			p = &reg(lo&7);					// Rn
+		uint8_t imm = (lo==5) ? a2 : a1;	// #data or rel following the operand
+		switch( op>>4 )
+		{
+			case 0x0:	(*p)++;								break;	// INC
+			case 0x1:	(*p)--;								break;	// DEC
+			case 0x2:	add( *p, false );					break;	// ADD
+			case 0x3:	add( *p, true );					break;	// ADDC
+			case 0x4:	acc() |= *p;						break;	// ORL A,
+			case 0x5:	acc() &= *p;						break;	// ANL A,
+			case 0x6:	acc() ^= *p;						break;	// XRL A,
+			case 0x7:	*p = imm;							break;	// MOV ,#data
+			case 0x8:										// MOV dir,
+				if( lo==5 )
+					write_direct( a2, *p );	// MOV dir,dir is source first
+				else
+					write_direct( a1, *p );
+				break;
+			case 0x9:	subb( *p );							break;	// SUBB
+			case 0xa:	*p = read_direct( a1 );				break;	// MOV ,dir
+			case 0xb:										// CJNE
+				if( lo==5 )
+					cjne( acc(), *p, a2 );
+				else
+					cjne( *p, a1, a2 );
+				break;
+			case 0xc:	v = acc(); acc() = *p; *p = v;		break;	// XCH
+			case 0xd:
+				if( lo==6 || lo==7 )
+				{
+					// XCHD
+					v = acc();
+					acc() = (v&0xf0) | (*p&0x0f);
+					*p = (*p&0xf0) | (v&0x0f);
+				}
+				else if( --(*p) )
+					m_pc += int8_t(imm);					// DJNZ
+				break;
+			case 0xe:	acc() = *p;							break;	// MOV A,
+			case 0xf:	*p = acc();							break;	// MOV ,A
+		}
+	}
+	else
+	{
+		switch( op )
+		{
+			case 0x00:	break;			// NOP
+			case 0xa5:	break;			// reserved, treated as NOP
+			case 0x02:	m_pc = (a1<<8) | a2;						break;	// LJMP
+			case 0x12:												// LCALL
+				push( next&0xff );
+				push( next>>8 );
+				m_pc = (a1<<8) | a2;
+				break;
+			case 0x22:												// RET
+			case 0x32:												// RETI
+				m_pc = pop() << 8;
+				m_pc |= pop();
+				break;
+			case 0x73:	m_pc = dptr() + acc();						break;	// JMP @A+DPTR
+			case 0x80:	m_pc += int8_t(a1);							break;	// SJMP
+			case 0x10:												// JBC
+				if( read_bit(a1) )
+				{
+					write_bit( a1, false );
+					m_pc += int8_t(a2);
+				}
+				break;
+			case 0x20:	if( read_bit(a1) ) m_pc += int8_t(a2);		break;	// JB
+			case 0x30:	if( !read_bit(a1) ) m_pc += int8_t(a2);		break;	// JNB
+			case 0x40:	if( carry() ) m_pc += int8_t(a1);			break;	// JC
+			case 0x50:	if( !carry() ) m_pc += int8_t(a1);			break;	// JNC
+			case 0x60:	if( acc()==0 ) m_pc += int8_t(a1);			break;	// JZ
+			case 0x70:	if( acc()!=0 ) m_pc += int8_t(a1);			break;	// JNZ
+
+			case 0x03:	acc() = (acc()>>1) | (acc()<<7);			break;	// RR A
+			case 0x13:												// RRC A
+				v = acc();
+				acc() = (v>>1) | (carry() ? 0x80 : 0);
+				set_carry( v&1 );
+				break;
+			case 0x23:	acc() = (acc()<<1) | (acc()>>7);			break;	// RL A
+			case 0x33:												// RLC A
+				v = acc();
+				acc() = (v<<1) | (carry() ? 1 : 0);
+				set_carry( v&0x80 );
+				break;
+			case 0x04:	acc()++;									break;	// INC A
+			case 0x14:	acc()--;									break;	// DEC A
+			case 0x24:	add( a1, false );							break;	// ADD A,#
+			case 0x34:	add( a1, true );							break;	// ADDC A,#
+			case 0x94:	subb( a1 );									break;	// SUBB A,#
+
+			case 0x42:	write_direct( a1, read_direct(a1) | acc() );	break;	// ORL dir,A
+			case 0x43:	write_direct( a1, read_direct(a1) | a2 );		break;	// ORL dir,#
+			case 0x44:	acc() |= a1;									break;	// ORL A,#
+			case 0x52:	write_direct( a1, read_direct(a1) & acc() );	break;	// ANL dir,A
+			case 0x53:	write_direct( a1, read_direct(a1) & a2 );		break;	// ANL dir,#
+			case 0x54:	acc() &= a1;									break;	// ANL A,#
+			case 0x62:	write_direct( a1, read_direct(a1) ^ acc() );	break;	// XRL dir,A
+			case 0x63:	write_direct( a1, read_direct(a1) ^ a2 );		break;	// XRL dir,#
+			case 0x64:	acc() ^= a1;									break;	// XRL A,#
+
+			case 0x72:	set_carry( carry() || read_bit(a1) );		break;	// ORL C,bit
+			case 0xa0:	set_carry( carry() || !read_bit(a1) );		break;	// ORL C,/bit
+			case 0x82:	set_carry( carry() && read_bit(a1) );		break;	// ANL C,bit
+			case 0xb0:	set_carry( carry() && !read_bit(a1) );		break;	// ANL C,/bit
+			case 0x92:	write_bit( a1, carry() );					break;	// MOV bit,C
+			case 0xa2:	set_carry( read_bit(a1) );					break;	// MOV C,bit
+			case 0xb2:	write_bit( a1, !read_bit(a1) );				break;	// CPL bit
+			case 0xb3:	set_carry( !carry() );						break;	// CPL C
+			case 0xc2:	write_bit( a1, false );						break;	// CLR bit
+			case 0xc3:	set_carry( false );							break;	// CLR C
+			case 0xd2:	write_bit( a1, true );						break;	// SETB bit
+			case 0xd3:	set_carry( true );							break;	// SETB C
+
+			case 0x74:	acc() = a1;									break;	// MOV A,#
+			case 0x83:	acc() = m_code[uint16_t(next+acc())];		break;	// MOVC A,@A+PC
+			case 0x93:	acc() = m_code[uint16_t(dptr()+acc())];		break;	// MOVC A,@A+DPTR
+			case 0x90:	set_dptr( (a1<<8) | a2 );					break;	// MOV DPTR,#
+			case 0xa3:	set_dptr( dptr()+1 );						break;	// INC DPTR
+			case 0x84:												// DIV AB
+				psw() &= ~(PSW_CY|PSW_OV);
+				if( breg()==0 )
+					psw() |= PSW_OV;
+				else
+				{
+					v = acc() % breg();
+					acc() = acc() / breg();
+					breg() = v;
+				}
+				break;
+			case 0xa4:												// MUL AB
+			{
+				uint16_t r = acc() * breg();
+				acc() = r & 0xff;
+				breg() = r >> 8;
+				psw() &= ~(PSW_CY|PSW_OV);
+				if( r>0xff )
+					psw() |= PSW_OV;
+				break;
+			}
+			case 0xb4:	cjne( acc(), a1, a2 );						break;	// CJNE A,#,rel
+			case 0xc0:	push( read_direct(a1) );					break;	// PUSH
+			case 0xd0:	write_direct( a1, pop() );					break;	// POP
+			case 0xc4:	acc() = (acc()<<4) | (acc()>>4);			break;	// SWAP A
+			case 0xd4:												// DA A
+			{
+				int a = acc();
+				if( (a&0x0f)>9 || (psw()&PSW_AC) )
+					a += 0x06;
+				if( a>0xff )
+					set_carry( true );
+				if( (a&0x1f0)>0x90 || carry() )
+					a += 0x60;
+				if( a>0xff )
+					set_carry( true );
+				acc() = a;
+				break;
+			}
+			case 0xe4:	acc() = 0;									break;	// CLR A
+			case 0xf4:	acc() = ~acc();								break;	// CPL A
+
+			case 0xe0:	acc() = m_xdata[dptr()];					break;	// MOVX A,@DPTR
+			case 0xf0:	m_xdata[dptr()] = acc();					break;	// MOVX @DPTR,A
+			case 0xe2:												// MOVX A,@Ri
+			case 0xe3:
+				acc() = m_xdata[(m_sfr[SFR_P2-0x80]<<8) | reg(op&1)];
+				break;
+			case 0xf2:												// MOVX @Ri,A
+			case 0xf3:
+				m_xdata[(m_sfr[SFR_P2-0x80]<<8) | reg(op&1)] = acc();
+				break;
+		}
+	}
+
+	// parity always follows the accumulator
+	v = acc();
+	v ^= v>>4;
+	v ^= v>>2;
+	v ^= v>>1;
+	psw() = (psw() & ~PSW_P) | (v&1);
+
+	m_inst++;
+	m_cycles += inst_cycles[op];
+	return inst_cycles[op];
+}
+
+
+Sim8051::RUN_RESULT Sim8051::run( uint32_t max_inst )
+{
+	for( uint32_t i=0; i<max_inst; i++ )
+	{
+		step();
+		if( m_bp[m_pc] )
+			return RUN_BREAKPOINT;
+	}
+	return RUN_LIMIT;
+}
+
+
+bool Sim8051::add_breakpoint( uint16_t addr )
+{
+	if( m_bp[addr] )
+		return false;
+	m_bp[addr] = true;
+	m_bp_count++;
+	return true;
+}
+
+
+bool Sim8051::del_breakpoint( uint16_t addr )
+{
+	if( !m_bp[addr] )
+		return false;
+	m_bp[addr] = false;
+	m_bp_count--;
+	return true;
+}
+
+
+void Sim8051::clear_breakpoints()
+{
+	memset( m_bp, 0, sizeof(m_bp) );
+	m_bp_count = 0;
+}
+
+
+/** Pointer to memory for read() / write(), len is clipped to the area.
+*/
+static uint8_t *area_ptr( uint8_t *code, uint8_t *xdata, uint8_t *iram,
+						  uint8_t *sfr, char area, uint16_t addr, int &len )
+{
+	uint8_t *base;
+	int size;
+	switch( area )
+	{
+		case 'c':	base = code;	size = 0x10000;	break;
+		case 'x':	base = xdata;	size = 0x10000;	break;
+		case 's':
+			if( addr<0x80 )
+				return 0;
+			base = sfr;		addr -= 0x80;	size = 0x80;
+			break;
+		default:	base = iram;	size = 0x100;	break;
+	}
+	if( addr>=size )
+		return 0;
+	if( addr+len > size )
+		len = size - addr;
+	return base + addr;
+}
+
+
+void Sim8051::read( char area, uint16_t addr, int len, unsigned char *buf )
+{
+	int n = len;
+	uint8_t *p = area_ptr( m_code, m_xdata, m_iram, m_sfr, area, addr, n );
+	memset( buf, 0, len );
+	if( p )
+		memcpy( buf, p, n );
+}
+
+
+void Sim8051::write( char area, uint16_t addr, int len,
+					 const unsigned char *buf )
+{
+	uint8_t *p = area_ptr( m_code, m_xdata, m_iram, m_sfr, area, addr, len );
+	if( p )
+		memcpy( p, buf, len );
+}
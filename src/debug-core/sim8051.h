@@ -0,0 +1,121 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef SIM8051_H
+#define SIM8051_H
+#include <stdint.h>
+
+/**	In-process 8051 core.
+	Executes the full instruction set against 64K CODE, 64K XDATA, 256 bytes
+	of IDATA and the SFR space, counting machine cycles of the classic 12
+	clock core.  There are no peripherals or interrupts, SFRs are plain
+	storage.  MOVX @Ri takes the high address byte from P2.
+
+	Breakpoints behave like hardware ones, run() stops before executing an
+	instruction at a breakpoint but always executes the first instruction so
+	it can leave the one it stopped on.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Sim8051
+{
+public:
+	Sim8051();
+
+	/// Reset the core, memory other than the SFRs is left as it is.
+	void reset();
+
+	/** Execute one instruction.
+		\returns the machine cycles it took.
+	*/
+	int step();
+
+	typedef enum
+	{
+		RUN_BREAKPOINT,		///< stopped at a breakpoint
+		RUN_LIMIT			///< executed max_inst instructions
+	} RUN_RESULT;
+
+	/** Execute up to max_inst instructions, stopping early at a breakpoint.
+	*/
+	RUN_RESULT run( uint32_t max_inst );
+
+	/** \returns false if there was already a breakpoint at addr.
+	*/
+	bool add_breakpoint( uint16_t addr );
+	/** \returns false if there was no breakpoint at addr.
+	*/
+	bool del_breakpoint( uint16_t addr );
+	void clear_breakpoints();
+	int breakpoint_count()				{ return m_bp_count; }
+
+	uint16_t pc()						{ return m_pc; }
+	void set_pc( uint16_t addr )		{ m_pc = addr; }
+	uint64_t cycles()					{ return m_cycles; }
+	uint64_t instructions()				{ return m_inst; }
+
+	/** Copy memory out of the simulator.
+		\param area	'c' CODE, 'x' XDATA, 'd' IDATA (all 256 bytes) or
+					's' SFR (addr 0x80 to 0xff)
+	*/
+	void read( char area, uint16_t addr, int len, unsigned char *buf );
+	/** Copy memory into the simulator, area as for read().
+	*/
+	void write( char area, uint16_t addr, int len, const unsigned char *buf );
+
+protected:
+	uint8_t		m_code[0x10000];
+	uint8_t		m_xdata[0x10000];
+	uint8_t		m_iram[0x100];
+	uint8_t		m_sfr[0x80];		///< 0x80 to 0xff
+	bool		m_bp[0x10000];		///< breakpoint at each address
+	int			m_bp_count;
+	uint16_t	m_pc;
+	uint64_t	m_cycles;
+	uint64_t	m_inst;
+
+	uint8_t &acc()						{ return m_sfr[0xe0-0x80]; }
+	uint8_t &psw()						{ return m_sfr[0xd0-0x80]; }
+	uint8_t &sp()						{ return m_sfr[0x81-0x80]; }
+	uint8_t &breg()						{ return m_sfr[0xf0-0x80]; }
+	uint16_t dptr()
+		{ return (m_sfr[0x83-0x80]<<8) | m_sfr[0x82-0x80]; }
+	void set_dptr( uint16_t v )
+		{ m_sfr[0x83-0x80] = v>>8;  m_sfr[0x82-0x80] = v&0xff; }
+	/// register Rn in the current bank
+	uint8_t &reg( int n )				{ return m_iram[(psw()&0x18)+n]; }
+	bool carry()						{ return psw() & 0x80; }
+	void set_carry( bool c )
+		{ psw() = c ? (psw()|0x80) : (psw()&~0x80); }
+
+	uint8_t read_direct( uint8_t addr )
+		{ return addr<0x80 ? m_iram[addr] : m_sfr[addr-0x80]; }
+	void write_direct( uint8_t addr, uint8_t v )
+		{ if( addr<0x80 ) m_iram[addr] = v; else m_sfr[addr-0x80] = v; }
+	bool read_bit( uint8_t bit );
+	void write_bit( uint8_t bit, bool v );
+	void push( uint8_t v )				{ m_iram[++sp()] = v; }
+	uint8_t pop()						{ return m_iram[sp()--]; }
+
+	void add( uint8_t v, bool with_carry );
+	void subb( uint8_t v );
+	void cjne( uint8_t a, uint8_t b, uint8_t rel );
+};
+
+#endif
@@ -0,0 +1,318 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <iostream>
+#include <stdio.h>
+#include "snapshot.h"
+#include "target.h"
+#include "memremap.h"
+#include "symtab.h"
+#include "disasm8051.h"
+
+using namespace std;
+
+#define SNAPSHOT_KEY_EVERY		32		///< snapshots between whole images
+#define SNAPSHOT_RUN_GAP		8		///< unchanged bytes kept to join runs
+#define SNAPSHOT_XDATA_CHUNK	0x8000	///< largest XDATA read, len is 16 bit
+#define SNAPSHOT_DIFF_WIDTH		8		///< bytes per line of a diff
+
+Snapshots::Snapshots( DbgSession *session )
+	: mSession(session)
+{
+}
+
+
+Snapshots::~Snapshots()
+{
+}
+
+void Snapshots::clear()
+{
+	m_snaps.clear();
+	m_last.clear();
+}
+
+int Snapshots::find( const string &name )
+{
+	for( size_t i=0; i<m_snaps.size(); i++ )
+		if( m_snaps[i].name==name )
+			return i;
+	return -1;
+}
+
+bool Snapshots::same_layout( const LAYOUT &a, const LAYOUT &b )
+{
+	return a.sfr_pages==b.sfr_pages && a.xdata_size==b.xdata_size;
+}
+
+/** Read the whole memory into image, laid out as DATA, IDATA, each SFR
+	page in layout order, then XDATA.
+*/
+void Snapshots::capture( const LAYOUT &layout, vector<uint8_t> &image )
+{
+	Target *t = mSession->target();
+	uint32_t sfr_end = 0x100 + layout.sfr_pages.size()*0x80;
+	image.resize( sfr_end + layout.xdata_size );
+	// one RAM, but read_data() can't take all 256 bytes at once
+	t->read_memory_uncached( MemRemap::flat( 0x00, 'd' ), 0x80, &image[0] );
+	t->read_memory_uncached( MemRemap::flat( 0x80, 'i' ), 0x80, &image[0x80] );
+	for( size_t i=0; i<layout.sfr_pages.size(); i++ )
+		t->read_sfr_page( layout.sfr_pages[i], &image[0x100+i*0x80] );
+	for( uint32_t a=0; a<layout.xdata_size; a+=SNAPSHOT_XDATA_CHUNK )
+	{
+		uint32_t n = layout.xdata_size-a < SNAPSHOT_XDATA_CHUNK ?
+					 layout.xdata_size-a : SNAPSHOT_XDATA_CHUNK;
+		t->read_memory_uncached( MemRemap::flat( a, 'x' ), n,
+								 &image[sfr_end+a] );
+	}
+}
+
+bool Snapshots::save( const string &name )
+{
+	if( find( name )>=0 )
+		return fail( "Snapshot \"" + name + "\" already exists." );
+
+	SNAP snap;
+	snap.name = name;
+	snap.layout.sfr_pages = mSession->target()->sfr_pages();
+	snap.layout.xdata_size = mSession->target()->xdata_size();
+	vector<uint8_t> image;
+	capture( snap.layout, image );
+
+	size_t since_key = 0;
+	for( size_t i=m_snaps.size(); i>0 && !m_snaps[i-1].key; i-- )
+		since_key++;
+	snap.key = m_snaps.empty() || since_key+1>=SNAPSHOT_KEY_EVERY ||
+			   !same_layout( snap.layout, m_snaps.back().layout );
+	uint32_t delta_size = 0;
+	for( uint32_t i=0; !snap.key && i<image.size(); )
+	{
+		if( image[i]==m_last[i] )
+		{
+			i++;
+			continue;
+		}
+		// carry on past short stretches of unchanged bytes, a run costs
+		// more than a few bytes to store
+		uint32_t end = i+1, same = 0;
+		for( uint32_t j=end; j<image.size() && same<SNAPSHOT_RUN_GAP; j++ )
+		{
+			if( image[j]!=m_last[j] )
+			{
+				end = j+1;
+				same = 0;
+			}
+			else
+				same++;
+		}
+		RUN run;
+		run.offset = i;
+		run.bytes.assign( image.begin()+i, image.begin()+end );
+		snap.delta.push_back( run );
+		delta_size += sizeof(RUN) + run.bytes.size();
+		if( delta_size>=image.size()/2 )
+		{
+			snap.key = true;	// mostly changed, cheaper to keep it whole
+			snap.delta.clear();
+		}
+		i = end;
+	}
+	if( snap.key )
+		snap.image = image;
+	m_last.swap( image );
+	m_snaps.push_back( snap );
+	return true;
+}
+
+/** Build the whole image of snapshot idx, from the whole image before it
+	and the changes since.
+*/
+void Snapshots::rebuild( int idx, vector<uint8_t> &image )
+{
+	int k = idx;
+	while( !m_snaps[k].key )
+		k--;
+	image = m_snaps[k].image;
+	for( k++; k<=idx; k++ )
+	{
+		const vector<RUN> &delta = m_snaps[k].delta;
+		for( size_t i=0; i<delta.size(); i++ )
+			copy( delta[i].bytes.begin(), delta[i].bytes.end(),
+				  image.begin()+delta[i].offset );
+	}
+}
+
+/// where an image offset is in target memory
+void Snapshots::locate( const LAYOUT &layout, uint32_t offset, AREA &area,
+						uint32_t &addr, uint8_t &page )
+{
+	uint32_t sfr_end = 0x100 + layout.sfr_pages.size()*0x80;
+	page = 0;
+	if( offset<0x80 )
+	{
+		area = AREA_DATA;
+		addr = offset;
+	}
+	else if( offset<0x100 )
+	{
+		area = AREA_IDATA;
+		addr = offset;
+	}
+	else if( offset<sfr_end )
+	{
+		area = AREA_SFR;
+		page = layout.sfr_pages[(offset-0x100)/0x80];
+		addr = 0x80 + (offset-0x100)%0x80;
+	}
+	else
+	{
+		area = AREA_XDATA;
+		addr = offset - sfr_end;
+	}
+}
+
+/** Name for a memory location, the symbol that covers it, otherwise the
+	bank register or standard SFR name, otherwise empty.
+	\param[out] offset	of addr within the symbol
+*/
+string Snapshots::label( AREA area, uint32_t addr, uint32_t &offset )
+{
+	static const char areas[] = { 'd', 'i', 's', 'x' };
+	SymTab *symtab = mSession->symtab();
+	offset = 0;
+	string name = symtab->get_symbol_covering(
+					MemRemap::flat( addr, areas[area] ), offset );
+	if( name.empty() && area==AREA_DATA )
+		name = symtab->get_symbol_covering( MemRemap::flat( addr, 'i' ), offset );
+	if( name.empty() && area==AREA_DATA && addr<0x20 )
+	{
+		char buf[16];
+		snprintf( buf, sizeof(buf), "R%u bank %u", addr&7, addr>>3 );
+		name = buf;
+	}
+	if( name.empty() && area==AREA_SFR && Disasm8051::sfr_name( addr ) )
+		name = Disasm8051::sfr_name( addr );
+	return name;
+}
+
+/** Differing bytes are printed as lines of up to SNAPSHOT_DIFF_WIDTH
+	adjacent bytes, a line is only continued within the same symbol.
+*/
+bool Snapshots::diff( const string &a, const string &b )
+{
+	int ia = find( a ), ib = find( b );
+	if( ia<0 )
+		return fail( "No snapshot \"" + a + "\"." );
+	if( ib<0 )
+		return fail( "No snapshot \"" + b + "\"." );
+	const LAYOUT &layout = m_snaps[ia].layout;
+	if( !same_layout( layout, m_snaps[ib].layout ) )
+		return fail( "The snapshots were taken with different memory layouts." );
+	vector<uint8_t> old_img, new_img;
+	rebuild( ia, old_img );
+	rebuild( ib, new_img );
+
+	static const char *area_names[] = { "DATA", "IDATA", "SFR", "XDATA" };
+	uint32_t changed = 0;
+	cout << "Changes from \"" << a << "\" to \"" << b << "\":" << endl;
+	for( uint32_t i=0; i<old_img.size(); )
+	{
+		if( old_img[i]==new_img[i] )
+		{
+			i++;
+			continue;
+		}
+		AREA area, next_area;
+		uint32_t addr, next_addr;
+		uint8_t page, next_page;
+		uint32_t offset, next_offset;
+		locate( layout, i, area, addr, page );
+		string name = label( area, addr, offset );
+		string olds, news;
+		uint32_t n = 0;
+		char buf[16];
+		do
+		{
+			snprintf( buf, sizeof(buf), "%02x ", old_img[i+n] );
+			olds += buf;
+			snprintf( buf, sizeof(buf), "%02x ", new_img[i+n] );
+			news += buf;
+			n++;
+			if( n==SNAPSHOT_DIFF_WIDTH || i+n>=old_img.size() ||
+				old_img[i+n]==new_img[i+n] )
+				break;
+			locate( layout, i+n, next_area, next_addr, next_page );
+			if( next_area!=area || next_page!=page ||
+				label( next_area, next_addr, next_offset )!=name )
+				break;
+		} while( true );
+
+		string area_name = area_names[area];
+		if( area==AREA_SFR && layout.sfr_pages.size()>1 )
+		{
+			snprintf( buf, sizeof(buf), "[%02x]", page );
+			area_name += buf;
+		}
+		if( offset )
+		{
+			snprintf( buf, sizeof(buf), "+%u", offset );
+			name += buf;
+		}
+		printf( "  %-8s 0x%04x  %-20s %s-> %s\n", area_name.c_str(), addr,
+				name.c_str(), olds.c_str(),
+				news.substr( 0, news.length()-1 ).c_str() );
+		changed += n;
+		i += n;
+	}
+	if( changed==0 )
+		cout << "No differences." << endl;
+	else
+		printf( "%u bytes changed.\n", changed );
+	return true;
+}
+
+uint32_t Snapshots::stored_size( const SNAP &snap )
+{
+	uint32_t size = sizeof(SNAP) + snap.image.size();
+	for( size_t i=0; i<snap.delta.size(); i++ )
+		size += sizeof(RUN) + snap.delta[i].bytes.size();
+	return size;
+}
+
+void Snapshots::list()
+{
+	if( m_snaps.empty() )
+	{
+		cout << "No snapshots." << endl;
+		return;
+	}
+	uint32_t total = 0;
+	for( size_t i=0; i<m_snaps.size(); i++ )
+	{
+		const SNAP &snap = m_snaps[i];
+		uint32_t size = stored_size( snap );
+		total += size;
+		if( snap.key )
+			printf( "%-20s %8u bytes, whole image\n", snap.name.c_str(), size );
+		else
+			printf( "%-20s %8u bytes, %u changed runs\n", snap.name.c_str(),
+					size, (unsigned)snap.delta.size() );
+	}
+	printf( "%u snapshots, %u bytes.\n", (unsigned)m_snaps.size(), total );
+}
@@ -0,0 +1,102 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "types.h"
+#include "dbgsession.h"
+
+/**	Named snapshots of the target's memory, for finding what changed
+	between two stops.
+
+	A snapshot holds DATA, IDATA, every SFR page and the XDATA the target
+	reports, each area read uncached in as few bulk transfers as the target
+	interface allows.  Only every SNAPSHOT_KEY_EVERY'th snapshot is stored
+	whole, the others hold just the runs of bytes that differ from the one
+	before, so a long session of snapshots of a mostly idle memory costs
+	little more than the first one.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class Snapshots
+{
+public:
+	Snapshots( DbgSession *session );
+	~Snapshots();
+
+	/** Read the target's memory and keep it under name.
+		\returns false if name is already used, error() says why.
+	*/
+	bool save( const std::string &name );
+
+	/** Print every byte that differs from snapshot a to b, grouped by
+		memory area and labelled with the symbol that covers it.
+		\returns false if either snapshot is missing or they were taken with
+				 different memory layouts.
+	*/
+	bool diff( const std::string &a, const std::string &b );
+
+	/** Print the snapshots and the memory each one takes.
+	*/
+	void list();
+
+	void clear();
+	std::string error()			{ return m_error; }
+
+protected:
+	typedef struct
+	{
+		std::vector<uint8_t>	sfr_pages;
+		uint32_t				xdata_size;
+	} LAYOUT;
+	typedef struct
+	{
+		uint32_t				offset;		///< into the image
+		std::vector<uint8_t>	bytes;
+	} RUN;
+	typedef struct
+	{
+		std::string				name;
+		LAYOUT					layout;
+		bool					key;		///< image holds the whole memory
+		std::vector<uint8_t>	image;
+		std::vector<RUN>		delta;		///< changes from the previous snapshot
+	} SNAP;
+	typedef enum { AREA_DATA, AREA_IDATA, AREA_SFR, AREA_XDATA } AREA;
+
+	DbgSession				*mSession;
+	std::vector<SNAP>		m_snaps;		///< oldest first
+	std::vector<uint8_t>	m_last;			///< whole image of the newest
+	std::string				m_error;
+
+	bool fail( std::string msg )	{ m_error = msg; return false; }
+	int find( const std::string &name );
+	void capture( const LAYOUT &layout, std::vector<uint8_t> &image );
+	void rebuild( int idx, std::vector<uint8_t> &image );
+	void locate( const LAYOUT &layout, uint32_t offset, AREA &area,
+				 uint32_t &addr, uint8_t &page );
+	std::string label( AREA area, uint32_t addr, uint32_t &offset );
+	static bool same_layout( const LAYOUT &a, const LAYOUT &b );
+	static uint32_t stored_size( const SNAP &snap );
+};
+
+#endif
@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <algorithm>
+#include "stopprefetch.h"
+#include "target.h"
+#include "memremap.h"
+#include "symtab.h"
+#include "contextmgr.h"
+
+StopPrefetch::StopPrefetch( DbgSession *session )
+	: mSession(session), mTarget(0), mGeneration(0), mBusy(false),
+	  mYield(false)
+{
+}
+
+
+StopPrefetch::~StopPrefetch()
+{
+	yield();
+}
+
+bool StopPrefetch::start()
+{
+	Target *t = mSession->target();
+	if( mBusy || !t || !t->is_connected() )
+		return false;
+	if( t==mTarget && t->data_generation()==mGeneration )
+		return false;		// nothing has changed since the last one
+	mTarget = t;
+	mGeneration = t->data_generation();
+	
+	// registers, bank and stack are all in DATA / IDATA, just read all of it
+	mQueue.clear();
+	RANGE data = { MemRemap::flat( 0, 'd' ), 0x100 };
+	mQueue.push_back( data );
+	queue_locals();
+	
+	mYield = false;
+	mBusy = pthread_create( &mThread, 0, prefetch, this )==0;
+	return mBusy;
+}
+
+void StopPrefetch::yield()
+{
+	if( !mBusy )
+		return;
+	mYield = true;
+	pthread_join( mThread, 0 );
+	mBusy = false;
+}
+
+/** Queue the XDATA the current function's locals live in, those in DATA
+	are already queued.  Locals close together are merged so each takes
+	one transfer.
+*/
+void StopPrefetch::queue_locals()
+{
+	std::vector<Symbol*> syms;
+	RANGES locals;
+	mSession->symtab()->get_locals( mSession->contextmgr()->get_current(),
+									syms );
+	for( size_t i=0; i<syms.size(); i++ )
+	{
+		char area;
+		FLAT_ADDR flat = syms[i]->flat_start_addr();
+		if( syms[i]->onStack() || flat==MemRemap::INVALID_FLAT_ADDR ||
+			MemRemap::target( flat, area )==INVALID_ADDR || area!='x' ||
+			syms[i]->endAddr()<=syms[i]->addr() )
+			continue;
+		RANGE r = { flat, syms[i]->endAddr()-syms[i]->addr() };
+		locals.push_back( r );
+	}
+	std::sort( locals.begin(), locals.end(), range_less );
+	
+	uint32_t total = 0;
+	RANGES::iterator last = mQueue.end();
+	for( RANGES::iterator it=locals.begin(); it!=locals.end(); ++it )
+	{
+		if( total+it->len > MAX_XDATA )
+			break;
+		total += it->len;
+		if( last!=mQueue.end() && it->addr <= last->addr+last->len+CHUNK )
+		{
+			if( it->addr+it->len > last->addr+last->len )
+				last->len = it->addr+it->len - last->addr;
+			continue;
+		}
+		mQueue.push_back( *it );
+		last = mQueue.end()-1;
+	}
+}
+
+void *StopPrefetch::prefetch( void *arg )
+{
+	StopPrefetch *p = (StopPrefetch*)arg;
+	// one SFR page read and the first DATA block
+	p->mTarget->read_cpu_context();
+	for( RANGES::iterator it=p->mQueue.begin();
+		 it!=p->mQueue.end() && !p->mYield; ++it )
+	{
+		for( uint32_t ofs=0; ofs<it->len && !p->mYield; ofs+=CHUNK )
+		{
+			uint32_t n = it->len-ofs < CHUNK ? it->len-ofs : CHUNK;
+			p->mTarget->prefetch( it->addr+ofs, n );
+		}
+	}
+	return 0;
+}
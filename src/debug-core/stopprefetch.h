@@ -0,0 +1,90 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef STOPPREFETCH_H
+#define STOPPREFETCH_H
+#include <pthread.h>
+#include <vector>
+#include "dbgsession.h"
+#include "types.h"
+
+/** Reads what is nearly always asked for after the target stops into the
+	target's memory cache from a background thread, so the registers,
+	backtrace and locals a user or front end asks for next are served from
+	the host.
+	start() queues the core SFRs, register bank and stack (all of DATA /
+	IDATA) and the XDATA locals of the current function and returns, the
+	thread then reads them through Target::prefetch() a chunk at a time.
+	yield() stops it at the end of the chunk under way, so a command waits
+	for one transfer at most.  Nothing may touch the target between start()
+	and yield().
+
+	Only the thread that called start() may call the other members.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class StopPrefetch
+{
+public:
+	StopPrefetch( DbgSession *session );
+	~StopPrefetch();
+
+	/** Start a prefetch if the target has run, stepped or been reset since
+		the last one, and return straight away.  Call while waiting for the
+		next command, never while the target runs in the background.
+		\returns true if a prefetch was started.
+	*/
+	bool start();
+
+	/** Stop a prefetch in progress, waiting only for the chunk being read.
+		Call before anything else uses the target.
+	*/
+	void yield();
+
+	/// true from start() until yield()
+	bool busy()				{ return mBusy; }
+
+protected:
+	/// bytes read per Target::prefetch(), what a command may have to wait for
+	static const uint32_t CHUNK = 128;
+	/// most bytes of XDATA locals queued, a large buffer isn't worth it
+	static const uint32_t MAX_XDATA = 1024;
+
+	typedef struct
+	{
+		FLAT_ADDR	addr;
+		uint32_t	len;
+	} RANGE;
+	typedef std::vector<RANGE> RANGES;
+
+	DbgSession		*mSession;
+	Target			*mTarget;		///< the target last prefetched from
+	uint32_t		mGeneration;	///< its data_generation() then
+	RANGES			mQueue;
+	pthread_t		mThread;
+	bool			mBusy;
+	volatile bool	mYield;
+
+	void queue_locals();
+	static bool range_less( const RANGE &a, const RANGE &b )
+							{ return a.addr < b.addr; }
+	static void *prefetch( void *arg );
+};
+
+#endif
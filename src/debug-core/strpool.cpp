@@ -0,0 +1,42 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "strpool.h"
+
+const StrPool::ID StrPool::NONE;
+
+StrPool::StrPool()
+{
+	intern( "" );
+}
+
+StrPool::ID StrPool::intern( const std::string &s )
+{
+	std::pair<ID_MAP::iterator,bool> r =
+		m_ids.insert( ID_MAP::value_type( s, ID(m_strs.size()) ) );
+	if( r.second )
+		m_strs.push_back( &r.first->first );
+	return r.first->second;
+}
+
+StrPool::ID StrPool::find( const std::string &s ) const
+{
+	ID_MAP::const_iterator it = m_ids.find( s );
+	return it==m_ids.end() ? NONE : it->second;
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef STRPOOL_H
+#define STRPOOL_H
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+/**	Interned strings for the names loaded from a cdb file.
+	Symbol names, file names and function names repeat over and over in a
+	cdb file, each distinct string is stored once here and everything else
+	holds its id.  Two ids are equal exactly when their strings are, so
+	lookups compare ids and only turn them back into text for display.
+
+	Strings are never removed, ids stay valid for the life of the pool.
+	Id 0 is always the empty string so zeroed ids need no interning.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class StrPool
+{
+public:
+	typedef uint32_t ID;
+	static const ID NONE = 0xffffffff;	///< returned by find() for unknown strings
+	
+	StrPool();
+	
+	/** Get the id of a string, adding it to the pool if it is new.
+	*/
+	ID intern( const std::string &s );
+	
+	/** Get the id of a string without adding it.
+		\returns the id, or NONE if the string isn't in the pool, in which
+				 case nothing holding an id can match it.
+	*/
+	ID find( const std::string &s ) const;
+	
+	/** \returns the text of id, valid for the life of the pool.
+	*/
+	const std::string &str( ID id ) const	{ return *m_strs[id]; }
+	
+	uint32_t size() const					{ return m_strs.size(); }
+	
+protected:
+	typedef std::map<std::string,ID> ID_MAP;
+	ID_MAP	m_ids;
+	/// text of each id, pointing at the keys of m_ids which never move
+	std::vector<const std::string*>	m_strs;
+};
+
+#endif
@@ -36,11 +36,15 @@ Symbol::Symbol( DbgSession *session )
 	: mSession(session)
 {
 	setAddrSpace('Z');	// undefined
-	m_name="";
+	m_name = m_file = m_function = m_type_name = m_type_chain = 0;	// ""
+	m_type_resolved = true;		// nothing to decode
 	m_start_addr = 0xffffffff;
 	m_end_addr = -1;
 	m_length = -1;
 	m_bFunction = false;
+	m_on_stack = false;
+	m_stack_ofs = 0;
+	m_is_reentrant = false;
 }
 
 
@@ -102,40 +106,105 @@ void Symbol::setEndAddr( uint32_t addr )
 */
 FLAT_ADDR Symbol::flat_start_addr()
 {
-	printf("addr apace = %c\n",addr_space_map[m_addr_space]);
-	printf("type = %i\n",m_addr_space);
 	char as;
 	switch(m_addr_space)
 	{
-		case AS_XSTACK:		;	break;			///< External stack
-		case AS_ISTACK:		;	break;			///< Internal stack
-		case AS_CODE:		;	break;			///< Code memory
-		case AS_CODE_STATIC:	;	break;		///< Code memory, static segment
-		case AS_IRAM_LOW:	as='d'	;	break;		///< Internal RAM (lower 128 bytes)
-		case AS_EXT_RAM:		;	break;			///< External data RAM
-		case AS_INT_RAM:	as='d'	;	break;			///< Internal data RAM
-		case AS_BIT:		;	break;				///< Bit addressable area
-		case AS_SFR:		;	break;				///< SFR space
-		case AS_SBIT:		;	break;			///< SBIT space
-		case AS_REGISTER:		;	break;
+		case AS_XSTACK:		as='x';	break;			///< External stack
+		case AS_ISTACK:		as='i';	break;			///< Internal stack
+		case AS_CODE:		as='c';	break;			///< Code memory
+		case AS_CODE_STATIC:	as='c';	break;		///< Code memory, static segment
+		case AS_IRAM_LOW:	as='d';	break;			///< Internal RAM (lower 128 bytes)
+		case AS_EXT_RAM:	as='x';	break;			///< External data RAM
+		case AS_INT_RAM:	as='d';	break;			///< Internal data RAM
+		case AS_SFR:		as='s';	break;			///< SFR space
+		case AS_REGISTER:	as='d';	break;
+		default:			return MemRemap::INVALID_FLAT_ADDR;	// bits, functions
 	}
 	return MemRemap::flat( m_start_addr, as );
+}
 
 
+void Symbol::setTypeChain( const string &chain )
+{
+	m_type_chain = mSession->strings()->intern( chain );
+	m_type_resolved = chain.empty();
+	m_type_name = 0;
+	m_return_type = "";
+	m_array_dim.clear();
+}
 
-
-
-
-
-	FLAT_ADDR a = MemRemap::flat( m_start_addr, addr_space_map[m_addr_space] );
-	printf("Flat addr = 0x%08x, m_start_addr=0x%08x\n",a,m_start_addr);
-	return a;
+/** Decode the type chain kept by setTypeChain().
+	<pre>
+	<(><{><Size><}><DCLType>{<,><DCLType>}<:><Sign><)>
+	</pre>
+	The size was already taken while loading, only the type name, array
+	dimensions and function return type are filled in here.
+*/
+void Symbol::resolve_type()
+{
+	if( m_type_resolved )
+		return;
+	m_type_resolved = true;
+	
+	const string &line = mSession->strings()->str( m_type_chain );
+	int pos, npos = line.find('}');
+	int limit = line.find(':');
+	char type_char = 0;
+	string type_name = "";
+	
+	if( npos==-1 || limit==-1 || limit<npos )
+		return;		// bad format
+	// The last loop will be followed by a sign type if an integer type
+	while( npos < limit )
+	{
+		pos = npos + 1;
+		npos = line.find(',',pos);
+		npos = (npos==-1 || npos>limit) ? limit : npos;
+		
+		// which type and sign
+		if( line[pos]=='D' && line[pos+1]=='A' )
+		{
+			// DAxxx, where xxx is the number of elements
+			AddArrayDim( strtoul( line.c_str()+pos+2, 0, 10 ) );
+		}
+		else if( line[pos]=='S' )
+		{
+			type_char = line[pos+1];
+			if( type_char=='T' )	// typedef
+				type_name = line.substr(pos+2,npos-pos-2);
+		}
+	}
+	
+	bool issigned = line[limit+1]=='S';
+	switch(type_char)
+	{
+		case 'T':														break;
+		case 'C': type_name = issigned ? "char"	: "unsigned char";		break;
+		case 'S': type_name = issigned ? "short": "unsigned short";		break;
+		case 'I': type_name = issigned ? "int"	: "unsigned int";		break;
+		case 'L': type_name = issigned ? "long"	: "unsigned long";		break;
+		case 'F': type_name = "float";									break;
+		case 'V': type_name = "void";									break;
+		case 'X': type_name = "sbit";									break;
+		case 'B': type_name = "bitfield of n bits???";					break;
+		default:
+			cerr << "ERROR unhandled type in "<<line<<" for "<<name()<<endl;
+	}
+	
+	if( type_name!="" )
+	{
+		if( isFunction() )
+			setReturn( type_name );
+		else
+			setType( type_name );
+	}
 }
 
 
 void Symbol::dump()
 {
-	string name = m_name;
+	resolve_type();
+	string name = this->name();
 	char buf[255];
 	memset(buf,0,sizeof(buf));
 	for(int i=0; i<m_array_dim.size(); i++)
@@ -147,11 +216,11 @@ void Symbol::dump()
 		   name.c_str(),
 		   m_start_addr,
 		   m_end_addr,
-		   m_file.c_str(),
+		   file().c_str(),
 		   scope_name[m_scope],
-		   m_function.c_str(),
+		   function().c_str(),
 		   addr_space_map[m_addr_space],
-		   m_type_name.c_str()
+		   type().c_str()
 		  );
 	list<string>::iterator it;
 	if( !m_regs.empty() )
@@ -164,209 +233,3 @@ void Symbol::dump()
 	}
 	printf("\n");
 }
-
-
-/** Print the symbol with the specified indent
-*/
-void Symbol::print( char format )
-{
-	SymType *type;
-	//printf("*** name = %s\n",m_name.c_str());
-	cout << m_name << " = ";
-//	if( sym_type_tree.get_type( m_type_name, &type ) )
-	//sym_type_tree.get_type( m_type_name, file, block, &type ) )
-	// FIXME a context woule be usefule here...
-	
-	ContextMgr::Context context;
-	type = mSession->symtree()->get_type( m_type_name, context );
-	if( type )
-	{
-		// where do arrays get handles?  count in symbol...
-		if( type->terminal() )
-		{
-			// print out data now...
-			cout << "type = " << type->name() << endl;
-			// @TODO pass flat memory address to the type so it can reterieve the data and print it out.
-			
-			// @FIXME: need to use the flat addr from remap rather than just the start without an area.
-			uint32_t flat_addr = MemRemap::flat( m_start_addr, addr_space_map[m_addr_space] );	// map needs to map to lower case in some cases...!!! maybe fix in memremap
-			
-			flat_addr = MemRemap::flat( m_start_addr,'d');	// @FIXME remove this hack
-//			cout << type->pretty_print( m_name, indent, flat_addr );
-			cout << type->pretty_print( format,m_name, flat_addr );
-		}
-		else
-		{
-			// its more comples like a structure or typedef
-		}
-		cout << endl;
-	}
-//	assert(1==0);	// oops unknown type
-}
-
-#include <boost/regex.hpp>
-#include <iostream>
-/** scan for a [ or a . indicating the end of the current element
-*/
-size_t find_element_end( std::string expr )
-{
-//	if( expr.find_first_of('[', size_type pos = 0)
-
-	return -1;
-}
-
-
-/** Recursive function to print out an complete arrays contents.
-*/
-void Symbol::print_array( char format, int dim_num, FLAT_ADDR &addr, SymType *type )
-{
-//	cout << "print_array( "<<format<<", "<<dim_num<<", "<<hex<<addr<<" )"<<endl;
-//	cout << "m_array_dim.size() = " << m_array_dim.size() << endl;
-
-	if( dim_num == (m_array_dim.size()-1) )
-	{
-//		cout <<"elements("<<m_array_dim[dim_num/*-1*/]<<")"<<endl;
-		// deapest, print elements
-
-		// special case default format with char array
-		if( format==0 && (type->name()=="char" || type->name()=="unsigned char") )
-		{
-			cout << "\"";
-			for(int i=0; i<m_array_dim[dim_num/*-1*/]; i++ )
-			{
-				cout << type->pretty_print( 's',"", addr );
-				addr += type->size();
-			}
-			cout << "\"";
-		}
-		else
-		{
-			cout << "{";
-			for(int i=0; i<m_array_dim[dim_num/*-1*/]; i++ )
-			{
-				cout << (i>0?",":"") << type->pretty_print( format,"", addr );
-				addr += type->size();
-			}
-			cout << "}";
-		}
-	}
-	else
-	{
-		cout << "{";
-		for( int i=0; i<m_array_dim[dim_num]; i++ )
-		{
-			print_array( format, dim_num+1, addr, type );
-		}
-		cout << "}";
-	}
-	
-}
-
-
-/** Checks to see if value represents a number or a symbol.
-	if its a symbol then a lookup is performed to find its value.
-
-	\param index	string representing the index to get the real index for.
-	\param result	Received the numerical index value.
-	\return			Returns true if ok, false on invalid.
-*/
-bool Symbol::array_index_lookup( std::string index, int32_t &result )
-{
-	char *endptr;
- 
-	result = strtoul( index.c_str(), &endptr, 0);
-	if( endptr==index.c_str()+index.length() )
-	{
-		return true;
-	}
-	else
-	{
-		// its a variable
-		cout << "SORRY: index by lookup of another symbol is not supported yet"<<endl;
-		return false;
-	}
-}
-
-
-/** Print the symbol,  The expression must start with the symnbol.
-	expr is used to determine if a single element or the entire array is to be printed
-*/
-void Symbol::print( char format, std::string expr )
-{
-	cout << "expr = '"<< expr << "'" << endl;
-	char msg[] = "Hello World";
-
-//	size_t find_element_end( expr )
-//find_element_end("gfdgsdfg");
-
-	//boost::regex reg_array("^([a-z|0-9|_|-]+)\\x5b([a-z|0-9|_|-]+)\\x5d(.+)");
-	boost::regex reg_array("^([a-z|0-9|_|-]+)\\x5b([a-z|0-9|_|-]+)\\x5d(.*)");
-	boost::regex reg_child("^([a-z|0-9|_|-]+)\\.(.+)");
-	boost::smatch what;
-
-	if( boost::regex_match( expr, what, reg_array, boost::match_extra) )
-	{
-		// Array with index
-		// what[0] = all
-		// what[1] = name
-		// what[2] = array index
-		cout << "array with index" << endl;
-		// @FIXME: this dosen't handle multiple dimentions
-		ContextMgr::Context context = mSession->contextmgr()->get_current();
-		SymType *type = mSession->symtree()->get_type( m_type_name, context );
-		if( type->terminal() )
-		{
-			// figure out which element to print
-//			cout << "index = "<<what[2]<<endl;
-			int32_t index;
-			if( array_index_lookup(what[2],index) )
-			{
-				// calculate memory location
-				FLAT_ADDR addr = MemRemap::flat( m_start_addr,'d');	// @FIXME remove this and get correct address
-				addr += index * type->size();
-				cout << type->pretty_print( format,what[0], addr ) << endl;
-			}
-
- 		}
-	}
-	else if( boost::regex_match( expr, what, reg_child, boost::match_extra) )
-	{
-		// sub element, eg struct element.
-		// what[0] = all
-		// what[1] = name
-		// what[2] = child
-		// we may have to use the same regex again to figure out the child
-		cout << "sub element, eg struct element" << endl;
-	}
-	else
-	{
-		// if we get here and the symbol says it is not terminal then we must print all its children
-
-		// Either a terminal or an array of terminals where we print all.
-		// array count is part of symbol.
-		ContextMgr::Context context = mSession->contextmgr()->get_current();
-		SymType *type = mSession->symtree()->get_type( m_type_name, context );
-		if( type )
-		{
-			if( type->terminal() )
-			{
-				if( m_array_dim.size()==0 )
-				{
-					// single terminal object
-					print(format);
-				}
-				else
-				{
-					FLAT_ADDR flat_addr = MemRemap::flat( m_start_addr,'d');	// @FIXME remove this and get correct address
-					print_array( format, 0, flat_addr, type );
-					cout << endl;
-				}
-			}
-			else
-			{
-				// print all children
-			}
-		}
-	}
-}
-
@@ -37,6 +37,7 @@ class SymType;
 */
 class Symbol
 {
+	friend class SymCache;
 public:
     Symbol( DbgSession *session );
     ~Symbol();
@@ -63,8 +64,8 @@ public:
 	} ADDR_SPACE;
 	static const char addr_space_map[];
 	
-	void setName( string name )		{ m_name = name;cout <<"{{"<<name<<"}}"<<endl; }
-	void setFile( string name )		{ m_file = name; }
+	void setName( string name )		{ m_name = mSession->strings()->intern(name); }
+	void setFile( string name )		{ m_file = mSession->strings()->intern(name); }
 	void setAddr( uint32_t addr );
 	void setEndAddr( uint32_t addr );
 	void setScope( SCOPE scope )	{ m_scope = scope; }
@@ -74,15 +75,24 @@ public:
 	void setLine( int i )			{ m_line = i; }
 	void setBlock( int block )		{ m_block = block; }
 	void setLength( int len )		{ m_length = len; m_end_addr = m_start_addr+m_length; }
-	void setFunction( string func )	{ m_function = func; }
+	void setFunction( string func )	{ m_function = mSession->strings()->intern(func); }
 	void setAddrSpace( char c );
 	void addReg( string reg )		{ m_regs.push_back(reg); }
+	/// <OnStack> and <Stack> of the record, the offset is from _bp
+	void setStack( bool on_stack, int offset )	{ m_on_stack = on_stack; m_stack_ofs = offset; }
 	// function symbol specific values
 	void setIsFunction( bool bfunc=true )	{ m_bFunction = bfunc; }
 	void set_interrupt( bool intr=true )	{ m_is_int = intr; }
 	int set_interrupt_num( int i )			{ int r = m_int_num; m_int_num = i; return r; }
 	int set_reg_bank( int bank )			{ int r = m_reg_bank; m_reg_bank = bank; return r; }
-	void setType(string type_name)			{ m_type_name = type_name; }
+	void set_reentrant( bool reent=true )	{ m_is_reentrant = reent; }
+	void setType(string type_name)			{ m_type_name = mSession->strings()->intern(type_name); }
+	
+	/** Keep the type chain of the symbol's cdb record, eg "({2}DA2,SC:U)".
+		It is only decoded into type() / array_dims() / the return type the
+		first time one of them is needed, most symbols never are.
+	*/
+	void setTypeChain( const string &chain );
 	void addParam( string param_type )		{ m_params.push_back(param_type); }
 	void setReturn( string return_type )	{ m_return_type = return_type; }
 	
@@ -90,23 +100,32 @@ public:
 		\param size Size of the new dimention.
 	*/
 	void AddArrayDim( uint16_t size )		{ m_array_dim.push_back(size); }
+	std::vector<uint16_t> array_dims()		{ resolve_type(); return m_array_dim; }
 	
-	string		name()				{ return m_name; }
-	string		file()				{ return m_file; }
+	const string &name()			{ return mSession->strings()->str(m_name); }
+	const string &file()			{ return mSession->strings()->str(m_file); }
 	uint32_t	addr()				{ return m_start_addr; }
 	int			line()				{ return m_line; }
 	int			level()				{ return m_level; }
 	int			block()				{ return m_block; }
 	SCOPE		scope()				{ return m_scope; }
-	string		function()			{ return m_function; }
+	const string &function()		{ return mSession->strings()->str(m_function); }
 	uint32_t	endAddr()			{ return m_end_addr; }
+	bool		onStack()			{ return m_on_stack; }
+	int			stackOffset()		{ return m_stack_ofs; }
 	// function symbol specific values
 	bool		isFunction()		{ return m_bFunction; }
 	bool		is_int_handler()	{ return m_is_int; }
 	int			interrupt_num()		{ return m_int_num; }
 	int			reg_bank()			{ return m_reg_bank; }
-	string 		type()				{ return m_type_name; }
+	/// true if the function keeps its locals on the stack, see SymTab::build_index()
+	bool		is_reentrant()		{ return m_is_reentrant; }
+	const string &type()			{ resolve_type(); return mSession->strings()->str(m_type_name); }
 	FLAT_ADDR	flat_start_addr();
+	// ids of the names in the session's StrPool, for comparisons
+	StrPool::ID	name_id()			{ return m_name; }
+	StrPool::ID	file_id()			{ return m_file; }
+	StrPool::ID	function_id()		{ return m_function; }
 
 	// type information, especially useful for structures.
 	//set_type( string type );
@@ -117,13 +136,11 @@ public:
 	
 	
 	void dump();
-	void print( char format );
-	void print( char format, std::string expr );
 
 protected:
 	DbgSession	*mSession;
-	string		m_name;
-	string		m_file;
+	StrPool::ID	m_name;
+	StrPool::ID	m_file;
 	uint32_t	m_start_addr;
 //	uint32_t	end_addr;
 	SCOPE		m_scope;
@@ -132,22 +149,26 @@ protected:
 	int			m_block;
 	int			m_length;
 	int			m_end_addr;
-	string		m_function;
+	StrPool::ID	m_function;
 	ADDR_SPACE	m_addr_space;
 	list<string> m_regs;
+	bool		m_on_stack;
+	int			m_stack_ofs;
 	list<string> m_params;		// parameters for function symbols
 	string 		m_return_type;	// return type for functions
 	bool		m_bFunction;
-	string		m_type_name;
+	StrPool::ID	m_type_name;
+	StrPool::ID	m_type_chain;	///< undecoded type chain, see setTypeChain()
+	bool		m_type_resolved;	///< the type chain has been decoded
 	
 	std::vector<uint16_t> m_array_dim;
 	
 	bool	m_is_int;
 	int		m_int_num;
 	int		m_reg_bank;
-
-	void print_array( char format, int dim_num, FLAT_ADDR &addr, SymType *type );
-	bool array_index_lookup( std::string index, int32_t &result );
+	bool	m_is_reentrant;
+	
+	void resolve_type();
 };
 
 #endif
@@ -0,0 +1,591 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <iostream>
+#include <map>
+#include "symcache.h"
+
+using namespace std;
+
+#define CACHE_MAGIC		0x4244434e		// "NCDB"
+#define CACHE_VERSION	5
+#define NO_FILE			0xffffffff		///< mtime recorded for a missing file
+
+SymCache::SymCache( DbgSession *session )
+	: mSession(session), in(0), in_end(0), in_ok(false)
+{
+}
+
+SymCache::~SymCache()
+{
+}
+
+string SymCache::cache_name( const string &cdb_file )
+{
+	return cdb_file + ".cache";
+}
+
+static uint32_t file_mtime( const string &path, uint32_t *size=0 )
+{
+	struct stat st;
+	if( stat( path.c_str(), &st )!=0 )
+		return NO_FILE;
+	if( size )
+		*size = st.st_size;
+	return st.st_mtime;
+}
+
+
+/** A cache image held in memory for sessions loading the same cdb file.
+	The data never changes once published, a newer image for the same file
+	replaces the map entry and the old one lives on until its users let go.
+	While the first session to want a file is still loading it the entry is
+	pending and other sessions wait for it rather than parsing too.
+*/
+typedef struct
+{
+	string		data;
+	int			refs;		///< sessions whose symbols came from / went into it
+	DbgSession	*builder;	///< session loading it, 0 once published
+} SHARED_IMAGE;
+typedef map<string,SHARED_IMAGE*>			SHARED_MAP;
+typedef map<DbgSession*,SHARED_IMAGE*>		SHARED_USERS;
+
+static SHARED_MAP		shared_images;		///< keyed by cdb file
+static SHARED_USERS		shared_users;
+static pthread_mutex_t	shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	shared_published = PTHREAD_COND_INITIALIZER;
+
+/// the same file gets the same key however the path was spelt
+static string shared_key( const string &cdb_file )
+{
+	char buf[PATH_MAX];
+	return realpath( cdb_file.c_str(), buf ) ? string(buf) : cdb_file;
+}
+
+static void unmap_shared( SHARED_IMAGE *img )
+{
+	for( SHARED_MAP::iterator i=shared_images.begin();
+		 i!=shared_images.end(); ++i )
+	{
+		if( i->second==img )
+		{
+			shared_images.erase( i );
+			break;
+		}
+	}
+}
+
+/// drop session's reference and claims, caller holds shared_lock.
+static void unref_shared( DbgSession *session )
+{
+	SHARED_MAP::iterator i;
+	for( i=shared_images.begin(); i!=shared_images.end(); ++i )
+	{
+		if( i->second->builder==session )
+		{
+			// gave up loading, let a waiting session have a go
+			delete i->second;
+			shared_images.erase( i );
+			pthread_cond_broadcast( &shared_published );
+			break;
+		}
+	}
+	SHARED_USERS::iterator u = shared_users.find( session );
+	if( u==shared_users.end() )
+		return;
+	SHARED_IMAGE *img = u->second;
+	shared_users.erase( u );
+	if( --img->refs==0 )
+	{
+		unmap_shared( img );
+		delete img;
+	}
+}
+
+/// make session a user of img, caller holds shared_lock.
+static void ref_shared( DbgSession *session, SHARED_IMAGE *img )
+{
+	unref_shared( session );
+	img->refs++;
+	shared_users[session] = img;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Writing
+///////////////////////////////////////////////////////////////////////////////
+
+void SymCache::put( uint32_t v )
+{
+	out.append( (const char*)&v, sizeof(v) );
+}
+
+void SymCache::put( const string &s )
+{
+	put( uint32_t(s.length()) );
+	out.append( s );
+}
+
+void SymCache::put_symbol( Symbol &sym )
+{
+	list<string>::iterator it;
+	put( sym.name() );
+	put( sym.file() );
+	put( sym.m_start_addr );
+	put( sym.m_scope );
+	put( sym.m_line );
+	put( sym.m_level );
+	put( sym.m_block );
+	put( sym.m_length );
+	put( sym.m_end_addr );
+	put( sym.function() );
+	put( sym.m_addr_space );
+	put( sym.m_regs.size() );
+	for( it=sym.m_regs.begin(); it!=sym.m_regs.end(); ++it )
+		put( *it );
+	put( sym.m_params.size() );
+	for( it=sym.m_params.begin(); it!=sym.m_params.end(); ++it )
+		put( *it );
+	put( sym.m_bFunction );
+	put( mSession->strings()->str( sym.m_type_chain ) );
+	put( sym.m_is_int );
+	put( sym.m_int_num );
+	put( sym.m_reg_bank );
+	put( sym.m_on_stack );
+	put( sym.m_stack_ofs );
+}
+
+void SymCache::put_srcvec( Module::SrcVec &v )
+{
+	put( v.size() );
+	for( int i=0; i<v.size(); i++ )
+	{
+		put( v[i].addr );
+		put( v[i].block );
+		put( v[i].level );
+	}
+}
+
+void SymCache::put_addrmap( Module::AddrMap &m )
+{
+	Module::AddrMap::iterator it;
+	put( m.size() );
+	for( it=m.begin(); it!=m.end(); ++it )
+	{
+		put( it->first );
+		put( it->second );
+	}
+}
+
+bool SymCache::serialise( const string &cdb_file )
+{
+	SymTab *symtab = mSession->symtab();
+	SymTypeTree *tree = mSession->symtree();
+	ModuleMgr *mods = mSession->modulemgr();
+	ModuleMgr::ModMap::iterator mit;
+	SymTab::SYMLIST::iterator sit;
+	uint32_t size = 0, mtime;
+	int i, j;
+
+	mtime = file_mtime( cdb_file, &size );
+	if( mtime==NO_FILE )
+		return false;
+	out.clear();
+	put( CACHE_MAGIC );
+	put( CACHE_VERSION );
+	put( size );
+	put( mtime );
+
+	// source files the modules were loaded from
+	vector<string> sources;
+	for( mit=mods->mMap.begin(); mit!=mods->mMap.end(); ++mit )
+	{
+		if( !mit->second.c_file_path.empty() )
+			sources.push_back( mit->second.c_file_path );
+		if( !mit->second.asm_file_path.empty() )
+			sources.push_back( mit->second.asm_file_path );
+	}
+	put( sources.size() );
+	for( i=0; i<sources.size(); i++ )
+	{
+		put( sources[i] );
+		put( file_mtime( sources[i] ) );
+	}
+
+	// symbol table
+	put( symtab->file_map.size() );
+	for( i=0; i<symtab->file_map.size(); i++ )
+		put( symtab->file_map[i] );
+	put( symtab->m_symlist.size() );
+	for( sit=symtab->m_symlist.begin(); sit!=symtab->m_symlist.end(); ++sit )
+		put_symbol( *sit );
+	SymTab::FILE_LIST *lists[2] = { &symtab->c_file_list, &symtab->asm_file_list };
+	for( j=0; j<2; j++ )
+	{
+		put( lists[j]->size() );
+		for( i=0; i<lists[j]->size(); i++ )
+		{
+			SymTab::FILE_ENTRY &ent = (*lists[j])[i];
+			put( ent.file_id );
+			put( mSession->strings()->str( ent.function ) );
+			put( ent.line_num );
+			put( ent.level );
+			put( ent.block );
+			put( ent.addr );
+		}
+	}
+
+	// structure type records, decoded or not
+	put( tree->m_records.size() );
+	for( i=0; i<tree->m_records.size(); i++ )
+	{
+		put( tree->m_records[i].file );
+		put( tree->m_records[i].name );
+		put( tree->m_records[i].record );
+	}
+
+	// modules
+	put( mods->mMap.size() );
+	for( mit=mods->mMap.begin(); mit!=mods->mMap.end(); ++mit )
+	{
+		Module &m = mit->second;
+		put( mit->first );
+		put( m.module_name );
+		put( m.c_file_name );
+		put( m.c_file_path );
+		put_srcvec( m.c_src );
+		put_addrmap( m.c_addr_map );
+		put( m.asm_file_name );
+		put( m.asm_file_path );
+		put_srcvec( m.asm_src );
+		put_addrmap( m.asm_addr_map );
+	}
+
+	return true;
+}
+
+bool SymCache::save( string cdb_file )
+{
+	if( out.empty() && !serialise( cdb_file ) )
+		return false;
+
+	// write to a temporary and rename so readers never see half a cache
+	string name = cache_name( cdb_file );
+	string tmp = name + ".tmp";
+	FILE *f = fopen( tmp.c_str(), "wb" );
+	if( !f )
+		return false;
+	bool ok = fwrite( out.data(), 1, out.size(), f )==out.size();
+	ok = fclose( f )==0 && ok;
+	if( !ok || rename( tmp.c_str(), name.c_str() )!=0 )
+	{
+		unlink( tmp.c_str() );
+		return false;
+	}
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Reading
+///////////////////////////////////////////////////////////////////////////////
+
+uint32_t SymCache::get()
+{
+	uint32_t v = 0;
+	if( in_end-in < (int)sizeof(v) )
+	{
+		in_ok = false;
+		in = in_end;
+		return 0;
+	}
+	memcpy( &v, in, sizeof(v) );
+	in += sizeof(v);
+	return v;
+}
+
+string SymCache::get_str()
+{
+	uint32_t len = get();
+	if( len > uint32_t(in_end-in) )
+	{
+		in_ok = false;
+		in = in_end;
+		return "";
+	}
+	string s( in, len );
+	in += len;
+	return s;
+}
+
+void SymCache::get_symbol( Symbol &sym )
+{
+	uint32_t n;
+	sym.setName( get_str() );
+	sym.setFile( get_str() );
+	sym.m_start_addr	= get();
+	sym.m_scope			= Symbol::SCOPE( get() );
+	sym.m_line			= get();
+	sym.m_level			= get();
+	sym.m_block			= get();
+	sym.m_length		= get();
+	sym.m_end_addr		= get();
+	sym.setFunction( get_str() );
+	sym.m_addr_space	= Symbol::ADDR_SPACE( get() );
+	for( n=get(); n>0 && in_ok; n-- )
+		sym.m_regs.push_back( get_str() );
+	for( n=get(); n>0 && in_ok; n-- )
+		sym.m_params.push_back( get_str() );
+	sym.m_bFunction		= get();
+	sym.setTypeChain( get_str() );
+	sym.m_is_int		= get();
+	sym.m_int_num		= get();
+	sym.m_reg_bank		= get();
+	sym.m_on_stack		= get();
+	sym.m_stack_ofs		= get();
+}
+
+void SymCache::get_srcvec( Module::SrcVec &v )
+{
+	uint32_t n = get();
+	if( n > uint32_t(in_end-in) )
+	{
+		in_ok = false;
+		return;
+	}
+	v.resize( n );
+	for( uint32_t i=0; i<n && in_ok; i++ )
+	{
+		v[i].addr	= get();
+		v[i].block	= get();
+		v[i].level	= get();
+	}
+}
+
+void SymCache::get_addrmap( Module::AddrMap &m )
+{
+	ADDR a;
+	for( uint32_t n=get(); n>0 && in_ok; n-- )
+	{
+		a = get();
+		m[a] = get();
+	}
+}
+
+bool SymCache::check_source( const string &path, uint32_t mtime )
+{
+	return file_mtime( path )==mtime;
+}
+
+bool SymCache::load( string cdb_file )
+{
+	struct stat st;
+	const char *map;
+	int fd;
+	bool ok;
+
+	if( file_mtime( cdb_file )==NO_FILE )
+		return false;
+	fd = open( cache_name( cdb_file ).c_str(), O_RDONLY );
+	if( fd<0 )
+		return false;
+	if( fstat( fd, &st )!=0 || st.st_size==0 )
+	{
+		close( fd );
+		return false;
+	}
+	map = (const char*)mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( map==MAP_FAILED )
+		return false;
+	ok = decode( map, map + st.st_size, cdb_file );
+	munmap( (void*)map, st.st_size );
+	return ok;
+}
+
+bool SymCache::load_shared( string cdb_file )
+{
+	const string key = shared_key( cdb_file );
+	SHARED_IMAGE *img;
+	SHARED_MAP::iterator i;
+
+	pthread_mutex_lock( &shared_lock );
+	unref_shared( mSession );
+	for(;;)
+	{
+		i = shared_images.find( key );
+		if( i==shared_images.end() )
+		{
+			// first one here, claim it until we publish or release
+			img = new SHARED_IMAGE;
+			img->refs = 0;
+			img->builder = mSession;
+			shared_images[key] = img;
+			pthread_mutex_unlock( &shared_lock );
+			return false;
+		}
+		if( !i->second->builder )
+			break;
+		pthread_cond_wait( &shared_published, &shared_lock );
+	}
+	img = i->second;
+	ref_shared( mSession, img );		// keeps data alive while decoding
+	pthread_mutex_unlock( &shared_lock );
+	if( decode( img->data.data(), img->data.data()+img->data.size(), cdb_file ) )
+		return true;
+	release( mSession );
+	return false;
+}
+
+bool SymCache::publish( string cdb_file )
+{
+	const string key = shared_key( cdb_file );
+	if( out.empty() && !serialise( cdb_file ) )
+	{
+		release( mSession );
+		return false;
+	}
+	SHARED_IMAGE *img;
+
+	pthread_mutex_lock( &shared_lock );
+	SHARED_MAP::iterator i = shared_images.find( key );
+	if( i!=shared_images.end() && i->second->builder==mSession )
+		img = i->second;	// our claim
+	else
+	{
+		img = new SHARED_IMAGE;
+		img->refs = 0;
+		shared_images[key] = img;		// an older image stays with its users
+	}
+	img->data = out;
+	img->builder = 0;
+	ref_shared( mSession, img );
+	pthread_cond_broadcast( &shared_published );
+	pthread_mutex_unlock( &shared_lock );
+	return true;
+}
+
+void SymCache::release( DbgSession *session )
+{
+	pthread_mutex_lock( &shared_lock );
+	unref_shared( session );
+	pthread_mutex_unlock( &shared_lock );
+}
+
+bool SymCache::decode( const char *start, const char *end,
+					   const string &cdb_file )
+{
+	SymTab *symtab = mSession->symtab();
+	SymTypeTree *tree = mSession->symtree();
+	ModuleMgr *mods = mSession->modulemgr();
+	uint32_t size = 0, mtime, n, i;
+
+	mtime = file_mtime( cdb_file, &size );
+	in = start;
+	in_end = end;
+	in_ok = true;
+
+	// is it still current?
+	if( get()!=CACHE_MAGIC || get()!=CACHE_VERSION ||
+		get()!=size || get()!=mtime )
+		in_ok = false;
+	for( n=get(); n>0 && in_ok; n-- )
+	{
+		string path = get_str();
+		if( !check_source( path, get() ) )
+			in_ok = false;
+	}
+	if( !in_ok )
+		return false;
+
+	// symbol table
+	symtab->clear();
+	for( n=get(); n>0 && in_ok; n-- )
+		symtab->file_map.push_back( get_str() );
+	for( n=get(); n>0 && in_ok; n-- )
+	{
+		Symbol sym( mSession );
+		get_symbol( sym );
+		symtab->insert_symbol( sym );
+	}
+	SymTab::FILE_LIST *lists[2] = { &symtab->c_file_list, &symtab->asm_file_list };
+	for( i=0; i<2; i++ )
+	{
+		for( n=get(); n>0 && in_ok; n-- )
+		{
+			SymTab::FILE_ENTRY ent;
+			ent.file_id		= get();
+			ent.function	= mSession->strings()->intern( get_str() );
+			ent.line_num	= get();
+			ent.level		= get();
+			ent.block		= get();
+			ent.addr		= get();
+			lists[i]->push_back( ent );
+		}
+	}
+
+	// structure type records
+	tree->clear();
+	for( n=get(); n>0 && in_ok; n-- )
+	{
+		string file = get_str();
+		string name = get_str();
+		tree->add_type_record( file, name, get_str() );
+	}
+
+	// modules
+	mods->reset();
+	for( n=get(); n>0 && in_ok; n-- )
+	{
+		Module &m = mods->mMap[ get_str() ];
+		m.module_name	= get_str();
+		m.c_file_name	= get_str();
+		m.c_file_path	= get_str();
+		m.c_file.set_path( m.c_file_path );
+		get_srcvec( m.c_src );
+		get_addrmap( m.c_addr_map );
+		m.asm_file_name	= get_str();
+		m.asm_file_path	= get_str();
+		m.asm_file.set_path( m.asm_file_path );
+		get_srcvec( m.asm_src );
+		get_addrmap( m.asm_addr_map );
+	}
+
+	if( !in_ok || in!=in_end )
+	{
+		// corrupt, leave empty tables for the caller to parse into
+		cout << "Ignoring corrupt symbol cache for '"<<cdb_file<<"'"<<endl;
+		symtab->clear();
+		tree->clear();
+		mods->reset();
+		return false;
+	}
+	symtab->build_index();
+	return true;
+}
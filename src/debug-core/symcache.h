@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef SYMCACHE_H
+#define SYMCACHE_H
+#include <string>
+#include <stdint.h>
+#include "dbgsession.h"
+#include "symtab.h"
+#include "symtypetree.h"
+#include "module.h"
+
+using namespace std;
+
+/**	Binary cache of a loaded cdb file.
+	Holds the symbol table, the structure types and the modules' line
+	tables, so a later load of the same cdb file is a single mapped read.
+	The cache lives next to the cdb file (name.cdb.cache) and is only used
+	while the cdb file and every source file it references still have the
+	size / modification time recorded when it was written.
+
+	The same image can also be shared in memory between the sessions of one
+	process, see publish().  Sessions each decode their own tables from it
+	since symbols and types refer back to their session, but the cdb file is
+	only parsed once however many targets are running the same firmware.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class SymCache
+{
+public:
+	SymCache( DbgSession *session );
+	~SymCache();
+
+	/** Load the session state from the cache for cdb_file.
+		\returns true if a valid cache was loaded, false if the cache is
+				 missing / stale, in which case nothing was changed.
+	*/
+	bool load( string cdb_file );
+
+	/** Write the current session state to the cache for cdb_file.
+		\returns true on success.
+	*/
+	bool save( string cdb_file );
+
+	/** Load the session state from an image of cdb_file published by this
+		or another session in the process.  The session holds a reference
+		to the image until release().
+		\returns true if a current image was loaded, false otherwise, in
+				 which case nothing was changed.
+	*/
+	bool load_shared( string cdb_file );
+
+	/** Make the current session state available to load_shared() in other
+		sessions, replacing any older image of cdb_file.  The session holds
+		a reference to the image until release().
+		\returns true on success.
+	*/
+	bool publish( string cdb_file );
+
+	/** Drop the session's reference to a shared image, the image is freed
+		once no session refers to it.  Safe to call from any thread, and on
+		a session holding no reference.
+	*/
+	static void release( DbgSession *session );
+
+protected:
+	DbgSession	*mSession;
+
+	// writing
+	string		out;			///< serialised state, kept for save() and publish()
+	bool serialise( const string &cdb_file );
+	void put( uint32_t v );
+	void put( const string &s );
+	void put_symbol( Symbol &sym );
+	void put_srcvec( Module::SrcVec &v );
+	void put_addrmap( Module::AddrMap &m );
+
+	// reading
+	const char	*in, *in_end;
+	bool		in_ok;
+	bool decode( const char *start, const char *end, const string &cdb_file );
+	uint32_t get();
+	string get_str();
+	void get_symbol( Symbol &sym );
+	void get_srcvec( Module::SrcVec &v );
+	void get_addrmap( Module::AddrMap &m );
+
+	bool check_source( const string &path, uint32_t mtime );
+	static string cache_name( const string &cdb_file );
+};
+
+#endif
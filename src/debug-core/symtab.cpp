@@ -22,14 +22,18 @@
 #include <unistd.h>
 #include <iostream>
 #include <stdio.h>
+#include <limits.h>
+#include <algorithm>
 #include "symtab.h"
 #include "module.h"
 
 using namespace std;
 
 SymTab::SymTab( DbgSession *session )
-	: mSession(session)
+	: mSession(session), m_index_valid(false), m_generation(0),
+	  m_complete_gen(0)
 {
+	m_ctx.pool_size = 0;	// the pool always holds "", so never matches
 }
 
 
@@ -41,9 +45,57 @@ void SymTab::clear()
 {
 	// @TODO clear all tables
 	m_symlist.clear();
+	m_name_index.clear();
+	m_addr_index.clear();
+	m_func_index.clear();
+	m_index_valid = false;
 	file_map.clear();
+	m_file_ids.clear();
 	c_file_list.clear();
 	asm_file_list.clear();
+	c_by_addr.clear();
+	asm_by_addr.clear();
+	c_lines.clear();
+	asm_lines.clear();
+}
+
+void SymTab::clear_symbols()
+{
+	m_symlist.clear();
+	m_name_index.clear();
+	m_addr_index.clear();
+	m_func_index.clear();
+	m_index_valid = false;
+}
+
+/** \returns the name of a file without its extension.
+*/
+static string strip_ext( const string &name )
+{
+	string::size_type dot = name.rfind('.'), slash = name.rfind('/');
+	if( dot==string::npos || ( slash!=string::npos && dot<slash ) )
+		return name;
+	return name.substr( 0, dot );
+}
+
+void SymTab::remove_lines( const string &module )
+{
+	FILE_LIST *lists[2] = { &c_file_list, &asm_file_list };
+	vector<bool> match( file_map.size() );
+	for( int i=0; i<file_map.size(); i++ )
+		match[i] = strip_ext( file_map[i] )==module;
+	for( int l=0; l<2; l++ )
+	{
+		FILE_LIST &files = *lists[l];
+		int n = 0;
+		for( int i=0; i<files.size(); i++ )
+		{
+			if( !match[ files[i].file_id ] )
+				files[n++] = files[i];
+		}
+		files.resize( n );
+	}
+	m_index_valid = false;
 }
 
 bool SymTab::getSymbol( string file,
@@ -51,18 +103,16 @@ bool SymTab::getSymbol( string file,
 						string name,
 						SYMLIST::iterator &it)
 {
-	cout<<"looking for "<<file<<", "<<name<<", "<<scope<<endl;
-	for( it=m_symlist.begin(); it!=m_symlist.end(); it++ )
+	NAME_RANGE r;
+	StrPool::ID fid = find_id( file );
+	r = named( find_id( name ) );
+	for( SYM_VEC::iterator i=r.first; i!=r.second; ++i )
 	{
-		cout << "checking "<<it->file()<<", "<<it->scope()<<", "<<it->name()<<endl;
-		if( it->file().compare(file)==0	&&
-			it->scope()==scope			&&
-			it->name().compare(name)==0 )
-		{
-			//cout <<"lookup match!!!!!"<<endl;
+		it = *i;
+		if( it->file_id()==fid && it->scope()==scope )
 			return true;
-		}
 	}
+	it = m_symlist.end();
 	return false;
 }
 
@@ -71,50 +121,83 @@ bool SymTab::getSymbol( string name,
 						ContextMgr::Context context,
 						SYMLIST::iterator &it)
 {
-	// there are more efficient ways of doing this.
-	// this is just quick and dirty for now and should be cleaned up
+	NAME_RANGE r;
+	SYM_VEC::iterator i;
+	SYMLIST::iterator file_match = m_symlist.end();
+	SYMLIST::iterator global_match = m_symlist.end();
+	CONTEXT_IDS *ids = 0;	// only looked up for local / file symbols
 	
-	// search local scope
-	for( it=m_symlist.begin(); it!=m_symlist.end(); it++ )
-	{
-		if( (it->name().compare(name)==0)					&&
-			((it->file().compare(context.module+".c")) ||
-			(it->file().compare(context.module+".asm")))	&&
-			(it->function()==context.function) &&
-			(it->scope()==Symbol::SCOPE_LOCAL) )
-		{
-			cout <<"MATCH LOCAL"<<endl;
-			return true;
-		}
-	}
-	
-	// File scope
-	for( it=m_symlist.begin(); it!=m_symlist.end(); it++ )
+	// one pass over the symbols of that name, local scope wins, then a file
+	// scope symbol (preferably from the current module), then global.
+	r = named( find_id( name ) );
+	for( i=r.first; i!=r.second; ++i )
 	{
-		if( (it->name().compare(name)==0)					&&
-			((it->file().compare(context.module+".c")) ||
-			(it->file().compare(context.module+".asm")))	&&
-			(it->scope()==Symbol::SCOPE_FILE) )
+		it = *i;
+		switch( it->scope() )
 		{
-			cout <<"MATCH FILE"<<endl;
-			return true;
+			case Symbol::SCOPE_LOCAL:
+				if( !ids )
+					ids = &context_ids( context );
+				if( it->function_id()==ids->func )
+					return true;
+				break;
+			case Symbol::SCOPE_FILE:
+				if( !ids )
+					ids = &context_ids( context );
+				if( file_match==m_symlist.end() ||
+					it->file_id()==ids->mod ||
+					it->file_id()==ids->mod_c ||
+					it->file_id()==ids->mod_asm )
+					file_match = it;
+				break;
+			case Symbol::SCOPE_GLOBAL:
+				if( global_match==m_symlist.end() )
+					global_match = it;
+				break;
+			default:
+				break;
 		}
 	}
-	
-	// Global scope
-	for( it=m_symlist.begin(); it!=m_symlist.end(); it++ )
+	it = file_match!=m_symlist.end() ? file_match : global_match;
+	return it!=m_symlist.end();
+}
+
+
+void SymTab::get_locals( ContextMgr::Context context, vector<Symbol*> &syms )
+{
+	StrPool::ID func = context_ids( context ).func;
+	if( func==StrPool::NONE )
+		return;
+	for( SYMLIST::iterator it=m_symlist.begin(); it!=m_symlist.end(); ++it )
 	{
-		if( (it->name().compare(name)==0)	&&
-		    (it->scope()==Symbol::SCOPE_GLOBAL) )
-		{
-			cout <<"MATCH FILE"<<endl;
-			return true;
-		}
+		if( it->scope()==Symbol::SCOPE_LOCAL && it->function_id()==func )
+			syms.push_back( &(*it) );
 	}
-	return false;
 }
 
 
+/** Get the ids of the function and module file names of a context.
+	Lookups tend to come from the same context over and over, so the ids of
+	the last one are kept until the context or the pool changes.
+*/
+SymTab::CONTEXT_IDS &SymTab::context_ids( ContextMgr::Context &context )
+{
+	StrPool *pool = mSession->strings();
+	if( m_ctx.pool_size!=pool->size() ||
+		m_ctx.function!=context.function ||
+		m_ctx.module!=context.module )
+	{
+		m_ctx.module	= context.module;
+		m_ctx.function	= context.function;
+		m_ctx.pool_size	= pool->size();
+		m_ctx.func		= pool->find( context.function );
+		m_ctx.mod		= pool->find( context.module );
+		m_ctx.mod_c		= pool->find( context.module+".c" );
+		m_ctx.mod_asm	= pool->find( context.module+".asm" );
+	}
+	return m_ctx;
+}
+
 void SymTab::dump()
 {
 	dump_symbols();
@@ -177,23 +260,164 @@ void SymTab::addSymbol( Symbol sym )
 	// @FIXME: currently we are seeing duplicate symbols here and are creating 2 entries...
 	// FIXME: the duplicate check should n't be here, we know what will double up in cdbfile so detect and manage  it there.
 	
+	NAME_RANGE r;
+	r = named( sym.name_id() );
+	for( SYM_VEC::iterator i=r.first; i!=r.second; ++i )
+	{
+		if( (*i)->scope()==sym.scope() )
+			cout<<"RELOADING SYMBOL "<<sym.name()<<endl;
+	}
+	insert_symbol( sym );
+}
+
+/** Add a symbol to the list and the name index.
+	\returns iterator pointing at the new entry.
+*/
+SymTab::SYMLIST::iterator SymTab::insert_symbol( Symbol &sym )
+{
+	SYMLIST::iterator it = m_symlist.insert( m_symlist.end(), sym );
+	if( sym.name_id()>=m_name_index.size() )
+		m_name_index.resize( sym.name_id()+1 );
+	m_name_index[sym.name_id()].push_back( it );
+	m_index_valid = false;
+	return it;
+}
+
+/** \returns the symbols named by id, empty if there are none.
+*/
+SymTab::NAME_RANGE SymTab::named( StrPool::ID id )
+{
+	static SYM_VEC none;
+	SYM_VEC &v = id<m_name_index.size() ? m_name_index[id] : none;
+	return NAME_RANGE( v.begin(), v.end() );
+}
+
+void SymTab::build_index()
+{
 	SYMLIST::iterator it;
+	ADDR_ENTRY ent;
+	
+	m_addr_index.clear();
+	m_func_index.clear();
 	for( it=m_symlist.begin(); it!=m_symlist.end(); ++it )
 	{
-//		if( (*it).name()==sym.name()	&&
-//			(*it).file()==sym.file()	&&
-//			(*it).level()==sym.level()	&&
-//			(*it).block()==sym.block()	&&
-//			(*it).isFunction()			)
-		if( (*it).name()==sym.name()	&&
-			(*it).scope()==sym.scope() )
+		ent.sym = it;
+		if( it->isFunction() )
 		{
-			cout<<"===================================================================================================================================================RELOADING SYMBOL!!!!!"<<endl;
+			it->set_reentrant( false );
+			ent.start = it->addr();
+			ent.end = it->endAddr();
+			m_func_index.push_back( ent );
 		}
+		ent.start = it->flat_start_addr();
+		if( ent.start==MemRemap::INVALID_FLAT_ADDR )
+			continue;
+		ent.end = ent.start + ( it->endAddr()>it->addr() ?
+								it->endAddr()-it->addr() : 0 );
+		m_addr_index.push_back( ent );
 	}
+	// SDCC doesn't flag reentrant functions, but only their locals are on
+	// the stack
+	for( it=m_symlist.begin(); it!=m_symlist.end(); ++it )
+	{
+		if( !it->onStack() || it->function_id()==0 )
+			continue;
+		NAME_RANGE r = named( it->function_id() );
+		for( SYM_VEC::iterator i=r.first; i!=r.second; ++i )
+			if( (*i)->isFunction() )
+				(*i)->set_reentrant();
+	}
+	// stable so the first symbol loaded at an address wins, as before
+	stable_sort( m_addr_index.begin(), m_addr_index.end(), addr_less );
+	stable_sort( m_func_index.begin(), m_func_index.end(), addr_less );
+	build_line_index( c_file_list, c_by_addr, c_lines );
+	build_line_index( asm_file_list, asm_by_addr, asm_lines );
+	m_index_valid = true;
+	m_generation++;
+	m_expr_cache.clear();	// plans may refer to symbols that have changed
+}
+
+/** Sort the entries of a file list by address and work out the range of
+	addresses belonging to each line.
+*/
+void SymTab::build_line_index( FILE_LIST &files, ENTRY_INDEX &by_addr,
+							   LINE_INDEX &lines )
+{
+	int i, next;
+	ADDR end;
+	LINE_INDEX::iterator lit;
 	
+	by_addr.clear();
+	lines.clear();
+	by_addr.reserve( files.size() );
+	for( i=0; i<files.size(); i++ )
+		by_addr.push_back( make_pair( files[i].addr, i ) );
+	sort( by_addr.begin(), by_addr.end() );	// ties keep file list order
 	
-	m_symlist.push_back(sym);
+	for( i=0, next=0; i<by_addr.size(); i++ )
+	{
+		// a line owns everything up to where the next address starts
+		while( next<by_addr.size() && by_addr[next].first==by_addr[i].first )
+			next++;
+		end = next<by_addr.size() ? by_addr[next].first-1 : by_addr[i].first;
+		
+		FILE_ENTRY &ent = files[by_addr[i].second];
+		pair<int,LINE_NUM> key( ent.file_id, ent.line_num );
+		lit = lines.find( key );
+		if( lit==lines.end() )
+		{
+			LINE_RANGE r;
+			r.start = ent.addr;
+			r.end = end;
+			r.entry = by_addr[i].second;
+			lines.insert( LINE_INDEX::value_type( key, r ) );
+			continue;
+		}
+		// entries are visited in address order so start is already lowest
+		if( end>lit->second.end )
+			lit->second.end = end;
+		if( by_addr[i].second<lit->second.entry )
+			lit->second.entry = by_addr[i].second;
+	}
+}
+
+/** \returns index into the file list of the first entry at addr, or -1.
+*/
+int SymTab::find_entry( ENTRY_INDEX &by_addr, ADDR addr )
+{
+	ENTRY_INDEX::iterator it;
+	if( addr<0 || addr>0xffff )
+		return -1;
+	it = lower_bound( by_addr.begin(), by_addr.end(),
+					  make_pair( uint16_t(addr), -1 ) );
+	if( it==by_addr.end() || it->first!=addr )
+		return -1;
+	return it->second;
+}
+
+SymTab::LINE_INDEX::iterator SymTab::find_line( LINE_INDEX &lines, int fid,
+												 LINE_NUM line )
+{
+	check_index();
+	return lines.find( make_pair( fid, line ) );
+}
+
+/** Find the first entry of the closest run of entries starting at or below
+	addr.
+	\returns iterator to the entry, or index.end() if all start above addr.
+*/
+SymTab::ADDR_INDEX::iterator SymTab::find_preceding( ADDR_INDEX &index,
+													 uint32_t addr )
+{
+	ADDR_ENTRY key;
+	ADDR_INDEX::iterator it;
+	key.start = addr;
+	it = upper_bound( index.begin(), index.end(), key, addr_less );
+	if( it==index.begin() )
+		return index.end();
+	--it;
+	key.start = it->start;
+	return lower_bound( index.begin(), it, key, addr_less );
 }
 
  
@@ -205,23 +429,23 @@ void SymTab::addSymbol( Symbol sym )
 */
 int32_t SymTab::get_addr( string file, int line_num )
 {
-	FILE_LIST::iterator it;
+	LINE_INDEX::iterator it;
 	int fid = file_id(file);
 	if(fid==-1)
 		return -1;	// failure
 	if( file.substr(file.length()-2).compare(".c")==0 )
 	{
-		for( it=c_file_list.begin(); it!=c_file_list.end(); ++it)
-			if( (*it).file_id == fid && (*it).line_num==line_num )
-				return (*it).addr;
+		it = find_line( c_lines, fid, line_num );
+		if( it!=c_lines.end() )
+			return c_file_list[it->second.entry].addr;
 		cout <<" Error: "<<file<<" line number not found"<<endl;
 	}
 	else if( file.substr(file.length()-4).compare(".asm")==0 ||
 			 file.substr(file.length()-4).compare(".a51")==0 )
 	{
-		for( it=asm_file_list.begin(); it!=asm_file_list.end(); ++it)
-			if( (*it).file_id == fid && (*it).line_num==line_num )
-				return (*it).addr;
+		it = find_line( asm_lines, fid, line_num );
+		if( it!=asm_lines.end() )
+			return asm_file_list[it->second.entry].addr;
 		cout <<" Error: "<<file<<" line number not found"<<endl;
 	}
 	else
@@ -238,21 +462,7 @@ int32_t SymTab::get_addr( string file, int line_num )
 bool SymTab::get_addr( string file, string function, int32_t &addr,
 						int32_t &endaddr )
 {
-	SYMLIST::iterator it;
-	for( it=m_symlist.begin(); it!=m_symlist.end(); ++it )
-	{
-		if( (*it).isFunction() )
-		{
-			cout <<"checking file="<<(*it).file()<<" function="<<(*it).name()<<endl;
-			if( (*it).name()==function )
-			{
-				addr = (*it).addr();
-				endaddr = (*it).endAddr();
-				return true;
-			}
-		}
-	}
-	return false;
+	return get_addr( function, addr, endaddr );
 }
 
 
@@ -263,8 +473,11 @@ bool SymTab::get_addr( string file, string function, int32_t &addr,
 int32_t SymTab::get_addr( string function )
 {
 	FILE_LIST::iterator it;
+	StrPool::ID fid = find_id( function );
+	if( fid==StrPool::NONE )
+		return -1;	// failure
 	for( it=c_file_list.begin(); it!=c_file_list.end(); ++it)
-		if( (*it).function==function )
+		if( (*it).function==fid )
 			return (*it).addr;
 	return -1;	// failure
 }
@@ -272,17 +485,15 @@ int32_t SymTab::get_addr( string function )
 
 bool SymTab::get_addr( string function, int32_t &addr, int32_t &endaddr )
 {
-	SYMLIST::iterator it;
-	for( it=m_symlist.begin(); it!=m_symlist.end(); ++it )
+	NAME_RANGE r;
+	r = named( find_id( function ) );
+	for( SYM_VEC::iterator i=r.first; i!=r.second; ++i )
 	{
-		if( (*it).isFunction() )
+		if( (*i)->isFunction() )
 		{
-			if( (*it).name()==function )
-			{
-				addr = (*it).addr();
-				endaddr = (*it).endAddr();
-				return true;
-			}
+			addr = (*i)->addr();
+			endaddr = (*i)->endAddr();
+			return true;
 		}
 	}
 	return false;	// failure
@@ -291,15 +502,15 @@ bool SymTab::get_addr( string function, int32_t &addr, int32_t &endaddr )
 
 bool SymTab::find_c_file_line( ADDR addr, string &file, LINE_NUM &line_num )
 {
-	FILE_LIST::iterator it;
-
-	for( it=c_file_list.begin(); it!=c_file_list.end(); ++it)
-		if( (*it).addr==addr )
-		{
-			file = file_name( (*it).file_id );
-			line_num = (*it).line_num;
-			return true;
-		}
+	int i;
+	check_index();
+	i = find_entry( c_by_addr, addr );
+	if( i!=-1 )
+	{
+		file = file_name( c_file_list[i].file_id );
+		line_num = c_file_list[i].line_num;
+		return true;
+	}
 	file = "no match";
 	line_num = LINE_NUM(-1);
 	return false;	// not found
@@ -307,19 +518,80 @@ bool SymTab::find_c_file_line( ADDR addr, string &file, LINE_NUM &line_num )
 
 bool SymTab::find_asm_file_line( uint16_t addr, string &file, int &line_num )
 {
-	FILE_LIST::iterator it;
-	for( it=asm_file_list.begin(); it!=asm_file_list.end(); ++it)
-		if( (*it).addr==addr )
-		{
-			file = file_name( (*it).file_id );
-			line_num = (*it).line_num;
-			return true;
-		}
+	int i;
+	check_index();
+	i = find_entry( asm_by_addr, addr );
+	if( i!=-1 )
+	{
+		file = file_name( asm_file_list[i].file_id );
+		line_num = asm_file_list[i].line_num;
+		return true;
+	}
 	file = "no match";
 	line_num = -1;
 	return false;	// not found
 }
 
+bool SymTab::get_line_range( string file, LINE_NUM line_num,
+							 ADDR &start, ADDR &end )
+{
+	LINE_INDEX *lines;
+	LINE_INDEX::iterator it;
+	int fid = file_id(file);
+	if( fid==-1 )
+		return false;
+	if( file.substr(file.length()-2).compare(".c")==0 )
+		lines = &c_lines;
+	else
+		lines = &asm_lines;
+	it = find_line( *lines, fid, line_num );
+	if( it==lines->end() )
+		return false;
+	start = it->second.start;
+	end = it->second.end;
+	return true;
+}
+
+void SymTab::get_c_lines( FILE_LINE_MAP &lines )
+{
+	LINE_INDEX::iterator it;
+	check_index();
+	lines.clear();
+	for( it=c_lines.begin(); it!=c_lines.end(); ++it )
+		lines[ file_name( it->first.first ) ][ it->first.second ] = it->second.start;
+}
+
+
+bool SymTab::get_c_block( ADDR addr, ADDR &start, ADDR &end )
+{
+	ENTRY_INDEX::iterator it;
+	ADDR_INDEX::iterator fit;
+	if( addr<0 || addr>0xffff )
+		return false;
+	check_index();
+	it = upper_bound( c_by_addr.begin(), c_by_addr.end(),
+					  make_pair( uint16_t(addr), INT_MAX ) );
+	if( it==c_by_addr.begin() )
+		return false;
+	start = (it-1)->first;
+	end = it==c_by_addr.end() ? 0xffff : it->first-1;
+	
+	// don't run on past the end of the function
+	fit = find_preceding( m_func_index, addr );
+	for( ; fit!=m_func_index.end() && fit->start<=addr; ++fit )
+	{
+		if( addr<=fit->end )
+		{
+			if( fit->end<end )
+				end = fit->end;
+			if( fit->start>start )
+				start = fit->start;
+			return true;
+		}
+	}
+	return false;
+}
+
 //bool SymTab::add_c_file_entry( string name, int line_num, uint16_t addr )
 bool SymTab::add_c_file_entry( string name, int line_num, int level, int block, uint16_t addr )
 {
@@ -333,17 +605,19 @@ bool SymTab::add_c_file_entry( string name, int line_num, int level, int block,
 		// first time we have encountered this c file
 		file_map.push_back(name);
 		fid = file_id(name);
-
-		m.load_c_file( name );
 	}
+	if( m.get_c_file_path().empty() )
+		m.load_c_file( name );	// new module, or reloaded by CdbFile::reload()
 	// build and add the entry
 	FILE_ENTRY	ent;
 	ent.file_id 	= fid;
+	ent.function	= 0;	// ""
 	ent.line_num	= line_num;
 	ent.level		= level;
 	ent.block		= block;
 	ent.addr		= addr;
 	c_file_list.push_back(ent);
+	m_index_valid = false;
 	m.set_c_addr( line_num, addr );
 	m.set_c_block_level( line_num, block, level );
 	return true;
@@ -365,17 +639,24 @@ bool SymTab::add_asm_file_entry( string name, int line_num, uint16_t addr )
 
 	if( fid==-1 )
 	{
-		cout <<"loading ASM '"<<name<<"'"<<endl;
 		file_map.push_back(name+ext);
 		fid = file_id(name+ext);
+	}
+	if( m.get_asm_file_path().empty() )
+	{
+		cout <<"loading ASM '"<<name<<"'"<<endl;
 		m.load_asm_file( name+ext );
 	}
 	// build and add the entry
 	FILE_ENTRY	ent;
 	ent.file_id 	= fid;
+	ent.function	= 0;	// ""
 	ent.line_num	= line_num;
+	ent.level		= 0;
+	ent.block		= 0;
 	ent.addr		= addr;
 	asm_file_list.push_back(ent);
+	m_index_valid = false;
 	
 	m.set_asm_addr( line_num, addr );
 	return true;
@@ -408,15 +689,12 @@ bool SymTab::add_function_file_entry( string file_name, int line_num,
 
 int SymTab::file_id(string filename)
 {
-	// iterate over the vector till we fine a match or the end.
-	int i=0;
-	while( i<file_map.size() )
-	{
-		//cout<<i<<" = ["<<file_map[i]<<"]"<<endl;
-		if( file_map[i]==filename )
-			return i;
-		i++;
-	}
+	// files are only ever appended to file_map, index any new ones
+	for( int i=m_file_ids.size(); i<(int)file_map.size(); i++ )
+		m_file_ids[file_map[i]] = i;
+	map<string,int>::iterator it = m_file_ids.find( filename );
+	if( it!=m_file_ids.end() )
+		return it->second;
 	return -1;		// Failure
 }
 
@@ -426,6 +704,103 @@ string SymTab::file_name( int id )
 }
 
 
+/// orders StrPool ids by their strings
+class IdLess
+{
+public:
+	IdLess( StrPool *pool ) : m_pool(pool) {}
+	bool operator()( StrPool::ID a, StrPool::ID b ) const
+		{ return m_pool->str(a) < m_pool->str(b); }
+	bool operator()( StrPool::ID a, const string &b ) const
+		{ return m_pool->str(a) < b; }
+protected:
+	StrPool *m_pool;
+};
+
+static void sort_names( vector<StrPool::ID> &v, StrPool *pool )
+{
+	sort( v.begin(), v.end() );
+	v.erase( unique( v.begin(), v.end() ), v.end() );	// each id once
+	sort( v.begin(), v.end(), IdLess( pool ) );
+}
+
+void SymTab::build_complete_index()
+{
+	StrPool *pool = mSession->strings();
+	m_complete_syms.clear();
+	m_complete_funcs.clear();
+	m_complete_files.clear();
+	for( SYMLIST::iterator it=m_symlist.begin(); it!=m_symlist.end(); ++it )
+	{
+		m_complete_syms.push_back( it->name_id() );
+		if( it->isFunction() )
+			m_complete_funcs.push_back( it->name_id() );
+	}
+	for( int i=0; i<file_map.size(); i++ )
+		m_complete_files.push_back( pool->intern( file_map[i] ) );
+	sort_names( m_complete_syms, pool );
+	sort_names( m_complete_funcs, pool );
+	sort_names( m_complete_files, pool );
+	m_complete_gen = m_generation;
+}
+
+/// add the names from index that start with prefix
+void SymTab::complete_range( SORTED_NAMES &index, const string &prefix,
+							 vector<string> &names )
+{
+	StrPool *pool = mSession->strings();
+	SORTED_NAMES::iterator it;
+	it = lower_bound( index.begin(), index.end(), prefix, IdLess( pool ) );
+	for( ; it!=index.end(); ++it )
+	{
+		const string &s = pool->str( *it );
+		if( s.compare( 0, prefix.length(), prefix )!=0 )
+			break;
+		names.push_back( s );
+	}
+}
+
+void SymTab::complete( const string &prefix, int what, vector<string> &names )
+{
+	if( m_complete_gen!=generation() )
+		build_complete_index();
+	size_t first = names.size();
+	string::size_type colon = prefix.find( ':' );
+	if( colon!=string::npos )
+	{
+		// file:func, only functions defined in that file
+		if( !(what & COMPLETE_FUNCTIONS) )
+			return;
+		string file = prefix.substr( 0, colon );
+		vector<string> funcs;
+		complete_range( m_complete_funcs, prefix.substr( colon+1 ), funcs );
+		for( size_t i=0; i<funcs.size(); i++ )
+		{
+			NAME_RANGE r = named( find_id( funcs[i] ) );
+			for( SYM_VEC::iterator it=r.first; it!=r.second; ++it )
+			{
+				if( (*it)->isFunction() && (*it)->file()==file )
+				{
+					names.push_back( file + ':' + funcs[i] );
+					break;
+				}
+			}
+		}
+		return;
+	}
+	if( what & COMPLETE_SYMBOLS )
+		complete_range( m_complete_syms, prefix, names );
+	else if( what & COMPLETE_FUNCTIONS )
+		complete_range( m_complete_funcs, prefix, names );
+	size_t mid = names.size();
+	if( what & COMPLETE_FILES )
+		complete_range( m_complete_files, prefix, names );
+	// the kinds are each in order, merge them
+	inplace_merge( names.begin()+first, names.begin()+mid, names.end() );
+	names.erase( unique( names.begin()+first, names.end() ), names.end() );
+}
+
+
 void SymTab::dump_functions()
 {
 //	FUNC_LIST::iterator it;
@@ -461,7 +836,7 @@ void SymTab::dump_functions()
 bool SymTab::compare( Symbol &sym1, Symbol &sym2 )
 {
 	if( sym1.scope() == sym2.scope() &&
-		sym1.name()  == sym2.name()	 &&
+		sym1.name_id() == sym2.name_id() &&
 		sym1.level() == sym2.level() &&
 		sym1.block() == sym2.block() )
 		return true;
@@ -473,14 +848,17 @@ bool SymTab::compare( Symbol &sym1, Symbol &sym2 )
 // @FIXME: needs to check for function name match for local scope!
 Symbol *SymTab::getSymbol( Symbol sym )
 {
-	SYMLIST::iterator it;
-	for( it=m_symlist.begin(); it!=m_symlist.end(); ++it )
+	NAME_RANGE r;
+	r = named( sym.name_id() );
+	for( SYM_VEC::iterator i=r.first; i!=r.second; ++i )
 	{
-		if( compare( (*it), sym ) )
-			return &(*it);
+		if( compare( **i, sym ) )
+		{
+			m_index_valid = false;	// caller is about to modify it
+			return &(**i);
+		}
 	}
-	m_symlist.push_back( sym );
-	return getSymbol( sym );
+	return &(*insert_symbol( sym ));
 }
 
 
@@ -493,26 +871,24 @@ bool SymTab::get_c_function( ADDR addr,
 							string &file,
 							string &func)
 {
-	SYMLIST::iterator it;
-	for( it=m_symlist.begin(); it!=m_symlist.end(); ++it )
+	Symbol *sym = get_function( addr );
+	if( !sym )
+		return false;
+	func = sym->name();
+	return true;
+}
+
+Symbol *SymTab::get_function( ADDR addr )
+{
+	ADDR_INDEX::iterator it;
+	check_index();
+	it = find_preceding( m_func_index, addr );
+	for( ; it!=m_func_index.end() && it->start<=addr; ++it )
 	{
-		if( (*it).isFunction() )
-		{
-			if( addr>=(*it).addr() && addr<=(*it).endAddr() )
-			{
-				func = (*it).name();
-				
-				return true;
-			}
-//			printf("%-20s  %-20s  0x%08x  0x%08x\n",
-//				   (*it).file().c_str(),
-//				   (*it).name().c_str(),
-//				   (*it).addr(),
-//				   (*it).endAddr()
-//				  );
-		}
+		if( addr<=it->end )
+			return &*it->sym;
 	}
-	return false;
+	return 0;
 }
 
 bool SymTab::get_c_block_level( string file,
@@ -520,22 +896,16 @@ bool SymTab::get_c_block_level( string file,
 								BLOCK &block,
 								LEVEL &level )
 {
-	FILE_LIST::iterator it;
-	for( it=c_file_list.begin(); it!=c_file_list.end(); ++it)
-	{
-		if( file_name((*it).file_id).c_str()==file )
-		{
-			//cout << "FOUND: correct file"<<endl;
-			if(  (*it).line_num==line  )
-			{
-				level = (*it).level;
-				block = (*it).block;
-				return true;
-			}
-		
-		}
-	}
-	return false;	// failure
+	LINE_INDEX::iterator it;
+	int fid = file_id( file );
+	if( fid==-1 )
+		return false;
+	it = find_line( c_lines, fid, line );
+	if( it==c_lines.end() )
+		return false;	// failure
+	level = c_file_list[it->second.entry].level;
+	block = c_file_list[it->second.entry].block;
+	return true;
 	
 #if 0	
 	SYMLIST::iterator it;
@@ -555,40 +925,68 @@ bool SymTab::get_c_block_level( string file,
 }
 #include <assert.h>
 
-/// @FIXME dosen't work flat vs normal address issue
 string SymTab::get_symbol_name( FLAT_ADDR addr )
 {
-	SYMLIST::iterator it;
-	for(it=m_symlist.begin(); it!=m_symlist.end(); ++it)
-	{
-		if( (*it).addr()==addr )
-			return (*it).name();
-	}
+	ADDR_INDEX::iterator it;
+	check_index();
+	it = find_preceding( m_addr_index, addr );
+	if( it!=m_addr_index.end() && it->start==addr )
+		return it->sym->name();
 	return "NOT IMPLEMENTED";
 }
 
-/// @FIXME dosen't work flat vs normal address issue
 /// DO we need to look at scope here also? would need an extra parameter
 string SymTab::get_symbol_name_closest( FLAT_ADDR flat_addr )
 {
-	ADDR closest = 0;
-	SYMLIST::iterator it;
-	SYMLIST::iterator close_it = m_symlist.begin();
-	cout << "size of list = "<<m_symlist.size()<<endl;
+	ADDR_INDEX::iterator it;
+	check_index();
+	if( m_symlist.empty() )
+		return "";
+	it = find_preceding( m_addr_index, flat_addr );
+	if( it==m_addr_index.end() )
+		return m_symlist.begin()->name();
+	return it->sym->name();
+}
+
 
-	for(it=m_symlist.begin(); it!=m_symlist.end(); ++it)
+string SymTab::get_symbol_covering( FLAT_ADDR addr, uint32_t &offset )
+{
+	ADDR_INDEX::iterator it;
+	check_index();
+	it = find_preceding( m_addr_index, addr );
+	if( it==m_addr_index.end() )
+		return "";
+	// skip to the last symbol starting at or before addr, then work back
+	// through the ones starting lower in case an array or struct covers it
+	ADDR_INDEX::iterator last = upper_bound( it, m_addr_index.end(), *it, addr_less );
+	while( last!=m_addr_index.begin() )
 	{
-		printf("sym_addr = 0x%08x, addr = 0x%08x, '%s'\n",(*it).flat_start_addr(),flat_addr,(*it).name().c_str());
-		if( (*it).flat_start_addr()==flat_addr )
-			return (*it).name();
-		else if( (*it).flat_start_addr()<flat_addr &&
-				 (*it).flat_start_addr()>closest )
+		--last;
+		if( last->start<=addr && addr<=last->end )
 		{
-			cout << "closest = "<<hex<<closest<<endl;
-			closest = (*it).addr();
-			close_it = it;
+			offset = addr - last->start;
+			return last->sym->name();
 		}
 	}
-	return (*close_it).name();
+	return "";
 }
 
+
+Expression *SymTab::get_expression( string expr, ContextMgr::Context context )
+{
+	char buf[32];
+	check_index();
+	snprintf( buf, sizeof(buf), "%i", context.block );
+	string key = expr + '\0' + context.module + '\0' + context.function +
+				 '\0' + buf;
+	EXPR_CACHE::iterator it = m_expr_cache.find( key );
+	if( it==m_expr_cache.end() || !it->second.valid() )
+	{
+		// failures aren't kept, they are recompiled in case the symbol is
+		// defined by then.
+		it = m_expr_cache.insert( EXPR_CACHE::value_type( key,
+								  Expression(mSession) ) ).first;
+		it->second.compile( expr, context );
+	}
+	return &it->second;
+}
@@ -21,10 +21,12 @@
 #define SYMTAB_H
 #include <list>
 #include <vector>
+#include <map>
 #include "types.h"
 #include "symbol.h"
 #include "contextmgr.h"
 #include "memremap.h"
+#include "expression.h"
 
 using namespace std;
 
@@ -36,6 +38,7 @@ using namespace std;
 	@author Ricky White <ricky@localhost.localdomain>
 */
 class SymTab{
+	friend class SymCache;
 public:
     SymTab( DbgSession *session );
     ~SymTab();
@@ -45,8 +48,31 @@ public:
 	*/
 	void clear();
 	
+	/** Clear the symbols only, the line tables are kept.
+		Used by CdbFile::reload() before applying the symbol records again.
+	*/
+	void clear_symbols();
+	
+	/** Remove the C and asm line entries of a module.
+		\param module	module name, its files are module.c and module.asm
+						or module.a51
+	*/
+	void remove_lines( const string &module );
+	
 	void addSymbol( Symbol sym );
 	
+	/** (Re)build the address and line indexes used by the lookups below.
+		Call once the cdb file has been loaded, symbols keep being added and
+		modified while it is parsed.  Lookups rebuild the indexes themselves
+		if the table has changed since.
+	*/
+	void build_index();
+	
+	/** Changes whenever the indexes are rebuilt, so anything derived from
+		the symbols can tell when to throw its copy away.
+	*/
+	uint32_t generation()		{ check_index(); return m_generation; }
+	
 	/** Obtain direct access to the symbol to modify it.
 		Searches for th matching symbol.
 		@FIXME dosen't seem safe, i think we need to compare more!, function name is necessary with local scope etc...  what about levels
@@ -72,6 +98,11 @@ public:
 	bool getSymbol( string name,
 					ContextMgr::Context context,
 					SYMLIST::iterator &it);
+	
+	/** The parameters and locals of every block of the context's function.
+		\param[out] syms	receives them in table order
+	*/
+	void get_locals( ContextMgr::Context context, vector<Symbol*> &syms );
 
 	
 	
@@ -105,6 +136,22 @@ public:
 	*/
 	string get_symbol_name_closest( FLAT_ADDR addr );
 
+	/** Find the symbol whose storage covers a memory location.
+		\param addr		Address to look for
+		\param[out] offset	offset of addr from the start of the symbol
+		\returns the symbol name, or an empty string if no symbol covers addr.
+	*/
+	string get_symbol_covering( FLAT_ADDR addr, uint32_t &offset );
+
+	/** Get the compiled form of a print / display expression.
+		Plans are cached per expression and context until the symbol table
+		changes, so evaluating the same expression again only reads memory.
+		\param expr		expression to compile, eg "cfg.ports[2]"
+		\param context	Context to resolve the symbol in
+		\returns the plan, check Expression::valid() before using it.
+	*/
+	Expression *get_expression( string expr, ContextMgr::Context context );
+
 
 	void dump();
 	void dump_symbols();
@@ -138,6 +185,37 @@ public:
 	bool find_c_file_line( ADDR addr, string &file, LINE_NUM &line_num );
 	bool find_asm_file_line( uint16_t addr, string &file, int &line_num );
 	
+	/** Get the range of code generated for a line.
+		If the code for the line isn't contiguous the range covers all of it,
+		along with whatever lies in between.
+		\param file		source file name (.c, .asm or .a51)
+		\param line_num	line to look up
+		\param[out] start	lowest address generated for the line
+		\param[out] end		last address before the code of the next line
+		\returns true on success, false if the line has no code.
+	*/
+	bool get_line_range( string file, LINE_NUM line_num, ADDR &start, ADDR &end );
+	
+	/** Get the contiguous run of code containing addr that was generated for
+		a single C line entry, limited to the function addr is in.
+		Used for range stepping where code of other lines in between must not
+		be included.
+		\param addr		address inside the run
+		\param[out] start	address of the C line entry at or below addr
+		\param[out] end		last address before the next C line entry
+		\returns true on success, false if addr isn't within C code.
+	*/
+	bool get_c_block( ADDR addr, ADDR &start, ADDR &end );
+	
+	typedef map<LINE_NUM,ADDR> LINE_ADDR_MAP;
+	typedef map<string,LINE_ADDR_MAP> FILE_LINE_MAP;
+	
+	/** Get every C line that has code, by file.
+		\param[out] lines	lowest address of each line keyed by file name
+							then line number
+	*/
+	void get_c_lines( FILE_LINE_MAP &lines );
+	
 	///////////////////////////////////////////////////////////////////////////
 	// Adding file entries
 	///////////////////////////////////////////////////////////////////////////
@@ -154,28 +232,71 @@ public:
 	bool get_c_function( ADDR addr,
 						 string &file,
 						 string &func);
+	/** \returns the function symbol whose code range holds addr, 0 if
+		there is none.
+	*/
+	Symbol *get_function( ADDR addr );
 	bool get_c_block_level( string file,
 							LINE_NUM line,
 							BLOCK &block,
 							LEVEL &level );
+	
+	///////////////////////////////////////////////////////////////////////////
+	// command line completion
+	///////////////////////////////////////////////////////////////////////////
+	/// kinds of name for complete(), or'ed together
+	enum { COMPLETE_SYMBOLS=1, COMPLETE_FUNCTIONS=2, COMPLETE_FILES=4 };
+	
+	/** Find the names that start with prefix, for command line completion.
+		The names are kept sorted by kind, built the first time after each
+		load, so each call costs a binary search plus the matches.
+		With COMPLETE_FUNCTIONS a prefix of the form file:func completes the
+		functions of that file.
+		\param what		COMPLETE_ flags of the kinds of name wanted
+		\param[out] names	receives the matches in order, each once
+	*/
+	void complete( const string &prefix, int what, vector<string> &names );
 
 protected:
 	SYMLIST m_symlist;
 	typedef struct
 	{
-		int		file_id;
-		string	function;
-		int		line_num;
+		int			file_id;
+		StrPool::ID	function;
+		int			line_num;
 		int		level;
 		int		block;
-		int16_t	addr;
+		uint16_t	addr;
 	} FILE_ENTRY;
-	typedef list<FILE_ENTRY> FILE_LIST;
+	typedef vector<FILE_ENTRY> FILE_LIST;
 	FILE_LIST	c_file_list;
 	FILE_LIST	asm_file_list;
 	
+	/// (address, index into a FILE_LIST) sorted by address
+	typedef vector< pair<uint16_t,int> > ENTRY_INDEX;
+	ENTRY_INDEX	c_by_addr;
+	ENTRY_INDEX	asm_by_addr;
+	
+	typedef struct
+	{
+		ADDR	start;		///< lowest address generated for the line
+		ADDR	end;		///< last address before the next line's code
+		int		entry;		///< first entry for the line in the FILE_LIST
+	} LINE_RANGE;
+	/// keyed by (file id, line number)
+	typedef map< pair<int,LINE_NUM>, LINE_RANGE > LINE_INDEX;
+	LINE_INDEX	c_lines;
+	LINE_INDEX	asm_lines;
+	
+	void build_line_index( FILE_LIST &files, ENTRY_INDEX &by_addr,
+						   LINE_INDEX &lines );
+	int find_entry( ENTRY_INDEX &by_addr, ADDR addr );
+	LINE_INDEX::iterator find_line( LINE_INDEX &lines, int fid, LINE_NUM line );
+	
 	typedef vector<string>	FILE_VEC;
 	FILE_VEC	file_map;
+	/// file_map inverted, caught up by file_id() as files are added
+	map<string,int>	m_file_ids;
 	int file_id(string filename);
 	string file_name( int id );
 	
@@ -190,6 +311,56 @@ protected:
 	} FUNC_ENTRY;
 	typedef list<FUNC_ENTRY> FUNC_LIST;
 //	FUNC_LIST	func_list;
+	
+	/// the symbols of each name, indexed by the name's StrPool id and
+	/// maintained as symbols are added.
+	typedef vector<SYMLIST::iterator> SYM_VEC;
+	typedef vector<SYM_VEC> NAME_INDEX;
+	NAME_INDEX	m_name_index;
+	typedef pair<SYM_VEC::iterator,SYM_VEC::iterator> NAME_RANGE;
+	NAME_RANGE named( StrPool::ID id );
+	
+	typedef struct
+	{
+		uint32_t			start;
+		uint32_t			end;
+		SYMLIST::iterator	sym;
+	} ADDR_ENTRY;
+	typedef vector<ADDR_ENTRY> ADDR_INDEX;
+	ADDR_INDEX	m_addr_index;	///< symbols sorted by flat start address
+	ADDR_INDEX	m_func_index;	///< functions sorted by code start address
+	bool		m_index_valid;	///< false when the address indexes are stale
+	uint32_t	m_generation;	///< bumped by build_index()
+	
+	SYMLIST::iterator insert_symbol( Symbol &sym );
+	/// id of a name, StrPool::NONE if no symbol can have it
+	StrPool::ID find_id( const string &s )	{ return mSession->strings()->find(s); }
+	
+	/// StrPool ids of the names in the last context passed to getSymbol()
+	typedef struct
+	{
+		string		module, function;
+		uint32_t	pool_size;	///< ids looked up while the pool had this size
+		StrPool::ID	func, mod, mod_c, mod_asm;
+	} CONTEXT_IDS;
+	CONTEXT_IDS	m_ctx;
+	CONTEXT_IDS &context_ids( ContextMgr::Context &context );
+	void check_index()			{ if( !m_index_valid ) build_index(); }
+	static bool addr_less( const ADDR_ENTRY &a, const ADDR_ENTRY &b )
+								{ return a.start < b.start; }
+	ADDR_INDEX::iterator find_preceding( ADDR_INDEX &index, uint32_t addr );
+	
+	/// interned names sorted by their strings, for complete()
+	typedef vector<StrPool::ID> SORTED_NAMES;
+	SORTED_NAMES	m_complete_syms, m_complete_funcs, m_complete_files;
+	uint32_t		m_complete_gen;		///< generation they were built for
+	void build_complete_index();
+	void complete_range( SORTED_NAMES &index, const string &prefix,
+						 vector<string> &names );
+	
+	/// compiled expressions keyed by expression and context
+	typedef map<string,Expression> EXPR_CACHE;
+	EXPR_CACHE	m_expr_cache;
 	DbgSession *mSession;
 };
 
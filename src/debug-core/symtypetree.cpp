@@ -19,13 +19,16 @@
  ***************************************************************************/
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <stdio.h>
+#include <string.h>
 #include "symtypetree.h"
 #include "contextmgr.h"
 #include "target.h"
 #include "memremap.h"
 #include "outformat.h"
 #include "dbgsession.h"
+#include "cdbfile.h"
 using namespace std;
 
 SymTypeTree::SymTypeTree( DbgSession *session )
@@ -62,6 +65,22 @@ SymTypeTree::SymTypeTree( DbgSession *session )
 
 SymTypeTree::~SymTypeTree()
 {
+	free_types();
+}
+
+/** Destroy every type, they all live in the arena.
+*/
+void SymTypeTree::free_types()
+{
+	for( int i=0; i<m_types.size(); i++ )
+		m_types[i]->~SymType();
+	m_types.clear();
+	m_file_index.clear();
+	m_name_index.clear();
+	m_records.clear();
+	m_record_file_index.clear();
+	m_record_name_index.clear();
+	m_arena.clear();
 }
 
 
@@ -70,30 +89,89 @@ SymTypeTree::~SymTypeTree()
 void SymTypeTree::clear()
 {
 	m_types_scope.clear();
-	m_types.clear();
+	free_types();
 
 	// Add terminal types to the tree
 	m_types.reserve(10);
-	m_types.push_back(new SymTypeChar(mSession));
-	m_types.push_back(new SymTypeUChar(mSession));
-	m_types.push_back(new SymTypeShort(mSession));
-	m_types.push_back(new SymTypeUShort(mSession));
-	m_types.push_back(new SymTypeInt(mSession));
-	m_types.push_back(new SymTypeUInt(mSession));
-	m_types.push_back(new SymTypeLong(mSession));
-	m_types.push_back(new SymTypeULong(mSession));
-	m_types.push_back(new SymTypeFloat(mSession));
-	m_types.push_back(new SymTypeSbit(mSession));
+	add_type( new_type<SymTypeChar>() );
+	add_type( new_type<SymTypeUChar>() );
+	add_type( new_type<SymTypeShort>() );
+	add_type( new_type<SymTypeUShort>() );
+	add_type( new_type<SymTypeInt>() );
+	add_type( new_type<SymTypeUInt>() );
+	add_type( new_type<SymTypeLong>() );
+	add_type( new_type<SymTypeULong>() );
+	add_type( new_type<SymTypeFloat>() );
+	add_type( new_type<SymTypeSbit>() );
 }
 
 
 bool SymTypeTree::add_type( SymType *ptype )
 {
 	m_types.push_back(ptype);
+	// insert() leaves an existing entry alone so the first one added wins
+	m_file_index.insert( TYPE_INDEX::value_type(
+						 make_pair( ptype->file(), ptype->name() ), ptype ) );
+	m_name_index.insert( NAME_INDEX::value_type( ptype->name(), ptype ) );
+	return true;
+}
+
+void SymTypeTree::add_type_record( const std::string &file,
+								   const std::string &name,
+								   const std::string &record )
+{
+	int idx = m_records.size();
+	if( !m_record_file_index.insert( RECORD_INDEX::value_type(
+								make_pair( file, name ), idx ) ).second )
+		return;		// already have one
+	m_record_name_index.insert( RECORD_NAME_INDEX::value_type( name, idx ) );
+	TYPE_RECORD r;
+	r.file		= file;
+	r.name		= name;
+	r.record	= record;
+	r.type		= 0;
+	m_records.push_back( r );
+}
+
+/** Decode a kept type record, once.
+	\returns the type or 0 if the record can't be decoded.
+*/
+SymType *SymTypeTree::resolve_record( int idx )
+{
+	TYPE_RECORD &r = m_records[idx];
+	if( !r.type )
+	{
+		CdbFile f( mSession );
+		r.type = f.decode_type( r.record );
+		if( !r.type )
+		{
+			cout << "ERROR bad type record '"<<r.name<<"'"<<endl;
+			return 0;
+		}
+		add_type( r.type );
+	}
+	return r.type;
+}
+
+/** \returns the first type by that name in any file.
+*/
+SymType *SymTypeTree::find_by_name( const std::string &type_name )
+{
+	// records are checked first, decoding one out of order may have put a
+	// later type by the same name in the index
+	RECORD_NAME_INDEX::iterator rit = m_record_name_index.find( type_name );
+	if( rit!=m_record_name_index.end() )
+		return resolve_record( rit->second );
+	NAME_INDEX::iterator nit = m_name_index.find( type_name );
+	if( nit!=m_name_index.end() )
+		return nit->second;
+	return 0;	// not found
 }
 
 void SymTypeTree::dump()
 {
+	for( int i=0; i<m_records.size(); i++ )
+		resolve_record( i );
 	cout << setw(24) << left <<"Type name"
 		<< setw(9)<< left << "Terminal"
 		<< setw(8)<< left << "Size"
@@ -114,16 +192,12 @@ void SymTypeTree::dump()
 
 void SymTypeTree::dump(std::string type_name)
 {
-	// find type
-	for(int i=0; i<m_types.size(); i++)
+	SymType *type = find_by_name( type_name );
+	if( type )
 	{
-		cout << "checking "<<m_types[i]->name()<<endl;
-		if(m_types[i]->name()==type_name)
-		{
-			cout << "Dumping type = '"<<type_name<<"'"<<endl;
-			cout << m_types[i]->text() << endl;
-			return;
-		}
+		cout << "Dumping type = '"<<type_name<<"'"<<endl;
+		cout << type->text() << endl;
+		return;
 	}
 	cout << "ERROR Type = '"<<type_name<<"' not found."<<endl;
 }
@@ -164,16 +238,17 @@ SymType *SymTypeTree::get_type( std::string type_name,
 {
 	//cout << "looking for '" << type_name << "'" << endl;
 	
-	/// @FIXME: this a a crude hack that just takes the first matching type and ignores the scope requirments
-	for(int i=0; i<m_types.size(); i++)
-	{
-		if( m_types[i]->name()==type_name )
-		{
-			return m_types[i];
-		}
-	}
-	
-	return 0;	// not found
+	/// @FIXME: blocks within functions are not handled, only the file of
+	/// the current module and then any file.
+	TYPE_INDEX::iterator it;
+	it = m_file_index.find( make_pair( context.module, type_name ) );
+	if( it!=m_file_index.end() )
+		return it->second;
+	RECORD_INDEX::iterator rit;
+	rit = m_record_file_index.find( make_pair( context.module, type_name ) );
+	if( rit!=m_record_file_index.end() )
+		return resolve_record( rit->second );
+	return find_by_name( type_name );
 }
 
 
@@ -186,18 +261,145 @@ std::string SymTypeTree::pretty_print( SymType *ptype,
 }
 
 
+bool SymTypeTree::prefetch( uint32_t flat_addr, uint32_t len )
+{
+	return prefetch( FETCH_LIST( 1, FETCH_RANGE( flat_addr, len ) ) )>0;
+}
+
+
+static bool range_less( const SymTypeTree::FETCH_RANGE &a,
+						const SymTypeTree::FETCH_RANGE &b )
+{
+	return a.first < b.first;
+}
+
+
+int SymTypeTree::prefetch( FETCH_LIST ranges )
+{
+	FETCH_LIST merged;
+	char area, last_area;
+	
+	m_fetch.clear();
+	sort( ranges.begin(), ranges.end(), range_less );
+	for( int i=0; i<ranges.size(); i++ )
+	{
+		if( ranges[i].second==0 ||
+			MemRemap::target( ranges[i].first, area )==INVALID_ADDR )
+			continue;
+		if( !merged.empty() && area==last_area &&
+			ranges[i].first <= merged.back().first+merged.back().second+PREFETCH_GAP )
+		{
+			// extend the previous read to cover this one too
+			uint32_t end = ranges[i].first + ranges[i].second;
+			if( end > merged.back().first+merged.back().second )
+				merged.back().second = end - merged.back().first;
+		}
+		else
+			merged.push_back( ranges[i] );
+		last_area = area;
+	}
+	
+	m_fetch.resize( merged.size() );
+	for( int i=0; i<merged.size(); i++ )
+	{
+		m_fetch[i].addr = merged[i].first;
+		m_fetch[i].buf.resize( merged[i].second );
+		if( !mSession->target()->read_memory( merged[i].first,
+											  merged[i].second,
+											  &m_fetch[i].buf[0] ) )
+			m_fetch[i].buf.clear();		// never matches, falls back to the target
+	}
+	return merged.size();
+}
+
+
+void SymTypeTree::end_prefetch()
+{
+	m_fetch.clear();
+}
+
+
+bool SymTypeTree::prefetched( uint32_t flat_addr, uint32_t len )
+{
+	for( int i=0; i<m_fetch.size(); i++ )
+	{
+		FETCH_WINDOW &w = m_fetch[i];
+		if( flat_addr>=w.addr && flat_addr+len <= w.addr+w.buf.size() )
+			return true;
+	}
+	return false;
+}
+
+
+bool SymTypeTree::read_memory( uint32_t flat_addr, uint32_t len, uint8_t *buf )
+{
+	for( int i=0; i<m_fetch.size(); i++ )
+	{
+		FETCH_WINDOW &w = m_fetch[i];
+		if( flat_addr>=w.addr && flat_addr+len <= w.addr+w.buf.size() )
+		{
+			memcpy( buf, &w.buf[flat_addr-w.addr], len );
+			return true;
+		}
+	}
+	return mSession->target()->read_memory( flat_addr, len, buf );
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SymTypeArena
+////////////////////////////////////////////////////////////////////////////////
+
+SymTypeArena::SymTypeArena()
+	: m_used(BLOCK_SIZE)
+{
+}
+
+SymTypeArena::~SymTypeArena()
+{
+	clear();
+}
+
+void *SymTypeArena::alloc( size_t size )
+{
+	char *p;
+	// keep everything aligned for any member type
+	size = (size + 2*sizeof(void*)-1) & ~(2*sizeof(void*)-1);
+	if( size>BLOCK_SIZE/4 )
+	{
+		// big objects get a block of their own, ahead of the current one
+		p = new char[size];
+		m_blocks.insert( m_blocks.end()-(m_blocks.empty() ? 0 : 1), p );
+		return p;
+	}
+	if( m_used+size > BLOCK_SIZE )
+	{
+		m_blocks.push_back( new char[BLOCK_SIZE] );
+		m_used = 0;
+	}
+	p = m_blocks.back() + m_used;
+	m_used += size;
+	return p;
+}
+
+/** Release all memory handed out, in one step.
+*/
+void SymTypeArena::clear()
+{
+	for( int i=0; i<m_blocks.size(); i++ )
+		delete [] m_blocks[i];
+	m_blocks.clear();
+	m_used = BLOCK_SIZE;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // SymType
 ////////////////////////////////////////////////////////////////////////////////
 
 bool SymType::read_memory( uint32_t flat_addr, uint32_t len, uint8_t *buf )
 {
-	char area;
-	ADDR a = MemRemap::target( flat_addr, area );
-	printf("reading from addr= 0x%04x\n",a);
-	mSession->target()->read_data( a, len, buf );
-	//memset( buf,0xFF,length );	// hack for test
-	return true;
+	return mSession->symtree()->read_memory( flat_addr, len, buf );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -298,15 +500,89 @@ std::string SymTypeFloat::pretty_print( char fmt,
 ////////////////////////////////////////////////////////////////////////////////
 
 
+/** Size of the structure, the sum of its members.
+	Member types are looked up in the file the structure was defined in.
+*/
 int32_t SymTypeStruct::size()
 {
 	int32_t size=0;
-//	for( int i=0; i<m_members.size(); i++)
-//		size += m_members[i].pType->size();
+	ContextMgr::Context context;
+	context.module = m_filename;
+	for( int i=0; i<m_members.size(); i++)
+	{
+		SymType *type = mSession->symtree()->get_type( m_members[i].type_name,
+													   context );
+		if( type )
+			size += type->size() * m_members[i].count;
+	}
 	return size;
 }
 
 
+/** Print every member as {a = 1, b = {1,2}, c = "str"}.
+	Reads go through SymType::read_memory() so a prefetched struct is
+	formatted entirely from the host copy.
+	Like the terminal types addr is left at the start of the structure,
+	callers step over it using size().
+*/
+std::string SymTypeStruct::pretty_print( char fmt,
+										 std::string name,
+										 uint32_t &addr )
+{
+	std::string s;
+	uint32_t member_addr = addr;
+	uint32_t elem_addr;
+	ContextMgr::Context context;
+	context.module = m_filename;
+	
+	if( !name.empty() )
+		s += name + '=';
+	s += '{';
+	for( int i=0; i<m_members.size(); i++ )
+	{
+		SymType *type = mSession->symtree()->get_type( m_members[i].type_name,
+													   context );
+		if( i>0 )
+			s += ", ";
+		s += m_members[i].member_name + " = ";
+		if( !type )
+		{
+			// without a size the rest of the members can't be located
+			s += "<unknown type " + m_members[i].type_name + ">";
+			break;
+		}
+		elem_addr = member_addr;
+		if( m_members[i].count==1 )
+			s += type->pretty_print( fmt, "", elem_addr );
+		else
+		{
+			bool str = fmt==0 && (type->name()=="char" ||
+								  type->name()=="unsigned char");
+			OutFormat of( mSession );
+			if( type->scalar() && (str || fmt!='s') &&
+				of.print_array( str ? 's' : fmt==0 ? type->default_format() : fmt,
+								elem_addr, type->size(), m_members[i].count, s ) )
+			{
+				member_addr += type->size() * m_members[i].count;
+				continue;
+			}
+			s += str ? '"' : '{';
+			for( int j=0; j<m_members[i].count; j++ )
+			{
+				if( !str && j>0 )
+					s += ',';
+				s += type->pretty_print( str ? 's' : fmt, "", elem_addr );
+				elem_addr += type->size();
+			}
+			s += str ? '"' : '}';
+		}
+		member_addr += type->size() * m_members[i].count;
+	}
+	s += '}';
+	return s;
+}
+
+
 // GDB standard text representation
 std::string SymTypeStruct::text()
 {
@@ -330,6 +606,28 @@ std::string SymTypeStruct::text()
 }
 
 
+bool SymTypeStruct::member( const std::string &name, uint32_t &offset,
+							SymType *&type, uint16_t &count )
+{
+	ContextMgr::Context context;
+	context.module = m_filename;
+	offset = 0;
+	for( int i=0; i<m_members.size(); i++ )
+	{
+		type = mSession->symtree()->get_type( m_members[i].type_name, context );
+		if( !type )
+			return false;	// can't locate anything past an unknown type
+		if( m_members[i].member_name==name )
+		{
+			count = m_members[i].count;
+			return true;
+		}
+		offset += type->size() * m_members[i].count;
+	}
+	return false;
+}
+
+
 /** Add a member to a structure.
 	\param name		Name of the member to add.
 	\param ptype	pointer to the type to add.
@@ -348,7 +646,7 @@ void SymTypeStruct::add_member( std::string member_name,
 	m.type_name		= type_name;
 	m.count			= count;
 	m_members.push_back(m);
-	cout << "adding: member ='"<<member_name<<"', "<<
-			"type = '"<<type_name<<"', "<<
-			" count="<<count<<endl;
+//	cout << "adding: member ='"<<member_name<<"', "<<
+//			"type = '"<<type_name<<"', "<<
+//			" count="<<count<<endl;
 }
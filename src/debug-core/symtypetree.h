@@ -21,6 +21,8 @@
 #define SYMTYPETREE_H
 #include <string>
 #include <vector>
+#include <map>
+#include <new>
 #include "contextmgr.h"
 
 #include "dbgsession.h"
@@ -46,6 +48,12 @@ public:
 	virtual std::string text()=0;
 	virtual char default_format()	{ return 'x'; }
 	
+	/** \returns true if pretty_print() formats the size() bytes of a value
+		with OutFormat, so arrays of the type can be formatted in bulk with
+		OutFormat::print_array().
+	*/
+	virtual bool scalar()			{ return false; }
+	
 	/** Print the symbol by using data from the specified ddress.
 		\param fmt		GDB print format character that follows the slash.
 		\param name		Name of the element
@@ -58,6 +66,17 @@ public:
 									  uint32_t &addr )	
 	{ return "not implemented";}
 	
+	/** Look up a member of a structure type.
+		\param name		Member to look for
+		\param offset	Receives the offset of the member from the start
+		\param type		Receives the type of one element of the member
+		\param count	Receives the number of elements, 1 if not an array
+		\returns true if name is a member of this type.
+	*/
+	virtual bool member( const std::string &name, uint32_t &offset,
+						 SymType *&type, uint16_t &count )
+	{ return false; }
+	
 protected:
 	DbgSession *mSession;
 	std::string m_name;
@@ -82,6 +101,7 @@ public:
 	~SymTypeChar()				{}
 	virtual std::string name()	{ return "char"; }
 	virtual bool terminal()		{ return true; }
+	virtual bool scalar()		{ return true; }
 	virtual int32_t size()		{ return 1; }
 	virtual std::string text()	{ return "char"; }
 	virtual std::string pretty_print( char fmt,
@@ -102,6 +122,7 @@ public:
 	~SymTypeUChar()				{}
 	virtual std::string name()	{ return "unsigned char"; }
 	virtual bool terminal()		{ return true; }
+	virtual bool scalar()		{ return true; }
 	virtual int32_t size()		{ return 1; }
 	virtual std::string text()	{ return "unsigned char"; }
 	virtual std::string pretty_print( char fmt,
@@ -149,6 +170,7 @@ class SymTypeInt : public SymType
 		~SymTypeInt()				{}
 		virtual std::string name()	{ return "int"; }
 		virtual bool terminal()		{ return true; }
+		virtual bool scalar()		{ return true; }
 		virtual int32_t size()		{ return 2; }
 		virtual std::string text()	{ return "int"; }
 	virtual std::string pretty_print( char fmt,
@@ -167,6 +189,7 @@ class SymTypeUInt : public SymType
 		~SymTypeUInt()				{}
 		virtual std::string name()	{ return "unsigned int"; }
 		virtual bool terminal()		{ return true; }
+		virtual bool scalar()		{ return true; }
 		virtual int32_t size()		{ return 2; }
 		virtual std::string text()	{ return "unsigned int"; }
 		virtual std::string pretty_print( char fmt,
@@ -186,6 +209,7 @@ class SymTypeLong : public SymType
 		~SymTypeLong()				{}
 		virtual std::string name()	{ return "long"; }
 		virtual bool terminal()		{ return true; }
+		virtual bool scalar()		{ return true; }
 		virtual int32_t size()		{ return 4; }
 		virtual std::string text()	{ return "long"; }
 		virtual std::string pretty_print( char fmt,
@@ -203,6 +227,7 @@ class SymTypeULong : public SymType
 		~SymTypeULong()				{}
 		virtual std::string name()	{ return "unsigned long"; }
 		virtual bool terminal()		{ return true; }
+		virtual bool scalar()		{ return true; }
 		virtual int32_t size()		{ return 4; }
 		virtual std::string text()	{ return "unsigned long"; }
 		virtual std::string pretty_print( char fmt,
@@ -220,6 +245,7 @@ class SymTypeFloat : public SymType
 		~SymTypeFloat()					{}
 		virtual std::string name()		{ return "float"; }
 		virtual bool terminal()			{ return true; }
+		virtual bool scalar()			{ return true; }
 		virtual int32_t size()			{ return 4; }
 		virtual std::string text()		{ return "float"; }
 		virtual char default_format()	{ return 'f'; }
@@ -255,6 +281,7 @@ class SymTypeSbit : public SymType
 */
 class SymTypeStruct : public SymType
 {
+	friend class SymCache;
 public:
 	SymTypeStruct( DbgSession *session ) : SymType(session) {}
 	~SymTypeStruct()			{}
@@ -262,6 +289,11 @@ public:
 	virtual bool terminal()		{ return false; }
 	virtual int32_t size();
 	virtual std::string text();
+	virtual std::string pretty_print( char fmt,
+									  std::string name,
+									  uint32_t &addr );
+	virtual bool member( const std::string &name, uint32_t &offset,
+						 SymType *&type, uint16_t &count );
 	void add_member( std::string member_name,
 						std::string type_name,
 						uint16_t count );
@@ -280,6 +312,26 @@ protected:
 };
 
 
+/** Hands out memory for SymType objects from large blocks so the types of
+	a session can all be released in one step.
+	Objects are never freed individually, the owner must run their
+	destructors before calling clear().
+*/
+class SymTypeArena
+{
+public:
+	SymTypeArena();
+	~SymTypeArena();
+	void *alloc( size_t size );
+	void clear();
+
+protected:
+	enum { BLOCK_SIZE = 16*1024 };
+	std::vector<char*>	m_blocks;
+	size_t				m_used;		///< bytes used in the last block
+};
+
+
 /** Implements a tree of active data types in the project from the basic types 		
 	through to nested structs.  The symbol table will referance this tree for
 	extra information.
@@ -290,6 +342,7 @@ protected:
 */
 class SymTypeTree
 {
+	friend class SymCache;
 public:
     SymTypeTree( DbgSession *session );
     ~SymTypeTree();
@@ -297,6 +350,25 @@ public:
 	void dump();
 	void dump(std::string type_name);
 	bool add_type( SymType *ptype );
+	
+	/** Keep a cdb type record for a structure, eg "T:Fmain$cfg[...]".
+		It is decoded by get_type() the first time the type is looked up
+		and added like any other type, most never are.  The first record
+		for a file and name wins.
+	*/
+	void add_type_record( const std::string &file,
+						  const std::string &name,
+						  const std::string &record );
+	
+	/** Create a type owned by this tree.
+		The object comes from the tree's arena and is destroyed by clear(),
+		it must not be deleted.  Pass it to add_type() to make it visible.
+	*/
+	template <class T> T *new_type()
+	{
+		return new( m_arena.alloc( sizeof(T) ) ) T( mSession );
+	}
+	
 //	bool get_type( std::string type_name,
 //				   std::string function,
 //				   std::string file,
@@ -327,6 +399,37 @@ public:
 							  uint32_t flat_addr,
 							  std::string subpath );
 	
+	/** Read [flat_addr, flat_addr+len) from the target in one transfer and
+		serve read_memory() calls inside that range from the host copy until
+		end_prefetch().  Used while printing a whole struct or array so each
+		member doesn't cost a round trip.
+		\returns true if the range was read.
+	*/
+	bool prefetch( uint32_t flat_addr, uint32_t len );
+	
+	typedef std::pair<uint32_t,uint32_t>	FETCH_RANGE;	///< flat address, length
+	typedef std::vector<FETCH_RANGE>		FETCH_LIST;
+	
+	/** Prefetch several ranges for formatting together, eg every display
+		expression after a stop.
+		Ranges in the same memory area that overlap or lie less than
+		PREFETCH_GAP bytes apart are merged, so each area costs as few
+		transfers as possible.
+		\returns the number of transfers made.
+	*/
+	int prefetch( FETCH_LIST ranges );
+	void end_prefetch();
+	
+	/** \returns true if [flat_addr, flat_addr+len) is inside a prefetched
+		range, so reads of it don't go to the target.
+	*/
+	bool prefetched( uint32_t flat_addr, uint32_t len );
+	
+	/** Read target memory for the types, from the prefetched copy when the
+		whole range is inside it, otherwise from the target.
+	*/
+	bool read_memory( uint32_t flat_addr, uint32_t len, uint8_t *buf );
+	
 	virtual void clear();
 
 protected:
@@ -350,6 +453,42 @@ protected:
 	
 	TYPE_VEC m_types;
 	TYPE_SCOPE_VEC m_types_scope;
+	
+	SymTypeArena	m_arena;
+	/// (file, name) -> type, the first type added wins
+	typedef std::map< std::pair<std::string,std::string>, SymType* > TYPE_INDEX;
+	TYPE_INDEX		m_file_index;
+	/// name -> first type added by that name in any file
+	typedef std::map< std::string, SymType* > NAME_INDEX;
+	NAME_INDEX		m_name_index;
+	
+	/// A type record waiting for its first use, see add_type_record().
+	typedef struct
+	{
+		std::string	file;
+		std::string	name;
+		std::string	record;
+		SymType		*type;		///< decoded type, 0 until first used
+	} TYPE_RECORD;
+	std::vector<TYPE_RECORD>	m_records;
+	/// (file, name) -> m_records index
+	typedef std::map< std::pair<std::string,std::string>, int > RECORD_INDEX;
+	RECORD_INDEX	m_record_file_index;
+	/// name -> m_records index of the first record by that name
+	typedef std::map< std::string, int > RECORD_NAME_INDEX;
+	RECORD_NAME_INDEX	m_record_name_index;
+	
+	enum { PREFETCH_GAP = 16 };
+	typedef struct
+	{
+		uint32_t				addr;	///< flat address of buf[0]
+		std::vector<uint8_t>	buf;
+	} FETCH_WINDOW;
+	std::vector<FETCH_WINDOW>	m_fetch;	///< empty when nothing is prefetched
+	
+	void free_types();
+	SymType *resolve_record( int idx );
+	SymType *find_by_name( const std::string &type_name );
 };
 
 #endif
@@ -1,6 +1,6 @@
 // target-dummy.cpp
 // Dummy Target
-// sink for all opperations when no real target exsists.
+// simulated 8051 used when no real target exsists.
 //
 // (C) Ricky White 2007
 // GPLv2 or later.
@@ -13,7 +13,7 @@
 using namespace std;
 
 TargetDummy::TargetDummy()
-  : Target()
+  : Target(), is_connected_flag(false), running(false)
 {
 }
 
@@ -31,6 +31,7 @@ bool TargetDummy::connect()
 
 bool TargetDummy::disconnect()
 {
+	flush_writes();
 	is_connected_flag = false;
 	return is_connected_flag;
 }
@@ -57,16 +58,22 @@ string TargetDummy::target_name()
 
 string TargetDummy::target_descr()
 {
-	return "Command sink, this is not a real target";
+	return "In-process 8051 simulator, this is not a real target";
 }
 
 string TargetDummy::device()
 {
-	return "sink";
+	return "sim8051";
 }
 
 bool TargetDummy::command( string cmd )
 {
+	if( cmd=="cycles" )
+	{
+		cout << sim.instructions() << " instructions, "
+			 << sim.cycles() << " machine cycles" << endl;
+		return true;
+	}
 	return false;
 }
 
@@ -78,47 +85,89 @@ bool TargetDummy::command( string cmd )
 void TargetDummy::reset()
 {
 	cout << "Resetting target."<<endl;
+	invalidate_cache();
+	sim.reset();
+	running = false;
 }
 
 uint16_t TargetDummy::step()
 {
-	return 0;
+	force_stop = false;
+	invalidate_cache();
+	sim.step();
+	return sim.pc();
 }
 
 bool TargetDummy::add_breakpoint(uint16_t addr)
 {
-	cout << "adding breakpoint to sink device" << endl;
+	if( sim.breakpoint_count()>=max_breakpoints() )
+		return false;
+	sim.add_breakpoint( addr );
 	return true;
 }
 
 bool TargetDummy::del_breakpoint(uint16_t addr)
 {
-	cout << "bool TargetDummy::del_breakpoint(uint16_t addr)" << endl;
-	return true;
+	return sim.del_breakpoint( addr );
 }
 
 void TargetDummy::clear_all_breakpoints()
 {
-	cout << "bool TargetDummy::clear_all_breakpoints()" << endl;
+	sim.clear_breakpoints();
 }
 
 
 void TargetDummy::run_to_bp(int ignore_cnt)
 {
-	cout << "TargetDummy::run_to_bp(int ignore_cnt)" << endl;
+	force_stop = false;
+	invalidate_cache();
+	for( int i=0; i<=ignore_cnt; i++ )
+	{
+		while( sim.run( RUN_SLICE )!=Sim8051::RUN_BREAKPOINT )
+		{
+			if( force_stop )
+				return;		// someone stopped us early
+		}
+	}
 }
 
 bool TargetDummy::is_running()
 {
-	return false;
+	return running;
 }
 
 void TargetDummy::stop()
 {
 	Target::stop();
+	running = false;
 	cout <<"Stopping....."<<endl;
 }
 
+/** The simulator only runs while it is polled, each poll runs one slice.
+*/
+void TargetDummy::go()
+{
+	invalidate_cache();
+	running = true;
+}
+
+bool TargetDummy::poll_for_halt()
+{
+	if( running && sim.run( RUN_SLICE )==Sim8051::RUN_BREAKPOINT )
+		running = false;
+	return !running;
+}
+
+Target::SAMPLE_RESULT TargetDummy::sample_PC( uint16_t &pc, bool resume )
+{
+	bool halted = poll_for_halt();
+	pc = sim.pc();
+	if( halted )
+		return SAMPLE_HALTED;
+	running = resume;
+	return SAMPLE_OK;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Memory reads
@@ -126,14 +175,14 @@ void TargetDummy::stop()
 
 void TargetDummy::read_data( uint8_t addr, uint8_t len, unsigned char *buf )
 {
-	memset(buf,0x55,len);
+	sim.read( 'd', addr, len, buf );
 }
 
 /** @DEPRECIATED
 */
 void TargetDummy::read_sfr( uint8_t addr, uint8_t len, unsigned char *buf )
 {
-	memset(buf,0x55,len);
+	sim.read( 's', addr, len, buf );
 }
 
 void TargetDummy::read_sfr( uint8_t addr,
@@ -141,23 +190,23 @@ void TargetDummy::read_sfr( uint8_t addr,
 				uint8_t len,
 				unsigned char *buf )
 {
-	memset(buf,0x55,len);
+	sim.read( 's', addr, len, buf );
 }
 
 
 void TargetDummy::read_xdata( uint16_t addr, uint16_t len, unsigned char *buf )
 {
-	memset(buf,0x55,len);
+	sim.read( 'x', addr, len, buf );
 }
 
 void TargetDummy::read_code( uint16_t addr, int len, unsigned char *buf )
 {
-	memset(buf,0x55,len);
+	sim.read( 'c', addr, len, buf );
 }
 
 uint16_t TargetDummy::read_PC()
 {
-	return 0x1234;
+	return sim.pc();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -165,6 +214,8 @@ uint16_t TargetDummy::read_PC()
 ///////////////////////////////////////////////////////////////////////////////
 void TargetDummy::write_data( uint8_t addr, uint8_t len, unsigned char *buf )
 {
+	sim.write( 'd', addr, len, buf );
+	cache_update( 'd', addr, len, buf );
 }
 
 
@@ -172,6 +223,8 @@ void TargetDummy::write_data( uint8_t addr, uint8_t len, unsigned char *buf )
 */
 void TargetDummy::write_sfr( uint8_t addr, uint8_t len, unsigned char *buf )
 {
+	sim.write( 's', addr, len, buf );
+	invalidate_cpu_context();
 }
 
 void TargetDummy::write_sfr( uint8_t addr,
@@ -179,18 +232,26 @@ void TargetDummy::write_sfr( uint8_t addr,
 				uint8_t len,
 				unsigned char *buf )
 {
+	Target::write_sfr( addr, page, len, buf );
+	sim.write( 's', addr, len, buf );
 }
 
 
 
 void TargetDummy::write_xdata( uint16_t addr, uint16_t len, unsigned char *buf )
 {
+	sim.write( 'x', addr, len, buf );
+	cache_update( 'x', addr, len, buf );
 }
 
 void TargetDummy::write_code( uint16_t addr, int len, unsigned char *buf )
 {
+	invalidate_code_cache();
+	sim.write( 'c', addr, len, buf );
 }
 
 void TargetDummy::write_PC( uint16_t addr )
 {
+	sim.set_pc( addr );
+	invalidate_cpu_context();
 }
@@ -1,5 +1,5 @@
 // Dummy Target
-// sink for all opperations when no real target exsists.
+// simulated 8051 used when no real target exsists.
 //
 // (C) Ricky White 2007
 // GPLv2 or later.
@@ -8,9 +8,13 @@
 #define TARGETDUMMY_H
 #include <stdint.h>
 #include "target.h"
+#include "sim8051.h"
 
 
-/** Dummy target sink for all opperations when no real target exsists.
+/** Dummy target used when no real target exsists.
+	Runs the program on an in-process Sim8051, so the host side can be
+	exercised and benchmarked without hardware.  Breakpoints are limited like
+	the hardware ones are.
 	@author Ricky White <rickyw@neatstuff.co.nz>
 */
 class TargetDummy : public Target
@@ -39,6 +43,9 @@ public:
 	virtual void run_to_bp(int ignore_cnt=0);
 	virtual bool is_running();
 	virtual void stop();
+	virtual void go();
+	virtual bool poll_for_halt();
+	virtual SAMPLE_RESULT sample_PC( uint16_t &pc, bool resume=true );
 
 	// memory reads
 	virtual void read_data( uint8_t addr, uint8_t len, unsigned char *buf );
@@ -57,7 +64,11 @@ public:
 	virtual void write_PC( uint16_t addr );
 
 protected:
+	/// instructions executed per poll while running, about 1ms of a 24MHz core
+	static const uint32_t RUN_SLICE = 2000;
 	bool is_connected_flag;
+	bool running;		///< started by go() and not yet halted
+	Sim8051 sim;
 };
 
 #endif
@@ -19,15 +19,34 @@
  ***************************************************************************/
 #include <iostream>
 #include <string.h>
+#include <vector>
 #include <stdio.h>
 #include "target.h"
+#include "memremap.h"
 #include "ihex.h"
 
 using namespace std;
 
 Target::Target()
-	: force_stop(false)
+	: force_stop(false),
+	  mCachePolicyData(CACHE_STOP),
+	  mCachePolicyXdata(CACHE_STOP),
+	  mCachePolicySfr(CACHE_OFF),
+	  mDataGeneration(0),
+	  mSeqNext(MemRemap::INVALID_FLAT_ADDR),
+	  mSeqWindow(0),
+	  mCodeGeneration(0),
+	  mImageStart(INVALID_ADDR),
+	  mImageEnd(INVALID_ADDR),
+	  mImageOverlay(false),
+	  mWriteBack(false),
+	  mCpuContextValid(false)
 {
+	invalidate_code_cache();
+	memset( mSfrWriteThrough, 0, sizeof(mSfrWriteThrough) );
+	memset( mSfrVolatile, 0, sizeof(mSfrVolatile) );
+	memset( mSfrReadSide, 0, sizeof(mSfrReadSide) );
+	set_sfr_write_through( 0x99, true );	// SBUF, sends a character
 }
 
 
@@ -53,25 +72,65 @@ void Target::print_buf_dump( char *buf, int len )
 	}
 }
 
-/** Default implementation, load an intel hex file and use write_code to place
-	it in memory
+/** Default implementation, load an intel hex file and use write_image to
+	place it in memory.  The image is kept to serve CODE reads, so with no
+	target connected it is only loaded for disassembly.
 */
 bool Target::load_file( string name )
 {
-	uint16_t start, end;
-	char *buf = new char[0x10000];
-	// set all data to 0xff, since this is the default erased value for flash
-	memset(buf,0xff,0x10000);
+	IHEX_IMAGE img;
+	bool ok = false;
+
 	cout << "Loading file '"<<name<<"'"<<endl;
-	if( buf && ihex_load_file( name.c_str(), buf, &start, &end) )
+	ihex_init( &img );
+	if( ihex_read( name.c_str(), &img ) && load_image( img ) )
 	{
-		print_buf_dump( buf, end-start );
-		write_code( start, end-start+1, (unsigned char*)&buf[start] );
-		delete buf;
-		return true;
+		if( is_connected() )
+			print_buf_dump( (char*)mImage, mImageEnd-mImageStart );
+		ok = true;
 	}
-	delete buf;
-	return false;
+	ihex_free( &img );
+	return ok;
+}
+
+bool Target::load_image( const IHEX_IMAGE &img )
+{
+	uint32_t start, end;
+
+	if( img.count==0 || img.seg[img.count-1].addr+img.seg[img.count-1].len>0x10000 )
+		return false;
+	// set all data to 0xff, since this is the default erased value for flash
+	memset( mImage, 0xff, sizeof(mImage) );
+	ihex_flatten( &img, mImage, sizeof(mImage), &start, &end );
+	mImageStart = start;
+	mImageEnd = end;
+	mImageSegs.clear();
+	for( int i=0; i<img.count; i++ )
+	{
+		IMAGE_SEG seg;
+		seg.start = img.seg[i].addr;
+		seg.end = img.seg[i].addr + img.seg[i].len - 1;
+		mImageSegs.push_back( seg );
+	}
+	if( is_connected() )
+	{
+		write_image( img );
+		for( int i=0; i<img.count; i++ )
+			fill_code_cache( img.seg[i].addr, img.seg[i].len, img.seg[i].data );
+	}
+	else
+	{
+		cout << "Target not connected, image loaded for reading only" << endl;
+		invalidate_code_cache();
+	}
+	mImageOverlay = true;	// after the writes, which drop it
+	return true;
+}
+
+void Target::write_image( const IHEX_IMAGE &img )
+{
+	for( int i=0; i<img.count; i++ )
+		write_code( img.seg[i].addr, img.seg[i].len, img.seg[i].data );
 }
 
 void Target::stop()
@@ -79,6 +138,24 @@ void Target::stop()
 	force_stop = true;
 }
 
+/** Polls as fast as poll_for_halt() allows, targets with a better way of
+	waiting override this.
+*/
+bool Target::wait_for_halt( volatile bool &stop )
+{
+	while( !poll_for_halt() )
+	{
+		if( stop )
+		{
+			stop2();
+			while( !poll_for_halt() )
+				;
+			return false;
+		}
+	}
+	return true;
+}
+
 bool Target::check_stop_forced()
 {
 	if( force_stop )
@@ -89,6 +166,13 @@ bool Target::check_stop_forced()
 	return false;
 }
 
+int Target::step_n( uint16_t *pcs, int n )
+{
+	for( int i=0; i<n; i++ )
+		pcs[i] = step();
+	return n;
+}
+
 
 
 
@@ -108,11 +192,383 @@ void Target::write_sfr( uint8_t addr,
 		// update values in cache
 		memcpy( (*it).buf+(addr-0x80), buf, len );
 	}
+	cache_update( 's', addr, len, buf );
 }
 
 void Target::invalidate_cache()
 {
+	flush_writes();
 	mCacheSfrPages.clear();
+	mMemCache.clear();
+	mCpuContextValid = false;
+	mDataGeneration++;
+}
+
+
+const Target::CPU_CONTEXT &Target::read_cpu_context()
+{
+	if( mCpuContextValid )
+		return mCpuContext;
+	flush_writes();
+	unsigned char sfr[0x80];
+	CPU_CONTEXT &c = mCpuContext;
+	// every core SFR is in one page read, they are on all pages of the
+	// parts that page their SFRs
+	read_sfr_page( 0, sfr );
+	c.sp  = sfr[0x81-0x80];
+	c.dpl = sfr[0x82-0x80];
+	c.dph = sfr[0x83-0x80];
+	c.psw = sfr[0xd0-0x80];
+	c.acc = sfr[0xe0-0x80];
+	c.b   = sfr[0xf0-0x80];
+	c.pc  = read_PC();
+	// normally both in the first DATA cache block, so one transfer
+	c.stack_base = c.sp>=CPU_STACK_DEPTH-1 ? c.sp-(CPU_STACK_DEPTH-1) : 0;
+	read_memory( MemRemap::flat( c.psw & 0x18, 'd' ), 8, c.r );
+	read_memory( MemRemap::flat( c.stack_base, 'i' ), c.sp-c.stack_base+1,
+				 c.stack );
+	mCpuContextValid = true;
+	return c;
+}
+
+
+bool Target::read_memory( uint32_t flat_addr, uint32_t len, unsigned char *buf )
+{
+	char area;
+	ADDR addr = MemRemap::target( flat_addr, area );
+	if( addr==INVALID_ADDR )
+		return false;
+	if( area=='c' )
+	{
+		read_code_cache( addr, len, buf );
+		return true;
+	}
+	if( area=='i' )
+		area = 'd';		// same RAM, read_data() reaches all 256 bytes
+	if( write_held( MemRemap::flat( addr, area ), len ) )
+		flush_writes();
+	if( cache_policy(area)==CACHE_OFF )
+	{
+		read_uncached( area, addr, len, buf );
+		return true;
+	}
+	
+	uint32_t base = MemRemap::flat( 0, area );
+	uint32_t start = addr, end = addr + len;
+	unsigned char *out = buf;
+	fill_cache( area, addr, len );
+	while( addr<end )
+	{
+		uint32_t blk = addr & ~(MEM_CACHE_BLOCK-1);
+		uint32_t ofs = addr - blk;
+		uint32_t n = MEM_CACHE_BLOCK-ofs < end-addr ? MEM_CACHE_BLOCK-ofs : end-addr;
+		MEM_CACHE_MAP::iterator it = mMemCache.find( base+blk );
+		memcpy( buf, it->second.buf+ofs, n );
+		buf += n;
+		addr += n;
+	}
+	// volatile SFRs aren't cached, read side effect ones only when asked
+	// for alone so dumping a range doesn't drain a FIFO
+	for( uint32_t a=start; area=='s' && a<end; a++ )
+	{
+		if( mSfrVolatile[a & 0x7f] || (mSfrReadSide[a & 0x7f] && len==1) )
+			read_uncached( area, a, 1, out+a-start );
+	}
+	return true;
+}
+
+
+void Target::fill_cache( char area, uint32_t addr, uint32_t len )
+{
+	uint32_t base = MemRemap::flat( 0, area );
+	uint32_t blk = addr & ~(MEM_CACHE_BLOCK-1);
+	uint32_t end = addr + len;
+	std::vector<unsigned char> tmp;
+	
+	while( blk<end )
+	{
+		if( mMemCache.find( base+blk )!=mMemCache.end() )
+		{
+			blk += MEM_CACHE_BLOCK;
+			continue;
+		}
+		// gather the run of missing blocks starting here
+		uint32_t run = blk;
+		while( run<end && mMemCache.find( base+run )==mMemCache.end() )
+			run += MEM_CACHE_BLOCK;
+		tmp.assign( run-blk, 0xff );
+		for( uint32_t a=blk, n; a<run; a+=n )
+		{
+			for( n=0; a+n<run && !(area=='s' && sfr_skip_fill( a+n )); n++ )
+				;
+			if( n>0 )
+				read_uncached( area, a, n, &tmp[a-blk] );
+			else
+				n = 1;
+		}
+		for( uint32_t a=blk; a<run; a+=MEM_CACHE_BLOCK )
+		{
+			MEM_CACHE_ENTRY &entry = mMemCache[base+a];
+			memcpy( entry.buf, &tmp[a-blk], MEM_CACHE_BLOCK );
+		}
+		blk = run;
+	}
+}
+
+
+bool Target::cached( char area, uint32_t addr, uint32_t len )
+{
+	uint32_t base = MemRemap::flat( 0, area );
+	uint32_t end = addr + len;
+	for( uint32_t blk = addr & ~(MEM_CACHE_BLOCK-1); blk<end;
+		 blk += MEM_CACHE_BLOCK )
+	{
+		if( mMemCache.find( base+blk )==mMemCache.end() )
+			return false;
+	}
+	return true;
+}
+
+
+void Target::read_ahead( uint32_t flat_addr, uint32_t len )
+{
+	char area = 0;
+	uint32_t size, n;
+	ADDR addr = MemRemap::target( flat_addr, area );
+	bool seq = len>0 && flat_addr==mSeqNext;
+	
+	mSeqNext = flat_addr + len;
+	if( !seq )
+	{
+		mSeqWindow = 0;		// a new walk, wait to see if it continues
+		return;
+	}
+	if( addr==INVALID_ADDR )
+		return;
+	// start at a few reads' worth, doubling while the walk continues
+	if( mSeqWindow==0 )
+		mSeqWindow = len*4 > READ_AHEAD_MIN ? len*4 : READ_AHEAD_MIN;
+	else
+		mSeqWindow *= 2;
+	if( mSeqWindow>READ_AHEAD_MAX )
+		mSeqWindow = READ_AHEAD_MAX;
+	
+	addr += len;
+	if( area=='c' )
+	{
+		if( addr>=0x10000 )
+			return;
+		n = 0x10000-addr < mSeqWindow ? 0x10000-addr : mSeqWindow;
+		std::vector<unsigned char> tmp( n );
+		read_code_cache( addr, n, &tmp[0] );	// fills the CODE shadow
+		return;
+	}
+	if( area=='i' )
+		area = 'd';
+	if( area=='s' || cache_policy(area)==CACHE_OFF )
+		return;
+	size = area=='x' ? 0x10000 : 0x100;
+	if( addr>=size )
+		return;
+	n = size-addr < mSeqWindow ? size-addr : mSeqWindow;
+	// only go to the target once the walk has used up half the window, so
+	// each transfer stays large
+	if( cached( area, addr, n/2 ) )
+		return;
+	if( write_held( MemRemap::flat( addr, area ), n ) )
+		flush_writes();
+	fill_cache( area, addr, n );
+}
+
+
+void Target::prefetch( uint32_t flat_addr, uint32_t len )
+{
+	char area;
+	ADDR addr = MemRemap::target( flat_addr, area );
+	if( addr==INVALID_ADDR || len==0 )
+		return;
+	if( area=='i' )
+		area = 'd';
+	if( area=='c' || area=='s' || cache_policy(area)==CACHE_OFF )
+		return;
+	uint32_t size = area=='x' ? 0x10000 : 0x100;
+	if( (uint32_t)addr>=size )
+		return;
+	if( len>size-addr )
+		len = size-addr;
+	if( write_held( MemRemap::flat( addr, area ), len ) )
+		flush_writes();
+	fill_cache( area, addr, len );
+}
+
+
+bool Target::read_memory_uncached( uint32_t flat_addr, uint32_t len,
+									unsigned char *buf )
+{
+	char area;
+	ADDR addr = MemRemap::target( flat_addr, area );
+	if( addr==INVALID_ADDR )
+		return false;
+	if( area=='c' )
+	{
+		read_code_cache( addr, len, buf );
+		return true;
+	}
+	if( area=='i' )
+		area = 'd';
+	if( write_held( MemRemap::flat( addr, area ), len ) )
+		flush_writes();
+	read_uncached( area, addr, len, buf );
+	return true;
+}
+
+
+bool Target::write_memory( uint32_t flat_addr, uint32_t len, unsigned char *buf )
+{
+	char area;
+	ADDR addr = MemRemap::target( flat_addr, area );
+	if( addr==INVALID_ADDR )
+		return false;
+	if( area=='i' )
+		area = 'd';
+	if( mWriteBack && area!='c' )
+	{
+		bool hold = true;
+		for( uint32_t i=0; area=='s' && i<len; i++ )
+			hold = hold && !mSfrWriteThrough[(addr+i) & 0x7f];
+		if( hold )
+		{
+			uint32_t base = MemRemap::flat( addr, area );
+			for( uint32_t i=0; i<len; i++ )
+				mWriteBuf[base+i] = buf[i];
+			return true;
+		}
+		flush_writes();		// so the target sees the writes in order
+	}
+	switch( area )
+	{
+		case 'c':	write_code( addr, len, buf );			break;
+		case 'x':	write_xdata( addr, len, buf );			break;
+		case 's':
+			write_sfr( addr, len, buf );
+			cache_update( area, addr, len, buf );
+			break;
+		default:	write_data( addr, len, buf );			break;
+	}
+	return true;
+}
+
+
+void Target::set_cache_policy( char area, CACHE_POLICY policy )
+{
+	switch( area )
+	{
+		case 'd':
+		case 'i':	mCachePolicyData = policy;		break;
+		case 'x':	mCachePolicyXdata = policy;		break;
+		case 's':	mCachePolicySfr = policy;		break;
+	}
+	invalidate_cache();
+}
+
+
+void Target::set_write_back( bool on )
+{
+	if( !on )
+		flush_writes();
+	mWriteBack = on;
+}
+
+
+/** The held bytes are taken out of the buffer before they are written, the
+	write calls drop any they overlap through cache_update().
+*/
+void Target::flush_writes()
+{
+	if( mWriteBuf.empty() )
+		return;
+	WRITE_BACK_MAP bytes;
+	bytes.swap( mWriteBuf );
+	WRITE_BACK_MAP::iterator it = bytes.begin();
+	while( it!=bytes.end() )
+	{
+		vector<unsigned char> run;
+		uint32_t start = it->first;
+		char area = 0, next_area;
+		ADDR addr = MemRemap::target( start, area );
+		uint32_t max = area=='x' ? 0xffff : 0xff;	// the write calls' len
+		do
+		{
+			run.push_back( it->second );
+			++it;
+		} while( it!=bytes.end() && it->first==start+run.size() &&
+				 run.size()<max &&
+				 MemRemap::target( it->first, next_area )!=INVALID_ADDR &&
+				 next_area==area );
+		switch( area )
+		{
+			case 'x':	write_xdata( addr, run.size(), &run[0] );	break;
+			case 's':
+				write_sfr( addr, run.size(), &run[0] );
+				cache_update( area, addr, run.size(), &run[0] );
+				break;
+			default:	write_data( addr, run.size(), &run[0] );	break;
+		}
+	}
+}
+
+
+/** \returns true if any byte of the range is held by the write back buffer.
+*/
+bool Target::write_held( uint32_t flat_addr, uint32_t len )
+{
+	WRITE_BACK_MAP::iterator it = mWriteBuf.lower_bound( flat_addr );
+	return it!=mWriteBuf.end() && it->first<flat_addr+len;
+}
+
+
+Target::CACHE_POLICY Target::cache_policy( char area )
+{
+	switch( area )
+	{
+		case 'd':	return mCachePolicyData;
+		case 'x':	return mCachePolicyXdata;
+		case 's':	return mCachePolicySfr;
+		default:	return CACHE_OFF;
+	}
+}
+
+
+/** Read straight from the target, blocks are clipped to the end of the area.
+*/
+void Target::read_uncached( char area, uint32_t addr, int len, unsigned char *buf )
+{
+	uint32_t size = area=='x' ? 0x10000 : 0x100;
+	memset( buf, 0xff, len );
+	if( addr+len>size )
+		len = size-addr;
+	switch( area )
+	{
+		case 'x':	read_xdata( addr, len, buf );	break;
+		case 's':	read_sfr( addr, len, buf );		break;
+		default:	read_data( addr, len, buf );	break;
+	}
+}
+
+
+void Target::cache_update( char area, uint32_t addr, int len, unsigned char *buf )
+{
+	mCpuContextValid = false;
+	uint32_t base = MemRemap::flat( 0, area=='i' ? 'd' : area );
+	for( int i=0; i<len; i++ )
+	{
+		uint32_t a = addr+i;
+		mWriteBuf.erase( base+a );	// a direct write is newer than any held
+		MEM_CACHE_MAP::iterator it =
+			mMemCache.find( base + (a & ~(MEM_CACHE_BLOCK-1)) );
+		if( it!=mMemCache.end() )
+			it->second.buf[a & (MEM_CACHE_BLOCK-1)] = buf[i];
+	}
 }
 
 void Target::read_sfr_cache(uint8_t addr,
@@ -128,7 +584,7 @@ void Target::read_sfr_cache(uint8_t addr,
 		// not in cache, read it and cache it.
 		SFR_CACHE_PAGE page_entry;
 		page_entry.page = page;
-		read_sfr( 0x80, page_entry.page, 128, page_entry.buf );
+		read_sfr_page( page_entry.page, page_entry.buf );
 		mCacheSfrPages.push_back(page_entry);
 		memcpy( buf, page_entry.buf+(addr-0x80), len );
 	}
@@ -139,3 +595,97 @@ void Target::read_sfr_cache(uint8_t addr,
 	}
 }
 
+
+void Target::read_code_cache( uint16_t addr, int len, unsigned char *buf )
+{
+	int end = addr + len;
+	bool reading = false;
+	if( end>0x10000 )
+	{
+		memset( buf+0x10000-addr, 0xff, end-0x10000 );	// as read_uncached()
+		end = 0x10000;
+	}
+	for( int blk=addr/CODE_CACHE_BLOCK; blk*CODE_CACHE_BLOCK<end; blk++ )
+	{
+		int lo = blk*CODE_CACHE_BLOCK>addr ? blk*CODE_CACHE_BLOCK : addr;
+		int hi = (blk+1)*CODE_CACHE_BLOCK<end ? (blk+1)*CODE_CACHE_BLOCK : end;
+		if( image_covers( lo, hi ) )
+			continue;		// never needs the target
+		if( !mCodeCacheValid[blk] )
+		{
+			if( !reading )
+			{
+				begin_code_access();	// one set up for all the missing blocks
+				reading = true;
+			}
+			// reads outside the usable flash leave the erased value
+			memset( mCodeCache+blk*CODE_CACHE_BLOCK, 0xff, CODE_CACHE_BLOCK );
+			read_code( blk*CODE_CACHE_BLOCK, CODE_CACHE_BLOCK,
+					   mCodeCache+blk*CODE_CACHE_BLOCK );
+			mCodeCacheValid[blk] = true;
+		}
+		memcpy( buf+lo-addr, mCodeCache+lo, hi-lo );
+	}
+	if( reading )
+		end_code_access();
+	if( !mImageOverlay )
+		return;
+	for( size_t i=0; i<mImageSegs.size(); i++ )
+	{
+		int lo = mImageSegs[i].start>addr ? mImageSegs[i].start : addr;
+		int hi = mImageSegs[i].end+1<end ? mImageSegs[i].end+1 : end;
+		if( hi>lo )
+			memcpy( buf+lo-addr, mImage+lo, hi-lo );
+	}
+}
+
+/** \returns true if one segment of the image overlay holds all of [lo,hi).
+*/
+bool Target::image_covers( int lo, int hi )
+{
+	if( !mImageOverlay )
+		return false;
+	for( size_t i=0; i<mImageSegs.size(); i++ )
+	{
+		if( mImageSegs[i].start<=lo && hi<=mImageSegs[i].end+1 )
+			return true;
+	}
+	return false;
+}
+
+bool Target::image_range( ADDR &start, ADDR &end )
+{
+	start = mImageStart;
+	end = mImageEnd;
+	return mImageStart!=INVALID_ADDR;
+}
+
+bool Target::verify_code( uint16_t addr, int len, const unsigned char *buf )
+{
+	unsigned char *code = new unsigned char[len];
+	begin_code_access();
+	read_code( addr, len, code );
+	end_code_access();
+	bool same = memcmp( code, buf, len )==0;
+	delete [] code;
+	return same;
+}
+
+void Target::invalidate_code_cache()
+{
+	memset( mCodeCacheValid, 0, sizeof(mCodeCacheValid) );
+	mCodeGeneration++;
+	mImageOverlay = false;	// the flash may no longer hold the image
+}
+
+void Target::fill_code_cache( uint16_t addr, int len, unsigned char *buf )
+{
+	int end = addr + len;
+	int blk = (addr+CODE_CACHE_BLOCK-1)/CODE_CACHE_BLOCK;	// first whole block
+	for( ; (blk+1)*CODE_CACHE_BLOCK<=end; blk++ )
+	{
+		memcpy( mCodeCache+blk*CODE_CACHE_BLOCK,
+				buf+blk*CODE_CACHE_BLOCK-addr, CODE_CACHE_BLOCK );
+		mCodeCacheValid[blk] = true;
+	}
+}
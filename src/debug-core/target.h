@@ -22,6 +22,10 @@
 #include <stdint.h>
 #include <string>
 #include <list>
+#include <vector>
+#include <map>
+#include "types.h"
+#include "ihex.h"
 using namespace std;
 /**
 Base class for all target implementations
@@ -58,6 +62,14 @@ public:
 	/// cause the target to step 1 assembly instruction.
 	virtual uint16_t step()=0;
 	
+	/** Step n assembly instructions back to back.
+		Targets that can overlap the steps should override this.
+		\param[out] pcs	PC after each step, room for n entries
+		\param n		number of steps
+		\returns the number of steps completed.
+	*/
+	virtual int step_n( uint16_t *pcs, int n );
+	
 	/** Add a breakpoint.
 		\param addr	address to place the breakpoint at
 		\returns true=success, false=failure
@@ -102,15 +114,85 @@ public:
 	*/
 	virtual bool poll_for_halt()
 	{
+		return true;	// targets that can't run in the background never run
 	}
+	
+	/** Wait for a target started with go() to halt.
+		\param stop	Checked while waiting, once it is set the target is
+					stopped and the wait ends.
+		\returns true if the target halted by itself, eg on a breakpoint,
+				 false if it was stopped.
+	*/
+	virtual bool wait_for_halt( volatile bool &stop );
+	
+	typedef enum
+	{
+		SAMPLE_OK,		///< PC sampled, the target is running again
+		SAMPLE_HALTED,	///< the target had stopped by itself, eg on a breakpoint
+		SAMPLE_FAILED	///< couldn't sample, or the target doesn't support it
+	} SAMPLE_RESULT;
+	
+	/** Sample the PC of a target started with go().
+		The target is halted just long enough to read the PC.
+		\param[out] pc	sampled address
+		\param resume	false to leave the target halted after the sample
+		\returns SAMPLE_HALTED with pc set to where it stopped if the target
+				stopped by itself.
+	*/
+	virtual SAMPLE_RESULT sample_PC( uint16_t &pc, bool resume=true )
+		{ return SAMPLE_FAILED; }
+	
+	static const int CPU_STACK_DEPTH = 16;
+	/** The registers of a halted CPU, see read_cpu_context().
+	*/
+	typedef struct
+	{
+		uint16_t	pc;
+		uint8_t		psw, acc, b, dpl, dph, sp;
+		uint8_t		r[8];				///< the bank PSW selects
+		uint8_t		stack_base;			///< IDATA address of stack[0]
+		uint8_t		stack[CPU_STACK_DEPTH];	///< stack_base up to SP
+	} CPU_CONTEXT;
+	
+	/** Read the PC, the core SFRs, the selected register bank and the top
+		of the stack of a halted target.
+		The SFRs come from one SFR page read and the bank and stack from
+		read_memory(), which normally makes one transfer of them, the result
+		is then kept until the target next runs, steps or is reset or any of
+		the memory it came from is written.
+	*/
+	const CPU_CONTEXT &read_cpu_context();
+	
+	/** Make the next read_cpu_context() read the target again, targets call
+		this from write_PC() and the write_sfr() that bypasses the cache.
+	*/
+	void invalidate_cpu_context()		{ mCpuContextValid = false; }
 
 	
 	// memory reads
 	virtual void read_data( uint8_t addr, uint8_t len, unsigned char *buf )=0;
 	virtual void read_sfr( uint8_t addr, uint8_t len, unsigned char *buf )=0;
 	virtual void read_sfr( uint8_t addr, uint8_t page, uint8_t len, unsigned char *buf )=0;
+	/** Read a whole SFR page, 0x80 - 0xFF, into buf.
+		Targets that can do this faster than read_sfr() should override it.
+	*/
+	virtual void read_sfr_page( uint8_t page, unsigned char *buf )
+		{ read_sfr( 0x80, page, 128, buf ); }
+	/** SFR pages the device has, just page 0 unless its SFRs are paged.
+	*/
+	virtual std::vector<uint8_t> sfr_pages()
+		{ return std::vector<uint8_t>( 1, 0 ); }
+	/** Bytes of XDATA from address 0 that are worth reading, eg for a
+		snapshot of the whole memory.
+	*/
+	virtual uint32_t xdata_size()		{ return 0x10000; }
 	virtual void read_xdata( uint16_t addr, uint16_t len, unsigned char *buf )=0;
 	virtual void read_code( uint16_t addr, int len, unsigned char *buf )=0;
+	/** Bracket a run of read_code() calls so the target can set up flash
+		access once for all of them rather than per read.
+	*/
+	virtual void begin_code_access()	{}
+	virtual void end_code_access()		{}
 	virtual uint16_t read_PC()=0;
 	
 	// memory writes
@@ -122,15 +204,78 @@ public:
 	virtual void write_PC( uint16_t addr )=0;
 
 	/** load an intel hex file into the target
+		The image is kept and CODE reads in its range are served from it
+		rather than the target.  If the target isn't connected the file is
+		only loaded into the image, for disassembly and listings.
 	*/
 	virtual bool load_file( string name );
 
+	/** Load an image already in memory, as load_file() does once the file
+		has been read.  Used by front ends that receive the program some
+		other way, such as a gdb load.
+		\returns false if the image is empty or doesn't fit in 64K.
+	*/
+	bool load_image( const IHEX_IMAGE &img );
+
+	/** Program a sparse image into CODE, leaving the flash between its
+		segments alone.  The default writes each segment with write_code(),
+		targets that erase flash should override it to erase each sector
+		only once.
+	*/
+	virtual void write_image( const IHEX_IMAGE &img );
+
+	/** The range of CODE held by the image from the last load_file().
+		\returns false if no file has been loaded.
+	*/
+	bool image_range( ADDR &start, ADDR &end );
+
+	/** Compare target CODE memory with buf, reading directly from the
+		target rather than the shadow or the image.
+		\returns true if they match.
+	*/
+	virtual bool verify_code( uint16_t addr, int len, const unsigned char *buf );
+
+	/** \returns the loaded image, valid in the image_range() only.
+	*/
+	const unsigned char *image()			{ return mImage; }
+
+	/// A run of CODE set by the image, end inclusive.
+	typedef struct
+	{
+		ADDR start;
+		ADDR end;
+	} IMAGE_SEG;
+	typedef std::vector<IMAGE_SEG> IMAGE_SEG_VEC;
+
+	/** \returns the parts of the image_range() the file actually sets, in
+		address order.
+	*/
+	const IMAGE_SEG_VEC &image_segments()	{ return mImageSegs; }
+
 	
 	/** Special function to allow target->stop() to stop processes outside of the target such as a cont or runaway step of until operation.
 	if a force_stop has been requested and the target han't handle it this function will return true and will clear the flag within the target module.  the caller must then stop the current operation.
 	*/
 	virtual bool check_stop_forced();
 	
+	/** Print protocol statistics for the debug adapter.
+		\param reset	true to clear the counters after printing.
+		\returns		false if this target doesn't keep statistics.
+	*/
+	virtual bool print_stats( bool reset )	{ return false; }
+
+	/** Print and empty the debug adapter's trace ring of recent transfers.
+		\returns		false if this target doesn't keep a trace.
+	*/
+	virtual bool dump_trace()	{ return false; }
+
+	/** Turn the trace ring on or off.
+		\param on			true to log transfers.
+		\param dump_on_error	true to dump the ring when a transfer fails.
+		\returns			false if this target doesn't keep a trace.
+	*/
+	virtual bool set_trace( bool on, bool dump_on_error )	{ return false; }
+	
 	/** utility function to print a buffer as an HEX and ASCII dump
 	*/
 	void print_buf_dump( char *buf, int len );
@@ -139,6 +284,10 @@ public:
 // Read Caching functions used for all targets but can be overridden if desired
 ////////////////////////////////////////////////////////////////////////////////
 	
+	/** Forget the cached DATA, XDATA and SFRs.  Anything held by the write
+		back buffer is written first, the targets call this before every
+		run, step and reset.
+	*/
 	virtual void invalidate_cache();
 	
 	/** Read an SFR from the cach.  if this register isn't in the cache then
@@ -146,10 +295,166 @@ public:
 	*/
 	virtual void read_sfr_cache( uint8_t addr, uint8_t page, uint8_t len, unsigned char *buf );
 	
+	/** Read CODE memory through a host side shadow.
+		Code can't change while the target runs or steps so each block is only
+		read from the target the first time it is needed.  Addresses the
+		loaded image sets come from the image and never touch the target,
+		until the shadow is next invalidated by a connect or a write.
+	*/
+	virtual void read_code_cache( uint16_t addr, int len, unsigned char *buf );
 	
+	/** Forget the CODE shadow and stop serving reads from the loaded
+		image.  Derived classes must call this from write_code(), connect()
+		and anything else that erases flash.
+	*/
+	virtual void invalidate_code_cache();
+	
+	/** Changes every time the CODE shadow is invalidated, so anything
+		derived from code memory can tell when to throw its copy away.
+	*/
+	uint32_t code_generation()			{ return mCodeGeneration; }
+	
+	/** Read target memory by MemRemap flat address.
+		DATA / IDATA and XDATA are cached in blocks until the target next runs,
+		steps or is reset, CODE goes through read_code_cache() and SFRs are
+		always read from the target.  See set_cache_policy().
+		\returns false if the address isn't valid.
+	*/
+	virtual bool read_memory( uint32_t flat_addr, uint32_t len, unsigned char *buf );
+	
+	/** Read exactly len bytes by MemRemap flat address straight from the
+		target, for polling memory that is expected to change.  The cache is
+		neither used nor filled, CODE still comes from read_code_cache().
+		\returns false if the address isn't valid.
+	*/
+	bool read_memory_uncached( uint32_t flat_addr, uint32_t len, unsigned char *buf );
+	
+	/** Read ahead of a caller walking forward through memory, eg the x
+		command paging through a buffer.
+		Once a read starts where the previous one noted here ended, the
+		window following it is read into the cache, in as few transfers as
+		the cache has gaps, so the next reads are served from the host.  The
+		window grows while the walk continues.  Call it after the data has
+		been shown so the transfer overlaps with the user reading it.  SFRs
+		and areas with a CACHE_OFF policy are never read ahead.
+		\param flat_addr	start of the read just made
+		\param len			its length
+	*/
+	void read_ahead( uint32_t flat_addr, uint32_t len );
+	
+	/** Read memory the debugger expects to need soon into the cache, eg
+		what is usually asked for after the target stops.  Only the blocks
+		missing from the cache are read, each run of them in one transfer.
+		SFRs, CODE and areas with a CACHE_OFF policy are skipped.
+	*/
+	void prefetch( uint32_t flat_addr, uint32_t len );
+	
+	/** Changes every time the DATA / XDATA cache is invalidated, ie every
+		time the target runs, steps or is reset.
+	*/
+	uint32_t data_generation()			{ return mDataGeneration; }
+	
+	/** Write target memory by MemRemap flat address, the cache is written
+		through.
+	*/
+	virtual bool write_memory( uint32_t flat_addr, uint32_t len, unsigned char *buf );
+	
+	typedef enum
+	{
+		CACHE_OFF,		///< always read from the target (volatile)
+		CACHE_STOP		///< keep until the target runs, steps or resets
+	} CACHE_POLICY;
+	
+	/** Choose how one memory area ('d','i','x','s') is cached by
+		read_memory().  IDATA shares the DATA policy.
+	*/
+	void set_cache_policy( char area, CACHE_POLICY policy );
+	
+	/** Hold the writes made through write_memory(), merging adjacent and
+		overlapping ones per memory area, until the target next runs, steps
+		or is reset or a read_memory() covers them.  Off by default, turning
+		it off writes anything held.
+	*/
+	void set_write_back( bool on );
+	bool write_back()					{ return mWriteBack; }
+	
+	/** Write everything held by the write back buffer, each run of adjacent
+		bytes in as few transfers as the target's write calls allow.
+	*/
+	void flush_writes();
+	
+	/** Flag an SFR whose writes have side effects, eg SBUF, so they are never
+		held.  Everything held before it is written first, keeping the order
+		the target sees the writes in.
+	*/
+	void set_sfr_write_through( uint8_t addr, bool on )
+		{ mSfrWriteThrough[addr & 0x7f] = on; }
+	
+	/** Flag an SFR the hardware changes by itself, eg a timer, so
+		read_memory() reads it from the target even when SFRs are cached.
+	*/
+	void set_sfr_volatile( uint8_t addr, bool on )
+		{ mSfrVolatile[addr & 0x7f] = on; }
+	
+	/** Flag an SFR whose reads have side effects, eg a FIFO, so it is left
+		out of reads of a range and only read when it is asked for alone.
+	*/
+	void set_sfr_read_side( uint8_t addr, bool on )
+		{ mSfrReadSide[addr & 0x7f] = on; }
 	
 protected:
 	bool force_stop;
+	
+	/** Update any cached copy of memory that has just been written, held
+		writes it overlaps are dropped.
+		Derived classes must call this from write_data() and write_xdata().
+	*/
+	void cache_update( char area, uint32_t addr, int len, unsigned char *buf );
+	
+	static const int MEM_CACHE_BLOCK = 64;
+	typedef struct
+	{
+		unsigned char buf[MEM_CACHE_BLOCK];
+	} MEM_CACHE_ENTRY;
+	typedef std::map<uint32_t,MEM_CACHE_ENTRY> MEM_CACHE_MAP;
+	MEM_CACHE_MAP mMemCache;		///< keyed by flat address of the block
+	CACHE_POLICY mCachePolicyData;
+	CACHE_POLICY mCachePolicyXdata;
+	CACHE_POLICY mCachePolicySfr;
+	uint32_t mDataGeneration;
+	
+	CACHE_POLICY cache_policy( char area );
+	bool write_held( uint32_t flat_addr, uint32_t len );
+	
+	/// Read every block of [addr, addr+len) missing from the cache, each
+	/// run of adjacent missing blocks in one read_uncached().  Volatile and
+	/// read side effect SFRs are skipped, their cached copy is 0xff.
+	void fill_cache( char area, uint32_t addr, uint32_t len );
+	bool sfr_skip_fill( uint32_t addr )
+		{ return mSfrVolatile[addr & 0x7f] || mSfrReadSide[addr & 0x7f]; }
+	bool cached( char area, uint32_t addr, uint32_t len );
+	
+	static const uint32_t READ_AHEAD_MIN = 256;
+	static const uint32_t READ_AHEAD_MAX = 4096;
+	uint32_t mSeqNext;		///< flat address a sequential read_ahead() starts at
+	uint32_t mSeqWindow;	///< bytes read ahead, 0 until a walk is seen
+	void read_uncached( char area, uint32_t addr, int len, unsigned char *buf );
+	
+	/** Seed the CODE shadow with an image that has just been written, only
+		blocks completely covered by the image are filled.
+	*/
+	void fill_code_cache( uint16_t addr, int len, unsigned char *buf );
+	
+	static const int CODE_CACHE_BLOCK = 512;
+	unsigned char mCodeCache[0x10000];
+	bool mCodeCacheValid[0x10000/CODE_CACHE_BLOCK];
+	uint32_t mCodeGeneration;
+	unsigned char mImage[0x10000];	///< the last file loaded by load_file()
+	ADDR mImageStart;				///< INVALID_ADDR when there is no image
+	ADDR mImageEnd;					///< inclusive
+	IMAGE_SEG_VEC mImageSegs;
+	bool mImageOverlay;				///< CODE reads in mImageSegs use mImage
+	bool image_covers( int lo, int hi );
 		
 	typedef struct
 	{
@@ -159,6 +464,16 @@ protected:
 	typedef std::list<SFR_CACHE_PAGE> SFR_PAGE_LIST;
 	SFR_PAGE_LIST mCacheSfrPages;
 	
+	typedef std::map<uint32_t,unsigned char> WRITE_BACK_MAP;
+	bool mWriteBack;
+	WRITE_BACK_MAP mWriteBuf;		///< held bytes keyed by flat address
+	bool mSfrWriteThrough[0x80];
+	bool mSfrVolatile[0x80];
+	bool mSfrReadSide[0x80];
+	
+	CPU_CONTEXT mCpuContext;
+	bool mCpuContextValid;
+	
 	SFR_PAGE_LIST::iterator cache_get_sfr_page( int page )
 	{
 		SFR_PAGE_LIST::iterator it;
@@ -32,6 +32,8 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <signal.h>
+#include <ctype.h>
+#include <sys/time.h>
 //FILE *simin ; /* stream for simulator input */
 //FILE *simout; /* stream for simulator output */
 
@@ -44,6 +46,7 @@ TargetS51::TargetS51()
 {
 	sock = -1;
 	simPid = -1;
+	rx_head = rx_tail = 0;
 }
 
 
@@ -57,6 +60,8 @@ bool TargetS51::connect()
 	int retry = 0;
 	int i ;
 	bRunning = false;
+	invalidate_code_cache();
+	invalidate_cache();
 	if( !bConnected )
 	{
 	try_connect:
@@ -117,6 +122,7 @@ bool TargetS51::connect()
 			exit(1);
 		}
 		cout<<"Waiting for sim."<<endl;
+		rx_head = rx_tail = 0;
 		bConnected = true;	
 		recvSim( 200 );
 		cout<<"Ready."<<endl;
@@ -130,6 +136,7 @@ bool TargetS51::disconnect()
 {
 	if( bConnected )
 	{
+		flush_writes();
 		bConnected = false;
 		sendSim("quit\n");
 		recvSim( 2000 );
@@ -185,47 +192,93 @@ void TargetS51::sendSim( string cmd )
 	}
 }
 
-string TargetS51::recvSim(int timeout_ms )
+/** \returns true if resp ends with the ucsim prompt, "> " at the start of a
+	line, optionally preceded by a console number as in "0> ".
+*/
+static bool ends_with_prompt( const string &resp )
+{
+	size_t len = resp.length();
+	if( len<2 || resp[len-2]!='>' || resp[len-1]!=' ' )
+		return false;
+	size_t pos = len-2;
+	while( pos>0 && isdigit(resp[pos-1]) )
+		pos--;
+	return pos==0 || resp[pos-1]=='\n';
+}
+
+/** \returns milliseconds elapsed since start.
+*/
+static long ms_since( const struct timeval &start )
+{
+	struct timeval now;
+	gettimeofday( &now, 0 );
+	return (now.tv_sec-start.tv_sec)*1000 + (now.tv_usec-start.tv_usec)/1000;
+}
+
+/** Wait up to timeout_ms for data from the simulator and append as much as is
+	available to rx_buf in a single read.
+	\returns true if any data was read, false on timeout or a closed socket.
+*/
+bool TargetS51::fill_rx( int timeout_ms )
 {
-	int		i=0;
-	char	ch;
-	string	resp;
 	fd_set	input;
 	struct	timeval	timeout;
+
+	if( rx_head==rx_tail )
+		rx_head = rx_tail = 0;
+	else if( rx_tail==RX_BUF_SIZE )
+	{
+		// move the unused part down to make room
+		memmove( rx_buf, rx_buf+rx_head, rx_tail-rx_head );
+		rx_tail -= rx_head;
+		rx_head = 0;
+	}
+
+	FD_ZERO( &input );
+	FD_SET( sock, &input );
+	timeout.tv_sec  = timeout_ms/1000;
+	timeout.tv_usec = (timeout_ms%1000)*1000;
+
+	int n = select( sock+1, &input, NULL, NULL, &timeout );
+	if( n<0 )
+	{
+		if( errno==EINTR )
+			return false;	// eg the user stopping the target
+//		perror("select failed");
+		exit(-1);
+	}
+	if( n==0 )
+		return false;		// timeout
+	int r = read( sock, rx_buf+rx_tail, RX_BUF_SIZE-rx_tail );
+	if( r<=0 )
+		return false;
+	rx_tail += r;
+	return true;
+}
+
+/** Read a response from the simulator.
+	Returns as soon as the response ends with the simulator prompt,
+	timeout_ms is only an upper bound for responses that never get one.
+*/
+string TargetS51::recvSim(int timeout_ms )
+{
+	string	resp;
+	struct	timeval	start;
 	if( bConnected )
 	{
-		// Initialize the input set
-		FD_ZERO( &input );
-		FD_SET( sock, &input );
-		fcntl(sock, F_SETFL,0);	// block if not enough characters available
-		
-		// Initialize the timeout structure
-		timeout.tv_sec  = 0;		// n seconds timeout
-		timeout.tv_usec = timeout_ms*1000/4;
-		
-		//char *cur_ptr = buf;
-		int cnt=0, r, n;
-			
+		gettimeofday( &start, 0 );
 		while(1)
 		{
-			// Do the select
-			n = select( sock+1, &input, NULL, NULL, &timeout );
-			if (n < 0)
+			if( rx_head<rx_tail )
 			{
-	//			perror("select failed");
-				exit(-1);
-				return resp;
+				resp.append( rx_buf+rx_head, rx_tail-rx_head );
+				rx_head = rx_tail;
+				if( ends_with_prompt(resp) )
+					return resp;
 			}
-			else if (n == 0)
-			{
-	//			puts("TIMEOUT");
+			long remaining = timeout_ms - ms_since(start);
+			if( remaining<=0 || !fill_rx(remaining) )
 				return resp;
-			}
-			else
-			{
-				r = read( sock, &ch, 1 );
-				resp+=ch;
-			}
 		}
 	}
 	return resp;
@@ -233,58 +286,47 @@ string TargetS51::recvSim(int timeout_ms )
 
 
 /** Reads from simulator until line end or timeout.
+	Anything after the line end stays buffered for the next read.
 */
 string TargetS51::recvSimLine(int timeout_ms )
 {
-	int		i=0;
-	char	ch;
 	string	resp;
-	fd_set	input;
-	struct	timeval	timeout;
+	struct	timeval	start;
 	if( bConnected )
 	{
-		// Initialize the input set
-		FD_ZERO( &input );
-		FD_SET( sock, &input );
-		fcntl(sock, F_SETFL,0);	// block if not enough characters available
-		
-		// Initialize the timeout structure
-		timeout.tv_sec  = 0;		// n seconds timeout
-		timeout.tv_usec = timeout_ms*1000/4;
-		
-		//char *cur_ptr = buf;
-		int cnt=0, r, n;
-			
+		gettimeofday( &start, 0 );
 		while(1)
 		{
-			// Do the select
-			n = select( sock+1, &input, NULL, NULL, &timeout );
-			if (n < 0)
+			char *nl = (char*)memchr( rx_buf+rx_head, '\n', rx_tail-rx_head );
+			if( nl )
 			{
-	//			perror("select failed");
-				exit(-1);
+				resp.append( rx_buf+rx_head, nl-(rx_buf+rx_head) );
+				rx_head = nl-rx_buf+1;
+				printf("line resp = '%s'\n",resp.c_str());
 				return resp;
 			}
-			else if (n == 0)
-			{
-	//			puts("TIMEOUT");
+			resp.append( rx_buf+rx_head, rx_tail-rx_head );
+			rx_head = rx_tail;
+			long remaining = timeout_ms - ms_since(start);
+			if( remaining<=0 || !fill_rx(remaining) )
 				return resp;
-			}
-			else
-			{
-				r = read( sock, &ch, 1 );
-				if(ch=='\n')
-				{
-					printf("line resp = '%s'\n",resp.c_str());
-					return resp;
-				}
-				resp+=ch;
-			}
 		}
 	}
 	return resp;
 }
 
+/** Discard anything the simulator has already sent without waiting for more.
+*/
+void TargetS51::flushSim()
+{
+	if( bConnected )
+	{
+		while( fill_rx(0) )
+			rx_head = rx_tail;
+		rx_head = rx_tail = 0;
+	}
+}
+
 #if 0
 bool TargetS51::load_file( string name )
 {
@@ -310,6 +352,7 @@ bool TargetS51::load_file( string name )
 
 void TargetS51::reset()
 {
+	invalidate_cache();
 	sendSim("reset\n");
 	recvSim( 250 );
 	bRunning = false;
@@ -320,6 +363,7 @@ void TargetS51::reset()
 */
 uint16_t TargetS51::step()
 {
+	invalidate_cache();
 	sendSim("step\n");
 	recvSim( 100 );
 	bRunning = false;
@@ -394,6 +438,7 @@ void TargetS51::run_to_bp(int ignore_cnt)
 //					F? 0x0078 74 04    MOV   A,#04
 //					F 0x000078
 	// fixme: need to know when sim has actually stopped.
+	invalidate_cache();
 	for(int i=0; i<=ignore_cnt; i++)
 	{
 		sendSim("go\n");
@@ -427,6 +472,7 @@ void TargetS51::stop()
 */
 void TargetS51::go()
 {
+	invalidate_cache();
 	sendSim("go\n");
 	string msg = recvSimLine(100);
 	//"Simulation started"
@@ -454,22 +500,14 @@ bool TargetS51::poll_for_halt()
 
 void TargetS51::read_data( uint8_t start, uint8_t len, unsigned char *buf )
 {
-	char cmd[16];
-	snprintf(cmd,16,"di 0x%02x 0x%02x\n",start, (start+len-1) );
-	sendSim( cmd );
-	string s = recvSim( 250 );
-	// cout <<"got : "<<s<<endl;
-	parse_mem_dump( s, buf, len );
+	read_mem( "di", start, len, buf );
 }
 
 /** @OBSOLETE
 */
 void TargetS51::read_sfr( uint8_t addr, uint8_t len, unsigned char *buf )
 {
-	char cmd[16];
-	snprintf(cmd,16,"ds 0x%02x 0x%02x\n",addr, (addr+len-1) );
-	sendSim( cmd );
-	parse_mem_dump( recvSim( 250 ), buf, len );
+	read_mem( "ds", addr, len, buf );
 }
 
 void TargetS51::read_sfr( uint8_t addr, uint8_t page,
@@ -483,27 +521,21 @@ void TargetS51::read_sfr( uint8_t addr, uint8_t page,
 
 void TargetS51::read_xdata( uint16_t addr, uint16_t len, unsigned char *buf )
 {
-	char cmd[16];
-	snprintf(cmd,16,"ds 0x%04x 0x%04x\n",addr, (addr+len-1) );
-	sendSim( cmd );
-	parse_mem_dump( recvSim( 250 ), buf, len );
+	read_mem( "dx", addr, len, buf );
 }
 
 void TargetS51::read_code( uint16_t addr, int len, unsigned char *buf )
 {
-	char cmd[16];
-	snprintf(cmd,16,"dch 0x%04x 0x%04x\n",addr, (addr+len-1) );
-	sendSim( cmd );
-	parse_mem_dump( recvSim( 250 ), buf, len );
+	read_mem( "dch", addr, len, buf );
 }
 
 uint16_t TargetS51::read_PC()
 {
 	if( !bConnected )
 		return 0;
-	string r = recvSim( 100 );	// to flush any remaining data
+	flushSim();		// drop any remaining data
 	sendSim("pc\n");
-	r = recvSim( 250 );
+	string r = recvSim( 250 );
 //	cout << "["<<r<<"]";
 	int pos = r.find("0x",0);
 	int npos = r.find(' ',pos);
@@ -517,6 +549,7 @@ uint16_t TargetS51::read_PC()
 void TargetS51::write_data( uint8_t addr, uint8_t len, unsigned char *buf )
 {
 	write_mem("iram",addr,len,buf);
+	cache_update( 'd', addr, len, buf );
 }
 
 /** @OBSOLETE
@@ -524,6 +557,7 @@ void TargetS51::write_data( uint8_t addr, uint8_t len, unsigned char *buf )
 void TargetS51::write_sfr( uint8_t addr, uint8_t len, unsigned char *buf )
 {
 	write_mem("sfr",addr,len,buf);
+	invalidate_cpu_context();
 }
 
 void TargetS51::write_sfr( uint8_t addr, uint8_t page,
@@ -540,19 +574,22 @@ void TargetS51::write_sfr( uint8_t addr, uint8_t page,
 void TargetS51::write_xdata( uint16_t addr, uint16_t len, unsigned char *buf )
 {
 	write_mem("xram",addr,len,buf);
+	cache_update( 'x', addr, len, buf );
 } 
 
 void TargetS51::write_code( uint16_t addr, int len, unsigned char *buf )
 {
+	invalidate_code_cache();
 	write_mem("rom",addr,len,buf);
 }
 
 void TargetS51::write_PC( uint16_t addr )
 {
 	char cmd[16];
-	snprintf(cmd,16,"pc 0x%04x",addr);
+	snprintf(cmd,16,"pc 0x%04x\n",addr);
 	sendSim(cmd);
 	recvSim( 250 );
+	invalidate_cpu_context();
 }
 
 
@@ -597,58 +634,118 @@ bool TargetS51::command( string cmd )
 // simplify communications with the simulator
 ///////////////////////////////////////////////////////////////////////////////
 
-/** Take a memory dump from the dimulator and parse it into the supplied buffer.
+/** Read a range of simulator memory with one dump command per MAX_DUMP
+	bytes.
+	\param dump_cmd	ucsim dump command for the memory area, eg di, dx, dch
+*/
+void TargetS51::read_mem( const char *dump_cmd, ADDR addr, int len,
+						  unsigned char *buf )
+{
+	char cmd[32];
+	memset( buf, 0, len );
+	for( int offset=0; offset<len; offset+=MAX_DUMP )
+	{
+		int n = (len-offset)>MAX_DUMP ? MAX_DUMP : (len-offset);
+		snprintf( cmd, sizeof(cmd), "%s 0x%04x 0x%04x\n", dump_cmd,
+				  addr+offset, addr+offset+n-1 );
+		sendSim( cmd );
+		parse_mem_dump( recvSim( 1000 ), addr+offset, n, buf+offset );
+	}
+}
+
+/** \returns the value of hex digit c, or -1 if it isn't one.
+*/
+static inline int hex_val( char c )
+{
+	if( c>='0' && c<='9' )
+		return c-'0';
+	if( c>='a' && c<='f' )
+		return c-'a'+10;
+	if( c>='A' && c<='F' )
+		return c-'A'+10;
+	return -1;
+}
+
+/** Take a memory dump from the simulator and parse it into the supplied buffer.
 	Format: 
 		0x08 00 bc d4 b6 3d 1c 3e 22 ....=.>"
 		reads with less bytes will return a partial row,
 		those with more will return multiple rows
-	note the address can use more characters in the event of 16 bit so we must parse it
+	The address at the start of each row places its bytes, so the row width
+	doesn't matter and anything that isn't a row (eg the prompt) is skipped.
+	A single pass over the text, nothing is allocated.
+	\param addr	address of buf[0]
+	\returns the number of bytes found.
 */
-void TargetS51::parse_mem_dump( string dump, unsigned char *buf, int len )
+int TargetS51::parse_mem_dump( const string &dump, ADDR addr,
+							   int len, unsigned char *buf )
 {
-	int pos=0, epos=0;
-	string line;
-	int total_rows = (len%8==0) ? len/8 : len/8+1;
-	int ofs=0;
-	// split returned string up into lines and process independantly
-	for( int row=0; row<total_rows; row++ )
+	const char *p = dump.c_str();
+	const char *end = p + dump.length();
+	int found = 0;
+
+	while( p<end )
 	{
-		epos = dump.find('\n',pos);
-		line = dump.substr( pos, epos-pos );
-		// parse the line
-		ofs = line.find(' ',0) + 1;		// skip over address
-		int max_j = (len-(row*8))>8 ? 8 : (len-(row*8));
-		for(int j=0; j<max_j; j++)
+		// row address
+		if( p+2<end && p[0]=='0' && (p[1]=='x' || p[1]=='X') &&
+			hex_val(p[2])>=0 )
 		{
-			*buf++ = strtol( line.substr( ofs, 2).c_str(), 0, 16 );
-			ofs +=3;
+			ADDR row = 0;
+			int v;
+			for( p+=2; p<end && (v=hex_val(*p))>=0; p++ )
+				row = (row<<4) | v;
+			int ofs = row - addr;
+			// bytes are two hex digits separated by single spaces, the ascii
+			// column that follows is told apart by its length, it can only
+			// look like a byte in the last partial row, where the length
+			// limit stops us first.
+			while( ofs<len && p+3<=end && *p==' ' &&
+				   hex_val(p[1])>=0 && hex_val(p[2])>=0 &&
+				   (p+3==end || p[3]==' ' || p[3]=='\n' || p[3]=='\r') )
+			{
+				if( ofs>=0 )
+				{
+					buf[ofs] = (hex_val(p[1])<<4) | hex_val(p[2]);
+					found++;
+				}
+				ofs++;
+				p += 3;
+			}
 		}
-		pos = epos+1;
+		// on to the next line
+		while( p<end && *p!='\n' )
+			p++;
+		p++;
 	}
+	return found;
 }
 
 /** write to a specific memory area on the simulator.
 	the area provided must match a memory area recognised by the simulator
 	eg xram, rom, iram, sfr
+	Each set mem command carries up to MAX_SET bytes.
 */
 void TargetS51::write_mem( string area, uint16_t addr, uint16_t len,
 						   unsigned char *buf )
 {
-	const int MAX_CHUNK = 16;
+	static const char hex[] = "0123456789abcdef";
 	string cmd;
 	char s[32];
 
-	for( ADDR offset=0; offset<len; offset+=MAX_CHUNK )
+	cmd.reserve( 32 + MAX_SET*5 );
+	for( ADDR offset=0; offset<len; offset+=MAX_SET )
 	{
 		snprintf( s, 32, "set mem %s 0x%04X", area.c_str(), addr+offset  );
 		cmd = s;
-		for( int i=0; ( i<MAX_CHUNK && (offset+i)<len); i++ )
+		for( int i=0; ( i<MAX_SET && (offset+i)<len); i++ )
 		{
-			snprintf(s,32," 0x%02x", buf[offset+i] );
-			cmd += s;
+			unsigned char b = buf[offset+i];
+			cmd += " 0x";
+			cmd += hex[b>>4];
+			cmd += hex[b&0x0f];
 		}
 		cmd += "\n";
 		sendSim( cmd );
-		recvSim( 250 );	// the sim sends back the result in memory, we ignore it
+		recvSim( 1000 );	// the sim sends back the result in memory, we ignore it
 	}
 }
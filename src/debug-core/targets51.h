@@ -30,6 +30,7 @@
 using namespace std;
 
 #include <target.h>
+#include "types.h"
 
 /**	Target for debugging using the s51 simulator
 
@@ -89,13 +90,22 @@ protected:
 	pid_t simPid;
 	bool bConnected;
 	bool bRunning;
+	enum { RX_BUF_SIZE = 4096 };
+	enum { MAX_DUMP = 1024 };		///< most bytes read by one dump command
+	enum { MAX_SET = 256 };			///< most bytes written by one set mem command
+	char rx_buf[RX_BUF_SIZE];	///< bytes read from the socket, not yet used
+	int rx_head;				///< next unused byte in rx_buf
+	int rx_tail;				///< end of the valid data in rx_buf
 	// Protected functions
 	///////////////////////////////////////////////////////////////////////////
 	
 	void sendSim( string cmd );
 	string recvSim(int timeout_ms );
 	string recvSimLine(int timeout_ms );
-	void parse_mem_dump( string dump, unsigned char *buf, int len );
+	void flushSim();
+	bool fill_rx( int timeout_ms );
+	void read_mem( const char *dump_cmd, ADDR addr, int len, unsigned char *buf );
+	int parse_mem_dump( const string &dump, ADDR addr, int len, unsigned char *buf );
 	void write_mem( string area, uint16_t addr, uint16_t len, unsigned char *buf );
 };
 
@@ -33,6 +33,10 @@ TargetSiLabs::TargetSiLabs()
 	is_connected_flag(false)
 {
 	obj.mode=AUTO;
+	profile.valid = FALSE;
+	obj.profile = &profile;		// reconnects to the same target skip detection
+	ec2_set_erase_costs( &obj, 0 );
+	use_sfr_map( sfr_map_unknown );		// until connect() finds the device
 }
 
 
@@ -45,19 +49,38 @@ TargetSiLabs::~TargetSiLabs()
 
 bool TargetSiLabs::connect()
 {
+	invalidate_code_cache();
+	invalidate_cache();
 	if( ec2_connect( &obj, debugger_port.c_str() ) )
 	{
 		is_connected_flag = true;
+		use_sfr_map( getSfrMap( obj.dev ) );
 		return true;
 	}
 	else
 		return false;
 }
 
+/** Flag the SFRs of the device family whose writes have side effects, or
+	change what later writes reach, as write through, the ones the
+	hardware changes as volatile and the ones whose reads have side effects
+	as read side.
+*/
+void TargetSiLabs::use_sfr_map( const SFR_MAP *map )
+{
+	for( int addr=0x80; addr<0x100; addr++ )
+	{
+		set_sfr_write_through( addr, map->flags[addr-0x80] & SFR_WRITE_SIDE );
+		set_sfr_volatile( addr, map->flags[addr-0x80] & SFR_VOLATILE );
+		set_sfr_read_side( addr, map->flags[addr-0x80] & SFR_READ_SIDE );
+	}
+}
+
 bool TargetSiLabs::disconnect()
 {
 	if( is_connected() )
 	{
+		flush_writes();
 		ec2_disconnect( &obj );
 		is_connected_flag = false;
 		return true;
@@ -132,22 +155,81 @@ bool TargetSiLabs::command( string cmd )
 // Device control
 ///////////////////////////////////////////////////////////////////////////////
 
+bool TargetSiLabs::print_stats( bool reset )
+{
+	EC2_STATS st;
+	ec2_get_stats( &obj, &st );
+	printf("Transport: %s\n", obj.transport ? obj.transport->name : "none");
+	printf("Bytes sent %llu, received %llu, timeouts %u, retries %u\n",
+		   (unsigned long long)st.tx_bytes, (unsigned long long)st.rx_bytes,
+		   st.timeouts, st.retries );
+	if( st.round_trips )
+		printf("Round trips %u, average %llu us, max %u us\n",
+			   st.round_trips,
+			   (unsigned long long)(st.total_usec/st.round_trips),
+			   st.max_usec );
+	printf("\nOpcode    Count   Total us    Avg us\n");
+	for( int op=0; op<256; op++ )
+	{
+		if( st.cmd_count[op]==0 )
+			continue;
+		printf("  0x%02x %8u %10llu %9llu\n", op, st.cmd_count[op],
+			   (unsigned long long)st.cmd_usec[op],
+			   (unsigned long long)(st.cmd_usec[op]/st.cmd_count[op]) );
+	}
+	printf("\nLatency histogram\n");
+	for( int b=0; b<EC2_STATS_BUCKETS; b++ )
+	{
+		if( st.latency_hist[b]==0 )
+			continue;
+		if( b==EC2_STATS_BUCKETS-1 )
+			printf("  >= %7u us %8u\n", 32u<<(b-1), st.latency_hist[b] );
+		else
+			printf("  <  %7u us %8u\n", 32u<<b, st.latency_hist[b] );
+	}
+	if( reset )
+		ec2_reset_stats( &obj );
+	return true;
+}
+
+bool TargetSiLabs::dump_trace()
+{
+	ec2_trace_dump( &obj, stdout );
+	return true;
+}
+
+bool TargetSiLabs::set_trace( bool on, bool dump_on_error )
+{
+	obj.trace_off = !on;
+	obj.trace_dump_on_error = on && dump_on_error;
+	return true;
+}
+
+
 void TargetSiLabs::reset()
 {
 	cout << "Resetting target."<<endl;
+	invalidate_cache();
 	ec2_target_reset( &obj );
 }
 
 uint16_t TargetSiLabs::step()
 {
 	force_stop = false;
+	invalidate_cache();
 	return ec2_step( &obj );
 }
 
+int TargetSiLabs::step_n( uint16_t *pcs, int n )
+{
+	force_stop = false;
+	invalidate_cache();
+	return ec2_step_n( &obj, pcs, n );
+}
+
 bool TargetSiLabs::add_breakpoint(uint16_t addr)
 {	cout << "adding breakpoint to silabs device" << endl;
-	ec2_addBreakpoint( &obj, addr );
-	return true;
+	return ec2_addBreakpoint( &obj, addr );
 }
 
 bool TargetSiLabs::del_breakpoint(uint16_t addr)
@@ -162,26 +244,32 @@ void TargetSiLabs::clear_all_breakpoints()
 }
 
 
+/** Stop callback for ec2_target_wait_halt(), ends the wait once stop() has
+	cleared running.
+*/
+BOOL TargetSiLabs::run_stopped( void *ctx )
+{
+	return !((TargetSiLabs*)ctx)->running;
+}
+
+
 void TargetSiLabs::run_to_bp(int ignore_cnt)
 {
 	cout << "starting a run now..."<<endl;
 	running = TRUE;
 	force_stop = false;
+	invalidate_cache();
 	int i=0;
 	
 	do
 	{
 		//ec2_target_run_bp( &obj, &running );
 		ec2_target_go(&obj);
-		while( !ec2_target_halt_poll( &obj ) )
+		if( ec2_target_wait_halt( &obj, 0, run_stopped, this )!=EC2_HALTED )
 		{
-			usleep(250);
-			if(!running)
-			{
-				ec2_target_halt(&obj);
-				return;		// someone stopped us early
-			}
-		}		
+			ec2_target_halt(&obj);
+			return;		// someone stopped us early
+		}
 	}
 	while( (i++)!=ignore_cnt );
 }
@@ -193,10 +281,22 @@ void TargetSiLabs::run_to_bp(int ignore_cnt)
 */
 void TargetSiLabs::go()
 {
+	invalidate_cache();
 	ec2_target_go(&obj);
 }
 
 
+Target::SAMPLE_RESULT TargetSiLabs::sample_PC( uint16_t &pc, bool resume )
+{
+	switch( ec2_target_sample_pc( &obj, &pc, resume ) )
+	{
+		case EC2_SAMPLE_OK:		return SAMPLE_OK;
+		case EC2_SAMPLE_HALTED:	return SAMPLE_HALTED;
+		default:				return SAMPLE_FAILED;
+	}
+}
+
+
 /** Call after starting the target running to determnin if the traget has halted
 	at a breakpoint or for some other reason.
 */
@@ -206,6 +306,24 @@ bool TargetSiLabs::poll_for_halt()
 }
 
 
+/** Stop callback for wait_for_halt(), ctx is the caller's stop flag.
+*/
+BOOL TargetSiLabs::wait_stopped( void *ctx )
+{
+	return *(volatile bool*)ctx;
+}
+
+/** Waits with the adaptive back off of ec2_target_wait_halt().
+*/
+bool TargetSiLabs::wait_for_halt( volatile bool &stop )
+{
+	if( ec2_target_wait_halt( &obj, 0, wait_stopped, (void*)&stop )==EC2_HALTED )
+		return true;
+	ec2_target_halt( &obj );
+	return false;
+}
+
+
 bool TargetSiLabs::is_running()
 {
 	return running;
@@ -257,6 +375,30 @@ void TargetSiLabs::read_sfr( uint8_t addr,
 	}
 }
 
+void TargetSiLabs::read_sfr_page( uint8_t page, unsigned char *buf )
+{
+	ec2_read_sfr_page_bulk( &obj, page, buf );
+}
+
+
+/** The pages the device's SFR map lists.
+*/
+vector<uint8_t> TargetSiLabs::sfr_pages()
+{
+	const SFR_MAP *map = getSfrMap( obj.dev );
+	if( obj.dev && obj.dev->has_paged_sfr )
+		return vector<uint8_t>( map->pages, map->pages+map->page_count );
+	return vector<uint8_t>( 1, 0 );
+}
+
+/** Only the on chip XRAM, anything external can't be told apart from
+	unused address space.
+*/
+uint32_t TargetSiLabs::xdata_size()
+{
+	return obj.dev ? obj.dev->internal_xram_size : 0;
+}
+
 
 void TargetSiLabs::read_xdata( uint16_t addr, uint16_t len, unsigned char *buf )
 {
@@ -268,6 +410,16 @@ void TargetSiLabs::read_code( uint16_t addr, int len, unsigned char *buf )
 	ec2_read_flash( &obj, buf, addr, len );
 }
 
+void TargetSiLabs::begin_code_access()
+{
+	ec2_begin_flash_access( &obj );
+}
+
+void TargetSiLabs::end_code_access()
+{
+	ec2_end_flash_access( &obj );
+}
+
 uint16_t TargetSiLabs::read_PC()
 {
 	return ec2_read_pc( &obj );
@@ -279,6 +431,7 @@ uint16_t TargetSiLabs::read_PC()
 void TargetSiLabs::write_data( uint8_t addr, uint8_t len, unsigned char *buf )
 {
 	ec2_write_ram( &obj, (char*)buf, addr, len );
+	cache_update( 'd', addr, len, buf );
 }
 
 
@@ -288,6 +441,7 @@ void TargetSiLabs::write_sfr( uint8_t addr, uint8_t len, unsigned char *buf )
 {
 	for( uint16_t offset=0; offset<len; offset++ )
 		ec2_write_sfr( &obj, buf[offset], addr+offset );
+	invalidate_cpu_context();
 }
 
 void TargetSiLabs::write_sfr( uint8_t addr,
@@ -312,10 +466,12 @@ void TargetSiLabs::write_sfr( uint8_t addr,
 void TargetSiLabs::write_xdata( uint16_t addr, uint16_t len, unsigned char *buf )
 {
 	ec2_write_xdata( &obj, (char*)buf, addr, len );
+	cache_update( 'x', addr, len, buf );
 }
 
 void TargetSiLabs::write_code( uint16_t addr, int len, unsigned char *buf )
 {
+	invalidate_code_cache();
 	cout << "Writing to flash with auto erase as necessary" << endl;
 	printf("\tWriting %d bytes at 0x%04x\n",len,addr);
 	// also erase scratchpad, since we may be using that for storage
@@ -327,7 +483,23 @@ void TargetSiLabs::write_code( uint16_t addr, int len, unsigned char *buf )
 		cout << "ERROR: Flash write Failed." << endl;
 }
 
+void TargetSiLabs::write_image( const IHEX_IMAGE &img )
+{
+	invalidate_code_cache();
+	cout << "Writing to flash, erasing only the sectors used" << endl;
+	for( int i=0; i<img.count; i++ )
+		printf("\tWriting %d bytes at 0x%04x\n", img.seg[i].len, img.seg[i].addr);
+	// also erase scratchpad, since we may be using that for storage
+	cout << "Erasing scratchpad";
+	ec2_erase_flash_scratchpad( &obj );
+	if( ec2_write_flash_image( &obj, &img ) )
+		cout << "Flash write successful." << endl;
+	else
+		cout << "ERROR: Flash write Failed." << endl;
+}
+
 void TargetSiLabs::write_PC( uint16_t addr )
 {
 	ec2_set_pc( &obj, addr );
+	invalidate_cpu_context();
 }
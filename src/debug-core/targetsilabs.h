@@ -45,14 +45,19 @@ public:
 	virtual uint32_t max_breakpoints()		{ return 4; }
 //	virtual bool load_file( string name );
 	virtual bool command( string cmd );	
+	virtual bool print_stats( bool reset );
+	virtual bool dump_trace();
+	virtual bool set_trace( bool on, bool dump_on_error );
 
 	// device control
 	virtual void reset();
 	virtual uint16_t step();
+	virtual int step_n( uint16_t *pcs, int n );
 	virtual bool add_breakpoint(uint16_t addr);
 	virtual bool del_breakpoint(uint16_t addr);
 	virtual void clear_all_breakpoints();
 	virtual void run_to_bp(int ignore_cnt=0);
+	virtual SAMPLE_RESULT sample_PC( uint16_t &pc, bool resume=true );
 	virtual bool is_running();
 	virtual void stop();
 	/** Stop the target running
@@ -63,13 +68,19 @@ public:
 	
 	virtual void go();
 	virtual bool poll_for_halt();
+	virtual bool wait_for_halt( volatile bool &stop );
 
 	// memory reads
 	virtual void read_data( uint8_t addr, uint8_t len, unsigned char *buf );
 	virtual void read_sfr( uint8_t addr, uint8_t len, unsigned char *buf );
 	virtual void read_sfr( uint8_t addr, uint8_t page, uint8_t len, unsigned char *buf );
+	virtual void read_sfr_page( uint8_t page, unsigned char *buf );
+	virtual std::vector<uint8_t> sfr_pages();
+	virtual uint32_t xdata_size();
 	virtual void read_xdata( uint16_t addr, uint16_t len, unsigned char *buf );
 	virtual void read_code( uint16_t addr, int len, unsigned char *buf );
+	virtual void begin_code_access();
+	virtual void end_code_access();
 	virtual uint16_t read_PC();
 	
 	// memory writes
@@ -78,14 +89,19 @@ public:
 	virtual void write_sfr( uint8_t addr, uint8_t page, uint8_t len, unsigned char *buf );
 	virtual void write_xdata( uint16_t addr, uint16_t len, unsigned char *buf );
 	virtual void write_code( uint16_t addr, int len, unsigned char *buf );
+	virtual void write_image( const IHEX_IMAGE &img );
 	virtual void write_PC( uint16_t addr );
 
 protected:
 	string	debugger_port;		// port the device is connected to.
 	EC2DRV	obj;
+	EC2_CONN_PROFILE profile;	///< what the last connect found
 	pthread_t	run_thread;		///< thread that manages a running target.
 	volatile BOOL		running;
 	static void *run_thread_func( void *ptr );
+	static BOOL run_stopped( void *ctx );
+	static BOOL wait_stopped( void *ctx );
+	void use_sfr_map( const SFR_MAP *map );
 	bool is_connected_flag;
 };
 
@@ -0,0 +1,259 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <iostream>
+#include <unistd.h>
+#include <sys/time.h>
+#include "varmonitor.h"
+#include "target.h"
+#include "symtab.h"
+#include "symtypetree.h"
+#include "breakpointmgr.h"
+#include "contextmgr.h"
+#include "expression.h"
+
+using namespace std;
+
+VarMonitor::VarMonitor( DbgSession *session )
+	: mSession(session), m_samples(0), m_halted(false), m_halt_total_us(0),
+	  m_halt_max_us(0), m_halt_min_us(0), m_run_us(0)
+{
+}
+
+
+VarMonitor::~VarMonitor()
+{
+}
+
+static uint64_t now_us()
+{
+	struct timeval tv;
+	gettimeofday( &tv, 0 );
+	return (uint64_t)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+bool VarMonitor::run( const vector<string> &exprs, char format,
+					  uint32_t count, uint32_t interval_us, string log )
+{
+	vector<Expression*> plans;
+	SymTypeTree::FETCH_LIST ranges;
+	ContextMgr::Context c = mSession->contextmgr()->get_current();
+
+	reset_stats();
+	for( size_t i=0; i<exprs.size(); i++ )
+	{
+		Expression *e = mSession->symtab()->get_expression( exprs[i], c );
+		if( !e->valid() )
+			return fail( exprs[i] + ": " + e->error() );
+		plans.push_back( e );
+		ranges.push_back( SymTypeTree::FETCH_RANGE( e->addr(), e->length() ) );
+	}
+
+	bool binary = log.length()>4 && log.compare( log.length()-4, 4, ".bin" )==0;
+	FILE *fp = stdout;
+	if( log.length() && (fp = fopen( log.c_str(), binary ? "wb" : "w" ))==0 )
+		return fail( "Can't write \"" + log + "\"." );
+	write_header( fp, binary, exprs, plans );
+
+	Target *t = mSession->target();
+	Target::SAMPLE_RESULT r = Target::SAMPLE_OK;
+	uint16_t pc;
+	bool last = false;
+	mSession->bpmgr()->sync_target();
+	uint64_t start = now_us();
+	t->go();
+	while( !last )
+	{
+		if( interval_us )
+			usleep( interval_us );
+		last = (count && m_samples+1>=count) || t->check_stop_forced();
+		uint64_t t0 = now_us();
+		r = t->sample_PC( pc, false );
+		if( r==Target::SAMPLE_FAILED )
+		{
+			t->stop();		// don't leave it running unwatched
+			break;
+		}
+		mSession->symtree()->prefetch( ranges );
+		if( r==Target::SAMPLE_OK && !last )
+			t->go();		// formatting is done with the target running
+		uint32_t halt_us = now_us() - t0;
+		add_halt( halt_us );
+		write_sample( fp, binary, format, t0-start, halt_us, plans );
+		mSession->symtree()->end_prefetch();
+		if( r==Target::SAMPLE_HALTED )
+			break;
+	}
+	m_run_us = now_us() - start;
+	m_halted = r==Target::SAMPLE_HALTED;
+	if( fp!=stdout )
+		fclose( fp );
+	else
+		fflush( fp );
+	if( r==Target::SAMPLE_FAILED && m_samples==0 )
+		return fail( "Target doesn't support halting while running." );
+	return true;
+}
+
+VarMonitor::WATCH_RESULT VarMonitor::watch( uint32_t flat_addr, uint32_t len,
+											uint32_t interval_us,
+											vector<uint8_t> &value )
+{
+	Target *t = mSession->target();
+	Target::SAMPLE_RESULT r;
+	vector<uint8_t> cur( len );
+	uint16_t pc;
+
+	reset_stats();
+	if( len==0 || len!=value.size() )
+	{
+		fail( "Nothing to watch." );
+		return WATCH_FAILED;
+	}
+	mSession->bpmgr()->sync_target();
+	uint64_t start = now_us();
+	t->go();
+	while( true )
+	{
+		if( interval_us )
+			usleep( interval_us );
+		bool forced = t->check_stop_forced();
+		uint64_t t0 = now_us();
+		r = t->sample_PC( pc, false );
+		if( r==Target::SAMPLE_FAILED )
+			break;
+		t->read_memory_uncached( flat_addr, len, &cur[0] );
+		bool changed = cur!=value;
+		if( r==Target::SAMPLE_OK && !changed && !forced )
+			t->go();
+		add_halt( now_us() - t0 );
+		if( changed || r==Target::SAMPLE_HALTED || forced )
+		{
+			m_run_us = now_us() - start;
+			m_halted = r==Target::SAMPLE_HALTED;
+			if( !changed )
+				return WATCH_STOPPED;
+			value = cur;
+			return WATCH_CHANGED;
+		}
+	}
+	t->stop();
+	m_run_us = now_us() - start;
+	fail( "Target doesn't support halting while running." );
+	return WATCH_FAILED;
+}
+
+void VarMonitor::reset_stats()
+{
+	m_samples = 0;
+	m_halted = false;
+	m_halt_total_us = 0;
+	m_halt_max_us = 0;
+	m_halt_min_us = 0;
+	m_run_us = 0;
+}
+
+/// account for one sample that halted the target for halt_us
+void VarMonitor::add_halt( uint32_t halt_us )
+{
+	m_halt_total_us += halt_us;
+	if( halt_us>m_halt_max_us )
+		m_halt_max_us = halt_us;
+	if( m_samples==0 || halt_us<m_halt_min_us )
+		m_halt_min_us = halt_us;
+	m_samples++;
+}
+
+void VarMonitor::write_header( FILE *fp, bool binary,
+							   const vector<string> &exprs,
+							   const vector<Expression*> &plans )
+{
+	if( !binary )
+	{
+		fprintf( fp, "time_s,halt_us" );
+		for( size_t i=0; i<exprs.size(); i++ )
+			fprintf( fp, ",%s", exprs[i].c_str() );
+		fprintf( fp, "\n" );
+		return;
+	}
+	uint16_t n = exprs.size();
+	fwrite( "EC2MON1\n", 1, 8, fp );
+	fwrite( &n, sizeof(n), 1, fp );
+	for( size_t i=0; i<exprs.size(); i++ )
+	{
+		uint16_t len = exprs[i].length();
+		uint32_t vlen = plans[i]->length();
+		fwrite( &len, sizeof(len), 1, fp );
+		fwrite( exprs[i].data(), 1, len, fp );
+		fwrite( &vlen, sizeof(vlen), 1, fp );
+	}
+}
+
+/** Write one sample, values are taken from the prefetched copy.
+*/
+void VarMonitor::write_sample( FILE *fp, bool binary, char format,
+							   uint64_t t_us, uint32_t halt_us,
+							   const vector<Expression*> &plans )
+{
+	if( !binary )
+	{
+		fprintf( fp, "%u.%06u,%u", (unsigned)(t_us/1000000),
+				 (unsigned)(t_us%1000000), halt_us );
+		for( size_t i=0; i<plans.size(); i++ )
+		{
+			string v = plans[i]->value( format );
+			// quote anything with a comma in it, eg structs
+			if( v.find_first_of( ",\"" )!=string::npos )
+			{
+				string q = "\"";
+				for( size_t j=0; j<v.length(); j++ )
+					q += v[j]=='"' ? string("\"\"") : string( 1, v[j] );
+				v = q + "\"";
+			}
+			fprintf( fp, ",%s", v.c_str() );
+		}
+		fprintf( fp, "\n" );
+		return;
+	}
+	fwrite( &t_us, sizeof(t_us), 1, fp );
+	fwrite( &halt_us, sizeof(halt_us), 1, fp );
+	for( size_t i=0; i<plans.size(); i++ )
+	{
+		vector<uint8_t> buf( plans[i]->length() );
+		if( buf.size() )
+		{
+			mSession->symtree()->read_memory( plans[i]->addr(), buf.size(), &buf[0] );
+			fwrite( &buf[0], 1, buf.size(), fp );
+		}
+	}
+}
+
+void VarMonitor::print_stats()
+{
+	if( m_samples==0 )
+	{
+		cout << "No samples." << endl;
+		return;
+	}
+	printf( "%u samples in %.3f s, target halted %u us per sample "
+			"(min %u, max %u), %.2f%% of the time.\n",
+			m_samples, m_run_us/1e6, (unsigned)(m_halt_total_us/m_samples),
+			m_halt_min_us, m_halt_max_us,
+			m_run_us ? 100.0*m_halt_total_us/m_run_us : 0.0 );
+}
@@ -0,0 +1,120 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef VARMONITOR_H
+#define VARMONITOR_H
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "dbgsession.h"
+
+class Expression;
+
+/**	Live variable monitor.
+	Runs the target and at each interval halts it with Target::sample_PC(),
+	fetches the ranges of all the expressions in one SymTypeTree::prefetch()
+	and sets it running again before anything is formatted, so the target is
+	only halted for the halt handshake and the coalesced reads.
+
+	Samples are logged with the time since the start of the run and how long
+	the target was halted for that sample, either as CSV:
+		time_s,halt_us,expr1,expr2...
+	or, for log files named *.bin, as binary records in host byte order:
+		header: "EC2MON1\n", uint16 count, then per expression
+				uint16 name length, name, uint32 value length
+		sample: uint64 time_us, uint32 halt_us, the raw bytes of each value
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class VarMonitor
+{
+public:
+	VarMonitor( DbgSession *session );
+	~VarMonitor();
+
+	/** Run the target from the current PC sampling exprs every interval_us.
+		Runs until count samples have been taken, the target stops by itself
+		or the user stops it, the target is left halted.
+		\param exprs		expressions to sample, as for print
+		\param format		print format for CSV values, 0 for the default
+		\param count		number of samples, 0 for no limit
+		\param interval_us	delay between samples
+		\param log			file to log to, CSV to stdout if empty
+		\returns false if nothing could be sampled, error() says why.
+	*/
+	bool run( const std::vector<std::string> &exprs, char format,
+			  uint32_t count, uint32_t interval_us, std::string log );
+
+	typedef enum
+	{
+		WATCH_CHANGED,		///< the watched bytes changed
+		WATCH_STOPPED,		///< target stopped by itself or by the user
+		WATCH_FAILED		///< target can't be sampled, see error()
+	} WATCH_RESULT;
+
+	/** Emulate a data watchpoint by sampling.
+		Runs the target and halts it every interval_us, as run() does, but
+		only reads the len bytes at flat_addr, uncached as one minimal read,
+		and sets the target running again unless they differ from value.
+		A write is caught some time after it happens, the target is left
+		halted wherever the sample stopped it.
+		\param flat_addr	first byte watched
+		\param len			number of bytes watched
+		\param interval_us	delay between samples, 0 to sample back to back
+		\param[in,out] value	bytes expected, the new bytes when they change
+	*/
+	WATCH_RESULT watch( uint32_t flat_addr, uint32_t len, uint32_t interval_us,
+						std::vector<uint8_t> &value );
+
+	std::string error()			{ return m_error; }
+	uint32_t samples()			{ return m_samples; }
+
+	/** \returns true if the last run ended with the target stopping by
+		itself, eg on a breakpoint.
+	*/
+	bool halted()				{ return m_halted; }
+
+	/** Print how intrusive the last run was, the time the target spent
+		halted per sample and as a share of the run.
+	*/
+	void print_stats();
+
+protected:
+	DbgSession		*mSession;
+	std::string		m_error;
+	uint32_t		m_samples;
+	bool			m_halted;
+	uint64_t		m_halt_total_us;
+	uint32_t		m_halt_max_us;
+	uint32_t		m_halt_min_us;
+	uint64_t		m_run_us;		///< wall time of the last run
+
+	bool fail( std::string msg )	{ m_error = msg; return false; }
+	void reset_stats();
+	void add_halt( uint32_t halt_us );
+	void write_header( FILE *fp, bool binary,
+					   const std::vector<std::string> &exprs,
+					   const std::vector<Expression*> &plans );
+	void write_sample( FILE *fp, bool binary, char format, uint64_t t_us,
+					   uint32_t halt_us, const std::vector<Expression*> &plans );
+};
+
+#endif
@@ -0,0 +1,540 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** cdbbench
+	Times the host side of debug-core against a synthetic SDCC cdb file so
+	the cost of symbol loading and lookups can be compared as the size of a
+	program grows.  The target is TargetDummy, so no hardware is involved.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "dbgsession.h"
+#include "cdbfile.h"
+#include "symtab.h"
+#include "symtypetree.h"
+#include "module.h"
+#include "contextmgr.h"
+#include "expression.h"
+#include "memremap.h"
+#include "target.h"
+
+using namespace std;
+
+void help()
+{
+	cout <<"cdbbench\n"
+		<<"options:\n"
+		<<"\t--modules	Number of modules, default 20\n"
+		<<"\t--functions	Functions per module, default 20\n"
+		<<"\t--lines		C line records per function, default 10\n"
+		<<"\t--globals	Global variables per module, default 50\n"
+		<<"\t--structs	Struct types per module, default 5\n"
+		<<"\t--count		Calls per lookup test, default 10000\n"
+		<<"\t--loads		Times the file is loaded, default 3\n"
+		<<"\t--file		Where to write the generated cdb file, default cdbbench.cdb\n"
+		<<"\t--cache		Allow CdbFile to use its symbol cache when loading\n"
+		<<"\t--sessions	Also load the file into this many sessions at once, each\n"
+		<<"\t		on its own thread, with and without sharing symbols\n"
+		<<"\t--csv		Machine readable output, one line per test\n"
+		<< endl;
+}
+
+
+// Program shape.  Each C line is given 3 bytes of code, functions follow
+// each other from address 0 and globals are packed into XDATA.
+static int	modules = 20;
+static int	functions = 20;
+static int	lines = 10;
+static int	globals = 50;
+static int	structs = 5;
+static int	count = 10000;
+static int	loads = 3;
+static int	sessions = 0;
+static const int LINE_BYTES = 3;
+static const int STRUCT_BYTES = 11;	// int a; char b; char s[8];
+
+static ADDR		code_end;
+static ADDR		xdata_end;
+static vector<string>	global_names;
+static vector<string>	struct_globals;
+
+
+static uint64_t now_usec()
+{
+	struct timeval tv;
+	gettimeofday( &tv, 0 );
+	return (uint64_t)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+/** Deterministic pseudo random numbers, so runs are repeatable.
+*/
+static uint32_t rnd()
+{
+	static uint32_t seed = 12345;
+	seed = seed*1103515245 + 12345;
+	return seed>>8;
+}
+
+
+static string fn_name( int m, int f )
+{
+	char s[32];
+	snprintf( s, sizeof(s), "f_%d_%d", m, f );
+	return s;
+}
+
+/** Write the synthetic cdb file.
+	Every module has its struct types, then its globals cycling through
+	int, char array and struct, then its functions each with a C line
+	record per line.
+	\returns false if the program doesn't fit in 64K of code and xdata.
+*/
+static bool generate( string filename )
+{
+	ofstream out( filename.c_str() );
+	if( !out )
+	{
+		printf("Error: can't write %s\n", filename.c_str() );
+		return false;
+	}
+	char s[256];
+	ADDR code = 0, xdata = 0;
+	global_names.clear();
+	struct_globals.clear();
+	for( int m=0; m<modules; m++ )
+	{
+		snprintf( s, sizeof(s), "m%d", m );
+		string mod = s;
+		out << "M:" << mod << "\n";
+		for( int t=0; t<structs; t++ )
+		{
+			snprintf( s, sizeof(s), "T:F%s$tag_%d_%d[({0}S:S$a$0$0({2}SI:U),Z,0,0)"
+					  "({2}S:S$b$0$0({1}SC:U),Z,0,0)"
+					  "({3}S:S$s$0$0({8}DA8d,SC:U),Z,0,0)]", mod.c_str(), m, t );
+			out << s << "\n";
+		}
+		for( int g=0; g<globals; g++ )
+		{
+			char name[32];
+			snprintf( name, sizeof(name), "g_%d_%d", m, g );
+			int size;
+			if( structs>0 && g%3==2 )
+			{
+				size = STRUCT_BYTES;
+				snprintf( s, sizeof(s), "S:G$%s$0$0({%d}STtag_%d_%d:S),F,0,0",
+						  name, size, m, g%structs );
+				struct_globals.push_back( name );
+			}
+			else if( g%3==1 )
+			{
+				size = 4;
+				snprintf( s, sizeof(s), "S:G$%s$0$0({4}DA4d,SC:U),F,0,0", name );
+			}
+			else
+			{
+				size = 2;
+				snprintf( s, sizeof(s), "S:G$%s$0$0({2}SI:U),F,0,0", name );
+			}
+			out << s << "\n";
+			out << "L:G$" << name << "$0$0:" << hex << xdata << dec << "\n";
+			global_names.push_back( name );
+			xdata += size;
+		}
+		for( int f=0; f<functions; f++ )
+		{
+			string name = fn_name( m, f );
+			out << "S:G$" << name << "$0$0({2}DF,SV:S),C,0,0\n";
+			out << "F:G$" << name << "$0$0({2}DF,SV:S),C,0,0,0,0,0\n";
+			out << "L:G$" << name << "$0$0:" << hex << code << dec << "\n";
+			for( int l=0; l<lines; l++ )
+			{
+				out << "L:C$" << mod << ".c$" << f*lines+l+1 << "$0$0:"
+					<< hex << code + l*LINE_BYTES << dec << "\n";
+			}
+			code += lines*LINE_BYTES;
+			out << "L:XG$" << name << "$0$0:" << hex << code-1 << dec << "\n";
+		}
+	}
+	code_end = code;
+	xdata_end = xdata;
+	if( code>0x10000 || xdata>0x10000 )
+	{
+		printf("Error: program needs 0x%x bytes of code and 0x%x of xdata, "
+			   "reduce the scale\n", code, xdata );
+		return false;
+	}
+	return true;
+}
+
+
+/** Timing of one test.
+*/
+typedef struct
+{
+	string		name;
+	int			calls;
+	int			hits;		///< calls that found what they looked for
+	uint64_t	total_usec;
+} RESULT;
+
+static void print_result( const RESULT &r, bool csv )
+{
+	double avg = r.calls ? (double)r.total_usec / r.calls : 0;
+	if( csv )
+		printf( "%d,%d,%d,%d,%d,%s,%d,%d,%llu,%.3f\n",
+				modules, functions, lines, globals, structs,
+				r.name.c_str(), r.calls, r.hits,
+				(unsigned long long)r.total_usec, avg );
+	else
+		printf( "%-24s %8d %8d %12.3f %12.3f\n", r.name.c_str(), r.calls,
+				r.hits, r.total_usec/1000.0, avg );
+}
+
+
+static void reset_session( DbgSession &session )
+{
+	session.modulemgr()->reset();
+	session.symtab()->clear();
+	session.symtree()->clear();
+}
+
+/** Load the file, the progress messages the loader writes to cout are
+	discarded so the terminal doesn't dominate the time.
+*/
+static void bench_open( DbgSession &session, string filename, RESULT &r )
+{
+	r.name = "CdbFile::open";
+	r.calls = r.hits = 0;
+	r.total_usec = 0;
+	for( int i=0; i<loads; i++ )
+	{
+		reset_session( session );
+		CdbFile cdbfile( &session );
+		streambuf *old = cout.rdbuf( 0 );
+		uint64_t t = now_usec();
+		bool ok = cdbfile.open( filename );
+		r.total_usec += now_usec() - t;
+		cout.rdbuf( old );
+		cout.clear();
+		r.calls++;
+		r.hits += ok;
+	}
+}
+
+static void bench_get_symbol( DbgSession &session, RESULT &r )
+{
+	ContextMgr::Context context = session.contextmgr()->get_current();
+	vector<string> names;
+	for( int i=0; i<count; i++ )
+	{
+		if( i&1 )
+			names.push_back( fn_name( rnd()%modules, rnd()%functions ) );
+		else
+			names.push_back( global_names[rnd()%global_names.size()] );
+	}
+	r.name = "SymTab::getSymbol";
+	r.calls = r.hits = 0;
+	uint64_t t = now_usec();
+	for( int i=0; i<count; i++ )
+	{
+		SymTab::SYMLIST::iterator it;
+		r.hits += session.symtab()->getSymbol( names[i], context, it );
+		r.calls++;
+	}
+	r.total_usec = now_usec() - t;
+}
+
+static void bench_closest( DbgSession &session, RESULT &r )
+{
+	vector<FLAT_ADDR> addrs;
+	for( int i=0; i<count; i++ )
+	{
+		if( i&1 )
+			addrs.push_back( MemRemap::flat( rnd()%xdata_end, 'x' ) );
+		else
+			addrs.push_back( MemRemap::flat( rnd()%code_end, 'c' ) );
+	}
+	r.name = "get_symbol_name_closest";
+	r.calls = r.hits = 0;
+	uint64_t t = now_usec();
+	for( int i=0; i<count; i++ )
+	{
+		r.hits += !session.symtab()->get_symbol_name_closest( addrs[i] ).empty();
+		r.calls++;
+	}
+	r.total_usec = now_usec() - t;
+}
+
+static void bench_file_line( DbgSession &session, RESULT &r )
+{
+	vector<ADDR> addrs;
+	for( int i=0; i<count; i++ )
+		addrs.push_back( (rnd()%(code_end/LINE_BYTES))*LINE_BYTES );
+	r.name = "find_c_file_line";
+	r.calls = r.hits = 0;
+	uint64_t t = now_usec();
+	for( int i=0; i<count; i++ )
+	{
+		string file;
+		LINE_NUM line;
+		r.hits += session.symtab()->find_c_file_line( addrs[i], file, line );
+		r.calls++;
+	}
+	r.total_usec = now_usec() - t;
+}
+
+static void bench_c_addr( DbgSession &session, RESULT &r )
+{
+	vector<ADDR> addrs;
+	for( int i=0; i<count; i++ )
+		addrs.push_back( (rnd()%(code_end/LINE_BYTES))*LINE_BYTES );
+	r.name = "ModuleMgr::get_c_addr";
+	r.calls = r.hits = 0;
+	uint64_t t = now_usec();
+	for( int i=0; i<count; i++ )
+	{
+		string module;
+		LINE_NUM line;
+		r.hits += session.modulemgr()->get_c_addr( addrs[i], module, line );
+		r.calls++;
+	}
+	r.total_usec = now_usec() - t;
+}
+
+/** Compile a print expression for a struct member from scratch each time.
+*/
+static void bench_compile( DbgSession &session, RESULT &r )
+{
+	ContextMgr::Context context = session.contextmgr()->get_current();
+	vector<string> exprs;
+	const vector<string> &names = struct_globals.empty() ? global_names
+														  : struct_globals;
+	for( int i=0; i<count; i++ )
+		exprs.push_back( names[rnd()%names.size()]
+						 + (struct_globals.empty() ? "" : ".s[3]") );
+	r.name = "Expression::compile";
+	r.calls = r.hits = 0;
+	uint64_t t = now_usec();
+	for( int i=0; i<count; i++ )
+	{
+		Expression expr( &session );
+		r.hits += expr.compile( exprs[i], context );
+		r.calls++;
+	}
+	r.total_usec = now_usec() - t;
+}
+
+/** Print whole symbols the way the print command does, through the cached
+	plans, formatting the value but not writing it out.
+*/
+static void bench_print( DbgSession &session, RESULT &r )
+{
+	ContextMgr::Context context = session.contextmgr()->get_current();
+	vector<string> names;
+	for( int i=0; i<count; i++ )
+		names.push_back( global_names[rnd()%global_names.size()] );
+	r.name = "print symbol";
+	r.calls = r.hits = 0;
+	uint64_t t = now_usec();
+	for( int i=0; i<count; i++ )
+	{
+		Expression *expr = session.symtab()->get_expression( names[i], context );
+		if( expr->valid() )
+		{
+			r.hits += !expr->value( 0 ).empty();
+		}
+		r.calls++;
+	}
+	r.total_usec = now_usec() - t;
+}
+
+
+typedef struct
+{
+	DbgSession	*session;
+	string		filename;
+	bool		ok;
+} SESSION_JOB;
+
+/** What each session thread does, load the file then look up lines.
+*/
+static void *session_thread( void *arg )
+{
+	SESSION_JOB *job = (SESSION_JOB*)arg;
+	CdbFile cdbfile( job->session );
+	job->ok = cdbfile.open( job->filename );
+	for( int i=0; i<count && job->ok; i++ )
+	{
+		string file;
+		LINE_NUM line;
+		job->session->symtab()->find_c_file_line( (i*LINE_BYTES)%code_end,
+												   file, line );
+	}
+	return 0;
+}
+
+/** Load the file into --sessions sessions concurrently, timing from the
+	threads starting until the last one is done.  Session construction is
+	outside the timing.
+*/
+static void bench_sessions( string filename, bool share, RESULT &r )
+{
+	vector<DbgSession*> s( sessions );
+	vector<SESSION_JOB> jobs( sessions );
+	vector<pthread_t> tid( sessions );
+	vector<bool> started( sessions );
+	int i;
+
+	r.name = share ? "sessions, shared" : "sessions, unshared";
+	r.calls = sessions;
+	r.hits = 0;
+	streambuf *old = cout.rdbuf( 0 );
+	for( i=0; i<sessions; i++ )
+	{
+		s[i] = new DbgSession();
+		jobs[i].session = s[i];
+		jobs[i].filename = filename;
+		jobs[i].ok = false;
+	}
+	CdbFile::set_share_symbols( share );
+	uint64_t t = now_usec();
+	for( i=0; i<sessions; i++ )
+		started[i] = pthread_create( &tid[i], 0, session_thread, &jobs[i] )==0;
+	for( i=0; i<sessions; i++ )
+	{
+		if( started[i] )
+			pthread_join( tid[i], 0 );
+		else
+			session_thread( &jobs[i] );
+		r.hits += jobs[i].ok;
+	}
+	r.total_usec = now_usec() - t;
+	CdbFile::set_share_symbols( false );
+	for( i=0; i<sessions; i++ )
+		delete s[i];
+	cout.rdbuf( old );
+	cout.clear();
+}
+
+int main(int argc, char *argv[])
+{
+	string filename = "cdbbench.cdb";
+	static int csv=0, cache=0, help_flag;
+	static struct option long_options[] =
+	{
+		{"csv", no_argument, &csv, 1},
+		{"cache", no_argument, &cache, 1},
+		{"help", no_argument, &help_flag, 'h'},
+		{"modules", required_argument, 0, 'm'},
+		{"functions", required_argument, 0, 'f'},
+		{"lines", required_argument, 0, 'l'},
+		{"globals", required_argument, 0, 'g'},
+		{"structs", required_argument, 0, 's'},
+		{"count", required_argument, 0, 'c'},
+		{"loads", required_argument, 0, 'n'},
+		{"file", required_argument, 0, 'o'},
+		{"sessions", required_argument, 0, 'S'},
+		{0, 0, 0, 0}
+	};
+	int option_index = 0;
+	int c;
+	while(1)
+	{
+		c = getopt_long (argc, argv, "", long_options, &option_index);
+		if( c==-1)
+			break;
+		switch(c)
+		{
+			case 0:		// set a flag, nothing to do
+				break;
+			case 'm':	modules = strtoul( optarg, 0, 0 );		break;
+			case 'f':	functions = strtoul( optarg, 0, 0 );	break;
+			case 'l':	lines = strtoul( optarg, 0, 0 );		break;
+			case 'g':	globals = strtoul( optarg, 0, 0 );		break;
+			case 's':	structs = strtoul( optarg, 0, 0 );		break;
+			case 'c':	count = strtoul( optarg, 0, 0 );		break;
+			case 'n':	loads = strtoul( optarg, 0, 0 );		break;
+			case 'o':	filename = optarg;						break;
+			case 'S':	sessions = strtoul( optarg, 0, 0 );		break;
+			default:
+				printf("unexpected option\n");
+				break;
+		}
+	};
+	if( help_flag )
+	{
+		help();
+		return EXIT_SUCCESS;
+	}
+	if( modules<1 || functions<1 || lines<1 || globals<1 )
+	{
+		printf("Error: --modules, --functions, --lines and --globals must be "
+			   "at least 1\n");
+		return EXIT_FAILURE;
+	}
+	if( !generate( filename ) )
+		return EXIT_FAILURE;
+
+	DbgSession session;
+	session.target()->connect();
+	CdbFile::set_use_cache( cache );
+
+	RESULT r;
+	if( csv )
+		printf("modules,functions,lines,globals,structs,test,calls,hits,"
+			   "total_us,avg_us\n");
+	else
+	{
+		printf("\n%d modules, %d functions, %d lines each, %d globals, "
+			   "%d structs, target %s\n\n", modules, modules*functions,
+			   lines, modules*globals, modules*structs,
+			   session.target()->device().c_str() );
+		printf("%-24s %8s %8s %12s %12s\n",
+			   "test", "calls", "hits", "total ms", "avg us");
+	}
+	bench_open( session, filename, r );			print_result( r, csv );
+	bench_get_symbol( session, r );				print_result( r, csv );
+	bench_closest( session, r );				print_result( r, csv );
+	bench_file_line( session, r );				print_result( r, csv );
+	bench_c_addr( session, r );					print_result( r, csv );
+	bench_compile( session, r );				print_result( r, csv );
+	bench_print( session, r );					print_result( r, csv );
+	if( sessions>0 )
+	{
+		bench_sessions( filename, false, r );	print_result( r, csv );
+		bench_sessions( filename, true, r );	print_result( r, csv );
+	}
+	session.target()->disconnect();
+	return EXIT_SUCCESS;
+}
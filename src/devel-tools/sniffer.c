@@ -2,19 +2,38 @@
 	Initial version by  (C) Henri Geist 2006
 	Modifications to output format (C) Ricky White 2006
 
+	Passes everything between the two ports, including the handshake lines,
+	and captures it to a session log in the format described in ec2drv.h, so
+	it can be replayed with "REPLAY:<file>" as the port or listed with -d.
+	Each port is read on its own thread into a lock free ring and the main
+	thread merges the two in time order and writes the log, so the capture
+	doesn't hold up the link.
+
 	GPL V2 or later, see copying for details.
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
+#include "ec2drv.h"
+
+#define USAGE	"Usage : Master Slave speed format log\nwith speedin Kbps and format like [5-8][NOE][1-2]\n" \
+				"        -d log [-t]  list a log, -t adds the time of each command\n"
 
-#define USAGE	"Usage : Master Slave speed format\nwith speedin Kbps and format like [5-8][NOE][1-2]\0n"
+#define CHUNK_MAX	56		///< most bytes taken by one read
+#define RING_SIZE	8192	///< chunks per direction, a power of 2
+#define POLL_MS		5		///< longest time between checks of the handshake lines
 
 struct termios tty;
 
@@ -93,158 +112,420 @@ void port_init(int portfd, char *speed, char NB_bits, char
 	tcsetattr(portfd, TCSANOW, &tty);
 }
 
-/*
- * Main fonction.
- */
-int main( int argc, char **argv )
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Capture
+////////////////////////////////////////////////////////////////////////////////
+
+/** One read from a port, or a change of its handshake lines.
+*/
+typedef struct
+{
+	uint64_t	ns;
+	uint8_t		kind;		///< EC2_REC_TX, EC2_REC_RX or EC2_REC_LINES
+	uint8_t		len;
+	uint8_t		data[CHUNK_MAX];
+} CHUNK;
+
+/** Single producer, single consumer ring.  Only the port's thread moves
+	head and only the main thread moves tail, the barriers make sure a chunk
+	is complete before the index that hands it over.
+*/
+typedef struct
+{
+	CHUNK				chunk[RING_SIZE];
+	volatile uint32_t	head;
+	volatile uint32_t	tail;
+	volatile uint64_t	watermark;	///< no later chunk is earlier than this
+	volatile uint32_t	dropped;	///< chunks lost to a full ring
+} RING;
+
+typedef struct
+{
+	int			fd;			///< port read
+	int			peer;		///< port it is passed on to
+	uint8_t		kind;		///< EC2_REC_TX from the master, EC2_REC_RX from the slave
+	uint32_t	bytes;
+	pthread_t	thread;
+	RING		ring;
+} SIDE;
+
+static volatile bool stop = false;
+
+static void on_signal( int sig )
+{
+	stop = true;
+}
+
+static uint64_t now_ns()
 {
-	char c;
-	int portfdMaster;
-	int portfdSlave;
-	int MasterHandShake = 0;
-	int SlaveHandShake = 0;
-	int i = 0;
-	int j = 0;
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
 
-	bool master = true;
+static void ring_put( RING *r, uint8_t kind, uint64_t ns, const uint8_t *buf,
+					  int len )
+{
+	CHUNK *c;
+	if( r->head - r->tail >= RING_SIZE )
+	{
+		r->dropped++;
+		return;
+	}
+	c = &r->chunk[r->head & (RING_SIZE-1)];
+	c->ns = ns;
+	c->kind = kind;
+	c->len = len;
+	memcpy( c->data, buf, len );
+	__sync_synchronize();
+	r->head++;
+}
+
+static CHUNK *ring_peek( RING *r )
+{
+	if( r->head==r->tail )
+		return 0;
+	__sync_synchronize();
+	return &r->chunk[r->tail & (RING_SIZE-1)];
+}
+
+static void ring_pop( RING *r )
+{
+	__sync_synchronize();
+	r->tail++;
+}
+
+/** Pass the handshake lines on as the old console sniffer did, DSR to DTR
+	and CD to RTS, and log what the peer now sees.
+*/
+static void pass_lines( SIDE *s, int lines, int old )
+{
+	int bit;
+	uint8_t rec[2];
+
+	bit = TIOCM_DTR;
+	if( (lines ^ old) & TIOCM_DSR )
+		ioctl( s->peer, (lines & TIOCM_DSR) ? TIOCMBIS : TIOCMBIC, &bit );
+	bit = TIOCM_RTS;
+	if( (lines ^ old) & TIOCM_CD )
+		ioctl( s->peer, (lines & TIOCM_CD) ? TIOCMBIS : TIOCMBIC, &bit );
+	rec[0] = s->kind;
+	rec[1] = ((lines & TIOCM_DSR) ? EC2_LINE_DTR : 0) |
+			 ((lines & TIOCM_CD) ? EC2_LINE_RTS : 0);
+	ring_put( &s->ring, EC2_REC_LINES, now_ns(), rec, 2 );
+}
+
+/** Reads one port, passes the bytes straight on and queues them for the
+	log.  The watermark is set before each wait so the merge knows this side
+	has nothing earlier to come.
+*/
+static void *side_thread( void *arg )
+{
+	SIDE *s = (SIDE*)arg;
+	struct pollfd pfd;
+	uint8_t buf[CHUNK_MAX];
+	int lines, old = 0, n;
+	uint64_t ns;
+
+	pfd.fd = s->fd;
+	pfd.events = POLLIN;
+	while( !stop )
+	{
+		s->ring.watermark = now_ns();
+		__sync_synchronize();
+		if( ioctl( s->fd, TIOCMGET, &lines )<0 )
+			lines = old;		// eg a pty, it has no handshake lines
+		lines &= TIOCM_DSR | TIOCM_CD;
+		if( lines!=old )
+		{
+			pass_lines( s, lines, old );
+			old = lines;
+		}
+		if( poll( &pfd, 1, POLL_MS )<=0 )
+			continue;
+		n = read( s->fd, buf, sizeof(buf) );
+		if( n<=0 )
+			continue;
+		ns = now_ns();
+		write( s->peer, buf, n );
+		ring_put( &s->ring, s->kind, ns, buf, n );
+		s->bytes += n;
+	}
+	return 0;
+}
+
+/** Log being written, chunks from one side in a row are joined into one
+	record so a reply reads back as it was sent.
+*/
+typedef struct
+{
+	FILE		*f;
+	uint64_t	last_ns;
+	uint8_t		kind;		///< of the record being built, 0 for none
+	uint64_t	ns;
+	uint32_t	len;
+	uint8_t		data[0xffff];
+	uint32_t	records;
+} LOG;
+
+static void put_le( uint8_t *p, uint64_t v, int n )
+{
+	int i;
+	for( i=0; i<n; i++ )
+		p[i] = v >> (8*i);
+}
+
+static uint64_t get_le( const uint8_t *p, int n )
+{
+	uint64_t v = 0;
+	int i;
+	for( i=n-1; i>=0; i-- )
+		v = (v<<8) | p[i];
+	return v;
+}
+
+static void log_record( LOG *log )
+{
+	uint8_t hdr[EC2_REC_ENTRY_LEN+8];
+	if( !log->kind )
+		return;
+	if( log->ns - log->last_ns > 0xffffffff )
+	{
+		hdr[0] = EC2_REC_SYNC;
+		put_le( hdr+1, 0, 4 );
+		put_le( hdr+5, 8, 2 );
+		put_le( hdr+7, log->ns, 8 );
+		fwrite( hdr, EC2_REC_ENTRY_LEN+8, 1, log->f );
+		log->last_ns = log->ns;
+	}
+	hdr[0] = log->kind;
+	put_le( hdr+1, log->ns - log->last_ns, 4 );
+	put_le( hdr+5, log->len, 2 );
+	fwrite( hdr, EC2_REC_ENTRY_LEN, 1, log->f );
+	fwrite( log->data, log->len, 1, log->f );
+	log->last_ns = log->ns;
+	log->kind = 0;
+	log->records++;
+}
+
+static void log_add( LOG *log, const CHUNK *c )
+{
+	if( c->kind!=log->kind || c->kind==EC2_REC_LINES ||
+		log->len+c->len > sizeof(log->data) )
+	{
+		log_record( log );
+		log->kind = c->kind;
+		log->ns = c->ns;
+		log->len = 0;
+	}
+	memcpy( log->data+log->len, c->data, c->len );
+	log->len += c->len;
+}
+
+/** \returns the side with the earliest chunk, or 0 if there is none or the
+	other side might still produce an earlier one.
+	\param drain	true once both threads have finished
+*/
+static SIDE *next_side( SIDE *a, SIDE *b, bool drain )
+{
+	uint64_t wa = a->ring.watermark, wb = b->ring.watermark;
+	CHUNK *ca = ring_peek( &a->ring );
+	CHUNK *cb = ring_peek( &b->ring );
+	if( ca && cb )
+		return ca->ns<=cb->ns ? a : b;
+	if( ca && (drain || ca->ns<=wb) )
+		return a;
+	if( cb && (drain || cb->ns<=wa) )
+		return b;
+	return 0;
+}
+
+static int capture( char **argv )
+{
+	static SIDE master, slave;
+	static LOG log;
+	uint8_t hdr[EC2_REC_HEADER_LEN];
+	struct timespec idle = { 0, 1000000 };
+	SIDE *s;
+	bool drain = false;
 
 	/*Openning the serial port in read/write with nodelay mode*/
-	portfdMaster = open(argv[1], O_RDWR | O_NONBLOCK | O_NOCTTY);
-	portfdSlave = open(argv[2], O_RDWR | O_NONBLOCK | O_NOCTTY);
+	master.fd = open(argv[1], O_RDWR | O_NONBLOCK | O_NOCTTY);
+	slave.fd = open(argv[2], O_RDWR | O_NONBLOCK | O_NOCTTY);
+	if( master.fd<0 || slave.fd<0 )
+	{
+		printf("Unable to open %s\n", master.fd<0 ? argv[1] : argv[2] );
+		return 1;
+	}
+	log.f = fopen( argv[5], "wb" );
+	if( !log.f )
+	{
+		printf("Unable to create %s\n", argv[5] );
+		return 1;
+	}
+	setvbuf( log.f, 0, _IOFBF, 1<<20 );
 
 	/*Serial port initialisation with the right proprieties*/
-	port_init(portfdMaster, argv[3], argv[4][0], argv[4][1],
-			  argv[4][2]);
-
-	port_init(portfdSlave, argv[3], argv[4][0], argv[4][1],
-			  argv[4][2]);
+	port_init(master.fd, argv[3], argv[4][0], argv[4][1], argv[4][2]);
+	port_init(slave.fd, argv[3], argv[4][0], argv[4][1], argv[4][2]);
 	/*Flushing old IO*/
-	tcflush(portfdMaster, TCIOFLUSH);
-	tcflush(portfdSlave, TCIOFLUSH);
+	tcflush(master.fd, TCIOFLUSH);
+	tcflush(slave.fd, TCIOFLUSH);
+
+	// a serial EC2, there are no USB ids
+	memcpy( hdr, "EC2R", 4 );
+	hdr[4] = EC2_REC_VERSION;
+	hdr[5] = 0;
+	put_le( hdr+6, 0xffff, 2 );
+	put_le( hdr+8, 0xffff, 2 );
+	fwrite( hdr, EC2_REC_HEADER_LEN, 1, log.f );
+	log.last_ns = now_ns() - 0x100000000ULL;	// the first record gets a sync
+
+	master.peer = slave.fd;
+	master.kind = EC2_REC_TX;
+	slave.peer = master.fd;
+	slave.kind = EC2_REC_RX;
+	master.ring.watermark = slave.ring.watermark = 0;
+	signal( SIGINT, on_signal );
+	signal( SIGTERM, on_signal );
+	pthread_create( &master.thread, 0, side_thread, &master );
+	pthread_create( &slave.thread, 0, side_thread, &slave );
+	printf("Capturing to %s, ^C to stop\n", argv[5] );
+
+	while( true )
+	{
+		if( (s = next_side( &master, &slave, drain )) )
+		{
+			log_add( &log, ring_peek( &s->ring ) );
+			ring_pop( &s->ring );
+		}
+		else if( drain )
+			break;
+		else if( stop )
+		{
+			pthread_join( master.thread, 0 );
+			pthread_join( slave.thread, 0 );
+			drain = true;
+		}
+		else
+			nanosleep( &idle, 0 );
+	}
+	log_record( &log );
+	fclose( log.f );
+	close(master.fd);
+	close(slave.fd);
+	printf("\n%u records, %u bytes sent, %u received\n",
+		   log.records, master.bytes, slave.bytes );
+	if( master.ring.dropped || slave.ring.dropped )
+		printf("WARNING: %u chunks lost, the log couldn't keep up\n",
+			   master.ring.dropped + slave.ring.dropped );
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Decoder
+////////////////////////////////////////////////////////////////////////////////
+
+/** List a session log in the "T xx .. R yy .." text format used by the
+	PLAYBACK transport and devel-tools/playback, anything else becomes a
+	comment line.
+	\param times	start each command with its time from the first record
+*/
+static int decode( const char *file, bool times )
+{
+	static uint8_t data[0xffff];
+	uint8_t hdr[EC2_REC_HEADER_LEN];
+	uint64_t t = 0, t0 = 0, delta;
+	bool started = false;
+	char col = 0;		// the side the open line ends with, 0 for none
+	unsigned int len, n, i, scale;
+	FILE *f;
 
-	printf("Master\n");
-	/*Main loop*/
-	while (true)
+	f = fopen( file, "rb" );
+	if( !f )
+	{
+		printf("Unable to open %s\n", file );
+		return 1;
+	}
+	if( fread( hdr, EC2_REC_HEADER_LEN, 1, f )!=1 ||
+		memcmp( hdr, "EC2R", 4 )!=0 || hdr[4]<1 || hdr[4]>EC2_REC_VERSION )
 	{
-		ioctl(portfdMaster, TIOCMGET, &i);
-		if ((i & (TIOCM_DSR | TIOCM_CD)) != (MasterHandShake
-				   &
-				   (TIOCM_DSR | TIOCM_CD)))
+		printf("%s is not a recorded session\n", file );
+		fclose( f );
+		return 1;
+	}
+	scale = hdr[4]==1 ? 1000 : 1;
+	printf("// %s, %s, usb %04x:%04x\n", file, hdr[5] ? "EC3" : "EC2",
+		   (unsigned int)get_le( hdr+6, 2 ), (unsigned int)get_le( hdr+8, 2 ) );
+	while( fread( hdr, EC2_REC_ENTRY_LEN, 1, f )==1 )
+	{
+		delta = get_le( hdr+1, 4 ) * scale;
+		len = get_le( hdr+5, 2 );
+		n = hdr[0]==EC2_REC_TIMEOUT ? 0 : len;
+		if( fread( data, 1, n, f )!=n )
+			break;
+		if( hdr[0]==EC2_REC_SYNC )
 		{
-			if (!master)
-			{
-				master = true;
-//RW				printf("\nMaster\n\t");
-				printf("\nT ");
-			}
-//			printf("\n\t");
-			if ((i & TIOCM_DSR) != (MasterHandShake &
-						  TIOCM_DSR))
-			{
-				j = TIOCM_DTR;
-				if (i & TIOCM_DSR)
-				{
-					ioctl(portfdSlave, TIOCMBIS, &j);
-//RW					printf("DTR ON ");
-				}
-				else
-				{
-					ioctl(portfdSlave, TIOCMBIC, &j);
-//RW					printf("DTR OFF ");
-				}
-				fflush(stdout);
-			}
-			if ((i & TIOCM_CD) != (MasterHandShake & TIOCM_CD))
-			{
-				j = TIOCM_RTS;
-				if (i & TIOCM_CD)
-				{
-					ioctl(portfdSlave, TIOCMBIS, &j);
-//RW					printf("RTS_ON ");
-				}
-				else
-				{
-					ioctl(portfdSlave, TIOCMBIC, &j);
-//RW					printf("RTS_OFF ");
-				}
-				fflush(stdout);
-			}
-			MasterHandShake = i;
+			t = get_le( data, 8 );
+			continue;
 		}
-		if (1 == read(portfdMaster, &c, 1))
+		t += delta;
+		if( !started )
 		{
-			if (!master)
-			{
-				master = true;
-//RW				printf("\nMaster\n\t");
-				printf("\nT ");
-			}
-			write(portfdSlave, &c, 1);
-			printf("0x%02hhX ", c);
-			fflush(stdout);
+			t0 = t;
+			started = true;
 		}
-		ioctl(portfdSlave, TIOCMGET, &i);
-		if ((i & (TIOCM_DSR | TIOCM_CD)) != (SlaveHandShake &
-				   (TIOCM_DSR | TIOCM_CD)))
+		if( hdr[0]==EC2_REC_TX || (hdr[0]==EC2_REC_RX && col==0) )
 		{
-			if (master)
-			{
-				master = false;
-//RW				printf("\nSlave\n\t");
-				printf("\tR ");
-			}
-//			printf("\n\t");
-			if ((i & TIOCM_DSR) != (SlaveHandShake & TIOCM_DSR))
-			{
-				j = TIOCM_DTR;
-				if (i & TIOCM_DSR)
-				{
-					ioctl(portfdMaster, TIOCMBIS, &j);
-//RW					printf("DTR ON ");
-				}
-				else
-				{
-					ioctl(portfdMaster, TIOCMBIC, &j);
-//RW					printf("DTR OFF ");
-				}
-				fflush(stdout);
-			}
-			if ((i & TIOCM_CD) != (SlaveHandShake & TIOCM_CD))
-			{
-				j = TIOCM_RTS;
-				if (i & TIOCM_CD)
-				{
-					ioctl(portfdMaster, TIOCMBIS, &j);
-//RW					printf("RTS_ON ");
-				}
-				else
-				{
-					ioctl(portfdMaster, TIOCMBIC, &j);
-//RW					printf("RTS_OFF ");
-				}
-				fflush(stdout);
-			}
-			SlaveHandShake = i;
+			if( col )
+				printf("\n");
+			if( times )
+				printf("%llu.%09llu ", (unsigned long long)(t-t0)/1000000000,
+					   (unsigned long long)(t-t0)%1000000000 );
+			printf("%c", hdr[0] );
+			col = hdr[0];
 		}
-		if (1 == read(portfdSlave, &c, 1))
+		else if( hdr[0]==EC2_REC_RX && col==EC2_REC_TX )
 		{
-			if (master)
-			{
-				master = false;
-//RW				printf("\nSlave\n\t");
-				printf("\tR ");
-			}
-			write(portfdMaster, &c, 1 );
-			printf("0x%02hhX ", c);
-			fflush(stdout);
+			printf("\tR");
+			col = EC2_REC_RX;
 		}
+		else if( hdr[0]!=EC2_REC_RX )
+		{
+			if( col )
+				printf("\n");
+			col = 0;
+			if( hdr[0]==EC2_REC_TIMEOUT )
+				printf("// read of %u bytes timed out\n", len );
+			else if( hdr[0]==EC2_REC_LINES && len==2 )
+				printf("// %c DTR %s RTS %s\n", data[0],
+					   data[1] & EC2_LINE_DTR ? "on" : "off",
+					   data[1] & EC2_LINE_RTS ? "on" : "off" );
+			continue;
+		}
+		for( i=0; i<n; i++ )
+			printf(" %02X", data[i] );
 	}
-	
-	close(portfdMaster);
-	close(portfdSlave);
-	exit(0);
+	if( col )
+		printf("\n");
+	fclose( f );
+	return 0;
 }
 
-
-
-
+/*
+ * Main fonction.
+ */
+int main( int argc, char **argv )
+{
+	if( argc>=3 && strcmp( argv[1], "-d" )==0 )
+		return decode( argv[2], argc>3 && strcmp( argv[3], "-t" )==0 );
+	if( argc!=6 || strlen( argv[4] )!=3 )
+	{
+		printf( USAGE );
+		return 1;
+	}
+	return capture( argv );
+}
@@ -0,0 +1,644 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White   *
+ *   rickyw@neatstuff.co.nz   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** traceana
+	Decodes a session log, as written by the sniffer or with RECORD:<file>,
+	into debugger commands using the opcode tables in ec2drv and reports
+	where the time on the link goes: per command type, per ec2drv call and
+	the gaps where the host had nothing outstanding.
+
+	Each command is timed from the later of it being sent and the previous
+	reply ending, to the end of its own reply, so queued commands aren't
+	counted twice and the command times plus the idle time make up the
+	whole session.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <getopt.h>
+
+#include "ec2drv.h"
+
+using namespace std;
+
+void help()
+{
+	printf("traceana [options] log\n"
+		   "options:\n"
+		   "\t--gap	Report idle gaps of at least this many us, default 1000\n"
+		   "\t--top	Number of calls and gaps to list, default 10\n"
+		   "\t--list	Print every command as it is decoded\n");
+}
+
+
+/// One decoded command and its reply
+struct CMD
+{
+	const EC2_OPCODE *op;	///< 0 if the opcode isn't known
+	uint8_t		opcode;
+	uint64_t	tx_ns;		///< when it was sent
+	uint64_t	start_ns;	///< when the link started working on it
+	uint64_t	end_ns;		///< when its reply ended
+	unsigned	tx_bytes;
+	unsigned	rx_bytes;
+	unsigned	rx_expect;	///< EC2_RX_ANY if not known
+	unsigned	data;		///< bytes read or written
+	int32_t		addr;		///< -1 if it has none
+	bool		timeout;
+	bool		short_reply;
+};
+
+/// A run of commands from one ec2drv call
+struct CALL
+{
+	const char	*name;
+	size_t		first, last;
+	int32_t		addr;
+	unsigned	data;
+};
+
+/// Totals for one command or call name
+struct TOTAL
+{
+	TOTAL() : count(0), cmds(0), bytes(0), data(0), ns(0), max_ns(0),
+			  timeouts(0), short_replies(0) {}
+	unsigned	count;
+	unsigned	cmds;		///< commands, for calls
+	uint64_t	bytes;		///< sent and received
+	uint64_t	data;
+	uint64_t	ns;
+	uint64_t	max_ns;		///< longest latency, for commands
+	unsigned	timeouts;
+	unsigned	short_replies;
+};
+
+/// An idle gap, cmd is the first command after it
+struct GAP
+{
+	uint64_t	at_ns;
+	uint64_t	ns;
+	size_t		cmd;
+	bool operator<( const GAP &o ) const	{ return ns>o.ns; }
+};
+
+static vector<CMD>		cmds;
+static deque<size_t>	pending;		///< sent, reply not complete
+static vector<uint8_t>	txbuf;			///< bytes not yet making up a command
+static uint64_t			txbuf_ns;
+static vector<GAP>		gaps;
+static uint64_t			gap_min_ns = 1000000;
+static uint64_t			idle_ns = 0;
+static uint64_t			last_end_ns = 0;
+static uint64_t			last_rx_ns = 0;
+static unsigned			stray_bytes = 0;
+static bool				list_cmds = false;
+
+// debugger state the commands depend on
+static bool		in_boot = true;
+static bool		xdata_access = false;
+static uint8_t	xdata_page = 0;
+static uint32_t	flash_addr = 0;
+
+
+static uint32_t get_val( const uint8_t *p, int len, bool be )
+{
+	uint32_t v = 0;
+	for( int i=0; i<len; i++ )
+		v |= (uint32_t)p[be ? len-1-i : i] << (8*i);
+	return v;
+}
+
+static string op_name( const CMD &c )
+{
+	char s[32];
+	if( c.op )
+		return c.op->name;
+	snprintf( s, sizeof(s), "undecoded 0x%02x", c.opcode );
+	return s;
+}
+
+static string desc( const CMD &c )
+{
+	char s[32];
+	string r = op_name( c );
+	if( c.data )
+	{
+		snprintf( s, sizeof(s), " %uB", c.data );
+		r += s;
+	}
+	if( c.addr>=0 )
+	{
+		snprintf( s, sizeof(s), " @0x%04x", c.addr );
+		r += s;
+	}
+	if( c.timeout )
+		r += " (timeout)";
+	return r;
+}
+
+static const char *call_name( const CMD &c )
+{
+	return c.op ? c.op->call : "undecoded";
+}
+
+/** Find the table entry for the command at the start of buf.
+	\param need		set to the bytes needed to decide, if more than len
+	\returns the entry, or 0 if there is none or need was set
+*/
+static const EC2_OPCODE *lookup( const EC2_OPCODE *table, const uint8_t *buf,
+								 size_t len, size_t &need )
+{
+	for( const EC2_OPCODE *op=table; op->name; op++ )
+	{
+		if( op->opcode!=buf[0] )
+			continue;
+		if( (op->flags & EC2_OPF_XDATA) && !xdata_access )
+			continue;
+		if( op->match_ofs>=0 )
+		{
+			if( (size_t)op->match_ofs>=len )
+			{
+				need = op->match_ofs+1;
+				return 0;
+			}
+			if( buf[op->match_ofs]!=op->match_val )
+				continue;
+		}
+		return op;
+	}
+	return 0;
+}
+
+static void complete( size_t i, uint64_t t );
+
+/** Split the bytes sent so far into commands.
+	\param flush	the rest are one command even if it looks short
+*/
+static void parse_tx( bool flush )
+{
+	size_t pos = 0;
+	while( pos<txbuf.size() )
+	{
+		const uint8_t *p = &txbuf[pos];
+		size_t len = txbuf.size()-pos, need = 0;
+		const EC2_OPCODE *op = 0;
+		if( in_boot )
+			op = lookup( ec2_boot_opcodes, p, len, need );
+		if( !op && !need )
+			op = lookup( p[0]>=0x20 ? ec2_c2_opcodes : ec2_jtag_opcodes,
+						 p, len, need );
+		if( !op && !need && !in_boot )
+		{
+			op = lookup( ec2_boot_opcodes, p, len, need );
+			if( op && !(op->flags & EC2_OPF_ENTER_BOOT) )
+				op = 0;
+		}
+
+		CMD c;
+		memset( &c, 0, sizeof(c) );
+		c.op = op;
+		c.opcode = p[0];
+		c.tx_ns = txbuf_ns;
+		c.addr = -1;
+		if( op )
+		{
+			need = op->tx_len;
+			if( op->data_ofs>=0 )
+			{
+				size_t n = (op->flags & EC2_OPF_DATA16) ? 2 : 1;
+				if( len<op->data_ofs+n )
+					need = op->data_ofs+n;
+				else
+				{
+					c.data = get_val( p+op->data_ofs, n, false );
+					need += c.data;
+				}
+			}
+		}
+		if( need>len )
+		{
+			if( !flush )
+				break;
+			op = c.op = 0;		// cut short, we can't trust the rest of it
+			c.data = 0;
+		}
+		if( !op )
+			need = len;
+
+		c.tx_bytes = need;
+		c.rx_expect = EC2_RX_ANY;
+		if( op )
+		{
+			c.rx_expect = op->rx_len;
+			if( op->rx_ofs>=0 )
+			{
+				c.data = p[op->rx_ofs];
+				c.rx_expect += c.data;
+			}
+			if( op->addr_ofs>=0 )
+				c.addr = get_val( p+op->addr_ofs, op->addr_len,
+								  op->flags & EC2_OPF_ADDR_BE );
+			if( op->flags & EC2_OPF_XDATA )
+				c.addr |= xdata_page<<8;
+			if( op->flags & EC2_OPF_XDATA_ACCESS )
+				xdata_access = p[3]!=0;
+			if( op->flags & EC2_OPF_XDATA_PAGE )
+				xdata_page = p[3];
+			if( op->flags & EC2_OPF_FLASH_ADDR )
+				flash_addr = c.addr;
+			if( op->flags & EC2_OPF_FLASH_PTR )
+			{
+				c.addr = flash_addr;
+				flash_addr += c.data;
+			}
+			if( op->flags & EC2_OPF_ENTER_BOOT )
+				in_boot = true;
+			if( op->flags & EC2_OPF_LEAVE_BOOT )
+				in_boot = false;
+		}
+		cmds.push_back( c );
+		pending.push_back( cmds.size()-1 );
+		if( c.rx_expect==0 )
+			complete( cmds.size()-1, txbuf_ns );
+		pos += need;
+	}
+	txbuf.erase( txbuf.begin(), txbuf.begin()+pos );
+}
+
+static void complete( size_t i, uint64_t t )
+{
+	CMD &c = cmds[i];
+	c.start_ns = max( c.tx_ns, last_end_ns );
+	c.end_ns = max( t, c.start_ns );
+	last_end_ns = c.end_ns;
+	pending.erase( find( pending.begin(), pending.end(), i ) );
+	if( list_cmds )
+		printf( "%10.6f %8.1f us  %s\n", (c.tx_ns-cmds.front().tx_ns)/1e9,
+				(c.end_ns-c.start_ns)/1e3, desc( c ).c_str() );
+}
+
+/** Replies of unknown length end when the next command is sent, so do ones
+	already started, the host wanted fewer bytes than the table says.
+*/
+static void end_open_replies()
+{
+	for( size_t i=0; i<pending.size(); )
+	{
+		CMD &c = cmds[pending[i]];
+		if( c.rx_expect==EC2_RX_ANY )
+			complete( pending[i], c.rx_bytes ? last_rx_ns : c.tx_ns );
+		else if( c.rx_bytes )
+		{
+			c.short_reply = true;
+			complete( pending[i], last_rx_ns );
+		}
+		else
+			i++;
+	}
+}
+
+static void on_tx( uint64_t t, const uint8_t *buf, unsigned len )
+{
+	end_open_replies();
+	if( pending.empty() && txbuf.empty() && !cmds.empty() && t>last_end_ns )
+	{
+		GAP g = { last_end_ns, t-last_end_ns, cmds.size() };
+		idle_ns += g.ns;
+		if( g.ns>=gap_min_ns )
+			gaps.push_back( g );
+	}
+	if( txbuf.empty() )
+		txbuf_ns = t;
+	txbuf.insert( txbuf.end(), buf, buf+len );
+	parse_tx( false );
+}
+
+static void on_rx( uint64_t t, const uint8_t *buf, unsigned len )
+{
+	parse_tx( true );
+	last_rx_ns = t;
+	while( len )
+	{
+		if( pending.empty() )
+		{
+			// more than we expected, it belongs with the last reply
+			stray_bytes += len;
+			if( !cmds.empty() )
+			{
+				cmds.back().rx_bytes += len;
+				cmds.back().end_ns = t;
+				last_end_ns = t;
+			}
+			return;
+		}
+		CMD &c = cmds[pending.front()];
+		unsigned n = len;
+		if( c.rx_expect!=EC2_RX_ANY )
+			n = min( len, c.rx_expect-c.rx_bytes );
+		c.rx_bytes += n;
+		len -= n;
+		if( c.rx_bytes==c.rx_expect )
+			complete( pending.front(), t );
+	}
+}
+
+static void on_timeout( uint64_t t )
+{
+	parse_tx( true );
+	if( pending.empty() )
+		return;
+	cmds[pending.front()].timeout = true;
+	complete( pending.front(), t );
+}
+
+/** Read a log and decode it.
+	\returns the time of the last record, or 0 if it couldn't be read
+*/
+static uint64_t read_log( const char *file )
+{
+	static uint8_t data[0xffff];
+	uint8_t hdr[EC2_REC_HEADER_LEN];
+	uint64_t t = 0;
+	unsigned len, scale;
+	FILE *f = fopen( file, "rb" );
+	if( !f )
+	{
+		printf("Unable to open %s\n", file );
+		return 0;
+	}
+	if( fread( hdr, EC2_REC_HEADER_LEN, 1, f )!=1 ||
+		memcmp( hdr, "EC2R", 4 )!=0 || hdr[4]<1 || hdr[4]>EC2_REC_VERSION )
+	{
+		printf("%s is not a recorded session\n", file );
+		fclose( f );
+		return 0;
+	}
+	scale = hdr[4]==1 ? 1000 : 1;
+	while( fread( hdr, EC2_REC_ENTRY_LEN, 1, f )==1 )
+	{
+		len = hdr[5] | hdr[6]<<8;
+		if( hdr[0]==EC2_REC_TIMEOUT )
+			len = 0;
+		if( len && fread( data, 1, len, f )!=len )
+			break;
+		t += (uint64_t)get_val( hdr+1, 4, false ) * scale;
+		switch( hdr[0] )
+		{
+			case EC2_REC_SYNC:
+				if( len>=8 )
+					t = get_val( data, 4, false ) |
+						(uint64_t)get_val( data+4, 4, false )<<32;
+				break;
+			case EC2_REC_TX:		on_tx( t, data, len );	break;
+			case EC2_REC_RX:		on_rx( t, data, len );	break;
+			case EC2_REC_TIMEOUT:	on_timeout( t );		break;
+			default:				break;	// handshake lines and newer kinds
+		}
+	}
+	fclose( f );
+	parse_tx( true );
+	end_open_replies();
+	while( !pending.empty() )
+	{
+		cmds[pending.front()].timeout = true;
+		complete( pending.front(), t );
+	}
+	return t ? t : 1;
+}
+
+/** Group the commands into calls.  Commands without a call, such as
+	setting the flash address, belong to the call that follows them.
+*/
+static void find_calls( vector<CALL> &calls )
+{
+	size_t setup = cmds.size();		// first set up command waiting for a call
+	for( size_t i=0; i<cmds.size(); i++ )
+	{
+		const char *name = call_name( cmds[i] );
+		if( !name )
+		{
+			if( setup==cmds.size() )
+				setup = i;
+			continue;
+		}
+		if( calls.empty() || strcmp( calls.back().name, name )!=0 )
+		{
+			CALL c = { name, min( setup, i ), i, -1, 0 };
+			calls.push_back( c );
+		}
+		calls.back().last = i;
+		setup = cmds.size();
+	}
+	if( setup<cmds.size() )
+	{
+		if( calls.empty() )
+		{
+			CALL c = { "set up", setup, setup, -1, 0 };
+			calls.push_back( c );
+		}
+		calls.back().last = cmds.size()-1;
+	}
+	for( size_t i=0; i<calls.size(); i++ )
+	{
+		for( size_t j=calls[i].first; j<=calls[i].last; j++ )
+		{
+			if( calls[i].addr<0 )
+				calls[i].addr = cmds[j].addr;
+			calls[i].data += cmds[j].data;
+		}
+	}
+}
+
+static uint64_t call_ns( const CALL &c )
+{
+	return cmds[c.last].end_ns - cmds[c.first].start_ns;
+}
+
+static bool longer_call( const CALL &a, const CALL &b )
+{
+	return call_ns( a )>call_ns( b );
+}
+
+typedef pair<string,TOTAL> NAMED_TOTAL;
+static bool more_time( const NAMED_TOTAL &a, const NAMED_TOTAL &b )
+{
+	return a.second.ns>b.second.ns;
+}
+
+static void print_totals( const char *title, map<string,TOTAL> &totals,
+						  bool calls )
+{
+	vector<NAMED_TOTAL> v( totals.begin(), totals.end() );
+	sort( v.begin(), v.end(), more_time );
+	if( calls )
+		printf("\n%-24s %8s %8s %9s %11s %9s\n", title, "Calls", "Cmds",
+			   "Data", "Total us", "Avg us" );
+	else
+		printf("\n%-24s %8s %9s %9s %11s %9s %9s\n", title, "Count", "Bytes",
+			   "Data", "Total us", "Avg us", "Max us" );
+	for( size_t i=0; i<v.size(); i++ )
+	{
+		const TOTAL &t = v[i].second;
+		if( calls )
+		{
+			printf("%-24s %8u %8u %9llu %11.0f %9.1f\n", v[i].first.c_str(),
+				   t.count, t.cmds, (unsigned long long)t.data, t.ns/1e3,
+				   t.ns/1e3/t.count );
+			continue;
+		}
+		printf("%-24s %8u %9llu %9llu %11.0f %9.1f %9.0f", v[i].first.c_str(),
+			   t.count, (unsigned long long)t.bytes,
+			   (unsigned long long)t.data, t.ns/1e3, t.ns/1e3/t.count,
+			   t.max_ns/1e3 );
+		if( t.timeouts )
+			printf("  %u timeouts", t.timeouts );
+		if( t.short_replies )
+			printf("  %u short", t.short_replies );
+		printf("\n");
+	}
+}
+
+static void report( unsigned top )
+{
+	if( cmds.empty() )
+	{
+		printf("No commands in the log\n");
+		return;
+	}
+	uint64_t t0 = cmds.front().tx_ns;
+	uint64_t span = cmds.back().end_ns - t0;
+	uint64_t tx = 0, rx = 0;
+	map<string,TOTAL> ops, call_totals;
+	for( size_t i=0; i<cmds.size(); i++ )
+	{
+		const CMD &c = cmds[i];
+		TOTAL &t = ops[op_name( c )];
+		t.count++;
+		t.bytes += c.tx_bytes + c.rx_bytes;
+		t.data += c.data;
+		t.ns += c.end_ns - c.start_ns;
+		t.max_ns = max( t.max_ns, c.end_ns - c.tx_ns );
+		t.timeouts += c.timeout;
+		t.short_replies += c.short_reply;
+		tx += c.tx_bytes;
+		rx += c.rx_bytes;
+	}
+	vector<CALL> calls;
+	find_calls( calls );
+	for( size_t i=0; i<calls.size(); i++ )
+	{
+		TOTAL &t = call_totals[calls[i].name];
+		t.count++;
+		t.cmds += calls[i].last - calls[i].first + 1;
+		t.data += calls[i].data;
+		t.ns += call_ns( calls[i] );
+	}
+
+	printf("%u commands, %llu bytes sent, %llu received, %.6f s\n",
+		   (unsigned)cmds.size(), (unsigned long long)tx,
+		   (unsigned long long)rx, span/1e9 );
+	printf("Link busy %.6f s, idle %.6f s (%.1f%%)\n",
+		   (span-idle_ns)/1e9, idle_ns/1e9,
+		   span ? 100.0*idle_ns/span : 0.0 );
+	if( stray_bytes )
+		printf("%u reply bytes beyond what the commands expect\n",
+			   stray_bytes );
+	print_totals( "Command", ops, false );
+	print_totals( "Call", call_totals, true );
+
+	sort( calls.begin(), calls.end(), longer_call );
+	printf("\nLongest calls\n");
+	for( size_t i=0; i<calls.size() && i<top; i++ )
+	{
+		const CALL &c = calls[i];
+		printf("%10.6f s %11.0f us  %s", (cmds[c.first].start_ns-t0)/1e9,
+			   call_ns( c )/1e3, c.name );
+		if( c.data )
+			printf(" %uB", c.data );
+		if( c.addr>=0 )
+			printf(" @0x%04x", c.addr );
+		printf(", %u commands\n", (unsigned)(c.last-c.first+1) );
+	}
+
+	sort( gaps.begin(), gaps.end() );
+	printf("\n%u idle gaps of %llu us or more\n", (unsigned)gaps.size(),
+		   (unsigned long long)(gap_min_ns/1000) );
+	for( size_t i=0; i<gaps.size() && i<top; i++ )
+	{
+		const GAP &g = gaps[i];
+		printf("%10.6f s %11.0f us  after %s, before %s\n", (g.at_ns-t0)/1e9,
+			   g.ns/1e3, desc( cmds[g.cmd-1] ).c_str(),
+			   desc( cmds[g.cmd] ).c_str() );
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	static int list_flag = 0, help_flag = 0;
+	unsigned top = 10;
+	static struct option long_options[] =
+	{
+		{"list", no_argument, &list_flag, 1},
+		{"help", no_argument, &help_flag, 'h'},
+		{"gap", required_argument, 0, 'g'},
+		{"top", required_argument, 0, 't'},
+		{0, 0, 0, 0}
+	};
+	int option_index = 0;
+	int c;
+	while(1)
+	{
+		c = getopt_long (argc, argv, "", long_options, &option_index);
+		if( c==-1)
+			break;
+		switch(c)
+		{
+			case 0:		// set a flag, nothing to do
+				break;
+			case 'g':	gap_min_ns = strtoull( optarg, 0, 0 )*1000;	break;
+			case 't':	top = strtoul( optarg, 0, 0 );				break;
+			default:
+				printf("unexpected option\n");
+				break;
+		}
+	};
+	if( help_flag || optind!=argc-1 )
+	{
+		help();
+		return help_flag ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	list_cmds = list_flag;
+	if( !read_log( argv[optind] ) )
+		return EXIT_FAILURE;
+	report( top );
+	return EXIT_SUCCESS;
+}
@@ -186,3 +186,19 @@ uint16_t boot_local_calc_page_cksum(uint8_t *data)
  
 	return cksum; 
 };
+
+
+/// Boot loader commands, see EC2_OPCODE
+const EC2_OPCODE ec2_boot_opcodes[] =
+{
+//	  op   match     tx  data  rx       addr    flags
+	{ 0x55, -1, 0,    1, -1, -1,  1,    -1, 0,  EC2_OPF_ENTER_BOOT, "autobaud", "connect" },
+	{ 0x00, -1, 0,    3, -1, -1,  1,    -1, 0,  0, "boot loader version", "connect" },
+	{ 0x01, -1, 0,    3, -1, -1,  1,     1, 1,  0, "select page", "connect" },
+	{ 0x02, -1, 0,    3, -1, -1,  1,    -1, 0,  0, "erase page", "firmware update" },
+	{ 0x03, -1, 0,  515, -1, -1,  1,    -1, 0,  0, "write page", "firmware update" },
+	{ 0x04, -1, 0,    3, -1, -1,  2,    -1, 0,  0, "page checksum", "firmware update" },
+	{ 0x05, -1, 0,    3, -1, -1,  1,     1, 2,  EC2_OPF_ADDR_BE, "read byte", "firmware update" },
+	{ 0x06, -1, 0,    3, -1, -1,  1,    -1, 0,  EC2_OPF_LEAVE_BOOT, "run application", "connect" },
+	{ 0 }
+};
@@ -4,6 +4,12 @@
 #include <string.h>
 #include "c2_mode.h"
 
+#define C2_READ_BLOCK_MAX	0x3C	///< Largest 0x2E read current EC3 firmware accepts
+#define C2_WRITE_BLOCK_MAX	0x38	///< Largest 0x2F write, 4 byte header + data fits a packet
+#define C2_PROBE_TIMEOUT	500		///< ms to wait for each c2_probe_read_block() reply
+
+static uint8_t c2_probe_read_block( EC2DRV *obj );
+
 uint8_t c2_special_read( EC2DRV *obj, uint8_t sfr)
 {
 	int i;
@@ -47,7 +53,7 @@ static void flash_write_pre( EC2DRV *obj )
 	uint8_t reg_a0_save;
 	BOOL ok;
 
-	if( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F530, C8051F537 ) )
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_VDDMON_FLASH ) )
 	{
 		SFRREG SFR_VDDMON = { 0, 0xff };
 		SFRREG SFR_RSTSRC = { 0, 0xef };
@@ -58,7 +64,7 @@ static void flash_write_pre( EC2DRV *obj )
 		ec2_write_paged_sfr( obj, SFR_RSTSRC, 0x4a );
 		ec2_write_raw_sfr( obj, 0xa0, reg_a0_save ); // restore a0 = 80
 	}
-	else if( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F340, C8051F347 ) )
+	else if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_F34X_FLASH ) )
 	{
 		char buf[5];
 		
@@ -80,9 +86,7 @@ static void flash_write_pre( EC2DRV *obj )
 		c2_special_write (obj, 0xa0, 0x80);
 		c2_special_write (obj, 0xbf, 0x01);
 	}
-	else if(( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F920, C8051F921 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F930, C8051F931 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, SI1000, SI1031)))
+	else if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_FLASH_8F ))
 	{
 		char buf[5];
 		
@@ -112,13 +116,13 @@ static void flash_write_pre( EC2DRV *obj )
 */ 
 static void flash_write_post( EC2DRV *obj )
 {
-	if( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F530, C8051F537 ) )
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_VDDMON_FLASH ) )
 	{
 		SFRREG SFR_VDDMON = { 0, 0xff };
 		SFRREG SFR_RSTSRC = { 0, 0xef };
 		ec2_write_paged_sfr( obj, SFR_VDDMON, 0xc0 );	// VDMLVL = 0
 	}
-	else if( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F340, C8051F347 ) )
+	else if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_F34X_FLASH ) )
 	{
 
 	}
@@ -169,7 +173,7 @@ uint16_t c2_unique_device_id( EC2DRV *obj )
 }
 
 
-void c2_erase_flash( EC2DRV *obj )
+BOOL c2_erase_flash( EC2DRV *obj )
 {
 	int i;
 	DUMP_FUNC();
@@ -193,6 +197,7 @@ void c2_erase_flash( EC2DRV *obj )
 		ec2_connect( obj, obj->port );
 	}
 	DUMP_FUNC_END();
+	return TRUE;
 }
 
 BOOL c2_erase_flash_sector( EC2DRV *obj, uint32_t sector_addr,
@@ -202,9 +207,7 @@ BOOL c2_erase_flash_sector( EC2DRV *obj, uint32_t sector_addr,
 	BOOL r;
 	char cmd[2];
 	flash_write_pre(obj);
-	if(( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F920, C8051F921 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F930, C8051F931 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, SI1000, SI1031))) {
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_FLASH_8F )) {
 		if (scratchpad) {
 			c2_special_write (obj, 0x8f, 0x04);
 		}
@@ -216,9 +219,7 @@ BOOL c2_erase_flash_sector( EC2DRV *obj, uint32_t sector_addr,
 	cmd[1] = sector_addr/ obj->dev->flash_sector_size;
 	r =  trx( obj, cmd, 2, "\x0d", 1 );
 	flash_write_post(obj);
-	if(( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F920, C8051F921 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F930, C8051F931 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, SI1000, SI1031))) {
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_FLASH_8F )) {
 		c2_special_write (obj, 0x8f, 0x00);
 	}
 	DUMP_FUNC_END();
@@ -236,25 +237,32 @@ BOOL c2_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len, BO
 	// 2f connect breakdown:
 	// T 2f 00 30 08 55 55 55 55 55 55 55 55		R 0d
 	//    |  |  |  | +---+--+--+--+--+--+--+--- Data bytes to write
-	//    |  |  |  +--------------------------- number of data bytes towrite (8 max, maxtotal cmd length 0x0c)
+	//    |  |  |  +--------------------------- number of data bytes towrite (8 max EC2, C2_WRITE_BLOCK_MAX EC3)
 	//    |  |  +------------------------------ High byte of address to start write
 	//    |  +--------------------------------- low byte of address
 	//    +------------------------------------ write code memory command
 	//
 	// for some funny reason the IDE alternates between 8 byte writes and 
 	// 4 byte writes, this means the total number of writes cycle is 0x0c the
-	// exact same number as the JTAG mode, it looks like they economise code,
-	// I this would complicate things, well just do 8 byte writes and then an
-	// fragment at the end.  This will need testing throughlerly as it is
-	// different to the IDE's action.
+	// exact same number as the JTAG mode.  We just do 8 byte writes and then
+	// a fragment at the end.  EC3 firmware that accepts large reads (see
+	// c2_probe_read_block()) also accepts C2_WRITE_BLOCK_MAX byte writes.
+	// The writes are queued so the EC3 has several in flight, each ack is
+	// still checked and the first failing address kept in flash_fail_addr.
 	unsigned int i, addr;
-	char		 cmd[0x0c];
-	BOOL ok;
+	char		 cmd[4+C2_WRITE_BLOCK_MAX];
+	uint32_t	 batch_addr[EC2_QUEUE_DEPTH];
+	int			 n = 0;
+	uint8_t		 block;
+	BOOL ok = TRUE;
+
+	if( obj->c2_read_block==0 )
+		obj->c2_read_block = c2_probe_read_block( obj );
+	block = obj->c2_read_block==C2_READ_BLOCK_MAX ? C2_WRITE_BLOCK_MAX : 8;
+	obj->flash_fail_addr = -1;
 
 	flash_write_pre(obj);
-	if(( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F920, C8051F921 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F930, C8051F931 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, SI1000, SI1031))) {
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_FLASH_8F )) {
 		if (scratchpad) {
 			c2_special_write (obj, 0x8f, 0x04);
 		}
@@ -263,37 +271,50 @@ BOOL c2_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len, BO
 		}
 	}
 	cmd[0] = 0x2f;									// Write code/flash memory cmd	
-	for( i=0; i<len; i+=8 )
+	for( i=0; i<len && ok; i+=block )
 	{
 		addr = start_addr + i;
 		cmd[1] = addr & 0xff;						// low byte
 		cmd[2] = (addr>>8) & 0xff;					// high byte
-		cmd[3] = (len-i)<8 ? (len-i) : 8;
+		cmd[3] = (len-i)<block ? (len-i) : block;
 		memcpy( &cmd[4], &buf[i], cmd[3] );
-		if( !trx( obj, cmd, cmd[3]+4, "\x0d", 1 ) )
-			return FALSE;							// Failure
+		batch_addr[n++] = addr;
+		ec2_queue_trx( obj, cmd, cmd[3]+4, "\x0d", 1 );
+		if( n==EC2_QUEUE_DEPTH || i+cmd[3]>=len )
+		{
+			if( !ec2_queue_flush( obj ) )
+			{
+				obj->flash_fail_addr = batch_addr[obj->queue_failed];
+				printf( "Flash write failed at 0x%05x\n", obj->flash_fail_addr );
+				ok = FALSE;
+			}
+			n = 0;
+		}
 	}
 
 	// estore origional condition
 	flash_write_post(obj);
-	if(( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F920, C8051F921 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F930, C8051F931 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, SI1000, SI1031))) {
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_FLASH_8F )) {
 		c2_special_write (obj, 0x8f, 0x00);
 	}
-	return TRUE;
+	return ok;
 }
 
 
 BOOL c2_read_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len, BOOL scratchpad )
 {
-	int i;
+	int i, j, n, blk_start = 0;
 	uint8_t cmd[10];
 	uint32_t addr;
+	BOOL r = TRUE;
+	char tmp_buf[EC2_QUEUE_DEPTH][C2_READ_BLOCK_MAX+1];	// room for terminators
+	uint8_t block;
 	
-	if(( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F920, C8051F921 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F930, C8051F931 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, SI1000, SI1031))) {
+	if( obj->c2_read_block==0 )
+		obj->c2_read_block = c2_probe_read_block( obj );
+	block = obj->c2_read_block;
+	
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_FLASH_8F )) {
 		if (scratchpad) {
 			c2_special_write (obj, 0x8f, 0x04);
 		}
@@ -305,26 +326,65 @@ BOOL c2_read_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len, BOO
 	//
 	// example command 0x2E 0x00 0x00 0x0C
 	//				     |    |   |    |
-	//					 |    |   |    +---- Length or read up to 0x0C bytes
+	//					 |    |   |    +---- Length or read up to 0x0C bytes (0x3C EC3)
 	//					 |    |   +--------- High byte of address to start at
 	//					 |    +----(len-i)--------- Low byte of address
 	//					 +------------------ Flash read command
 	cmd[0] = 0x2E;
-	for( i=0; i<len; i+=0x0c )
+	for( i=0; i<len; i+=block )
 	{
 		addr = start_addr + i;
 		cmd[1] = addr & 0xff;	// low byte
 		cmd[2] = (addr >> 8) & 0xff;
-		cmd[3] = (len-i) > 0x0c ? 0x0c : (len-i);
-		write_port( obj, (char*)cmd, 4 );
-		read_port( obj, (char*)buf+i, cmd[3]+1 );	// +1 for 0x0d
+		cmd[3] = (len-i) > block ? block : (len-i);
+		n = (i/block) % EC2_QUEUE_DEPTH;
+		ec2_queue_cmd( obj, (char*)cmd, 4, tmp_buf[n], cmd[3]+1 );	// +1 for 0x0d
+		if( n==EC2_QUEUE_DEPTH-1 || i+cmd[3]>=len )
+		{
+			// copy out the completed batch
+			r &= ec2_queue_flush( obj );
+			for( j=0; j<=n; j++, blk_start+=block )
+				memcpy( buf+blk_start, tmp_buf[j],
+						len-blk_start > block ? block : len-blk_start );
+		}
 	}
-	if(( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F920, C8051F921 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F930, C8051F931 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, SI1000, SI1031))) {
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_FLASH_8F )) {
 		c2_special_write (obj, 0x8f, 0x00);
 	}
-	return TRUE;
+	return r;
+}
+
+
+/** Find the largest flash read block the adapter supports.
+	The EC2 is limited to 0x0C bytes.  Current EC3 firmware accepts 0x3C, older
+	firmware doesn't so we read the start of flash both ways and only use the
+	large block if the replies agree and the large one is properly terminated.
+	Each EC3 reply is a single packet so a rejected request doesn't leave the
+	stream out of step.  Parts with the 0x8f flash select get the main flash
+	selected first, and the replies are only waited for briefly so firmware
+	that ignores the large request doesn't hold up the first flash access.
+
+	\param obj		ec2drv object to act on.
+	\returns		Block size to use for 0x2E reads.
+*/
+static uint8_t c2_probe_read_block( EC2DRV *obj )
+{
+	char small[0x0c+1], big[C2_READ_BLOCK_MAX+1];
+	
+	if( obj->dbg_adaptor!=EC3 )
+		return 0x0c;
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_FLASH_8F ))
+		c2_special_write (obj, 0x8f, 0x00);
+	memset( big, 0, sizeof(big) );
+	write_port( obj, "\x2E\x00\x00\x0C", 4 );
+	if( !read_port_tm( obj, small, sizeof(small), C2_PROBE_TIMEOUT ) )
+		return 0x0c;
+	write_port( obj, "\x2E\x00\x00\x3C", 4 );
+	if( !read_port_tm( obj, big, sizeof(big), C2_PROBE_TIMEOUT ) )
+		return 0x0c;
+	if( big[C2_READ_BLOCK_MAX]==0x0d && memcmp( big, small, 0x0c )==0 )
+		return C2_READ_BLOCK_MAX;
+	return 0x0c;
 }
 
 
@@ -371,52 +431,98 @@ BOOL c2_read_xdata_emif( EC2DRV *obj, char *buf, int start_addr, int len )
 
 
 
-/** Special version for F350 xdata reads.
-	now not using pages as they seem unnecessary based on the latest data
-	captures.
-
-	\param obj			Object to act on
-	\param buf			Buffer to recieve the read data.
-	\param start_addr	Address in xdata to start reading from
-	\param len			number of bytes to read.
-	\return				TRUE is successful, false if address out of range
+/** Point the EMI0ADDR registers at start_addr and select the SFR page of the
+	auto incrementing xdata register (0x84) for a streamed xdata access.
+	\returns the SFR page to restore with xdata_stream_end().
 */
-BOOL c2_read_xdata_F350( EC2DRV *obj, char *buf, int start_addr, int len )
+static uint8_t xdata_stream_begin( EC2DRV *obj, int start_addr )
 {
 	const SFRREG LOW_ADDR_REG	= { 0x0f, 0xad };
 	const SFRREG HIGH_ADDR_REG	= { 0x0f, 0xc7 };
-	const uint8_t max_read_len = obj->dbg_adaptor==EC3 ? 0x3c : 0x0c;
-	uint8_t sfrpage_save;
-			
-	// Set start address
+	uint8_t sfrpage_save = 0;
+	
 	ec2_write_paged_sfr( obj, LOW_ADDR_REG , start_addr&0xff );
 	ec2_write_paged_sfr( obj, HIGH_ADDR_REG, (start_addr >> 8)&0xff );
-	
-	// save SFR page register
 	if( obj->dev->has_paged_sfr )
 	{
 		sfrpage_save = ec2_read_raw_sfr(obj, obj->dev->sfr_page_reg, 0 );
 		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, 0x0f );
 	}
+	return sfrpage_save;
+}
+
 
-	// read the data
-	uint16_t ofs;
+static void xdata_stream_end( EC2DRV *obj, uint8_t sfrpage_save )
+{
+	if( obj->dev->has_paged_sfr )
+		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, sfrpage_save );
+}
+
+
+/** Bulk XDATA read for DEV_CAP_XDATA_BLOCK devices on the EC3.
+	These devices reach XDATA through the EMI0ADDR registers and an auto
+	incrementing data register (0x84).  The address and SFR page are set up
+	once, then the data register is streamed in 0x2C block reads (as the
+	IDE does for the F35x), queued so several are in flight at once.
+
+	\param obj			Object to act on
+	\param buf			Buffer to recieve the read data.
+	\param start_addr	Address in xdata to start reading from
+	\param len			number of bytes to read.
+	\return				TRUE is successful, FALSE on a communications error
+*/
+static BOOL c2_read_xdata_stream( EC2DRV *obj, char *buf, int start_addr, int len )
+{
+	const uint8_t max_read_len = 0x3c;
+	char tmp_buf[EC2_QUEUE_DEPTH][0x3c+1];	// room for terminators
+	uint8_t sfrpage_save;
 	uint8_t cmd[4];
-	for(ofs=0; ofs<len; ofs+=max_read_len )
+	int ofs, j, n, blk_start = 0;
+	BOOL r = TRUE;
+	
+	sfrpage_save = xdata_stream_begin( obj, start_addr );
+	// T 2c 84 00 NN	R NN bytes of data 0d
+	cmd[0] = 0x2c;
+	cmd[1] = 0x84;
+	cmd[2] = 0x00;
+	for( ofs=0; ofs<len; ofs+=max_read_len )
 	{
-		cmd[0] = 0x2c;
-		cmd[1] = 0x84;
-		cmd[2] = 0x00;
 		cmd[3] = (len-ofs)>=max_read_len ? max_read_len : (len-ofs);
-		write_port( obj, (char*)cmd, 4 );
-		read_port( obj, (char*)buf+ofs, cmd[3]+1 ); // for 0x0d terminator
+		n = (ofs/max_read_len) % EC2_QUEUE_DEPTH;
+		ec2_queue_cmd( obj, (char*)cmd, 4, tmp_buf[n], cmd[3]+1 );
+		if( n==EC2_QUEUE_DEPTH-1 || ofs+cmd[3]>=len )
+		{
+			r &= ec2_queue_flush( obj );
+			for( j=0; j<=n; j++, blk_start+=max_read_len )
+				memcpy( buf+blk_start, tmp_buf[j],
+						len-blk_start > max_read_len ? max_read_len : len-blk_start );
+		}
 	}
+	xdata_stream_end( obj, sfrpage_save );
+	return r;
+}
 
-	// restore SFR page register
-	if( obj->dev->has_paged_sfr )
-		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, sfrpage_save );
+
+/** As c2_read_xdata_stream() for the EC2 and the parts without
+	DEV_CAP_XDATA_BLOCK, reads the data register one byte per queued command.
+*/
+static BOOL c2_read_xdata_bytes( EC2DRV *obj, char *buf, int start_addr, int len )
+{
+	uint8_t sfrpage_save;
+	uint8_t cmd[3];
+	int ofs;
+	BOOL r = TRUE;
 	
-	return TRUE;
+	sfrpage_save = xdata_stream_begin( obj, start_addr );
+	// T 28 84 01		R 00	// read next byte
+	cmd[0] = 0x28;
+	cmd[1] = 0x84;
+	cmd[2] = 0x01;
+	for( ofs=0; ofs<len; ofs++ )
+		r &= ec2_queue_cmd( obj, (char*)cmd, 3, buf+ofs, 1 );
+	r &= ec2_queue_flush( obj );
+	xdata_stream_end( obj, sfrpage_save );
+	return r;
 }
 
 
@@ -514,9 +620,9 @@ void c2_read_ram_sfr( EC2DRV *obj, char *buf, int start_addr, int len, BOOL sfr
 	{
 		cmd[1] = start_addr+i;
 		cmd[2] = len-i >= block_len ? block_len : len-i;
-		write_port( obj, (char*)cmd, 3 );
-		read_port( obj, buf+i, cmd[2] );
+		ec2_queue_cmd( obj, (char*)cmd, 3, buf+i, cmd[2] );
 	}
+	ec2_queue_flush( obj );
 }
 
 
@@ -589,173 +695,95 @@ BOOL c2_write_ram( EC2DRV *obj, char *buf, int start_addr, int len )
 }
 
 
-/** This method of writing to XDATA is probably used by more than just the F350
-	Need to find out which then the name can be changed to be more generic
+/** Bulk XDATA write for DEV_CAP_XDATA_BLOCK devices on the EC3.
+	Counterpart of c2_read_xdata_stream(), 0x2D block writes kept to a
+	single packet.  Every write is acknowledged with 0x0d and all acks are
+	checked.
 
 	\param obj			Object to act on.
 	\param buf			Buffer containing data to write to xdata RAM.
 	\param start_addr	Address in XDATA to begin writing at.
 	\param len			Number of bytes to write.
+	\return				TRUE on success, FALSE if any write wasn't acknowledged
 */
-BOOL c2_write_xdata_F35x( EC2DRV *obj, char *buf, int start_addr, int len )
+static BOOL c2_write_xdata_stream( EC2DRV *obj, char *buf, int start_addr, int len )
 {
-	const SFRREG LOW_ADDR_REG	= { 0x0f, 0xad };
-	const SFRREG HIGH_ADDR_REG	= { 0x0f, 0xc7 };
+	const uint16_t block_len_max = EC2_QUEUE_TX_MAX-4;
 	uint8_t sfrpage_save;
-	
-	// setup start address as low and high bytes
-	ec2_write_paged_sfr( obj, LOW_ADDR_REG , start_addr&0xff );
-	ec2_write_paged_sfr( obj, HIGH_ADDR_REG, (start_addr >> 8)&0xff );
-
-	// save SFR page register
-	if( obj->dev->has_paged_sfr )
-	{
-		sfrpage_save = ec2_read_raw_sfr(obj, obj->dev->sfr_page_reg, 0 );
-		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, 0x0f );
-	}
-
-	// each write block begins with 2d 84 00 LL
-	// where LL is the number of bytes to write
-	// the result is 0x0d on success
-	// max transfer size of USB is 0x3C, probably 0x0c for EC2
-	
-	assert( obj->mode==C2 );
-	uint16_t block_len_max = obj->dbg_adaptor==EC2 ? 0x0C : 0x3C;
 	uint16_t block_len;
-	uint16_t addr = start_addr;
-	uint16_t cnt = 0;
-	char cmd[64];
-	const char cmd_len = 4;
+	uint16_t cnt;
+	char cmd[EC2_QUEUE_TX_MAX];
 	BOOL ok=TRUE;
-	while( cnt<len )
+	
+	sfrpage_save = xdata_stream_begin( obj, start_addr );
+	// 2d 84 00 LL + LL bytes of data	R 0d
+	cmd[0] = 0x2d;
+	cmd[1] = 0x84;
+	cmd[2] = 0x00;
+	for( cnt=0; cnt<len; cnt+=block_len )
 	{
-		// 2d 84 00 len + len bytes of data
-		cmd[0] = 0x2d;					// Write F35x xdata
-		cmd[1] = 0x84;
-		cmd[2] = 0x00;
 		block_len = (len-cnt)>block_len_max ? block_len_max : len-cnt;
 		cmd[3] = block_len;
 		memcpy( &cmd[4], buf+cnt, block_len );
-		if( block_len==0x3c )
-		{
-			// split write over 2 USB writes
-			write_port( obj, cmd, 0x3f );
-			write_port( obj, &cmd[cmd_len+0x3b], 1 );
-			ok |= (read_port_ch( obj)=='\x0d');
-		}
-		else
-		{
-			write_port( obj, cmd, block_len + cmd_len );
-			ok |= (read_port_ch( obj)=='\x0d');
-		}
-		addr += block_len;
-		cnt += block_len;
+		ok &= ec2_queue_trx( obj, cmd, block_len+4, "\x0d", 1 );
 	}
-
-	// restore SFR page register
-	if( obj->dev->has_paged_sfr )
-		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, sfrpage_save );
-
+	ok &= ec2_queue_flush( obj );
+	xdata_stream_end( obj, sfrpage_save );
 	return ok;
 }
 
 
-/** write to targets XDATA address space (C2 with only internal xdata).
-	Normal c2 xdata write without emif.
-
-	\param obj			Object to act on.
-	\param buf			Buffer containing data to write to XDATA
-	\param start_addr	Address to begin writing at, 0x00 - 0xFFFF
-	\param len			Number of bytes to write, 0x00 - 0xFFFF
-	
-	\returns			TRUE on success, otherwise FALSE
+/** As c2_write_xdata_stream() for the EC2 and the parts without
+	DEV_CAP_XDATA_BLOCK, one queued 0x29 write per byte.
 */
-BOOL c2_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
+static BOOL c2_write_xdata_bytes( EC2DRV *obj, char *buf, int start_addr, int len )
 {
-	assert( obj->mode==C2);
-	if( obj->dev->has_external_bus )
-		return c2_write_xdata_emif( obj, buf, start_addr, len );
-	
-	if( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F350, C8051F353 ) &&
-	  	obj->dbg_adaptor==EC3 )
-		return c2_write_xdata_F35x( obj, buf, start_addr, len );
-	
-	const SFRREG LOW_ADDR_REG	= { 0x0f, 0xad };
-	const SFRREG HIGH_ADDR_REG	= { 0x0f, 0xc7 };
-	const SFRREG WRITE_BYTE_REG	= { 0x0f, 0x84 };
-	
-	// T 29 ad 01 00	R 0d
-	// T 29 c7 01 00	R 0d
-	// T 29 84 01 55	R 0d	// write 1 byte (0x55) at the curr addr then inc that addr
+	uint8_t sfrpage_save;
+	uint16_t cnt;
 	char cmd[4];
-	unsigned int i;
-	// EC2  seems to use this method rather the the bulk method used by the EC3.
-	// even for the same micro like the F350
-	// start addres ad low and high bytes
-	ec2_write_paged_sfr( obj, LOW_ADDR_REG , start_addr&0xff );
-	ec2_write_paged_sfr( obj, HIGH_ADDR_REG, (start_addr >> 8)&0xff );
+	BOOL ok=TRUE;
 	
-	// setup write command
-	for(i=0; i<len; i++)
+	sfrpage_save = xdata_stream_begin( obj, start_addr );
+	// T 29 84 01 55	R 0d	// write 1 byte then inc the address
+	cmd[0] = 0x29;
+	cmd[1] = 0x84;
+	cmd[2] = 0x01;
+	for( cnt=0; cnt<len; cnt++ )
 	{
-		if( !ec2_write_paged_sfr(obj,WRITE_BYTE_REG,buf[i]) )
-			return FALSE;
+		cmd[3] = buf[cnt];
+		ok &= ec2_queue_trx( obj, cmd, 4, "\x0d", 1 );
 	}
-	return TRUE;
+	ok &= ec2_queue_flush( obj );
+	xdata_stream_end( obj, sfrpage_save );
+	return ok;
 }
 
 
-/** Read len bytes of data from the target (C2)
-	8051F310
-	8051F350???
-	althernate function called from within for EMIF based devices.
-
-	The newer SILABS code for the F35x seems to read large blocks over USB
-	rather than byte by byte
+/** Choose the xdata and SFR block access for the adapter and device, called
+	by ec2_connect() once obj->ops holds ec2_c2_ops.
 
-	\param obj			Object to act on.
-	\param buf			Buffer to recieve data read from XDATA
-	\param start_addr	Address to begin reading from, 0x00 - 0xFFFF
-	\param len			Number of bytes to read, 0x00 - 0xFFFF
-	
-	\returns			TRUE on success, otherwise FALSE
+	Devices with an external bus go through EMIF, the rest stream the
+	EMI0ADDR data register.  The F35x SILABS code reads large blocks over
+	USB with the 0x2C / 0x2D commands, which the EC3 is only known to
+	handle for the DEV_CAP_XDATA_BLOCK parts, everything else goes byte by
+	byte.
 */
-BOOL c2_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
+void c2_select_ops( EC2DRV *obj )
 {
-	// C2 dosen't seem to need any paging like jtag mode does
-	char cmd[4];
-	unsigned int i;
-
-	if( obj->dev->has_external_bus )
-		return c2_read_xdata_emif( obj, buf, start_addr, len );
-	
-	if( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F350, C8051F353 ) &&
-		obj->dbg_adaptor==EC3 )
+	BOOL ec3 = obj->dbg_adaptor==EC3;
+	BOOL block = ec3 && obj->dev &&
+				 DEVICE_HAS_CAP( obj->dev, DEV_CAP_XDATA_BLOCK );
+	obj->ops.sfr_block = ec3 ? 0x3b : 0x0c;
+	if( obj->dev && obj->dev->has_external_bus )
 	{
-		return c2_read_xdata_F350( obj, buf, start_addr, len );
+		obj->ops.read_xdata = c2_read_xdata_emif;
+		obj->ops.write_xdata = c2_write_xdata_emif;
 	}
-	
-	// code below is for C2 devices that don't have externam memory.
-	// T 29 ad 01 10	R 0d	.// low byte of address 10 ( last byte of cmd)
-	// T 29 c7 01 01	R 0d	//  high byte of address 01 ( last byte of cmd)
-	// T 28 84 01		R 00	// read next byte (once for every byte to be read)
-
-	
-	const SFRREG addr_low_sfr = { 0x0f, 0xad };
-	const SFRREG addr_high_sfr = { 0x0f, 0xc7 };
-	const SFRREG read_ram_sfr = { 0x0f, 0x84 };
-	// low byte of start address
-	ec2_write_paged_sfr( obj, addr_low_sfr, start_addr&0xff );
-	// high byte of start address
-	ec2_write_paged_sfr( obj, addr_high_sfr, (start_addr>>8)&0xff );
-
-	// setup read command
-	for(i=0; i<len; i++)
+	else
 	{
-		buf[i] = ec2_read_paged_sfr( obj, read_ram_sfr,0 );
+		obj->ops.read_xdata = block ? c2_read_xdata_stream : c2_read_xdata_bytes;
+		obj->ops.write_xdata = block ? c2_write_xdata_stream : c2_write_xdata_bytes;
 	}
-	
-	return TRUE;
 }
 
 
@@ -772,12 +800,83 @@ void c2_write_sfr( EC2DRV *obj, uint8_t value, uint8_t addr )
 }
 
 
+/** Queue a read of len SFRs from addr in the current page (C2).
+	The reply is just the values, buf[len] is left alone.
+*/
+BOOL c2_queue_read_sfr( EC2DRV *obj, uint8_t addr, uint8_t len, char *buf )
+{
+	char cmd[3];
+	cmd[0] = 0x28;
+	cmd[1] = addr;
+	cmd[2] = len;
+	return ec2_queue_cmd( obj, cmd, 3, buf, len );
+}
+
+
+/** Queue a write to one SFR in the current page (C2).
+*/
+BOOL c2_queue_write_sfr( EC2DRV *obj, uint8_t addr, uint8_t value )
+{
+	char cmd[4];
+	cmd[0] = 0x29;
+	cmd[1] = addr;
+	cmd[2] = 0x01;
+	cmd[3] = value;
+	return ec2_queue_trx( obj, cmd, 4, "\x0D", 1 );
+}
+
+
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Target state control
 ////////////////////////////////////////////////////////////////////////////////
 
+/** Read the program counter (C2).
+*/
+uint16_t c2_read_pc( EC2DRV *obj )
+{
+	unsigned char buf[2];
+	write_port( obj, "\x28\x20\x02", 3 );
+	read_port(  obj, (char*)buf, 2 );
+	return ((buf[1]<<8) | buf[0]);
+}
+
+
+void c2_set_pc( EC2DRV *obj, uint16_t addr )
+{
+	char cmd[4];
+	cmd[0] = 0x29;
+	cmd[1] = 0x20;
+	cmd[2] = 0x01;					// len
+	cmd[3] = addr & 0xff;			// low byte addr
+	trx( obj, cmd, 4,"\x0d", 1 );
+	cmd[1] = 0x21;
+	cmd[3] = addr>>8;				// high byte
+	trx( obj, cmd, 4, "\x0d", 1 );
+}
+
+
+/** Step one instruction (C2).
+	\returns the PC after the step.
+*/
+uint16_t c2_step( EC2DRV *obj )
+{
+	trx( obj, "\x26", 1, "\x0d", 1 );
+	return c2_read_pc( obj );
+}
+
+
+/** Queue one step and a read of the PC that follows into pc (C2).
+	Uses 2 queue entries.
+*/
+void c2_queue_step( EC2DRV *obj, char *pc )
+{
+	ec2_queue_trx( obj, "\x26", 1, "\x0d", 1 );
+	ec2_queue_cmd( obj, "\x28\x20\x02", 3, pc, 2 );
+}
+
+
 /** Start the target running. (C2)
 
 	\param obj			Object to act on.
@@ -915,7 +1014,7 @@ void c2_write_breakpoints( EC2DRV *obj )
 //		printf("BP %i High = 0x%02x\n",i,obj->dev->SFR_BP_H[i]);
 //	}
 	
-	if( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F340, C8051F347 ))
+	if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_BP_ACTIVE_E5 ))
 	{
 		const SFRREG BP_ACTIVE_REG	= { 0x01, 0xe5 };
 		uint8_t active_bitmap = 0x00;
@@ -934,9 +1033,7 @@ void c2_write_breakpoints( EC2DRV *obj )
 			ec2_write_paged_sfr( obj, BP_ACTIVE_REG, active_bitmap );
 		}
 	}
-	else if(( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F920, C8051F921 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, C8051F930, C8051F931 ))||
-		( DEVICE_IN_RANGE( obj->dev->unique_id, SI1000, SI1031)))
+	else if( DEVICE_HAS_CAP( obj->dev, DEV_CAP_BP_ACTIVE_F4 ))
 	{
 		//printf("New method");
 		const SFRREG BP_ACTIVE_REG	= { 0x01, 0xf4};
@@ -981,3 +1078,82 @@ void c2_write_breakpoints( EC2DRV *obj )
 	}
 }
 
+
+
+/// xdata and sfr_block are replaced by c2_select_ops()
+const EC2_MODE_OPS ec2_c2_ops =
+{
+	"C2",
+	c2_device_id,
+	c2_unique_device_id,
+	c2_core_suspend,
+	c2_read_ram,
+	c2_read_ram_sfr,
+	c2_write_ram,
+	c2_write_sfr,
+	c2_queue_read_sfr,
+	c2_queue_write_sfr,
+	c2_read_xdata_bytes,
+	c2_write_xdata_bytes,
+	c2_read_flash,
+	c2_write_flash,
+	0,
+	c2_erase_flash,
+	c2_erase_flash_sector,
+	0,
+	c2_read_pc,
+	c2_set_pc,
+	c2_step,
+	c2_queue_step,
+	2,
+	c2_target_go,
+	c2_target_halt,
+	c2_target_halt_poll,
+	c2_target_reset,
+	c2_addBreakpoint,
+	c2_update_bp_enable_mask,
+	0x0c,
+	{
+		EC2_C2_SECTOR_ERASE_US,
+		EC2_C2_CHIP_ERASE_US,
+		EC2_C2_READ_US_PER_KB,
+		EC2_C2_WRITE_US_PER_KB
+	}
+};
+
+
+/// C2 commands, see EC2_OPCODE
+const EC2_OPCODE ec2_c2_opcodes[] =
+{
+//	  op   match     tx  data  rx       addr    flags
+	{ 0x20, -1, 0,    1, -1, -1,  1,    -1, 0,  0, "connect target", "connect" },
+	{ 0x21, -1, 0,    1, -1, -1,  1,    -1, 0,  0, "disconnect target", "disconnect" },
+	{ 0x22, -1, 0,    1, -1, -1,  3,    -1, 0,  0, "read device id", "connect" },
+	{ 0x23, -1, 0,    1, -1, -1,  3,    -1, 0,  0, "read unique id", "connect" },
+	{ 0x24, -1, 0,    1, -1, -1,  1,    -1, 0,  0, "run", "run control" },
+	{ 0x25, -1, 0,    1, -1, -1,  1,    -1, 0,  0, "halt", "run control" },
+	{ 0x26, -1, 0,    1, -1, -1,  1,    -1, 0,  0, "step", "run control" },
+	{ 0x27, -1, 0,    1, -1, -1,  2,    -1, 0,  0, "poll running", "run control" },
+	{ 0x28,  1, 0x20, 3, -1,  2,  0,    -1, 0,  0, "read PC", "run control" },
+	{ 0x28,  1, 0x84, 3, -1,  2,  0,    -1, 0,  0, "read xdata byte", "xdata read" },
+	{ 0x28, -1, 0,    3, -1,  2,  0,     1, 1,  0, "read SFR", "sfr read" },
+	{ 0x29,  1, 0x20, 3,  2, -1,  1,    -1, 0,  0, "set PC", "run control" },
+	{ 0x29,  1, 0x21, 3,  2, -1,  1,    -1, 0,  0, "set PC", "run control" },
+	{ 0x29,  1, 0x84, 3,  2, -1,  1,    -1, 0,  0, "write xdata byte", "xdata write" },
+	{ 0x29,  1, 0xad, 3,  2, -1,  1,    -1, 0,  0, "set xdata address low", 0 },
+	{ 0x29,  1, 0xc7, 3,  2, -1,  1,    -1, 0,  0, "set xdata address high", 0 },
+	{ 0x29, -1, 0,    3,  2, -1,  1,     1, 1,  0, "write SFR", "sfr write" },
+	{ 0x2a, -1, 0,    3, -1,  2,  0,     1, 1,  0, "read RAM", "ram read" },
+	{ 0x2b, -1, 0,    3,  2, -1,  1,     1, 1,  0, "write RAM", "ram write" },
+	{ 0x2c, -1, 0,    4, -1,  3,  1,    -1, 0,  0, "read xdata", "xdata read" },
+	{ 0x2d, -1, 0,    4,  3, -1,  1,    -1, 0,  0, "write xdata", "xdata write" },
+	{ 0x2e, -1, 0,    4, -1,  3,  1,     1, 2,  0, "read flash", "flash read" },
+	{ 0x2f, -1, 0,    4,  3, -1,  1,     1, 2,  0, "write flash", "flash write" },
+	{ 0x30, -1, 0,    2, -1, -1,  1,    -1, 0,  0, "erase sector", "flash erase" },
+	{ 0x36, -1, 0,    3, -1, -1,  2,     1, 1,  0, "special read", "sfr read" },
+	{ 0x37, -1, 0,    4, -1, -1,  1,     1, 1,  0, "special write", "sfr write" },
+	{ 0x3c, -1, 0,    1, -1, -1,  1,    -1, 0,  0, "erase all", "flash erase" },
+	{ 0x3e, -1, 0,    4, -1,  3,  1,     1, 2,  0, "read EMIF", "xdata read" },
+	{ 0x3f, -1, 0,    4,  3, -1,  1,     1, 2,  0, "write EMIF", "xdata write" },
+	{ 0 }
+};
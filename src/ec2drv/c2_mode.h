@@ -13,7 +13,7 @@ void c2_connect_target( EC2DRV *obj );
 void c2_disconnect_target( EC2DRV *obj );
 uint16_t c2_device_id( EC2DRV *obj );
 uint16_t c2_unique_device_id( EC2DRV *obj );
-void c2_erase_flash( EC2DRV *obj );
+BOOL c2_erase_flash( EC2DRV *obj );
 BOOL c2_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len, BOOL scratchpad );
 BOOL c2_erase_flash_sector( EC2DRV *obj, uint32_t sector_addr, BOOL scratchpad );
 BOOL c2_read_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len, BOOL scratchpad );
@@ -22,9 +22,15 @@ BOOL ec2_write_xdata_c2_emif( EC2DRV *obj, char *buf, int start_addr, int len );
 void c2_read_ram( EC2DRV *obj, char *buf, int start_addr, int len );
 void c2_read_ram_sfr( EC2DRV *obj, char *buf, int start_addr, int len, BOOL sfr );
 BOOL c2_write_ram( EC2DRV *obj, char *buf, int start_addr, int len );
-BOOL c2_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len );
-BOOL c2_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len );
 void c2_write_sfr( EC2DRV *obj, uint8_t value, uint8_t addr );
+BOOL c2_queue_read_sfr( EC2DRV *obj, uint8_t addr, uint8_t len, char *buf );
+BOOL c2_queue_write_sfr( EC2DRV *obj, uint8_t addr, uint8_t value );
+void c2_select_ops( EC2DRV *obj );
+
+uint16_t c2_read_pc( EC2DRV *obj );
+void c2_set_pc( EC2DRV *obj, uint16_t addr );
+uint16_t c2_step( EC2DRV *obj );
+void c2_queue_step( EC2DRV *obj, char *pc );
 
 BOOL c2_target_go( EC2DRV *obj );
 BOOL c2_target_halt( EC2DRV *obj );
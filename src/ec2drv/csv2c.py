@@ -10,6 +10,193 @@ import csv
 from optparse import OptionParser
 
 
+# Device quirks the driver tests for on hot paths.  Each capability is set for
+# every device whose unique id falls in one of the listed (first, last) ranges,
+# the same test DEVICE_IN_RANGE does, so the code only has to check one bit.
+CAPS = [
+	("DEV_CAP_VDDMON_FLASH",	"VDMLVL must be raised in VDDMON around flash writes",
+		[("C8051F530","C8051F537")]),
+	("DEV_CAP_F34X_FLASH",		"F34x flash write preamble",
+		[("C8051F340","C8051F347")]),
+	("DEV_CAP_FLASH_8F",		"C2 special register 0x8f selects flash / scratchpad",
+		[("C8051F920","C8051F921"),("C8051F930","C8051F931"),("SI1000","SI1031")]),
+	("DEV_CAP_BP_ACTIVE_E5",	"C2 breakpoint enable bits in SFR 0x01:0xe5",
+		[("C8051F340","C8051F347")]),
+	("DEV_CAP_BP_ACTIVE_F4",	"C2 breakpoint enable bits in SFR 0x01:0xf4",
+		[("C8051F920","C8051F921"),("C8051F930","C8051F931"),("SI1000","SI1031")]),
+	("DEV_CAP_JTAG_ADDR17",		"JTAG flash / breakpoint address registers are 17 bits",
+		[("C8051F120","C8051F133")]),
+	("DEV_CAP_F02X_XDATA",		"F02x JTAG XDATA register layout",
+		[("C8051F020","C8051F023")]),
+	("DEV_CAP_XDATA_BLOCK",		"EC3 0x2C / 0x2D block XDATA reads and writes over C2",
+		[("C8051F350","C8051F353")]),
+]
+
+
+# SFR maps, the registers of each are in the sfr_table.csv file and the map
+# of each device is its SFR Map column.  A map has the registers of its base
+# map too, and lists the SFR pages the family uses, just page 0 if it doesn't
+# page its SFRs.
+SFR_MAPS = [
+	("8051",		None,			[0x00],		"standard 8051 core"),
+	("C8051F",		"8051",			[0x00],		"common to the Silicon Labs parts"),
+	("C8051F0XX",	"C8051F",		[0x00],		"JTAG parts without SFR pages"),
+	("C8051F12X",	"C8051F0XX",	[0x00,0x01,0x02,0x03,0x0f],	"JTAG parts with SFR pages, F04x F06x F12x F13x"),
+	("C8051F3XX",	"C8051F",		[0x00],		"C2 parts without SFR pages"),
+	("C8051F35X",	"C8051F3XX",	[0x00,0x01,0x02,0x03,0x0f],	"F35x"),
+	("C8051F34X",	"C8051F3XX",	[0x00,0x01,0x02,0x03,0x0f],	"F34x"),
+	("C8051F53X",	"C8051F3XX",	[0x00,0x01,0x02,0x03,0x0f],	"F53x F92x F93x Si10xx"),
+]
+
+# map of the devices not in the table
+SFR_MAP_UNKNOWN = "C8051F"
+
+# sfr_table.csv Flags letters, bit n of SFR_INFO::flags is entry n
+SFR_FLAGS = [
+	("V",	"SFR_VOLATILE",		"changed by the hardware, never cached"),
+	("R",	"SFR_READ_SIDE",	"reads have side effects, bulk reads skip it"),
+	("W",	"SFR_WRITE_SIDE",	"writes have side effects, never held"),
+	("P",	"SFR_PAGE_REG",		"the SFR page register"),
+	("A",	"SFR_ALL_PAGES",	"in every SFR page, reached without selecting one"),
+]
+SFR_FLAG_LETTERS = "".join( [f[0] for f in SFR_FLAGS] )
+
+
+def read_sfr_maps( infile ):
+	"""Return { map: (pages, [(name, page, addr, flags)]) } with the base map
+	registers merged in, sorted by page then address."""
+	regs = {}
+	for (name, base, pages, desc) in SFR_MAPS:
+		regs[name] = []
+	for row in csv.reader( open(infile, "rb") ):
+		if len(row)==0 or row[0].startswith('#'):
+			continue
+		for f in row[4]:
+			if f not in SFR_FLAG_LETTERS:
+				sys.exit(infile+": bad flag "+f+" for "+row[1])
+		regs[row[0]].append( (row[1], int(row[2],0), int(row[3],0), row[4]) )
+	maps = {}
+	for (name, base, pages, desc) in SFR_MAPS:
+		merged = {}
+		if base:
+			for r in maps[base][1]:
+				merged[r[0]] = r
+		for r in regs[name]:
+			merged[r[0]] = r
+		sfrs = sorted( merged.values(), key=lambda r: (r[1], r[2]) )
+		for r in sfrs:
+			if r[1] not in pages or r[2]<0x80 or r[2]>0xff:
+				sys.exit(infile+": "+name+" "+r[0]+" isn't in the map's pages")
+		maps[name] = (pages, sfrs)
+	return maps
+
+
+def sfr_flags( letters ):
+	"""Return the C expression for the flags letters of a register."""
+	if letters=="":
+		return "0"
+	return "|".join( [SFR_FLAGS[SFR_FLAG_LETTERS.index(f)][1] for f in letters] )
+
+
+def write_sfr_maps( cfile, maps ):
+	"""Write the SFR_INFO list, pages and per address flags of every map and
+	the sfr_maps[] table of them, in SFR_MAPS order."""
+	for (name, base, pages, desc) in SFR_MAPS:
+		(pages, sfrs) = maps[name]
+		cfile.writelines("\n// "+desc+"\n")
+		cfile.writelines("static const SFR_INFO sfr_info_"+name+"[] =\n{\n")
+		for (reg, page, addr, letters) in sfrs:
+			cfile.writelines("\t{ \""+reg+"\",\t{ 0x%02x, 0x%02x },\t" % (page, addr)
+							 +sfr_flags(letters)+" },\n")
+		cfile.writelines("};\n")
+		cfile.writelines("static const uint8_t sfr_pages_"+name+"[] = { "+
+						 ", ".join(["0x%02x" % p for p in pages])+" };\n")
+		# flags of each address, per page and for any page
+		any = [0]*0x80
+		cfile.writelines("static const uint8_t sfr_page_flags_"+name+"[][0x80] =\n{")
+		for page in pages:
+			flags = [0]*0x80
+			for (reg, p, addr, letters) in sfrs:
+				if p==page or "A" in letters:
+					for f in letters:
+						flags[addr-0x80] |= 1<<SFR_FLAG_LETTERS.index(f)
+			for i in range(0x80):
+				any[i] |= flags[i]
+			cfile.writelines("\n\t{\t// page 0x%02x" % page)
+			for i in range(0x80):
+				if i % 16==0:
+					cfile.writelines("\n\t")
+				cfile.writelines(str(flags[i])+",")
+			cfile.writelines("\n\t},")
+		cfile.writelines("\n};\n")
+		cfile.writelines("static const uint8_t sfr_flags_"+name+"[0x80] =\n{")
+		for i in range(0x80):
+			if i % 16==0:
+				cfile.writelines("\n\t")
+			cfile.writelines(str(any[i])+",")
+		cfile.writelines("\n};\n")
+	cfile.writelines("\nconst SFR_MAP sfr_maps[] =\n{\n")
+	for (name, base, pages, desc) in SFR_MAPS:
+		(pages, sfrs) = maps[name]
+		cfile.writelines("\t{ \""+name+"\", sfr_info_"+name+", "+str(len(sfrs))+
+						 ", sfr_pages_"+name+", "+str(len(pages))+
+						 ", sfr_page_flags_"+name+", sfr_flags_"+name+" },\n")
+	cfile.writelines("\t{0}\n};\n")
+	names = [m[0] for m in SFR_MAPS]
+	cfile.writelines("const SFR_MAP * const sfr_map_unknown = &sfr_maps["+
+					 str(names.index(SFR_MAP_UNKNOWN))+"];\n\n")
+
+
+def sfr_map_index( row, maps ):
+	"""Return the index in SFR_MAPS of the map of device row, checking its
+	page register against the SFR_Page column."""
+	names = [m[0] for m in SFR_MAPS]
+	if row[34] not in names:
+		sys.exit(row[0]+": unknown SFR map "+row[34])
+	page_regs = [r[2] for r in maps[row[34]][1] if "P" in r[3]]
+	if row[20]=="TRUE":
+		ok = page_regs==[int(row[21],0)]
+	else:
+		ok = page_regs==[]
+	if not ok:
+		sys.exit(row[0]+": SFR map "+row[34]+" doesn't match the SFR page register")
+	return names.index(row[34])
+
+
+def device_caps( uid, names ):
+	"""Return the C expression for the capability bits of unique id uid."""
+	caps = []
+	for (cap, desc, ranges) in CAPS:
+		for (first, last) in ranges:
+			if names[first] <= uid <= names[last]:
+				caps.append(cap)
+				break
+	if len(caps)==0:
+		return "0"
+	return "|".join(caps)
+
+
+def write_index( cfile, name, next_name, keys ):
+	"""Write a 256 entry table giving the first device with each key and a
+	table chaining on to the next device with the same key, -1 terminated."""
+	first = [-1]*256
+	next = [-1]*len(keys)
+	for i in range(len(keys)-1, -1, -1):
+		next[i] = first[keys[i]]
+		first[keys[i]] = i
+	cfile.writelines("\nconst int16_t "+name+"[256] =\n{")
+	for i in range(256):
+		if i % 16==0:
+			cfile.writelines("\n\t")
+		cfile.writelines(str(first[i])+",")
+	cfile.writelines("\n};\n")
+	cfile.writelines("\nconst int16_t "+next_name+"[] =\n{")
+	for i in range(len(next)):
+		if i % 16==0:
+			cfile.writelines("\n\t")
+		cfile.writelines(str(next[i])+",")
+	cfile.writelines("\n};\n")
+
 
 def main():
 	usage = "usage: %prog [options] arg";
@@ -18,6 +205,7 @@ def main():
 	parser.add_option("-i", "--input-file", type="string", dest="infile")
 	parser.add_option("-c", "--output-cfile", type="string", dest="coutfile")
 	parser.add_option("-e", "--output-hfile", type="string", dest="houtfile")
+	parser.add_option("-s", "--sfr-file", type="string", dest="sfrfile")
 	(options, args) = parser.parse_args()
 	hfile = open(options.houtfile,"wb")
 	hfile.writelines(
@@ -39,10 +227,18 @@ def main():
 	"//\n" \
 	"//////////////////////////////////////////////////////////////////////////////////////////////\n\n")
 	cfile.writelines("#include \"devices.h\"\n")
+	maps = read_sfr_maps( options.sfrfile )
+	write_sfr_maps( cfile, maps )
 	cfile.writelines("DEVICE devices[] =\n")
 	reader = csv.reader( open(options.infile, "rb") )
+	rows = [row for row in reader if row[0][0]!='#']
+	names = {}
+	for row in rows:
+		names[row[0]] = int(row[2],0)
+	families = []
+	uniques = []
 	i = 0;
-	for row in reader:
+	for row in rows:
 		# Skip lines marked for exclusion
 		if row[0][0]!='#':
 			if i==0:
@@ -85,13 +281,29 @@ def main():
 							 ","+row[31]+"},\t// C2 SFRs Breakpoint low addr\n")
 			cfile.writelines("\t\t{"+row[26]+","+row[28]+","+row[30]+
 							","+row[32]+"},\t// C2 SFRs Breakpoint high addr\n")
+			cfile.writelines("\t\t"+device_caps(int(row[2],0),names)+",\t// Capabilities\n")
+			cfile.writelines("\t\t&sfr_maps["+str(sfr_map_index(row,maps))+"],\t// SFR map "+row[34]+"\n")
 			
 			cfile.writelines("\t}")
+			families.append(int(row[1],0))
+			uniques.append(int(row[2],0))
 			i+=1
 	
-	hfile.writelines("\n}DEVICE_ENUM;\n")
+	hfile.writelines("\n}DEVICE_ENUM;\n\n")
+	bit = 0
+	for (cap, desc, ranges) in CAPS:
+		hfile.writelines("#define "+cap+"\t(1UL<<"+str(bit)+")\t///< "+desc+"\n")
+		bit+=1
+	hfile.writelines("\n")
+	bit = 0
+	for (letter, flag, desc) in SFR_FLAGS:
+		hfile.writelines("#define "+flag+"\t(1<<"+str(bit)+")\t///< "+desc+"\n")
+		bit+=1
 	cfile.writelines(",\n\t{0}}\n")
 	cfile.writelines(";\n")
+	# lookup tables for getDevice() / getDeviceUnique()
+	write_index( cfile, "device_by_family", "device_family_next", families )
+	write_index( cfile, "device_by_unique", "device_unique_next", uniques )
 	cfile.close()
 
 
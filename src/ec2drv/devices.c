@@ -3,36 +3,54 @@
 
 static DEVICE unknown_dev = { "Unknown",-1,255,AUTO,0,8196,512,FALSE };
 extern DEVICE devices[];
+extern const int16_t device_by_family[256];
+extern const int16_t device_family_next[];
+extern const int16_t device_by_unique[256];
+extern const int16_t device_unique_next[];
 
 // Pick the closest device and return it.
 DEVICE *getDevice( uint8_t id, uint8_t rev )
 {
-	int i = 0;
-	printf("id=0x%02x, rev=%02x\n",id, rev);
-	do
+	int i;
+	for( i=device_by_family[id]; i>=0; i=device_family_next[i] )
 	{
-		if( (devices[i].id==id)&&(devices[i].rev==255) )
+		if( (devices[i].rev==255) || (devices[i].rev==rev) )
 			return &devices[i];
-		else if( (devices[i].id==id)&&(devices[i].rev==rev) )
-			return &devices[i];
-	} while( devices[++i].name[0] != 0 );
-	
+	}
 	return &unknown_dev;
 }
 
 
 DEVICE *getDeviceUnique( uint8_t unique_id, uint8_t rev )
 {
-	int i=0;
-	printf("unique_id=0x%02x, rev=%02x\n",unique_id, rev);
-	do
+	int i;
+	for( i=device_by_unique[unique_id]; i>=0; i=device_unique_next[i] )
 	{
-		if( (devices[i].unique_id==unique_id)&&(devices[i].rev==255) )
-			return &devices[i];
-		else if( (devices[i].unique_id==unique_id)&&(devices[i].rev==rev) )
+		if( (devices[i].rev==255) || (devices[i].rev==rev) )
 			return &devices[i];
-	} while( devices[++i].name[0] != 0 );
-	
+	}
 	return &unknown_dev;
 }
 
+
+/** The SFR map of dev, the one common to the C8051F parts if it has none.
+*/
+const SFR_MAP *getSfrMap( const DEVICE *dev )
+{
+	return dev && dev->sfr_map ? dev->sfr_map : sfr_map_unknown;
+}
+
+/** The SFR_xxx flags of every address in one SFR page of dev.
+	\returns 0 if the device doesn't use the page.
+*/
+const uint8_t *getSfrPageFlags( const DEVICE *dev, uint8_t page )
+{
+	const SFR_MAP *map = getSfrMap( dev );
+	int i;
+	for( i=0; i<map->page_count; i++ )
+	{
+		if( map->pages[i]==page )
+			return map->page_flags[i];
+	}
+	return 0;
+}
@@ -5,6 +5,33 @@
 #include "ec2types.h"
 
 
+/** A named SFR of an SFR_MAP, generated from sfr_table.csv.
+*/
+typedef struct
+{
+	const char	*name;
+	SFRREG		reg;
+	uint8_t		flags;		///< SFR_xxx bits, see device_enum.h
+} SFR_INFO;
+
+/** The SFRs of one device family, generated from sfr_table.csv.
+	The flags tables give the SFR_xxx bits of every address 0x80 - 0xFF so
+	the driver and debugger can test a register without searching sfrs.
+*/
+typedef struct
+{
+	const char		*name;			///< family, eg "C8051F12X"
+	const SFR_INFO	*sfrs;			///< by page then address
+	uint16_t		sfr_count;
+	const uint8_t	*pages;			///< SFR pages used, only page 0 if not paged
+	uint8_t			page_count;
+	const uint8_t	(*page_flags)[0x80];	///< flags in each of pages
+	const uint8_t	*flags;			///< flags in any page
+} SFR_MAP;
+
+extern const SFR_MAP sfr_maps[];
+extern const SFR_MAP * const sfr_map_unknown;	///< for devices not in the table
+
 
 typedef struct
 {
@@ -44,12 +71,23 @@ typedef struct
 	const SFRREG SFR_BP_L[4];		// SFR low addr part of Breakpoint
 	const SFRREG SFR_BP_H[4];		// SFR high addr part of bp + active bit
 #endif
+	uint32_t	caps;		// DEV_CAP_xxx quirk bits, see device_enum.h
+	const SFR_MAP	*sfr_map;	// 0 for an unknown device, see getSfrMap()
 } DEVICE;
 
 DEVICE *getDevice( uint8_t id, uint8_t rev );
 DEVICE *getDeviceUnique( uint8_t unique_id, uint8_t rev );
 
 
+/// TRUE if the device has all the DEV_CAP_xxx bits in cap.
+#define DEVICE_HAS_CAP( dev, cap )	(((dev)->caps & (cap))==(cap))
+
+const SFR_MAP *getSfrMap( const DEVICE *dev );
+const uint8_t *getSfrPageFlags( const DEVICE *dev, uint8_t page );
+
+/// SFR_xxx flags of SFR addr in any page of the device.
+#define DEVICE_SFR_FLAGS( dev, addr )	(getSfrMap( dev )->flags[(addr) & 0x7f])
+
 #define DEVICE_IN_RANGE( uid, start_uid, end_uid )	\
 	(((uid)>=(start_uid)) && ((uid)<=(end_uid)))
 
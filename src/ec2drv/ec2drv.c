@@ -29,11 +29,15 @@
 #include <errno.h>			// Error number definitions
 #include <termios.h>		// POSIX terminal control definitions
 #include <sys/ioctl.h>
+#include <sys/time.h>
+#include <time.h>
 #include "ec2drv.h"
 #include "config.h"
 #include "boot.h"
 #include "c2_mode.h"
 #include "jtag_mode.h"
+#include "usb_async.h"
+#include "flashcache.h"
 
 #include <usb.h>			// Libusb header
 #include <sys/ioctl.h>
@@ -56,10 +60,25 @@ static void	init_ec2( EC2DRV *obj );
 static void	print_buf( char *buf, int len );
 static int	getNextBPIdx( EC2DRV *obj );
 static int	getBP( EC2DRV *obj, uint32_t addr );
+static int	getInactiveBP( EC2DRV *obj, uint32_t addr );
 static BOOL	setBpMask( EC2DRV *obj, int bp, BOOL active );
 
 inline static void update_progress( EC2DRV *obj, uint8_t percent );
 static uint8_t sfr_fixup( uint8_t addr );
+static BOOL queue_read_sfr( EC2DRV *obj, uint8_t addr, char *buf );
+static BOOL queue_write_sfr( EC2DRV *obj, uint8_t addr, uint8_t value );
+static void init_lock( EC2DRV *obj );
+static BOOL run_bp_stopped( void *ctx );
+static void save_profile( EC2DRV *obj, uint16_t idrev );
+static BOOL profile_mismatch( EC2DRV *obj, EC2_MODE req_mode );
+static void sfr_page_forget( EC2DRV *obj );
+static BOOL queue_sfr_page( EC2DRV *obj, uint8_t page, char *saved );
+static BOOL in_all_pages( EC2DRV *obj, uint8_t addr );
+static void sfr_page_selected( EC2DRV *obj, uint8_t page, char *saved, BOOL ok );
+static void sfr_page_written( EC2DRV *obj, uint8_t value );
+static void select_ops( EC2DRV *obj );
+static BOOL connect_debugger( EC2DRV *obj, const char *port );
+static BOOL daemon_attach( EC2DRV *obj, const EC2D_SESSION *s );
 
 BOOL ec2_write_flash_jtag( EC2DRV *obj, char *buf,
 						   uint32_t start_addr, uint32_t len );
@@ -67,23 +86,44 @@ uint16_t device_id( EC2DRV *obj );
 
 static BOOL check_flash_range( EC2DRV *obj, uint32_t addr, int len );
 static BOOL check_scratchpad_range( EC2DRV *obj, uint32_t addr, uint32_t len );
+static BOOL chip_erase_faster( EC2DRV *obj, const uint8_t *erase, int nsec );
+static BOOL erase_sectors( EC2DRV *obj, const uint8_t *erase, int nsec );
 
 /** Suspend the target core.
 	\param obj			Object to act on.
 */
 void ec2_core_suspend( EC2DRV *obj )
 {
-	if( obj->mode==JTAG )
-		jtag_core_suspend(obj);
-	else if( obj->mode==C2 )
-		c2_core_suspend(obj);
+	ec2_lock( obj );
+	obj->ops.core_suspend( obj );
+	ec2_unlock( obj );
 }
 
 // PORT support
+static BOOL select_transport( EC2DRV *obj, const char **port );
 static BOOL open_port( EC2DRV *obj, const char *port );
-static void rx_flush( EC2DRV *obj );
-static void tx_flush( EC2DRV *obj );
 static void close_port( EC2DRV *obj );
+static void stats_tx( EC2DRV *obj, char *buf, int len );
+static void stats_rx( EC2DRV *obj, int len, BOOL ok );
+static void trace_rx( EC2DRV *obj, char *buf, int len, BOOL ok );
+
+/** Receive side state for the serial EC2.
+*/
+typedef struct
+{
+	char	buf[256];		///< bytes read from the port but not yet used
+	int		head;
+	int		count;
+	BOOL	stale;			///< TRUE when the kernel buffers need flushing
+} SERIAL_STATE;
+
+static BOOL serial_open( EC2DRV *obj, const char *port );
+static void serial_close( EC2DRV *obj );
+static BOOL serial_write( EC2DRV *obj, char *buf, int len );
+static BOOL serial_read( EC2DRV *obj, char *buf, int len );
+static BOOL serial_read_timeout( EC2DRV *obj, char *buf, int len, uint32_t ms );
+static void serial_flush( EC2DRV *obj );
+static void serial_reset( EC2DRV *obj );
 static void DTR( EC2DRV *obj, BOOL on );
 static void RTS( EC2DRV *obj, BOOL on );
 
@@ -91,10 +131,10 @@ static void RTS( EC2DRV *obj, BOOL on );
 static BOOL open_ec3( EC2DRV *obj, const char *port );
 static void close_ec3( EC2DRV *obj );
 static BOOL write_usb( EC2DRV *obj, char *buf, int len );
-static BOOL write_usb_ch( EC2DRV *obj, char ch );
+static BOOL write_usb_pkt( EC2DRV *obj, char *pkt, int len );
 static BOOL read_usb( EC2DRV *obj, char *buf, int len );
-static int read_usb_ch( EC2DRV *obj );
-void close_ec3( EC2DRV *obj );
+static BOOL read_usb_tm( EC2DRV *obj, char *buf, int len, uint32_t ms );
+static void flush_usb( EC2DRV *obj );
 
 
 
@@ -142,14 +182,40 @@ static DBG_ADAPTER_INFO debugger_info[] =
   *				or "/dev/ttyUSB0" for an EC2 on a USB-serial converter
   *				or USB for an EC3, or to specify an exact device USB::XXXXXXXX
   *				where XXXXXXXX is the device serial number.
+  *				or EC2D / EC2D:<one of these> for an adapter held by ec2d.
   * \returns TRUE on success
   */
 BOOL ec2_connect( EC2DRV *obj, const char *port )
+{
+	EC2D_SESSION s;
+	const char *dir;
+	if( !connect_debugger( obj, port ) )
+		return FALSE;
+	// what the next ec2d client needs to take over from us
+	if( ec2_daemon_session( obj, &s ) )
+	{
+		s.connected = 1;
+		s.mode = obj->mode;
+		s.fw_ver = obj->fw_ver;
+		s.unique_id = obj->dev->unique_id;
+		ec2_daemon_set_session( obj, &s );
+		ec2_daemon_remote_ops( obj );
+	}
+	dir = getenv("EC2_FLASH_CACHE");
+	if( dir && *dir )
+		ec2_flash_cache_open( obj, dir );
+	return TRUE;
+}
+
+static BOOL connect_debugger( EC2DRV *obj, const char *port )
 {
 	DUMP_FUNC();
-	int debugger_sw_ver;
+	int debugger_sw_ver, i;
 	const char *lport = port;
 	uint16_t idrev;
+	EC2_CONN_PROFILE *prof;
+	EC2_MODE req_mode = obj->mode;
+	EC2D_SESSION sess;
 	
 	if( !port || strlen(port)==0 )
 	{
@@ -172,24 +238,24 @@ BOOL ec2_connect( EC2DRV *obj, const char *port )
 	
 	obj->progress = 0;
 	obj->progress_cbk = 0;
-	if( strncmp(lport,"USB",3)==0 )
-	{
-		// USB mode, EC3
-		obj->dbg_adaptor = EC3;
-		if( lport[3]==':' )
-		{
-			lport = lport+4;	// point to the remainder ( hopefully the serial number of the adaptor )
-		}
-		else if( strlen(lport)==3 )
-		{
-			lport = 0;
-		}
-		else
-			return FALSE;
-	}
-	else
-		obj->dbg_adaptor = EC2;
-	
+	obj->queue_len = 0;
+	obj->ec3_async = 0;
+	obj->c2_read_block = 0;
+	obj->flash_access = 0;
+	obj->flash_access_ready = FALSE;
+	obj->sfr_page_cur = -1;
+	obj->sfr_page_user = -1;
+	obj->flash_fail_addr = -1;
+	obj->bp_flags = 0;
+	for( i=0; i<4; i++ )
+		obj->bpaddr[i] = EC2_BP_ADDR_UNKNOWN;	// nothing known to reuse
+	obj->record_log = 0;
+	obj->flash_cache = 0;
+	obj->fw_ver = 0;
+	init_lock( obj );
+	ec2_reset_stats( obj );
+	if( !select_transport( obj, &lport ) )
+		return FALSE;
 	
 	if( !open_port( obj, lport) )
 	{
@@ -197,9 +263,38 @@ BOOL ec2_connect( EC2DRV *obj, const char *port )
 		return FALSE;
 	}
 	obj->connected=TRUE;
+	if( ec2_daemon_session( obj, &sess ) && sess.connected )
+	{
+		if( daemon_attach( obj, &sess ) )
+			return TRUE;
+		// start again from an adapter the daemon has reset
+		printf("Target differs from the one ec2d held, running full detection\n");
+		sess.connected = 0;
+		ec2_daemon_set_session( obj, &sess );
+		ec2_disconnect( obj );
+		obj->mode = req_mode;
+		return ec2_connect( obj, obj->port );
+	}
+	prof = obj->profile;
+	if( prof && prof->valid && strcmp( prof->port, obj->port )==0 &&
+		(obj->mode==AUTO || obj->mode==prof->mode) )
+	{
+		req_mode = obj->mode;
+		obj->mode = prof->mode;
+	}
+	else
+		prof = 0;
 	// call new jtag init
 	if(obj->mode==JTAG)
-		return ec2_connect_jtag( obj, port );
+	{
+		select_ops( obj );
+		if( !ec2_connect_jtag( obj, port ) )
+			return FALSE;
+		if( prof && obj->dev!=prof->dev )
+			return profile_mismatch( obj, req_mode );
+		save_profile( obj, device_id( obj ) );
+		return TRUE;
+	}
 	ec2_reset( obj );
 	if( obj->dbg_adaptor==EC2 )
 	{
@@ -219,6 +314,7 @@ BOOL ec2_connect( EC2DRV *obj, const char *port )
 	if( obj->dbg_info->has_bootloader )
 	{
 		debugger_sw_ver = boot_run_app(obj);
+		obj->fw_ver = debugger_sw_ver;
 	
 		printf( "%s firmware version = 0x%02x\n",
 				obj->dbg_info->name,
@@ -248,6 +344,20 @@ BOOL ec2_connect( EC2DRV *obj, const char *port )
 		printf("%s debugger, no version information\n",obj->dbg_info->name);
 		obj->mode=C2;	// all knowen toolsticks are C2.
 	}
+	select_ops( obj );		// C2 until we know better, the device comes later
+	
+	if( prof )
+	{
+		// known adapter / target pair, just make sure it's still the same chip
+		c2_connect_target(obj);
+		idrev = device_id( obj );
+		if( idrev!=prof->idrev )
+			return profile_mismatch( obj, req_mode );
+		obj->dev = prof->dev;
+		select_ops( obj );
+		ec2_target_reset( obj );
+		return TRUE;
+	}
 	
 	if( obj->mode==AUTO )
 	{
@@ -287,41 +397,136 @@ BOOL ec2_connect( EC2DRV *obj, const char *port )
 		}
 		obj->dev = getDevice( idrev>>8, idrev&0xFF );
 		obj->dev = getDeviceUnique( unique_device_id(obj), 0);
+		select_ops( obj );
+		save_profile( obj, idrev );
 		ec2_target_reset( obj );
 		return TRUE;
 	}
 	obj->dev = getDevice( idrev>>8, idrev&0xFF );
 	obj->dev = getDeviceUnique( unique_device_id(obj), 0);
+	select_ops( obj );
+	save_profile( obj, idrev );
+	ec2_target_reset( obj );
+	return TRUE;
+}
+
+
+/** Take over an adapter and target that an earlier ec2d client left
+	connected.  Only the device id is read back to check the target, the
+	breakpoints the last client may have left are cleared and the target
+	reset as a full connect would.
+	\returns FALSE if the target isn't the one recorded in the session.
+*/
+static BOOL daemon_attach( EC2DRV *obj, const EC2D_SESSION *s )
+{
+	DEVICE *dev = getDeviceUnique( s->unique_id, 0 );
+	if( !dev || (obj->mode!=AUTO && obj->mode!=s->mode) )
+		return FALSE;
+	obj->mode = s->mode;
+	obj->fw_ver = s->fw_ver;
+	obj->dev = dev;
+	select_ops( obj );
+	if( (device_id( obj )>>8)!=dev->id )
+		return FALSE;
+	printf( "%s firmware version = 0x%02x, held by ec2d\n",
+			obj->dbg_info->name, obj->fw_ver );
+	ec2_clear_all_bp( obj );
 	ec2_target_reset( obj );
 	return TRUE;
 }
 
 
+/** Set up an adapter opened with ec2_open_adapter() to run operations for
+	the target an ec2d client has connected to through it, see EC2D_CALL.
+	Nothing is sent to the adapter, the client has done the connect.
+	\param obj			Adapter to set up.
+	\param s			Session the client reported with EC2D_TARGET.
+	\returns			FALSE if the target isn't a known device.
+*/
+BOOL ec2_adopt_target( EC2DRV *obj, const EC2D_SESSION *s )
+{
+	DEVICE *dev = getDeviceUnique( s->unique_id, 0 );
+	if( !dev || !s->connected )
+		return FALSE;
+	obj->mode = s->mode;
+	obj->fw_ver = s->fw_ver;
+	obj->dev = dev;
+	obj->c2_read_block = 0;
+	obj->flash_access = 0;
+	obj->flash_access_ready = FALSE;
+	obj->sfr_page_cur = -1;
+	obj->sfr_page_user = -1;
+	obj->flash_fail_addr = -1;
+	if( !obj->lock_ready )
+		init_lock( obj );
+	select_ops( obj );
+	obj->connected = TRUE;
+	return TRUE;
+}
+
+
+/** Set up obj->ops for the mode, adapter and device now known.
+	Called again as ec2_connect() learns more, an unresolved AUTO mode
+	gets the C2 operations as that is what detection tries first.
+*/
+static void select_ops( EC2DRV *obj )
+{
+	if( obj->mode==JTAG )
+		obj->ops = ec2_jtag_ops;
+	else
+	{
+		obj->ops = ec2_c2_ops;
+		c2_select_ops( obj );
+	}
+}
+
+
+/** Record the result of a full connect in obj->profile, if there is one.
+*/
+static void save_profile( EC2DRV *obj, uint16_t idrev )
+{
+	EC2_CONN_PROFILE *prof = obj->profile;
+	if( !prof )
+		return;
+	strncpy( prof->port, obj->port, sizeof(prof->port) );
+	prof->mode = obj->mode;
+	prof->idrev = idrev;
+	prof->dev = obj->dev;
+	prof->valid = TRUE;
+}
+
+
+/** The target doesn't match the cached profile, drop it and start again with
+	full detection.
+*/
+static BOOL profile_mismatch( EC2DRV *obj, EC2_MODE req_mode )
+{
+	printf("Target differs from cached profile, running full detection\n");
+	obj->profile->valid = FALSE;
+	ec2_disconnect( obj );
+	obj->mode = req_mode;
+	return ec2_connect( obj, obj->port );
+}
+
+
 BOOL ec2_connect_fw_update( EC2DRV *obj, char *port )
 {
 	DUMP_FUNC();
 
 	obj->progress = 0;
 	obj->progress_cbk = 0;
-	if( strncmp(port,"USB",3)==0 )
-	{
-		// USB mode, EC3
-		obj->dbg_adaptor = EC3;
-		if( port[3]==':' )
-		{
-			// get the rest of the string
-			port = port+4;	// point to the remainder ( hopefully the serial number of the adaptor )
-		}
-		else if( strlen(port)==3 )
-		{
-			port = 0;
-		}
-		else
-			return FALSE;
-	}
-	else
-		obj->dbg_adaptor = EC2;
-	
+	obj->queue_len = 0;
+	obj->ec3_async = 0;
+	obj->c2_read_block = 0;
+	obj->flash_access = 0;
+	obj->flash_access_ready = FALSE;
+	obj->sfr_page_cur = -1;
+	obj->sfr_page_user = -1;
+	obj->flash_fail_addr = -1;
+	obj->record_log = 0;
+	init_lock( obj );
+	if( !select_transport( obj, (const char**)&port ) )
+		return FALSE;
 	
 	if( !open_port( obj, port) )
 	{
@@ -338,17 +543,47 @@ BOOL ec2_connect_fw_update( EC2DRV *obj, char *port )
 }
 
 
+/** Open the port to a debug adapter without talking to it.
+	For ec2d, its clients then connect through it with the daemon
+	transport.
+	\param port	as for ec2_connect(), except EC2D
+	\returns TRUE on success
+*/
+BOOL ec2_open_adapter( EC2DRV *obj, const char *port )
+{
+	obj->progress = 0;
+	obj->progress_cbk = 0;
+	obj->queue_len = 0;
+	obj->ec3_async = 0;
+	obj->record_log = 0;
+	strncpy( obj->port, port, sizeof(obj->port) );
+	ec2_reset_stats( obj );
+	if( !select_transport( obj, &port ) ||
+		obj->transport==&ec2_daemon_transport )
+		return FALSE;
+	return open_port( obj, port );
+}
+
+
+/** Close a port opened with ec2_open_adapter().
+*/
+void ec2_close_adapter( EC2DRV *obj )
+{
+	close_port( obj );
+	obj->connected = FALSE;
+	if( obj->lock_ready )
+	{
+		obj->lock_ready = FALSE;
+		pthread_mutex_destroy( &obj->lock );
+	}
+}
+
+
 // identify the device, id = upper 8 bites, rev = lower 9 bits
 uint16_t device_id( EC2DRV *obj )
 {
 	DUMP_FUNC();
-	uint16_t idrev = 0;
-	
-	if( obj->mode==C2 )
-		idrev = c2_device_id(obj);
-	else if( obj->mode==JTAG )
-		idrev = jtag_device_id(obj);
-	return idrev;
+	return obj->ops.device_id( obj );
 }
 
 
@@ -356,14 +591,7 @@ uint16_t device_id( EC2DRV *obj )
 uint16_t unique_device_id( EC2DRV *obj )
 {
 	DUMP_FUNC();
-	uint16_t unique_id=0xffff;	// invalid
-	if( obj->mode==C2 )
-		unique_id = c2_unique_device_id(obj);
-	else if( obj->mode==JTAG )
-		unique_id = jtag_unique_device_id(obj);
-	
-	DUMP_FUNC_END();
-	return unique_id;
+	return obj->ops.unique_device_id( obj );
 }
 
 /** Disconnect from the EC2/EC3 releasing the serial port.
@@ -379,28 +607,23 @@ void ec2_disconnect( EC2DRV *obj )
 	
 	if( obj->connected==TRUE )
 	{
+		ec2_flash_cache_close( obj );
+		ec2_sfr_page_sync( obj );
 		obj->connected = FALSE;
-		if( obj->dbg_adaptor==EC3)
+		if( obj->transport==&ec2_daemon_transport )
+			ec2_daemon_keep( obj );		// adapter and target stay connected
+		else if( obj->dbg_adaptor==EC3)
 		{
-			char buf[255];
-			int r;
-	
 			c2_disconnect_target(obj);
-			write_usb_ch(obj, 0xff);	// turn off debugger
-			r = usb_release_interface(obj->ec3, 0);
-			//assert(r == 0);
-			usb_reset(obj->ec3);
-			r = usb_close( obj->ec3);
-			//assert(r == 0);
-			DUMP_FUNC_END();
-			return;
-		}
-		else if( obj->dbg_adaptor==EC2)
-		{
-			DTR( obj, FALSE );
+			write_port_ch(obj, 0xff);	// turn off debugger
 		}
 		close_port( obj );
 	}
+	if( obj->lock_ready )
+	{
+		obj->lock_ready = FALSE;
+		pthread_mutex_destroy( &obj->lock );
+	}
 	DUMP_FUNC_END();
 }
 
@@ -417,7 +640,6 @@ void ec2_disconnect( EC2DRV *obj )
 */
 static uint8_t sfr_fixup( uint8_t addr )
 {
-	DUMP_FUNC();
 	switch( addr )
 	{
 		case 0xa9:	return 0x2b;	// CKLSEL
@@ -483,10 +705,12 @@ void ec2_write_sfr( EC2DRV *obj, uint8_t value, uint8_t addr )
 		addr = 0x80;
 	}
 
-	if( obj->mode==JTAG )
-		jtag_write_sfr( obj, value, sfr_fixup( addr ) );
-	else if( obj->mode==C2 )
-		c2_write_sfr( obj, value, sfr_fixup( addr ) );
+	ec2_lock( obj );
+	ec2_sfr_page_sync( obj );
+	obj->ops.write_sfr( obj, value, sfr_fixup( addr ) );
+	if( obj->dev->has_paged_sfr && addr==obj->dev->sfr_page_reg )
+		sfr_page_written( obj, value );
+	ec2_unlock( obj );
 	DUMP_FUNC_END();
 }
 
@@ -505,22 +729,37 @@ void ec2_write_sfr( EC2DRV *obj, uint8_t value, uint8_t addr )
 */
 uint8_t ec2_read_paged_sfr( EC2DRV *obj, SFRREG sfr_reg, BOOL *ok )
 {
-	uint8_t cur_page = 0, value;
+	char cur_page[2], value[2];
+	BOOL r;
 	
-	// Save page register and set new page
-	if( obj->dev->has_paged_sfr )
+	if( !obj->dev->has_paged_sfr )
+		return ec2_read_raw_sfr( obj, sfr_reg.addr, ok );
+	if( sfr_reg.addr<0x80 )
 	{
-		cur_page = ec2_read_raw_sfr( obj, obj->dev->sfr_page_reg, 0 );
-		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, sfr_reg.page );
+		if(ok)	*ok = FALSE;
+		return 0;
 	}
 	
-	value = ec2_read_raw_sfr( obj, sfr_reg.addr, ok );
+	ec2_lock( obj );
+	if( in_all_pages( obj, sfr_reg.addr ) )
+	{
+		// whichever page is selected will do
+		r  = queue_read_sfr( obj, sfr_reg.addr, value );
+		r &= ec2_queue_flush( obj );
+		ec2_unlock( obj );
+		if(ok)	*ok = r;
+		return value[0];
+	}
+	// Select the page if needed and read in one batch, the page register is
+	// put back by ec2_sfr_page_sync()
+	r  = queue_sfr_page( obj, sfr_reg.page, cur_page );
+	r &= queue_read_sfr( obj, sfr_reg.addr, value );
+	r &= ec2_queue_flush( obj );
+	sfr_page_selected( obj, sfr_reg.page, cur_page, r );
+	ec2_unlock( obj );
 	
-	// Restore page register
-	if( obj->dev->has_paged_sfr )
-		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, cur_page );
-
-	return value;
+	if(ok)	*ok = r;
+	return value[0];
 }
 
 /**	Write to  a paged Special function register.
@@ -532,23 +771,225 @@ uint8_t ec2_read_paged_sfr( EC2DRV *obj, SFRREG sfr_reg, BOOL *ok )
  */
 BOOL ec2_write_paged_sfr(EC2DRV *obj, SFRREG sfr_reg, uint8_t value)
 {
-	uint8_t cur_page = 0;
-	BOOL result;
+	char cur_page[2];
+	BOOL r;
+	
+	if( !obj->dev->has_paged_sfr )
+		return ec2_write_raw_sfr( obj, sfr_reg.addr, value );
+	if( sfr_reg.addr<0x80 )
+		return FALSE;
 	
-	// Save page register and set new page
-	if( obj->dev->has_paged_sfr )
+	ec2_lock( obj );
+	if( in_all_pages( obj, sfr_reg.addr ) )
 	{
-		cur_page = ec2_read_raw_sfr( obj, obj->dev->sfr_page_reg, 0 );
-		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, sfr_reg.page );
+		r  = queue_write_sfr( obj, sfr_reg.addr, value );
+		r &= ec2_queue_flush( obj );
+		ec2_unlock( obj );
+		return TRUE;
 	}
+	// Select the page if needed and write in one batch
+	r  = queue_sfr_page( obj, sfr_reg.page, cur_page );
+	r &= queue_write_sfr( obj, sfr_reg.addr, value );
+	r &= ec2_queue_flush( obj );
+	sfr_page_selected( obj, sfr_reg.page, cur_page, r );
+	if( sfr_reg.addr==obj->dev->sfr_page_reg )
+		sfr_page_written( obj, value );
+	ec2_unlock( obj );
 	
-	result = ec2_write_raw_sfr( obj, sfr_reg.addr, value );
-	
-	// Restore page register
-	if( obj->dev->has_paged_sfr )
-		ec2_write_raw_sfr( obj, obj->dev->sfr_page_reg, cur_page );
-	
-	return result;
+	return TRUE;
+}
+
+
+/** Read all 128 SFRs of one page.
+	The registers are read in blocks as large as the adapter allows, the few
+	that need a different access address (see sfr_fixup()) are read
+	separately in the same batch.  Registers whose reads have side effects
+	in the device's SFR map (SFR_READ_SIDE), eg a FIFO, aren't read and are
+	left 0xff.  On paged devices the page is selected as for
+	ec2_read_paged_sfr(), otherwise page is ignored.
+
+	\param[in]	obj		EC2 object to operate on
+	\param[in]	page	Page to read
+	\param[out]	buf		Receives SFRs 0x80 - 0xFF, 128 bytes
+	\returns			TRUE on success
+*/
+BOOL ec2_read_sfr_page_bulk( EC2DRV *obj, uint8_t page, uint8_t *buf )
+{
+	static const uint8_t fixups[] = { 0x82, 0x83, 0xa9, 0xd0, 0xe0 };
+	char tmp[0x80*2];					// room for a terminator per read
+	char fix[sizeof(fixups)][2];
+	char cur_page[2];
+	uint8_t start[0x80], cnt[0x80];
+	uint8_t block = obj->ops.sfr_block;
+	BOOL paged = obj->dev->has_paged_sfr;
+	const uint8_t *flags = getSfrPageFlags( obj->dev, paged ? page : 0 );
+	int i, n, reads = 0, pos;
+	BOOL r = TRUE;
+
+	memset( tmp, 0xff, sizeof(tmp) );		// what a failed read leaves
+	memset( buf, 0xff, 0x80 );
+	ec2_lock( obj );
+	if( paged )
+		r &= queue_sfr_page( obj, page, cur_page );
+	else
+		ec2_sfr_page_sync( obj );
+	for( i=0, pos=0; i<0x80; )
+	{
+		if( flags && (flags[i] & SFR_READ_SIDE) )
+		{
+			i++;
+			continue;
+		}
+		// the run up to the next register that mustn't be read
+		for( n=1; i+n<0x80 && n<block &&
+			 !(flags && (flags[i+n] & SFR_READ_SIDE)); n++ )
+			;
+		start[reads] = i;
+		cnt[reads] = n;
+		r &= obj->ops.queue_read_sfr( obj, 0x80+i, n, tmp+pos );
+		reads++;
+		pos += n+1;
+		i += n;
+	}
+	for( n=0; n<sizeof(fixups); n++ )
+		r &= queue_read_sfr( obj, fixups[n], fix[n] );
+	r &= ec2_queue_flush( obj );
+	if( paged )
+		sfr_page_selected( obj, page, cur_page, r );
+	ec2_unlock( obj );
+
+	for( i=0, pos=0; i<reads; i++ )
+	{
+		memcpy( buf+start[i], tmp+pos, cnt[i] );
+		pos += cnt[i]+1;
+	}
+	for( n=0; n<sizeof(fixups); n++ )
+		buf[fixups[n]-0x80] = fix[n][0];
+	return r;
+}
+
+
+/** Put back the SFR page the target program had selected.
+	Paged SFR accesses leave the page they used selected so a run of
+	accesses to the same page only switches once, the original page is
+	restored here.  This is done automatically before the target is run or
+	stepped and before any access to the current page (ec2_read_sfr(),
+	ec2_write_sfr() ...), call it directly at the end of a batch if the
+	target page register must be correct straight away.
+
+	\param obj		EC2 object to operate on
+	\returns		TRUE on success
+*/
+BOOL ec2_sfr_page_sync( EC2DRV *obj )
+{
+	BOOL r = TRUE;
+	ec2_lock( obj );
+	if( obj->sfr_page_user>=0 )
+	{
+		if( obj->sfr_page_user!=obj->sfr_page_cur )
+		{
+			r  = queue_write_sfr( obj, obj->dev->sfr_page_reg, obj->sfr_page_user );
+			r &= ec2_queue_flush( obj );
+		}
+		obj->sfr_page_cur = r ? obj->sfr_page_user : -1;
+		obj->sfr_page_user = -1;
+	}
+	ec2_unlock( obj );
+	return r;
+}
+
+
+/** Restore the SFR page and forget it, for when the target is about to run
+	and may change the page itself.
+*/
+static void sfr_page_forget( EC2DRV *obj )
+{
+	ec2_sfr_page_sync( obj );
+	obj->sfr_page_cur = -1;
+}
+
+
+/** TRUE if addr is a register in every SFR page of the device, other than
+	the page register, so it can be reached without selecting a page.
+*/
+static BOOL in_all_pages( EC2DRV *obj, uint8_t addr )
+{
+	return (DEVICE_SFR_FLAGS( obj->dev, addr ) &
+			(SFR_ALL_PAGES|SFR_PAGE_REG))==SFR_ALL_PAGES;
+}
+
+
+/** Queue selecting an SFR page, only writing the page register when it
+	changes.  When the current page isn't known it is read into saved (2 bytes)
+	so it can be restored later.  Call sfr_page_selected() after the flush.
+*/
+static BOOL queue_sfr_page( EC2DRV *obj, uint8_t page, char *saved )
+{
+	BOOL r = TRUE;
+	if( obj->sfr_page_cur<0 )
+	{
+		r &= queue_read_sfr( obj, obj->dev->sfr_page_reg, saved );
+		r &= queue_write_sfr( obj, obj->dev->sfr_page_reg, page );
+	}
+	else
+	{
+		if( obj->sfr_page_user<0 )
+			obj->sfr_page_user = obj->sfr_page_cur;
+		if( obj->sfr_page_cur!=page )
+			r &= queue_write_sfr( obj, obj->dev->sfr_page_reg, page );
+	}
+	return r;
+}
+
+
+/** Update the page tracking once a queue_sfr_page() batch has been flushed.
+*/
+static void sfr_page_selected( EC2DRV *obj, uint8_t page, char *saved, BOOL ok )
+{
+	if( !ok )
+	{
+		obj->sfr_page_cur = -1;		// no idea what state it was left in
+		return;
+	}
+	if( obj->sfr_page_cur<0 && obj->sfr_page_user<0 )
+		obj->sfr_page_user = (uint8_t)saved[0];
+	obj->sfr_page_cur = page;
+}
+
+
+/** The page register has been written with value, that is now the page the
+	target program sees.
+*/
+static void sfr_page_written( EC2DRV *obj, uint8_t value )
+{
+	obj->sfr_page_cur = value;
+	obj->sfr_page_user = -1;
+}
+
+
+/** Queue a read of one SFR in the current page.
+	The reply is stored in buf which must have room for 2 bytes, the value
+	being placed in buf[0].  Nothing is sent until ec2_queue_flush().
+	\param[in]	obj		EC2 object to operate on
+	\param[in]	addr	Register address (0x80-0xFF)
+	\param[out]	buf		Receives the value on flush
+	\returns			TRUE if the command was queued
+ */
+static BOOL queue_read_sfr( EC2DRV *obj, uint8_t addr, char *buf )
+{
+	return obj->ops.queue_read_sfr( obj, sfr_fixup( addr ), 1, buf );
+}
+
+/** Queue a write to one SFR in the current page.
+	Nothing is sent until ec2_queue_flush().
+	\param[in]	obj		EC2 object to operate on
+	\param[in]	addr	Register address (0x80-0xFF)
+	\param[in]	value	Value to write to register (0-0xff)
+	\returns			TRUE if the command was queued
+ */
+static BOOL queue_write_sfr( EC2DRV *obj, uint8_t addr, uint8_t value )
+{
+	return obj->ops.queue_write_sfr( obj, sfr_fixup( addr ), value );
 }
 
 
@@ -602,10 +1043,9 @@ void ec2_read_ram( EC2DRV *obj, char *buf, int start_addr, int len )
 	DUMP_FUNC();
 
 	// special case here and call 
-	if( obj->mode == JTAG )
-		jtag_read_ram( obj, buf, start_addr, len );
-	else if( obj->mode==C2 )
-		c2_read_ram( obj, buf, start_addr, len );
+	ec2_lock( obj );
+	obj->ops.read_ram( obj, buf, start_addr, len );
+	ec2_unlock( obj );
 	
 	DUMP_FUNC_END();
 }
@@ -633,10 +1073,11 @@ void ec2_read_ram_sfr( EC2DRV *obj, char *buf, int start_addr, int len, BOOL sfr
 		len = 0x100 - (int)start_addr;
 	}
 
-	if( obj->mode == JTAG )
-		jtag_read_ram_sfr( obj, buf, start_addr, len, sfr );
-	else if( obj->mode == C2 )
-		c2_read_ram_sfr( obj, buf, start_addr, len, sfr );
+	ec2_lock( obj );
+	if( sfr )
+		ec2_sfr_page_sync( obj );
+	obj->ops.read_ram_sfr( obj, buf, start_addr, len, sfr );
+	ec2_unlock( obj );
 	
 	DUMP_FUNC_END();
 }
@@ -665,12 +1106,9 @@ BOOL ec2_write_ram( EC2DRV *obj, char *buf, int start_addr, int len )
 		len = 0x100 - (int)start_addr;
 	}
 	// printf("start addr = 0x%02x\n",start_addr);
-	if( obj->mode == JTAG )
-		r = jtag_write_ram( obj, buf, start_addr, len );
-	else if( obj->mode == C2 )
-		r = c2_write_ram( obj, buf, start_addr, len );
-	else
-		r = FALSE;
+	ec2_lock( obj );
+	r = obj->ops.write_ram( obj, buf, start_addr, len );
+	ec2_unlock( obj );
 	DUMP_FUNC_END();
 	return r;
 }
@@ -689,12 +1127,9 @@ BOOL ec2_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
 { 
 	DUMP_FUNC();
 	BOOL r = FALSE;
-	if( obj->mode==JTAG )
-		r = jtag_write_xdata( obj, buf, start_addr, len );
-	else if( obj->mode==C2 )
-		r = c2_write_xdata( obj, buf, start_addr, len );
-	else
-		r = FALSE;
+	ec2_lock( obj );
+	r = obj->ops.write_xdata( obj, buf, start_addr, len );
+	ec2_unlock( obj );
 	DUMP_FUNC_END();
 	return r;
 }
@@ -713,10 +1148,9 @@ BOOL ec2_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
 void ec2_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
 {
 	DUMP_FUNC();
-	if( obj->mode==JTAG )
-		jtag_read_xdata( obj, buf, start_addr, len );
-	else if( obj->mode==C2 )
-		c2_read_xdata( obj, buf, start_addr, len );
+	ec2_lock( obj );
+	obj->ops.read_xdata( obj, buf, start_addr, len );
+	ec2_unlock( obj );
 }
 
 
@@ -743,15 +1177,119 @@ BOOL ec2_read_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len )
 	
 	if(!check_flash_range( obj, start_addr, len )) return FALSE;
 	
-	if( obj->mode==JTAG )
-		r = jtag_read_flash( obj, buf, start_addr, len, FALSE );
-	else if( obj->mode==C2 )
-		r = c2_read_flash( obj, buf, start_addr, len, FALSE );
+	ec2_lock( obj );
+	r = flash_cache_read( obj, buf, start_addr, len );
+	if( !r )
+	{
+		r = obj->ops.read_flash( obj, buf, start_addr, len, FALSE );
+		if( r )
+			flash_cache_readback( obj, buf, start_addr, len );
+	}
+	ec2_unlock( obj );
 	DUMP_FUNC_END();
 	return r;
 }
 
 
+/** Start a run of flash reads.
+	On JTAG devices every ec2_read_flash() otherwise halts the core, sets up
+	the clocks and flash timing and issues a long series of JTAG register
+	writes, then undoes them all.  Between ec2_begin_flash_access() and
+	ec2_end_flash_access() that is only done once, which makes many small reads
+	(the disassembler, code caching) much cheaper.
+	The connection is locked for the whole session.  Other operations may be
+	used inside it but the set up then has to be repeated by the next read.
+	Sessions nest, on C2 devices they do nothing.
+
+	\param obj			Object to act on.
+	\returns			TRUE
+*/
+BOOL ec2_begin_flash_access( EC2DRV *obj )
+{
+	ec2_lock( obj );
+	obj->flash_access++;
+	return TRUE;
+}
+
+
+/** End a session started with ec2_begin_flash_access().
+	\param obj			Object to act on.
+*/
+void ec2_end_flash_access( EC2DRV *obj )
+{
+	if( obj->flash_access==0 )
+		return;
+	if( --obj->flash_access==0 && obj->flash_access_ready )
+	{
+		if( obj->ops.end_flash_access )
+			obj->ops.end_flash_access( obj );
+		obj->flash_access_ready = FALSE;
+	}
+	ec2_unlock( obj );
+}
+
+
+/** CRC-16/CCITT (polynomial 0x1021) as used by the SiLabs CRC0 unit.
+	Start with crc = 0xFFFF, the result can be fed back in to continue.
+
+	\param crc			CRC of the preceeding data.
+	\param buf			Data to add.
+	\param len			Number of bytes in buf.
+	\returns			Updated CRC.
+*/
+uint16_t ec2_crc16( uint16_t crc, const uint8_t *buf, int len )
+{
+	int i, bit;
+	for( i=0; i<len; i++ )
+	{
+		crc ^= (uint16_t)buf[i] << 8;
+		for( bit=0; bit<8; bit++ )
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+
+/** Read back a region of flash memory (CODE space) and return its CRC-16.
+	The 8051 core can only execute from flash so the CRC can't be run on the
+	target without disturbing user code, the region is streamed back one
+	sector at a time using the pipelined block reads and the CRC worked out
+	on the host.  That costs as much as an ec2_read_flash() of the region, so
+	to verify against an image in memory compare the bytes instead, this is
+	for checking against a CRC recorded earlier.
+
+	\param obj			Object to act on.
+	\param start_addr	Address to begin at, 0x00 - 0x1FFFF
+	\param len			Number of bytes to include.
+	\param crc			Receives the CRC-16.
+	\returns			TRUE on success, FALSE if the range is invalid or a read
+						failed.
+*/
+BOOL ec2_read_flash_crc( EC2DRV *obj, uint32_t start_addr, int len, uint16_t *crc )
+{
+	DUMP_FUNC();
+	const int chunk = obj->dev->flash_sector_size;
+	uint8_t *buf;
+	int ofs, n;
+	BOOL ok = TRUE;
+
+	if(!check_flash_range( obj, start_addr, len )) return FALSE;
+	buf = malloc( chunk );
+	if( buf==0 )
+		return FALSE;
+	*crc = 0xFFFF;
+	for( ofs=0; ofs<len && ok; ofs+=n )
+	{
+		n = (len-ofs)>chunk ? chunk : len-ofs;
+		ok = ec2_read_flash( obj, buf, start_addr+ofs, n );
+		*crc = ec2_crc16( *crc, buf, n );
+	}
+	free( buf );
+	DUMP_FUNC_END();
+	return ok;
+}
+
+
 // These registers for the F120
 SFRREG SFR_SFRPAGE	= { 0x0, 0x84 };
 SFRREG SFR_FLSCL	= { 0x0, 0xb7 };
@@ -787,10 +1325,10 @@ BOOL ec2_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len )
 	BOOL r;
 	if(!check_flash_range( obj, start_addr, len )) return FALSE;
 	
-	if( obj->mode==C2 )
-		r = c2_write_flash( obj, buf, start_addr, len, FALSE );
-	else
-		r = jtag_write_flash( obj, buf, start_addr, len );
+	ec2_lock( obj );
+	flash_cache_forget( obj, start_addr, len );
+	r = obj->ops.write_flash( obj, buf, start_addr, len, FALSE );
+	ec2_unlock( obj );
 	DUMP_FUNC_END();
 	return r;
 }
@@ -798,6 +1336,9 @@ BOOL ec2_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len )
 
 /** This variant of writing to flash memory (CODE space) will erase sectors
 	before writing.
+	The sectors are erased one by one or with a chip erase that preserves
+	the rest of the flash, whichever the erase costs say is faster, see
+	ec2_set_erase_costs().  Locked devices always get a chip erase.
 
 	\param obj			Object to act on.
 	\param buf			Buffer containing data to write to CODE
@@ -810,30 +1351,31 @@ BOOL ec2_write_flash_auto_erase( EC2DRV *obj, uint8_t *buf,
 								 uint32_t start_addr, int len )
 {
 	DUMP_FUNC();
+	BOOL r;
 	if(!check_flash_range( obj, start_addr, len ))
 		return FALSE;
 	
-	if( obj->mode==JTAG )
-		return jtag_write_flash_block( obj, start_addr, buf, len, FALSE,FALSE);
-	
-	uint16_t first_sector = start_addr / obj->dev->flash_sector_size;
-	uint32_t end_addr = start_addr + len - 1;
-	uint16_t last_sector = end_addr / obj->dev->flash_sector_size;
-	int i;
-
-	// check if the flash is locked, in which case we need to do a complete
-	//   flash erase
-	if (flash_lock_byte(obj) != 0xff) {
-		ec2_erase_flash (obj);
-	}
-	// otherwise we can just erase the sectors we will be writing to
-	else {
-		// Erase sectors involved
-		for( i=first_sector; i<=last_sector; i++ )
-		{
-			ec2_erase_flash_sector( obj, i*obj->dev->flash_sector_size  );
-		}
+	if( obj->ops.write_flash_block )
+	{
+		ec2_lock( obj );
+		flash_cache_forget( obj, start_addr, len );
+		r = obj->ops.write_flash_block( obj, start_addr, buf, len, FALSE,FALSE);
+		ec2_unlock( obj );
+		return r;
 	}
+	
+	const uint32_t ss = obj->dev->flash_sector_size;
+	const int nsec = (obj->dev->flash_size+ss-1) / ss;
+	uint32_t sec;
+	uint8_t *erase = calloc( nsec, 1 );
+	if( erase==0 )
+		return FALSE;
+	for( sec=start_addr/ss; sec<=(start_addr+len-1)/ss; sec++ )
+		erase[sec] = 1;
+	r = erase_sectors( obj, erase, nsec );
+	free( erase );
+	if( !r )
+		return FALSE;
 	// finally, write the data
 	ec2_write_flash( obj, buf, start_addr, len );
 	
@@ -841,11 +1383,78 @@ BOOL ec2_write_flash_auto_erase( EC2DRV *obj, uint8_t *buf,
 }
 
 
+/** Write a sparse image, as loaded by ihex_read(), to flash memory (CODE
+	space).
+	Only the sectors holding data from the image are erased, each once, so
+	flash in the gaps between segments is left alone.  Parts of a sector not
+	covered by the image are erased though, as for
+	ec2_write_flash_auto_erase(), which also describes how the choice
+	between sector and chip erasing is made.
+
+	\param obj			Object to act on.
+	\param img			Image to write
+
+	\returns			TRUE on success, otherwise FALSE
+*/
+BOOL ec2_write_flash_image( EC2DRV *obj, const IHEX_IMAGE *img )
+{
+	DUMP_FUNC();
+	const uint32_t ss = obj->dev->flash_sector_size;
+	const int nsec = (obj->dev->flash_size+ss-1) / ss;
+	int i, sec;
+	uint8_t *erase;
+	BOOL r = TRUE;
+
+	if( img->count==0 )
+		return TRUE;
+	for( i=0; i<img->count; i++ )
+	{
+		if( !check_flash_range( obj, img->seg[i].addr, img->seg[i].len ) )
+			return FALSE;
+	}
+	if( obj->ops.write_flash_block )
+	{
+		// the JTAG block write erases and merges sectors itself
+		ec2_lock( obj );
+		for( i=0; i<img->count && r; i++ )
+		{
+			flash_cache_forget( obj, img->seg[i].addr, img->seg[i].len );
+			r = obj->ops.write_flash_block( obj, img->seg[i].addr,
+											img->seg[i].data, img->seg[i].len,
+											FALSE, FALSE );
+		}
+		ec2_unlock( obj );
+		return r;
+	}
+
+	erase = calloc( nsec, 1 );
+	if( erase==0 )
+		return FALSE;
+	for( i=0; i<img->count; i++ )
+	{
+		uint32_t last = img->seg[i].addr + img->seg[i].len - 1;
+		for( sec=img->seg[i].addr/ss; sec<=last/ss; sec++ )
+			erase[sec] = 1;
+	}
+	r = erase_sectors( obj, erase, nsec );
+	free( erase );
+	for( i=0; i<img->count && r; i++ )
+		r = ec2_write_flash( obj, img->seg[i].data, img->seg[i].addr,
+							 img->seg[i].len );
+	DUMP_FUNC_END();
+	return r;
+}
+
+
 /** This variant of writing to flash memory (CODE space) will read all sector
 	content before erasing and will merge changes over the existing data
 	before writing.
 	This is slower than the other methods in that it requires a read of the
-	sector first.  also blank sectors will not be erased again
+	sector first.  also blank sectors will not be erased again.
+	Sectors are handled one at a time, read, erase, write, so memory use
+	is a single sector regardless of len.  When most of the device is being
+	rewritten a chip erase may be faster, see ec2_write_flash_auto_erase(),
+	the affected sectors are then all read before erasing.
 
 	JTAG mode does this by default so not a big loss.	
 
@@ -863,51 +1472,143 @@ BOOL ec2_write_flash_auto_keep( EC2DRV *obj, uint8_t *buf,
 	BOOL ok;
 	if(!check_flash_range( obj, start_addr, len )) return FALSE;
 	
-	if( obj->mode==JTAG )
+	if( obj->ops.write_flash_block )
 	{
-		ok = jtag_write_flash_block( obj, start_addr, buf, len, TRUE, FALSE );
+		ec2_lock( obj );
+		flash_cache_forget( obj, start_addr, len );
+		ok = obj->ops.write_flash_block( obj, start_addr, buf, len, TRUE, FALSE );
+		ec2_unlock( obj );
 	}
 	else
 	{
-		int first_sector = start_addr/obj->dev->flash_sector_size;
-		int first_sec_addr = first_sector*obj->dev->flash_sector_size;
-		int end_addr = start_addr + len - 1;
-		int last_sector = end_addr/obj->dev->flash_sector_size;
-		int sector_cnt = last_sector - first_sector + 1;
-		int i,j;
-	
-		uint8_t *tbuf = malloc(obj->dev->flash_size);
-		if(tbuf==0)
+		uint32_t sec_size = obj->dev->flash_sector_size;
+		uint32_t end_addr = start_addr + len;		// one past the end
+		uint32_t sec_addr, lo, hi, j;
+		uint8_t *sbuf;
+		const int nsec = (obj->dev->flash_size+sec_size-1) / sec_size;
+		uint8_t *erase = calloc( nsec, 1 );
+		if( erase==0 )
 			return FALSE;
-		
-		// read in all sectors that are affected
-		ec2_read_flash( obj, tbuf, first_sec_addr,
-						sector_cnt*obj->dev->flash_sector_size );
-	
-		// erase nonblank sectors
-		for( i=0; i<sector_cnt; i++)
+		for( j=start_addr/sec_size; j<=(end_addr-1)/sec_size; j++ )
+			erase[j] = 1;
+		if( flash_lock_byte(obj)==0xff && chip_erase_faster( obj, erase, nsec ) )
 		{
-			j = 0;
-			while( j<0x200 )
+			// read and merge all the sectors, erase the chip, then write
+			uint32_t first = start_addr - start_addr % sec_size;
+			uint32_t n, span = (end_addr-1)/sec_size*sec_size + sec_size - first;
+			sbuf = malloc( span );
+			ok = sbuf!=0;
+			for( sec_addr=first; sec_addr<first+span && ok; sec_addr += sec_size )
 			{
-				if( (unsigned char)tbuf[i*0x200+j] != 0xFF )
-				{
-					// not blank, erase it
-					ec2_erase_flash_sector( obj,
-						first_sec_addr + i * obj->dev->flash_sector_size );
-					break;
-				}
-				j++;
+				if( (n = sector_usable( obj, sec_addr )) )
+					ok = ec2_read_flash( obj, sbuf+sec_addr-first, sec_addr, n );
+			}
+			if( ok )
+			{
+				memcpy( sbuf+start_addr-first, buf, len );
+				ok = erase_sectors( obj, erase, nsec );
+			}
+			for( sec_addr=first; sec_addr<first+span && ok; sec_addr += sec_size )
+			{
+				if( (n = sector_usable( obj, sec_addr )) )
+					ok = ec2_write_flash( obj, sbuf+sec_addr-first, sec_addr, n );
 			}
+			free( sbuf );
+			free( erase );
+			return ok;
 		}
-	
-		// merge data then write
-		memcpy( tbuf + ( start_addr - first_sec_addr ), buf, len );
+		free( erase );
+
+		// one sector at a time so only a single sector buffer is needed
+		sbuf = malloc( sec_size );
+		if( sbuf==0 )
+			return FALSE;
+		
+		ok = TRUE;
+		for( sec_addr = start_addr - start_addr % sec_size;
+			 sec_addr<end_addr && ok; sec_addr += sec_size )
+		{
+			lo = sec_addr<start_addr ? start_addr : sec_addr;
+			hi = sec_addr+sec_size>end_addr ? end_addr : sec_addr+sec_size;
+			ec2_read_flash( obj, sbuf, sec_addr, sec_size );
+			
+			// erase nonblank sectors
+			for( j=0; j<sec_size && sbuf[j]==0xFF; j++ )
+				;
+			if( j<sec_size )
+				ec2_erase_flash_sector( obj, sec_addr );
+			
+			// merge data then write
+			memcpy( sbuf + lo - sec_addr, buf + lo - start_addr, hi - lo );
+			ok = ec2_write_flash( obj, sbuf, sec_addr, sec_size );
+		}
+		free(sbuf);
+	}
+	return ok;
+}
+
+
+/** Differential variant of writing to flash memory (CODE space).
+	Each affected sector is read back and compared with the new data, sectors
+	that already hold it are left alone.  A changed sector is only erased if
+	some bit has to go from 0 to 1, otherwise the new bytes are just burnt
+	down over the old ones.  This makes reprogramming with a mostly unchanged
+	image much faster than ec2_write_flash_auto_keep().
+	Locked devices fall back to ec2_write_flash_auto_erase().
+
+	\param obj			Object to act on.
+	\param buf			Buffer containing data to write to CODE
+	\param start_addr	Address to begin writing at, 0 - 0x1FFFF
+	\param len			Number of bytes to write, 0 - 0x1FFFF
+
+	\returns			TRUE on success, otherwise FALSE
+*/
+BOOL ec2_write_flash_diff( EC2DRV *obj, uint8_t *buf,
+						   uint32_t start_addr, int len )
+{
+	DUMP_FUNC();
+	uint32_t sec_size = obj->dev->flash_sector_size;
+	uint32_t end_addr = start_addr + len;		// one past the end
+	uint32_t sec_addr, sec_end, lo, hi, j;
+	uint8_t *sbuf;
+	BOOL erase, ok = TRUE;
+
+	if(!check_flash_range( obj, start_addr, len )) return FALSE;
+	if( flash_lock_byte(obj) != 0xff )
+		return ec2_write_flash_auto_erase( obj, buf, start_addr, len );
+
+	sbuf = malloc( sec_size );
+	if( sbuf==0 )
+		return FALSE;
+	for( sec_addr = start_addr - start_addr % sec_size;
+		 sec_addr<end_addr && ok; sec_addr += sec_size )
+	{
+		// usable part of the sector and the part of it being written
+		sec_end = sec_addr + sec_size;
+		if( obj->dev->flash_reserved_bottom>(int32_t)sec_addr &&
+			obj->dev->flash_reserved_bottom<(int32_t)sec_end )
+			sec_end = obj->dev->flash_reserved_bottom;
+		lo = sec_addr<start_addr ? start_addr : sec_addr;
+		hi = sec_end>end_addr ? end_addr : sec_end;
+		ok = ec2_read_flash( obj, sbuf, sec_addr, sec_end-sec_addr );
+		if( !ok || memcmp( sbuf+lo-sec_addr, buf+lo-start_addr, hi-lo )==0 )
+			continue;	// unchanged
 		
-		ok = ec2_write_flash( obj, tbuf, first_sec_addr,
-							sector_cnt*obj->dev->flash_sector_size );
-		free(tbuf);
+		// writing can only clear bits
+		erase = FALSE;
+		for( j=lo; j<hi && !erase; j++ )
+			erase = ( buf[j-start_addr] & ~sbuf[j-sec_addr] ) != 0;
+		if( erase )
+		{
+			memcpy( sbuf+lo-sec_addr, buf+lo-start_addr, hi-lo );
+			ec2_erase_flash_sector( obj, sec_addr );
+			ok = ec2_write_flash( obj, sbuf, sec_addr, sec_end-sec_addr );
+		}
+		else
+			ok = ec2_write_flash( obj, buf+lo-start_addr, lo, hi-lo );
 	}
+	free( sbuf );
+	DUMP_FUNC_END();
 	return ok;
 }
 
@@ -919,10 +1620,10 @@ BOOL ec2_write_flash_auto_keep( EC2DRV *obj, uint8_t *buf,
 void ec2_erase_flash( EC2DRV *obj )
 {
 	DUMP_FUNC();
-	if( obj->mode==C2 )
-		c2_erase_flash(obj);
-	else if( obj->mode==JTAG )
-		jtag_erase_flash(obj);
+	ec2_lock( obj );
+	flash_cache_forget( obj, 0, obj->dev->flash_size );
+	obj->ops.erase_flash( obj );
+	ec2_unlock( obj );
 	DUMP_FUNC_END();
 }
 
@@ -938,14 +1639,40 @@ void ec2_erase_flash_sector( EC2DRV *obj, uint32_t sect_addr )
 	DUMP_FUNC();
 	if(!check_flash_range( obj, sect_addr, obj->dev->flash_sector_size) )
 		return;	// failure
-	if( obj->mode == JTAG )
-	{
-		jtag_erase_flash_sector( obj, sect_addr, FALSE );
-	}	// end JTAG
-	else if( obj->mode == C2 )
-	{
-		c2_erase_flash_sector( obj, sect_addr, FALSE );
-	}	// End C2
+	ec2_lock( obj );
+	flash_cache_forget( obj, sect_addr, 1 );
+	obj->ops.erase_flash_sector( obj, sect_addr, FALSE );
+	ec2_unlock( obj );
+}
+
+/** Set the timings used to choose between sector and chip erases.
+	Measure them with ec2bench, a costs of 0 restores the defaults for
+	the mode.
+
+	\param obj			Object to act on.
+	\param costs		Timings to use, or 0
+*/
+void ec2_set_erase_costs( EC2DRV *obj, const EC2_ERASE_COSTS *costs )
+{
+	if( costs )
+		obj->erase_costs = *costs;
+	else
+		memset( &obj->erase_costs, 0, sizeof(EC2_ERASE_COSTS) );
+}
+
+/** Get the timings in use for choosing between sector and chip erases,
+	which are the defaults for the current mode unless
+	ec2_set_erase_costs() has been called.
+
+	\param obj			Object to act on.
+	\param costs		Receives the timings
+*/
+void ec2_get_erase_costs( EC2DRV *obj, EC2_ERASE_COSTS *costs )
+{
+	if( obj->erase_costs.sector_erase_us )
+		*costs = obj->erase_costs;
+	else
+		*costs = obj->ops.erase_costs;
 }
 
 /** Read from the scratchpad area in flash.
@@ -960,14 +1687,14 @@ BOOL ec2_read_flash_scratchpad( EC2DRV *obj, uint8_t *buf,
 								uint32_t start_addr, int len )
 {
 	DUMP_FUNC();
+	BOOL r = FALSE;
 	if( check_scratchpad_range( obj, start_addr, len ) )
 	{
-		if( obj->mode==JTAG )
-			return jtag_read_flash( obj, buf, start_addr, len, TRUE );
-		else
-			return c2_read_flash( obj, buf, start_addr, len, TRUE );
+		ec2_lock( obj );
+		r = obj->ops.read_flash( obj, buf, start_addr, len, TRUE );
+		ec2_unlock( obj );
 	}
-	return FALSE;
+	return r;
 }
 
 /** Write to the flash scratchpad.
@@ -984,17 +1711,24 @@ BOOL ec2_write_flash_scratchpad( EC2DRV *obj, uint8_t *buf,
 								 uint32_t start_addr, int len )
 {
 	DUMP_FUNC();
+	BOOL r = FALSE;
 	if(!check_scratchpad_range( obj, start_addr, len ))
 		return FALSE;
-	if( obj->mode==JTAG )
-		return jtag_write_flash_block( obj, start_addr, buf, len, TRUE, TRUE );
+	ec2_lock( obj );
+	if( obj->ops.write_flash_block )
+		r = obj->ops.write_flash_block( obj, start_addr, buf, len, TRUE, TRUE );
 	else
-		return FALSE;
+		r = obj->ops.write_flash( obj, buf, start_addr, len, TRUE );
+	ec2_unlock( obj );
+	return r;
 }
 
 /** Write to the flash scratchpad with merge.
 	Write th the scratchpad a block of bytes while preserving all other bytes
-	in the page.  This function will wrewrite the entire page if necessary.
+	in the page.  Only the scratchpad sectors the write touches are read,
+	those already holding the data are left alone and the others are only
+	erased and rewritten if some bit has to go from 0 to 1, otherwise the new
+	bytes are burnt down over the old ones.
 
 	\param obj			Object to act on.
 	\param buf			Buffer containing data to write.
@@ -1006,31 +1740,58 @@ BOOL ec2_write_flash_scratchpad_merge( EC2DRV *obj, uint8_t *buf,
                                        uint32_t start_addr, int len )
 {
 	DUMP_FUNC();
-	BOOL result = 0;
-	
-	uint8_t *mbuf = malloc(obj->dev->scratchpad_len);
-	if(!mbuf)
-		return FALSE;	
-	if( obj->mode==JTAG )
+	const uint32_t ss = obj->dev->scratchpad_sector_size;
+	uint32_t end_addr = start_addr + len;		// one past the end
+	uint32_t first, sec_addr, sec_end, lo, hi, j;
+	uint8_t *sbuf;
+	BOOL erase, ok = TRUE;
+
+	if( !check_scratchpad_range( obj, start_addr, len ) )
+		return FALSE;
+	if( obj->ops.write_flash_block )
 	{
-		result = jtag_write_flash_block(obj,start_addr,buf,len,TRUE,TRUE);
-		goto done;
+		ec2_lock( obj );
+		ok = obj->ops.write_flash_block(obj,start_addr,buf,len,TRUE,TRUE);
+		ec2_unlock( obj );
+		return ok;
 	}
-	else
-	{
-		/// @todo	add erase only when necessary checks
-		update_progress( obj, 0 );
-		ec2_read_flash_scratchpad( obj, mbuf, 0, obj->dev->scratchpad_len );
-		memcpy( &mbuf[start_addr], buf, len );	// merge in changes
-		update_progress( obj, 45 );
-		ec2_erase_flash_scratchpad( obj );
-		update_progress( obj, 55 );
-		ec2_write_flash_scratchpad( obj, mbuf, 0, obj->dev->scratchpad_len );
-		update_progress( obj, 100 );
+
+	sbuf = malloc( ss );
+	if( !sbuf )
+		return FALSE;
+	update_progress( obj, 0 );
+	first = start_addr - start_addr % ss;
+	for( sec_addr=first; sec_addr<end_addr && ok; sec_addr += ss )
+	{
+		sec_end = sec_addr + ss;
+		if( sec_end > (uint32_t)obj->dev->scratchpad_len )
+			sec_end = obj->dev->scratchpad_len;
+		lo = sec_addr<start_addr ? start_addr : sec_addr;
+		hi = sec_end>end_addr ? end_addr : sec_end;
+		ok = ec2_read_flash_scratchpad( obj, sbuf, sec_addr, sec_end-sec_addr );
+		if( ok && memcmp( sbuf+lo-sec_addr, buf+lo-start_addr, hi-lo )!=0 )
+		{
+			// writing can only clear bits
+			erase = FALSE;
+			for( j=lo; j<hi && !erase; j++ )
+				erase = ( buf[j-start_addr] & ~sbuf[j-sec_addr] ) != 0;
+			if( erase )
+			{
+				memcpy( sbuf+lo-sec_addr, buf+lo-start_addr, hi-lo );
+				ok = ec2_erase_flash_scratchpad_sector( obj,
+							obj->dev->scratchpad_start + sec_addr ) &&
+					 ec2_write_flash_scratchpad( obj, sbuf, sec_addr,
+												 sec_end-sec_addr );
+			}
+			else
+				ok = ec2_write_flash_scratchpad( obj, buf+lo-start_addr, lo,
+												 hi-lo );
+		}
+		update_progress( obj, 100*(hi-first)/(end_addr-first) );
 	}
-done:
-	free(mbuf);
-	return result;
+	free( sbuf );
+	DUMP_FUNC_END();
+	return ok;
 }
 
 /** Erase all scratchpad sectors.
@@ -1064,11 +1825,12 @@ BOOL ec2_erase_flash_scratchpad( EC2DRV *obj )
 */
 BOOL ec2_erase_flash_scratchpad_sector( EC2DRV *obj, uint32_t sector_addr )
 {
+	BOOL r;
 	printf("erasing scratchpad sector at addr=0x%05x\n",sector_addr);
-	if( obj->mode==JTAG )
-		return jtag_erase_flash_sector( obj, sector_addr, TRUE );
-	else
-		return c2_erase_flash_sector( obj, sector_addr, TRUE );
+	ec2_lock( obj );
+	r = obj->ops.erase_flash_sector( obj, sector_addr, TRUE );
+	ec2_unlock( obj );
+	return r;
 }
 
 
@@ -1088,6 +1850,7 @@ void read_active_regs( EC2DRV *obj, char *buf )
 	DUMP_FUNC();
 	char psw;
 	int addr;
+	ec2_lock( obj );
 	// read PSW
 	ec2_read_sfr( obj, &psw, 0xD0 );
 	printf( "PSW = 0x%02x\n",psw );
@@ -1100,6 +1863,7 @@ void read_active_regs( EC2DRV *obj, char *buf )
 	// R0-R1
 	write_port( obj, "\x02\x02\x24\x02", 4 );
 	read_port( obj, &buf[0], 2 );
+	ec2_unlock( obj );
 }
 
 /** Read the targets program counter
@@ -1109,47 +1873,19 @@ void read_active_regs( EC2DRV *obj, char *buf )
 uint16_t ec2_read_pc( EC2DRV *obj )
 {
 	DUMP_FUNC();
-	unsigned char buf[2];
-
-	if( obj->mode==JTAG )
-	{
-		write_port( obj, "\x02\x02\x20\x02", 4 );
-		read_port(  obj, (char*)buf, 2 );
-	}
-	else if( obj->mode==C2 )
-	{
-		write_port( obj, "\x28\x20\x02", 3 );
-		read_port(  obj, (char*)buf, 2 );
-	}
-	return ((buf[1]<<8) | buf[0]);
+	uint16_t pc;
+	ec2_lock( obj );
+	pc = obj->ops.read_pc( obj );
+	ec2_unlock( obj );
+	return pc;
 }
 
 void ec2_set_pc( EC2DRV *obj, uint16_t addr )
 {
 	DUMP_FUNC();
-	char cmd[4];
-	if( obj->mode==JTAG )
-	{
-		cmd[0] = 0x03;
-		cmd[1] = 0x02;
-		cmd[2] = 0x20;
-		cmd[3] = addr&0xFF;
-		trx( obj, cmd, 4, "\x0D", 1 );
-		cmd[2] = 0x21;
-		cmd[3] = (addr>>8)&0xFF;
-		trx( obj, cmd, 4, "\x0D", 1 );
-	}
-	else if( obj->mode==C2 )
-	{
-		cmd[0] = 0x29;
-		cmd[1] = 0x20;
-		cmd[2] = 0x01;					// len
-		cmd[3] = addr & 0xff;			// low byte addr
-		trx( obj, cmd, 4,"\x0d", 1 );
-		cmd[1] = 0x21;
-		cmd[3] = addr>>8;				// high byte
-		trx( obj, cmd, 4, "\x0d", 1 );
-	}
+	ec2_lock( obj );
+	obj->ops.set_pc( obj, addr );
+	ec2_unlock( obj );
 }
 
 
@@ -1166,23 +1902,50 @@ void ec2_set_pc( EC2DRV *obj, uint16_t addr )
 uint16_t ec2_step( EC2DRV *obj )
 {
 	DUMP_FUNC();
-	char buf[2];
+	uint16_t pc;
 	
-	if( obj->mode==JTAG )
-	{
-		trx( obj, "\x09\x00", 2, "\x0d", 1 );
-		trx( obj, "\x13\x00", 2, "\x01", 1 );	// very similar to 1/2 a target_halt command,  test to see if stopped...
-		
-		write_port( obj, "\x02\x02\x20\x02", 4 );
-		read_port(  obj, buf, 2 );
-		return (uint8_t)buf[0] | ((uint8_t)buf[1]<<8);
-	}
-	else if( obj->mode==C2 )
-	{
-		trx( obj, "\x26", 1, "\x0d", 1 );
-		return ec2_read_pc(obj);
-	}
-	return 0;	// Invalid mode
+	ec2_lock( obj );
+	sfr_page_forget( obj );
+	pc = obj->ops.step( obj );
+	ec2_unlock( obj );
+	return pc;
+}
+
+/** Step n instructions, recording the PC after each one.
+  * The commands for several steps are queued back to back so on the EC3
+  * they are all in flight together, rather than waiting for the replies of
+  * one step before sending the next.
+  *
+  * \param obj		Object to act on.
+  * \param pcs		Receives the PC after each step, room for n entries.
+  * \param n			Number of steps to take.
+  * \returns			the number of steps completed, less than n on failure.
+  */
+int ec2_step_n( EC2DRV *obj, uint16_t *pcs, int n )
+{
+	DUMP_FUNC();
+	char buf[EC2_QUEUE_DEPTH][2];
+	int per_step = obj->ops.step_cmds;		// queue entries per step
+	int batch = EC2_QUEUE_DEPTH / per_step;
+	int done = 0, i, k;
+
+	ec2_lock( obj );
+	sfr_page_forget( obj );
+	while( done<n )
+	{
+		k = n-done<batch ? n-done : batch;
+		for( i=0; i<k; i++ )
+			obj->ops.queue_step( obj, buf[i] );
+		if( !ec2_queue_flush( obj ) )
+			k = obj->queue_failed / per_step;	// keep the complete steps
+		for( i=0; i<k; i++ )
+			pcs[done+i] = (uint8_t)buf[i][0] | ((uint8_t)buf[i][1]<<8);
+		done += k;
+		if( obj->queue_failed>=0 )
+			break;
+	}
+	ec2_unlock( obj );
+	return done;
 }
 
 /** Start the target processor running from the current PC location
@@ -1194,12 +1957,10 @@ BOOL ec2_target_go( EC2DRV *obj )
 	DUMP_FUNC();
 	BOOL r = FALSE;
 
-	if( obj->mode==JTAG )
-	{
-		r = jtag_target_go(obj);
-	}
-	else if( obj->mode==C2 )
-		r = c2_target_go(obj);
+	ec2_lock( obj );
+	sfr_page_forget( obj );
+	r = obj->ops.go( obj );
+	ec2_unlock( obj );
 	
 	DUMP_FUNC_END();
 	return r;
@@ -1222,10 +1983,9 @@ BOOL ec2_target_halt_poll( EC2DRV *obj )
 	DUMP_FUNC();
 	BOOL r = FALSE;
 	
-	if( obj->mode==JTAG )
-		r = jtag_target_halt_poll(obj);
-	else if( obj->mode==C2 )
-		r = c2_target_halt_poll(obj);
+	ec2_lock( obj );
+	r = obj->ops.halt_poll( obj );
+	ec2_unlock( obj );
 	
 	DUMP_FUNC_END();
 	return r;
@@ -1240,6 +2000,7 @@ uint16_t ec2_target_run_bp( EC2DRV *obj, BOOL *bRunning )
 {
 	DUMP_FUNC();
 	int i;
+	ec2_lock( obj );
 	ec2_target_go( obj );
 	if( obj->dbg_adaptor )		// @FIXME: which debug adapter?
 	{
@@ -1249,6 +2010,7 @@ uint16_t ec2_target_run_bp( EC2DRV *obj, BOOL *bRunning )
 		trx( obj, "\x0C\x02\xB1\x09", 4, "\x00\x00\x01", 3 );
 		trx( obj, "\x0C\x02\xB2\x0B", 4," \x00\x00\x20", 3 );
 	}
+	ec2_unlock( obj );
 	
 	// dump current breakpoints for debugging
 	for( i=0; i<4;i++)
@@ -1257,11 +2019,57 @@ uint16_t ec2_target_run_bp( EC2DRV *obj, BOOL *bRunning )
 			printf("bpaddr[%i] = 0x%05x\n",i,(unsigned int)obj->bpaddr[i]);
 	}
 	
-	while( !ec2_target_halt_poll( obj )&&(*bRunning) )
-		usleep(250);
+	ec2_target_wait_halt( obj, 0, run_bp_stopped, bRunning );
 	return ec2_read_pc( obj );
 }
 
+static BOOL run_bp_stopped( void *ctx )
+{
+	return !*(BOOL*)ctx;
+}
+
+
+/** Wait for the target to halt after ec2_target_go().
+	Polls straight away and then backs off exponentially from
+	EC2_HALT_POLL_MIN_US to EC2_HALT_POLL_MAX_US between polls, so a
+	breakpoint hit shortly after go is seen quickly without flooding the link
+	while the target runs for a long time.
+
+	\param obj			Object to act on.
+	\param timeout_ms	Give up after this long, 0 to wait forever.
+	\param stop			Called between polls, return TRUE to abandon the wait.
+						May be 0.
+	\param ctx			Passed to stop.
+	\returns			EC2_HALTED, EC2_HALT_TIMEOUT or EC2_HALT_STOPPED.  The
+						target is left running in the last two cases.
+*/
+EC2_HALT_RESULT ec2_target_wait_halt( EC2DRV *obj, uint32_t timeout_ms,
+									  EC2_STOP_FN stop, void *ctx )
+{
+	struct timeval start, now;
+	uint32_t delay = 0;
+	
+	gettimeofday( &start, 0 );
+	while( !ec2_target_halt_poll( obj ) )
+	{
+		if( stop && stop( ctx ) )
+			return EC2_HALT_STOPPED;
+		if( timeout_ms )
+		{
+			gettimeofday( &now, 0 );
+			if( (now.tv_sec-start.tv_sec)*1000 +
+				(now.tv_usec-start.tv_usec)/1000 >= timeout_ms )
+				return EC2_HALT_TIMEOUT;
+		}
+		if( delay )
+			usleep( delay );
+		delay = delay==0 ? EC2_HALT_POLL_MIN_US : delay*2;
+		if( delay>EC2_HALT_POLL_MAX_US )
+			delay = EC2_HALT_POLL_MAX_US;
+	}
+	return EC2_HALTED;
+}
+
 /** Request the target processor to stop
   * the polling is necessary to determine when it has actually stopped
   */
@@ -1270,10 +2078,9 @@ BOOL ec2_target_halt( EC2DRV *obj )
 	DUMP_FUNC();
 	int i;
 	BOOL r = FALSE;
-	if( obj->mode==JTAG )
-		r = jtag_target_halt(obj);
-	else if( obj->mode==C2 )
-		r = c2_target_halt(obj);
+	ec2_lock( obj );
+	r = obj->ops.halt( obj );
+	ec2_unlock( obj );
 
 	// loop allows upto 8 retries 
 	// returns 0x01 of successful stop, 0x00 otherwise suchas already stopped	
@@ -1281,6 +2088,7 @@ BOOL ec2_target_halt( EC2DRV *obj )
 	{
 		if( ec2_target_halt_poll( obj ) )
 			return TRUE;	// success
+		obj->stats.retries++;
 	}
 	printf("ERROR: target would not stop after halt!\n");
 	return FALSE;
@@ -1296,10 +2104,57 @@ void ec2_target_halt_no_wait( EC2DRV *obj )
 	DUMP_FUNC();
 	int i;
 	BOOL r = FALSE;
-	if( obj->mode==JTAG )
-		r = jtag_target_halt(obj);
-	else if( obj->mode==C2 )
-		r = c2_target_halt(obj);
+	ec2_lock( obj );
+	r = obj->ops.halt( obj );
+	ec2_unlock( obj );
+}
+
+
+/** Take one PC sample from a running target.
+	The target is halted, its PC read and the target set running again, all
+	under one lock so nothing else can get in between.  A target that has
+	stopped by itself, or that halts on an active breakpoint address, is left
+	halted so the breakpoint isn't lost.
+
+	\param obj			Object to act on.
+	\param pc			Receives the PC.
+	\param resume		FALSE to leave the target halted after the sample.
+	\returns			EC2_SAMPLE_OK if sampled (and running again if resume),
+						EC2_SAMPLE_HALTED if the target stopped by itself,
+						EC2_SAMPLE_FAILED if it wouldn't halt.
+*/
+EC2_SAMPLE_RESULT ec2_target_sample_pc( EC2DRV *obj, uint16_t *pc, BOOL resume )
+{
+	DUMP_FUNC();
+	EC2_SAMPLE_RESULT r = EC2_SAMPLE_FAILED;
+	int i;
+
+	ec2_lock( obj );
+	if( ec2_target_halt_poll( obj ) )
+		r = EC2_SAMPLE_HALTED;
+	else
+	{
+		ec2_target_halt_no_wait( obj );
+		for( i=0; i<16; i++ )		// same retries as ec2_target_halt()
+		{
+			if( ec2_target_halt_poll( obj ) )
+			{
+				r = EC2_SAMPLE_OK;
+				break;
+			}
+			obj->stats.retries++;
+		}
+	}
+	if( r!=EC2_SAMPLE_FAILED )
+	{
+		*pc = ec2_read_pc( obj );
+		if( r==EC2_SAMPLE_OK && getBP( obj, *pc )!=-1 )
+			r = EC2_SAMPLE_HALTED;	// raced with a breakpoint
+	}
+	if( r==EC2_SAMPLE_OK && resume )
+		ec2_target_go( obj );
+	ec2_unlock( obj );
+	return r;
 }
 
 
@@ -1313,10 +2168,10 @@ BOOL ec2_target_reset( EC2DRV *obj )
 	DUMP_FUNC();
 	BOOL r = FALSE;
 
-	if( obj->mode == JTAG )
-		r = jtag_target_reset(obj);
-	else if( obj->mode==C2 )
-		r = c2_target_reset(obj);
+	ec2_lock( obj );
+	obj->sfr_page_cur = obj->sfr_page_user = -1;	// reset selects page 0
+	r = obj->ops.reset( obj );
+	ec2_unlock( obj );
 	
 	DUMP_FUNC_END();
 	return r;
@@ -1400,6 +2255,111 @@ static BOOL check_flash_range( EC2DRV *obj, uint32_t addr, int len )
 	return TRUE;
 }
 
+/** Number of bytes at the start of a sector that can be written, the
+	sector may run into the reserved area.
+	\param obj			EC2DRV object to act on.
+	\param sec_addr		Base address of the sector
+	\returns			0 to flash_sector_size
+ */
+uint32_t sector_usable( EC2DRV *obj, uint32_t sec_addr )
+{
+	int32_t sec_end = sec_addr + obj->dev->flash_sector_size;
+	if( sec_end > obj->dev->flash_size )
+		sec_end = obj->dev->flash_size;
+	if( obj->dev->flash_reserved_bottom>(int32_t)sec_addr &&
+		obj->dev->flash_reserved_bottom<sec_end )
+		sec_end = obj->dev->flash_reserved_bottom;
+	if( sec_end<=(int32_t)sec_addr ||
+		!check_flash_range( obj, sec_addr, sec_end-sec_addr ) )
+		return 0;
+	return sec_end - sec_addr;
+}
+
+/** Estimate whether a chip erase beats erasing the flagged sectors one
+	by one.  The chip erase has to save and restore every other usable
+	sector, which is assumed not to be blank.
+	\param obj			EC2DRV object to act on.
+	\param erase		One flag per sector, non zero if it must be erased
+	\param nsec			Number of sectors in the device
+	\returns			TRUE if a chip erase is expected to be faster
+ */
+static BOOL chip_erase_faster( EC2DRV *obj, const uint8_t *erase, int nsec )
+{
+	const uint32_t ss = obj->dev->flash_sector_size;
+	EC2_ERASE_COSTS c;
+	uint64_t by_sector = 0, by_chip;
+	int sec;
+
+	ec2_get_erase_costs( obj, &c );
+	by_chip = c.chip_erase_us;
+	for( sec=0; sec<nsec; sec++ )
+	{
+		if( erase[sec] )
+			by_sector += c.sector_erase_us;
+		else
+			by_chip += (uint64_t)(c.read_us_per_kb + c.write_us_per_kb)
+					   * sector_usable( obj, sec*ss ) / 1024;
+	}
+	return by_chip < by_sector;
+}
+
+/** Erase the flagged sectors, by sector or with a chip erase according to
+	chip_erase_faster().  Unflagged sectors keep their contents either way,
+	except on a locked device which can only be chip erased.
+	\param obj			EC2DRV object to act on.
+	\param erase		One flag per sector, non zero if it must be erased
+	\param nsec			Number of sectors in the device
+	\returns			FALSE if the other sectors couldn't be saved or
+						restored
+ */
+static BOOL erase_sectors( EC2DRV *obj, const uint8_t *erase, int nsec )
+{
+	const uint32_t ss = obj->dev->flash_sector_size;
+	uint32_t n, j;
+	uint8_t *save;
+	int sec;
+	BOOL ok = TRUE;
+
+	if( flash_lock_byte(obj) != 0xff )
+	{
+		ec2_erase_flash( obj );
+		return TRUE;
+	}
+	if( !chip_erase_faster( obj, erase, nsec ) )
+	{
+		for( sec=0; sec<nsec; sec++ )
+		{
+			if( erase[sec] )
+				ec2_erase_flash_sector( obj, sec*ss );
+		}
+		return TRUE;
+	}
+
+	save = malloc( nsec*ss );
+	if( save==0 )
+		return FALSE;
+	for( sec=0; sec<nsec && ok; sec++ )
+	{
+		if( !erase[sec] && (n = sector_usable( obj, sec*ss )) )
+			ok = ec2_read_flash( obj, save+sec*ss, sec*ss, n );
+	}
+	if( ok )
+	{
+		ec2_erase_flash( obj );
+		for( sec=0; sec<nsec && ok; sec++ )
+		{
+			if( erase[sec] || (n = sector_usable( obj, sec*ss ))==0 )
+				continue;
+			for( j=0; j<n && save[sec*ss+j]==0xff; j++ )
+				;
+			if( j<n )
+				ok = ec2_write_flash( obj, save+sec*ss, sec*ss, n );
+		}
+	}
+	free( save );
+	return ok;
+}
+
 /** Checks if all addresses in the range specified are valid for scratchpad.
 	\param obj		EC2DRV object to test address range for.
 	\param addr		Address block to test starts at
@@ -1470,6 +2430,21 @@ static int getNextBPIdx( EC2DRV *obj )
 	return -1;						// no more available
 }
 
+/** Find an inactive breakpoint whose address register already holds addr.
+  * Reusing such a slot only needs the enable mask updating.
+  * \returns index of the matching inactive breakpoint or -1 if not found
+  */
+static int getInactiveBP( EC2DRV *obj, uint32_t addr )
+{
+	DUMP_FUNC();
+	int i;
+
+	for( i=0; i<4; i++ )
+		if( ( obj->bpaddr[i]==addr) && !((obj->bp_flags>>i)&0x01) )
+			return i;
+	return -1;
+}
+
 /** Get the index of the breakpoint for the specified address
   * \returns index of breakpoint matching supplied address or -1 if not found
   */
@@ -1494,19 +2469,18 @@ static int getBP( EC2DRV *obj, uint32_t addr )
 static BOOL setBpMask( EC2DRV *obj, int bp, BOOL active )
 {
 	DUMP_FUNC();
+	BOOL r = FALSE;
 //	printf("static BOOL setBpMask( EC2DRV *obj, %i, %i )\n",bp,active);
 //	printf("obj->bp_flags = 0x%04x\n",obj->bp_flags);
+	ec2_lock( obj );
 	if( active )
 		obj->bp_flags |= ( 1 << bp );
 	else
 		obj->bp_flags &= ~( 1 << bp );
 
-	if( obj->mode==JTAG )
-		return jtag_update_bp_enable_mask(obj);
-	else if( obj->mode==C2 )
-		return c2_update_bp_enable_mask(obj);
-	else
-		return FALSE;
+	r = obj->ops.update_bp_enable_mask( obj );
+	ec2_unlock( obj );
+	return r;
 }
 
 /** check the breakpoint flags to see if the specific breakpoint is set.
@@ -1518,37 +2492,32 @@ BOOL isBPSet( EC2DRV *obj, int bpid )
 }
 
 
-/** Add a new breakpoint using the first available breakpoint
+/** Add a new breakpoint using the first available breakpoint.
+  * A disabled breakpoint that was last used for the same address is
+  * re-enabled in preference, saving the address write.
   */
 BOOL ec2_addBreakpoint( EC2DRV *obj, uint32_t addr )
 {
 	DUMP_FUNC();
 	int bp;
+	BOOL r = FALSE;
 //	printf("BOOL ec2_addBreakpoint( EC2DRV *obj, uint16_t addr )\n");
+	ec2_lock( obj );
 	if( getBP( obj, addr )==-1 )	// check address doesn't already have a BP
 	{
-		bp = getNextBPIdx( obj );
+		bp = getInactiveBP( obj, addr );
 		if( bp!=-1 )
 		{
-			if( obj->mode==JTAG )
-			{
-				if( jtag_addBreakpoint( obj, bp, addr ) )
-					return setBpMask( obj, bp, TRUE );
-				else
-					return FALSE;
-			}
-			else if( obj->mode==C2 )
-			{
-				if( c2_addBreakpoint( obj, bp, addr ) )
-					return setBpMask( obj, bp, TRUE );
-				else
-					return FALSE;
-			}
-			else
-				printf("ERROR Unsupported device mode\n");
+			r = setBpMask( obj, bp, TRUE );
+			ec2_unlock( obj );
+			return r;
 		}
+		bp = getNextBPIdx( obj );
+		if( bp!=-1 && obj->ops.add_breakpoint( obj, bp, addr ) )
+			r = setBpMask( obj, bp, TRUE );
 	}
-	return FALSE;
+	ec2_unlock( obj );
+	return r;
 }
 
 BOOL ec2_removeBreakpoint( EC2DRV *obj, uint32_t addr )
@@ -1562,7 +2531,52 @@ BOOL ec2_removeBreakpoint( EC2DRV *obj, uint32_t addr )
 }
 
 
+/** Write the firmware pages of the image to the adapter, skipping those
+	whose checksum on the adapter already matches the image.  Pages that
+	are rewritten are checked against the same checksum afterwards by
+	boot_write_flash_page().
+
+	\param obj		Object to act on.
+	\param image	Firmware image, 0x200 bytes per page
+	\param pages	Number of pages in the image
+	\param first	Adapter page the first image page goes into when there
+					is no blockmap
+	\param do_xor	As for ec2_write_firmware()
+	\param blockmap	As for ec2_write_firmware()
+	\returns		TRUE if every page matches the image
+*/
+static BOOL write_firmware_pages( EC2DRV *obj, uint8_t *image, int pages,
+								  uint8_t first, BOOL do_xor, char *blockmap )
+{
+	uint8_t plain[0x200];
+	uint8_t *page;
+	int i, j, written = 0;
+
+	for( i=0; i<pages; i++ )
+	{
+		page = image + i*0x200;
+		boot_select_flash_page( obj, blockmap ? blockmap[i] : i+first );
+		// the checksum is of the data as stored, without the xor
+		for( j=0; j<0x200; j++ )
+			plain[j] = do_xor ? page[j] : page[j] ^ 0x55;
+		if( boot_calc_page_cksum( obj )!=boot_local_calc_page_cksum( plain ) )
+		{
+			boot_erase_flash_page( obj );
+			if( !boot_write_flash_page( obj, page, do_xor ) )
+				return FALSE;
+			written++;
+		}
+		update_progress( obj, (i+1)*100/pages );
+	}
+	if( obj->debug )
+		printf("firmware: %i of %i pages rewritten\n", written, pages );
+	return TRUE;
+}
+
+
 /**	Write the data pointed to by image into the flash memory of the EC2/3.
+	Pages the adapter already holds are left alone, so updating an adapter
+	that is current only costs a checksum per page.
 
 	\param image	buffer containing the firmware image.
 	\param len		Length of the image in bytes (shoulden't ever change)
@@ -1576,7 +2590,6 @@ BOOL ec2_write_firmware( EC2DRV *obj, char *image, uint16_t len,
 					     char *blockmap )
 {
 	DUMP_FUNC();
-	int i;
 	BOOL r = FALSE;
 
 	if( obj->dbg_adaptor==EC2 )
@@ -1584,16 +2597,10 @@ BOOL ec2_write_firmware( EC2DRV *obj, char *image, uint16_t len,
 		update_progress( obj, 0 );
 		ec2_reset( obj );
 		trx( obj, "\x55", 1, "\x5A", 1 );
-		for(i=0; i<14;i++)
-		{
-			// +2 below for first block of app
-			boot_select_flash_page(obj, (blockmap) ? blockmap[i] : i+2 );
-			//printf("block = 0x%02x\n",(blockmap) ? blockmap[i] : i+2);
-			boot_erase_flash_page(obj);
-			if( !boot_write_flash_page(obj,(uint8_t*)image+(i*0x200),do_xor) )
-				return FALSE;
-			update_progress( obj, (i+1)*100/14 );
-		}
+		// +2 for first block of app
+		if( !write_firmware_pages( obj, (uint8_t*)image, 14, 2, do_xor,
+								   blockmap ) )
+			return FALSE;
 		boot_select_flash_page(obj,0x0c);
 		ec2_reset( obj );
 		r = trx( obj, "\x55", 1, "\x5a", 1 );
@@ -1603,21 +2610,10 @@ BOOL ec2_write_firmware( EC2DRV *obj, char *image, uint16_t len,
 	{
 		update_progress( obj, 0 );
 		trx( obj, "\x05\x17\xff",3,"\xff",1);
-		int i;
-		for( i=0; i<19; i++)
-		{
-			// +0x0c below for first block of app
-			/*
-			printf("block = 0x%02x, addr= 0x%04x\n",
-					(blockmap) ? blockmap[i] : i+0x0b,
-					(blockmap[i]-11)*0x200 );
-			*/
-			boot_select_flash_page(obj, (blockmap) ? blockmap[i] : i+0x0b );
-			boot_erase_flash_page(obj);
-			if(!boot_write_flash_page(obj,(uint8_t*)image+(i*0x200),do_xor))
-				return FALSE;
-			update_progress( obj, (i+1)*100/19 );
-		}
+		// +0x0b for first block of app
+		if( !write_firmware_pages( obj, (uint8_t*)image, 19, 0x0b, do_xor,
+								   blockmap ) )
+			return FALSE;
 		boot_select_flash_page(obj,0x0c);
 		ec2_disconnect(obj);
 		return TRUE;
@@ -1640,18 +2636,210 @@ inline static void update_progress( EC2DRV *obj, uint8_t percent )
 
 }
 
+/** Take the per connection command lock.
+	Every library call that talks to the adapter holds this while it sends
+	its commands and collects the replies, so several threads can share one
+	EC2DRV without their traffic interleaving.  The lock is recursive, hold
+	it yourself to make a group of calls atomic or when using the
+	ec2_queue_*() functions directly.
+*/
+void ec2_lock( EC2DRV *obj )
+{
+	if( obj->lock_ready )
+	{
+		pthread_mutex_lock( &obj->lock );
+		obj->lock_depth++;
+	}
+}
+
+/** Release the lock taken by ec2_lock().
+	Leaving the outermost lock ends the library call, so the trace stack is
+	emptied there in case a function on it returned without DUMP_FUNC_END().
+*/
+void ec2_unlock( EC2DRV *obj )
+{
+	if( obj->lock_ready )
+	{
+		if( --obj->lock_depth==0 )
+			obj->trace_depth = 0;
+		pthread_mutex_unlock( &obj->lock );
+	}
+}
+
+static void init_lock( EC2DRV *obj )
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init( &attr );
+	pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+	pthread_mutex_init( &obj->lock, &attr );
+	pthread_mutexattr_destroy( &attr );
+	obj->lock_depth = 0;
+	obj->lock_ready = TRUE;
+}
+
 /** Send a block of characters to the port and check for the correct reply
   */
 BOOL trx( EC2DRV *obj, char *txbuf, int txlen, char *rxexpect, int rxlen )
 {
 	char rxbuf[256];
+	BOOL r = FALSE;
+	ec2_lock( obj );
 	write_port( obj, txbuf, txlen );
 	if( read_port( obj, rxbuf, rxlen ) )
-		return memcmp( rxbuf, rxexpect, rxlen )==0 ? TRUE : FALSE;
-	else
+		r = memcmp( rxbuf, rxexpect, rxlen )==0 ? TRUE : FALSE;
+	ec2_unlock( obj );
+	return r;
+}
+
+
+/** Add a command to the transmit queue.
+	Queued commands are not sent until ec2_queue_flush() is called or the
+	queue fills up.  On the EC3 all queued commands are then written back to
+	back and the replies collected afterwards, so several requests are in
+	flight at once instead of waiting for each reply in turn.
+	Don't mix direct port access with queued commands, flush first.
+	If other threads share obj hold ec2_lock() from the first queued command
+	until the flush.
+
+	\param obj		ec2drv object to act on.
+	\param txbuf	Command to send, copied into the queue.
+	\param txlen	Length of command, at most EC2_QUEUE_TX_MAX bytes.
+	\param rxbuf	Buffer to receive the reply, must stay valid until flushed.
+	\param rxlen	Number of reply bytes expected.
+	\returns		TRUE on success, FALSE if the command is too long or an
+					automatic flush failed.
+*/
+BOOL ec2_queue_cmd( EC2DRV *obj, char *txbuf, int txlen, char *rxbuf, int rxlen )
+{
+	BOOL r = TRUE;
+	EC2_QCMD *q;
+	
+	if( txlen>EC2_QUEUE_TX_MAX )
+		return FALSE;
+	if( obj->queue_len==EC2_QUEUE_DEPTH )
+		r = ec2_queue_flush( obj );
+	q = &obj->queue[obj->queue_len++];
+	memcpy( q->pkt+1, txbuf, txlen );
+	q->txlen	= txlen;
+	q->rx		= rxbuf;
+	q->rxlen	= rxlen;
+	q->expect	= 0;
+	return r;
+}
+
+/** Queued equivalent of trx().
+	The reply is checked against rxexpect when the queue is flushed and the
+	result is folded into the return value of ec2_queue_flush().
+	rxexpect must stay valid until the queue is flushed.
+*/
+BOOL ec2_queue_trx( EC2DRV *obj, char *txbuf, int txlen,
+					const char *rxexpect, int rxlen )
+{
+	BOOL r;
+	EC2_QCMD *q;
+	
+	if( rxlen>(int)sizeof(q->ack) )
 		return FALSE;
+	r = ec2_queue_cmd( obj, txbuf, txlen, 0, rxlen );
+	q = &obj->queue[obj->queue_len-1];
+	q->rx		= q->ack;
+	q->expect	= rxexpect;
+	return r;
+}
+
+/** Check the reply to queue entry i, recording it in queue_failed if it is
+	missing (ok FALSE) or doesn't match.
+*/
+static BOOL queue_check( EC2DRV *obj, int i, BOOL ok )
+{
+	EC2_QCMD *q = &obj->queue[i];
+	if( ok && q->expect )
+		ok = memcmp( q->rx, q->expect, q->rxlen )==0;
+	if( !ok && obj->queue_failed<0 )
+		obj->queue_failed = i;
+	return ok;
 }
 
+/** Read the reply to queue entry i, see queue_check().
+*/
+static BOOL queue_reply( EC2DRV *obj, int i )
+{
+	EC2_QCMD *q = &obj->queue[i];
+	return queue_check( obj, i, read_port( obj, q->rx, q->rxlen ) );
+}
+
+/** Send all queued commands and collect their replies.
+	The index of the first command that failed is left in obj->queue_failed.
+
+	\param obj		ec2drv object to act on.
+	\returns		TRUE if every reply was received (and matched when an
+					expected reply was given), FALSE otherwise.
+*/
+BOOL ec2_queue_flush( EC2DRV *obj )
+{
+	BOOL r = TRUE;
+	EC2_QCMD *q;
+	int i, got;
+	
+	ec2_lock( obj );
+	obj->queue_failed = -1;
+	if( obj->transport->flush_queue && obj->queue_len>0 )
+	{
+		for( i=0; i<obj->queue_len; i++ )
+		{
+			q = &obj->queue[i];
+			ec2_trace( obj, EC2_TRACE_TX, 0, q->pkt+1, q->txlen );
+			stats_tx( obj, q->pkt+1, q->txlen );
+			if( obj->record_log )
+				ec2_record_tx( obj, q->pkt+1, q->txlen );
+		}
+		got = obj->transport->flush_queue( obj );
+		for( i=0; i<obj->queue_len; i++ )
+		{
+			q = &obj->queue[i];
+			trace_rx( obj, q->rx, q->rxlen, i<got );
+			stats_rx( obj, q->rxlen, i<got );
+			if( obj->record_log )
+				ec2_record_rx( obj, q->rx, q->rxlen, i<got );
+			r &= queue_check( obj, i, i<got );
+		}
+	}
+	else if( obj->dbg_adaptor==EC3 )
+	{
+		for( i=0; i<obj->queue_len; i++ )
+		{
+			q = &obj->queue[i];
+			if( obj->transport->write_pkt )
+			{
+				ec2_trace( obj, EC2_TRACE_TX, 0, q->pkt+1, q->txlen );
+				stats_tx( obj, q->pkt+1, q->txlen );
+				if( obj->record_log )
+					ec2_record_tx( obj, q->pkt+1, q->txlen );
+				r &= obj->transport->write_pkt( obj, q->pkt, q->txlen );
+			}
+			else
+				r &= write_port( obj, q->pkt+1, q->txlen );
+		}
+		for( i=0; i<obj->queue_len; i++ )
+			r &= queue_reply( obj, i );
+	}
+	else
+	{
+		// write_port() flushes the serial buffers before every command so
+		// the EC2 has to be driven one command at a time.
+		for( i=0; i<obj->queue_len; i++ )
+		{
+			q = &obj->queue[i];
+			write_port( obj, q->pkt+1, q->txlen );
+			r &= queue_reply( obj, i );
+		}
+	}
+	obj->queue_len = 0;
+	ec2_unlock( obj );
+	return r;
+}
+
+
 /** Reset the EC2 by turning off DTR for a short period
   */
 void ec2_reset( EC2DRV *obj )
@@ -1659,11 +2847,8 @@ void ec2_reset( EC2DRV *obj )
 	DUMP_FUNC();
 	if( obj->dbg_adaptor==EC2 )
 	{
-		usleep(100);
-		DTR( obj, FALSE );
-		usleep(100);
-		DTR( obj, TRUE );
-		usleep(100000);	// 10ms minimum appears to be about 8ms so play it safe
+		if( obj->transport->reset )
+			obj->transport->reset( obj );
 	}
 	else if( obj->dbg_adaptor==EC3 )
 	{
@@ -1677,16 +2862,394 @@ void ec2_reset( EC2DRV *obj )
 
 
 ///////////////////////////////////////////////////////////////////////////////
-/// COM port control functions                                              ///
+/// Transport independent port functions                                    ///
 ///////////////////////////////////////////////////////////////////////////////
-static BOOL open_port( EC2DRV *obj, const char *port )
+
+/** Choose the transport to use from the port name.
+	"USB" or "USB:<serial>" selects the EC3 / ToolStick, "PLAYBACK:<file>"
+	replays a captured session, "REPLAY:<file>" replays a session log,
+	"RECORD:<file>,<port>" logs the session to file while using port,
+	"LOOPBACK" uses the in memory loopback and anything else is treated as a
+	serial port with an EC2 attached.
+	\param obj		ec2drv object to act on.
+	\param port	In: port name from the user, Out: the part passed on to
+					the transport's open function
+	\returns		TRUE on success, FALSE if the port name is malformed.
+*/
+static BOOL select_transport( EC2DRV *obj, const char **port )
 {
-	if( obj->dbg_adaptor==EC3 )
+	const char *lport = *port;
+	if( strncmp(lport,"RECORD:",7)==0 )
+	{
+		char file[256];
+		const char *sep = strchr( lport+7, ',' );
+		if( !sep || sep-(lport+7)>=sizeof(file) )
+			return FALSE;
+		memcpy( file, lport+7, sep-(lport+7) );
+		file[sep-(lport+7)] = '\0';
+		if( !ec2_record_start( obj, file ) )
+			return FALSE;
+		*port = sep+1;
+		return select_transport( obj, port );
+	}
+	if( strncmp(lport,"USB",3)==0 )
+	{
+		// USB mode, EC3
+		obj->dbg_adaptor = EC3;
+		obj->transport = &ec2_usb_transport;
+		if( lport[3]==':' )
+			lport = lport+4;	// point to the remainder ( hopefully the serial number of the adaptor )
+		else if( strlen(lport)==3 )
+			lport = 0;
+		else
+			return FALSE;
+	}
+	else if( strncmp(lport,"PLAYBACK:",9)==0 )
+	{
+		obj->dbg_adaptor = EC2;
+		obj->transport = &ec2_playback_transport;
+		lport = lport+9;
+	}
+	else if( strncmp(lport,"REPLAY:",7)==0 )
 	{
-		return open_ec3( obj, port );
+		obj->dbg_adaptor = EC2;		// the log says which, see replay_open()
+		obj->transport = &ec2_replay_transport;
+		lport = lport+7;
 	}
+	else if( strncmp(lport,"EC2D",4)==0 )
+	{
+		obj->dbg_adaptor = EC2;		// the daemon says which, see daemon_open()
+		obj->transport = &ec2_daemon_transport;
+		if( lport[4]==':' )
+			lport = lport+5;
+		else if( lport[4]=='\0' )
+			lport = 0;
+		else
+			return FALSE;
+	}
+	else if( strncmp(lport,"LOOPBACK",8)==0 )
+	{
+		obj->dbg_adaptor = EC2;
+		obj->transport = &ec2_loopback_transport;
+	}
+	else
+	{
+		obj->dbg_adaptor = EC2;
+		obj->transport = &ec2_serial_transport;
+	}
+	*port = lport;
+	return TRUE;
+}
+
+static BOOL open_port( EC2DRV *obj, const char *port )
+{
+	obj->transport_data = 0;
+	return obj->transport->open( obj, port );
+}
+
+static void close_port( EC2DRV *obj )
+{
+	obj->transport->close( obj );
+	obj->transport_data = 0;
+	ec2_record_stop( obj );
+}
+
+BOOL write_port_ch( EC2DRV *obj, char ch )
+{
+	return write_port( obj, &ch, 1 );
+}
+
+BOOL write_port( EC2DRV *obj, char *buf, int len )
+{
+	ec2_trace( obj, EC2_TRACE_TX, 0, buf, len );
+	stats_tx( obj, buf, len );
+	if( obj->record_log )
+		ec2_record_tx( obj, buf, len );
+	return obj->transport->write( obj, buf, len );
+}
+
+int read_port_ch( EC2DRV *obj )
+{
+	char ch;
+	if( read_port( obj, &ch, 1 ) )
+		return ch;
 	else
+		return -1;
+}
+
+/** Wait fo characters to be received fixed timeout of 100ms.
+	\param obj		ec2drv object to act on.
+	\param buf		buffer to recieve read data.
+	\param len		Number of bytes to read.
+	\returns		TRUE on success, FALSE on timeout ro failure.
+*/
+BOOL read_port( EC2DRV *obj, char *buf, int len )
+{
+	BOOL r = obj->transport->read( obj, buf, len );
+	trace_rx( obj, buf, len, r );
+	stats_rx( obj, len, r );
+	if( obj->record_log )
+		ec2_record_rx( obj, buf, len, r );
+	return r;
+}
+		
+
+/** Wait fo characters to be received using the specified timeout value.
+	\param obj		ec2drv object to act on.
+	\param buf		buffer to recieve read data.
+	\param len		Number of bytes to read.
+	\param ms		Number of milliseconds beefore a timeout will occur.
+	\returns		TRUE on success, FALSE on timeout ro failure.
+*/
+BOOL read_port_tm( EC2DRV *obj, char *buf, int len, uint32_t ms )
+{
+	BOOL r = obj->transport->read_timeout( obj, buf, len, ms );
+	trace_rx( obj, buf, len, r );
+	stats_rx( obj, len, r );
+	if( obj->record_log )
+		ec2_record_rx( obj, buf, len, r );
+	return r;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Statistics                                                              ///
+///////////////////////////////////////////////////////////////////////////////
+
+/** Copy the current protocol statistics.
+	\param obj		ec2drv object to act on.
+	\param stats	Receives the counters.
+*/
+void ec2_get_stats( EC2DRV *obj, EC2_STATS *stats )
+{
+	memcpy( stats, &obj->stats, sizeof(EC2_STATS) );
+}
+
+/** Clear all protocol statistics.
+*/
+void ec2_reset_stats( EC2DRV *obj )
+{
+	memset( &obj->stats, 0, sizeof(EC2_STATS) );
+	obj->stats_head = 0;
+	obj->stats_cnt = 0;
+}
+
+static uint64_t stats_now()
+{
+	struct timeval tv;
+	gettimeofday( &tv, 0 );
+	return (uint64_t)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+/** Record a command being sent and start its round trip timer.
+*/
+static void stats_tx( EC2DRV *obj, char *buf, int len )
+{
+	EC2_STATS_PENDING *p;
+	obj->stats.tx_bytes += len;
+	obj->stats.cmd_count[(uint8_t)buf[0]]++;
+	if( obj->stats_cnt==EC2_QUEUE_DEPTH )
 	{
+		// oldest command never read a reply, forget it
+		obj->stats_head = (obj->stats_head+1) % EC2_QUEUE_DEPTH;
+		obj->stats_cnt--;
+	}
+	p = &obj->stats_pending[(obj->stats_head+obj->stats_cnt) % EC2_QUEUE_DEPTH];
+	p->opcode = buf[0];
+	p->usec = stats_now();
+	obj->stats_cnt++;
+}
+
+/** Record a reply, the first read after a command completes its round trip.
+*/
+static void stats_rx( EC2DRV *obj, int len, BOOL ok )
+{
+	EC2_STATS_PENDING *p;
+	uint32_t usec;
+	int bucket;
+	
+	if( !ok )
+	{
+		obj->stats.timeouts++;
+		return;
+	}
+	obj->stats.rx_bytes += len;
+	if( obj->stats_cnt==0 )
+		return;
+	p = &obj->stats_pending[obj->stats_head];
+	obj->stats_head = (obj->stats_head+1) % EC2_QUEUE_DEPTH;
+	obj->stats_cnt--;
+	
+	usec = stats_now() - p->usec;
+	obj->stats.round_trips++;
+	obj->stats.total_usec += usec;
+	obj->stats.cmd_usec[p->opcode] += usec;
+	if( usec>obj->stats.max_usec )
+		obj->stats.max_usec = usec;
+	for( bucket=0; bucket<EC2_STATS_BUCKETS-1; bucket++ )
+	{
+		if( usec < (32u<<bucket) )
+			break;
+	}
+	obj->stats.latency_hist[bucket]++;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Trace ring                                                              ///
+///////////////////////////////////////////////////////////////////////////////
+
+/// \returns the innermost function entered and not left, 0 if none
+static const char *trace_func( EC2DRV *obj )
+{
+	if( obj->trace_depth==0 )
+		return 0;
+	if( obj->trace_depth>EC2_TRACE_STACK )
+		return obj->trace_stack[EC2_TRACE_STACK-1];
+	return obj->trace_stack[obj->trace_depth-1];
+}
+
+/** Pop back to func, so a function that returned without DUMP_FUNC_END()
+	doesn't get the blame for what its caller does next.
+*/
+static void trace_leave( EC2DRV *obj, const char *func )
+{
+	int i = obj->trace_depth<EC2_TRACE_STACK ? obj->trace_depth
+											   : EC2_TRACE_STACK;
+	if( obj->trace_depth>EC2_TRACE_STACK )
+	{
+		obj->trace_depth--;		// too deep to know, assume it matches
+		return;
+	}
+	while( i-- > 0 )
+	{
+		if( obj->trace_stack[i]==func )
+		{
+			obj->trace_depth = i;
+			return;
+		}
+	}
+}
+
+/** Log an event into the trace ring.
+	This is cheap enough to leave on, unlike debug which prints every
+	transfer, set trace_off to skip it altogether.  The ring is updated
+	under the command lock, DUMP_FUNC() usually comes before ec2_lock().
+
+	\param obj		ec2drv object to act on.
+	\param kind		What happened.
+	\param func		Function being entered or left, 0 for a transfer.
+	\param buf		Bytes transferred, only the first few are kept.
+	\param len		Number of bytes.
+*/
+void ec2_trace( EC2DRV *obj, EC2_TRACE_KIND kind, const char *func,
+				const char *buf, int len )
+{
+	EC2_TRACE_EVENT *e;
+	struct timespec ts;
+
+	if( obj->trace_off )
+		return;
+	// taken directly, this isn't a library call ending in ec2_unlock()
+	if( obj->lock_ready )
+		pthread_mutex_lock( &obj->lock );
+	if( kind==EC2_TRACE_TX && len )
+		obj->trace_op = buf[0];
+	e = &obj->trace[obj->trace_next++ & (EC2_TRACE_DEPTH-1)];
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	e->ns = (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+	e->func = func ? func : trace_func( obj );
+	if( kind==EC2_TRACE_ENTER && obj->trace_depth<255 )
+	{
+		if( obj->trace_depth<EC2_TRACE_STACK )
+			obj->trace_stack[obj->trace_depth] = func;
+		obj->trace_depth++;
+	}
+	else if( kind==EC2_TRACE_LEAVE )
+		trace_leave( obj, func );
+	e->kind = kind;
+	e->opcode = obj->trace_op;
+	e->len = len;
+	if( buf )
+		memcpy( e->data, buf, len<EC2_TRACE_BYTES ? len : EC2_TRACE_BYTES );
+	if( obj->lock_ready )
+		pthread_mutex_unlock( &obj->lock );
+}
+
+static void trace_rx( EC2DRV *obj, char *buf, int len, BOOL ok )
+{
+	if( ok )
+	{
+		ec2_trace( obj, EC2_TRACE_RX, 0, buf, len );
+		return;
+	}
+	ec2_trace( obj, EC2_TRACE_TIMEOUT, 0, 0, len );
+	if( obj->trace_dump_on_error )
+		ec2_trace_dump( obj, stderr );
+}
+
+/** Print the events in the trace ring, oldest first, and empty it.
+	Times are from the oldest event printed.
+	\param obj		ec2drv object to act on.
+	\param f		Where to print them.
+*/
+void ec2_trace_dump( EC2DRV *obj, FILE *f )
+{
+	static const char *kinds[] = { "enter", "leave", "TX", "RX", "timeout" };
+	uint32_t n, i, j;
+	uint64_t t0 = 0;
+
+	if( obj->lock_ready )
+		pthread_mutex_lock( &obj->lock );
+	n = obj->trace_next<EC2_TRACE_DEPTH ? obj->trace_next : EC2_TRACE_DEPTH;
+
+	fprintf( f, "Trace, %u of %u events\n", n, obj->trace_next );
+	for( i=obj->trace_next-n; i!=obj->trace_next; i++ )
+	{
+		EC2_TRACE_EVENT *e = &obj->trace[i & (EC2_TRACE_DEPTH-1)];
+		if( i==obj->trace_next-n )
+			t0 = e->ns;
+		fprintf( f, "%12.6f  %-7s %-32s", (e->ns-t0)/1e9, kinds[e->kind],
+				 e->func ? e->func : "-" );
+		if( e->kind>=EC2_TRACE_TX )
+		{
+			fprintf( f, " 0x%02x %4u ", e->opcode, e->len );
+			for( j=0; e->kind!=EC2_TRACE_TIMEOUT && j<e->len &&
+					  j<EC2_TRACE_BYTES; j++ )
+				fprintf( f, " %02x", e->data[j] );
+			if( e->kind!=EC2_TRACE_TIMEOUT && e->len>EC2_TRACE_BYTES )
+				fprintf( f, " .." );
+		}
+		fprintf( f, "\n" );
+	}
+	obj->trace_next = 0;
+	if( obj->lock_ready )
+		pthread_mutex_unlock( &obj->lock );
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// COM port control functions                                              ///
+///////////////////////////////////////////////////////////////////////////////
+
+const EC2_TRANSPORT ec2_serial_transport =
+{
+	"serial",
+	serial_open,
+	serial_close,
+	serial_write,
+	0,
+	serial_read,
+	serial_read_timeout,
+	serial_flush,
+	serial_reset
+};
+
+/** Open the serial port an EC2 is connected to.
+	115200 8N1 raw, RTS and DTR asserted.
+*/
+static BOOL serial_open( EC2DRV *obj, const char *port )
+{
 	obj->fd = open( port, O_RDWR | O_NOCTTY | O_NDELAY );
 	if( obj->fd == -1 )
 	{
@@ -1737,188 +3300,186 @@ static BOOL open_port( EC2DRV *obj, const char *port )
 	RTS( obj, TRUE );
 	DTR( obj, TRUE );
 	
+	// reads are non blocking, serial_read_timeout() does the waiting
+	fcntl( obj->fd, F_SETFL, O_NONBLOCK );
+	obj->transport_data = calloc( 1, sizeof(SERIAL_STATE) );
+	if( !obj->transport_data )
+	{
+		close( obj->fd );
+		return FALSE;
+	}
+	tcflush( obj->fd, TCIOFLUSH );
 	obj->dbg_info = ec2_GetDbgInfo( -1,-1 );	// EC2 serial debugger
 	return TRUE;
-	}
 }
 
-BOOL write_port_ch( EC2DRV *obj, char ch )
+static void serial_close( EC2DRV *obj )
 {
-	if( obj->dbg_adaptor==EC3 )
-		return write_usb_ch( obj, ch );
-	else
-		return write_port( obj, &ch, 1 );
+	DTR( obj, FALSE );
+	close( obj->fd );
+	free( obj->transport_data );
 }
 
-BOOL write_port( EC2DRV *obj, char *buf, int len )
+/** Send a command to the EC2.
+	Anything still sitting in the input buffer belongs to an earlier command
+	so it is dropped here.  The kernel buffers are only flushed after a
+	timeout or error has left the stream out of step.
+*/
+static BOOL serial_write( EC2DRV *obj, char *buf, int len )
 {
-	if( obj->dbg_adaptor==EC3 )
+	SERIAL_STATE *ss = (SERIAL_STATE*)obj->transport_data;
+	fd_set			output;
+	int				cnt = 0, r;
+
+	ss->head = ss->count = 0;
+	if( ss->stale )
 	{
-		return write_usb( obj, buf, len );
+		tcflush( obj->fd, TCIOFLUSH );
+		ss->stale = FALSE;
 	}
-	else
+	while( cnt<len )
 	{
-		tx_flush( obj );
-		rx_flush( obj );
-		BOOL ok = write( obj->fd, buf, len ) == len;
-		tcdrain(obj->fd);
-//		usleep(10000);				// without this we get TIMEOUT errors
-		if( obj->debug )
+		r = write( obj->fd, buf+cnt, len-cnt );
+		if( r>0 )
+			cnt += r;
+		else if( r<0 && errno==EAGAIN )
 		{
-			printf("TX: ");
-			print_buf( buf, len );
+			FD_ZERO( &output );
+			FD_SET( obj->fd, &output );
+			select( obj->fd+1, NULL, &output, NULL, NULL );
+		}
+		else if( r<0 && errno!=EINTR )
+		{
+			perror("ec2drv: serial write failed");
+			ss->stale = TRUE;
+			return FALSE;
 		}
-		return ok;
-	}
-}
-
-int read_port_ch( EC2DRV *obj )
-{
-	if( obj->dbg_adaptor==EC3 )
-	{
-		return read_usb_ch( obj );
 	}
-	else
+	if( obj->debug )
 	{
-		char ch;
-		if( read_port( obj, &ch, 1 ) )
-			return ch;
-		else
-			return -1;
+		printf("TX: ");
+		print_buf( buf, len );
 	}
+	return TRUE;
 }
 
-/** Wait fo characters to be received fixed timeout of 100ms.
-	\param obj		ec2drv object to act on.
-	\param buf		buffer to recieve read data.
-	\param len		Number of bytes to read.
-	\returns		TRUE on success, FALSE on timeout ro failure.
-*/
-BOOL read_port( EC2DRV *obj, char *buf, int len )
+static BOOL serial_read( EC2DRV *obj, char *buf, int len )
 {
-	return read_port_tm( obj, buf, len, 100000 );
+	return serial_read_timeout( obj, buf, len, 100000 );
 }
-		
 
-/** Wait fo characters to be received using the specified timeout value.
-	\param obj		ec2drv object to act on.
-	\param buf		buffer to recieve read data.
-	\param len		Number of bytes to read.
-	\param ms		Number of milliseconds beefore a timeout will occur.
-	\returns		TRUE on success, FALSE on timeout ro failure.
+/** Read len bytes, waiting at most ms milliseconds in total.
+	Bytes are served from the input buffer first, each read() takes as much
+	as the port has available so a multi byte reply is normally one syscall.
+	\returns TRUE on success, FALSE on timeout or error.
 */
-BOOL read_port_tm( EC2DRV *obj, char *buf, int len, uint32_t ms )
-{
-	if( obj->dbg_adaptor==EC3 )
-	{
-		return read_usb( obj, buf, len );
-	}
-	else
-	{
-		fd_set			input;
-		struct timeval	timeout;
-		int cnt=0, r, n;
-		while(TRUE)
+static BOOL serial_read_timeout( EC2DRV *obj, char *buf, int len, uint32_t ms )
+{
+	SERIAL_STATE *ss = (SERIAL_STATE*)obj->transport_data;
+	fd_set			input;
+	struct timeval	now, deadline, timeout;
+	int cnt=0, r, n;
+
+	gettimeofday( &deadline, 0 );
+	deadline.tv_sec += ms / 1000;
+	deadline.tv_usec += (ms % 1000) * 1000;
+	if( deadline.tv_usec>=1000000 )
+	{
+		deadline.tv_sec++;
+		deadline.tv_usec -= 1000000;
+	}
+	while(TRUE)
+	{
+		// serve what we already have
+		n = ss->count < len-cnt ? ss->count : len-cnt;
+		memcpy( buf+cnt, ss->buf+ss->head, n );
+		ss->head += n;
+		ss->count -= n;
+		cnt += n;
+		if (cnt == len)
 		{
-//			r = read( obj->fd, cur_ptr, len-cnt );
-//			if( obj->debug )
-			// Initialize the input set
-			FD_ZERO( &input );
-			FD_SET( obj->fd, &input );
-			//	fcntl(obj->fd, F_SETFL, 0);	// block if not enough		characters available
-
-			// Initialize the timeout structure
-			timeout.tv_sec  = 0;		// n seconds timeout
-			timeout.tv_usec = ms*1000;	// timeout
-			
-			// Do the select
-			n = select( obj->fd+1, &input, NULL, NULL,&timeout );
-			if (n < 0)
+			if( obj->debug)
 			{
-//				printf("RX: ");
-//				print_buf( buf, len );
-				perror("select failed");
-				exit(-1);
-				return FALSE;
-			}
-			else if (n == 0)
-			{
-				puts("TIMEOUT");
-				return FALSE;
-			}
-			else
-			{
-				r = read( obj->fd, buf+cnt, len-cnt );
-				if (r < 1)
-				{
-					printf ("Problem !!! This shouldn't happenen.\n");
-					return FALSE;
-				}
-				cnt += r;
-				if( obj->debug )
-				{
-//					printf("RX: ");
-//					print_buf( buf, len );
-				}
-				if (cnt == len)
-				{
-					if( obj->debug)
-					{
-						printf("RX: ");
-						print_buf( buf, len );
-					}
-					return TRUE;
-				}
+				printf("RX: ");
+				print_buf( buf, len );
 			}
+			return TRUE;
 		}
-	}
-}
+		ss->head = 0;
 
+		// try the port before paying for a select
+		r = read( obj->fd, ss->buf, sizeof(ss->buf) );
+		if( r>0 )
+		{
+			ss->count = r;
+			continue;
+		}
+		if( r==0 || (errno!=EAGAIN && errno!=EINTR) )
+		{
+			perror("ec2drv: serial read failed");
+			ss->stale = TRUE;
+			return FALSE;
+		}
 
-static void rx_flush( EC2DRV *obj )
-{
-	tcflush( obj->fd, TCIFLUSH );
+		gettimeofday( &now, 0 );
+		if( !timercmp( &now, &deadline, < ) )
+		{
+			puts("TIMEOUT");
+			ss->stale = TRUE;
+			return FALSE;
+		}
+		timersub( &deadline, &now, &timeout );
+		FD_ZERO( &input );
+		FD_SET( obj->fd, &input );
+		n = select( obj->fd+1, &input, NULL, NULL, &timeout );
+		if( n<0 && errno!=EINTR )
+		{
+			perror("ec2drv: select failed");
+			ss->stale = TRUE;
+			return FALSE;
+		}
+	}
 }
 
-static void tx_flush( EC2DRV *obj )
+static void serial_flush( EC2DRV *obj )
 {
-	tcflush( obj->fd, TCOFLUSH );
+	SERIAL_STATE *ss = (SERIAL_STATE*)obj->transport_data;
+	ss->head = ss->count = 0;
+	ss->stale = FALSE;
+	tcflush( obj->fd, TCIOFLUSH );
 }
 
-static void close_port( EC2DRV *obj )
+/** Reset the EC2 by turning off DTR for a short period
+*/
+static void serial_reset( EC2DRV *obj )
 {
-	if( obj->dbg_adaptor==EC3 )
-		close_ec3( obj );
-	else
-		close( obj->fd );
+	usleep(100);
+	DTR( obj, FALSE );
+	usleep(100);
+	DTR( obj, TRUE );
+	usleep(100000);	// 10ms minimum appears to be about 8ms so play it safe
 }
 
 static void DTR( EC2DRV *obj, BOOL on )
 {
-	if( obj->dbg_adaptor==EC2 )
-	{
-		int status;
-		ioctl( obj->fd, TIOCMGET, &status );
-		if( on )
-			status |= TIOCM_DTR;
-		else
-			status &= ~TIOCM_DTR;
-		ioctl( obj->fd, TIOCMSET, &status );
-	}
+	int status;
+	ioctl( obj->fd, TIOCMGET, &status );
+	if( on )
+		status |= TIOCM_DTR;
+	else
+		status &= ~TIOCM_DTR;
+	ioctl( obj->fd, TIOCMSET, &status );
 }
 
 static void RTS( EC2DRV *obj, BOOL on )
 {
-	if( obj->dbg_adaptor==EC2 )
-	{
-		int status;
-		ioctl( obj->fd, TIOCMGET, &status );
-		if( on )
-			status |= TIOCM_RTS;
-		else
-			status &= ~TIOCM_RTS;
-		ioctl( obj->fd, TIOCMSET, &status );
-	}
+	int status;
+	ioctl( obj->fd, TIOCMGET, &status );
+	if( on )
+		status |= TIOCM_RTS;
+	else
+		status &= ~TIOCM_RTS;
+	ioctl( obj->fd, TIOCMSET, &status );
 }
 
 static void print_buf( char *buf, int len )
@@ -1958,38 +3519,42 @@ extern int usb_debug;		///< control libusb debugging
   adds length byte
 */
 static BOOL write_usb( EC2DRV *obj, char *buf, int len )
+{
+	if( len>EC2_QUEUE_TX_MAX )
+		return FALSE;
+	memcpy( obj->usb_tx+1, buf, len );
+	return write_usb_pkt( obj, obj->usb_tx, len );
+}
+
+/* write a command that already has room for the length byte in pkt[0].
+  the command itself starts at pkt+1, no copy is made.
+*/
+static BOOL write_usb_pkt( EC2DRV *obj, char *pkt, int len )
 {
 	int r;
-	char *txbuf = malloc( len + 1 );
-	txbuf[0] = len;
-	memcpy( txbuf+1, buf, len );
+#ifdef HAVE_LIBUSB_1_0
+	if( obj->ec3_async )
+		return ec3_async_write( obj->ec3_async, pkt+1, len );
+#endif
+	pkt[0] = len;
 	if( obj->debug )
 	{
 		printf("TX: ");
-		print_buf(txbuf,len+1);
+		print_buf(pkt,len+1);
 	}
 	
 	r = usb_interrupt_write(obj->ec3,
 							obj->dbg_info->usb_out_endpoint,
-							txbuf, len + 1, 1000 );
+							pkt, len + 1, 1000 );
 	
 	if(r<0)
 		USB_ERROR("usb_interrupt_write",r);
 
-	free( txbuf );
 	//usleep(10);
 	return r > 0;
 }
 
 
-/** write a single byte to the EC3 using USB.
-	This should only be used for writes that have exactly 1 byte of data and 1 length byte.
- */
-static BOOL write_usb_ch( EC2DRV *obj, char ch )
-{
-	return write_usb( obj, &ch, 1 );
-}
-
 /**	Read a complete result from the EC3, stripping off length byte.
 	This read has been modified to read 64 bytes every time and only return the
 	requested number of bytes.
@@ -2003,12 +3568,25 @@ static BOOL write_usb_ch( EC2DRV *obj, char ch )
 	\param	len		Number of bytes the caller wants to recieve in their buffer
 */
 static BOOL read_usb( EC2DRV *obj, char *buf, int len )
+{
+	return read_usb_tm( obj, buf, len, 8000 );	// 8 second timeout.
+}
+
+/** Read a reply from the EC3 waiting at most ms milliseconds.
+*/
+static BOOL read_usb_tm( EC2DRV *obj, char *buf, int len, uint32_t ms )
 {
 	int r;
-	char *rxbuf = malloc( 64 );
+#ifdef HAVE_LIBUSB_1_0
+	if( obj->ec3_async )
+		return ec3_async_read( obj->ec3_async, buf, len, ms );
+#endif
+	char *rxbuf = obj->usb_rx;
+	if( len>EC2_USB_PACKET-1 )
+		len = EC2_USB_PACKET-1;
 	r = usb_interrupt_read( obj->ec3,
 							obj->dbg_info->usb_in_endpoint,
-							rxbuf, 64, 8000 );	// 8 second timeout.
+							rxbuf, EC2_USB_PACKET, ms );
 	
 	if( obj->debug )
 	{
@@ -2016,30 +3594,23 @@ static BOOL read_usb( EC2DRV *obj, char *buf, int len )
 		print_buf(rxbuf,len+1);
 	}
 	memcpy( buf, rxbuf+1, len );
-	free( rxbuf );
 	if(r<0)
 		USB_ERROR("usb_interrupt_read",r);
 	//usleep(10);
 	return r > 0;
 }
 
-/** read a single byte from the EC3 using USB.
-	This should only be used for replies that have exactly 1 byte of data and 1 length byte.
+/** Nothing to flush, every EC3 reply is a complete packet.
 */
-static int read_usb_ch( EC2DRV *obj )
+static void flush_usb( EC2DRV *obj )
 {
-	char ch;
-	if( read_usb( obj, &ch, 1 ) )
-		return ch;
-	else
-		return -1;
 }
 
 
 /** Initialise communications with an EC3.
 	Search for an EC3 then initialise communications with it.
 */
-BOOL open_ec3( EC2DRV *obj, const char *port )
+static BOOL open_ec3( EC2DRV *obj, const char *port )
 {
 	struct usb_bus *busses;
 	struct usb_bus *bus;
@@ -2139,6 +3710,17 @@ ready:
 //	printf("idVendor = %04x\n",(unsigned int)ec3descr->idVendor);
 //	printf("idProduct = %04x\n",(unsigned int)ec3descr->idProduct);
 //	printf("dbg_info = %p\n",dbg_info);
+#ifdef HAVE_LIBUSB_1_0
+	// Prefer the asynchronous backend, it keeps IN transfers queued ahead
+	obj->dbg_info = dbg_info;
+	obj->ec3_async = ec3_async_open( dbg_info, port );
+	if( obj->ec3_async )
+	{
+		ec3_async_set_debug( obj->ec3_async, obj->debug );
+		return TRUE;
+	}
+	// fall back to the synchronous libusb-0.1 path
+#endif
 	obj->ec3 = usb_open(ec3dev);
 	obj->dbg_info = dbg_info;
 //	printf("open ec3 = 0x%x\n",obj->ec3);
@@ -2169,24 +3751,39 @@ ready:
 }
 
 
-void close_ec3( EC2DRV *obj )
+static void close_ec3( EC2DRV *obj )
 {
 	DUMP_FUNC();
 	int r;
-#ifdef HAVE_USB_DETACH_KERNEL_DRIVER_NP
-	r = usb_detach_kernel_driver_np( obj->ec3, 0);
-	if(r<0)
-		USB_ERROR("usb_detach_kernel_driver_np",r);
+#ifdef HAVE_LIBUSB_1_0
+	if( obj->ec3_async )
+	{
+		ec3_async_close( obj->ec3_async, TRUE );
+		obj->ec3_async = 0;
+		DUMP_FUNC_END();
+		return;
+	}
 #endif
 	r = usb_release_interface( obj->ec3, 0 );
-	if(r<0)
-		USB_ERROR("usb_release_interface",r);
-	usb_close(obj->ec3);
-	if(r<0)
-		USB_ERROR("usb_close",r);
+	//assert(r == 0);
+	usb_reset( obj->ec3 );
+	r = usb_close( obj->ec3 );
+	//assert(r == 0);
 	DUMP_FUNC_END();
 }
 
+const EC2_TRANSPORT ec2_usb_transport =
+{
+	"usb",
+	open_ec3,
+	close_ec3,
+	write_usb,
+	write_usb_pkt,
+	read_usb,
+	read_usb_tm,
+	flush_usb,
+	0
+};
 
 
 /** Finc the debugger info tfor the sdpecified vendor id and product id.
@@ -22,6 +22,8 @@
 #ifndef EC2_H
 #define EC2_H
 #include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,37 +35,454 @@ extern "C" {
 #define DUMP_FUNC()		printf("Function = %s\n",__PRETTY_FUNCTION__ );
 #define DUMP_FUNC_END()	printf("End Function = %s\n",__PRETTY_FUNCTION__ );
 #else
-#define DUMP_FUNC()
-#define DUMP_FUNC_END()
+// Logged into the trace ring instead, these need an EC2DRV *obj in scope
+#define DUMP_FUNC()		ec2_trace( obj, EC2_TRACE_ENTER, __func__, 0, 0 );
+#define DUMP_FUNC_END()	ec2_trace( obj, EC2_TRACE_LEAVE, __func__, 0, 0 );
 #endif	
 
 #include "devices.h"
+#include "ihex.h"
+
+#define EC2_QUEUE_DEPTH		8		///< Maximum number of commands kept in flight
+#define EC2_USB_PACKET		64		///< EC3 interrupt packet size
+#define EC2_QUEUE_TX_MAX	(EC2_USB_PACKET-1)	///< Largest command that fits in one EC3 packet
+
+/** A command waiting in the transmit queue.
+	See ec2_queue_cmd() and ec2_queue_flush().
+*/
+typedef struct
+{
+	char		pkt[EC2_USB_PACKET];	///< pkt[0] reserved for the EC3 length byte, command follows
+	int			txlen;					///< Number of command bytes in pkt
+	char		*rx;					///< Where the reply is stored
+	int			rxlen;					///< Number of reply bytes expected
+	const char	*expect;				///< If non NULL the reply must match this
+	char		ack[8];					///< Reply storage for ec2_queue_trx()
+} EC2_QCMD;
+
+#define EC2_BP_ADDR_UNKNOWN	0xffffffff	///< bpaddr[] value when the hardware register contents aren't known
+
+#define EC2_STATS_BUCKETS	16	///< Latency histogram buckets, bucket n holds round trips < 32us<<n
+
+/** Protocol statistics, see ec2_get_stats().
+	A round trip is measured from a command being written to the first read
+	of its reply completing.
+*/
+typedef struct
+{
+	uint32_t	cmd_count[256];		///< Commands sent by opcode (first byte)
+	uint64_t	cmd_usec[256];		///< Cumulative round trip time by opcode
+	uint64_t	tx_bytes;			///< Bytes written to the adapter
+	uint64_t	rx_bytes;			///< Bytes read back
+	uint32_t	round_trips;		///< Replies received
+	uint64_t	total_usec;			///< Sum of all round trip times
+	uint32_t	max_usec;			///< Slowest round trip
+	uint32_t	timeouts;			///< Reads that timed out or failed
+	uint32_t	retries;			///< Polls repeated waiting for the target to halt
+	uint32_t	latency_hist[EC2_STATS_BUCKETS];
+} EC2_STATS;
+
+#define EC2_TRACE_DEPTH		256		///< Events kept in the trace ring, a power of 2
+#define EC2_TRACE_BYTES		8		///< Leading bytes kept of each transfer
+#define EC2_TRACE_STACK		8		///< Nested DUMP_FUNC() names kept
+
+typedef enum
+{
+	EC2_TRACE_ENTER,		///< DUMP_FUNC()
+	EC2_TRACE_LEAVE,		///< DUMP_FUNC_END()
+	EC2_TRACE_TX,			///< bytes written to the adapter
+	EC2_TRACE_RX,			///< bytes read back
+	EC2_TRACE_TIMEOUT		///< a read that failed, len is what was wanted
+} EC2_TRACE_KIND;
+
+/** One entry in the trace ring, see ec2_trace_dump().
+	Kept small and fixed size so the ring can stay on all the time.
+*/
+typedef struct
+{
+	uint64_t	ns;					///< CLOCK_MONOTONIC
+	const char	*func;				///< Function last entered, 0 if none
+	uint16_t	len;				///< Transfer length
+	uint8_t		kind;				///< EC2_TRACE_KIND
+	uint8_t		opcode;				///< Command sent, or the one replied to
+	uint8_t		data[EC2_TRACE_BYTES];
+} EC2_TRACE_EVENT;
+
+/** A command waiting for its reply, used for the round trip timing.
+*/
+typedef struct
+{
+	uint8_t		opcode;
+	uint64_t	usec;
+} EC2_STATS_PENDING;
+
+/** What ec2_connect() found last time it connected through a given adapter.
+	Point EC2DRV::profile at one of these to let the next ec2_connect() through
+	the same port skip mode detection and the device table search, only the
+	device id is read back to check the same target is still attached.  If it
+	isn't the full detection is run and the profile updated.
+*/
+typedef struct
+{
+	BOOL			valid;				///< FALSE until a connect has filled it in
+	char			port[255];			///< Port / adapter serial the profile belongs to
+	EC2_MODE		mode;				///< Mode the target was found to use
+	uint16_t		idrev;				///< device_id() of the target
+	DEVICE			*dev;
+} EC2_CONN_PROFILE;
+
+/** Timings used to choose between erasing flash by sector and a full chip
+	erase, see ec2_set_erase_costs().  ec2bench's erase_sector, erase_chip,
+	flash_read and flash_write tests measure them for a given setup.
+*/
+typedef struct
+{
+	uint32_t		sector_erase_us;	///< Erasing one sector, 0 selects the defaults for the mode
+	uint32_t		chip_erase_us;		///< Erasing the whole device
+	uint32_t		read_us_per_kb;		///< Reading flash back
+	uint32_t		write_us_per_kb;	///< Programming erased flash
+} EC2_ERASE_COSTS;
+
+// Defaults, rough figures for an EC3 on full speed USB
+#define EC2_C2_SECTOR_ERASE_US		40000
+#define EC2_C2_CHIP_ERASE_US		300000
+#define EC2_C2_READ_US_PER_KB		4000
+#define EC2_C2_WRITE_US_PER_KB		25000
+#define EC2_JTAG_SECTOR_ERASE_US	30000
+#define EC2_JTAG_CHIP_ERASE_US		250000
+#define EC2_JTAG_READ_US_PER_KB		6000
+#define EC2_JTAG_WRITE_US_PER_KB	30000
+
+struct ec2drv;
+
+/** Target access for one debug mode.
+	ec2_connect() copies the table for the mode in use into the connection,
+	then replaces the entries that depend on the adapter or device (xdata
+	on C2 goes through EMIF, EC3 block transfers or EC2 single bytes), so
+	the ec2_* functions call straight through without testing the mode,
+	adapter or device again.  Entries a mode doesn't have are 0.
+*/
+typedef struct ec2_mode_ops
+{
+	const char	*name;
+	uint16_t (*device_id)( struct ec2drv *obj );
+	uint16_t (*unique_device_id)( struct ec2drv *obj );
+	void (*core_suspend)( struct ec2drv *obj );
+
+	void (*read_ram)( struct ec2drv *obj, char *buf, int start_addr, int len );
+	void (*read_ram_sfr)( struct ec2drv *obj, char *buf, int start_addr, int len,
+						  BOOL sfr );
+	BOOL (*write_ram)( struct ec2drv *obj, char *buf, int start_addr, int len );
+	void (*write_sfr)( struct ec2drv *obj, uint8_t value, uint8_t addr );
+	/// Queue reading len SFRs from addr, buf needs room for len+1 bytes
+	BOOL (*queue_read_sfr)( struct ec2drv *obj, uint8_t addr, uint8_t len,
+							char *buf );
+	BOOL (*queue_write_sfr)( struct ec2drv *obj, uint8_t addr, uint8_t value );
+	BOOL (*read_xdata)( struct ec2drv *obj, char *buf, int start_addr, int len );
+	BOOL (*write_xdata)( struct ec2drv *obj, char *buf, int start_addr, int len );
+
+	BOOL (*read_flash)( struct ec2drv *obj, uint8_t *buf, uint32_t start_addr,
+						int len, BOOL scratchpad );
+	BOOL (*write_flash)( struct ec2drv *obj, uint8_t *buf, uint32_t start_addr,
+						 int len, BOOL scratchpad );
+	/// Write, erasing and merging the sectors touched itself, may be 0
+	BOOL (*write_flash_block)( struct ec2drv *obj, uint32_t addr, uint8_t *buf,
+							   uint32_t len, BOOL save, BOOL scratchpad );
+	BOOL (*erase_flash)( struct ec2drv *obj );
+	BOOL (*erase_flash_sector)( struct ec2drv *obj, uint32_t sector_addr,
+								BOOL scratchpad );
+	void (*end_flash_access)( struct ec2drv *obj );	///< may be 0
+
+	uint16_t (*read_pc)( struct ec2drv *obj );
+	void (*set_pc)( struct ec2drv *obj, uint16_t addr );
+	uint16_t (*step)( struct ec2drv *obj );
+	/// Queue one step and a read of the PC after it into pc (2 bytes)
+	void (*queue_step)( struct ec2drv *obj, char *pc );
+	uint8_t		step_cmds;			///< Queue entries used by queue_step()
+	BOOL (*go)( struct ec2drv *obj );
+	BOOL (*halt)( struct ec2drv *obj );
+	BOOL (*halt_poll)( struct ec2drv *obj );
+	BOOL (*reset)( struct ec2drv *obj );
+	BOOL (*add_breakpoint)( struct ec2drv *obj, uint8_t bp, uint32_t addr );
+	BOOL (*update_bp_enable_mask)( struct ec2drv *obj );
+
+	uint8_t		sfr_block;			///< Most SFRs one queue_read_sfr() may read
+	EC2_ERASE_COSTS	erase_costs;	///< Defaults for ec2_get_erase_costs()
+} EC2_MODE_OPS;
+
+extern const EC2_MODE_OPS ec2_jtag_ops;
+extern const EC2_MODE_OPS ec2_c2_ops;
+
+
+/** One debugger command as seen on the wire, for tools decoding session logs.
+	Offsets count from the opcode, multi byte values are low byte first.
+	Each table ends with an entry whose name is 0, the first entry matching
+	a command wins.
+*/
+typedef struct
+{
+	uint8_t		opcode;
+	int8_t		match_ofs;		///< byte that must equal match_val, -1 for none
+	uint8_t		match_val;
+	uint16_t	tx_len;			///< command length without any variable data
+	int8_t		data_ofs;		///< byte holding the data length, -1 for none
+	int8_t		rx_ofs;			///< byte holding the reply length, -1 for none
+	uint8_t		rx_len;			///< fixed reply length, or added to rx_ofs's
+	int8_t		addr_ofs;		///< address, -1 for none
+	uint8_t		addr_len;
+	uint16_t	flags;			///< EC2_OPF_ bits
+	const char	*name;			///< what it does, "read flash"
+	const char	*call;			///< ec2drv call it belongs to, 0 if it sets up the next one
+} EC2_OPCODE;
+
+#define EC2_RX_ANY				0xff	///< reply length unknown, it lasts until the next command
+#define EC2_OPF_DATA16			0x0001	///< data length is 16 bits
+#define EC2_OPF_ADDR_BE			0x0002	///< address is high byte first
+#define EC2_OPF_XDATA			0x0004	///< only while JTAG xdata access is on, in the selected page
+#define EC2_OPF_XDATA_ACCESS	0x0008	///< byte 3 nonzero turns JTAG xdata access on
+#define EC2_OPF_XDATA_PAGE		0x0010	///< byte 3 selects the JTAG xdata page
+#define EC2_OPF_FLASH_ADDR		0x0020	///< the address loads the JTAG flash address
+#define EC2_OPF_FLASH_PTR		0x0040	///< at the JTAG flash address, which moves on by the data length
+#define EC2_OPF_ENTER_BOOT		0x0080	///< the debugger is in its boot loader after this
+#define EC2_OPF_LEAVE_BOOT		0x0100	///< the debugger runs its application after this
+
+extern const EC2_OPCODE ec2_boot_opcodes[];	///< boot loader, until EC2_OPF_LEAVE_BOOT
+extern const EC2_OPCODE ec2_jtag_opcodes[];	///< opcodes below 0x20
+extern const EC2_OPCODE ec2_c2_opcodes[];	///< opcodes 0x20 and above
+
 
 /**	Object for an EC2.
 	Create one of these for every EC you wish to use
 */
-typedef struct
+typedef struct ec2drv
 {
 	// public settings
 	EC2_MODE		mode;				///< Communication method used to communicate with the target chip.
 	DEVICE		*dev;
 	enum  { EC2, EC3 }	dbg_adaptor;	/// set before calling connect so choose your adaptor type
 	BOOL			debug;				///< true to enable debugging on an object, false otherwise
+	BOOL			trace_off;			///< true to stop logging into the trace ring
+	BOOL			trace_dump_on_error;	///< true to dump the trace ring to stderr when a read fails
 	uint8_t			progress;			///< % complete, check from an alternative thread or use callback
 	void (*progress_cbk)(uint8_t percent);	///< called on significant progress update interval
 	char 			port[255];			///< Holds a copy of the port used to communicate with the debugger
+	EC2_CONN_PROFILE	*profile;		///< Optional, cached connection details, see EC2_CONN_PROFILE
+	EC2_ERASE_COSTS	erase_costs;		///< Use ec2_set_erase_costs(), all zero for the mode defaults
+	struct ec2_flash_cache	*flash_cache;	///< Flash contents known on the host, see ec2_flash_cache_open()
 	
 	BOOL connected;					///< True when actually connected
 	// private settings
 	uint8_t			boot_ver;
+	uint8_t			fw_ver;			///< Adapter firmware version, 0 if it wasn't read
 	int				fd;				///< file descriptor for com port
 	uint8_t			bp_flags;		///< mirror of EC2 breakpoint byte
-	uint32_t		bpaddr[4];		///< breakpoint addresses
+	uint32_t		bpaddr[4];		///< breakpoint addresses, kept while disabled so the slot can be reused
 	struct usb_dev_handle	*ec3;	
+	struct ec3_async	*ec3_async;	///< libusb-1.0 async transport, 0 when using libusb-0.1
 	DBG_ADAPTER_INFO	*dbg_info;	///< Information about the partucular debugger, flags etc
+	EC2_QCMD		queue[EC2_QUEUE_DEPTH];	///< Commands waiting for ec2_queue_flush()
+	uint8_t			queue_len;		///< Number of entries used in queue
+	int				queue_failed;	///< First entry that failed in the last flush, -1 if none
+	const struct ec2_transport	*transport;	///< How we talk to the debugger, chosen in ec2_connect()
+	EC2_MODE_OPS	ops;			///< Mode access for this connection, set up by ec2_connect()
+	void			*transport_data;	///< Private state for the transport
+	void			*record_log;	///< Session log being written, see ec2_record_start()
+	char			usb_tx[EC2_USB_PACKET];	///< EC3 packet buffers, avoids allocating per transfer
+	char			usb_rx[EC2_USB_PACKET];
+	EC2_STATS		stats;			///< Protocol statistics since connect or ec2_reset_stats()
+	EC2_STATS_PENDING stats_pending[EC2_QUEUE_DEPTH];	///< Commands awaiting a reply
+	uint8_t			stats_head;
+	uint8_t			stats_cnt;
+	uint8_t			c2_read_block;	///< Largest C2 flash read block the adapter accepts, 0 until probed
+	int32_t			flash_fail_addr;	///< First address the last flash write failed at, -1 if none
+	pthread_mutex_t	lock;			///< Serialises command sequences, see ec2_lock()
+	BOOL			lock_ready;		///< TRUE between connect and disconnect
+	uint32_t		lock_depth;		///< ec2_lock() nesting, see ec2_unlock()
+	uint8_t			flash_access;	///< ec2_begin_flash_access() nesting depth
+	BOOL			flash_access_ready;	///< JTAG flash read set up is in effect
+	int16_t			sfr_page_cur;	///< SFR page selected on the target, -1 if unknown
+	int16_t			sfr_page_user;	///< Page to restore in ec2_sfr_page_sync(), -1 if none
+	EC2_TRACE_EVENT	trace[EC2_TRACE_DEPTH];	///< Recent events, see ec2_trace_dump()
+	uint32_t		trace_next;		///< Events logged since the ring was last emptied
+	const char		*trace_stack[EC2_TRACE_STACK];	///< Functions entered and not left
+	uint8_t			trace_depth;
+	uint8_t			trace_op;		///< Opcode of the last command sent
 } EC2DRV;
 
 
+#define EC2_HALT_POLL_MIN_US	100		///< First back off delay in ec2_target_wait_halt()
+#define EC2_HALT_POLL_MAX_US	20000	///< Longest delay between halt polls
+
+typedef enum { EC2_HALTED, EC2_HALT_TIMEOUT, EC2_HALT_STOPPED } EC2_HALT_RESULT;
+
+/// Result of ec2_target_sample_pc()
+typedef enum { EC2_SAMPLE_OK, EC2_SAMPLE_HALTED, EC2_SAMPLE_FAILED } EC2_SAMPLE_RESULT;
+
+/** Checked by ec2_target_wait_halt() between polls.
+	\returns TRUE to stop waiting.
+*/
+typedef BOOL (*EC2_STOP_FN)( void *ctx );
+
+
+/** Operations used to talk to the debug adapter.
+	ec2_connect() picks one of these from the port name, the protocol code
+	only ever goes through write_port() / read_port() which call these.
+*/
+typedef struct ec2_transport
+{
+	const char	*name;
+	BOOL (*open)( EC2DRV *obj, const char *port );
+	void (*close)( EC2DRV *obj );
+	BOOL (*write)( EC2DRV *obj, char *buf, int len );
+	/// As write but pkt[0] is free for a header and the command is at pkt+1,
+	/// may be 0.
+	BOOL (*write_pkt)( EC2DRV *obj, char *pkt, int len );
+	BOOL (*read)( EC2DRV *obj, char *buf, int len );
+	BOOL (*read_timeout)( EC2DRV *obj, char *buf, int len, uint32_t ms );
+	void (*flush)( EC2DRV *obj );		///< Discard any pending input
+	void (*reset)( EC2DRV *obj );		///< Reset the adapter, may be 0
+	/// Send the commands in obj->queue and collect their replies in one
+	/// exchange, may be 0.  Returns how many replies, in queue order, were
+	/// received.
+	int (*flush_queue)( EC2DRV *obj );
+} EC2_TRANSPORT;
+
+extern const EC2_TRANSPORT ec2_serial_transport;	///< EC2 on an RS-232 port
+extern const EC2_TRANSPORT ec2_usb_transport;		///< EC3 / ToolStick
+extern const EC2_TRANSPORT ec2_playback_transport;	///< Replay a captured session
+extern const EC2_TRANSPORT ec2_loopback_transport;	///< In memory, for testing
+extern const EC2_TRANSPORT ec2_replay_transport;	///< Replay a recorded session log
+
+/** Called by the loopback transport for every command written.
+	Use ec2_loopback_reply() to provide the reply.
+*/
+typedef void (*EC2_LOOPBACK_FN)( EC2DRV *obj, const char *buf, int len,
+								 void *ctx );
+void ec2_loopback_set_responder( EC2_LOOPBACK_FN fn, void *ctx );
+BOOL ec2_loopback_reply( EC2DRV *obj, const char *buf, int len );
+
+// Session recording, replay with "REPLAY:<file>" as the port
+//
+// Log format, all values little endian:
+//	header	"EC2R", uint8 version, uint8 adaptor (0 EC2, 1 EC3),
+//			uint16 usb vendor id, uint16 usb product id
+//	records	uint8 kind, uint32 time since the previous record, uint16 len,
+//			then len data bytes, none for EC2_REC_TIMEOUT
+// Version 2 times are in ns, version 1 in us.  An EC2_REC_SYNC record holds
+// the uint64 CLOCK_MONOTONIC time in ns the deltas that follow count from,
+// it comes first and again after any gap too long for 32 bits.  Readers
+// skip kinds they don't know.
+#define EC2_REC_VERSION		2
+#define EC2_REC_HEADER_LEN	10
+#define EC2_REC_ENTRY_LEN	7		///< record length without the data
+enum
+{
+	EC2_REC_TX='T',			///< bytes sent to the debugger
+	EC2_REC_RX='R',			///< bytes received from the debugger
+	EC2_REC_TIMEOUT='F',	///< a read of len bytes that failed
+	EC2_REC_SYNC='S',		///< uint64 absolute time in ns
+	EC2_REC_LINES='L'		///< 'T' or 'R' side, then EC2_LINE_ bits
+};
+#define EC2_LINE_DTR		0x01	///< as driven by that side
+#define EC2_LINE_RTS		0x02
+
+BOOL ec2_record_start( EC2DRV *obj, const char *file );
+void ec2_record_stop( EC2DRV *obj );
+void ec2_record_tx( EC2DRV *obj, const char *buf, int len );
+void ec2_record_rx( EC2DRV *obj, const char *buf, int len, BOOL ok );
+
+// Adapter pool, see ec2tools/ec2d.c
+//
+// The port "EC2D" or "EC2D:<adapter port>" reaches an adapter held open by
+// the ec2d daemon, over the Unix socket named by $EC2D_SOCKET or EC2D_SOCKET,
+// or over TCP when $EC2D_SOCKET is <host>:<tcp port>, for adapters on
+// another machine.
+// Every transport call is forwarded, writes aren't replied to so a batch of
+// queued commands goes out back to back and only reads wait for the daemon.
+// A client that disconnects cleanly leaves the adapter and target connected,
+// the next ec2_connect() then only checks the device id.
+//
+// A daemon that answers EC2D_OPEN with the EC2D_CAP_CALLS arg also takes a
+// whole command queue in one EC2D_BATCH, and once told the target with
+// EC2D_TARGET, runs memory and flash operations itself (EC2D_CALL), so over
+// a network each costs one round trip rather than one per command.
+//
+// Messages both ways are an EC2D_HEADER_LEN header, uint8 op, uint8 status
+// (0 for success), uint16 data length, uint32 arg, little endian, then the
+// data.
+#define EC2D_SOCKET			"/tmp/ec2d.socket"
+#define EC2D_HEADER_LEN		8
+#define EC2D_SESSION_LEN	9
+#define EC2D_CAP_CALLS		0x01	///< EC2D_OPEN reply arg, has the ops below
+enum
+{
+	EC2D_OPEN='O',		///< data the adapter port, "" for any, replied to with
+						///< its EC2D_SESSION or an error message
+	EC2D_WRITE='W',		///< data the bytes to write
+	EC2D_READ='R',		///< arg timeout in ms, 0 for the default, data the
+						///< uint16 length wanted, replied to with the bytes
+	EC2D_FLUSH='F',
+	EC2D_RESET='X',
+	EC2D_KEEP='K',		///< data the EC2D_SESSION being left for the next client
+	EC2D_BATCH='B',		///< data per command uint8 length, uint16 reply
+						///< length and the command, replied to with arg the
+						///< number of replies received and those replies
+	EC2D_TARGET='T',	///< data the EC2D_SESSION of the target the client
+						///< has connected to, replied to with the status
+	EC2D_CALL='C'		///< arg the EC2D_CALL_ operation, data an
+						///< EC2D_CALL_HEADER_LEN header, uint32 address,
+						///< uint32 length, uint8 EC2D_CALLF_ flags, then the
+						///< data to write, replied to with the data read, for
+						///< writes arg EC2DRV::flash_fail_addr
+};
+#define EC2D_CALL_HEADER_LEN	9
+#define EC2D_CALL_MAX		0x8000	///< most data one EC2D_CALL moves
+enum
+{
+	EC2D_CALL_READ_RAM=1,		///< or SFRs with EC2D_CALLF_SFR
+	EC2D_CALL_WRITE_RAM,
+	EC2D_CALL_READ_XDATA,
+	EC2D_CALL_WRITE_XDATA,
+	EC2D_CALL_READ_FLASH,
+	EC2D_CALL_WRITE_FLASH,
+	EC2D_CALL_WRITE_FLASH_BLOCK,	///< EC2_MODE_OPS::write_flash_block
+	EC2D_CALL_ERASE_FLASH,
+	EC2D_CALL_ERASE_SECTOR,
+	EC2D_CALL_READ_PC			///< replied to with the uint16 PC
+};
+#define EC2D_CALLF_SFR			0x01
+#define EC2D_CALLF_SCRATCHPAD	0x02
+#define EC2D_CALLF_SAVE			0x04	///< write_flash_block() save argument
+
+/** The state of an adapter held by ec2d.
+*/
+typedef struct
+{
+	uint8_t		adaptor;		///< 0 EC2, 1 EC3
+	uint8_t		connected;		///< the target is connected, the rest is valid
+	uint8_t		mode;			///< EC2_MODE in use
+	uint8_t		fw_ver;			///< adapter firmware version
+	uint16_t	usb_vendor_id;	///< of the adapter, 0xffff for the serial EC2
+	uint16_t	usb_product_id;
+	uint8_t		unique_id;		///< DEVICE::unique_id of the target
+} EC2D_SESSION;
+
+extern const EC2_TRANSPORT ec2_daemon_transport;	///< Adapter held by ec2d
+BOOL ec2_open_adapter( EC2DRV *obj, const char *port );
+void ec2_close_adapter( EC2DRV *obj );
+BOOL ec2d_send( int fd, uint8_t op, uint8_t status, uint32_t arg,
+				const char *data, int len );
+BOOL ec2d_recv( int fd, uint8_t *op, uint8_t *status, uint32_t *arg,
+				char *data, int max, int *len );
+void ec2d_put_session( char *buf, const EC2D_SESSION *s );
+void ec2d_get_session( const char *buf, EC2D_SESSION *s );
+BOOL ec2_daemon_session( EC2DRV *obj, EC2D_SESSION *s );
+void ec2_daemon_set_session( EC2DRV *obj, const EC2D_SESSION *s );
+void ec2_daemon_keep( EC2DRV *obj );
+BOOL ec2_daemon_remote_ops( EC2DRV *obj );
+BOOL ec2_adopt_target( EC2DRV *obj, const EC2D_SESSION *s );
+
+
 
 uint16_t ec2drv_version();
 BOOL ec2_connect( EC2DRV *obj, const char *port );
@@ -79,25 +498,37 @@ BOOL ec2_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len );
 void ec2_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len );
 
 BOOL ec2_read_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len );
+BOOL ec2_begin_flash_access( EC2DRV *obj );
+void ec2_end_flash_access( EC2DRV *obj );
 BOOL ec2_read_flash_scratchpad( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len );
+BOOL ec2_read_flash_crc( EC2DRV *obj, uint32_t start_addr, int len, uint16_t *crc );
+uint16_t ec2_crc16( uint16_t crc, const uint8_t *buf, int len );
 
 BOOL ec2_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len );
 BOOL ec2_write_flash_auto_erase( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len );
+BOOL ec2_write_flash_image( EC2DRV *obj, const IHEX_IMAGE *img );
 BOOL ec2_write_flash_auto_keep( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len );
+BOOL ec2_write_flash_diff( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len );
 BOOL ec2_write_flash_scratchpad( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len );
 BOOL ec2_write_flash_scratchpad_merge( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len );
 BOOL ec2_erase_flash_scratchpad( EC2DRV *obj );
 BOOL ec2_erase_flash_scratchpad_sector( EC2DRV *obj, uint32_t sector_addr );
 void ec2_erase_flash_sector( EC2DRV *obj, uint32_t sector_addr );
 void ec2_erase_flash( EC2DRV *obj );
+void ec2_set_erase_costs( EC2DRV *obj, const EC2_ERASE_COSTS *costs );
+void ec2_get_erase_costs( EC2DRV *obj, EC2_ERASE_COSTS *costs );
 BOOL ec2_target_go( EC2DRV *obj );
 uint16_t ec2_target_run_bp( EC2DRV *obj, BOOL *bRunning );
 BOOL ec2_target_halt( EC2DRV *obj );
 void ec2_target_halt_no_wait( EC2DRV *obj );
 BOOL ec2_target_halt_poll( EC2DRV *obj );
+EC2_SAMPLE_RESULT ec2_target_sample_pc( EC2DRV *obj, uint16_t *pc, BOOL resume );
+EC2_HALT_RESULT ec2_target_wait_halt( EC2DRV *obj, uint32_t timeout_ms,
+									  EC2_STOP_FN stop, void *ctx );
 
 BOOL ec2_target_reset( EC2DRV *obj );
 uint16_t ec2_step( EC2DRV *obj );
+int ec2_step_n( EC2DRV *obj, uint16_t *pcs, int n );
 void read_active_regs( EC2DRV *obj, char *buf );
 uint16_t ec2_read_pc( EC2DRV *obj );
 void ec2_set_pc( EC2DRV *obj, uint16_t addr );
@@ -115,6 +546,7 @@ DBG_ADAPTER_INFO *ec2_GetDbgInfo( uint16_t usb_vendor_id,
 uint8_t flash_lock_byte( EC2DRV *obj );
 uint8_t flash_read_lock( EC2DRV *obj );
 uint8_t flash_write_erase_lock( EC2DRV *obj );
+uint16_t device_id( EC2DRV *obj );
 uint16_t unique_device_id( EC2DRV *obj );
 
 BOOL isBPSet( EC2DRV *obj, int bpid );
@@ -124,6 +556,8 @@ uint8_t ec2_read_paged_sfr(EC2DRV *obj, SFRREG sfr_reg, BOOL *ok );
 BOOL ec2_write_paged_sfr(EC2DRV *obj, SFRREG sfr_reg, uint8_t value);
 uint8_t ec2_read_raw_sfr(EC2DRV *obj, uint8_t addr, BOOL *ok );
 BOOL ec2_write_raw_sfr(EC2DRV *obj, uint8_t addr, uint8_t value );
+BOOL ec2_sfr_page_sync( EC2DRV *obj );
+BOOL ec2_read_sfr_page_bulk( EC2DRV *obj, uint8_t page, uint8_t *buf );
 
 
 
@@ -135,6 +569,23 @@ int read_port_ch( EC2DRV *obj );
 BOOL read_port( EC2DRV *obj, char *buf, int len );
 BOOL read_port_tm( EC2DRV *obj, char *buf, int len, uint32_t ms );
 
+// Statistics
+void ec2_get_stats( EC2DRV *obj, EC2_STATS *stats );
+void ec2_reset_stats( EC2DRV *obj );
+
+// Trace ring
+void ec2_trace( EC2DRV *obj, EC2_TRACE_KIND kind, const char *func,
+				const char *buf, int len );
+void ec2_trace_dump( EC2DRV *obj, FILE *f );
+
+// Command queue, keeps several commands in flight on the EC3
+void ec2_lock( EC2DRV *obj );
+void ec2_unlock( EC2DRV *obj );
+BOOL ec2_queue_cmd( EC2DRV *obj, char *txbuf, int txlen, char *rxbuf, int rxlen );
+BOOL ec2_queue_trx( EC2DRV *obj, char *txbuf, int txlen,
+					const char *rxexpect, int rxlen );
+BOOL ec2_queue_flush( EC2DRV *obj );
+
 void set_flash_addr_jtag( EC2DRV *obj, uint32_t addr );
 void ec2_core_suspend( EC2DRV *obj );
 #ifdef __cplusplus
@@ -0,0 +1,310 @@
+/**	Host side cache of a target's flash contents, see flashcache.h.
+
+	The file is an 8 byte magic, the target's device id and unique id
+	(uint16), flash size and sector size (uint32), the CRC-16 of the sector
+	table (uint16), then the sector table, a known flag (uint8) and the
+	CRC-16 of the usable part (uint16) for each sector, then the flash image.
+	All little endian, unknown sectors are 0xff in the image.
+
+	(C) Ricky White 2006
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include "flashcache.h"
+
+#define FC_MAGIC		"EC2FLC\0\1"
+#define FC_HEADER_LEN	22
+#define FC_SECTOR_LEN	3
+
+struct ec2_flash_cache
+{
+	char		file[1024];
+	uint16_t	idrev;			///< device_id() of the target
+	uint16_t	unique_id;		///< unique_device_id() of the target
+	uint32_t	size;			///< flash_size of the device
+	uint32_t	sector_size;
+	int			nsec;
+	uint8_t		*known;			///< one flag per sector
+	uint8_t		*image;			///< size bytes
+};
+
+static void put_le( uint8_t *p, uint32_t v, int n )
+{
+	int i;
+	for( i=0; i<n; i++, v>>=8 )
+		p[i] = v & 0xff;
+}
+
+static uint32_t get_le( const uint8_t *p, int n )
+{
+	uint32_t v = 0;
+	while( n-- )
+		v = v<<8 | p[n];
+	return v;
+}
+
+/** CRC-16 of each sector's usable part into the sector table, unknown
+	sectors get a 0 flag and CRC.
+*/
+static void build_table( EC2DRV *obj, struct ec2_flash_cache *fc, uint8_t *tbl )
+{
+	uint32_t addr, n;
+	int sec;
+	for( sec=0; sec<fc->nsec; sec++ )
+	{
+		addr = sec*fc->sector_size;
+		n = sector_usable( obj, addr );
+		tbl[sec*FC_SECTOR_LEN] = fc->known[sec];
+		put_le( tbl+sec*FC_SECTOR_LEN+1,
+				fc->known[sec] ? ec2_crc16( 0xFFFF, fc->image+addr, n ) : 0, 2 );
+	}
+}
+
+/** Load the cache file, only if it is for the same target and intact.
+	\returns TRUE if any sector is known.
+*/
+static BOOL load( EC2DRV *obj, struct ec2_flash_cache *fc )
+{
+	uint8_t hdr[FC_HEADER_LEN];
+	uint8_t *tbl = malloc( fc->nsec*FC_SECTOR_LEN );
+	uint8_t *chk = malloc( fc->nsec*FC_SECTOR_LEN );
+	FILE *f = fopen( fc->file, "rb" );
+	BOOL ok = f && tbl && chk;
+	int sec, any = 0;
+
+	ok = ok && fread( hdr, 1, sizeof(hdr), f )==sizeof(hdr) &&
+		 memcmp( hdr, FC_MAGIC, 8 )==0 &&
+		 get_le( hdr+8, 2 )==fc->idrev && get_le( hdr+10, 2 )==fc->unique_id &&
+		 get_le( hdr+12, 4 )==fc->size && get_le( hdr+16, 4 )==fc->sector_size;
+	ok = ok && fread( tbl, FC_SECTOR_LEN, fc->nsec, f )==fc->nsec &&
+		 ec2_crc16( 0xFFFF, tbl, fc->nsec*FC_SECTOR_LEN )==get_le( hdr+20, 2 ) &&
+		 fread( fc->image, 1, fc->size, f )==fc->size;
+	if( ok )
+	{
+		for( sec=0; sec<fc->nsec; sec++ )
+			fc->known[sec] = tbl[sec*FC_SECTOR_LEN]!=0;
+		// the image must match the table
+		build_table( obj, fc, chk );
+		ok = memcmp( tbl, chk, fc->nsec*FC_SECTOR_LEN )==0;
+	}
+	if( f )
+		fclose( f );
+	free( tbl );
+	free( chk );
+	for( sec=0; sec<fc->nsec; sec++ )
+	{
+		if( !ok )
+			fc->known[sec] = 0;
+		any |= fc->known[sec];
+	}
+	if( !ok )
+		memset( fc->image, 0xff, fc->size );
+	return any;
+}
+
+/** Check the sector at addr on the target against the cache.
+	obj->flash_cache must not be set yet so the read reaches the target.
+*/
+static BOOL check_sector( EC2DRV *obj, struct ec2_flash_cache *fc, int sec )
+{
+	uint32_t addr = sec*fc->sector_size;
+	uint32_t n = sector_usable( obj, addr );
+	uint8_t *buf = malloc( n );
+	BOOL ok = buf && ec2_read_flash( obj, buf, addr, n ) &&
+			  memcmp( buf, fc->image+addr, n )==0;
+	free( buf );
+	return ok;
+}
+
+/** Confirm a loaded cache still describes the target, by reading back the
+	first known sector, usually holding the reset vector and so differing
+	between nearly any two programs, and of one other picked at random.
+*/
+static BOOL spot_check( EC2DRV *obj, struct ec2_flash_cache *fc )
+{
+	int first = -1, other = -1, cnt = 0, sec;
+	for( sec=0; sec<fc->nsec; sec++ )
+	{
+		if( !fc->known[sec] )
+			continue;
+		if( first==-1 )
+			first = sec;
+		else if( rand() % ++cnt == 0 )
+			other = sec;			// each equally likely
+	}
+	if( first==-1 )
+		return TRUE;
+	return check_sector( obj, fc, first ) &&
+		   ( other==-1 || check_sector( obj, fc, other ) );
+}
+
+/** Start caching the flash contents of the connected target.
+	The cache file for the adapter port and target is loaded from dir, if
+	there is one and it is still valid, otherwise the cache starts empty.
+	Call after ec2_connect(), ec2_disconnect() saves and closes it.
+
+	\param obj			Object to act on.
+	\param dir			Directory holding the cache files.
+	\returns			FALSE if not connected or out of memory.
+*/
+BOOL ec2_flash_cache_open( EC2DRV *obj, const char *dir )
+{
+	struct ec2_flash_cache *fc;
+	char port[sizeof(obj->port)];
+	int i;
+
+	ec2_flash_cache_close( obj );
+	if( !obj->connected || !obj->dev || obj->dev->flash_sector_size==0 )
+		return FALSE;
+	fc = calloc( 1, sizeof(struct ec2_flash_cache) );
+	if( !fc )
+		return FALSE;
+	fc->size = obj->dev->flash_size;
+	fc->sector_size = obj->dev->flash_sector_size;
+	fc->nsec = (fc->size+fc->sector_size-1) / fc->sector_size;
+	fc->known = calloc( fc->nsec, 1 );
+	fc->image = malloc( fc->size );
+	if( !fc->known || !fc->image )
+	{
+		free( fc->known );
+		free( fc->image );
+		free( fc );
+		return FALSE;
+	}
+	memset( fc->image, 0xff, fc->size );
+	fc->idrev = device_id( obj );
+	fc->unique_id = unique_device_id( obj );
+	// the port names the adapter, keep it to a plain file name
+	for( i=0; obj->port[i] && i<(int)sizeof(port)-1; i++ )
+		port[i] = isalnum( (unsigned char)obj->port[i] ) ? obj->port[i] : '_';
+	port[i] = '\0';
+	snprintf( fc->file, sizeof(fc->file), "%s/%s-%04x-%04x.flash",
+			  dir, port, fc->idrev, fc->unique_id );
+	srand( time(0) ^ getpid() );
+	if( load( obj, fc ) && !spot_check( obj, fc ) )
+	{
+		if( obj->debug )
+			printf("%s is out of date, starting again\n", fc->file );
+		memset( fc->known, 0, fc->nsec );
+		memset( fc->image, 0xff, fc->size );
+	}
+	obj->flash_cache = fc;
+	return TRUE;
+}
+
+
+/** Write the cache file, known sectors only.
+	\param obj			Object to act on.
+	\returns			FALSE if there is no cache or it couldn't be written.
+*/
+BOOL ec2_flash_cache_save( EC2DRV *obj )
+{
+	struct ec2_flash_cache *fc = obj->flash_cache;
+	uint8_t hdr[FC_HEADER_LEN];
+	uint8_t *tbl;
+	char tmp[sizeof(fc->file)+8];
+	FILE *f;
+	BOOL ok;
+
+	if( !fc )
+		return FALSE;
+	tbl = malloc( fc->nsec*FC_SECTOR_LEN );
+	if( !tbl )
+		return FALSE;
+	build_table( obj, fc, tbl );
+	memcpy( hdr, FC_MAGIC, 8 );
+	put_le( hdr+8, fc->idrev, 2 );
+	put_le( hdr+10, fc->unique_id, 2 );
+	put_le( hdr+12, fc->size, 4 );
+	put_le( hdr+16, fc->sector_size, 4 );
+	put_le( hdr+20, ec2_crc16( 0xFFFF, tbl, fc->nsec*FC_SECTOR_LEN ), 2 );
+	// written aside then renamed so a reader never sees half a file
+	snprintf( tmp, sizeof(tmp), "%s.tmp", fc->file );
+	f = fopen( tmp, "wb" );
+	ok = f!=0;
+	ok = ok && fwrite( hdr, 1, sizeof(hdr), f )==sizeof(hdr);
+	ok = ok && fwrite( tbl, FC_SECTOR_LEN, fc->nsec, f )==fc->nsec;
+	ok = ok && fwrite( fc->image, 1, fc->size, f )==fc->size;
+	if( f && fclose( f )!=0 )
+		ok = FALSE;
+	ok = ok && rename( tmp, fc->file )==0;
+	if( !ok )
+		unlink( tmp );
+	free( tbl );
+	return ok;
+}
+
+
+/** Save and free the cache, if there is one.
+	\param obj			Object to act on.
+*/
+void ec2_flash_cache_close( EC2DRV *obj )
+{
+	struct ec2_flash_cache *fc = obj->flash_cache;
+	if( !fc )
+		return;
+	ec2_flash_cache_save( obj );
+	free( fc->known );
+	free( fc->image );
+	free( fc );
+	obj->flash_cache = 0;
+}
+
+
+/** Copy a range out of the cache.
+	\returns TRUE if every sector it touches is known, buf is then filled.
+*/
+BOOL flash_cache_read( EC2DRV *obj, uint8_t *buf, uint32_t addr, int len )
+{
+	struct ec2_flash_cache *fc = obj->flash_cache;
+	uint32_t sec;
+	if( !fc || len<=0 || addr+len>fc->size )
+		return FALSE;
+	for( sec=addr/fc->sector_size; sec<=(addr+len-1)/fc->sector_size; sec++ )
+	{
+		if( !fc->known[sec] )
+			return FALSE;
+	}
+	memcpy( buf, fc->image+addr, len );
+	return TRUE;
+}
+
+
+/** Record data read from the target, sectors read in full become known.
+*/
+void flash_cache_readback( EC2DRV *obj, const uint8_t *buf, uint32_t addr,
+						   int len )
+{
+	struct ec2_flash_cache *fc = obj->flash_cache;
+	uint32_t sec, start, n;
+	if( !fc || len<=0 || addr+len>fc->size )
+		return;
+	for( sec=addr/fc->sector_size; sec<=(addr+len-1)/fc->sector_size; sec++ )
+	{
+		start = sec*fc->sector_size;
+		n = sector_usable( obj, start );
+		if( n && start>=addr && start+n<=addr+len )
+		{
+			memcpy( fc->image+start, buf+start-addr, n );
+			fc->known[sec] = 1;
+		}
+	}
+}
+
+
+/** The sectors touched by a range are being written or erased.
+*/
+void flash_cache_forget( EC2DRV *obj, uint32_t addr, int len )
+{
+	struct ec2_flash_cache *fc = obj->flash_cache;
+	uint32_t sec;
+	if( !fc || len<=0 )
+		return;
+	for( sec=addr/fc->sector_size;
+		 sec<=(addr+len-1)/fc->sector_size && sec<(uint32_t)fc->nsec; sec++ )
+		fc->known[sec] = 0;
+}
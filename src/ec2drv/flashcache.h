@@ -0,0 +1,37 @@
+/**	Host side cache of a target's flash contents.
+	Stations that reprogram the same boards all day spend most of their time
+	reading back flash that hasn't changed.  The cache keeps what is known
+	of the flash of each target, by adapter port, device id and unique id,
+	in a file and serves ec2_read_flash() from it, so differential writes,
+	verification and code reads only go to the target for sectors that are
+	not known.
+
+	A sector is known once it has been read back in full, writing or erasing
+	any of it makes it unknown again until the next read, so a verify after
+	programming still reads what was programmed and only that.  When a cache
+	file is loaded the first sector and one other known sector are read
+	back from the target, if either differs the file is discarded.  Flash
+	changed by the target's own code is not seen by the cache.
+
+	Setting EC2_FLASH_CACHE to a directory makes ec2_connect() open a cache
+	there, ec2_disconnect() saves and closes it.
+
+	(C) Ricky White 2006
+*/
+#ifndef FLASHCACHE_H
+#define FLASHCACHE_H
+#include <stdint.h>
+#include "ec2drv.h"
+
+BOOL ec2_flash_cache_open( EC2DRV *obj, const char *dir );
+BOOL ec2_flash_cache_save( EC2DRV *obj );
+void ec2_flash_cache_close( EC2DRV *obj );
+
+// used by ec2drv.c, the caller holds the connection lock
+BOOL flash_cache_read( EC2DRV *obj, uint8_t *buf, uint32_t addr, int len );
+void flash_cache_readback( EC2DRV *obj, const uint8_t *buf, uint32_t addr,
+						   int len );
+void flash_cache_forget( EC2DRV *obj, uint32_t addr, int len );
+uint32_t sector_usable( EC2DRV *obj, uint32_t sec_addr );	// in ec2drv.c
+
+#endif
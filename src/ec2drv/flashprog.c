@@ -0,0 +1,373 @@
+/**	Pipelined programming, hex files to verified flash in one pass.
+
+	The loader thread feeds the records of the files into a flat copy of
+	the flash and marks the sectors they touch.  Hex files are nearly always
+	written in address order, so once a record of the last file starts
+	beyond a sector that sector is handed to the programmer, which diffs it
+	against the flash (served from the flash cache when it is known there),
+	erases it only if some bit has to go from 0 to 1, writes it with the
+	queued block writes and reads it back to check it.  The verify read of
+	a sector also fetches the next one if that is ready and not cached, so
+	the diff of the next sector costs no extra round trip.  A record that comes back
+	to a sector already handed over just dirties it again and it is done
+	once more, so out of order files still end up programmed correctly.
+
+	(C) Ricky White 2006
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "flashprog.h"
+#include "flashcache.h"
+#include "ihex.h"
+
+/** State shared between the loader and the programmer, everything after
+	cond is protected by mutex.
+*/
+struct ec2_prog_job
+{
+	char			**files;
+	int				nfiles;
+	uint32_t		size;			///< flash size
+	uint32_t		sec_size;
+	int				nsec;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	uint8_t			*image;			///< data from the files indexed by address
+	uint8_t			*mask;			///< non zero for each byte the files set
+	uint8_t			*dirty;			///< per sector, data not handed over yet
+	uint8_t			*ready;			///< per sector, loader has passed it
+	uint8_t			*taken;			///< per sector, handed over before
+	int				file;			///< file being parsed
+	uint32_t		high;			///< one past the highest address in it
+	int				released;		///< sectors below this have been passed
+	BOOL			redo;			///< a passed sector was dirtied again
+	BOOL			loading;		///< loader still running
+	BOOL			abort;			///< programming failed, stop loading
+	BOOL			load_ok;
+	EC2_PROG_STATS	*stats;
+};
+
+static uint64_t now_us()
+{
+	struct timeval tv;
+	gettimeofday( &tv, 0 );
+	return (uint64_t)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+/** Hand sectors from..to-1 that hold new data to the programmer.
+	Caller holds the mutex.
+*/
+static void release( struct ec2_prog_job *job, int from, int to )
+{
+	int sec;
+	for( sec=from; sec<to; sec++ )
+	{
+		if( job->dirty[sec] && !job->ready[sec] )
+		{
+			job->ready[sec] = 1;
+			pthread_cond_signal( &job->cond );
+		}
+	}
+}
+
+/** ihex_parse() callback, store one record.
+*/
+static BOOL store( void *ctx, uint32_t addr, const uint8_t *data, uint32_t n )
+{
+	struct ec2_prog_job *job = (struct ec2_prog_job*)ctx;
+	int sec, passed;
+
+	if( n==0 )
+		return TRUE;
+	if( addr+n > job->size )
+		return FALSE;
+	pthread_mutex_lock( &job->mutex );
+	if( job->abort )
+	{
+		pthread_mutex_unlock( &job->mutex );
+		return FALSE;
+	}
+	memcpy( job->image+addr, data, n );
+	memset( job->mask+addr, 1, n );
+	job->stats->bytes += n;
+	for( sec=addr/job->sec_size; sec<=(addr+n-1)/job->sec_size; sec++ )
+	{
+		if( !job->dirty[sec] && job->taken[sec] )
+			job->stats->revisited++;
+		job->dirty[sec] = 1;
+		if( sec<job->released )
+			job->redo = TRUE;
+	}
+	// a later file may still overwrite anything, so only the last one
+	// releases sectors and only while it is going up through the flash
+	if( job->file==job->nfiles-1 && addr>=job->high )
+	{
+		passed = addr/job->sec_size;
+		if( job->redo )
+			release( job, 0, passed );
+		else if( passed>job->released )
+			release( job, job->released, passed );
+		job->redo = FALSE;
+		if( passed>job->released )
+			job->released = passed;
+	}
+	if( addr+n>job->high )
+		job->high = addr+n;
+	pthread_mutex_unlock( &job->mutex );
+	return TRUE;
+}
+
+static void *loader( void *arg )
+{
+	struct ec2_prog_job *job = (struct ec2_prog_job*)arg;
+	uint64_t start = now_us();
+	BOOL ok = TRUE;
+	int i;
+
+	for( i=0; i<job->nfiles && ok; i++ )
+	{
+		pthread_mutex_lock( &job->mutex );
+		job->file = i;
+		job->high = 0;
+		pthread_mutex_unlock( &job->mutex );
+		ok = ihex_parse( job->files[i], store, job );
+	}
+	pthread_mutex_lock( &job->mutex );
+	job->stats->load_us = now_us() - start;
+	job->load_ok = ok || job->abort;	// stopped early isn't a bad file
+	job->loading = FALSE;
+	if( ok )
+		release( job, 0, job->nsec );
+	pthread_cond_broadcast( &job->cond );
+	pthread_mutex_unlock( &job->mutex );
+	return 0;
+}
+
+/** Wait for the next sector to program and copy its data out.
+	\returns the sector, -1 once there are no more or the load failed.
+*/
+static int take_sector( struct ec2_prog_job *job, uint8_t *data,
+						uint8_t *mask )
+{
+	uint64_t start = now_us();
+	uint32_t addr;
+	int sec = -1, i;
+
+	pthread_mutex_lock( &job->mutex );
+	for(;;)
+	{
+		for( i=0; i<job->nsec && sec<0; i++ )
+		{
+			if( job->ready[i] )
+				sec = i;
+		}
+		if( sec>=0 || !job->loading )
+			break;
+		pthread_cond_wait( &job->cond, &job->mutex );
+	}
+	if( !job->load_ok && !job->loading )
+		sec = -1;		// don't carry on with a bad file
+	if( sec>=0 )
+	{
+		addr = sec*job->sec_size;
+		memcpy( data, job->image+addr, job->sec_size );
+		memcpy( mask, job->mask+addr, job->sec_size );
+		if( !job->taken[sec] )
+			job->stats->sectors++;
+		job->dirty[sec] = job->ready[sec] = 0;
+		job->taken[sec] = 1;
+	}
+	pthread_mutex_unlock( &job->mutex );
+	job->stats->wait_us += now_us() - start;
+	return sec;
+}
+
+/** Is sec handed over and waiting?
+*/
+static BOOL sector_ready( struct ec2_prog_job *job, int sec )
+{
+	BOOL r;
+	if( sec>=job->nsec )
+		return FALSE;
+	pthread_mutex_lock( &job->mutex );
+	r = job->ready[sec];
+	pthread_mutex_unlock( &job->mutex );
+	return r;
+}
+
+
+/** Program hex files into flash, overlapping loading, diffing, erasing,
+	writing and verifying.
+	Only the sectors the files touch are changed, what else they hold is
+	kept as with ec2_write_flash_diff().  Sectors are programmed as soon as
+	the files have moved past them, so a bad record part way through a file
+	leaves the sectors before it programmed.  A locked device is chip erased
+	first, which unlocks it, and everything outside the files is lost then.
+
+	\param obj			Object to act on.
+	\param files		Intel hex files to load, later files override
+						earlier ones.
+	\param nfiles		Number of entries in files.
+	\param verify		TRUE to read each written sector back and compare it.
+	\param stats		Receives the timings and sector counts, load_ok tells
+						a bad file from a failed write.
+	\returns			TRUE if every file loaded and every sector was
+						written (and verified).
+*/
+BOOL ec2_program_hex( EC2DRV *obj, char **files, int nfiles, BOOL verify,
+					  EC2_PROG_STATS *stats )
+{
+	DUMP_FUNC();
+	struct ec2_prog_job job;
+	pthread_t thread;
+	uint64_t start = now_us(), t;
+	uint32_t ss = obj->dev->flash_sector_size;
+	uint32_t sec_addr, n, nn, lo, hi, i;
+	uint8_t *data, *mask, *flash, *rbuf, *next;
+	int sec, pre = -1;
+	BOOL ok = TRUE, blank, changed, erase;
+
+	memset( stats, 0, sizeof(EC2_PROG_STATS) );
+	memset( &job, 0, sizeof(job) );
+	job.files = files;
+	job.nfiles = nfiles;
+	job.size = obj->dev->flash_size;
+	job.sec_size = ss;
+	job.nsec = (job.size + ss - 1) / ss;
+	job.loading = TRUE;
+	job.stats = stats;
+	job.image = malloc( job.nsec*ss );
+	job.mask = calloc( job.nsec, ss );
+	job.dirty = calloc( job.nsec, 3 );
+	data = malloc( 5*ss );			// data, mask, flash and two read back
+	if( !job.image || !job.mask || !job.dirty || !data )
+	{
+		free( job.image );
+		free( job.mask );
+		free( job.dirty );
+		free( data );
+		return FALSE;
+	}
+	memset( job.image, 0xff, job.nsec*ss );
+	job.ready = job.dirty + job.nsec;
+	job.taken = job.ready + job.nsec;
+	mask = data + ss;
+	flash = mask + ss;
+	rbuf = flash + ss;
+	next = rbuf + ss;
+	pthread_mutex_init( &job.mutex, 0 );
+	pthread_cond_init( &job.cond, 0 );
+	if( pthread_create( &thread, 0, loader, &job )!=0 )
+	{
+		// parse on this thread instead, nothing overlaps then
+		thread = 0;
+		loader( &job );
+	}
+
+	ec2_begin_flash_access( obj );
+	// a locked device can't be read back and sector erases leave it
+	// locked, so chip erase it once and it is unlocked and blank after
+	blank = flash_lock_byte( obj )!=0xff;
+	if( blank )
+	{
+		t = now_us();
+		ec2_erase_flash( obj );
+		stats->erase_us += now_us() - t;
+	}
+	while( ok && (sec = take_sector( &job, data, mask ))>=0 )
+	{
+		sec_addr = sec*ss;
+		n = sector_usable( obj, sec_addr );
+		ok = n>0;
+		for( i=n; i<ss && ok; i++ )
+			ok = !mask[i];				// data in the reserved area
+		if( !ok )
+			break;
+
+		// diff, the merged sector is built in flash
+		t = now_us();
+		if( blank )
+			memset( flash, 0xff, n );
+		else if( sec==pre )
+			memcpy( flash, next, n );
+		else
+			ok = ec2_read_flash( obj, flash, sec_addr, n );
+		pre = -1;
+		changed = erase = FALSE;
+		lo = n;
+		hi = 0;
+		for( i=0; i<n && ok; i++ )
+		{
+			if( mask[i] && data[i]!=flash[i] )
+			{
+				changed = TRUE;
+				erase |= ( data[i] & ~flash[i] ) != 0;
+				if( i<lo )
+					lo = i;
+				hi = i+1;
+				flash[i] = data[i];
+			}
+		}
+		stats->diff_us += now_us() - t;
+		if( !ok )
+			break;
+		if( !changed )
+		{
+			stats->unchanged++;
+			continue;
+		}
+
+		if( erase )
+		{
+			t = now_us();
+			ec2_erase_flash_sector( obj, sec_addr );
+			stats->erase_us += now_us() - t;
+			stats->erased++;
+			lo = 0;
+			hi = n;
+		}
+		t = now_us();
+		ok = ec2_write_flash( obj, flash+lo, sec_addr+lo, hi-lo );
+		stats->write_us += now_us() - t;
+		stats->written++;
+		if( !ok || !verify )
+			continue;
+
+		// verify, picking up the next sector on the way if it is waiting
+		t = now_us();
+		nn = sector_ready( &job, sec+1 ) ? sector_usable( obj, sec_addr+ss ) : 0;
+		if( nn && flash_cache_read( obj, next, sec_addr+ss, nn ) )
+		{
+			pre = sec+1;
+			nn = 0;
+		}
+		if( n<ss )
+			nn = 0;			// not contiguous
+		ok = ec2_read_flash( obj, rbuf, sec_addr, n+nn ) &&
+			 memcmp( rbuf, flash, n )==0;
+		if( ok && nn )
+			pre = sec+1;	// already in next
+		stats->verify_us += now_us() - t;
+	}
+	ec2_end_flash_access( obj );
+
+	// stop the loader early if programming failed
+	pthread_mutex_lock( &job.mutex );
+	job.abort = TRUE;
+	pthread_mutex_unlock( &job.mutex );
+	if( thread )
+		pthread_join( thread, 0 );
+	stats->load_ok = job.load_ok;
+	ok = ok && job.load_ok;
+	pthread_cond_destroy( &job.cond );
+	pthread_mutex_destroy( &job.mutex );
+	free( job.image );
+	free( job.mask );
+	free( job.dirty );
+	free( data );
+	stats->total_us = now_us() - start;
+	DUMP_FUNC_END();
+	return ok;
+}
@@ -0,0 +1,40 @@
+/**	Pipelined programming, hex files to verified flash in one pass.
+	A loader thread parses the files while the calling thread works through
+	the sectors the loader has finished with, so reading the files, the
+	differential read back, erasing, writing and verifying overlap instead
+	of running one after the other over the whole image.
+
+	(C) Ricky White 2006
+*/
+#ifndef FLASHPROG_H
+#define FLASHPROG_H
+#include <stdint.h>
+#include <pthread.h>
+#include "ec2drv.h"
+
+/** Where the time went.  The stages are timed on the thread that runs them,
+	the loader runs alongside the others so total is normally less than
+	the sum of the stages.
+*/
+typedef struct
+{
+	uint64_t	load_us;		///< Parsing the hex files (loader thread)
+	uint64_t	wait_us;		///< Waiting for the loader to finish a sector
+	uint64_t	diff_us;		///< Reading back and comparing each sector
+	uint64_t	erase_us;		///< Erasing sectors
+	uint64_t	write_us;		///< Writing sectors
+	uint64_t	verify_us;		///< Reading back and comparing written sectors
+	uint64_t	total_us;		///< Wall clock for the whole job
+	uint32_t	bytes;			///< Data bytes in the files
+	int			sectors;		///< Sectors holding data from the files
+	int			unchanged;		///< Sectors that already held the data
+	int			erased;			///< Sectors that had to be erased
+	int			written;		///< Sectors written, erased or not
+	int			revisited;		///< Sectors done again for a late record
+	BOOL		load_ok;		///< Every file was read and fitted the flash
+} EC2_PROG_STATS;
+
+BOOL ec2_program_hex( EC2DRV *obj, char **files, int nfiles, BOOL verify,
+					  EC2_PROG_STATS *stats );
+
+#endif
@@ -0,0 +1,145 @@
+/**	Gang programming, several debug adapters driven from one process.
+
+	(C) Ricky White 2006
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gang.h"
+
+/** What every worker has to do, shared read only between the threads.
+*/
+struct ec2_gang_job
+{
+	uint8_t					*buf;
+	uint32_t				start_addr;
+	int						len;
+	BOOL					verify;
+	EC2_GANG_PROGRESS_FN	fn;
+	void					*ctx;
+};
+
+static void *gang_worker( void *arg );
+static void gang_report( EC2_GANG_UNIT *unit, uint8_t progress,
+						 const char *result );
+
+
+/** Program the same image into several targets at once.
+	Every adapter is connected first, then each one gets its own worker
+	thread that writes (auto erasing as needed) and optionally reads the
+	image back to verify it.  Returns once all the workers have finished,
+	the adapters are disconnected again.
+
+	\param units		Adapters to use, see EC2_GANG_UNIT.
+	\param n			Number of entries in units.
+	\param buf			Image to write.
+	\param start_addr	Address to begin writing at, 0 - 0x1FFFF
+	\param len			Number of bytes to write.
+	\param verify		TRUE to read the result back and compare it.
+	\param fn			Progress callback, may be 0.
+	\param ctx			Passed through to fn.
+	\returns			TRUE if every unit succeeded, check each unit's ok and
+						result otherwise.
+*/
+BOOL ec2_gang_write_flash( EC2_GANG_UNIT *units, int n,
+						   uint8_t *buf, uint32_t start_addr, int len,
+						   BOOL verify,
+						   EC2_GANG_PROGRESS_FN fn, void *ctx )
+{
+	struct ec2_gang_job job = { buf, start_addr, len, verify, fn, ctx };
+	BOOL all_ok = TRUE;
+	int i;
+
+	for( i=0; i<n; i++ )
+	{
+		units[i].job = &job;
+		units[i].done = FALSE;
+		units[i].ok = FALSE;
+		units[i].thread = 0;
+		if( !ec2_connect( &units[i].obj, units[i].port ) )
+		{
+			units[i].done = TRUE;
+			gang_report( &units[i], 0, "unable to connect" );
+			continue;
+		}
+		if( pthread_create( &units[i].thread, 0, gang_worker, &units[i] )!=0 )
+		{
+			units[i].thread = 0;
+			units[i].done = TRUE;
+			gang_report( &units[i], 0, "unable to start worker" );
+		}
+	}
+
+	for( i=0; i<n; i++ )
+	{
+		if( units[i].thread )
+			pthread_join( units[i].thread, 0 );
+		if( units[i].obj.connected )
+			ec2_disconnect( &units[i].obj );
+		all_ok &= units[i].ok;
+	}
+	return all_ok;
+}
+
+
+/** Write the image one sector aligned chunk at a time so progress can be
+	reported, then verify it.
+*/
+static void *gang_worker( void *arg )
+{
+	EC2_GANG_UNIT *unit = (EC2_GANG_UNIT*)arg;
+	struct ec2_gang_job *job = unit->job;
+	EC2DRV *obj = &unit->obj;
+	uint32_t sec_size = obj->dev->flash_sector_size;
+	uint32_t addr = job->start_addr;
+	uint32_t end_addr = job->start_addr + job->len;
+	uint32_t next;
+	uint8_t *rbuf;
+	BOOL same;
+
+	gang_report( unit, 0, "programming" );
+	while( addr<end_addr )
+	{
+		next = addr - addr % sec_size + sec_size;
+		if( next>end_addr )
+			next = end_addr;
+		if( !ec2_write_flash_auto_erase( obj, job->buf + addr - job->start_addr,
+										 addr, next-addr ) )
+		{
+			unit->done = TRUE;
+			gang_report( unit, unit->progress, "write failed" );
+			return 0;
+		}
+		addr = next;
+		gang_report( unit, (addr-job->start_addr)*100/job->len, "programming" );
+	}
+
+	if( job->verify )
+	{
+		gang_report( unit, 100, "verifying" );
+		rbuf = malloc( job->len );
+		same = rbuf && ec2_read_flash( obj, rbuf, job->start_addr, job->len ) &&
+			   memcmp( rbuf, job->buf, job->len )==0;
+		free( rbuf );
+		if( !same )
+		{
+			unit->done = TRUE;
+			gang_report( unit, 100, "verify failed" );
+			return 0;
+		}
+	}
+	unit->ok = TRUE;
+	unit->done = TRUE;
+	gang_report( unit, 100, job->verify ? "programmed and verified" : "programmed" );
+	return 0;
+}
+
+
+static void gang_report( EC2_GANG_UNIT *unit, uint8_t progress,
+						 const char *result )
+{
+	unit->progress = progress;
+	unit->result = result;
+	if( unit->job->fn )
+		unit->job->fn( unit, unit->job->ctx );
+}
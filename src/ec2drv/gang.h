@@ -0,0 +1,43 @@
+/**	Gang programming, several debug adapters driven from one process.
+	Each EC2DRV object is independent so the adapters can be programmed
+	from separate threads.  Connecting is done one adapter at a time as
+	libusb-0.1 device enumeration is process wide.
+
+	(C) Ricky White 2006
+*/
+#ifndef GANG_H
+#define GANG_H
+#include <stdint.h>
+#include <pthread.h>
+#include "ec2drv.h"
+
+struct ec2_gang_job;
+
+/** One adapter in a gang.
+	Zero the structure and fill in port (and obj.mode if not AUTO) before
+	passing it to ec2_gang_write_flash().
+*/
+typedef struct
+{
+	const char	*port;			///< Port as for ec2_connect(), eg "USB:EC30012AB"
+	EC2DRV		obj;
+	uint8_t		progress;		///< % complete
+	BOOL		done;			///< TRUE once the worker has finished
+	BOOL		ok;				///< TRUE if programmed (and verified)
+	const char	*result;		///< Short description of the outcome
+	// private
+	pthread_t	thread;
+	struct ec2_gang_job	*job;
+} EC2_GANG_UNIT;
+
+/** Called from the worker threads whenever a unit's progress or result
+	changes.
+*/
+typedef void (*EC2_GANG_PROGRESS_FN)( EC2_GANG_UNIT *unit, void *ctx );
+
+BOOL ec2_gang_write_flash( EC2_GANG_UNIT *units, int n,
+						   uint8_t *buf, uint32_t start_addr, int len,
+						   BOOL verify,
+						   EC2_GANG_PROGRESS_FN fn, void *ctx );
+
+#endif
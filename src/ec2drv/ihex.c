@@ -0,0 +1,497 @@
+/**	Intel HEX read/write functions, Paul Stoffregen, paul@ece.orst.edu
+  * This code is in the public domain.  Please retain my name and
+  * email address in distributed copies, and let me know about any bugs
+  * 
+  * I, Paul Stoffregen, give no warranty, expressed or implied for
+  * this software and/or documentation provided, including, without
+  * limitation, warranty of merchantability and fitness for a
+  * particular purpose.
+  * Origional source obtained from http://www.pjrc.com/tech/8051/ihex.c
+  *
+  *=======================================================================
+  *
+  * Modifications by Ricky white
+  *   Copyright (C) 2005 by Ricky White
+  *   rickyw@neatstuff.co.nz
+  *
+  *   This program is free software; you can redistribute it and/or modify
+  *   it under the terms of the GNU General Public License as published by
+  *   the Free Software Foundation; either version 2 of the License, or
+  *   (at your option) any later version.
+  *
+  *   This program is distributed in the hope that it will be useful,
+  *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+  *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  *   GNU General Public License for more details.
+  *
+  *   You should have received a copy of the GNU General Public License
+  *   along with this program; if not, write to the
+  *   Free Software Foundation, Inc.,
+  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "ihex.h"
+
+#define MIN_SEG_ALLOC	256
+
+/// Buffered input, records are parsed straight from the block just read.
+typedef struct
+{
+	FILE	*f;
+	int		pos;
+	int		len;
+	uint8_t	buf[4096];
+} READER;
+
+static int rd_char( READER *r )
+{
+	if( r->pos==r->len )
+	{
+		r->len = fread( r->buf, 1, sizeof(r->buf), r->f );
+		r->pos = 0;
+		if( r->len<=0 )
+			return EOF;
+	}
+	return r->buf[r->pos++];
+}
+
+static int hex_val( int c )
+{
+	if( c>='0' && c<='9' )	return c-'0';
+	if( c>='A' && c<='F' )	return c-'A'+10;
+	if( c>='a' && c<='f' )	return c-'a'+10;
+	return -1;
+}
+
+/** \returns the next two hex digits as a byte, -1 if they aren't hex.
+*/
+static int rd_byte( READER *r )
+{
+	int hi = hex_val( rd_char(r) );
+	int lo = hex_val( rd_char(r) );
+	if( hi<0 || lo<0 )
+		return -1;
+	return (hi<<4) | lo;
+}
+
+
+/** Make sure segment s can hold len bytes.
+*/
+static BOOL seg_reserve( IHEX_SEGMENT *s, uint32_t len )
+{
+	uint32_t alloc;
+	uint8_t *data;
+	if( len<=s->alloc )
+		return TRUE;
+	for( alloc = s->alloc ? s->alloc : MIN_SEG_ALLOC; alloc<len; alloc*=2 )
+		;
+	data = realloc( s->data, alloc );
+	if( data==0 )
+		return FALSE;
+	s->data = data;
+	s->alloc = alloc;
+	return TRUE;
+}
+
+/** Add data at addr to the image.
+	Records normally arrive in ascending order and just extend the last
+	segment.  Otherwise the data is merged into any segment it overlaps or
+	touches, later data replacing earlier, so segments stay sorted and
+	separated by gaps.
+	\returns FALSE if out of memory
+*/
+BOOL ihex_add_data( IHEX_IMAGE *img, uint32_t addr, const uint8_t *data,
+						uint32_t n )
+{
+	IHEX_SEGMENT *s;
+	uint32_t lo, hi;
+	int i, j;
+
+	if( img->count>0 )
+	{
+		s = &img->seg[img->count-1];
+		if( s->addr+s->len==addr )
+		{
+			if( !seg_reserve( s, s->len+n ) )
+				return FALSE;
+			memcpy( s->data+s->len, data, n );
+			s->len += n;
+			return TRUE;
+		}
+	}
+	// first segment ending at or after addr
+	for( i=0; i<img->count && img->seg[i].addr+img->seg[i].len<addr; i++ )
+		;
+	if( i<img->count && img->seg[i].addr<=addr+n )
+	{
+		// merge with seg[i] and anything else the new data now reaches
+		s = &img->seg[i];
+		lo = s->addr<addr ? s->addr : addr;
+		hi = s->addr+s->len>addr+n ? s->addr+s->len : addr+n;
+		for( j=i+1; j<img->count && img->seg[j].addr<=hi; j++ )
+		{
+			if( img->seg[j].addr+img->seg[j].len>hi )
+				hi = img->seg[j].addr+img->seg[j].len;
+		}
+		if( lo<s->addr )
+		{
+			uint32_t shift = s->addr-lo;
+			if( !seg_reserve( s, s->len+shift ) )
+				return FALSE;
+			memmove( s->data+shift, s->data, s->len );
+			s->addr = lo;
+			s->len += shift;
+		}
+		if( !seg_reserve( s, hi-lo ) )
+			return FALSE;
+		s->len = hi-lo;
+		for( ; i+1<j; j-- )
+		{
+			// absorb seg[i+1], shuffling the rest down
+			IHEX_SEGMENT *m = &img->seg[i+1];
+			memcpy( s->data+(m->addr-lo), m->data, m->len );
+			free( m->data );
+			memmove( m, m+1, (img->count-i-2)*sizeof(IHEX_SEGMENT) );
+			img->count--;
+		}
+		memcpy( s->data+(addr-lo), data, n );
+		return TRUE;
+	}
+	// new segment before seg[i]
+	if( img->count==img->alloc )
+	{
+		int alloc = img->alloc ? img->alloc*2 : 8;
+		s = realloc( img->seg, alloc*sizeof(IHEX_SEGMENT) );
+		if( s==0 )
+			return FALSE;
+		img->seg = s;
+		img->alloc = alloc;
+	}
+	memmove( &img->seg[i+1], &img->seg[i], (img->count-i)*sizeof(IHEX_SEGMENT) );
+	img->count++;
+	s = &img->seg[i];
+	memset( s, 0, sizeof(IHEX_SEGMENT) );
+	s->addr = addr;
+	return ihex_add_data( img, addr, data, n );	// fills in the empty segment
+}
+
+
+void ihex_init( IHEX_IMAGE *img )
+{
+	memset( img, 0, sizeof(IHEX_IMAGE) );
+}
+
+void ihex_free( IHEX_IMAGE *img )
+{
+	int i;
+	for( i=0; i<img->count; i++ )
+		free( img->seg[i].data );
+	free( img->seg );
+	ihex_init( img );
+}
+
+
+static BOOL add_record( void *ctx, uint32_t addr, const uint8_t *data,
+						uint32_t n )
+{
+	return ihex_add_data( (IHEX_IMAGE*)ctx, addr, data, n );
+}
+
+/** Read an intel hex file into img, adding to anything already there.
+	See ihex_parse().
+
+	\param filename		Name of the file to load
+	\param img			Image to add the data to, see ihex_init()
+	\returns			TRUE on success, FALSE if the file couldn't be read or
+						has a bad record.  img may hold part of the file then.
+*/
+BOOL ihex_read( const char *filename, IHEX_IMAGE *img )
+{
+	return ihex_parse( filename, add_record, img );
+}
+
+
+/** Parse an intel hex file, handing each data record to fn as it is read.
+	The file is parsed in one pass without line buffers, every record's
+	checksum is checked and extended segment (02) and extended linear (04)
+	address records are honoured so parts over 64K can be loaded.
+	Records are passed on in file order, which lets a caller such as the
+	programming pipeline start on the first sectors before the end of the
+	file has been read.
+
+	\param filename		Name of the file to load
+	\param fn			Called with the address, data and length of every
+						data record, returning FALSE stops the parse.
+	\param ctx			Passed through to fn.
+	\returns			TRUE on success, FALSE if the file couldn't be read,
+						has a bad record or fn failed.
+*/
+BOOL ihex_parse( const char *filename, IHEX_DATA_FN fn, void *ctx )
+{
+	READER r;
+	uint8_t data[255];
+	uint32_t offset=0, total=0, minaddr=0xffffffff, maxaddr=0;
+	int lineno=1, c, i, len, addr, type, sum, cksum;
+	const char *err = 0;
+
+	if( filename==0 || strlen(filename)==0 )
+	{
+		printf("   Can't load a file without the filename.\n");
+		return FALSE;
+	}
+	r.f = fopen( filename, "rb" );
+	if( r.f==NULL )
+	{
+		printf("   Can't open file '%s' for reading.\n", filename);
+		return FALSE;
+	}
+	r.pos = r.len = 0;
+	while( err==0 )
+	{
+		c = rd_char( &r );
+		if( c==EOF )
+		{
+			err = "no end of file record";
+			break;
+		}
+		if( c=='\n' )
+		{
+			lineno++;
+			continue;
+		}
+		if( c=='\r' || c==' ' || c=='\t' )
+			continue;
+		if( c!=':' )
+		{
+			err = "not a hex record";
+			break;
+		}
+		len = rd_byte( &r );
+		addr = rd_byte( &r );
+		addr = (addr<<8) | rd_byte( &r );
+		type = rd_byte( &r );
+		if( len<0 || addr<0 || type<0 )
+		{
+			err = "bad hex digit";
+			break;
+		}
+		sum = len + (addr>>8) + (addr&0xff) + type;
+		for( i=0; i<len; i++ )
+		{
+			int b = rd_byte( &r );
+			if( b<0 )
+				break;
+			data[i] = b;
+			sum += b;
+		}
+		cksum = rd_byte( &r );
+		if( i<len || cksum<0 )
+			err = "bad hex digit";
+		else if( (sum+cksum)&0xff )
+			err = "checksum error";
+		else switch( type )
+		{
+			case 0:		// data
+				if( !fn( ctx, offset+addr, data, len ) )
+					err = "can't store data";
+				if( len>0 )
+				{
+					if( offset+addr<minaddr )
+						minaddr = offset+addr;
+					if( offset+addr+len-1>maxaddr )
+						maxaddr = offset+addr+len-1;
+				}
+				total += len;
+				break;
+			case 1:		// end of file
+				fclose( r.f );
+				printf("   Loaded %d bytes between:", total);
+				printf(" %04X to %04X\n", total ? minaddr : 0, maxaddr);
+				return TRUE;
+			case 2:		// extended segment address
+				if( len!=2 )
+					err = "bad extended address record";
+				offset = ((data[0]<<8) | data[1]) << 4;
+				break;
+			case 4:		// extended linear address
+				if( len!=2 )
+					err = "bad extended address record";
+				offset = ((data[0]<<8) | data[1]) << 16;
+				break;
+			case 3:		// start segment address
+			case 5:		// start linear address
+				break;
+			default:
+				err = "unknown record type";
+				break;
+		}
+	}
+	fclose( r.f );
+	printf("   Error: '%s', line %d: %s\n", filename, lineno, err);
+	return FALSE;
+}
+
+
+/** Copy an image into a flat buffer, gaps are left as they were so the
+	caller would normally fill the buffer with 0xFF first.
+
+	\param img			Image to copy
+	\param memory		Buffer indexed by address
+	\param size			Size of memory in bytes
+	\param start		will recieve the lowest address in the image
+	\param end			will recieve the highest address in the image
+	\returns			FALSE if the image is empty or doesn't fit.
+*/
+BOOL ihex_flatten( const IHEX_IMAGE *img, uint8_t *memory, uint32_t size,
+				   uint32_t *start, uint32_t *end )
+{
+	int i;
+	if( img->count==0 )
+	{
+		printf("   No data to load.\n");
+		return FALSE;
+	}
+	for( i=0; i<img->count; i++ )
+	{
+		const IHEX_SEGMENT *s = &img->seg[i];
+		if( s->addr+s->len>size )
+		{
+			printf("   Data at %05X to %05X is outside the memory.\n",
+				   s->addr, s->addr+s->len-1 );
+			return FALSE;
+		}
+		memcpy( memory+s->addr, s->data, s->len );
+	}
+	*start = img->seg[0].addr;
+	*end = img->seg[img->count-1].addr + img->seg[img->count-1].len - 1;
+	return TRUE;
+}
+
+
+/** Load an intel hex file into the supplied buffer
+  *
+  * \param filename		Name of the file to load
+  * \param memory		Buffer to recieve the file contents in binary form.
+  * \param size			Size of memory in bytes
+  * \param start		will recieve the lowest address read
+  * \param end			will recieve the highest address read
+  * \returns 			TRUE on success
+  */
+BOOL ihex_load_file( const char *filename, uint8_t *memory, uint32_t size,
+					 uint32_t *start, uint32_t *end )
+{
+	IHEX_IMAGE img;
+	BOOL ok;
+	ihex_init( &img );
+	ok = ihex_read( filename, &img ) &&
+		 ihex_flatten( &img, memory, size, start, end );
+	ihex_free( &img );
+	return ok;
+}
+
+
+/** Save a block of data an an intel hex file
+  *
+  * \param filename		Name to save the file as
+  * \param memory		Buffer containing the data to write
+  * \param start_addr	Address torepresent the first address in memory in the output file
+  * \param len			Number of bytes to write
+  */
+void ihex_save_file( const char *filename, const uint8_t *memory,
+					 uint32_t start_addr, uint32_t len )
+{
+	uint32_t begin	= start_addr;
+	uint32_t end	= begin+len-1;
+	uint32_t addr;
+	FILE *fhex;
+
+	fhex = fopen(filename, "w");
+	if( fhex == NULL )
+	{
+		printf("   Can't open '%s' for writing.\n", filename);
+		return;
+	}
+	for (addr=begin; addr <= end; addr++)
+		ihex_hexout(fhex, memory[addr-begin], addr, 0);
+	ihex_hexout( fhex, 0, 0, 1 );
+	printf( "Memory %04X to %04X written to '%s'\n", begin, end, filename );
+}
+
+
+
+#define MAXHEXLINE 32	/* the maximum number of bytes to put in one line */
+
+static void hexout_record( FILE *fhex, int type, uint32_t addr,
+						   const uint8_t *data, int n )
+{
+	int i, sum;
+	fprintf(fhex, ":%02X%04X%02X", n, addr&0xffff, type);
+	sum = n + ((addr>>8)&255) + (addr&255) + type;
+	for (i=0; i < n; i++) {
+		fprintf(fhex, "%02X", data[i]);
+		sum += data[i];
+	}
+	fprintf(fhex, "%02X\n", (-sum)&255);
+}
+
+/** produce intel hex file output... call this routine with
+  * each byte to output and it's memory location.  The file
+  * pointer fhex must have been opened for writing.  After
+  * all data is written, call with end=1 (normally set to 0)
+  * so it will flush the data from its static buffer and close the file.
+  * An extended linear address record is written whenever the upper 16 bits
+  * of the address change.
+  *
+  * \param fhex				valid file handle
+  * \param byte				byte to output to file
+  * \param memory_location	address of byte
+  * \param end				call with end=0 for all but the last byte of the
+  *							file in which case end=1
+  */
+void ihex_hexout( FILE *fhex, int byte, uint32_t memory_location, int end )
+{
+	static uint8_t byte_buffer[MAXHEXLINE];
+	static uint32_t last_mem, buffer_pos, buffer_addr, segment;
+	static int writing_in_progress=0;
+
+	if (end) {
+		if (writing_in_progress && buffer_pos > 0)
+			hexout_record( fhex, 0, buffer_addr, byte_buffer, buffer_pos );
+		fprintf(fhex, ":00000001FF\n");  /* end of file marker */
+		fclose(fhex);
+		writing_in_progress = 0;
+		return;
+	}
+	if (!writing_in_progress)
+	{
+		/* initial condition setup */
+		last_mem = memory_location-1;
+		buffer_pos = 0;
+		buffer_addr = memory_location;
+		segment = 0;
+		writing_in_progress = 1;
+	}
+	if ( (memory_location != (last_mem+1)) || (buffer_pos >= MAXHEXLINE)
+		 || (memory_location>>16) != segment )
+	{
+		/* it's time to dump the buffer to a line in the file */
+		if (buffer_pos > 0)
+			hexout_record( fhex, 0, buffer_addr, byte_buffer, buffer_pos );
+		buffer_addr = memory_location;
+		buffer_pos = 0;
+	}
+	if ( (memory_location>>16) != segment )
+	{
+		uint8_t upper[2];
+		segment = memory_location>>16;
+		upper[0] = segment>>8;
+		upper[1] = segment;
+		hexout_record( fhex, 4, 0, upper, 2 );
+	}
+	last_mem = memory_location;
+	byte_buffer[buffer_pos] = byte & 255;
+	buffer_pos++;
+}
@@ -0,0 +1,58 @@
+/**	Intel HEX loading and saving, shared by newcdb and the ec2tools.
+	Files load into a sparse image, a sorted list of contiguous segments,
+	so programming can skip the gaps.  ihex_load_file() flattens that into
+	a buffer for callers that want one.
+*/
+#ifndef _IHEX_H
+#define _IHEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ec2types.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// A run of contiguous data from a hex file
+typedef struct
+{
+	uint32_t	addr;		///< address of the first byte
+	uint32_t	len;		///< bytes of data
+	uint8_t		*data;
+	uint32_t	alloc;		///< bytes allocated for data
+} IHEX_SEGMENT;
+
+/// Everything loaded from one or more hex files
+typedef struct
+{
+	IHEX_SEGMENT	*seg;	///< sorted by address, separated by gaps
+	int				count;
+	int				alloc;
+} IHEX_IMAGE;
+
+/// Receives each data record from ihex_parse()
+typedef BOOL (*IHEX_DATA_FN)( void *ctx, uint32_t addr, const uint8_t *data,
+							  uint32_t n );
+
+void ihex_init( IHEX_IMAGE *img );
+void ihex_free( IHEX_IMAGE *img );
+BOOL ihex_read( const char *filename, IHEX_IMAGE *img );
+BOOL ihex_parse( const char *filename, IHEX_DATA_FN fn, void *ctx );
+BOOL ihex_add_data( IHEX_IMAGE *img, uint32_t addr, const uint8_t *data,
+					uint32_t n );
+BOOL ihex_flatten( const IHEX_IMAGE *img, uint8_t *memory, uint32_t size,
+				   uint32_t *start, uint32_t *end );
+
+BOOL ihex_load_file( const char *filename, uint8_t *memory, uint32_t size,
+					 uint32_t *start, uint32_t *end );
+
+void ihex_save_file( const char *filename, const uint8_t *memory,
+					 uint32_t start_addr, uint32_t len );
+
+void ihex_hexout( FILE *fhex, int byte, uint32_t memory_location, int end );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
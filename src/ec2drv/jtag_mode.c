@@ -6,12 +6,11 @@
 
 #include "jtag_mode.h"
 
-static BOOL jtag_write_xdata_page( EC2DRV *obj, char *buf, unsigned char page,
-							unsigned char start, int len );
-//static void ec2_read_xdata_page( EC2DRV *obj, char *buf, unsigned char page,
-//						  unsigned char start, int len );
-void jtag_read_xdata_page( EC2DRV *obj, char *buf, unsigned char page,
-						   unsigned char start, int len );
+static void xdata_access( EC2DRV *obj, BOOL enable );
+static BOOL queue_xdata_page( EC2DRV *obj, uint8_t page );
+static void xdata_collect( EC2DRV *obj, char tmp[][0x3d], char **dst );
+static void flash_addr_cmd_jtag( EC2DRV *obj, uint32_t addr, char *cmd );
+static void drop_flash_access( EC2DRV *obj );
 
 
 /** Connect to a device using JTAG mode.
@@ -66,18 +65,14 @@ extern SFRREG SFR_OSCICN;
 extern SFRREG SFR_CLKSEL;
 extern SFRREG SFR_CCH0CN;
 
-/** Write an entire flash sector.
-	NOTE this function does not erase the sector first.
+/** Set up the target for a run of sector writes, see write_sector().
+	Undo with end_write_session().  The set up is the same for each sector
+	so a multi sector write only needs it once.
 	\param obj	ec2drv object to act on
-	\param buf	Buffer containing data to write, must contain a full sectors worth of data.
-	\returns TRUE on success, FALSE on failure
 */
-BOOL jtag_write_flash_sector( EC2DRV *obj, uint32_t sect_addr, uint8_t *buf,
-							  BOOL scratchpad )
+static void begin_write_session( EC2DRV *obj )
 {
-	DUMP_FUNC();
-	uint8_t max_block_len = (obj->dbg_adaptor==EC2) ? 0x0c : 0x3F;
-	BOOL result = TRUE;
+	drop_flash_access( obj );
 //	printf("jtag_write_flash_sector(...)    addr = 0x%05x\n",sect_addr);
 	jtag_flashcon( obj, 0x00 );
 	trx( obj, "\x0b\x02\x01\x00",4,"\x0d",1);
@@ -159,7 +154,31 @@ BOOL jtag_write_flash_sector( EC2DRV *obj, uint32_t sect_addr, uint8_t *buf,
 	
 	JTAG_unknown_op_0x15(obj);
 	JTAG_0x16_Len3( obj, 0x00, 0x80, 0x10 );
-	
+}
+
+
+/** Restore the target after begin_write_session().
+	\param obj	ec2drv object to act on
+*/
+static void end_write_session( EC2DRV *obj )
+{
+	jtag_flashcon( obj, 0x00 );
+	trx( obj, "\x0b\x02\x01\x00", 4, "\x0d", 1 );
+	trx( obj, "\x03\x02\xB6\x80", 4, "\x0d", 1 );
+	trx( obj, "\x03\x02\xB2\x14", 4, "\x0d", 1 );
+}
+
+
+/** Erase and write one sector inside a write session.
+	\param obj	ec2drv object to act on
+	\param buf	Buffer containing data to write, must contain a full sectors worth of data.
+	\returns TRUE on success, FALSE on failure
+*/
+static BOOL write_sector( EC2DRV *obj, uint32_t sect_addr, uint8_t *buf,
+						  BOOL scratchpad )
+{
+	uint8_t max_block_len = (obj->dbg_adaptor==EC2) ? 0x0c : 0x3F;
+	BOOL result = TRUE;
 	uint32_t sect_start_addr;
 	uint32_t sect_end_addr;
 	uint16_t sector_size;
@@ -214,28 +233,33 @@ BOOL jtag_write_flash_sector( EC2DRV *obj, uint32_t sect_addr, uint8_t *buf,
 	char tbuf[0xff];
 	if( obj->dbg_adaptor==EC2 )
 	{
-		while( (sect_end_addr-addr) >= max_block_len )
-		{
-//			printf("Fragment start_addr = 0x%05x, len = 0x%04x\n",addr,max_block_len );
-			memcpy(tbuf,"\x12\x02\x0c\x00",4);
-			memcpy(tbuf+4,buf,max_block_len);
-			write_port(obj,tbuf,max_block_len+4);
-			result |= read_port_ch(obj)==0x0d;
-			addr += max_block_len;
-			buf += max_block_len;
-		}
-		if( (sect_end_addr-addr)>0 )
+		// one command and ack per block, queued so several are in flight.
+		// The last fragment had better be a multiple of 4 for the F120
+		uint32_t	batch_addr[EC2_QUEUE_DEPTH];
+		int			n = 0;
+		while( addr<=sect_end_addr )
 		{
-			uint8_t len = (sect_end_addr-addr)+1;
-//			printf("Fragment start_addr = 0x%05x, len = 0x%04x\n",addr,len );
-			// mop up wats left, it had better be a multiple of 4 for the F120 and start on the correct offset
+			uint8_t len = (sect_end_addr-addr)>=max_block_len ? max_block_len
+				: (sect_end_addr-addr)+1;
 			tbuf[0] = 0x12;
 			tbuf[1] = 0x02;
 			tbuf[2] = len;
 			tbuf[3] = 0x00;
 			memcpy(&tbuf[4],buf,len);
-			write_port(obj, tbuf,4+len);
-			result &= read_port_ch( obj )==0x0d;
+			batch_addr[n++] = addr;
+			ec2_queue_trx( obj, tbuf, 4+len, "\x0d", 1 );
+			addr += len;
+			buf += len;
+			if( n==EC2_QUEUE_DEPTH || addr>sect_end_addr )
+			{
+				if( !ec2_queue_flush( obj ) )
+				{
+					if( result )
+						obj->flash_fail_addr = batch_addr[obj->queue_failed];
+					result = FALSE;
+				}
+				n = 0;
+			}
 		}
 	}
 	else
@@ -257,13 +281,32 @@ BOOL jtag_write_flash_sector( EC2DRV *obj, uint32_t sect_addr, uint8_t *buf,
 				: sector_size-offset;
 			write_port(obj,(char*)buf+offset,blk);
 		}
-		result &= read_port_ch(obj)==0x0d;
-		
+		if( read_port_ch(obj)!=0x0d )
+		{
+			if( result )
+				obj->flash_fail_addr = sect_start_addr;
+			result = FALSE;
+		}
 	}
-	jtag_flashcon( obj, 0x00 );
-	trx( obj, "\x0b\x02\x01\x00", 4, "\x0d", 1 );
-	trx( obj, "\x03\x02\xB6\x80", 4, "\x0d", 1 );
-	trx( obj, "\x03\x02\xB2\x14", 4, "\x0d", 1 );
+	return result;
+}
+
+
+/** Write an entire flash sector.
+	NOTE this function does not erase the sector first.
+	\param obj	ec2drv object to act on
+	\param buf	Buffer containing data to write, must contain a full sectors worth of data.
+	\returns TRUE on success, FALSE on failure
+*/
+BOOL jtag_write_flash_sector( EC2DRV *obj, uint32_t sect_addr, uint8_t *buf,
+							  BOOL scratchpad )
+{
+	DUMP_FUNC();
+	BOOL result;
+	obj->flash_fail_addr = -1;
+	begin_write_session( obj );
+	result = write_sector( obj, sect_addr, buf, scratchpad );
+	end_write_session( obj );
 	return result;
 }
 
@@ -291,22 +334,18 @@ BOOL jtag_read_flash_sector( EC2DRV *obj, uint32_t sect_addr, uint8_t *buf,
 }
 
 
-/** Read data from the code memory (Flash) of a JTAG connected processor.
-	Note that this function contains JTAG operations that are not fully 
-	understood but aseem necessary to tead the flash from the F120 but don't
+/** Put a JTAG device into the state needed to read flash.
+	This is the long sequence of SFR and JTAG register writes that used to be
+	done for every jtag_read_flash(), any number of reads can follow until
+	jtag_end_flash_access().  See ec2_begin_flash_access().
+	Note that this sequence contains JTAG operations that are not fully
+	understood but seem necessary to read the flash from the F120 but don't
 	seem to impact the F020.
 
-	\param obj			ec2drv object to cact on.
-	\param buf			Buffer to recieve the read bytes
-	\param start_addr	Address to start reading from.
-						( banks are treated as a flast address range )
-	\param len			Number of bytes to read.
-	\returns			TRUE on success, FALSE otherwise.
- */
-BOOL jtag_read_flash( EC2DRV *obj, uint8_t *buf,
-					  uint32_t start_addr, int len, BOOL scratchpad )
+	\param obj			ec2drv object to act on.
+*/
+void jtag_begin_flash_access( EC2DRV *obj )
 {
-	BOOL result = TRUE;
 	//ec2_target_halt(obj);
 	jtag_halt(obj);		// trx(obj,"\x0B\x02\x01\x00",4,"\x0D ",1);			// suspend processor?
 	ec2_write_paged_sfr( obj, SFR_FLSCL, 0x80 );
@@ -392,7 +431,41 @@ BOOL jtag_read_flash( EC2DRV *obj, uint8_t *buf,
 	
 //	usleep(10000);
 	//--------------------------------------------------------------------------
-	
+}
+
+
+/** Undo jtag_begin_flash_access().
+	\param obj			ec2drv object to act on.
+*/
+void jtag_end_flash_access( EC2DRV *obj )
+{
+	jtag_flashcon( obj, 0x00 );				//trx( obj, "\x0D\x05\x82\x08\x00\x00\x00", 7, "\x0D", 1 );
+	trx( obj, "\x0B\x02\x01\x00", 4, "\x0D", 1 );	// state ctrl = halt
+	trx( obj, "\x03\x02\xB6\x80", 4, "\x0D", 1 );
+	trx( obj, "\x03\x02\xB2\x14", 4, "\x0D", 1 );
+}
+
+
+/** Anything other than a flash read undoes the flash read set up, finish it
+	first so a later read in the same session sets it up again.
+*/
+static void drop_flash_access( EC2DRV *obj )
+{
+	if( obj->flash_access_ready )
+	{
+		jtag_end_flash_access( obj );
+		obj->flash_access_ready = FALSE;
+	}
+}
+
+
+/** Read blocks of flash, the device must already be set up by
+	jtag_begin_flash_access().
+*/
+static BOOL read_flash_blocks( EC2DRV *obj, uint8_t *buf,
+							   uint32_t start_addr, int len, BOOL scratchpad )
+{
+	BOOL result = TRUE;
 	// setup for readthe actual read
 	set_flash_addr_jtag( obj, start_addr );
 	
@@ -411,35 +484,74 @@ BOOL jtag_read_flash( EC2DRV *obj, uint8_t *buf,
 	memset( buf, 0xff, len );
 	
 	uint16_t block_size = obj->dbg_adaptor==EC3 ? 0x3C : 0x0C;
-	char tmp_buf[0x3d];	// room for terminator
+	// each block needs an address set and a read so half the queue per batch
+	char tmp_buf[EC2_QUEUE_DEPTH/2][0x3d];	// room for terminator
+	int n, j, blk_start = 0;
 //	printf("block size = 0x%04x\n",block_size);
 	for( i=0; i<len; i+=block_size )
 	{
 		addr = start_addr + i;
 //		printf("addr=0x%05x\n",addr);
-		set_flash_addr_jtag( obj, addr );
+		queue_flash_addr_jtag( obj, addr );
 		cmd[0] = 0x11;
 		cmd[1] = 0x02;
 		cmd[2] = (len-i)>=block_size ? block_size : (len-i);
 		cmd[3] = 0x00;
-		write_port( obj, (char*)cmd, 4 );
-		read_port( obj, tmp_buf, cmd[2]+1 );	// +1 for 0x0d terminator
-		memcpy(buf+i,tmp_buf,cmd[2]);
-		result &= tmp_buf[cmd[2]]==0x0d;
-		//read_port( obj, buf+i, cmd[2]+1 ); 
+		n = (i/block_size) % (EC2_QUEUE_DEPTH/2);
+		ec2_queue_cmd( obj, cmd, 4, tmp_buf[n], cmd[2]+1 );	// +1 for 0x0d terminator
+		if( n==EC2_QUEUE_DEPTH/2-1 || i+cmd[2]>=len )
+		{
+			result &= ec2_queue_flush( obj );
+			for( j=0; j<=n; j++ )
+			{
+				uint16_t blk = len-blk_start>=block_size ? block_size
+														 : len-blk_start;
+				memcpy( buf+blk_start, tmp_buf[j], blk );
+				result &= tmp_buf[j][blk]==0x0d;
+				blk_start += blk;
+			}
+		}
 	//	result &= read_port_ch( obj )==0x0d;	// requires ec2 ver 0x13 or newer
 	}
-	
-	jtag_flashcon( obj, 0x00 );				//trx( obj, "\x0D\x05\x82\x08\x00\x00\x00", 7, "\x0D", 1 );
-	trx( obj, "\x0B\x02\x01\x00", 4, "\x0D", 1 );	// state ctrl = halt
-	trx( obj, "\x03\x02\xB6\x80", 4, "\x0D", 1 );
-	trx( obj, "\x03\x02\xB2\x14", 4, "\x0D", 1 );
+	return result;
+}
+
+
+/** Read data from the code memory (Flash) of a JTAG connected processor.
+	Inside an ec2_begin_flash_access() session the set up is only done for
+	the first read, otherwise it is done and undone around this read.
+
+	\param obj			ec2drv object to cact on.
+	\param buf			Buffer to recieve the read bytes
+	\param start_addr	Address to start reading from.
+						( banks are treated as a flast address range )
+	\param len			Number of bytes to read.
+	\returns			TRUE on success, FALSE otherwise.
+ */
+BOOL jtag_read_flash( EC2DRV *obj, uint8_t *buf,
+					  uint32_t start_addr, int len, BOOL scratchpad )
+{
+	BOOL result;
+	if( obj->flash_access )
+	{
+		if( !obj->flash_access_ready )
+		{
+			jtag_begin_flash_access( obj );
+			obj->flash_access_ready = TRUE;
+		}
+		return read_flash_blocks( obj, buf, start_addr, len, scratchpad );
+	}
+	jtag_begin_flash_access( obj );
+	result = read_flash_blocks( obj, buf, start_addr, len, scratchpad );
+	jtag_end_flash_access( obj );
 	return result;
 }
 
 
 /** Write a block of data to flash.
 	This routine will erase and rewrite all affected sectors.
+	The sectors are read first when saving, then written in one write
+	session so the set up and restore are only done once for the block.
 	@FIXME this function is doing things to the wrong memory area and sizer when trying to use scratchpad.
 	\param save	TRUE causes exsisting data arround that written to be saved, FALSE dosen't save unmodified bytes within the sector
 */
@@ -458,53 +570,37 @@ BOOL jtag_write_flash_block( EC2DRV *obj, uint32_t addr,
 	uint32_t end_addr = addr + len - 1;
 	uint32_t first_sect_addr = (addr/sector_size)*sector_size;
 	uint32_t last_sect_addr = (end_addr/sector_size)*sector_size;
-	
-	uint16_t num_sects = (last_sect_addr/sector_size) -
-						 (first_sect_addr/sector_size);
+	uint32_t span = last_sect_addr + sector_size - first_sect_addr;
 //	printf("jtag_write_flash_block    addr = 0x%05x, len=0x%05x\n",addr,len);
-	// allocate buffer to hold out mirror image
-	uint8_t *mirror = malloc( sector_size );
+	// allocate buffer to hold out mirror image of all the sectors
+	uint8_t *mirror = malloc( span );
 	if(!mirror)
 		return FALSE;
 	
-	uint32_t cur_addr,cur_sect_addr;
-	uint32_t cur_sect_end_addr;
-	cur_addr = addr;
-	uint32_t offset = 0;
+	// reads need a different set up to writes so all are done beforehand
+	if(save)
+		result = jtag_read_flash( obj, mirror, first_sect_addr, span, scratchpad );
+	else
+		memset( mirror, 0xff, span );
+	
+	// modify with new data
+	// must be careful as data write might not be at start of sector
+	memcpy( mirror + (addr-first_sect_addr), buf, len );
 	
-	// for each sector...
+	// mirror should now contan the correct sector data, write it out
+	uint32_t cur_sect_addr;
+	obj->flash_fail_addr = -1;
+	begin_write_session( obj );
 	for( cur_sect_addr = first_sect_addr;
 		cur_sect_addr <= last_sect_addr;
 		cur_sect_addr += sector_size )
 	{
 //		printf("Modifying sector @ 0x%05x\n",cur_sect_addr);
-		cur_sect_end_addr = cur_sect_addr + sector_size - 1;
-		
-		if(save)
-		{
-			// read current sector
-			result &= jtag_read_flash_sector( obj, cur_sect_addr, mirror, scratchpad );
-		}
-		else
-			memset(mirror,0xff,sector_size);
-		
-		// modify with new data
-		// must be careful as data write might not be at start of sector
-		
-		for( cur_addr = cur_sect_addr; cur_addr<=cur_sect_end_addr; cur_addr++ )
-		{
-//			printf("cur_addr = 0x%05x, addr=0x%05x, value=0x%05x\n",cur_addr, addr,buf[offset]);
-			if( (cur_addr>=addr) && (cur_addr<=end_addr) )
-			{
-//				printf("will write 0x%05x\n",cur_addr-cur_sect_addr);
-				mirror[cur_addr-cur_sect_addr] = buf[offset++];
-			}
-		}
-		// mirror should now contan the correct sector data
-		// write out the new sector
-		result &= jtag_write_flash_sector( obj, cur_sect_addr,mirror,
-										   scratchpad );
+		result &= write_sector( obj, cur_sect_addr,
+								mirror + (cur_sect_addr-first_sect_addr),
+								scratchpad );
 	}
+	end_write_session( obj );
 	free(mirror);
 	return result;
 }
@@ -517,6 +613,7 @@ BOOL jtag_write_flash_block( EC2DRV *obj, uint32_t addr,
 */
 BOOL jtag_erase_flash( EC2DRV *obj )
 {
+	drop_flash_access( obj );
 	jtag_halt(obj);
 //	ec2_disconnect( obj );
 //	ec2_connect( obj, obj->port );
@@ -642,6 +739,7 @@ BOOL jtag_erase_flash( EC2DRV *obj )
 */
 BOOL jtag_erase_flash_sector( EC2DRV *obj, uint32_t sector_addr, BOOL scratchpad )
 {
+	drop_flash_access( obj );
 	jtag_halt(obj);
 //=== Expirimental code to erase F120 ==========================================
 	jtag_flashcon( obj, 0x00 );
@@ -766,13 +864,34 @@ void set_flash_addr_jtag( EC2DRV *obj, uint32_t addr )
 {
 	DUMP_FUNC();
 	char cmd[7];
+	flash_addr_cmd_jtag( obj, addr, cmd );
+	trx( obj, cmd, 7, "\x0D", 1 );
+}
+
+/** Queued form of set_flash_addr_jtag().
+	The command is sent on the next ec2_queue_flush().
+ */
+BOOL queue_flash_addr_jtag( EC2DRV *obj, uint32_t addr )
+{
+	char cmd[7];
+	flash_addr_cmd_jtag( obj, addr, cmd );
+	return ec2_queue_trx( obj, cmd, 7, "\x0D", 1 );
+}
+
+/** Build the command to set the flash address register.
+	\param obj		ec2 object to act on.
+	\param addr	24 bit address to set the flash pointer to
+	\param cmd		Receives the 7 byte command
+ */
+static void flash_addr_cmd_jtag( EC2DRV *obj, uint32_t addr, char *cmd )
+{
 	cmd[0] = 0x0d;
 	cmd[1] = 0x05;
 	cmd[2] = 0x84;				// write flash address
 //	cmd[3] = 0x10;				// for F020
 //	cmd[3] = 0x11;				// for F120
 	// @FIXME detect fproper processor here andadjust
-	if(DEVICE_IN_RANGE( obj->dev->unique_id, C8051F120, C8051F133 )) {
+	if(DEVICE_HAS_CAP( obj->dev, DEV_CAP_JTAG_ADDR17 )) {
 		// all devices in the F120 series seem to use this, even though the F13x chips
 		//   have only 0x1000 bytes of flash
 		cmd[3] = 0x11;
@@ -786,7 +905,6 @@ void set_flash_addr_jtag( EC2DRV *obj, uint32_t addr )
 	cmd[4] = addr & 0xFF;			// addr low
 	cmd[5] = (addr >> 8) & 0xFF;	// addr middle
 	cmd[6] = (addr >> 16) & 0xFF;	// addr top
-	trx( obj, cmd, 7, "\x0D", 1 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -927,8 +1045,8 @@ void jtag_read_ram( EC2DRV *obj, char *buf, int start_addr, int len )
 
 void jtag_read_ram_sfr( EC2DRV *obj, char *buf, int start_addr, int len, BOOL sfr )
 {
-	char cmd[0x40], rbuf[0x40];
-	int i;
+	char cmd[0x40], rbuf[EC2_QUEUE_DEPTH][0x0d];
+	int i, j, n;
 	memset( buf, 0xff, len );	
 	cmd[0] = sfr ? 0x02 : 0x06;
 	cmd[1] = 0x02;
@@ -936,11 +1054,15 @@ void jtag_read_ram_sfr( EC2DRV *obj, char *buf, int start_addr, int len, BOOL sf
 	{
 		cmd[2] = start_addr+i;
 		cmd[3] = len-i >= 0x0C ? 0x0C : len-i;
-		write_port( obj, cmd, 0x04 );
-//		usleep(10000);	// try to prevent bad reads of RAM by letting the EC2 take a breather
-		//read_port( obj, buf+i, cmd[3] );
-		read_port( obj, rbuf, cmd[3]+1 );	// +1 for terminator 0x0d
-		memcpy(buf+i,rbuf,cmd[3]);
+		n = (i/0x0C) % EC2_QUEUE_DEPTH;
+		ec2_queue_cmd( obj, cmd, 0x04, rbuf[n], cmd[3]+1 );	// +1 for terminator 0x0d
+		if( n==EC2_QUEUE_DEPTH-1 || i+cmd[3]>=len )
+		{
+			ec2_queue_flush( obj );
+			for( j=0; j<=n; j++ )
+				memcpy( buf+i-(n-j)*0x0C, rbuf[j],
+						j==n ? cmd[3] : 0x0C );
+		}
 	}
 }
 
@@ -1065,29 +1187,58 @@ BOOL jtag_write_ram( EC2DRV *obj, char *buf, int start_addr, int len )
 */
 BOOL jtag_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
 {
-	int blen, page;
-	char start_page	= ( start_addr >> 8 ) & 0xFF;
-	char last_page	= ( (start_addr+len-1) >> 8 ) & 0xFF;
-	unsigned int ofs=0;
-
-	unsigned int pg_start_addr, pg_end_addr;	// start and end addresses within page
+	int addr, pg_end, end = start_addr+len;
+	char cmd[5];
+	char pad[2];		// byte after an odd length run, in the first / last page
+	BOOL r = TRUE;
 	assert( start_addr>=0 && start_addr<=0xFFFF && start_addr+len<=0x10000 );
-	
-	for( page = start_page; page<=last_page; page++ )
+	if( len<=0 )
+		return TRUE;
+
+	// Writes go 2 bytes at a time so an odd length run within a page is padded
+	// with the byte already following it.  Only the first and last pages can
+	// have odd runs, read those bytes before starting since reading in the
+	// middle of a write causes problems.
+	pad[0] = pad[1] = 0xff;
+	pg_end = ((start_addr>>8)+1)<<8;
+	if( pg_end>end )
+		pg_end = end;
+	if( (pg_end-start_addr)%2 && pg_end<=0xFFFF )
+		jtag_read_xdata( obj, &pad[0], pg_end, 1 );
+	if( pg_end<end && (end-((end-1)&~0xFF))%2 && end<=0xFFFF )
+		jtag_read_xdata( obj, &pad[1], end, 1 );
+
+	xdata_access( obj, TRUE );
+	cmd[0] = 0x07;
+	cmd[2] = 2;	// length
+	for( addr=start_addr; addr<end; addr=pg_end )
 	{
-		pg_start_addr = (page==start_page) ? start_addr&0x00FF : 0x00;	
-		pg_end_addr = (page==last_page) ? (start_addr+len-1)-(page<<8) : 0xff;
-		blen = pg_end_addr - pg_start_addr + 1;	
-//		printf("page = 0x%02x, start = 0x%04x, end = 0x%04x, len = %i, ofs=%04x\n", page,pg_start_addr, pg_end_addr,blen,ofs);
-		jtag_write_xdata_page( obj, buf+ofs, page, pg_start_addr, blen );
-		ofs += blen;
+		r &= queue_xdata_page( obj, addr>>8 );	// once per page
+		pg_end = ((addr>>8)+1)<<8;
+		if( pg_end>end )
+			pg_end = end;
+		for( ; addr<pg_end; addr+=2 )
+		{
+			cmd[1] = addr & 0xFF;
+			cmd[3] = buf[addr-start_addr];
+			if( addr+1<pg_end )
+				cmd[4] = buf[addr+1-start_addr];
+			else
+				cmd[4] = pad[(addr>>8)!=(start_addr>>8)];
+			r &= ec2_queue_trx( obj, cmd, 5, "\x0d", 1 );
+		}
 	}
-	return TRUE;
+	r &= ec2_queue_flush( obj );
+	xdata_access( obj, FALSE );
+	return r;
 }
 
 
 /** Read len bytes of data from the target (JTAG mode)
-	starting at start_addr into buf
+	starting at start_addr into buf.
+	XDATA access is enabled once for the whole transfer, the page register
+	is only written when a page boundary is crossed and the reads are queued
+	in the largest blocks the adapter supports.
 
 	T 03 02 2D 01  R 0D								<br>
 	T 03 02 32 addrH								<br>
@@ -1099,24 +1250,55 @@ BOOL jtag_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
 	\param start_addr	Address to begin reading from, 0x00 - 0xFFFF
 	\param len			Number of bytes to read, 0x00 - 0xFFFF
 */
-void jtag_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
+BOOL jtag_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
 {
-	int blen, page;
-	char start_page	= ( start_addr >> 8 ) & 0xFF;
-	char last_page	= ( (start_addr+len-1) >> 8 ) & 0xFF;
-	unsigned int ofs=0;
-	unsigned int pg_start_addr, pg_end_addr;	// start and end addresses within page
-		
+	char tmp[EC2_QUEUE_DEPTH][0x3d];	// room for terminator
+	char *dst[EC2_QUEUE_DEPTH];			// where each queued reply goes, 0 for acks
+	uint8_t block = obj->dbg_adaptor==EC3 ? 0x3C : 0x0C;
+	int addr, pg_end, end = start_addr+len;
+	char cmd[4];
+
 	assert( start_addr>=0 && start_addr<=0xFFFF && start_addr+len<=0x10000 );
 	memset( buf, 0xff, len );
-	for( page = start_page; page<=last_page; page++ )
+	xdata_access( obj, TRUE );
+	cmd[0] = 0x06;
+	cmd[1] = 0x02;
+	for( addr=start_addr; addr<end; addr=pg_end )
+	{
+		if( obj->queue_len==EC2_QUEUE_DEPTH )
+			xdata_collect( obj, tmp, dst );
+		dst[obj->queue_len] = 0;
+		queue_xdata_page( obj, addr>>8 );
+		pg_end = ((addr>>8)+1)<<8;
+		if( pg_end>end )
+			pg_end = end;
+		for( ; addr<pg_end; addr+=cmd[3] )
+		{
+			if( obj->queue_len==EC2_QUEUE_DEPTH )
+				xdata_collect( obj, tmp, dst );
+			cmd[2] = addr & 0xFF;
+			cmd[3] = pg_end-addr>=block ? block : pg_end-addr;
+			dst[obj->queue_len] = buf+addr-start_addr;
+			ec2_queue_cmd( obj, cmd, 4, tmp[obj->queue_len], cmd[3]+1 );	// +1 for 0x0d terminator
+		}
+	}
+	xdata_collect( obj, tmp, dst );
+	xdata_access( obj, FALSE );
+	return TRUE;
+}
+
+
+/** Flush the queued XDATA reads and copy each reply, less its terminator,
+	to where it belongs.
+*/
+static void xdata_collect( EC2DRV *obj, char tmp[][0x3d], char **dst )
+{
+	int i, n = obj->queue_len;
+	ec2_queue_flush( obj );
+	for( i=0; i<n; i++ )
 	{
-		pg_start_addr = (page==start_page) ? start_addr&0x00FF : 0x00;	
-		pg_end_addr = (page==last_page) ? (start_addr+len-1)-(page<<8) : 0xff;
-		blen = pg_end_addr - pg_start_addr + 1;	
-	//		printf("page = 0x%02x, start = 0x%04x, end = 0x%04x, len = %i\n", page,pg_start_addr, pg_end_addr,blen);
-		jtag_read_xdata_page( obj, buf+ofs, page, pg_start_addr, blen );
-		ofs += blen;
+		if( dst[i] )
+			memcpy( dst[i], tmp[i], obj->queue[i].rxlen-1 );
 	}
 }
 
@@ -1133,117 +1315,59 @@ void jtag_write_sfr( EC2DRV *obj, uint8_t value, uint8_t addr )
 }
 
 
-
-/** this function performs the preamble and postamble
- */
-BOOL jtag_write_xdata_page( EC2DRV *obj, char *buf, unsigned char page,
-						   unsigned char start, int len )
+/** Queue a read of len SFRs from addr in the current page (JTAG).
+	Each reply carries a 0x0d terminator after the values, so buf needs room
+	for len+1 bytes.
+*/
+BOOL jtag_queue_read_sfr( EC2DRV *obj, uint8_t addr, uint8_t len, char *buf )
 {
-	DUMP_FUNC();
-	int i;
-	char cmd[5];
-	char extraValues[2],endByte;
-	
-	assert(obj->mode==JTAG);
-	
-	// if write length is odd, go ahead and read last byte before we even
-	//  start reading, since reading data in the middle of a write causes
-	//  problems
-	if (len % 2) {
-		ec2_read_xdata( obj, &extraValues[0], (page<<8)+len+start-1, 2 );
-		endByte = extraValues[1];
-	}
-	
-	// start writing to XDATA now
-	// write preamble
-	if(DEVICE_IN_RANGE( obj->dev->unique_id, C8051F020, C8051F023 ))
-		trx(obj,"\x03\x02\x2D\x01",4,"\x0D",1);
-	else
-		trx(obj,"\x03\x02\x2E\x01",4,"\x0D",1);
-	
-	// select page
-	cmd[0] = 0x03;
+	char cmd[4];
+	cmd[0] = 0x02;
 	cmd[1] = 0x02;
+	cmd[2] = addr;
+	cmd[3] = len;
+	return ec2_queue_cmd( obj, cmd, 4, buf, len+1 );
+}
 
-	if(DEVICE_IN_RANGE( obj->dev->unique_id, C8051F020, C8051F023 ))
-		cmd[2] = 0x32;
-	else
-		cmd[2] = 0x31;
 
-	cmd[3] = page;
-	trx( obj, (char*)cmd, 4, "\x0D", 1 );
-	
-	// set constant values
-	cmd[0] = 0x07;
-	cmd[2] = 2;	// length
-	for( i=0; i<len; i+=2 )
-	{
-		// write position
-		cmd[1] = i+start;
-		// write new values
-		cmd[3] = (char)buf[i];
-		cmd[4] = (char)buf[i+1];
-		// if it's the last byte, and it's odd, fill in the old
-		//  read value for the last byte to even it out
-		if( (len-i) <= 1 ) {
-			cmd[4] = endByte;
-		}
-		trx( obj, (char*)cmd, 5, "\x0d", 1 );
-	}
-	//write postamble
-	if(DEVICE_IN_RANGE( obj->dev->unique_id, C8051F020, C8051F023 ))
-		trx(obj,"\x03\x02\x2D\x00",4,"\x0D",1);
-	else
-		trx(obj,"\x03\x02\x2E\x00",4,"\x0D",1);
-	return TRUE;
+/** Queue a write to one SFR in the current page (JTAG).
+*/
+BOOL jtag_queue_write_sfr( EC2DRV *obj, uint8_t addr, uint8_t value )
+{
+	char cmd[4];
+	cmd[0] = 0x03;
+	cmd[1] = 0x02;
+	cmd[2] = addr;
+	cmd[3] = value;
+	return ec2_queue_trx( obj, cmd, 4, "\x0D", 1 );
 }
 
 
 
-void jtag_read_xdata_page( EC2DRV *obj, char *buf, unsigned char page,
-						  unsigned char start, int len )
+/** Enable or disable JTAG XDATA access.
+	The closing write is needed after reads too, bug fix for bug #2024032.
+*/
+static void xdata_access( EC2DRV *obj, BOOL enable )
 {
-	DUMP_FUNC();
-	unsigned int i;
-	unsigned char cmd[0x0C];
+	char cmd[4];
+	cmd[0] = 0x03;
+	cmd[1] = 0x02;
+	cmd[2] = DEVICE_HAS_CAP( obj->dev, DEV_CAP_F02X_XDATA ) ? 0x2D : 0x2E;
+	cmd[3] = enable ? 0x01 : 0x00;
+	trx( obj, cmd, 4, "\x0D", 1 );
+}
 
-	memset( buf, 0xff, len );	
-	assert( (start+len) <= 0x100 );		// must be in one page only
-	
-	if(DEVICE_IN_RANGE( obj->dev->unique_id, C8051F020, C8051F023 ))
-		trx( obj, "\x03\x02\x2D\x01", 4, "\x0D", 1 );
-	else
-		trx( obj, "\x03\x02\x2E\x01", 4, "\x0D", 1 );
 
-	// select page
+/** Queue the XDATA page (address high byte) select.
+*/
+static BOOL queue_xdata_page( EC2DRV *obj, uint8_t page )
+{
+	char cmd[4];
 	cmd[0] = 0x03;
 	cmd[1] = 0x02;
-	
-	if(DEVICE_IN_RANGE( obj->dev->unique_id, C8051F020, C8051F023 ))
-		cmd[2] = 0x32;	// 31 for F120, 32 for F020
-	else
-		cmd[2] = 0x31;	// 31 for F120, 32 for F020
-
+	cmd[2] = DEVICE_HAS_CAP( obj->dev, DEV_CAP_F02X_XDATA ) ? 0x32 : 0x31;	// 31 for F120, 32 for F020
 	cmd[3] = page;
-	trx( obj, (char*)cmd, 4, "\x0D", 1 );
-	cmd[0] = 0x06;
-	cmd[1] = 0x02;
-	/// @FIXME shoulden't we begin reading at the desired location
-	//	 within the page?
-	// read the rest
-	for( i=0; i<len; i+=0x3C )
-	{
-		cmd[2] = (start+i) & 0xFF;
-		cmd[3] = (len-i)>=0x3C ? 0x3C : (len-i);
-		write_port( obj, (char*)cmd, 4 );
-		read_port( obj, buf, cmd[3]+1 );	// +1 for 0x0d terminator
-		buf += cmd[3];
-	}
-	// close out XDATA read process...bug fix for bug #2024032
-	if(DEVICE_IN_RANGE( obj->dev->unique_id, C8051F020, C8051F023 ))
-		trx( obj, "\x03\x02\x2D\x00", 4, "\x0D", 1 );
-	else
-		trx( obj, "\x03\x02\x2E\x00", 4, "\x0D", 1 );
+	return ec2_queue_trx( obj, cmd, 4, "\x0D", 1 );
 }
 
 
@@ -1255,17 +1379,69 @@ void jtag_read_xdata_page( EC2DRV *obj, char *buf, unsigned char page,
 	\param buf	pointer to buffer containing data to write
 	\param start_addr	Address in flash to start writing at
 	\param len			number of bytes to write
+	\param scratchpad	TRUE to write the scratchpad
 	\returns 			TRUE on success, FALSE on failure
  */
-BOOL jtag_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, uint32_t len )
+BOOL jtag_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len,
+					   BOOL scratchpad )
 {
 	DUMP_FUNC();
 //	if(!check_flash_range( obj, start_addr, len )) return FALSE;
-	return jtag_write_flash_block( obj, start_addr, buf, len, TRUE, FALSE);
+	return jtag_write_flash_block( obj, start_addr, buf, len, TRUE, scratchpad );
 }
 
 
 
+/** Read the program counter (JTAG).
+*/
+uint16_t jtag_read_pc( EC2DRV *obj )
+{
+	unsigned char buf[2];
+	write_port( obj, "\x02\x02\x20\x02", 4 );
+	read_port(  obj, (char*)buf, 2 );
+	return ((buf[1]<<8) | buf[0]);
+}
+
+
+void jtag_set_pc( EC2DRV *obj, uint16_t addr )
+{
+	char cmd[4];
+	cmd[0] = 0x03;
+	cmd[1] = 0x02;
+	cmd[2] = 0x20;
+	cmd[3] = addr&0xFF;
+	trx( obj, cmd, 4, "\x0D", 1 );
+	cmd[2] = 0x21;
+	cmd[3] = (addr>>8)&0xFF;
+	trx( obj, cmd, 4, "\x0D", 1 );
+}
+
+
+/** Step one instruction (JTAG).
+	\returns the PC after the step.
+*/
+uint16_t jtag_step( EC2DRV *obj )
+{
+	char buf[2];
+	trx( obj, "\x09\x00", 2, "\x0d", 1 );
+	trx( obj, "\x13\x00", 2, "\x01", 1 );	// very similar to 1/2 a target_halt command,  test to see if stopped...
+	
+	write_port( obj, "\x02\x02\x20\x02", 4 );
+	read_port(  obj, buf, 2 );
+	return (uint8_t)buf[0] | ((uint8_t)buf[1]<<8);
+}
+
+
+/** Queue one step and a read of the PC that follows into pc (JTAG).
+	Uses 3 queue entries.
+*/
+void jtag_queue_step( EC2DRV *obj, char *pc )
+{
+	ec2_queue_trx( obj, "\x09\x00", 2, "\x0d", 1 );
+	ec2_queue_trx( obj, "\x13\x00", 2, "\x01", 1 );	// stopped again
+	ec2_queue_cmd( obj, "\x02\x02\x20\x02", 4, pc, 2 );
+}
+
 
 
 /** Start the target running. (JTAG)
@@ -1275,6 +1451,7 @@ BOOL jtag_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, uint32_t
  */
 BOOL jtag_target_go( EC2DRV *obj )
 {
+	drop_flash_access( obj );
 	if( !trx( obj, "\x0b\x02\x00\x00", 4, "\x0d", 1 ) )
 		return FALSE;
 	if( !trx( obj, "\x09\x00", 2, "\x0d", 1 ) )
@@ -1328,6 +1505,7 @@ BOOL jtag_target_halt_poll( EC2DRV *obj )
 BOOL jtag_target_reset( EC2DRV *obj )
 {
 	BOOL r = TRUE;
+	drop_flash_access( obj );
 	jtag_connect_target (obj);
 	//r &= trx( obj, "\x04", 1, "\x0D", 1 );
 	
@@ -1373,7 +1551,7 @@ BOOL jtag_addBreakpoint( EC2DRV *obj, uint8_t bp, uint32_t addr )
 	cmd[0] = 0x0D;
 	cmd[1] = 0x05;
 	cmd[2] = 0x90+bp;	// Breakpoint address register to write
-	if(DEVICE_IN_RANGE( obj->dev->unique_id, C8051F120, C8051F133 )) {
+	if(DEVICE_HAS_CAP( obj->dev, DEV_CAP_JTAG_ADDR17 )) {
 		// all devices in the F120 series seem to use this, even though the F13x chips
 		//   have only 0x1000 bytes of flash
 		cmd[3] = 0x11;		// 17 bits of address
@@ -1415,3 +1593,91 @@ BOOL jtag_update_bp_enable_mask( EC2DRV *obj )
 	else
 		return FALSE;
 }
+
+
+
+const EC2_MODE_OPS ec2_jtag_ops =
+{
+	"JTAG",
+	jtag_device_id,
+	jtag_unique_device_id,
+	jtag_core_suspend,
+	jtag_read_ram,
+	jtag_read_ram_sfr,
+	jtag_write_ram,
+	jtag_write_sfr,
+	jtag_queue_read_sfr,
+	jtag_queue_write_sfr,
+	jtag_read_xdata,
+	jtag_write_xdata,
+	jtag_read_flash,
+	jtag_write_flash,
+	jtag_write_flash_block,
+	jtag_erase_flash,
+	jtag_erase_flash_sector,
+	jtag_end_flash_access,
+	jtag_read_pc,
+	jtag_set_pc,
+	jtag_step,
+	jtag_queue_step,
+	3,
+	jtag_target_go,
+	jtag_target_halt,
+	jtag_target_halt_poll,
+	jtag_target_reset,
+	jtag_addBreakpoint,
+	jtag_update_bp_enable_mask,
+	0x0C,
+	{
+		EC2_JTAG_SECTOR_ERASE_US,
+		EC2_JTAG_CHIP_ERASE_US,
+		EC2_JTAG_READ_US_PER_KB,
+		EC2_JTAG_WRITE_US_PER_KB
+	}
+};
+
+
+/// JTAG commands, see EC2_OPCODE
+const EC2_OPCODE ec2_jtag_opcodes[] =
+{
+//	  op   match     tx  data  rx       addr    flags
+	{ 0x02,  2, 0x20, 4, -1,  3,  0,    -1, 0,  0, "read PC", "run control" },
+	{ 0x02, -1, 0,    4, -1,  3,  1,     2, 1,  0, "read SFR", "sfr read" },
+	{ 0x03,  2, 0x20, 4, -1, -1,  1,    -1, 0,  0, "set PC", "run control" },
+	{ 0x03,  2, 0x21, 4, -1, -1,  1,    -1, 0,  0, "set PC", "run control" },
+	{ 0x03,  2, 0x2d, 4, -1, -1,  1,    -1, 0,  EC2_OPF_XDATA_ACCESS, "xdata access", 0 },
+	{ 0x03,  2, 0x2e, 4, -1, -1,  1,    -1, 0,  EC2_OPF_XDATA_ACCESS, "xdata access", 0 },
+	{ 0x03,  2, 0x31, 4, -1, -1,  1,    -1, 0,  EC2_OPF_XDATA_PAGE, "select xdata page", 0 },
+	{ 0x03,  2, 0x32, 4, -1, -1,  1,    -1, 0,  EC2_OPF_XDATA_PAGE, "select xdata page", 0 },
+	{ 0x03, -1, 0,    4, -1, -1,  1,     2, 1,  0, "write SFR", "sfr write" },
+	{ 0x04, -1, 0,    1, -1, -1,  1,    -1, 0,  0, "connect target", "connect" },
+	{ 0x06, -1, 0,    4, -1,  3,  1,     2, 1,  EC2_OPF_XDATA, "read xdata", "xdata read" },
+	{ 0x06, -1, 0,    4, -1,  3,  1,     2, 1,  0, "read RAM", "ram read" },
+	{ 0x07, -1, 0,    3,  2, -1,  1,     1, 1,  EC2_OPF_XDATA, "write xdata", "xdata write" },
+	{ 0x07, -1, 0,    3,  2, -1,  1,     1, 1,  0, "write RAM", "ram write" },
+	{ 0x09, -1, 0,    2, -1, -1,  1,    -1, 0,  0, "step", "run control" },
+	{ 0x0a, -1, 0,    2, -1, -1,  6,    -1, 0,  0, "read device id", "connect" },
+	{ 0x0b,  2, 0x00, 4, -1, -1,  1,    -1, 0,  0, "run", "run control" },
+	{ 0x0b,  2, 0x01, 4, -1, -1,  1,    -1, 0,  0, "halt", "run control" },
+	{ 0x0b,  2, 0x02, 4, -1, -1,  1,    -1, 0,  0, "system reset", "reset" },
+	{ 0x0b, -1, 0,    4, -1, -1,  1,    -1, 0,  0, "state control", "run control" },
+	{ 0x0c, -1, 0,    4, -1, -1,  EC2_RX_ANY, 2, 1,  0, "read JTAG register", "jtag register" },
+	{ 0x0d,  2, 0x82, 7, -1, -1,  1,    -1, 0,  0, "write flashcon", 0 },
+	{ 0x0d,  2, 0x84, 7, -1, -1,  1,     4, 3,  EC2_OPF_FLASH_ADDR, "set flash address", 0 },
+	{ 0x0d,  2, 0x86, 7, -1, -1,  1,    -1, 0,  0, "write breakpoint mask", "breakpoint" },
+	{ 0x0d, -1, 0,    7, -1, -1,  1,     2, 1,  0, "write JTAG register", "jtag register" },
+	{ 0x0e, -1, 0,    2, -1, -1,  1,    -1, 0,  0, "flash status", 0 },
+	{ 0x0f,  2, 0xa5, 3, -1, -1,  1,    -1, 0,  EC2_OPF_FLASH_PTR, "erase sector", "flash erase" },
+	{ 0x0f, -1, 0,    3, -1, -1,  1,    -1, 0,  0, "flash operation", 0 },
+	{ 0x10, -1, 0,    2, -1, -1,  2,    -1, 0,  0, "unknown 0x10", 0 },
+	{ 0x11, -1, 0,    4, -1,  2,  1,    -1, 0,  EC2_OPF_FLASH_PTR, "read flash", "flash read" },
+	{ 0x12, -1, 0,    4,  2, -1,  1,    -1, 0,  EC2_OPF_FLASH_PTR|EC2_OPF_DATA16, "write flash", "flash write" },
+	{ 0x13, -1, 0,    2, -1, -1,  1,    -1, 0,  0, "poll halted", "run control" },
+	{ 0x14, -1, 0,    4, -1, -1,  2,    -1, 0,  0, "unknown 0x14", 0 },
+	{ 0x15, -1, 0,    4, -1, -1,  2,    -1, 0,  0, "unknown 0x15", 0 },
+	{ 0x16,  1, 0x01, 3, -1, -1,  1,    -1, 0,  0, "unknown 0x16", 0 },
+	{ 0x16,  1, 0x03, 5, -1, -1,  4,    -1, 0,  0, "unknown 0x16", 0 },
+	{ 0x16, -1, 0,    4, -1, -1,  3,    -1, 0,  0, "unknown 0x16", 0 },
+	{ 0x1a, -1, 0,    8, -1, -1,  1,    -1, 0,  0, "unknown 0x1a", 0 },
+	{ 0 }
+};
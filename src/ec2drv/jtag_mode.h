@@ -34,6 +34,8 @@ BOOL jtag_write_flash_sector( EC2DRV *obj, uint32_t sect_addr, uint8_t *buf,
 							  BOOL scratchpad );
 BOOL jtag_read_flash( EC2DRV *obj, uint8_t *buf,
 						  uint32_t start_addr, int len, BOOL scratchpad );
+void jtag_begin_flash_access( EC2DRV *obj );
+void jtag_end_flash_access( EC2DRV *obj );
 BOOL jtag_write_flash_block( EC2DRV *obj, uint32_t addr,
 							 uint8_t *buf, uint32_t len,
 							 BOOL save, BOOL scratchpad);
@@ -41,6 +43,7 @@ BOOL jtag_erase_flash( EC2DRV *obj );
 BOOL jtag_erase_flash_sector( EC2DRV *obj, uint32_t sector_addr,
 							  BOOL scratchpad );
 void set_flash_addr_jtag( EC2DRV *obj, uint32_t addr );
+BOOL queue_flash_addr_jtag( EC2DRV *obj, uint32_t addr );
 
 BOOL ec2_connect_jtag( EC2DRV *obj, const char *port );
 
@@ -48,9 +51,17 @@ void jtag_read_ram( EC2DRV *obj, char *buf, int start_addr, int len );
 void jtag_read_ram_sfr( EC2DRV *obj, char *buf, int start_addr, int len, BOOL sfr );
 BOOL jtag_write_ram( EC2DRV *obj, char *buf, int start_addr, int len );
 BOOL jtag_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len );
-void jtag_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len );
+BOOL jtag_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len );
 void jtag_write_sfr( EC2DRV *obj, uint8_t value, uint8_t addr );
-BOOL jtag_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, uint32_t len );
+BOOL jtag_queue_read_sfr( EC2DRV *obj, uint8_t addr, uint8_t len, char *buf );
+BOOL jtag_queue_write_sfr( EC2DRV *obj, uint8_t addr, uint8_t value );
+BOOL jtag_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr, int len,
+					   BOOL scratchpad );
+
+uint16_t jtag_read_pc( EC2DRV *obj );
+void jtag_set_pc( EC2DRV *obj, uint16_t addr );
+uint16_t jtag_step( EC2DRV *obj );
+void jtag_queue_step( EC2DRV *obj, char *pc );
 
 BOOL jtag_target_go( EC2DRV *obj );
 BOOL jtag_target_halt( EC2DRV *obj );
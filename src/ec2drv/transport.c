@@ -0,0 +1,1144 @@
+/**	Transports that don't need any hardware.
+
+	Playback replays a session captured with the sniffer (the same
+	"T xx xx .. R yy yy .." text format used by devel-tools/playback), checking
+	each command sent against the capture and returning the recorded reply.
+
+	Record writes every exchange made through write_port() / read_port() to a
+	compact binary log, replay feeds such a log back in-process without any
+	waiting, so driver changes can be timed against real captured sessions.
+
+	Loopback keeps everything in memory.  Without a responder every command is
+	echoed back, with one installed (ec2_loopback_set_responder()) the
+	responder decides on the reply, which lets the protocol layers be run and
+	timed at full host speed.
+
+	Daemon forwards the transport calls to an adapter that ec2d keeps open,
+	so tools don't pay for finding and connecting to it each time they run.
+	The daemon may be on another machine, whole command queues and memory
+	and flash operations are then sent in one message each so they cost one
+	network round trip rather than one per command.
+
+	(C) Ricky White 2006
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "ec2drv.h"
+
+#define FIFO_SIZE	4096
+
+/** Bytes waiting to be read by the driver.
+*/
+typedef struct
+{
+	char	buf[FIFO_SIZE];
+	int		head;
+	int		count;
+} BYTE_FIFO;
+
+static BOOL fifo_put( BYTE_FIFO *f, const char *buf, int len )
+{
+	int i;
+	if( f->count+len > FIFO_SIZE )
+		return FALSE;
+	for( i=0; i<len; i++ )
+		f->buf[(f->head+f->count+i) % FIFO_SIZE] = buf[i];
+	f->count += len;
+	return TRUE;
+}
+
+static BOOL fifo_get( BYTE_FIFO *f, char *buf, int len )
+{
+	int i;
+	if( f->count < len )
+		return FALSE;
+	for( i=0; i<len; i++ )
+		buf[i] = f->buf[(f->head+i) % FIFO_SIZE];
+	f->head = (f->head+len) % FIFO_SIZE;
+	f->count -= len;
+	return TRUE;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Playback
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	char	*tx;
+	int		txlen;
+	char	*rx;
+	int		rxlen;
+} PLAYBACK_PAIR;
+
+typedef struct
+{
+	PLAYBACK_PAIR	*pairs;
+	int				num_pairs;
+	int				next;		///< next pair expected
+	BYTE_FIFO		fifo;
+} PLAYBACK;
+
+
+/** Parse the hex bytes in line[start,end) into a newly allocated buffer.
+	\returns number of bytes parsed.
+*/
+static int parse_hex( const char *start, const char *end, char **out )
+{
+	char *p;
+	int n = 0;
+	unsigned long v;
+	*out = malloc( (end-start)/2+1 );
+	while( start<end )
+	{
+		v = strtoul( start, &p, 16 );
+		if( p==start )
+		{
+			start++;		// skip anything that isn't hex
+			continue;
+		}
+		(*out)[n++] = v;
+		start = p;
+	}
+	return n;
+}
+
+static BOOL playback_open( EC2DRV *obj, const char *port )
+{
+	FILE *f;
+	char line[1024];
+	char *t, *r;
+	PLAYBACK *pb;
+
+	f = fopen( port, "r" );
+	if( !f )
+	{
+		printf("playback: Unable to open %s\n", port );
+		return FALSE;
+	}
+	pb = calloc( 1, sizeof(PLAYBACK) );
+	while( fgets( line, sizeof(line), f ) )
+	{
+		if( strstr( line, "//" ) )
+			continue;		// comment
+		t = strchr( line, 'T' );
+		r = t ? strchr( t, 'R' ) : 0;
+		if( !t || !r )
+			continue;
+		pb->pairs = realloc( pb->pairs, sizeof(PLAYBACK_PAIR)*(pb->num_pairs+1) );
+		PLAYBACK_PAIR *pair = &pb->pairs[pb->num_pairs++];
+		pair->txlen = parse_hex( t+1, r, &pair->tx );
+		pair->rxlen = parse_hex( r+1, r+strlen(r), &pair->rx );
+	}
+	fclose( f );
+	obj->transport_data = pb;
+	obj->dbg_info = ec2_GetDbgInfo( -1,-1 );	// behaves as an EC2
+	return TRUE;
+}
+
+static void playback_close( EC2DRV *obj )
+{
+	int i;
+	PLAYBACK *pb = (PLAYBACK*)obj->transport_data;
+	for( i=0; i<pb->num_pairs; i++ )
+	{
+		free( pb->pairs[i].tx );
+		free( pb->pairs[i].rx );
+	}
+	free( pb->pairs );
+	free( pb );
+}
+
+static BOOL playback_write( EC2DRV *obj, char *buf, int len )
+{
+	PLAYBACK *pb = (PLAYBACK*)obj->transport_data;
+	PLAYBACK_PAIR *pair;
+
+	if( pb->next>=pb->num_pairs )
+	{
+		printf("playback: out of recorded data\n");
+		return FALSE;
+	}
+	pair = &pb->pairs[pb->next++];
+	if( pair->txlen!=len || memcmp( pair->tx, buf, len )!=0 )
+	{
+		printf("playback: command %i differs from capture\n", pb->next-1 );
+		return FALSE;
+	}
+	return fifo_put( &pb->fifo, pair->rx, pair->rxlen );
+}
+
+static BOOL playback_read( EC2DRV *obj, char *buf, int len )
+{
+	return fifo_get( &((PLAYBACK*)obj->transport_data)->fifo, buf, len );
+}
+
+static BOOL playback_read_timeout( EC2DRV *obj, char *buf, int len, uint32_t ms )
+{
+	return playback_read( obj, buf, len );
+}
+
+static void playback_flush( EC2DRV *obj )
+{
+	PLAYBACK *pb = (PLAYBACK*)obj->transport_data;
+	pb->fifo.head = pb->fifo.count = 0;
+}
+
+const EC2_TRANSPORT ec2_playback_transport =
+{
+	"playback",
+	playback_open,
+	playback_close,
+	playback_write,
+	0,
+	playback_read,
+	playback_read_timeout,
+	playback_flush,
+	0
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Loopback
+////////////////////////////////////////////////////////////////////////////////
+
+static EC2_LOOPBACK_FN	loopback_fn;
+static void				*loopback_ctx;
+
+/** Install the function that generates replies for loopback transports
+	opened after this call.  Pass 0 to go back to echoing commands.
+*/
+void ec2_loopback_set_responder( EC2_LOOPBACK_FN fn, void *ctx )
+{
+	loopback_fn = fn;
+	loopback_ctx = ctx;
+}
+
+/** Queue reply bytes for the driver to read, for use by a responder.
+	\returns TRUE on success, FALSE if the transport isn't a loopback or the
+			 reply buffer is full.
+*/
+BOOL ec2_loopback_reply( EC2DRV *obj, const char *buf, int len )
+{
+	if( obj->transport!=&ec2_loopback_transport || !obj->transport_data )
+		return FALSE;
+	return fifo_put( (BYTE_FIFO*)obj->transport_data, buf, len );
+}
+
+static BOOL loopback_open( EC2DRV *obj, const char *port )
+{
+	obj->transport_data = calloc( 1, sizeof(BYTE_FIFO) );
+	obj->dbg_info = ec2_GetDbgInfo( -1,-1 );	// behaves as an EC2
+	return obj->transport_data!=0;
+}
+
+static void loopback_close( EC2DRV *obj )
+{
+	free( obj->transport_data );
+}
+
+static BOOL loopback_write( EC2DRV *obj, char *buf, int len )
+{
+	if( loopback_fn )
+	{
+		loopback_fn( obj, buf, len, loopback_ctx );
+		return TRUE;
+	}
+	return fifo_put( (BYTE_FIFO*)obj->transport_data, buf, len );
+}
+
+static BOOL loopback_read( EC2DRV *obj, char *buf, int len )
+{
+	return fifo_get( (BYTE_FIFO*)obj->transport_data, buf, len );
+}
+
+static BOOL loopback_read_timeout( EC2DRV *obj, char *buf, int len, uint32_t ms )
+{
+	return loopback_read( obj, buf, len );
+}
+
+static void loopback_flush( EC2DRV *obj )
+{
+	BYTE_FIFO *f = (BYTE_FIFO*)obj->transport_data;
+	f->head = f->count = 0;
+}
+
+const EC2_TRANSPORT ec2_loopback_transport =
+{
+	"loopback",
+	loopback_open,
+	loopback_close,
+	loopback_write,
+	0,
+	loopback_read,
+	loopback_read_timeout,
+	loopback_flush,
+	0
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Record / Replay
+////////////////////////////////////////////////////////////////////////////////
+//
+// The log format is described with the EC2_REC_ kinds in ec2drv.h, the
+// sniffer in devel-tools writes the same logs from a serial capture.
+
+typedef struct
+{
+	FILE		*f;
+	BOOL		header_done;
+	uint64_t	last_ns;
+} REC_LOG;
+
+static uint64_t rec_now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void put_le( uint8_t *p, uint64_t v, int n )
+{
+	int i;
+	for( i=0; i<n; i++ )
+		p[i] = v >> (8*i);
+}
+
+static uint32_t get_le( const uint8_t *p, int n )
+{
+	uint32_t v = 0;
+	int i;
+	for( i=n-1; i>=0; i-- )
+		v = (v<<8) | p[i];
+	return v;
+}
+
+/** Start logging every exchange with the debugger to file.
+	The log is only opened here, the header is written with the first record
+	once the adapter is known.  To include the connect sequence use
+	"RECORD:<file>,<port>" as the port name instead.
+	\returns TRUE on success, FALSE if the file can't be created.
+*/
+BOOL ec2_record_start( EC2DRV *obj, const char *file )
+{
+	REC_LOG *log;
+	ec2_record_stop( obj );
+	log = calloc( 1, sizeof(REC_LOG) );
+	log->f = fopen( file, "wb" );
+	if( !log->f )
+	{
+		printf("record: Unable to create %s\n", file );
+		free( log );
+		return FALSE;
+	}
+	setvbuf( log->f, 0, _IOFBF, 65536 );
+	obj->record_log = log;
+	return TRUE;
+}
+
+/** Stop logging and close the log file.
+*/
+void ec2_record_stop( EC2DRV *obj )
+{
+	REC_LOG *log = (REC_LOG*)obj->record_log;
+	if( log )
+	{
+		fclose( log->f );
+		free( log );
+		obj->record_log = 0;
+	}
+}
+
+static void rec_entry( EC2DRV *obj, uint8_t kind, const char *buf, int len )
+{
+	REC_LOG *log = (REC_LOG*)obj->record_log;
+	uint8_t hdr[EC2_REC_HEADER_LEN];
+	uint64_t now = rec_now();
+
+	if( !log->header_done )
+	{
+		memcpy( hdr, "EC2R", 4 );
+		hdr[4] = EC2_REC_VERSION;
+		hdr[5] = obj->dbg_adaptor==EC3 ? 1 : 0;
+		put_le( hdr+6, obj->dbg_info ? obj->dbg_info->usb_vendor_id : 0xffff, 2 );
+		put_le( hdr+8, obj->dbg_info ? obj->dbg_info->usb_product_id : 0xffff, 2 );
+		fwrite( hdr, EC2_REC_HEADER_LEN, 1, log->f );
+		log->header_done = TRUE;
+		log->last_ns = now - 0x100000000ULL;	// forces the first sync
+	}
+	if( now - log->last_ns > 0xffffffff )
+	{
+		uint8_t sync[EC2_REC_ENTRY_LEN+8];
+		sync[0] = EC2_REC_SYNC;
+		put_le( sync+1, 0, 4 );
+		put_le( sync+5, 8, 2 );
+		put_le( sync+7, now, 8 );
+		fwrite( sync, sizeof(sync), 1, log->f );
+		log->last_ns = now;
+	}
+	hdr[0] = kind;
+	put_le( hdr+1, now - log->last_ns, 4 );
+	put_le( hdr+5, len, 2 );
+	fwrite( hdr, EC2_REC_ENTRY_LEN, 1, log->f );
+	if( buf )
+		fwrite( buf, len, 1, log->f );
+	log->last_ns = now;
+}
+
+/** Log a command sent to the debugger, called from write_port().
+*/
+void ec2_record_tx( EC2DRV *obj, const char *buf, int len )
+{
+	rec_entry( obj, EC2_REC_TX, buf, len );
+}
+
+/** Log the result of a read, called from read_port() / read_port_tm().
+*/
+void ec2_record_rx( EC2DRV *obj, const char *buf, int len, BOOL ok )
+{
+	if( ok )
+		rec_entry( obj, EC2_REC_RX, buf, len );
+	else
+		rec_entry( obj, EC2_REC_TIMEOUT, 0, len );
+}
+
+
+typedef struct
+{
+	uint8_t		*log;		///< the whole log file
+	uint32_t	len;
+	uint32_t	pos;		///< next record
+	uint32_t	used;		///< bytes of the record at pos already consumed
+	int			cmd;		///< commands replayed, for messages
+} REPLAY;
+
+static uint16_t rec_len( REPLAY *rp )
+{
+	return get_le( rp->log+rp->pos+5, 2 );
+}
+
+/** \returns the kind of the record at pos, 0 at the end of the log or for
+	a record cut short by it, as when the recording program died.
+*/
+static uint8_t rec_kind( REPLAY *rp )
+{
+	uint8_t kind;
+	if( rp->pos+EC2_REC_ENTRY_LEN > rp->len )
+		return 0;
+	kind = rp->log[rp->pos];
+	if( kind!=EC2_REC_TIMEOUT &&
+		rp->pos+EC2_REC_ENTRY_LEN+rec_len(rp) > rp->len )
+		return 0;
+	return kind;
+}
+
+static const uint8_t *rec_data( REPLAY *rp )
+{
+	return rp->log + rp->pos + EC2_REC_ENTRY_LEN + rp->used;
+}
+
+static void rec_step( REPLAY *rp )
+{
+	uint8_t kind = rec_kind( rp );
+	if( kind==0 )
+		rp->pos = rp->len;
+	else
+		rp->pos += EC2_REC_ENTRY_LEN + (kind==EC2_REC_TIMEOUT ? 0 : rec_len(rp));
+}
+
+/** Pass over the records replay has no use for, such as syncs and line
+	changes.
+*/
+static void rec_skip_other( REPLAY *rp )
+{
+	uint8_t kind;
+	while( (kind = rec_kind(rp)) && kind!=EC2_REC_TX && kind!=EC2_REC_RX &&
+		   kind!=EC2_REC_TIMEOUT )
+		rec_step( rp );
+}
+
+static void rec_next( REPLAY *rp )
+{
+	rec_step( rp );
+	rec_skip_other( rp );
+	rp->used = 0;
+}
+
+/** Skip over replies the driver didn't read.
+*/
+static void replay_skip_rx( REPLAY *rp )
+{
+	while( rec_kind(rp)==EC2_REC_RX || rec_kind(rp)==EC2_REC_TIMEOUT )
+		rec_next( rp );
+}
+
+static BOOL replay_open( EC2DRV *obj, const char *port )
+{
+	FILE *f;
+	REPLAY *rp;
+	long size;
+
+	f = fopen( port, "rb" );
+	if( !f )
+	{
+		printf("replay: Unable to open %s\n", port );
+		return FALSE;
+	}
+	fseek( f, 0, SEEK_END );
+	size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	rp = calloc( 1, sizeof(REPLAY) );
+	rp->log = malloc( size>0 ? size : 1 );
+	rp->len = fread( rp->log, 1, size, f );
+	fclose( f );
+	if( rp->len<EC2_REC_HEADER_LEN || memcmp( rp->log, "EC2R", 4 )!=0 ||
+		rp->log[4]<1 || rp->log[4]>EC2_REC_VERSION )
+	{
+		printf("replay: %s is not a recorded session\n", port );
+		free( rp->log );
+		free( rp );
+		return FALSE;
+	}
+	obj->dbg_adaptor = rp->log[5] ? EC3 : EC2;
+	obj->dbg_info = ec2_GetDbgInfo( get_le( rp->log+6, 2 ),
+									get_le( rp->log+8, 2 ) );
+	rp->pos = EC2_REC_HEADER_LEN;
+	rec_skip_other( rp );
+	obj->transport_data = rp;
+	return TRUE;
+}
+
+static void replay_close( EC2DRV *obj )
+{
+	REPLAY *rp = (REPLAY*)obj->transport_data;
+	free( rp->log );
+	free( rp );
+}
+
+/** Commands are matched against the recorded bytes rather than whole
+	records, a capture taken by the sniffer can hold several commands in one
+	EC2_REC_TX record.
+*/
+static BOOL replay_write( EC2DRV *obj, char *buf, int len )
+{
+	REPLAY *rp = (REPLAY*)obj->transport_data;
+	int n;
+
+	if( rp->used==0 )
+		replay_skip_rx( rp );
+	while( len>0 )
+	{
+		if( rec_kind(rp)!=EC2_REC_TX )
+		{
+			printf("replay: out of recorded data\n");
+			return FALSE;
+		}
+		n = rec_len(rp) - rp->used;
+		if( n>len )
+			n = len;
+		if( memcmp( rec_data(rp), buf, n )!=0 )
+		{
+			printf("replay: command %i differs from capture\n", rp->cmd );
+			return FALSE;
+		}
+		buf += n;
+		len -= n;
+		rp->used += n;
+		if( rp->used==rec_len(rp) )
+			rec_next( rp );
+	}
+	rp->cmd++;
+	return TRUE;
+}
+
+/** Reads are served from the replies recorded after the last command, in
+	whatever sized pieces the driver asks for.  A recorded timeout fails the
+	read that reaches it, as does running out of replies.
+*/
+static BOOL replay_read( EC2DRV *obj, char *buf, int len )
+{
+	REPLAY *rp = (REPLAY*)obj->transport_data;
+	int n;
+
+	while( len>0 )
+	{
+		if( rec_kind(rp)==EC2_REC_TIMEOUT )
+		{
+			rec_next( rp );
+			return FALSE;
+		}
+		if( rec_kind(rp)!=EC2_REC_RX )
+			return FALSE;
+		n = rec_len(rp) - rp->used;
+		if( n>len )
+			n = len;
+		memcpy( buf, rec_data(rp), n );
+		buf += n;
+		len -= n;
+		rp->used += n;
+		if( rp->used==rec_len(rp) )
+			rec_next( rp );
+	}
+	return TRUE;
+}
+
+static BOOL replay_read_timeout( EC2DRV *obj, char *buf, int len, uint32_t ms )
+{
+	return replay_read( obj, buf, len );
+}
+
+static void replay_flush( EC2DRV *obj )
+{
+	replay_skip_rx( (REPLAY*)obj->transport_data );
+}
+
+const EC2_TRANSPORT ec2_replay_transport =
+{
+	"replay",
+	replay_open,
+	replay_close,
+	replay_write,
+	0,
+	replay_read,
+	replay_read_timeout,
+	replay_flush,
+	0
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Daemon
+////////////////////////////////////////////////////////////////////////////////
+//
+// The message format is described with the EC2D_ ops in ec2drv.h, ec2d in
+// ec2tools is the other end.
+
+typedef struct
+{
+	int				fd;
+	EC2D_SESSION	session;	///< from the EC2D_OPEN reply, then as connected
+	uint32_t		caps;		///< EC2D_CAP_ bits from the EC2D_OPEN reply
+	char			msg[EC2D_CALL_HEADER_LEN+EC2D_CALL_MAX];	///< EC2D_CALL being sent
+} DAEMON;
+
+/** Read exactly len bytes, retrying interrupted and short reads.
+*/
+static BOOL read_all( int fd, char *buf, int len )
+{
+	ssize_t n;
+	while( len>0 )
+	{
+		n = read( fd, buf, len );
+		if( n<0 && errno==EINTR )
+			continue;
+		if( n<=0 )
+			return FALSE;
+		buf += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+/** Send one message, header and data in a single write.
+	\returns FALSE if the other end has gone.
+*/
+BOOL ec2d_send( int fd, uint8_t op, uint8_t status, uint32_t arg,
+				const char *data, int len )
+{
+	uint8_t hdr[EC2D_HEADER_LEN];
+	struct iovec iov[2];
+	ssize_t n, total = EC2D_HEADER_LEN+len;
+	int cnt = 2;
+	struct iovec *v = iov;
+
+	hdr[0] = op;
+	hdr[1] = status;
+	put_le( hdr+2, len, 2 );
+	put_le( hdr+4, arg, 4 );
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = EC2D_HEADER_LEN;
+	iov[1].iov_base = (char*)data;
+	iov[1].iov_len = len;
+	while( total>0 )
+	{
+		n = writev( fd, v, cnt );
+		if( n<0 && errno==EINTR )
+			continue;
+		if( n<=0 )
+			return FALSE;
+		total -= n;
+		// step over what went, only a large message is split
+		while( cnt>0 && n>=(ssize_t)v->iov_len )
+		{
+			n -= v->iov_len;
+			v++;
+			cnt--;
+		}
+		if( cnt>0 )
+		{
+			v->iov_base = (char*)v->iov_base + n;
+			v->iov_len -= n;
+		}
+	}
+	return TRUE;
+}
+
+/** Receive one message, data longer than max is discarded.
+	\param[out] len	data length received
+	\returns FALSE if the other end has gone or sent too much.
+*/
+BOOL ec2d_recv( int fd, uint8_t *op, uint8_t *status, uint32_t *arg,
+				char *data, int max, int *len )
+{
+	uint8_t hdr[EC2D_HEADER_LEN];
+	if( !read_all( fd, (char*)hdr, EC2D_HEADER_LEN ) )
+		return FALSE;
+	*op = hdr[0];
+	*status = hdr[1];
+	*len = get_le( hdr+2, 2 );
+	*arg = get_le( hdr+4, 4 );
+	if( *len>max )
+		return FALSE;
+	return read_all( fd, data, *len );
+}
+
+void ec2d_put_session( char *buf, const EC2D_SESSION *s )
+{
+	buf[0] = s->adaptor;
+	buf[1] = s->connected;
+	buf[2] = s->mode;
+	buf[3] = s->fw_ver;
+	put_le( (uint8_t*)buf+4, s->usb_vendor_id, 2 );
+	put_le( (uint8_t*)buf+6, s->usb_product_id, 2 );
+	buf[8] = s->unique_id;
+}
+
+void ec2d_get_session( const char *buf, EC2D_SESSION *s )
+{
+	s->adaptor = buf[0];
+	s->connected = buf[1];
+	s->mode = buf[2];
+	s->fw_ver = buf[3];
+	s->usb_vendor_id = get_le( (const uint8_t*)buf+4, 2 );
+	s->usb_product_id = get_le( (const uint8_t*)buf+6, 2 );
+	s->unique_id = buf[8];
+}
+
+/** Connect to a daemon at <host>:<tcp port>.
+	Nagle is turned off, the protocol is all small messages that are waited
+	for.
+	\returns the socket, -1 on failure.
+*/
+static int connect_tcp( const char *path )
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *sep = strrchr( path, ':' );
+	int fd = -1, on = 1;
+
+	if( sep-path>=(int)sizeof(host) )
+		return -1;
+	memcpy( host, path, sep-path );
+	host[sep-path] = '\0';
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if( getaddrinfo( host, sep+1, &hints, &res )!=0 )
+		return -1;
+	for( ai=res; ai && fd<0; ai=ai->ai_next )
+	{
+		fd = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+		if( fd>=0 && connect( fd, ai->ai_addr, ai->ai_addrlen )!=0 )
+		{
+			close( fd );
+			fd = -1;
+		}
+	}
+	freeaddrinfo( res );
+	if( fd>=0 )
+		setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+	return fd;
+}
+
+static BOOL daemon_open( EC2DRV *obj, const char *port )
+{
+	struct sockaddr_un addr;
+	const char *path = getenv("EC2D_SOCKET");
+	char reply[256];
+	uint8_t op, status;
+	uint32_t arg;
+	int len;
+	DAEMON *d;
+
+	if( !path || !*path )
+		path = EC2D_SOCKET;
+	if( !port )
+		port = "";
+	d = calloc( 1, sizeof(DAEMON) );
+	if( !d )
+		return FALSE;
+	if( !strchr( path, '/' ) && strchr( path, ':' ) )
+		d->fd = connect_tcp( path );
+	else
+	{
+		memset( &addr, 0, sizeof(addr) );
+		addr.sun_family = AF_UNIX;
+		strncpy( addr.sun_path, path, sizeof(addr.sun_path)-1 );
+		d->fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if( d->fd>=0 &&
+			connect( d->fd, (struct sockaddr*)&addr, sizeof(addr) )!=0 )
+		{
+			close( d->fd );
+			d->fd = -1;
+		}
+	}
+	if( d->fd<0 )
+	{
+		printf("ec2d: Unable to connect to %s\n", path );
+		goto fail;
+	}
+	// waits while another client has the adapter
+	if( !ec2d_send( d->fd, EC2D_OPEN, 0, 0, port, strlen(port) ) ||
+		!ec2d_recv( d->fd, &op, &status, &arg, reply, sizeof(reply)-1, &len ) ||
+		op!=EC2D_OPEN )
+	{
+		printf("ec2d: No reply from the daemon\n");
+		goto fail;
+	}
+	if( status!=0 || len!=EC2D_SESSION_LEN )
+	{
+		reply[len] = '\0';
+		printf("ec2d: %s\n", reply );
+		goto fail;
+	}
+	ec2d_get_session( reply, &d->session );
+	d->caps = arg;
+	obj->transport_data = d;
+	obj->dbg_adaptor = d->session.adaptor ? EC3 : EC2;
+	obj->dbg_info = ec2_GetDbgInfo( d->session.usb_vendor_id,
+									d->session.usb_product_id );
+	return obj->dbg_info!=0;
+fail:
+	if( d->fd>=0 )
+		close( d->fd );
+	free( d );
+	return FALSE;
+}
+
+static void daemon_close( EC2DRV *obj )
+{
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	if( !d )
+		return;
+	close( d->fd );		// the daemon frees the adapter
+	free( d );
+}
+
+static BOOL daemon_write( EC2DRV *obj, char *buf, int len )
+{
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	// a failed write shows up as a failed read of the reply
+	return ec2d_send( d->fd, EC2D_WRITE, 0, 0, buf, len );
+}
+
+static BOOL daemon_read_timeout( EC2DRV *obj, char *buf, int len, uint32_t ms )
+{
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	uint8_t want[2];
+	uint8_t op, status;
+	uint32_t arg;
+	int n;
+
+	put_le( want, len, 2 );
+	if( !ec2d_send( d->fd, EC2D_READ, 0, ms, (char*)want, 2 ) ||
+		!ec2d_recv( d->fd, &op, &status, &arg, buf, len, &n ) )
+		return FALSE;
+	return op==EC2D_READ && status==0 && n==len;
+}
+
+static BOOL daemon_read( EC2DRV *obj, char *buf, int len )
+{
+	return daemon_read_timeout( obj, buf, len, 0 );
+}
+
+static void daemon_flush( EC2DRV *obj )
+{
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	ec2d_send( d->fd, EC2D_FLUSH, 0, 0, 0, 0 );
+}
+
+static void daemon_reset( EC2DRV *obj )
+{
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	ec2d_send( d->fd, EC2D_RESET, 0, 0, 0, 0 );
+}
+
+/** Send the queue as one EC2D_BATCH, or command by command to a daemon
+	without EC2D_CAP_CALLS.
+*/
+static int daemon_flush_queue( EC2DRV *obj )
+{
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	char buf[EC2_QUEUE_DEPTH*(3+EC2_QUEUE_TX_MAX)];
+	char rx[4096];
+	uint8_t op, status;
+	uint32_t arg;
+	int i, len = 0, rxlen = 0, n;
+	EC2_QCMD *q;
+
+	for( i=0; i<obj->queue_len; i++ )
+		rxlen += obj->queue[i].rxlen;
+	if( !(d->caps & EC2D_CAP_CALLS) || rxlen>(int)sizeof(rx) )
+	{
+		// the EC2 is driven one command at a time, see ec2_queue_flush()
+		BOOL ec3 = obj->dbg_adaptor==EC3;
+		for( i=0; ec3 && i<obj->queue_len; i++ )
+			daemon_write( obj, obj->queue[i].pkt+1, obj->queue[i].txlen );
+		for( i=0; i<obj->queue_len; i++ )
+		{
+			q = &obj->queue[i];
+			if( !ec3 )
+				daemon_write( obj, q->pkt+1, q->txlen );
+			if( !daemon_read( obj, q->rx, q->rxlen ) )
+				return i;
+		}
+		return obj->queue_len;
+	}
+	for( i=0; i<obj->queue_len; i++ )
+	{
+		q = &obj->queue[i];
+		buf[len] = q->txlen;
+		put_le( (uint8_t*)buf+len+1, q->rxlen, 2 );
+		memcpy( buf+len+3, q->pkt+1, q->txlen );
+		len += 3+q->txlen;
+	}
+	if( !ec2d_send( d->fd, EC2D_BATCH, 0, 0, buf, len ) ||
+		!ec2d_recv( d->fd, &op, &status, &arg, rx, sizeof(rx), &n ) ||
+		op!=EC2D_BATCH )
+		return 0;
+	for( i=0, len=0; i<obj->queue_len && i<(int)arg; i++ )
+	{
+		q = &obj->queue[i];
+		if( len+q->rxlen>n )
+			return i;
+		if( q->rxlen )
+			memcpy( q->rx, rx+len, q->rxlen );
+		len += q->rxlen;
+	}
+	return i;
+}
+
+/** The adapter state the daemon reported when the port was opened, or that
+	ec2_daemon_set_session() has recorded since.
+	\returns FALSE if obj isn't using the daemon transport.
+*/
+BOOL ec2_daemon_session( EC2DRV *obj, EC2D_SESSION *s )
+{
+	if( obj->transport!=&ec2_daemon_transport || !obj->transport_data )
+		return FALSE;
+	*s = ((DAEMON*)obj->transport_data)->session;
+	return TRUE;
+}
+
+void ec2_daemon_set_session( EC2DRV *obj, const EC2D_SESSION *s )
+{
+	if( obj->transport==&ec2_daemon_transport && obj->transport_data )
+		((DAEMON*)obj->transport_data)->session = *s;
+}
+
+/** Tell the daemon the adapter is being left connected, with the session
+	recorded by ec2_daemon_set_session().  Without this the daemon resets the
+	adapter when the client goes.
+*/
+void ec2_daemon_keep( EC2DRV *obj )
+{
+	char buf[EC2D_SESSION_LEN];
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	if( obj->transport!=&ec2_daemon_transport || !d || !d->session.connected )
+		return;
+	ec2d_put_session( buf, &d->session );
+	ec2d_send( d->fd, EC2D_KEEP, 0, 0, buf, sizeof(buf) );
+}
+
+/** Run one operation on the daemon's adapter.
+	Operations moving more than EC2D_CALL_MAX bytes are split, the pieces
+	are all sent before any reply is read, so the whole operation costs one
+	round trip.
+	\param call		EC2D_CALL_ operation
+	\param rd		receives len bytes read, 0 for the writes
+	\param wr		len bytes to write, 0 for the reads
+	\returns		TRUE if every piece succeeded.
+*/
+static BOOL remote_call( EC2DRV *obj, uint8_t call, uint32_t addr,
+						 uint32_t len, uint8_t flags, char *rd, const char *wr )
+{
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	uint32_t ofs = 0, n, arg;
+	uint8_t op, status;
+	int pieces = 0, got;
+	BOOL r = TRUE;
+	BOOL flash = call==EC2D_CALL_WRITE_FLASH ||
+				 call==EC2D_CALL_WRITE_FLASH_BLOCK;
+
+	if( flash )
+		obj->flash_fail_addr = -1;
+	do		// at least once, for the calls without data
+	{
+		n = len-ofs < EC2D_CALL_MAX ? len-ofs : EC2D_CALL_MAX;
+		put_le( (uint8_t*)d->msg, addr+ofs, 4 );
+		put_le( (uint8_t*)d->msg+4, n, 4 );
+		d->msg[8] = flags;
+		if( wr )
+			memcpy( d->msg+EC2D_CALL_HEADER_LEN, wr+ofs, n );
+		if( !ec2d_send( d->fd, EC2D_CALL, 0, call, d->msg,
+						EC2D_CALL_HEADER_LEN+(wr ? n : 0) ) )
+			return FALSE;
+		pieces++;
+		ofs += n;
+	} while( ofs<len );
+	for( ofs=0; pieces>0; pieces--, ofs+=n )
+	{
+		n = len-ofs < EC2D_CALL_MAX ? len-ofs : EC2D_CALL_MAX;
+		if( !ec2d_recv( d->fd, &op, &status, &arg, rd ? rd+ofs : d->msg,
+						rd ? (int)n : (int)sizeof(d->msg), &got ) ||
+			op!=EC2D_CALL )
+			return FALSE;
+		if( status!=0 || (rd && got!=(int)n) )
+			r = FALSE;
+		if( flash && obj->flash_fail_addr<0 )
+			obj->flash_fail_addr = arg;
+	}
+	return r;
+}
+
+static void remote_read_ram( EC2DRV *obj, char *buf, int start_addr, int len )
+{
+	remote_call( obj, EC2D_CALL_READ_RAM, start_addr, len, 0, buf, 0 );
+}
+
+static void remote_read_ram_sfr( EC2DRV *obj, char *buf, int start_addr,
+								 int len, BOOL sfr )
+{
+	remote_call( obj, EC2D_CALL_READ_RAM, start_addr, len,
+				 sfr ? EC2D_CALLF_SFR : 0, buf, 0 );
+}
+
+static BOOL remote_write_ram( EC2DRV *obj, char *buf, int start_addr, int len )
+{
+	return remote_call( obj, EC2D_CALL_WRITE_RAM, start_addr, len, 0, 0, buf );
+}
+
+static BOOL remote_read_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
+{
+	return remote_call( obj, EC2D_CALL_READ_XDATA, start_addr, len, 0, buf, 0 );
+}
+
+static BOOL remote_write_xdata( EC2DRV *obj, char *buf, int start_addr, int len )
+{
+	return remote_call( obj, EC2D_CALL_WRITE_XDATA, start_addr, len, 0, 0, buf );
+}
+
+static BOOL remote_read_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr,
+							   int len, BOOL scratchpad )
+{
+	return remote_call( obj, EC2D_CALL_READ_FLASH, start_addr, len,
+						scratchpad ? EC2D_CALLF_SCRATCHPAD : 0, (char*)buf, 0 );
+}
+
+static BOOL remote_write_flash( EC2DRV *obj, uint8_t *buf, uint32_t start_addr,
+								int len, BOOL scratchpad )
+{
+	return remote_call( obj, EC2D_CALL_WRITE_FLASH, start_addr, len,
+						scratchpad ? EC2D_CALLF_SCRATCHPAD : 0, 0, (char*)buf );
+}
+
+static BOOL remote_write_flash_block( EC2DRV *obj, uint32_t addr, uint8_t *buf,
+									  uint32_t len, BOOL save, BOOL scratchpad )
+{
+	return remote_call( obj, EC2D_CALL_WRITE_FLASH_BLOCK, addr, len,
+						(save ? EC2D_CALLF_SAVE : 0) |
+						(scratchpad ? EC2D_CALLF_SCRATCHPAD : 0), 0, (char*)buf );
+}
+
+static BOOL remote_erase_flash( EC2DRV *obj )
+{
+	return remote_call( obj, EC2D_CALL_ERASE_FLASH, 0, 0, 0, 0, 0 );
+}
+
+static BOOL remote_erase_flash_sector( EC2DRV *obj, uint32_t sector_addr,
+									   BOOL scratchpad )
+{
+	return remote_call( obj, EC2D_CALL_ERASE_SECTOR, sector_addr, 0,
+						scratchpad ? EC2D_CALLF_SCRATCHPAD : 0, 0, 0 );
+}
+
+static uint16_t remote_read_pc( EC2DRV *obj )
+{
+	uint8_t pc[2] = { 0xff, 0xff };
+	remote_call( obj, EC2D_CALL_READ_PC, 0, 2, 0, (char*)pc, 0 );
+	return get_le( pc, 2 );
+}
+
+/** Have the daemon run the memory and flash operations of the target just
+	connected, in place of the commands they are made of.  Called by
+	ec2_connect(), does nothing for a daemon without EC2D_CAP_CALLS.
+	Everything else, breakpoints, running and stepping, still goes through
+	the transport.
+	\returns TRUE if obj->ops now uses the daemon.
+*/
+BOOL ec2_daemon_remote_ops( EC2DRV *obj )
+{
+	char buf[EC2D_SESSION_LEN];
+	DAEMON *d = (DAEMON*)obj->transport_data;
+	uint8_t op, status;
+	uint32_t arg;
+	int len;
+
+	if( obj->transport!=&ec2_daemon_transport || !d ||
+		!(d->caps & EC2D_CAP_CALLS) )
+		return FALSE;
+	ec2d_put_session( buf, &d->session );
+	if( !ec2d_send( d->fd, EC2D_TARGET, 0, 0, buf, sizeof(buf) ) ||
+		!ec2d_recv( d->fd, &op, &status, &arg, buf, sizeof(buf), &len ) ||
+		op!=EC2D_TARGET || status!=0 )
+		return FALSE;
+	obj->ops.read_ram			= remote_read_ram;
+	obj->ops.read_ram_sfr		= remote_read_ram_sfr;
+	obj->ops.write_ram			= remote_write_ram;
+	obj->ops.read_xdata			= remote_read_xdata;
+	obj->ops.write_xdata		= remote_write_xdata;
+	obj->ops.read_flash			= remote_read_flash;
+	obj->ops.write_flash		= remote_write_flash;
+	if( obj->ops.write_flash_block )
+		obj->ops.write_flash_block = remote_write_flash_block;
+	obj->ops.erase_flash		= remote_erase_flash;
+	obj->ops.erase_flash_sector	= remote_erase_flash_sector;
+	obj->ops.read_pc			= remote_read_pc;
+	return TRUE;
+}
+
+const EC2_TRANSPORT ec2_daemon_transport =
+{
+	"daemon",
+	daemon_open,
+	daemon_close,
+	daemon_write,
+	0,
+	daemon_read,
+	daemon_read_timeout,
+	daemon_flush,
+	daemon_reset,
+	daemon_flush_queue
+};
@@ -0,0 +1,312 @@
+/**	Asynchronous EC3 / ToolStick transport using libusb-1.0.
+
+	The EC3 replies to every command with a single interrupt IN packet.
+	Rather than issuing a blocking read after each write this backend keeps
+	EC3_ASYNC_IN_DEPTH IN transfers submitted at all times.  Completed packets
+	are copied into a small ring in arrival order and the transfer is
+	resubmitted straight away, ec3_async_read() just pops the ring, running the
+	libusb event loop only when nothing has arrived yet.
+	OUT transfers are also submitted without waiting for completion so a batch
+	of queued commands (see ec2_queue_flush()) goes out back to back.
+
+	(C) Ricky White 2006
+*/
+#include "config.h"
+#ifdef HAVE_LIBUSB_1_0
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <libusb-1.0/libusb.h>
+#include "usb_async.h"
+
+struct ec3_async
+{
+	libusb_context			*ctx;
+	libusb_device_handle	*h;
+	uint8_t					out_ep;
+	uint8_t					in_ep;
+	BOOL					debug;
+	BOOL					error;		///< set when a transfer fails
+
+	// IN side
+	struct libusb_transfer	*in_xfer[EC3_ASYNC_IN_DEPTH];
+	uint8_t					in_buf[EC3_ASYNC_IN_DEPTH][EC3_PACKET_SIZE];
+	int						in_active;	///< IN transfers currently submitted
+	uint8_t					ring[EC3_ASYNC_RING][EC3_PACKET_SIZE];
+	int						ring_head;	///< next slot to read
+	int						ring_count;	///< packets waiting
+
+	// OUT side
+	struct libusb_transfer	*out_xfer[EC3_ASYNC_OUT_DEPTH];
+	uint8_t					out_buf[EC3_ASYNC_OUT_DEPTH][EC3_PACKET_SIZE];
+	BOOL					out_busy[EC3_ASYNC_OUT_DEPTH];
+	int						out_next;
+	BOOL					closing;
+};
+
+
+static void LIBUSB_CALL in_complete( struct libusb_transfer *xfer );
+static void LIBUSB_CALL out_complete( struct libusb_transfer *xfer );
+static BOOL run_events( EC3_ASYNC *a, struct timeval *deadline );
+static void print_packet( const char *dir, uint8_t *buf, int len );
+
+
+/** Open the first matching debugger and start the IN transfers.
+	\param info		Adapter type to look for (vendor/product and endpoints)
+	\param serial	Serial number to match, 0 to accept any.
+	\returns		Handle on success, 0 if no device could be opened.
+*/
+EC3_ASYNC *ec3_async_open( DBG_ADAPTER_INFO *info, const char *serial )
+{
+	libusb_device **list;
+	struct libusb_device_descriptor desc;
+	unsigned char s[255];
+	ssize_t cnt, i;
+	int r;
+	EC3_ASYNC *a = calloc( 1, sizeof(EC3_ASYNC) );
+	if( !a )
+		return 0;
+	if( libusb_init( &a->ctx )<0 )
+	{
+		free( a );
+		return 0;
+	}
+	a->out_ep = info->usb_out_endpoint;
+	a->in_ep = info->usb_in_endpoint;
+
+	cnt = libusb_get_device_list( a->ctx, &list );
+	for( i=0; i<cnt && !a->h; i++ )
+	{
+		if( libusb_get_device_descriptor( list[i], &desc )<0 )
+			continue;
+		if( desc.idVendor!=info->usb_vendor_id ||
+			desc.idProduct!=info->usb_product_id )
+			continue;
+		if( libusb_open( list[i], &a->h )<0 )
+			continue;
+		r = libusb_get_string_descriptor_ascii( a->h, desc.iSerialNumber,
+												s, sizeof(s) );
+		if( r<0 || (serial && strcmp( (char*)s, serial )!=0) )
+		{
+			libusb_close( a->h );
+			a->h = 0;
+		}
+	}
+	libusb_free_device_list( list, 1 );
+	if( !a->h )
+	{
+		libusb_exit( a->ctx );
+		free( a );
+		return 0;
+	}
+
+	// on linux "usbhid" claims the device.
+	if( libusb_kernel_driver_active( a->h, 0 )==1 )
+		libusb_detach_kernel_driver( a->h, 0 );
+	if( libusb_set_configuration( a->h, 1 )<0 ||
+		libusb_claim_interface( a->h, 0 )<0 )
+	{
+		fprintf( stderr, "ec2drv: unable to claim EC3 interface\n" );
+		libusb_close( a->h );
+		libusb_exit( a->ctx );
+		free( a );
+		return 0;
+	}
+
+	for( i=0; i<EC3_ASYNC_OUT_DEPTH; i++ )
+		a->out_xfer[i] = libusb_alloc_transfer(0);
+	for( i=0; i<EC3_ASYNC_IN_DEPTH; i++ )
+	{
+		a->in_xfer[i] = libusb_alloc_transfer(0);
+		libusb_fill_interrupt_transfer( a->in_xfer[i], a->h, a->in_ep,
+										a->in_buf[i], EC3_PACKET_SIZE,
+										in_complete, a, 0 );
+		if( libusb_submit_transfer( a->in_xfer[i] )==0 )
+			a->in_active++;
+	}
+	return a;
+}
+
+
+/** Cancel outstanding transfers and release the device.
+	\param a		Handle from ec3_async_open()
+	\param reset	TRUE to issue a USB reset before closing
+*/
+void ec3_async_close( EC3_ASYNC *a, BOOL reset )
+{
+	int i;
+	struct timeval tv = { 0, 100000 };
+	if( !a )
+		return;
+	a->closing = TRUE;
+	for( i=0; i<EC3_ASYNC_IN_DEPTH; i++ )
+		libusb_cancel_transfer( a->in_xfer[i] );
+	while( a->in_active>0 )
+	{
+		if( libusb_handle_events_timeout( a->ctx, &tv )<0 )
+			break;
+	}
+	for( i=0; i<EC3_ASYNC_OUT_DEPTH; i++ )
+	{
+		if( a->out_busy[i] )
+			libusb_cancel_transfer( a->out_xfer[i] );
+	}
+	for( i=0; i<EC3_ASYNC_OUT_DEPTH; i++ )
+	{
+		while( a->out_busy[i] )
+		{
+			if( libusb_handle_events_timeout( a->ctx, &tv )<0 )
+				break;
+		}
+	}
+	for( i=0; i<EC3_ASYNC_IN_DEPTH; i++ )
+		libusb_free_transfer( a->in_xfer[i] );
+	for( i=0; i<EC3_ASYNC_OUT_DEPTH; i++ )
+		libusb_free_transfer( a->out_xfer[i] );
+	libusb_release_interface( a->h, 0 );
+	if( reset )
+		libusb_reset_device( a->h );
+	libusb_close( a->h );
+	libusb_exit( a->ctx );
+	free( a );
+}
+
+
+/** Submit a command to the debugger, adding the length byte.
+	Returns as soon as the transfer is submitted, only waiting when every OUT
+	slot is still busy.
+	\returns TRUE on success, FALSE if the submit failed.
+*/
+BOOL ec3_async_write( EC3_ASYNC *a, char *buf, int len )
+{
+	struct timeval deadline;
+	int slot = a->out_next;
+
+	if( len>EC3_PACKET_SIZE-1 )
+		return FALSE;
+	// a failure belongs to the exchange it happened in, a reply lost then
+	// still shows up as that exchange's read timing out
+	a->error = FALSE;
+	gettimeofday( &deadline, 0 );
+	deadline.tv_sec += 1;			// same 1s timeout as the sync path
+	while( a->out_busy[slot] )
+	{
+		if( !run_events( a, &deadline ) )
+			return FALSE;
+	}
+	a->out_buf[slot][0] = len;
+	memcpy( &a->out_buf[slot][1], buf, len );
+	if( a->debug )
+		print_packet( "TX", a->out_buf[slot], len+1 );
+	libusb_fill_interrupt_transfer( a->out_xfer[slot], a->h, a->out_ep,
+									a->out_buf[slot], len+1,
+									out_complete, &a->out_busy[slot], 1000 );
+	a->out_busy[slot] = TRUE;
+	if( libusb_submit_transfer( a->out_xfer[slot] )<0 )
+	{
+		a->out_busy[slot] = FALSE;
+		return FALSE;
+	}
+	a->out_next = (slot+1) % EC3_ASYNC_OUT_DEPTH;
+	return TRUE;
+}
+
+
+/** Collect the next reply, stripping off the length byte.
+	\param a	Handle from ec3_async_open()
+	\param buf	Buffer to receive the data
+	\param len	Number of bytes the caller wants in buf
+	\param ms	Timeout in milliseconds
+	\returns	TRUE on success, FALSE on timeout or transfer error.
+*/
+BOOL ec3_async_read( EC3_ASYNC *a, char *buf, int len, uint32_t ms )
+{
+	struct timeval deadline;
+
+	if( len>EC3_PACKET_SIZE-1 )
+		len = EC3_PACKET_SIZE-1;
+	gettimeofday( &deadline, 0 );
+	deadline.tv_sec += ms / 1000;
+	deadline.tv_usec += (ms % 1000) * 1000;
+	if( deadline.tv_usec>=1000000 )
+	{
+		deadline.tv_sec++;
+		deadline.tv_usec -= 1000000;
+	}
+	while( a->ring_count==0 )
+	{
+		if( a->error || !run_events( a, &deadline ) )
+			return FALSE;
+	}
+	if( a->debug )
+		print_packet( "RX", a->ring[a->ring_head], len+1 );
+	memcpy( buf, &a->ring[a->ring_head][1], len );
+	a->ring_head = (a->ring_head+1) % EC3_ASYNC_RING;
+	a->ring_count--;
+	return TRUE;
+}
+
+
+void ec3_async_set_debug( EC3_ASYNC *a, BOOL debug )
+{
+	a->debug = debug;
+}
+
+
+/** Run the libusb event loop once, bounded by deadline.
+	\returns FALSE if the deadline has passed or event handling failed.
+*/
+static BOOL run_events( EC3_ASYNC *a, struct timeval *deadline )
+{
+	struct timeval now, tv;
+	gettimeofday( &now, 0 );
+	if( !timercmp( &now, deadline, < ) )
+		return FALSE;
+	timersub( deadline, &now, &tv );
+	return libusb_handle_events_timeout( a->ctx, &tv )==0;
+}
+
+
+static void LIBUSB_CALL in_complete( struct libusb_transfer *xfer )
+{
+	EC3_ASYNC *a = (EC3_ASYNC*)xfer->user_data;
+	int tail;
+
+	if( xfer->status==LIBUSB_TRANSFER_COMPLETED )
+	{
+		if( a->ring_count<EC3_ASYNC_RING )
+		{
+			tail = (a->ring_head+a->ring_count) % EC3_ASYNC_RING;
+			memcpy( a->ring[tail], xfer->buffer, xfer->actual_length );
+			a->ring_count++;
+		}
+		else
+			a->error = TRUE;	// nobody is reading the replies
+	}
+	else if( xfer->status!=LIBUSB_TRANSFER_CANCELLED &&
+			 xfer->status!=LIBUSB_TRANSFER_TIMED_OUT )
+		a->error = TRUE;
+
+	if( !a->closing && libusb_submit_transfer( xfer )==0 )
+		return;
+	a->in_active--;
+}
+
+
+static void LIBUSB_CALL out_complete( struct libusb_transfer *xfer )
+{
+	*(BOOL*)xfer->user_data = FALSE;
+}
+
+
+static void print_packet( const char *dir, uint8_t *buf, int len )
+{
+	int i;
+	printf( "%s: ", dir );
+	for( i=0; i<len; i++ )
+		printf( "%02x ", buf[i] );
+	printf( "\n" );
+}
+
+#endif // HAVE_LIBUSB_1_0
@@ -0,0 +1,26 @@
+/**	Asynchronous EC3 / ToolStick transport using libusb-1.0.
+	Keeps several interrupt IN transfers submitted at all times so the
+	endpoint is never idle between commands.  Only built when configure found
+	libusb-1.0, otherwise the libusb-0.1 synchronous path in ec2drv.c is used.
+
+	(C) Ricky White 2006
+*/
+#ifndef USB_ASYNC_H
+#define USB_ASYNC_H
+#include <stdint.h>
+#include "ec2types.h"
+
+#define EC3_ASYNC_IN_DEPTH	4		///< IN transfers kept submitted
+#define EC3_ASYNC_OUT_DEPTH	8		///< OUT transfers that may be in flight
+#define EC3_ASYNC_RING		16		///< completed IN packets waiting to be read
+#define EC3_PACKET_SIZE		64
+
+typedef struct ec3_async EC3_ASYNC;
+
+EC3_ASYNC *ec3_async_open( DBG_ADAPTER_INFO *info, const char *serial );
+void ec3_async_close( EC3_ASYNC *a, BOOL reset );
+BOOL ec3_async_write( EC3_ASYNC *a, char *buf, int len );
+BOOL ec3_async_read( EC3_ASYNC *a, char *buf, int len, uint32_t ms );
+void ec3_async_set_debug( EC3_ASYNC *a, BOOL debug );
+
+#endif
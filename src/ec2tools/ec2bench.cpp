@@ -0,0 +1,502 @@
+/** ec2bench utility
+  * Measures the throughput and latency of the ec2drv operations against a
+  * connected adapter and target, for tracking driver performance.
+  *
+  *   Copyright (C) 2006 by Ricky White
+  *   rickyw@neatstuff.co.nz
+  *
+  *   This program is free software; you can redistribute it and/or modify
+  *   it under the terms of the GNU General Public License as published by
+  *   the Free Software Foundation; either version 2 of the License, or
+  *   (at your option) any later version.
+  *
+  *   This program is distributed in the hope that it will be useful,
+  *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+  *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  *   GNU General Public License for more details.
+  *
+  *   You should have received a copy of the GNU General Public License
+  *   along with this program; if not, write to the
+  *   Free Software Foundation, Inc.,
+  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <iostream>
+#include <string>
+#include <signal.h>
+#include <getopt.h>
+
+#include "ec2drv.h"
+
+using namespace std;
+
+void help()
+{
+	cout <<"ec2bench\n"
+		<<"options:\n"
+		<<"\t--port		Specify the device/port the debug adatper is connected to (USB for EC3)\n"
+		<<"\t--mode		auto / jtag / c2 with auto being the default\n"
+		<<"\t--count		Number of calls per test, default 100\n"
+		<<"\t--len		Bytes per call for the memory tests, default 256\n"
+		<<"\t--addr		CODE address used by the flash tests, default 0\n"
+		<<"\t--tests		Comma separated list of tests to run, default all except\n"
+		<<"\t		flash_write and the erase tests.  Tests: flash_read\n"
+		<<"\t		flash_write erase_sector erase_chip ram_read xdata_read\n"
+		<<"\t		xdata_write sfr_read step halt_go\n"
+		<<"\t--csv		Machine readable output, one line per test\n"
+		<<"\t--debug		Enable debugging trace\n"
+		<<"\n"
+		<<"flash_write and xdata_write write back the data that was there,\n"
+		<<"erase_sector and erase_chip restore the flash after erasing it,\n"
+		<<"erase_chip makes a single call whatever --count is.  When they run\n"
+		<<"the erase costs to pass to ec2_set_erase_costs() are printed.\n"
+		<<"step and halt_go run the program on the target.\n"
+		<< endl;
+}
+
+
+static EC2DRV obj;
+static void (*old_sigint_handler)(int);
+extern "C" void exit_func(void)
+{
+	ec2_disconnect(&obj);
+	signal(SIGINT,old_sigint_handler);
+}
+
+
+static uint64_t now_usec()
+{
+	struct timeval tv;
+	gettimeofday( &tv, 0 );
+	return (uint64_t)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+
+/** Timing of one test.
+*/
+typedef struct
+{
+	string		name;
+	int			calls;
+	uint32_t	bytes;			///< bytes moved per call, 0 for control operations
+	uint64_t	total_usec;
+	uint32_t	min_usec;
+	uint32_t	max_usec;
+	uint32_t	round_trips;	///< adapter round trips for all the calls
+	bool		ok;				///< every call succeeded
+} RESULT;
+
+static int		count = 100;
+static int		len = 256;
+static uint32_t	flash_addr = 0;
+static uint8_t	buf[0x10000];
+static uint8_t	saved[0x10000];
+static EC2_ERASE_COSTS	costs;		///< driver defaults updated by the tests run
+
+static void begin( RESULT &r, const char *name, uint32_t bytes )
+{
+	r.name = name;
+	r.calls = 0;
+	r.bytes = bytes;
+	r.total_usec = 0;
+	r.min_usec = 0xffffffff;
+	r.max_usec = 0;
+	r.ok = true;
+	ec2_reset_stats( &obj );
+}
+
+/** Account for one call that started at start.
+*/
+static void timed( RESULT &r, uint64_t start, bool ok )
+{
+	uint32_t usec = now_usec() - start;
+	r.calls++;
+	r.total_usec += usec;
+	if( usec<r.min_usec )
+		r.min_usec = usec;
+	if( usec>r.max_usec )
+		r.max_usec = usec;
+	r.ok &= ok;
+}
+
+static void end( RESULT &r )
+{
+	EC2_STATS stats;
+	ec2_get_stats( &obj, &stats );
+	r.round_trips = stats.round_trips;
+	if( r.calls==0 )
+		r.min_usec = 0;
+}
+
+
+static void bench_flash_read( RESULT &r )
+{
+	begin( r, "flash_read", len );
+	for( int i=0; i<count; i++ )
+	{
+		uint64_t t = now_usec();
+		bool ok = ec2_read_flash( &obj, buf, flash_addr, len );
+		timed( r, t, ok );
+	}
+	end( r );
+	if( r.ok && r.calls )
+		costs.read_us_per_kb = r.total_usec * 1024 / ((uint64_t)r.calls * len);
+}
+
+static void bench_flash_write( RESULT &r )
+{
+	// write back what is already there so the target is left as it was
+	ec2_read_flash( &obj, saved, flash_addr, len );
+	begin( r, "flash_write", len );
+	for( int i=0; i<count; i++ )
+	{
+		uint64_t t = now_usec();
+		bool ok = ec2_write_flash_auto_keep( &obj, saved, flash_addr, len );
+		timed( r, t, ok );
+	}
+	end( r );
+}
+
+static bool blank( const uint8_t *p, uint32_t n )
+{
+	while( n-- )
+	{
+		if( *p++!=0xff )
+			return false;
+	}
+	return true;
+}
+
+/** One call is a sector erase, the sector at --addr is written back after
+	each untimed, which also gives the programming rate.
+*/
+static void bench_erase_sector( RESULT &r )
+{
+	uint32_t ss = obj.dev->flash_sector_size;
+	uint32_t sec = flash_addr - flash_addr % ss;
+	uint64_t write_usec = 0;
+	int writes = 0;
+	bool ok = ec2_read_flash( &obj, saved, sec, ss );
+	begin( r, "erase_sector", 0 );
+	for( int i=0; i<count && ok; i++ )
+	{
+		uint64_t t = now_usec();
+		ec2_erase_flash_sector( &obj, sec );
+		timed( r, t, true );
+		if( !blank( saved, ss ) )
+		{
+			t = now_usec();
+			ok = ec2_write_flash( &obj, saved, sec, ss );
+			write_usec += now_usec() - t;
+			writes++;
+		}
+	}
+	r.ok = ok;
+	end( r );
+	if( r.ok && r.calls )
+		costs.sector_erase_us = r.total_usec / r.calls;
+	if( ok && writes )
+		costs.write_us_per_kb = write_usec * 1024 / ((uint64_t)writes * ss);
+}
+
+/** A single full chip erase, all usable sectors are saved first and the
+	ones that weren't blank written back afterwards.
+*/
+static void bench_erase_chip( RESULT &r )
+{
+	uint32_t ss = obj.dev->flash_sector_size;
+	uint32_t top = obj.dev->flash_reserved_bottom>0 ?
+				   obj.dev->flash_reserved_bottom : obj.dev->flash_size;
+	uint32_t a;
+	uint8_t *all = (uint8_t*)malloc( top );
+	bool ok = all!=0 && flash_lock_byte( &obj )==0xff;
+	for( a=0; a<top && ok; a+=ss )
+		ok = ec2_read_flash( &obj, all+a, a, top-a<ss ? top-a : ss );
+	begin( r, "erase_chip", 0 );
+	if( ok )
+	{
+		uint64_t t = now_usec();
+		ec2_erase_flash( &obj );
+		timed( r, t, true );
+		for( a=0; a<top && ok; a+=ss )
+		{
+			uint32_t n = top-a<ss ? top-a : ss;
+			if( !blank( all+a, n ) )
+				ok = ec2_write_flash( &obj, all+a, a, n );
+		}
+	}
+	r.ok = ok;
+	end( r );
+	if( r.ok && r.calls )
+		costs.chip_erase_us = r.total_usec;
+	free( all );
+}
+
+static void bench_ram_read( RESULT &r )
+{
+	int n = len>0x100 ? 0x100 : len;
+	begin( r, "ram_read", n );
+	for( int i=0; i<count; i++ )
+	{
+		uint64_t t = now_usec();
+		ec2_read_ram( &obj, (char*)buf, 0, n );
+		timed( r, t, true );
+	}
+	end( r );
+}
+
+static int xdata_len()
+{
+	int n = obj.dev->internal_xram_size;
+	return len<n ? len : n;
+}
+
+static void bench_xdata_read( RESULT &r )
+{
+	int n = xdata_len();
+	begin( r, "xdata_read", n );
+	for( int i=0; i<count; i++ )
+	{
+		uint64_t t = now_usec();
+		ec2_read_xdata( &obj, (char*)buf, 0, n );
+		timed( r, t, true );
+	}
+	end( r );
+}
+
+static void bench_xdata_write( RESULT &r )
+{
+	int n = xdata_len();
+	ec2_read_xdata( &obj, (char*)saved, 0, n );
+	begin( r, "xdata_write", n );
+	for( int i=0; i<count; i++ )
+	{
+		uint64_t t = now_usec();
+		bool ok = ec2_write_xdata( &obj, (char*)saved, 0, n );
+		timed( r, t, ok );
+	}
+	end( r );
+}
+
+static void bench_sfr_read( RESULT &r )
+{
+	char v;
+	begin( r, "sfr_read", 1 );
+	for( int i=0; i<count; i++ )
+	{
+		uint64_t t = now_usec();
+		ec2_read_sfr( &obj, &v, 0x81 );		// SP
+		timed( r, t, true );
+	}
+	end( r );
+}
+
+static void bench_step( RESULT &r )
+{
+	uint16_t pc = ec2_read_pc( &obj );
+	begin( r, "step", 0 );
+	for( int i=0; i<count; i++ )
+	{
+		uint64_t t = now_usec();
+		ec2_step( &obj );
+		timed( r, t, true );
+	}
+	end( r );
+	ec2_set_pc( &obj, pc );
+}
+
+/** One call is a go followed by a halt.
+*/
+static void bench_halt_go( RESULT &r )
+{
+	uint16_t pc = ec2_read_pc( &obj );
+	begin( r, "halt_go", 0 );
+	for( int i=0; i<count; i++ )
+	{
+		uint64_t t = now_usec();
+		bool ok = ec2_target_go( &obj );
+		ok &= ec2_target_halt( &obj );
+		timed( r, t, ok );
+	}
+	end( r );
+	ec2_set_pc( &obj, pc );
+}
+
+
+typedef struct
+{
+	const char	*name;
+	void		(*fn)( RESULT &r );
+	bool		by_default;
+} TEST;
+
+static const TEST tests[] =
+{
+	{ "flash_read",		bench_flash_read,	true },
+	{ "flash_write",	bench_flash_write,	false },
+	{ "erase_sector",	bench_erase_sector,	false },
+	{ "erase_chip",		bench_erase_chip,	false },
+	{ "ram_read",		bench_ram_read,		true },
+	{ "xdata_read",		bench_xdata_read,	true },
+	{ "xdata_write",	bench_xdata_write,	true },
+	{ "sfr_read",		bench_sfr_read,		true },
+	{ "step",			bench_step,			true },
+	{ "halt_go",		bench_halt_go,		true },
+	{ 0, 0, false }
+};
+
+static bool selected( const TEST &t, const string &list )
+{
+	if( list.empty() )
+		return t.by_default;
+	string padded = "," + list + ",";
+	return padded.find( string(",") + t.name + "," )!=string::npos;
+}
+
+
+static void print_result( const RESULT &r, bool csv )
+{
+	double avg = r.calls ? (double)r.total_usec / r.calls : 0;
+	double bps = r.total_usec ? (double)r.bytes * r.calls * 1e6 / r.total_usec : 0;
+	if( csv )
+	{
+		printf( "%u.%u,%s,0x%02x,%s,%s,%s,%d,%u,%llu,%.1f,%u,%u,%.0f,%u,%s\n",
+				ec2drv_version()>>8, ec2drv_version()&0xff,
+				obj.dbg_info->name, obj.fw_ver,
+				obj.mode==C2 ? "C2" : "JTAG", obj.dev->name,
+				r.name.c_str(), r.calls, r.bytes,
+				(unsigned long long)r.total_usec, avg, r.min_usec, r.max_usec,
+				bps, r.round_trips, r.ok ? "ok" : "fail" );
+	}
+	else
+	{
+		printf( "%-12s %6d %6u %10.1f %10u %10u %12.0f %8u  %s\n",
+				r.name.c_str(), r.calls, r.bytes, avg, r.min_usec, r.max_usec,
+				bps, r.round_trips, r.ok ? "" : "FAILED" );
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	string port, test_list;
+
+	static int debug=0, csv=0, help_flag;
+	static struct option long_options[] =
+	{
+		{"debug", no_argument, &debug, 1},
+		{"csv", no_argument, &csv, 1},
+		{"help", no_argument, &help_flag, 'h'},
+		{"mode", required_argument, 0, 'm'},
+		{"port", required_argument, 0, 'p'},
+		{"count", required_argument, 0, 'c'},
+		{"len", required_argument, 0, 'l'},
+		{"addr", required_argument, 0, 'a'},
+		{"tests", required_argument, 0, 't'},
+		{0, 0, 0, 0}
+	};
+	int option_index = 0;
+	int c;
+
+	old_sigint_handler = signal(SIGINT,exit);
+	atexit(exit_func);
+
+	obj.mode = AUTO;	// default to auto device selection
+	obj.debug = FALSE;
+	while(1)
+	{
+		c = getopt_long (argc, argv, "", long_options, &option_index);
+		if( c==-1)
+			break;
+		switch(c)
+		{
+			case 0:		// set a flag, nothing to do
+				break;
+			case 'p':	// port
+				port = optarg;
+				break;
+			case 'm':	// mode to use, JTAG / C2 / AUTO
+				if( strcasecmp( optarg, "AUTO" )==0 )
+					obj.mode = AUTO;
+				else if( strcasecmp( optarg, "JTAG" )==0 )
+					obj.mode = JTAG;
+				else if( strcasecmp( optarg, "C2" )==0 )
+					obj.mode = C2;
+				else
+				{
+					printf("Error: unsupported mode, supported modes are AUTO / JTAG/ C2.\n");
+					exit(-1);
+				}
+				break;
+			case 'c':
+				count = strtoul( optarg, 0, 0 );
+				break;
+			case 'l':
+				len = strtoul( optarg, 0, 0 );
+				if( len<1 || len>(int)sizeof(buf) )
+				{
+					printf("Error: --len must be between 1 and %u\n",
+						   (unsigned)sizeof(buf) );
+					exit(-1);
+				}
+				break;
+			case 'a':
+				flash_addr = strtoul( optarg, 0, 0 );
+				break;
+			case 't':
+				test_list = optarg;
+				break;
+			default:
+				printf("unexpected option\n");
+				break;
+		}
+	};
+	if( help_flag || port.length()==0 )
+	{
+		help();
+		return  help_flag ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	obj.debug = debug;
+	if( !ec2_connect( &obj, port.c_str() ) )
+	{
+		printf("ERROR: coulden't communicate with the EC2 debug adaptor\n");
+		exit(-1);
+	}
+	ec2_target_halt( &obj );
+	ec2_get_erase_costs( &obj, &costs );
+
+	if( csv )
+		printf("driver,adapter,firmware,mode,device,test,calls,bytes,total_us,"
+			   "avg_us,min_us,max_us,bytes_per_sec,round_trips,result\n");
+	else
+	{
+		printf("\n%s firmware 0x%02x, %s mode, %s, ec2drv %u.%u\n\n",
+			   obj.dbg_info->name, obj.fw_ver, obj.mode==C2 ? "C2" : "JTAG",
+			   obj.dev->name, ec2drv_version()>>8, ec2drv_version()&0xff );
+		printf("%-12s %6s %6s %10s %10s %10s %12s %8s\n",
+			   "test", "calls", "bytes", "avg us", "min us", "max us",
+			   "bytes/s", "trips");
+	}
+	bool erase_tests = false;
+	for( int i=0; tests[i].name; i++ )
+	{
+		if( selected( tests[i], test_list ) )
+		{
+			RESULT r;
+			tests[i].fn( r );
+			print_result( r, csv );
+			erase_tests |= strncmp( tests[i].name, "erase_", 6 )==0;
+		}
+	}
+	if( erase_tests && !csv )
+	{
+		printf("\nerase costs: sector %u us, chip %u us, read %u us/KB, "
+			   "write %u us/KB\n", costs.sector_erase_us, costs.chip_erase_us,
+			   costs.read_us_per_kb, costs.write_us_per_kb );
+	}
+	exit(0);
+}
@@ -0,0 +1,698 @@
+/** ec2d, adapter pool daemon
+  *
+  * Keeps EC2/EC3 adapters open and their targets connected between tool
+  * runs.  Tools reach it with the port "EC2D" or "EC2D:<adapter port>", the
+  * daemon transport in ec2drv forwards every transfer over a Unix socket so
+  * a tool starts in the time it takes to check the device id rather than
+  * that of finding, opening and connecting to the adapter.
+  *
+  * One client at a time has an adapter, others asking for it wait.  A client
+  * that goes without saying EC2D_KEEP, eg because it crashed, leaves the
+  * adapter in an unknown state so it is closed and reopened.
+  *
+  * With --listen the daemon is also reached over TCP, for adapters on a lab
+  * host debugged from elsewhere.  Command queues (EC2D_BATCH) and memory and
+  * flash operations (EC2D_CALL) are then run here, next to the adapter, so a
+  * remote client waits for the network once per operation rather than once
+  * per adapter command.  There is no authentication, listen on a trusted
+  * network or tunnel the port over ssh.
+  *
+  *   Copyright (C) 2006 by Ricky White
+  *   rickyw@neatstuff.co.nz
+  *
+  *   This program is free software; you can redistribute it and/or modify
+  *   it under the terms of the GNU General Public License as published by
+  *   the Free Software Foundation; either version 2 of the License, or
+  *   (at your option) any later version.
+  *
+  *   This program is distributed in the hope that it will be useful,
+  *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+  *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  *   GNU General Public License for more details.
+  *
+  *   You should have received a copy of the GNU General Public License
+  *   along with this program; if not, write to the
+  *   Free Software Foundation, Inc.,
+  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "ec2drv.h"
+
+#define MAX_ADAPTERS	16
+#define MAX_CLIENTS		32
+#define MAX_DATA		0xffff		///< largest message data, uint16 length
+
+typedef struct
+{
+	const char		*port;		///< as given with --port
+	EC2DRV			obj;
+	BOOL			open;
+	int				owner;		///< index of the client using it, -1 if free
+	EC2D_SESSION	session;	///< left by the last client
+} ADAPTER;
+
+typedef struct
+{
+	int			fd;			///< -1 for a free slot
+	ADAPTER		*adapter;	///< the one it has, 0 if none
+	BOOL		waiting;	///< sent EC2D_OPEN, its adapter is busy
+	uint32_t	seq;		///< waiting clients are served in arrival order
+	char		want[256];	///< port asked for, "" for any
+} CLIENT;
+
+static ADAPTER adapters[MAX_ADAPTERS];
+static int num_adapters = 0;
+static CLIENT clients[MAX_CLIENTS];
+static uint32_t next_seq = 0;
+static int debug = 0;
+static int help_flag = 0;
+static volatile sig_atomic_t stop = 0;
+static char data[MAX_DATA];
+static char reply[MAX_DATA];
+
+void help()
+{
+	printf("ec2d\n"
+		   "Keeps debug adapters open for the other tools, use the port EC2D\n"
+		   "or EC2D:<adapter port> with them to reach an adapter.\n"
+		   "syntax:\n"
+		   "\tec2d --port=USB\n"
+		   "\n"
+		   "Options:\n"
+		   "\t--port <port>         Adapter to hold, may be given more than\n"
+		   "\t                      once, USB by default\n"
+		   "\t--socket <path>       Socket to listen on, default $EC2D_SOCKET\n"
+		   "\t                      or "EC2D_SOCKET"\n"
+		   "\t--listen [<host>:]<tcp port>\n"
+		   "\t                      Also listen for clients on another machine,\n"
+		   "\t                      they set EC2D_SOCKET=<this host>:<tcp port>.\n"
+		   "\t                      The host defaults to localhost, eg for an\n"
+		   "\t                      ssh tunnel, there is no authentication\n"
+		   "\t--debug               Turn on debug tracing\n"
+		   "\t--help                Display this help\n"
+		   "\n");
+}
+
+static void on_signal( int sig )
+{
+	stop = 1;
+}
+
+
+static BOOL adapter_open( ADAPTER *a )
+{
+	if( a->open )
+		return TRUE;
+	memset( &a->obj, 0, sizeof(a->obj) );
+	memset( &a->session, 0, sizeof(a->session) );
+	a->obj.debug = debug;
+	a->open = ec2_open_adapter( &a->obj, a->port );
+	if( !a->open )
+	{
+		printf("%s: Unable to open the adapter\n", a->port );
+		return FALSE;
+	}
+	a->session.adaptor = a->obj.dbg_adaptor==EC3;
+	a->session.usb_vendor_id = a->obj.dbg_info->usb_vendor_id;
+	a->session.usb_product_id = a->obj.dbg_info->usb_product_id;
+	printf("%s: %s ready\n", a->port, a->obj.dbg_info->name );
+	return TRUE;
+}
+
+static void adapter_close( ADAPTER *a )
+{
+	if( !a->open )
+		return;
+	ec2_close_adapter( &a->obj );
+	a->open = FALSE;
+}
+
+/** true if a is the adapter a client asked for with want.
+	"USB:<serial>" also answers to just the serial number.
+*/
+static BOOL adapter_matches( const ADAPTER *a, const char *want )
+{
+	if( !*want || strcmp( a->port, want )==0 )
+		return TRUE;
+	return strncmp( a->port, "USB:", 4 )==0 && strcmp( a->port+4, want )==0;
+}
+
+static void client_close( CLIENT *c )
+{
+	close( c->fd );
+	c->fd = -1;
+	c->adapter = 0;
+	c->waiting = FALSE;
+}
+
+/** Give a client its adapter, replying to the EC2D_OPEN with the session.
+*/
+static void grant( CLIENT *c, ADAPTER *a )
+{
+	char buf[EC2D_SESSION_LEN];
+	c->waiting = FALSE;
+	if( !adapter_open( a ) )
+	{
+		snprintf( reply, sizeof(reply), "Unable to open %s", a->port );
+		ec2d_send( c->fd, EC2D_OPEN, 1, 0, reply, strlen(reply) );
+		return;
+	}
+	if( debug )
+		printf("client %i has %s\n", (int)(c-clients), a->port );
+	a->owner = c-clients;
+	c->adapter = a;
+	ec2d_put_session( buf, &a->session );
+	// kept again only if the client says so
+	a->session.connected = 0;
+	if( !ec2d_send( c->fd, EC2D_OPEN, 0, EC2D_CAP_CALLS, buf, sizeof(buf) ) )
+	{
+		a->owner = -1;
+		client_close( c );
+	}
+}
+
+/** Serve waiting clients, oldest first, that can now have an adapter.
+*/
+static void dispatch()
+{
+	for(;;)
+	{
+		CLIENT *c = 0;
+		ADAPTER *free_a = 0;
+		BOOL any = FALSE;
+		int i;
+		for( i=0; i<MAX_CLIENTS; i++ )
+		{
+			CLIENT *w = &clients[i];
+			if( w->fd<0 || !w->waiting )
+				continue;
+			if( !c || (int32_t)(w->seq - c->seq)<0 )
+			{
+				// the oldest that isn't stuck behind a busy adapter
+				int j;
+				ADAPTER *f = 0;
+				BOOL m = FALSE;
+				for( j=0; j<num_adapters && !f; j++ )
+				{
+					if( adapter_matches( &adapters[j], w->want ) )
+					{
+						m = TRUE;
+						if( adapters[j].owner==-1 )
+							f = &adapters[j];
+					}
+				}
+				if( f || !m )
+				{
+					c = w;
+					free_a = f;
+					any = m;
+				}
+			}
+		}
+		if( !c )
+			return;
+		if( !any )
+		{
+			snprintf( reply, sizeof(reply), "No adapter %s in the pool",
+					  c->want );
+			ec2d_send( c->fd, EC2D_OPEN, 1, 0, reply, strlen(reply) );
+			c->waiting = FALSE;
+		}
+		else
+			grant( c, free_a );
+	}
+}
+
+/** A client has gone, free its adapter for the next one.
+*/
+static void client_gone( CLIENT *c )
+{
+	ADAPTER *a = c->adapter;
+	client_close( c );
+	if( a )
+	{
+		a->owner = -1;
+		if( !a->session.connected )
+		{
+			// left without EC2D_KEEP, start again from an adapter reset
+			if( debug )
+				printf("%s: not kept, resetting the adapter\n", a->port );
+			adapter_close( a );
+		}
+		dispatch();
+	}
+}
+
+static uint32_t get_u32( const char *p )
+{
+	const uint8_t *b = (const uint8_t*)p;
+	return b[0] | b[1]<<8 | b[2]<<16 | (uint32_t)b[3]<<24;
+}
+
+/** Run an EC2D_BATCH of queued commands on the adapter, replying with how
+	many replies came back and the replies.
+*/
+static void client_batch( CLIENT *c, int len )
+{
+	EC2DRV *obj = &c->adapter->obj;
+	int pos = 0, got = 0, cnt = 0, rlen = 0, txlen, rxlen;
+	BOOL ok = TRUE;
+
+	obj->queue_len = 0;
+	while( ok && pos+3<=len )
+	{
+		txlen = (uint8_t)data[pos];
+		rxlen = (uint8_t)data[pos+1] | (uint8_t)data[pos+2]<<8;
+		if( pos+3+txlen>len || txlen>EC2_QUEUE_TX_MAX ||
+			rlen+rxlen>(int)sizeof(reply) )
+			break;
+		ec2_queue_cmd( obj, data+pos+3, txlen, reply+rlen, rxlen );
+		pos += 3+txlen;
+		rlen += rxlen;
+		if( ++cnt==EC2_QUEUE_DEPTH || pos+3>len )
+		{
+			ok = ec2_queue_flush( obj );
+			got += ok ? cnt : obj->queue_failed;
+			cnt = 0;
+		}
+	}
+	if( cnt )
+		ec2_queue_flush( obj );		// malformed, drop what was queued
+	if( !ec2d_send( c->fd, EC2D_BATCH, 0, got, reply, rlen ) )
+		client_gone( c );
+}
+
+/** Run an EC2D_CALL on the adapter, which EC2D_TARGET has set up.
+*/
+static void client_call( CLIENT *c, uint32_t call, int len )
+{
+	EC2DRV *obj = &c->adapter->obj;
+	char *wr = data+EC2D_CALL_HEADER_LEN;
+	uint32_t addr = 0, n = 0;
+	uint8_t flags = 0;
+	BOOL ok = FALSE, sp = FALSE;
+	int rlen = 0;
+	uint16_t pc;
+
+	if( len>=EC2D_CALL_HEADER_LEN && obj->connected )
+	{
+		addr = get_u32( data );
+		n = get_u32( data+4 );
+		flags = data[8];
+		sp = (flags & EC2D_CALLF_SCRATCHPAD)!=0;
+		ok = n<=EC2D_CALL_MAX;
+	}
+	if( ok )
+	{
+		// writes carry their data, reads fill the reply
+		switch( call )
+		{
+			case EC2D_CALL_WRITE_RAM:
+			case EC2D_CALL_WRITE_XDATA:
+			case EC2D_CALL_WRITE_FLASH:
+			case EC2D_CALL_WRITE_FLASH_BLOCK:
+				ok = len==EC2D_CALL_HEADER_LEN+(int)n;
+				break;
+			default:
+				rlen = n;
+		}
+	}
+	if( ok )
+	{
+		if( debug )
+			printf("call %u 0x%05x %u\n", call, addr, n );
+		switch( call )
+		{
+			case EC2D_CALL_READ_RAM:
+				if( flags & EC2D_CALLF_SFR )
+					obj->ops.read_ram_sfr( obj, reply, addr, n, TRUE );
+				else
+					obj->ops.read_ram( obj, reply, addr, n );
+				break;
+			case EC2D_CALL_WRITE_RAM:
+				ok = obj->ops.write_ram( obj, wr, addr, n );
+				break;
+			case EC2D_CALL_READ_XDATA:
+				ok = obj->ops.read_xdata( obj, reply, addr, n );
+				break;
+			case EC2D_CALL_WRITE_XDATA:
+				ok = obj->ops.write_xdata( obj, wr, addr, n );
+				break;
+			case EC2D_CALL_READ_FLASH:
+				ok = obj->ops.read_flash( obj, (uint8_t*)reply, addr, n, sp );
+				break;
+			case EC2D_CALL_WRITE_FLASH:
+				ok = obj->ops.write_flash( obj, (uint8_t*)wr, addr, n, sp );
+				break;
+			case EC2D_CALL_WRITE_FLASH_BLOCK:
+				ok = obj->ops.write_flash_block &&
+					 obj->ops.write_flash_block( obj, addr, (uint8_t*)wr, n,
+										(flags & EC2D_CALLF_SAVE)!=0, sp );
+				break;
+			case EC2D_CALL_ERASE_FLASH:
+				ok = obj->ops.erase_flash( obj );
+				break;
+			case EC2D_CALL_ERASE_SECTOR:
+				ok = obj->ops.erase_flash_sector( obj, addr, sp );
+				break;
+			case EC2D_CALL_READ_PC:
+				pc = obj->ops.read_pc( obj );
+				reply[0] = pc & 0xff;
+				reply[1] = pc >> 8;
+				ok = n==2;
+				break;
+			default:
+				ok = FALSE;
+		}
+	}
+	if( !ec2d_send( c->fd, EC2D_CALL, ok ? 0 : 1, obj->flash_fail_addr,
+					reply, ok ? rlen : 0 ) )
+		client_gone( c );
+}
+
+/** Handle one message from a client.
+*/
+static void client_msg( CLIENT *c )
+{
+	ADAPTER *a = c->adapter;
+	uint8_t op, status;
+	uint32_t arg;
+	int len, want;
+	BOOL ok;
+
+	if( !ec2d_recv( c->fd, &op, &status, &arg, data, sizeof(data), &len ) )
+	{
+		client_gone( c );
+		return;
+	}
+	if( op==EC2D_OPEN )
+	{
+		if( a || c->waiting || len>=(int)sizeof(c->want) )
+		{
+			client_gone( c );
+			return;
+		}
+		memcpy( c->want, data, len );
+		c->want[len] = '\0';
+		c->waiting = TRUE;
+		c->seq = next_seq++;
+		dispatch();
+		return;
+	}
+	if( !a )
+	{
+		client_gone( c );		// hasn't opened anything
+		return;
+	}
+	switch( op )
+	{
+		case EC2D_WRITE:
+			// a failure shows up in the client's next read
+			write_port( &a->obj, data, len );
+			break;
+		case EC2D_READ:
+			want = len==2 ? ((uint8_t)data[0] | (uint8_t)data[1]<<8) : 0;
+			if( arg )
+				ok = read_port_tm( &a->obj, reply, want, arg );
+			else
+				ok = read_port( &a->obj, reply, want );
+			if( !ec2d_send( c->fd, EC2D_READ, ok ? 0 : 1, 0, reply,
+							ok ? want : 0 ) )
+				client_gone( c );
+			break;
+		case EC2D_FLUSH:
+			a->obj.transport->flush( &a->obj );
+			break;
+		case EC2D_RESET:
+			if( a->obj.transport->reset )
+				a->obj.transport->reset( &a->obj );
+			break;
+		case EC2D_KEEP:
+			if( len==EC2D_SESSION_LEN )
+				ec2d_get_session( data, &a->session );
+			break;
+		case EC2D_BATCH:
+			client_batch( c, len );
+			break;
+		case EC2D_TARGET:
+			{
+				EC2D_SESSION s;
+				ok = len==EC2D_SESSION_LEN;
+				if( ok )
+				{
+					ec2d_get_session( data, &s );
+					ok = ec2_adopt_target( &a->obj, &s );
+				}
+				if( !ec2d_send( c->fd, EC2D_TARGET, ok ? 0 : 1, 0, 0, 0 ) )
+					client_gone( c );
+			}
+			break;
+		case EC2D_CALL:
+			client_call( c, arg, len );
+			break;
+		default:
+			client_gone( c );
+	}
+}
+
+/** Listen on path, refusing to take over from a running daemon.
+	\returns the socket, -1 on failure.
+*/
+static int listen_on( const char *path )
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	strncpy( addr.sun_path, path, sizeof(addr.sun_path)-1 );
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( fd<0 )
+		return -1;
+	if( connect( fd, (struct sockaddr*)&addr, sizeof(addr) )==0 )
+	{
+		printf("ec2d is already running on %s\n", path );
+		close( fd );
+		return -1;
+	}
+	close( fd );
+	unlink( path );		// left by a daemon that died
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( fd<0 || bind( fd, (struct sockaddr*)&addr, sizeof(addr) )!=0 ||
+		listen( fd, 8 )!=0 )
+	{
+		printf("Unable to listen on %s: %s\n", path, strerror(errno) );
+		if( fd>=0 )
+			close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+/** Take a new client from a listening socket.
+	Nagle is turned off for TCP clients, every message is waited for.
+*/
+static void accept_client( int lfd, BOOL tcp )
+{
+	int fd = accept( lfd, 0, 0 );
+	int i, on = 1;
+	for( i=0; fd>=0 && i<MAX_CLIENTS && clients[i].fd>=0; i++ )
+		;
+	if( fd>=0 && i==MAX_CLIENTS )
+	{
+		printf("Too many clients\n");
+		close( fd );
+	}
+	else if( fd>=0 )
+	{
+		if( tcp )
+			setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+		memset( &clients[i], 0, sizeof(CLIENT) );
+		clients[i].fd = fd;
+	}
+}
+
+/** Listen for TCP clients on [<host>:]<port>, localhost if no host is given.
+	\returns the socket, -1 on failure.
+*/
+static int listen_tcp( const char *spec )
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256] = "localhost";
+	const char *sep = strrchr( spec, ':' );
+	const char *port = sep ? sep+1 : spec;
+	int fd = -1, on = 1;
+
+	if( sep && sep-spec<(int)sizeof(host) )
+	{
+		memcpy( host, spec, sep-spec );
+		host[sep-spec] = '\0';
+	}
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if( getaddrinfo( host, port, &hints, &res )!=0 )
+	{
+		printf("Unknown address %s\n", spec );
+		return -1;
+	}
+	for( ai=res; ai && fd<0; ai=ai->ai_next )
+	{
+		fd = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+		if( fd<0 )
+			continue;
+		setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+		if( bind( fd, ai->ai_addr, ai->ai_addrlen )!=0 || listen( fd, 8 )!=0 )
+		{
+			close( fd );
+			fd = -1;
+		}
+	}
+	freeaddrinfo( res );
+	if( fd<0 )
+		printf("Unable to listen on %s: %s\n", spec, strerror(errno) );
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = getenv("EC2D_SOCKET");
+	const char *tcp = 0;
+	struct pollfd fds[2+MAX_CLIENTS];
+	int idx[2+MAX_CLIENTS];
+	int lfd, tfd = -1, c, i, n;
+	static struct option long_options[] =
+	{
+		{"debug", no_argument, &debug, 1},
+		{"help", no_argument, &help_flag, 'h'},
+		{"port", required_argument, 0, 'p'},
+		{"socket", required_argument, 0, 's'},
+		{"listen", required_argument, 0, 'l'},
+		{0, 0, 0, 0}
+	};
+	int option_index = 0;
+
+	if( !path || !*path )
+		path = EC2D_SOCKET;
+	while(1)
+	{
+		c = getopt_long (argc, argv, "", long_options, &option_index);
+		if( c==-1)
+			break;
+		switch(c)
+		{
+			case 0:		// set a flag, nothing to do
+				break;
+			case 'p':	// port
+				if( num_adapters==MAX_ADAPTERS )
+				{
+					printf("Error: at most %i adapters\n", MAX_ADAPTERS );
+					return -1;
+				}
+				adapters[num_adapters++].port = optarg;
+				break;
+			case 's':	// socket
+				path = optarg;
+				break;
+			case 'l':	// listen
+				tcp = optarg;
+				break;
+			default:
+				printf("unexpected option\n");
+				break;
+		}
+	}
+	if( help_flag || optind<argc )
+	{
+		help();
+		return help_flag ? 0 : -1;
+	}
+	if( num_adapters==0 )
+		adapters[num_adapters++].port = "USB";
+
+	lfd = listen_on( path );
+	if( lfd<0 )
+		return -1;
+	if( tcp && (tfd = listen_tcp( tcp ))<0 )
+	{
+		close( lfd );
+		unlink( path );
+		return -1;
+	}
+	signal( SIGINT, on_signal );
+	signal( SIGTERM, on_signal );
+	signal( SIGPIPE, SIG_IGN );		// a client that went is seen by ec2d_send
+	for( i=0; i<MAX_CLIENTS; i++ )
+		clients[i].fd = -1;
+	// open now so the first client doesn't wait, failures are retried later
+	for( i=0; i<num_adapters; i++ )
+	{
+		adapters[i].owner = -1;
+		adapter_open( &adapters[i] );
+	}
+	printf("ec2d listening on %s\n", path );
+	if( tcp )
+		printf("ec2d listening on TCP %s\n", tcp );
+	fflush( stdout );
+
+	while( !stop )
+	{
+		n = 0;
+		fds[n].fd = lfd;
+		fds[n].events = POLLIN;
+		idx[n++] = -1;
+		fds[n].fd = tfd;		// ignored by poll() when -1
+		fds[n].events = POLLIN;
+		idx[n++] = -1;
+		for( i=0; i<MAX_CLIENTS; i++ )
+		{
+			if( clients[i].fd<0 )
+				continue;
+			fds[n].fd = clients[i].fd;
+			fds[n].events = POLLIN;
+			idx[n++] = i;
+		}
+		if( poll( fds, n, -1 )<0 )
+		{
+			if( errno==EINTR )
+				continue;
+			break;
+		}
+		for( i=2; i<n; i++ )
+		{
+			// an earlier message may have closed it
+			if( (fds[i].revents & (POLLIN|POLLHUP|POLLERR)) &&
+				clients[idx[i]].fd==fds[i].fd )
+				client_msg( &clients[idx[i]] );
+		}
+		if( fds[0].revents & POLLIN )
+			accept_client( lfd, FALSE );
+		if( fds[1].revents & POLLIN )
+			accept_client( tfd, TRUE );
+		fflush( stdout );
+	}
+
+	printf("Exiting now\n");
+	for( i=0; i<num_adapters; i++ )
+		adapter_close( &adapters[i] );
+	close( lfd );
+	if( tfd>=0 )
+		close( tfd );
+	unlink( path );
+	return 0;
+}
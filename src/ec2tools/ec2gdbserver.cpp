@@ -0,0 +1,785 @@
+/** ec2gdbserver utility
+  * Serves a debug-core target to gdb style front ends over TCP using the
+  * GDB remote serial protocol.  Memory is addressed using the MemRemap flat
+  * addresses so CODE, XDATA, DATA / IDATA and SFRs all fit in one space.
+  *
+  *   Copyright (C) 2006 by Ricky White
+  *   rickyw@neatstuff.co.nz
+  *
+  *   This program is free software; you can redistribute it and/or modify
+  *   it under the terms of the GNU General Public License as published by
+  *   the Free Software Foundation; either version 2 of the License, or
+  *   (at your option) any later version.
+  *
+  *   This program is distributed in the hope that it will be useful,
+  *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+  *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  *   GNU General Public License for more details.
+  *
+  *   You should have received a copy of the GNU General Public License
+  *   along with this program; if not, write to the
+  *   Free Software Foundation, Inc.,
+  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <errno.h>
+#include <iostream>
+#include <string>
+#include <set>
+
+#include "dbgsession.h"
+#include "target.h"
+#include "memremap.h"
+#include "ihex.h"
+
+using namespace std;
+
+void help()
+{
+	cout <<"ec2gdbserver\n"
+		<<"options:\n"
+		<<"\t--target	SL51 (default), S51 or <none> for the built in simulator\n"
+		<<"\t--port		Port the debug adapter / simulator is on (USB for EC3)\n"
+		<<"\t--mode		auto / jtag / c2 for SL51, auto being the default\n"
+		<<"\t--listen	[<host>:]<tcp port> to accept gdb connections on,\n"
+		<<"\t		default 127.0.0.1:2331.  There is no authentication,\n"
+		<<"\t		only give another host on a trusted network\n"
+		<<"\t--file		Intel hex file to load before serving\n"
+		<<"\t--debug		Print every packet\n"
+		<<"\n"
+		<<"Registers, in g packet order: r0-r7 of the current bank, a, b, dpl,\n"
+		<<"dph, sp, psw, each 8 bits, then the 16 bit pc.  Memory uses the flat\n"
+		<<"addresses below, CODE is flash so gdb's load programs it.\n"
+		<<"\tCODE	0x00000000\n"
+		<<"\tXDATA	0x20000000\n"
+		<<"\tDATA	0x40000000, IDATA 0x40000100\n"
+		<<"\tSFR	0x80000080\n"
+		<< endl;
+}
+
+#define PACKET_SIZE		0x4000		///< largest packet we accept, m replies are half this
+#define NUM_REGS		15			///< r0-r7 a b dpl dph sp psw pc
+
+static DbgSession	*session;
+static Target		*target;
+static int			client = -1;
+static bool			debug = false;
+static bool			no_ack = false;
+static string		rx;				///< received but not yet consumed
+static set<uint16_t>	bps;		///< breakpoints the client has set
+static IHEX_IMAGE	flash_img;		///< vFlashWrite data waiting for vFlashDone
+
+/// SFR holding each of the byte registers after r0-r7
+static const uint8_t reg_sfr[] = { 0xe0, 0xf0, 0x82, 0x83, 0x81, 0xd0 };
+
+static const char target_xml[] =
+	"<?xml version=\"1.0\"?>"
+	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+	"<target version=\"1.0\">"
+	"<feature name=\"org.gnu.gdb.mcs51.core\">"
+	"<reg name=\"r0\" bitsize=\"8\" regnum=\"0\"/>"
+	"<reg name=\"r1\" bitsize=\"8\"/>"
+	"<reg name=\"r2\" bitsize=\"8\"/>"
+	"<reg name=\"r3\" bitsize=\"8\"/>"
+	"<reg name=\"r4\" bitsize=\"8\"/>"
+	"<reg name=\"r5\" bitsize=\"8\"/>"
+	"<reg name=\"r6\" bitsize=\"8\"/>"
+	"<reg name=\"r7\" bitsize=\"8\"/>"
+	"<reg name=\"a\" bitsize=\"8\"/>"
+	"<reg name=\"b\" bitsize=\"8\"/>"
+	"<reg name=\"dpl\" bitsize=\"8\"/>"
+	"<reg name=\"dph\" bitsize=\"8\"/>"
+	"<reg name=\"sp\" bitsize=\"8\" type=\"data_ptr\"/>"
+	"<reg name=\"psw\" bitsize=\"8\"/>"
+	"<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+	"</feature>"
+	"</target>";
+
+static const char memory_map_xml[] =
+	"<?xml version=\"1.0\"?>"
+	"<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\""
+	" \"http://sourceware.org/gdb/gdb-memory-map.dtd\">"
+	"<memory-map>"
+	"<memory type=\"flash\" start=\"0x0\" length=\"0x10000\">"
+	"<property name=\"blocksize\">0x200</property>"
+	"</memory>"
+	"<memory type=\"ram\" start=\"0x20000000\" length=\"0x10000\"/>"
+	"<memory type=\"ram\" start=\"0x40000000\" length=\"0x200\"/>"
+	"<memory type=\"ram\" start=\"0x80000080\" length=\"0x80\"/>"
+	"</memory-map>";
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Packet layer
+///////////////////////////////////////////////////////////////////////////////
+
+static int hex_val( char c )
+{
+	if( c>='0' && c<='9' )	return c-'0';
+	if( c>='a' && c<='f' )	return c-'a'+10;
+	if( c>='A' && c<='F' )	return c-'A'+10;
+	return -1;
+}
+
+static string to_hex( const unsigned char *buf, int len )
+{
+	static const char digits[] = "0123456789abcdef";
+	string s;
+	s.reserve( len*2 );
+	for( int i=0; i<len; i++ )
+	{
+		s += digits[buf[i]>>4];
+		s += digits[buf[i]&0xf];
+	}
+	return s;
+}
+
+/** Decode len bytes of hex from s.
+	\returns false if s holds fewer or bad digits.
+*/
+static bool from_hex( const char *s, unsigned char *buf, int len )
+{
+	for( int i=0; i<len; i++ )
+	{
+		int hi = hex_val( s[i*2] ), lo = hi<0 ? -1 : hex_val( s[i*2+1] );
+		if( lo<0 )
+			return false;
+		buf[i] = hi<<4 | lo;
+	}
+	return true;
+}
+
+/// Undo the binary escaping of X and vFlashWrite data.
+static string unescape( const char *p, const char *end )
+{
+	string s;
+	for( ; p<end; p++ )
+	{
+		if( *p=='}' && p+1<end )
+			s += char( *++p ^ 0x20 );
+		else
+			s += *p;
+	}
+	return s;
+}
+
+/// Escape data for a qXfer reply.
+static string escape( const char *p, int len )
+{
+	string s;
+	for( int i=0; i<len; i++ )
+	{
+		if( p[i]=='$' || p[i]=='#' || p[i]=='}' || p[i]=='*' )
+		{
+			s += '}';
+			s += char( p[i] ^ 0x20 );
+		}
+		else
+			s += p[i];
+	}
+	return s;
+}
+
+/** Get the next byte from the client.
+	\param timeout_ms	-1 to wait forever
+	\returns the byte, -1 on timeout or -2 if the client has gone
+*/
+static int get_byte( int timeout_ms )
+{
+	if( rx.empty() )
+	{
+		char buf[PACKET_SIZE];
+		fd_set fds;
+		struct timeval tv, *ptv = 0;
+		FD_ZERO( &fds );
+		FD_SET( client, &fds );
+		if( timeout_ms>=0 )
+		{
+			tv.tv_sec = timeout_ms/1000;
+			tv.tv_usec = (timeout_ms%1000)*1000;
+			ptv = &tv;
+		}
+		if( select( client+1, &fds, 0, 0, ptv )<=0 )
+			return -1;
+		int n = read( client, buf, sizeof(buf) );
+		if( n<=0 )
+			return -2;
+		rx.assign( buf, n );
+	}
+	unsigned char c = rx[0];
+	rx.erase( 0, 1 );
+	return c;
+}
+
+static bool put_packet( const string &data )
+{
+	unsigned char cs = 0;
+	for( size_t i=0; i<data.length(); i++ )
+		cs += data[i];
+	char tail[4];
+	snprintf( tail, sizeof(tail), "#%02x", cs );
+	string pkt = "$" + data + tail;
+	if( debug )
+		cout << "-> " << pkt << endl;
+	for(;;)
+	{
+		if( write( client, pkt.data(), pkt.length() )!=(ssize_t)pkt.length() )
+			return false;
+		if( no_ack )
+			return true;
+		int c;
+		do
+			c = get_byte( -1 );
+		while( c>=0 && c!='+' && c!='-' );
+		if( c<0 )
+			return false;
+		if( c=='+' )
+			return true;
+	}
+}
+
+/** Read the next packet.
+	\param[out] pkt	packet data, or "\x03" for an interrupt request
+	\returns false if the client has gone.
+*/
+static bool get_packet( string &pkt )
+{
+	int c;
+	for(;;)
+	{
+		c = get_byte( -1 );
+		if( c<0 )
+			return false;
+		if( c==0x03 )
+		{
+			pkt = "\x03";
+			return true;
+		}
+		if( c!='$' )
+			continue;		// acks and noise
+		pkt.clear();
+		unsigned char cs = 0;
+		while( (c = get_byte( -1 ))>=0 && c!='#' )
+		{
+			pkt += char(c);
+			cs += c;
+		}
+		int hi = c<0 ? -1 : hex_val( get_byte( -1 ) );
+		int lo = hi<0 ? -1 : hex_val( get_byte( -1 ) );
+		if( lo<0 && c<0 )
+			return false;
+		if( no_ack )
+			break;
+		if( lo>=0 && (hi<<4 | lo)==cs )
+		{
+			if( write( client, "+", 1 )!=1 )
+				return false;
+			break;
+		}
+		if( write( client, "-", 1 )!=1 )
+			return false;
+	}
+	if( debug )
+		cout << "<- " << pkt << endl;
+	return true;
+}
+
+/// true if the client has sent an interrupt, other input is kept.
+static bool interrupt_pending()
+{
+	int c = get_byte( 0 );
+	if( c==-2 )
+		return true;	// gone, stop the target anyway
+	if( c<0 )
+		return false;
+	if( c==0x03 )
+		return true;
+	rx.insert( rx.begin(), char(c) );
+	return false;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Commands
+///////////////////////////////////////////////////////////////////////////////
+
+/** Parse "addr,len" as used by m, M, X and Z.
+	\returns a pointer past what was parsed, 0 on error.
+*/
+static const char *parse_addr_len( const char *p, uint32_t &addr, uint32_t &len )
+{
+	char *end;
+	addr = strtoul( p, &end, 16 );
+	if( *end!=',' )
+		return 0;
+	len = strtoul( end+1, &end, 16 );
+	return end;
+}
+
+static void read_regs( unsigned char *regs )
+{
+	const Target::CPU_CONTEXT &c = target->read_cpu_context();
+	memcpy( regs, c.r, 8 );
+	regs[8]  = c.acc;
+	regs[9]  = c.b;
+	regs[10] = c.dpl;
+	regs[11] = c.dph;
+	regs[12] = c.sp;
+	regs[13] = c.psw;
+	regs[14] = c.pc & 0xff;
+	regs[15] = c.pc >> 8;
+}
+
+/// write register n (0 to NUM_REGS-1) from its bytes in regs
+static void write_reg( int n, unsigned char *regs )
+{
+	if( n<8 )
+	{
+		uint8_t psw = target->read_cpu_context().psw;
+		target->write_memory( MemRemap::flat( (psw & 0x18)+n, 'd' ), 1, regs );
+	}
+	else if( n<14 )
+		target->write_sfr( reg_sfr[n-8], 1, regs );
+	else
+		target->write_PC( regs[0] | regs[1]<<8 );
+}
+
+static string do_read_mem( const char *p )
+{
+	uint32_t addr, len;
+	if( !parse_addr_len( p, addr, len ) || len>PACKET_SIZE/2 )
+		return "E01";
+	unsigned char *buf = new unsigned char[len];
+	bool ok = target->read_memory( addr, len, buf );
+	string r = ok ? to_hex( buf, len ) : string("E02");
+	delete [] buf;
+	return r;
+}
+
+static string do_write_mem( const char *p, const char *end, bool binary )
+{
+	uint32_t addr, len;
+	p = parse_addr_len( p, addr, len );
+	if( !p || *p!=':' )
+		return "E01";
+	string data;
+	if( binary )
+		data = unescape( p+1, end );
+	else
+	{
+		data.resize( len );
+		if( (uint32_t)(end-p-1)<len*2 ||
+			!from_hex( p+1, (unsigned char*)&data[0], len ) )
+			return "E01";
+	}
+	if( data.length()!=len )
+		return "E01";
+	if( len==0 )
+		return "OK";
+	return target->write_memory( addr, len, (unsigned char*)&data[0] )
+		   ? "OK" : "E02";
+}
+
+static string do_breakpoint( const char *p, bool insert )
+{
+	uint32_t addr, kind;
+	if( (p[0]!='0' && p[0]!='1') || p[1]!=',' ||
+		!parse_addr_len( p+2, addr, kind ) )
+		return "";		// watchpoints aren't supported
+	char area;
+	ADDR a = MemRemap::target( addr, area );
+	if( a==INVALID_ADDR || area!='c' || a>0xffff )
+		return "E01";
+	// software and hardware breakpoints are both the adapter's
+	if( insert )
+	{
+		if( bps.count( a ) )
+			return "OK";
+		if( !target->add_breakpoint( a ) )
+			return "E02";
+		bps.insert( a );
+	}
+	else
+	{
+		if( bps.erase( a ) )
+			target->del_breakpoint( a );
+	}
+	return "OK";
+}
+
+/** Run until a breakpoint or the client interrupts.
+	\returns the stop reply.
+*/
+static string do_continue()
+{
+	target->go();
+	while( !target->poll_for_halt() )
+	{
+		if( interrupt_pending() )
+		{
+			target->stop2();
+			while( !target->poll_for_halt() )
+				;
+			return "S02";
+		}
+	}
+	return "S05";
+}
+
+static string do_step()
+{
+	target->step();
+	return "S05";
+}
+
+/// vCont;action[:thread]... only the first action matters with one thread
+static string do_vcont( const char *p )
+{
+	if( strcmp( p, "?" )==0 )
+		return "vCont;c;C;s;S;t";
+	if( *p!=';' )
+		return "";
+	switch( p[1] )
+	{
+		case 'c':
+		case 'C':	return do_continue();
+		case 's':
+		case 'S':	return do_step();
+		case 't':	return "S00";
+	}
+	return "E01";
+}
+
+/** Reply to qXfer:object:read:annex:offset,length from a fixed document.
+*/
+static string xfer( const char *doc, const char *p )
+{
+	uint32_t off, len, size = strlen( doc );
+	if( !parse_addr_len( p, off, len ) )
+		return "E01";
+	if( off>=size )
+		return "l";
+	if( len>size-off )
+		len = size-off;
+	return string( off+len<size ? "m" : "l" ) + escape( doc+off, len );
+}
+
+static string do_monitor( const char *p )
+{
+	string cmd;
+	int n = strlen( p )/2;
+	cmd.resize( n );
+	if( !from_hex( p, (unsigned char*)&cmd[0], n ) )
+		return "E01";
+	if( cmd=="reset" )
+	{
+		target->reset();
+		return "OK";
+	}
+	return target->command( cmd ) ? "OK" : "E02";
+}
+
+static string do_flash_done()
+{
+	bool ok = flash_img.count==0 || target->load_image( flash_img );
+	ihex_free( &flash_img );
+	ihex_init( &flash_img );
+	return ok ? "OK" : "E02";
+}
+
+/** Handle one packet.
+	\returns the reply, "" for anything unsupported.
+*/
+static string handle( const string &pkt, bool &detach )
+{
+	const char *p = pkt.c_str(), *end = p + pkt.length();
+	unsigned char regs[NUM_REGS+1];
+
+	switch( p[0] )
+	{
+		case '\x03':
+			return "S02";	// interrupt while halted
+		case '?':
+			return "S05";
+		case 'g':
+			read_regs( regs );
+			return to_hex( regs, sizeof(regs) );
+		case 'G':
+			if( pkt.length()<1+2*sizeof(regs) || !from_hex( p+1, regs, sizeof(regs) ) )
+				return "E01";
+			for( int i=0; i<NUM_REGS; i++ )
+				write_reg( i, &regs[i==NUM_REGS-1 ? 14 : i] );
+			return "OK";
+		case 'p':
+		{
+			int n = strtoul( p+1, 0, 16 );
+			if( n>=NUM_REGS )
+				return "E01";
+			read_regs( regs );
+			return to_hex( &regs[n], n==NUM_REGS-1 ? 2 : 1 );
+		}
+		case 'P':
+		{
+			char *val;
+			int n = strtoul( p+1, &val, 16 );
+			if( n>=NUM_REGS || *val!='=' ||
+				!from_hex( val+1, regs, n==NUM_REGS-1 ? 2 : 1 ) )
+				return "E01";
+			write_reg( n, regs );
+			return "OK";
+		}
+		case 'm':	return do_read_mem( p+1 );
+		case 'M':	return do_write_mem( p+1, end, false );
+		case 'X':	return do_write_mem( p+1, end, true );
+		case 'Z':	return do_breakpoint( p+1, true );
+		case 'z':	return do_breakpoint( p+1, false );
+		case 'c':
+			if( p[1] )
+				target->write_PC( strtoul( p+1, 0, 16 ) );
+			return do_continue();
+		case 's':
+			if( p[1] )
+				target->write_PC( strtoul( p+1, 0, 16 ) );
+			return do_step();
+		case 'H':
+			return "OK";
+		case 'T':
+			return "OK";
+		case 'D':
+			detach = true;
+			return "OK";
+		case 'k':
+			detach = true;
+			return "";
+		case 'r':
+		case 'R':
+			target->reset();
+			return "OK";
+	}
+
+	if( pkt.compare( 0, 11, "qSupported:" )==0 || pkt=="qSupported" )
+	{
+		char buf[128];
+		snprintf( buf, sizeof(buf), "PacketSize=%x;qXfer:features:read+;"
+				  "qXfer:memory-map:read+;QStartNoAckMode+;vContSupported+",
+				  PACKET_SIZE );
+		return buf;
+	}
+	if( pkt=="QStartNoAckMode" )
+	{
+		string r = "OK";
+		put_packet( r );	// acknowledged like any other packet
+		no_ack = true;
+		return "";
+	}
+	if( pkt.compare( 0, 31, "qXfer:features:read:target.xml:" )==0 )
+		return xfer( target_xml, p+31 );
+	if( pkt.compare( 0, 23, "qXfer:memory-map:read::" )==0 )
+		return xfer( memory_map_xml, p+23 );
+	if( pkt.compare( 0, 5, "vCont" )==0 )
+		return do_vcont( p+5 );
+	if( pkt.compare( 0, 12, "vFlashErase:" )==0 )
+		return "OK";		// write_image() erases what it programs
+	if( pkt.compare( 0, 12, "vFlashWrite:" )==0 )
+	{
+		char *colon;
+		uint32_t addr = strtoul( p+12, &colon, 16 );
+		if( *colon!=':' )
+			return "E01";
+		string data = unescape( colon+1, end );
+		return ihex_add_data( &flash_img, addr, (const uint8_t*)data.data(),
+							  data.length() ) ? "OK" : "E02";
+	}
+	if( pkt=="vFlashDone" )
+		return do_flash_done();
+	if( pkt.compare( 0, 6, "qRcmd," )==0 )
+		return do_monitor( p+6 );
+	if( pkt=="qAttached" )
+		return "1";
+	if( pkt=="qC" )
+		return "QC1";
+	if( pkt=="qfThreadInfo" )
+		return "m1";
+	if( pkt=="qsThreadInfo" )
+		return "l";
+	if( pkt.compare( 0, 7, "qSymbol" )==0 )
+		return "OK";
+	return "";
+}
+
+/** Talk to one client until it detaches or goes away.
+*/
+static void serve()
+{
+	string pkt;
+	bool detach = false;
+	no_ack = false;
+	rx.clear();
+	while( !detach && get_packet( pkt ) )
+	{
+		string reply = handle( pkt, detach );
+		if( pkt=="QStartNoAckMode" || pkt=="k" )
+			continue;		// already answered / no reply
+		if( !put_packet( reply ) )
+			break;
+	}
+	// leave the target as we found it
+	for( set<uint16_t>::iterator i=bps.begin(); i!=bps.end(); ++i )
+		target->del_breakpoint( *i );
+	bps.clear();
+	ihex_free( &flash_img );
+	ihex_init( &flash_img );
+}
+
+
+static void exit_func( void )
+{
+	if( target && target->is_connected() )
+		target->disconnect();
+}
+
+/** Listen for gdb on [<host>:]<port>, 127.0.0.1 if no host is given.
+	\returns the socket, -1 on failure.
+*/
+static int listen_tcp( const string &spec )
+{
+	struct addrinfo hints, *res, *ai;
+	size_t sep = spec.rfind( ':' );
+	string host = sep==string::npos ? "127.0.0.1" : spec.substr( 0, sep );
+	string port = sep==string::npos ? spec : spec.substr( sep+1 );
+	int fd = -1, on = 1;
+
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if( getaddrinfo( host.c_str(), port.c_str(), &hints, &res )!=0 )
+	{
+		printf("ERROR: unknown address %s\n", spec.c_str() );
+		return -1;
+	}
+	for( ai=res; ai && fd<0; ai=ai->ai_next )
+	{
+		fd = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+		if( fd<0 )
+			continue;
+		setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+		if( bind( fd, ai->ai_addr, ai->ai_addrlen )!=0 || listen( fd, 1 )!=0 )
+		{
+			close( fd );
+			fd = -1;
+		}
+	}
+	freeaddrinfo( res );
+	if( fd<0 )
+		printf("ERROR: can't listen on %s: %s\n", spec.c_str(), strerror(errno) );
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	string target_name = "SL51", port, file, mode;
+	string listen_spec = "2331";
+	static int debug_flag=0, help_flag;
+	static struct option long_options[] =
+	{
+		{"debug", no_argument, &debug_flag, 1},
+		{"help", no_argument, &help_flag, 'h'},
+		{"target", required_argument, 0, 't'},
+		{"port", required_argument, 0, 'p'},
+		{"mode", required_argument, 0, 'm'},
+		{"listen", required_argument, 0, 'l'},
+		{"file", required_argument, 0, 'f'},
+		{0, 0, 0, 0}
+	};
+	int option_index = 0;
+	int c;
+
+	while(1)
+	{
+		c = getopt_long (argc, argv, "", long_options, &option_index);
+		if( c==-1)
+			break;
+		switch(c)
+		{
+			case 0:		// set a flag, nothing to do
+				break;
+			case 't':	target_name = optarg;				break;
+			case 'p':	port = optarg;						break;
+			case 'm':	mode = optarg;						break;
+			case 'l':	listen_spec = optarg;				break;
+			case 'f':	file = optarg;						break;
+			default:
+				printf("unexpected option\n");
+				break;
+		}
+	};
+	if( help_flag )
+	{
+		help();
+		return EXIT_SUCCESS;
+	}
+	debug = debug_flag;
+	signal( SIGPIPE, SIG_IGN );		// a vanishing client is handled by write()
+
+	session = new DbgSession();
+	if( !session->SelectTarget( target_name ) )
+	{
+		printf("Error: unknown target '%s'\n", target_name.c_str() );
+		return EXIT_FAILURE;
+	}
+	target = session->target();
+	if( port.length() )
+		target->set_port( port );
+	if( mode.length() )
+	{
+		for( size_t i=0; i<mode.length(); i++ )
+			mode[i] = toupper( mode[i] );
+		target->command( mode=="AUTO" ? "mode AUTO" : "mode=" + mode );
+	}
+	if( !target->connect() )
+	{
+		printf("ERROR: coulden't connect to the target\n");
+		return EXIT_FAILURE;
+	}
+	atexit( exit_func );
+	ihex_init( &flash_img );
+	if( file.length() && !target->load_file( file ) )
+	{
+		printf("ERROR: coulden't load '%s'\n", file.c_str() );
+		return EXIT_FAILURE;
+	}
+
+	// local only by default, anyone who can connect can reprogram the target
+	int srv = listen_tcp( listen_spec );
+	int on = 1;
+	if( srv<0 )
+		return EXIT_FAILURE;
+	for(;;)
+	{
+		printf("Listening on %s for gdb\n", listen_spec.c_str() );
+		client = accept( srv, 0, 0 );
+		if( client<0 )
+			continue;
+		// packets are small and latency matters more than throughput
+		setsockopt( client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+		printf("gdb connected\n");
+		serve();
+		close( client );
+		client = -1;
+		printf("gdb disconnected\n");
+	}
+	return EXIT_SUCCESS;
+}
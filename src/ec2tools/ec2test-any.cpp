@@ -19,12 +19,16 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
 #include <string.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <time.h>
 #include "ec2drv.h"
 using namespace std;
 
@@ -68,6 +72,134 @@ extern "C" void exit_func(void)
 
 static int quick_flag;		// true if quick test only
 
+/** One of the functional tests, for running them in a loop.
+*/
+typedef struct
+{
+	const char	*name;
+	bool		(*fn)( EC2DRV &obj );
+	int			*disabled;
+} TEST;
+
+static volatile sig_atomic_t soak_stop = 0;
+
+static void soak_sigint( int sig )
+{
+	soak_stop = 1;			// finish the test in progress and report
+}
+
+static double now_ms()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+/** The p'th percentile of sorted times, nearest rank.
+*/
+static double percentile( const vector<double> &sorted, double p )
+{
+	int i = (int)(p*sorted.size()+0.999999) - 1;
+	return sorted[ i<0 ? 0 : i ];
+}
+
+/** Upper bound of the bucket holding the p'th percentile round trip.
+	\returns 0 if nothing was measured.
+*/
+static uint32_t hist_percentile( const EC2_STATS &st, double p )
+{
+	uint32_t total = 0, sum = 0;
+	int b;
+	for( b=0; b<EC2_STATS_BUCKETS; b++ )
+		total += st.latency_hist[b];
+	for( b=0; b<EC2_STATS_BUCKETS && total; b++ )
+	{
+		sum += st.latency_hist[b];
+		if( sum>=p*total )
+			return b==EC2_STATS_BUCKETS-1 ? st.max_usec : 32u<<b;
+	}
+	return 0;
+}
+
+/** Run the enabled tests over and over, for count loops or secs seconds,
+	whichever comes first (0 for no limit), and report how long each took
+	and what the adapter link did.  Test output is only shown for failures.
+	\returns true if every run of every test passed.
+*/
+static bool soak( EC2DRV &obj, TEST *tests, int ntests, long count, long secs )
+{
+	vector< vector<double> > times( ntests );
+	vector<int> fails( ntests, 0 );
+	double start = now_ms(), t;
+	long loop;
+	bool pass = true;
+	EC2_STATS st;
+
+	printf("Soak test, ec2drv %i.%i, adapter firmware 0x%02x\n",
+		   ec2drv_version()>>8, ec2drv_version()&0xff, obj.fw_ver );
+	signal( SIGINT, soak_sigint );
+	ec2_reset_stats( &obj );
+	for( loop=0; (count==0 || loop<count) && !soak_stop &&
+		 (secs==0 || now_ms()-start<secs*1000.0); loop++ )
+	{
+		bool loop_pass = true;
+		for( int i=0; i<ntests && !soak_stop; i++ )
+		{
+			if( *tests[i].disabled )
+				continue;
+			ostringstream out;					// quiet unless it fails
+			streambuf *old = cout.rdbuf( out.rdbuf() );
+			t = now_ms();
+			bool ok = tests[i].fn( obj );
+			times[i].push_back( now_ms()-t );
+			cout.rdbuf( old );
+			if( !ok )
+			{
+				fails[i]++;
+				loop_pass = false;
+				cout << out.str() << flush;
+				printf("loop %li: %s FAILED\n", loop+1, tests[i].name );
+			}
+		}
+		pass &= loop_pass;
+		printf("loop %li %s, %.1f s\n", loop+1, loop_pass ? "passed" : "failed",
+			   (now_ms()-start)/1000.0 );
+		fflush( stdout );
+	}
+	signal( SIGINT, exit );
+	t = (now_ms()-start)/1000.0;
+
+	printf("\n%li loops in %.1f s\n", loop, t );
+	printf("Test                 Runs Fails   Min ms   Avg ms   p50 ms   p90 ms   p99 ms   Max ms\n");
+	for( int i=0; i<ntests; i++ )
+	{
+		vector<double> &v = times[i];
+		double sum = 0;
+		if( v.empty() )
+			continue;
+		sort( v.begin(), v.end() );
+		for( int j=0; j<v.size(); j++ )
+			sum += v[j];
+		printf("%-18s %6i %5i %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+			   tests[i].name, (int)v.size(), fails[i], v.front(),
+			   sum/v.size(), percentile( v, 0.5 ), percentile( v, 0.9 ),
+			   percentile( v, 0.99 ), v.back() );
+	}
+
+	ec2_get_stats( &obj, &st );
+	printf("\nBytes sent %llu, received %llu, %.1f kB/s\n",
+		   (unsigned long long)st.tx_bytes, (unsigned long long)st.rx_bytes,
+		   t>0 ? (st.tx_bytes+st.rx_bytes)/1024.0/t : 0.0 );
+	printf("Timeouts %u, retries %u\n", st.timeouts, st.retries );
+	if( st.round_trips )
+		printf("Round trips %u, average %llu us, p50 < %u us, p90 < %u us, "
+			   "p99 < %u us, max %u us\n", st.round_trips,
+			   (unsigned long long)(st.total_usec/st.round_trips),
+			   hist_percentile( st, 0.5 ), hist_percentile( st, 0.9 ),
+			   hist_percentile( st, 0.99 ), st.max_usec );
+	return pass;
+}
+
 int main(int argc, char *argv[])
 {
 	string port;
@@ -75,6 +207,7 @@ int main(int argc, char *argv[])
 	static int debug=false, help_flag, mode_flag;
 	static int disable_flash, disable_data, disable_xdata, disable_pc;
 	static int disable_scratch, disable_debug;
+	long soak_count = 0, soak_secs = 0;
 	static struct option long_options[] = 
 	{
 		{"debug", no_argument, &debug, 1},
@@ -88,6 +221,8 @@ int main(int argc, char *argv[])
 		{"disable-scratch", no_argument, &disable_scratch, 1},
 		{"disable-debug", no_argument, &disable_debug, 1},
 		{"quick", no_argument, &quick_flag, 1},
+		{"soak-count", required_argument, 0, 'n'},
+		{"soak-time", required_argument, 0, 't'},
 		{0, 0, 0, 0}
 	};
 	int option_index = 0;
@@ -123,6 +258,12 @@ int main(int argc, char *argv[])
 					exit(-1);
 				}
 				break;
+			case 'n':	// soak loops
+				soak_count = strtol( optarg, 0, 0 );
+				break;
+			case 't':	// soak seconds
+				soak_secs = strtol( optarg, 0, 0 );
+				break;
 			default:
 				printf("unexpected option\n");
 				break;
@@ -170,13 +311,27 @@ int main(int argc, char *argv[])
 	if( quick_flag )
 		cout << "Quick Mode enabled" << endl;
 	
+	TEST tests[] =
+	{
+		{ "data ram",		test_data_ram,			&disable_data },
+		{ "xdata ram",		test_xdata_ram,			&disable_xdata },
+		{ "flash",			test_flash,				&disable_flash },
+		{ "scratchpad",		test_flash_scratchpad,	&disable_scratch },
+		{ "pc access",		test_pc_access,			&disable_pc },
+		{ "debug",			test_debug,				&disable_debug }
+	};
+	const int ntests = sizeof(tests)/sizeof(tests[0]);
 	bool pass = true;
-	if(!disable_data)		pass &= test_data_ram( obj );
-	if(!disable_xdata)		pass &= test_xdata_ram( obj );
-	if(!disable_flash)		pass &= test_flash( obj );
-	if(!disable_scratch)	pass &= test_flash_scratchpad( obj );
-	if(!disable_pc)			pass &= test_pc_access( obj );
-	if(!disable_debug)		pass &= test_debug( obj );
+	if( soak_count || soak_secs )
+		pass = soak( obj, tests, ntests, soak_count, soak_secs );
+	else
+	{
+		for( i=0; i<ntests; i++ )
+		{
+			if( !*tests[i].disabled )
+				pass &= tests[i].fn( obj );
+		}
+	}
 	
 	cout <<"Test " << (pass ? "Passed" : "Failed") << endl << endl;
 	ec2_disconnect( &obj);
@@ -839,6 +994,10 @@ void help()
 			"\t--disable-scratch     Disable flash scratchpad tests\n"
 			"\t--disable-debug       Disable target debug tests\n"
 			"\t--quick               Speed up some tests at the expense of accuracy\n"
+			"\t--soak-count <n>      Run the tests n times, reporting timings and\n"
+			"\t                      link statistics at the end\n"
+			"\t--soak-time <secs>    Run the tests over and over for secs seconds,\n"
+			"\t                      Ctrl-C stops a soak early and still reports\n"
 			"\n"
 			"\t--debug               Turn on ec2drv debug tracing\n"
 			"\t--help                Display this help\n"
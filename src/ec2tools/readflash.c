@@ -29,6 +29,7 @@
 #include <getopt.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "ec2drv.h"
 #include "ihex.h"
 
@@ -48,6 +49,11 @@ void help()
 		   "\t--start <addr>        Address to start reading from\n"
 		   "\t--len <length>        Number of bytes to read\n"
 		   "\t--scratch             Cause read to occur from scratchpad area of flash\n"
+		   "\t--stream              Read in chunks, writing each out while the next is\n"
+		   "\t                      read, memory use is independent of --len\n"
+		   "\t--chunk <bytes>       Chunk size for --stream, default 4096\n"
+		   "\t--crc                 Print the CRC-16 of the data read, as used by\n"
+		   "\t                      ec2_read_flash_crc()\n"
 		   "\t--mode                specify the mode of the debug interface.\n"
 		   "\t                      auto / jtag / c2 with auto being the default\n"
 		   "\t--debug               Turn on debug tracing\n"
@@ -64,13 +70,191 @@ void exit_func(void)
 }
 
 
+static void dump_console( uint32_t addr, const uint8_t *buf, uint32_t length )
+{
+	uint32_t i, j;
+	for( i=0; i<length; i+=16)
+	{
+		printf( "0x%05X  ", (unsigned int)(addr+i) );
+		// print hex
+		for( j=0; j<16; j++ )
+		{
+			if( (i+j)<length )
+				printf( "%02X ", (unsigned char)buf[i+j] );
+			else
+				printf("   ");
+		}
+		putchar(' ');
+		// print ASCII
+		for( j=0; j<16; j++ )
+		{
+			if( (i+j)<length )
+			{	
+				if( isprint( buf[i+j] ) )
+					putchar( buf[i+j] );
+				else
+					putchar('.');
+			}
+		}
+		putchar('\n');
+	}
+}
+
+
+/** Where a streamed dump goes, any combination of the outputs may be used.
+*/
+typedef struct
+{
+	int			bin;			///< binary file descriptor, -1 if none
+	FILE		*hex;			///< intel hex file, 0 if none
+	int			console;
+	uint16_t	crc;			///< running CRC-16 of everything written
+	uint32_t	written;		///< bytes passed to the outputs so far
+	BOOL		ok;				///< FALSE once a file write has failed
+} OUTPUT;
+
+/** One of the two buffers passed between the reading and writing threads.
+*/
+typedef struct
+{
+	uint8_t		*data;
+	uint32_t	addr;
+	uint32_t	len;			///< 0 while the buffer is free for reading into
+} CHUNK;
+
+static CHUNK			chunks[2];
+static BOOL				reading_done;
+static pthread_mutex_t	chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	chunk_cond = PTHREAD_COND_INITIALIZER;
+
+static void output_chunk( OUTPUT *out, const uint8_t *data,
+						  uint32_t addr, uint32_t len )
+{
+	uint32_t i;
+	ssize_t n;
+	for( i=0; out->bin!=-1 && i<len; i+=n )
+	{
+		n = write( out->bin, data+i, len-i );
+		if( n<=0 )
+		{
+			out->ok = FALSE;
+			break;
+		}
+	}
+	if( out->hex )
+	{
+		for( i=0; i<len; i++ )
+			ihex_hexout( out->hex, data[i], addr+i, 0 );
+	}
+	if( out->console )
+		dump_console( addr, data, len );
+	out->crc = ec2_crc16( out->crc, data, len );
+}
+
+/** Write each chunk out as soon as it has been read, in order, until the
+	reader is done.
+*/
+static void *writer_thread( void *arg )
+{
+	OUTPUT *out = (OUTPUT*)arg;
+	CHUNK *c;
+	int slot = 0;
+	for(;;)
+	{
+		c = &chunks[slot];
+		pthread_mutex_lock( &chunk_lock );
+		while( c->len==0 && !reading_done )
+			pthread_cond_wait( &chunk_cond, &chunk_lock );
+		pthread_mutex_unlock( &chunk_lock );
+		if( c->len==0 )
+			break;		// reader finished and nothing left
+		output_chunk( out, c->data, c->addr, c->len );
+		pthread_mutex_lock( &chunk_lock );
+		out->written += c->len;
+		c->len = 0;
+		pthread_cond_broadcast( &chunk_cond );
+		pthread_mutex_unlock( &chunk_lock );
+		slot ^= 1;
+	}
+	return 0;
+}
+
+/** Read the range chunk by chunk, double buffered so the adapter is busy
+	with the next chunk while the writer thread saves the previous one.
+	\returns TRUE if every read and write succeeded
+*/
+static BOOL stream_flash( OUTPUT *out, BOOL scratch, uint32_t start,
+						  uint32_t length, uint32_t chunk )
+{
+	pthread_t writer;
+	uint32_t addr, n, end = start + length;
+	int slot = 0;
+	BOOL ok = TRUE;
+
+	chunks[0].data = malloc( chunk );
+	chunks[1].data = malloc( chunk );
+	chunks[0].len = chunks[1].len = 0;
+	reading_done = FALSE;
+	if( !chunks[0].data || !chunks[1].data ||
+		pthread_create( &writer, 0, writer_thread, out )!=0 )
+	{
+		free( chunks[0].data );
+		free( chunks[1].data );
+		return FALSE;
+	}
+	for( addr=start; addr<end && ok; addr+=n, slot^=1 )
+	{
+		CHUNK *c = &chunks[slot];
+		n = end-addr < chunk ? end-addr : chunk;
+		pthread_mutex_lock( &chunk_lock );
+		while( c->len!=0 )
+			pthread_cond_wait( &chunk_cond, &chunk_lock );
+		pthread_mutex_unlock( &chunk_lock );
+		
+		if( scratch )
+			ok = ec2_read_flash_scratchpad( &obj, c->data, addr, n );
+		else
+			ok = ec2_read_flash( &obj, c->data, addr, n );
+		
+		pthread_mutex_lock( &chunk_lock );
+		if( ok )
+		{
+			c->addr = addr;
+			c->len = n;
+			pthread_cond_broadcast( &chunk_cond );
+		}
+		if( !out->console )
+		{
+			fprintf( stderr, "\rread %u of %u bytes, %u written",
+					 addr+n-start, length, out->written );
+		}
+		pthread_mutex_unlock( &chunk_lock );
+	}
+	pthread_mutex_lock( &chunk_lock );
+	reading_done = TRUE;
+	pthread_cond_broadcast( &chunk_cond );
+	pthread_mutex_unlock( &chunk_lock );
+	pthread_join( writer, 0 );
+	if( !out->console )
+		fprintf( stderr, "\rread %u of %u bytes, %u written\n",
+				 ok ? length : addr-start, length, out->written );
+	free( chunks[0].data );
+	free( chunks[1].data );
+	if( !ok )
+		printf("ERROR: read failed at 0x%05x\n", (unsigned)(addr-n) );
+	return ok && out->ok;
+}
+
+
 int main(int argc, char *argv[])
 {
 	uint8_t buf[0x20000];
 	char *port=0;
 	uint32_t start=0;
 	uint32_t length=0x20000;
+	uint32_t chunk=4096;
 	static int hex, bin, console, debug, help_flag, scratch_flag, out;
+	static int stream, crc;
 	static struct option long_options[] = 
 	{
 		{"hex", no_argument, &hex, 1},
@@ -79,6 +263,9 @@ int main(int argc, char *argv[])
 		{"debug", no_argument, &debug, 1},
 		{"help", no_argument, &help_flag, 'h'},
 		{"scratch", no_argument, &scratch_flag, 'z'},
+		{"stream", no_argument, &stream, 1},
+		{"crc", no_argument, &crc, 1},
+		{"chunk", required_argument, 0, 'k'},
 		{"mode", required_argument, 0, 'm'},
 		{"port", required_argument, 0, 'p'},
 		{"start", required_argument, 0, 's'},
@@ -110,6 +297,14 @@ int main(int argc, char *argv[])
 			case 'l':	// length of data to read
 				length = strtoul( optarg, 0, 0);
 				break;
+			case 'k':	// streaming chunk size, whole console lines
+				chunk = strtoul( optarg, 0, 0) & ~15;
+				if( chunk==0 )
+				{
+					printf("Error: --chunk must be at least 16\n");
+					exit(-1);
+				}
+				break;
 			case 'm':	// mode to use, JTAG / C2 / AUTO
 				if( strcasecmp( optarg, "AUTO" )==0 )
 					obj.mode = AUTO;
@@ -158,6 +353,44 @@ int main(int argc, char *argv[])
 		exit(-1);
 	}
 	
+	if( stream )
+	{
+		OUTPUT o;
+		BOOL ok;
+		o.bin = -1;
+		o.hex = 0;
+		o.console = console;
+		o.crc = 0xFFFF;
+		o.written = 0;
+		o.ok = TRUE;
+		if( (hex || bin) && argc-optind==1 )
+		{
+			if( hex )
+				o.hex = fopen( argv[optind], "w" );
+			else
+				o.bin = open( argv[optind], O_CREAT|O_WRONLY|O_TRUNC,
+							  S_IRUSR|S_IWUSR );
+			if( !o.hex && o.bin==-1 )
+			{
+				printf("ERROR: can't create %s\n", argv[optind] );
+				ec2_disconnect( &obj );
+				return EXIT_FAILURE;
+			}
+		}
+		ok = stream_flash( &o, scratch_flag, start, length, chunk );
+		if( o.hex )
+			ihex_hexout( o.hex, 0, 0, 1 );		// end record and close
+		if( o.bin!=-1 )
+		{
+			printf("%u bytes written\n", o.written );
+			close( o.bin );
+		}
+		if( crc )
+			printf("CRC-16 0x%04x\n", o.crc );
+		ec2_disconnect( &obj );
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	if( scratch_flag )
 		ec2_read_flash_scratchpad( &obj, buf, start, length );
 	else
@@ -166,7 +399,7 @@ int main(int argc, char *argv[])
 	if( hex )
 	{
 		if( argc-optind == 1 )
-			ihex_save_file( argv[optind], buf, 0, length );
+			ihex_save_file( argv[optind], buf, start, length );
 	}
 	
 	if(bin)
@@ -184,34 +417,9 @@ int main(int argc, char *argv[])
 	}
 	
 	if(console)
-	{
-		int j;
-		for( i=0; i<length; i+=16)
-		{
-			printf( "0x%05X  ", (unsigned int)(start+i) );
-			// print hex
-			for( j=0; j<16; j++ )
-			{
-				if( (i+j)<length )
-					printf( "%02X ", (unsigned char)buf[i+j] );
-				else
-					printf("   ");
-			}
-			putchar(' ');
-			// print ASCII
-			for( j=0; j<16; j++ )
-			{
-				if( (i+j)<length )
-				{	
-					if( isprint( buf[i+j] ) )
-						putchar( buf[i+j] );
-					else
-						putchar('.');
-				}
-			}
-			putchar('\n');
-		}
-	}
+		dump_console( start, buf, length );
+	if( crc )
+		printf("CRC-16 0x%04x\n", ec2_crc16( 0xFFFF, buf, length ) );
 	ec2_disconnect( &obj );
 	return EXIT_SUCCESS;
 }
@@ -29,6 +29,8 @@
 #include <signal.h>
 #include <unistd.h>
 #include "ec2drv.h"
+#include "gang.h"
+#include "flashprog.h"
 #include "ihex.h"
 void print_buf_dump( char *buf, int len )
 {
@@ -61,20 +63,145 @@ void help()
 		   "\t--hex                 File to upload is an intel hex format file\n"
 		   "\t--bin                 File to upload is a binary format file\n"
 		   "\t--port <serial dev>   Specify serial port to connect to EC2 on\n"
+		   "\t--gang <s1,s2,...>    Program several EC3s at once, identified by\n"
+		   "\t                      serial number (or full port names)\n"
 		   "\t--start <addr>        Address to write binary file too ( --bin mode only)\n"
 		   "\t--eraseall            Force complete erase of the devices flash memory\n"
+		   "\t--diff                Only erase and rewrite sectors that differ from\n"
+		   "\t                      the file\n"
+		   "\t--fast                Load, diff, erase, write and verify sector by\n"
+		   "\t                      sector with the stages overlapped ( --hex only),\n"
+		   "\t                      prints where the time went\n"
 		   "\t--scratch             Cause write to occure in scratchpad area of flash\n"
 		   "\t--mode                specify the mode of the debug interface.\n"
 		   "\t                      auto / jtag / c2 with auto being the default.\n"
+		   "\t--verify[=read|crc]   Check the flash contents after writing, either by\n"
+		   "\t                      reading it all back (default) or by CRC, which\n"
+		   "\t                      also reads it all but compares on the host\n"
 		   "\t--run                 Cause the target to be started after the flash\n"
 		   "\t                      write is complete\n"
 		   "\t--debug               Turn on debug tracing\n"
+		   "\t--trace               Print the last transfers with the debug adaptor\n"
+		   "\t                      when one fails\n"
 		   "\t--help                Display this help\n"
 		   "\n");
 }
 
+#define MAXPORTLEN 1024
+
 EC2DRV ec2obj;
 
+typedef enum { VERIFY_NONE, VERIFY_CRC, VERIFY_READ } VERIFY_METHOD;
+
+/** Check that flash holds the len bytes of buf starting at addr.
+	\returns TRUE if it does.
+*/
+BOOL verify_flash( uint8_t *buf, uint32_t addr, int len, VERIFY_METHOD method )
+{
+	uint16_t crc;
+	uint8_t *rbuf;
+	BOOL ok;
+
+	printf("Verifying 0x%05x - 0x%05x\n", addr, addr+len-1 );
+	if( method==VERIFY_CRC )
+	{
+		ok = ec2_read_flash_crc( &ec2obj, addr, len, &crc ) &&
+			 crc==ec2_crc16( 0xFFFF, buf, len );
+	}
+	else
+	{
+		rbuf = malloc( len );
+		ok = rbuf && ec2_read_flash( &ec2obj, rbuf, addr, len ) &&
+			 memcmp( rbuf, buf, len )==0;
+		free( rbuf );
+	}
+	printf( ok ? "Verify OK\n" : "Error: verify failed\n" );
+	return ok;
+}
+
+
+static void gang_progress( EC2_GANG_UNIT *unit, void *ctx )
+{
+	printf("[%s] %3i%% %s\n", unit->port, unit->progress, unit->result );
+}
+
+/** Program the image in buf into every adapter listed in the comma
+	separated list.
+	\returns EXIT_SUCCESS if they all succeeded.
+*/
+int gang_write( char *list, uint8_t *buf, uint32_t start, int len,
+				VERIFY_METHOD verify )
+{
+	EC2_GANG_UNIT units[16];
+	char names[16][MAXPORTLEN];
+	char *tok;
+	int i, n = 0;
+	BOOL ok;
+
+	memset( units, 0, sizeof(units) );
+	for( tok=strtok( list, "," ); tok && n<16; tok=strtok( 0, "," ) )
+	{
+		// bare serial numbers are EC3's
+		if( strncmp( tok, "USB", 3 )==0 || strchr( tok, '/' ) || strchr( tok, ':' ) )
+			strncpy( names[n], tok, MAXPORTLEN );
+		else
+			snprintf( names[n], MAXPORTLEN, "USB:%s", tok );
+		units[n].port = names[n];
+		units[n].obj.mode = ec2obj.mode;
+		units[n].obj.debug = ec2obj.debug;
+		units[n].obj.trace_dump_on_error = ec2obj.trace_dump_on_error;
+		n++;
+	}
+	printf("Gang programming %i adapters, 0x%05x - 0x%05x\n",
+		   n, start, start+len-1 );
+	ok = ec2_gang_write_flash( units, n, buf, start, len,
+							   verify!=VERIFY_NONE, gang_progress, 0 );
+	printf("\nResults:\n");
+	for( i=0; i<n; i++ )
+		printf("\t%-24s %s\n", units[i].port, units[i].result );
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void print_stage( const char *name, uint64_t us, uint64_t total )
+{
+	printf("\t%-8s %8.1f ms %5.1f%%\n", name, us/1000.0,
+		   total ? us*100.0/total : 0.0 );
+}
+
+/** Report the outcome of ec2_program_hex().
+*/
+static void print_prog_stats( const EC2_PROG_STATS *s )
+{
+	printf("%u bytes in %i sectors: %i unchanged, %i written, %i erased",
+		   s->bytes, s->sectors, s->unchanged, s->written, s->erased );
+	if( s->revisited )
+		printf(", %i done again", s->revisited );
+	printf("\n");
+	print_stage( "load", s->load_us, s->total_us );
+	print_stage( "wait", s->wait_us, s->total_us );
+	print_stage( "diff", s->diff_us, s->total_us );
+	print_stage( "erase", s->erase_us, s->total_us );
+	print_stage( "write", s->write_us, s->total_us );
+	print_stage( "verify", s->verify_us, s->total_us );
+	print_stage( "total", s->total_us, s->total_us );
+}
+
+/** Load all the hex files into one image and flatten it into buf, which is
+	already filled with the erased value.
+	\param img		initialised image to receive the files
+	\returns FALSE if any file failed to load.
+*/
+static BOOL load_hex_files( char **files, int n, IHEX_IMAGE *img,
+							uint8_t *buf, uint32_t *start, uint32_t *end )
+{
+	BOOL ok = TRUE;
+	int i;
+
+	for( i=0; i<n && ok; i++ )
+		ok = ihex_read( files[i], img );
+	return ok && ihex_flatten( img, buf, 0x20000, start, end );
+}
+
 void exit_func(void)
 {
 	printf("Exiting now\n");
@@ -84,25 +211,35 @@ void exit_func(void)
 
 
 
-#define MAXPORTLEN 1024
 int main(int argc, char *argv[])
 {
 	uint8_t buf[0x20000];
-	char port[MAXPORTLEN];
+	IHEX_IMAGE img;
+	char port[MAXPORTLEN] = "";
+	char *gang = 0;
 	int in, cnt;
+	BOOL ok = TRUE;
 	uint32_t start=0, end=0;
-	static int hex, bin, run, eraseall, debug, help_flag, scratch_flag;
+	static int hex, bin, run, eraseall, debug, trace, help_flag, scratch_flag, diff;
+	static int fast;
+	EC2_PROG_STATS stats;
+	VERIFY_METHOD verify = VERIFY_NONE;
 	static struct option long_options[] = 
 	{
 		{"hex", no_argument, &hex, 1},
 		{"bin", no_argument, &bin, 1},
 		{"debug", no_argument, &debug, 1},
+		{"trace", no_argument, &trace, 1},
 		{"eraseall", no_argument, &eraseall, 'e'},
+		{"diff", no_argument, &diff, 1},
+		{"fast", no_argument, &fast, 1},
 		{"scratch", no_argument, &scratch_flag, 'z'},
 		{"mode", required_argument, 0, 'm'},
 		{"port", required_argument, 0, 'p'},
+		{"gang", required_argument, 0, 'g'},
 		{"start", required_argument, 0, 's'},
 		{"run", no_argument, &run, 1},
+		{"verify", optional_argument, 0, 'v'},
 		{"help", no_argument, &help_flag, 'h'},
 		{0, 0, 0, 0}
 	};
@@ -127,6 +264,9 @@ int main(int argc, char *argv[])
 				printf("port = %s\n",optarg);
 				strncpy( port, optarg, MAXPORTLEN );
 				break;
+			case 'g':	// list of adapters to gang program
+				gang = optarg;
+				break;
 			case 's':	// start address, for bin mode only
 				start = strtoul( optarg, 0, 0);
 				break;
@@ -144,6 +284,17 @@ int main(int argc, char *argv[])
 					exit(-1);
 				}
 				break;
+			case 'v':	// verify method, READ / CRC
+				if( !optarg || strcasecmp( optarg, "READ" )==0 )
+					verify = VERIFY_READ;
+				else if( strcasecmp( optarg, "CRC" )==0 )
+					verify = VERIFY_CRC;
+				else
+				{
+					printf("Error: unsupported verify method, supported methods are READ / CRC.\n");
+					exit(-1);
+				}
+				break;
 			default:
 				printf("unexpected option\n");
 				break;
@@ -151,8 +302,9 @@ int main(int argc, char *argv[])
 	};
 	if(debug)
 		ec2obj.debug=TRUE;
+	ec2obj.trace_dump_on_error = trace;
 
-	if( help_flag || strlen(port)==0 )
+	if( help_flag || (strlen(port)==0 && !gang) )
 	{
 		help();
 		return  help_flag ? EXIT_SUCCESS : EXIT_FAILURE;
@@ -163,7 +315,31 @@ int main(int argc, char *argv[])
 		printf("ERROR :- you can either use binary or hex but not both!\n");
 		return EXIT_FAILURE;
 	}
+	if( fast && (!hex || gang || scratch_flag) )
+	{
+		printf("ERROR: --fast only writes hex files to one target's flash\n");
+		return EXIT_FAILURE;
+	}
 	memset( buf, 0xFF, sizeof(buf) );	// 0xFF to match erased state fo flash memory
+	if( gang )
+	{
+		if( hex )
+		{
+			ihex_init( &img );
+			if( !load_hex_files( argv+optind, argc-optind, &img, buf, &start, &end ) )
+				return EXIT_FAILURE;
+			return gang_write( gang, &buf[start], start, end-start+1, verify );
+		}
+		in = (argc-optind)==1 ? open( argv[optind], O_RDONLY, 0) : -1;
+		if( in<0 )
+		{
+			printf("ERROR: binary mode only supports one file at a time\n");
+			return EXIT_FAILURE;
+		}
+		cnt = read( in, buf, sizeof(buf) );
+		close( in );
+		return gang_write( gang, buf, start, cnt, verify );
+	}
 	if( ec2_connect( &ec2obj, port ) )
 	{
 		printf("FOUND:\n");
@@ -181,6 +357,8 @@ int main(int argc, char *argv[])
 	else
 	{
 		printf("ERROR: coulden't communicate with the EC2 debug adaptor\n");
+		if( trace )
+			ec2_trace_dump( &ec2obj, stderr );
 		exit(-1);
 	}
 	
@@ -198,23 +376,73 @@ int main(int argc, char *argv[])
 				   " hex files into the device\n");
 			return EXIT_FAILURE;
 		}
-		// load all specified files into the buffer
-		
-		for( i = optind; i < argc; i++)
+		if( fast )
 		{
-			ihex_load_file( argv[i], buf, &start, &end );
+			// the files are loaded as the sectors are programmed
+			printf("Writing to flash\n");
+			if( !ec2_program_hex( &ec2obj, argv+optind, argc-optind,
+								  verify!=VERIFY_NONE, &stats ) )
+			{
+				print_prog_stats( &stats );
+				if( stats.load_ok )
+					printf("Error: flash write failed\n");
+				else
+					printf("Error: couldn't load the hex files\n");
+				if( trace )
+					ec2_trace_dump( &ec2obj, stderr );
+				return EXIT_FAILURE;
+			}
+			print_prog_stats( &stats );
+			if( verify )
+				printf("Verify OK\n");
+			printf("done\n");
 		}
-		printf("Writing to flash\n");
-		printf("start=0x%05x, end=0x%05x\n",start,end);
-		if( scratch_flag )
-			ec2_write_flash_scratchpad_merge( &ec2obj, &buf[start],
-			                                  start, end-start+1 );
 		else
 		{
-			ec2_write_flash_auto_erase( &ec2obj, &buf[start], start,
-									 end-start+1 );
+			// load all specified files into the buffer
+			ihex_init( &img );
+			if( !load_hex_files( argv+optind, argc-optind, &img, buf, &start, &end ) )
+				return EXIT_FAILURE;
+			printf("Writing to flash\n");
+			printf("start=0x%05x, end=0x%05x\n",start,end);
+			if( scratch_flag )
+				ok = ec2_write_flash_scratchpad_merge( &ec2obj, &buf[start],
+				                                       start, end-start+1 );
+			else
+			{
+				// only the segments with data, the gaps are left as they are
+				for( i=0; i<img.count; i++ )
+					printf("\t0x%05x - 0x%05x\n", img.seg[i].addr,
+						   img.seg[i].addr+img.seg[i].len-1 );
+				if( diff )
+				{
+					for( i=0; i<img.count && ok; i++ )
+						ok = ec2_write_flash_diff( &ec2obj, img.seg[i].data,
+												   img.seg[i].addr, img.seg[i].len );
+				}
+				else
+					ok = ec2_write_flash_image( &ec2obj, &img );
+			}
+			if( !ok )
+			{
+				printf("Error: flash write failed\n");
+				if( trace )
+					ec2_trace_dump( &ec2obj, stderr );
+				ihex_free( &img );
+				return EXIT_FAILURE;
+			}
+			if( !scratch_flag )
+			{
+				for( i=0; i<img.count && verify; i++ )
+				{
+					if( !verify_flash( img.seg[i].data, img.seg[i].addr,
+									   img.seg[i].len, verify ) )
+						return EXIT_FAILURE;
+				}
+			}
+			ihex_free( &img );
+			printf("done\n");
 		}
-		printf("done\n");
 	}
 	
 	if(bin)
@@ -233,27 +461,44 @@ int main(int argc, char *argv[])
 			{
 				if( (start+cnt) <= ec2obj.dev->scratchpad_len )
 				{
-					ec2_write_flash_scratchpad_merge( &ec2obj, buf,
-					                                  start, cnt );
-					printf("%i bytes written\n",cnt);
+					ok = ec2_write_flash_scratchpad_merge( &ec2obj, buf,
+					                                       start, cnt );
+					if( ok )
+						printf("%i bytes written\n",cnt);
 				}
 				else
 				{
 					printf("Bin file too long, writing first %i bytes\n",
 						   ec2obj.dev->scratchpad_len-start);
-					ec2_write_flash_scratchpad_merge( &ec2obj, buf,
+					ok = ec2_write_flash_scratchpad_merge( &ec2obj, buf,
 							start, ec2obj.dev->scratchpad_len-start );
 				}
+				if( !ok )
+				{
+					printf("Error: flash write failed\n");
+					if( trace )
+						ec2_trace_dump( &ec2obj, stderr );
+					close( in );
+					return EXIT_FAILURE;
+				}
 			}
 			else
 			{
-				if( ec2_write_flash( &ec2obj, buf, start, cnt ) )
+				if( diff ? ec2_write_flash_diff( &ec2obj, buf, start, cnt )
+						 : ec2_write_flash( &ec2obj, buf, start, cnt ) )
 				{
 					printf("%i bytes written successfully\n",cnt);
+					if( verify && !verify_flash( buf, start, cnt, verify ) )
+					{
+						close( in );
+						return EXIT_FAILURE;
+					}
 				}
 				else
 				{
 					printf("Error: flash write failed\n");
+					if( trace )
+						ec2_trace_dump( &ec2obj, stderr );
 					close( in );
 					return EXIT_FAILURE;
 				}
@@ -0,0 +1,337 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White                                     *
+ *   rickyw@sourceforge.net                                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <iostream>
+#include <algorithm>
+#include "types.h"
+#include "memremap.h"
+#include "target.h"
+#include "cmdbatch.h"
+#include "newcdb.h"
+
+#define BATCH_MAX_OPS	256		///< queue length that forces a flush
+#define BATCH_READ_GAP	16		///< unused bytes we read to join two reads
+#define BATCH_READ_MAX	1024	///< largest block read in one go
+
+bool CmdCheck::direct( string cmd )
+{
+	TOKEN tokens[4];
+	int n = Tokenize( cmd, tokens, 4 );
+	if( n<3 || n>4 || !token_is( tokens[1], "=" ) )
+	{
+		cout << "ERROR: format must be check ADDR = VALUE [MASK]" << endl;
+		return true;
+	}
+	uint32_t flat_addr = token_ul( tokens[0] );
+	uint8_t expect = token_ul( tokens[2] );
+	uint8_t mask = n==4 ? token_ul( tokens[3] ) : 0xff;
+	unsigned char b;
+	if( !gSession.target()->read_memory( flat_addr, 1, &b ) )
+		cout << "ERROR: invalid address" << endl;
+	else if( (b & mask)==(expect & mask) )
+		cout << "OK" << endl;
+	else
+		printf( "FAILED, read 0x%02x\n", b );
+	return true;
+}
+
+
+BatchQueue::BatchQueue()
+	: mJson(false), mFailures(0), mChecks(0)
+{
+}
+
+/** Parse a line we can queue.
+	\returns false if it's something else or needs to run in order.
+*/
+bool BatchQueue::parse( const string &ln, OP &op )
+{
+	ParseCmd::TOKEN tokens[5];
+	size_t p = ln.find_first_not_of( " \t" );
+	if( p==string::npos )
+		return false;
+	string s = ln.substr( p );
+	op.text = s;
+	op.ok = true;
+	op.mask = 0xff;
+	op.unit_size = 1;
+
+	if( s[0]=='x' && s.find_first_not_of( " \t", 1 )!=string::npos &&
+		s[s.find_first_not_of( " \t", 1 )]=='/' )
+	{
+		// x/NxU ADDR, hex only, without a unit x would use the last one
+		const char *c = s.c_str() + s.find( '/' ) + 1;
+		char *end;
+		uint32_t n = strtoul( c, &end, 10 );
+		if( end==c )
+			n = 1;
+		int unit = 0;
+		for( c=end; *c && !isspace(*c); c++ )
+		{
+			switch( *c )
+			{
+				case 'x':	break;
+				case 'b':	unit = 1;	break;
+				case 'h':	unit = 2;	break;
+				case 'w':	unit = 4;	break;
+				case 'g':	unit = 8;	break;
+				default:	return false;	// i, s etc run as usual
+			}
+		}
+		while( isspace(*c) )
+			c++;
+		if( unit==0 || n==0 || !*c )
+			return false;
+		op.type = OP_READ;
+		op.flat_addr = strtoul( c, 0, 0 );
+		op.unit_size = unit;
+		op.len = n*unit;
+		return true;
+	}
+
+	size_t sp = s.find( ' ' );
+	bool change = s.compare( 0, sp, "change" )==0;
+	if( sp==string::npos || (!change && s.compare( 0, sp, "check" )!=0) )
+		return false;
+	int n = ParseCmd::Tokenize( s, tokens, 5, " \t" ) - 1;	// less the name
+	if( n<3 || !ParseCmd::token_is( tokens[2], "=" ) || tokens[1].start[0]=='$' )
+		return false;
+	op.flat_addr = ParseCmd::token_ul( tokens[1] );
+	op.len = 1;
+	op.data.assign( 1, ParseCmd::token_ul( tokens[3] ) );
+	char area;
+	if( MemRemap::target( op.flat_addr, area )==INVALID_ADDR )
+		return false;
+	if( change )
+	{
+		// SFR writes can change what other addresses read, code can't be
+		// changed at all, both run in order through the change command
+		if( n!=3 || area=='s' || area=='c' )
+			return false;
+		op.type = OP_WRITE;
+		return true;
+	}
+	if( n>4 )
+		return false;
+	op.type = OP_CHECK;
+	if( n==4 )
+		op.mask = ParseCmd::token_ul( tokens[4] );
+	return true;
+}
+
+/// true if op reads bytes a queued write changes or the other way round
+bool BatchQueue::conflicts( const OP &op )
+{
+	bool write = op.type==OP_WRITE;
+	for( size_t i=0; i<mQueue.size(); i++ )
+	{
+		if( (mQueue[i].type==OP_WRITE)!=write &&
+			op.flat_addr < mQueue[i].flat_addr+mQueue[i].len &&
+			mQueue[i].flat_addr < op.flat_addr+op.len )
+			return true;
+	}
+	return false;
+}
+
+bool BatchQueue::queue( const string &ln, int line_no )
+{
+	OP op;
+	if( !parse( ln, op ) )
+		return false;
+	op.line_no = line_no;
+	if( conflicts( op ) || mQueue.size()>=BATCH_MAX_OPS )
+		flush();
+	mQueue.push_back( op );
+	return true;
+}
+
+/** Merge the queued writes into runs of adjacent bytes, in script order so
+	the last write to a byte wins, and write each run in one transfer.
+*/
+void BatchQueue::run_writes()
+{
+	map<uint32_t,uint8_t> bytes;
+	for( size_t i=0; i<mQueue.size(); i++ )
+		if( mQueue[i].type==OP_WRITE )
+			for( uint32_t j=0; j<mQueue[i].len; j++ )
+				bytes[mQueue[i].flat_addr+j] = mQueue[i].data[j];
+
+	map<uint32_t,uint8_t>::iterator it = bytes.begin();
+	while( it!=bytes.end() )
+	{
+		vector<unsigned char> run;
+		uint32_t start = it->first;
+		char area, start_area = 0;
+		MemRemap::target( start, start_area );
+		do
+		{
+			run.push_back( it->second );
+			++it;
+		} while( it!=bytes.end() && it->first==start+run.size() &&
+				 MemRemap::target( it->first, area )!=INVALID_ADDR &&
+				 area==start_area );
+		if( gSession.target()->write_memory( start, run.size(), &run[0] ) )
+			continue;
+		for( size_t i=0; i<mQueue.size(); i++ )
+			if( mQueue[i].type==OP_WRITE && mQueue[i].flat_addr>=start &&
+				mQueue[i].flat_addr<start+run.size() )
+				mQueue[i].ok = false;
+	}
+}
+
+/** Join the queued reads and checks into blocks, allowing small gaps, read
+	each block in one transfer and hand the bytes back to the operations.
+*/
+void BatchQueue::run_reads()
+{
+	vector< pair<uint32_t,uint32_t> > ranges;	// start, end
+	for( size_t i=0; i<mQueue.size(); i++ )
+		if( mQueue[i].type!=OP_WRITE )
+			ranges.push_back( make_pair( mQueue[i].flat_addr,
+										 mQueue[i].flat_addr+mQueue[i].len ) );
+	sort( ranges.begin(), ranges.end() );
+
+	size_t r = 0;
+	while( r<ranges.size() )
+	{
+		uint32_t start = ranges[r].first, end = ranges[r].second;
+		char area, start_area = 0;
+		MemRemap::target( start, start_area );
+		for( r++; r<ranges.size(); r++ )
+		{
+			uint32_t new_end = max( end, ranges[r].second );
+			if( ranges[r].first > end+BATCH_READ_GAP ||
+				new_end-start > BATCH_READ_MAX ||
+				MemRemap::target( new_end-1, area )==INVALID_ADDR ||
+				area!=start_area )
+				break;
+			end = new_end;
+		}
+		vector<unsigned char> buf( end-start );
+		bool ok = gSession.target()->read_memory( start, end-start, &buf[0] );
+		for( size_t i=0; i<mQueue.size(); i++ )
+		{
+			OP &op = mQueue[i];
+			if( op.type==OP_WRITE || op.flat_addr<start ||
+				op.flat_addr+op.len>end )
+				continue;
+			if( !ok )
+			{
+				op.ok = false;
+				continue;
+			}
+			const unsigned char *p = &buf[op.flat_addr-start];
+			if( op.type==OP_READ )
+				op.data.assign( p, p+op.len );
+			else
+			{
+				op.ok = (p[0] & op.mask)==(op.data[0] & op.mask);
+				op.data.push_back( p[0] );	// data[1] is what we read
+			}
+		}
+	}
+}
+
+void BatchQueue::flush()
+{
+	if( mQueue.empty() )
+		return;
+	// nothing queued depends on anything else queued, so order is free
+	run_writes();
+	run_reads();
+	for( size_t i=0; i<mQueue.size(); i++ )
+	{
+		if( mQueue[i].type==OP_CHECK )
+			mChecks++;
+		if( !mQueue[i].ok )
+			mFailures++;
+		if( mJson )
+			result( mQueue[i] );
+		else
+			mDone.push_back( mQueue[i] );
+	}
+	mQueue.clear();
+}
+
+/// print the outcome of one operation
+void BatchQueue::result( const OP &op )
+{
+	if( mJson )
+	{
+		static const char *names[] = { "read", "write", "check" };
+		printf( "{\"line\":%i,\"op\":\"%s\",\"addr\":\"0x%08x\",\"ok\":%s",
+				op.line_no, names[op.type], op.flat_addr,
+				op.ok ? "true" : "false" );
+		if( op.type==OP_READ && op.ok )
+		{
+			printf( ",\"data\":[" );
+			for( uint32_t i=0; i<op.len; i+=op.unit_size )
+			{
+				printf( "%s\"0x", i ? "," : "" );
+				for( int j=0; j<op.unit_size; j++ )
+					printf( "%02x", op.data[i+j] );
+				printf( "\"" );
+			}
+			printf( "]" );
+		}
+		else if( op.type==OP_CHECK && op.data.size()>1 )
+			printf( ",\"expect\":\"0x%02x\",\"mask\":\"0x%02x\",\"actual\":\"0x%02x\"",
+					op.data[0], op.mask, op.data[1] );
+		printf( "}\n" );
+		return;
+	}
+	if( op.type==OP_READ && op.ok )
+	{
+		// as x prints it
+		cout << op.text << endl;
+		for( uint32_t i=0; i<op.len; i+=op.unit_size )
+		{
+			printf( "0x" );
+			for( int j=0; j<op.unit_size; j++ )
+				printf( "%02x", op.data[i+j] );
+			printf( "\n" );
+		}
+	}
+	else if( op.type==OP_CHECK && op.data.size()>1 )
+	{
+		if( op.ok )
+			printf( "%i: %s: OK\n", op.line_no, op.text.c_str() );
+		else
+			printf( "%i: %s: FAILED, read 0x%02x\n", op.line_no,
+					op.text.c_str(), op.data[1] );
+	}
+	else if( !op.ok )
+		printf( "%i: %s: FAILED\n", op.line_no, op.text.c_str() );
+}
+
+int BatchQueue::report()
+{
+	flush();
+	for( size_t i=0; i<mDone.size(); i++ )
+		result( mDone[i] );
+	mDone.clear();
+	if( mJson )
+		printf( "{\"checks\":%i,\"failures\":%i}\n", mChecks, mFailures );
+	else
+		printf( "%i checks, %i failures\n", mChecks, mFailures );
+	return mFailures;
+}
@@ -0,0 +1,108 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ricky White                                     *
+ *   rickyw@sourceforge.net                                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef CMDBATCH_H
+#define CMDBATCH_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "parsecmd.h"
+
+/** `check ADDR = VALUE [MASK]'
+	Read the byte at the flat address ADDR and compare it with VALUE, only
+	the bits set in MASK (default 0xff) are compared.
+*/
+class CmdCheck : public CmdShowSetInfoHelp
+{
+public:
+	CmdCheck()	{ name="check"; }
+	bool direct( string cmd );
+};
+
+
+/** Memory operations from a batch script, run as a few bulk transfers.
+
+	Script lines of the form `x/NxU ADDR', `change ADDR = VALUE' and
+	`check ADDR = VALUE [MASK]' are queued rather than run.  Queued
+	operations never touch bytes another operation in the queue depends on,
+	so the writes are merged into runs of adjacent bytes and the reads into
+	spanning blocks, each issued as one Target transfer which the targets
+	pass down to their pipelined driver paths.  Any other command, an
+	operation that overlaps the queue or an SFR write (which may change
+	what other addresses read back) runs the queue first.
+
+	Results are held and printed by report() in script order, or as one
+	JSON object per line as soon as each group has run.
+
+	@author Ricky White <rickyw@neatstuff.co.nz>
+*/
+class BatchQueue
+{
+public:
+	BatchQueue();
+
+	void set_json( bool json )		{ mJson = json; }
+
+	/** Queue a script line.
+		\param ln		Command line
+		\param line_no	Line number in the script, used in the results
+		\returns false if the line isn't a memory operation, the caller must
+				 flush() then run it as usual.
+	*/
+	bool queue( const std::string &ln, int line_no );
+
+	/** Run everything queued.
+	*/
+	void flush();
+
+	/** Print the held results, nothing in JSON mode.
+		\returns the number of failed checks and transfers in the script.
+	*/
+	int report();
+
+protected:
+	typedef enum { OP_READ, OP_WRITE, OP_CHECK } OP_TYPE;
+	typedef struct
+	{
+		OP_TYPE		type;
+		int			line_no;
+		std::string	text;			///< script line, for the results
+		uint32_t	flat_addr;
+		uint32_t	len;
+		int			unit_size;		///< bytes per line printed for reads
+		std::vector<uint8_t> data;	///< write data / expected bytes / bytes read
+		uint8_t		mask;			///< bits compared by a check
+		bool		ok;
+	} OP;
+
+	std::vector<OP>		mQueue;		///< waiting for flush()
+	std::vector<OP>		mDone;		///< run, waiting for report()
+	bool				mJson;
+	int					mFailures;
+	int					mChecks;
+
+	bool parse( const std::string &ln, OP &op );
+	bool conflicts( const OP &op );
+	void run_writes();
+	void run_reads();
+	void result( const OP &op );
+};
+
+#endif
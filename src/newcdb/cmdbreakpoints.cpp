@@ -118,15 +118,14 @@ bool CmdClear::directnoarg()
 
 bool CmdDelete::direct( string cmd )
 {
-	vector <string> token;
-	Tokenize( cmd, token );
-	if( token.size()==0 )
+	TOKEN token;
+	string::size_type pos = 0;
+	if( cmd.find_first_not_of(' ')==string::npos )
 		return false;
 	
-	for( int i=0; i<token.size(); i++ )
+	while( next_token( cmd, pos, token ) )
 	{
-		if( !gSession.bpmgr()->clear_breakpoint_id( strtoul( token[i].c_str(),
-															0, 10 ) ) )
+		if( !gSession.bpmgr()->clear_breakpoint_id( token_ul( token, 10 ) ) )
 			return false;
 	}
 	return true;
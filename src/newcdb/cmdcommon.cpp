@@ -27,11 +27,23 @@
 #include "types.h"
 #include "cmdcommon.h"
 #include "target.h"
+#include "memremap.h"
 #include "module.h"
 #include "cdbfile.h"
 #include "breakpointmgr.h"
 #include "linespec.h"
 #include "contextmgr.h"
+#include "inst8051.h"
+#include "sampler.h"
+#include "recorder.h"
+#include "coverage.h"
+#include "backtrace.h"
+#include "runmonitor.h"
+#include "varmonitor.h"
+#include "expression.h"
+#include "snapshot.h"
+#include "symtab.h"
+#include "symtypetree.h"
 #include "newcdb.h"
 
 using namespace std;
@@ -209,23 +221,218 @@ bool CmdTarget::show( string cmd )
 }
 
 
-/** cause the target to step one source level instruction
+/** Run the target until it hits a breakpoint, with step breakpoints at addrs.
+	If they can't all be placed a single instruction is stepped instead, the
+	callers loop until they reach where they are going.
+	\returns the address stopped at.
 */
-bool CmdStep::directnoarg()
+static ADDR run_to_step_bps( vector<ADDR> &addrs )
+{
+	for( int i=0; i<addrs.size(); i++ )
+	{
+		if( !gSession.bpmgr()->add_step_bp( addrs[i] ) )
+		{
+			gSession.bpmgr()->clear_step_bps();
+			return gSession.target()->step();
+		}
+	}
+	gSession.bpmgr()->sync_target();
+	gSession.target()->run_to_bp();
+	gSession.bpmgr()->clear_step_bps();
+	return gSession.target()->read_PC();
+}
+
+/** true if addr is inside a function we have C line information for.
+*/
+static bool has_c_code( ADDR addr )
+{
+	ADDR start, end;
+	return gSession.symtab()->get_c_block( addr, start, end );
+}
+
+/** true if a C line starts at addr.
+*/
+static bool is_c_line( ADDR addr )
+{
+	const ModuleMgr::ADDR_LINE *src = gSession.modulemgr()->find_addr( addr );
+	return src && src->c_module;
+}
+
+#define SFR_SP			0x81
+
+/** Run to a return address.
+	A deeper call returning to the same address (recursion) is recognised by
+	the stack pointer, stepped off and run on past.
+	\param ret	Address to stop at
+	\param sp	Stack pointer expected once the call has returned
+	\returns the address stopped at.
+*/
+static ADDR run_to_return( ADDR ret, uint8_t sp )
 {
-	string module;
-	LINE_NUM line;
 	ADDR addr;
-	// keep stepping over asm instructions until we hit another c function
-	do
+	uint8_t cur_sp;
+	if( !gSession.bpmgr()->add_step_bp( ret ) )
+		return gSession.target()->read_PC();
+	while( true )
 	{
+		gSession.bpmgr()->sync_target();
+		gSession.target()->run_to_bp();
+		addr = gSession.target()->read_PC();
+		if( addr!=ret || gSession.target()->check_stop_forced() )
+			break;		// stopped for some other reason
+		gSession.target()->read_sfr( SFR_SP, 1, &cur_sp );
+		if( cur_sp<=sp )
+			break;
+		// a go from a breakpoint would stop on it again straight away
 		addr = gSession.target()->step();
-		gSession.bpmgr()->stopped(addr);
-		gSession.contextmgr()->set_context(addr);
+		if( gSession.target()->check_stop_forced() )
+			break;
+	}
+	gSession.bpmgr()->clear_step_bps();
+	return addr;
+}
+
+/** Execute one instruction.
+	\param over	true to run over calls using a breakpoint on the return
+				address, false to step into them.
+	\param into_c_only	when stepping into calls, run over any that go to
+				code without line information.
+	\returns the address stopped at.
+*/
+static ADDR step_instruction( bool over, bool into_c_only=false )
+{
+	uint8_t code[Inst8051::MAX_LENGTH];
+	uint8_t sp;
+	ADDR pc = gSession.target()->read_PC();
+	ADDR target;
+	int len;
+	gSession.target()->read_memory( MemRemap::flat( pc, 'c' ), sizeof(code), code );
+	if( Inst8051::decode( pc, code, len, target )==Inst8051::FLOW_CALL &&
+		(over || (into_c_only && !has_c_code( target ))) &&
+		gSession.bpmgr()->free_bps()>0 )
+	{
+		gSession.target()->read_sfr( SFR_SP, 1, &sp );
+		return run_to_return( (pc+len) & 0xffff, sp );
+	}
+	return gSession.target()->step();
+}
+
+/** true if ret is the address after a call to func.
+	\param func	start of the called function, -1 to accept a call to anywhere
+*/
+static bool is_return_addr( ADDR ret, ADDR func )
+{
+	uint8_t code[3+Inst8051::MAX_LENGTH];
+	ADDR target;
+	int len;
+	if( ret<3 )
+		return false;
+	gSession.target()->read_memory( MemRemap::flat( ret-3, 'c' ), sizeof(code), code );
+	// LCALL at ret-3 or ACALL at ret-2
+	for( int i=0; i<2; i++ )
+	{
+		if( Inst8051::decode( ret-3+i, &code[i], len, target )==Inst8051::FLOW_CALL &&
+			len==3-i && (func==-1 || target==func) )
+			return true;
+	}
+	return false;
+}
+
+/** Work out every address execution can leave [addr,end] by.
+	\param into		true to include calls to functions with line information
+	\param[out] exits	addresses outside the range that execution can reach
+	\param[out] rets	RET instructions inside the range, the return
+						address is only known once the stack is unwound.
+	\returns false if the exits can't be determined (indirect jump).
+*/
+static bool find_exits( ADDR addr, ADDR end, bool into,
+						vector<ADDR> &exits, vector<ADDR> &rets )
+{
+	vector<uint8_t> code( end-addr+1+Inst8051::MAX_LENGTH );
+	Inst8051::FLOW flow = Inst8051::FLOW_NEXT;
+	ADDR pc, target;
+	int len;
+
+	gSession.target()->read_memory( MemRemap::flat( addr, 'c' ), code.size(),
+									&code[0] );
+	for( pc=addr; pc<=end; pc+=len )
+	{
+		flow = Inst8051::decode( pc, &code[pc-addr], len, target );
+		switch( flow )
+		{
+			case Inst8051::FLOW_JUMP:
+			case Inst8051::FLOW_BRANCH:
+				if( target<addr || target>end )
+					exits.push_back( target );
+				break;
+			case Inst8051::FLOW_CALL:
+				if( into && has_c_code( target ) )
+					exits.push_back( target );
+				break;
+			case Inst8051::FLOW_RET:
+				rets.push_back( pc );
+				break;
+			case Inst8051::FLOW_INDIRECT:
+				return false;
+			default:
+				break;
+		}
+	}
+	if( flow!=Inst8051::FLOW_JUMP && flow!=Inst8051::FLOW_RET )
+		exits.push_back( pc & 0xffff );		// falls off the end of the range
+	sort( exits.begin(), exits.end() );
+	exits.erase( unique( exits.begin(), exits.end() ), exits.end() );
+	return true;
+}
+
+/** Run to the start of the next C line by range stepping.
+	The run of code for the current line is decoded, a step breakpoint is
+	placed on every exit from it and the target is run, so a whole line
+	normally costs one run rather than a step per instruction.  Leaving by
+	a RET is caught by a breakpoint on the RET followed by a single step.
+	Single stepping is only used when the exits can't all be covered, by an
+	indirect jump or by running out of breakpoints.
+
+	\param into	true to stop in called functions (step), false to run over
+				them (next).
+	\returns the address stopped at.
+*/
+static ADDR range_step( bool into )
+{
+	ADDR addr, start, end;
+
+	// leave the current line start, this also avoids running with a
+	// breakpoint on the PC.
+	addr = step_instruction( !into, true );
+	while( !is_c_line( addr ) &&
+		   !gSession.target()->check_stop_forced() &&
+		   !gSession.bpmgr()->active_bp_at( addr ) )
+	{
+		vector<ADDR> exits, rets;
+		if( !gSession.symtab()->get_c_block( addr, start, end ) ||
+			!find_exits( addr, end, into, exits, rets ) ||
+			exits.size()+rets.size() > gSession.bpmgr()->free_bps() )
+		{
+			addr = step_instruction( !into, true );
+			continue;
+		}
+		exits.insert( exits.end(), rets.begin(), rets.end() );
+		addr = run_to_step_bps( exits );
+		if( find( rets.begin(), rets.end(), addr )!=rets.end() )
+			addr = gSession.target()->step();	// return to the caller
 	}
-	while( !gSession.modulemgr()->get_c_addr( addr, module, line ) && 
-			   !gSession.target()->check_stop_forced());
+	return addr;
+}
+
+/** cause the target to step one source level instruction
+*/
+bool CmdStep::directnoarg()
+{
+	ADDR addr = range_step( true );
+	gSession.bpmgr()->stopped(addr);
+	gSession.contextmgr()->set_context(addr);
 	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
 	return true;
 }
 
@@ -237,6 +444,7 @@ bool CmdStepi::directnoarg()
 	gSession.bpmgr()->stopped(addr);
 	gSession.contextmgr()->set_context(addr);
 	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
 	return true;
 }
 
@@ -246,54 +454,87 @@ bool CmdStepi::directnoarg()
 	Execution stops when control reaches a different line of code at the
 	original stack level that was executing when you gave the next command.
 	This command is abbreviated n.
-
-	@FIXME: change from step implementation to proper next
 */
 bool CmdNext::directnoarg()
 {
-	string module;
-	LINE_NUM line;
-	ADDR addr;
-	// keep stepping over asm instructions until we hit another c function
-	do
-	{
-		addr = gSession.target()->step();
-		gSession.bpmgr()->stopped(addr);
-		gSession.contextmgr()->set_context(addr);
-	}
-	while( !gSession.modulemgr()->get_c_addr( addr, module, line ) );
+	ADDR addr = range_step( false );
+	gSession.bpmgr()->stopped(addr);
+	gSession.contextmgr()->set_context(addr);
 	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
 	return true;
 }
 
 /** Execute one machine instruction, but if it is a function call, proceed until
 	the function returns.
-
-	@FIXME: change from stepi implementation to proper nexti
 */
 bool CmdNexti::directnoarg()
 {
-	ADDR addr = gSession.target()->step();
+	ADDR addr = step_instruction( true );
 	gSession.bpmgr()->stopped(addr);
 	gSession.contextmgr()->set_context(addr);
 	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
 	return true;
 }
 
 
+static RunMonitor run_monitor( &gSession );
+
+bool target_running()
+{
+	return run_monitor.running();
+}
+
+void interrupt_target()
+{
+	run_monitor.interrupt();
+}
+
+bool report_stop( bool wait )
+{
+	if( !run_monitor.running() || (!wait && !run_monitor.halted()) )
+		return false;
+	run_monitor.collect();
+	ADDR addr = gSession.target()->read_PC();
+	gSession.bpmgr()->stopped(addr);
+	gSession.contextmgr()->set_context(addr);
+	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
+	return true;
+}
+
+/** Start the target running in the background, report_stop() shows where
+	it stopped.
+*/
+static void run_background()
+{
+	gSession.bpmgr()->sync_target();
+	if( !run_monitor.start() )
+		cout << "The program is already running." << endl;
+}
+
 /**	Continue execution from the current address
 	if there is a breakpoint on the current address it is ignored.
-	optional parameter specifies a further number of breakpoints to ignore
+	optional parameter specifies a further number of breakpoints to ignore,
+	`continue &' returns straight away leaving the target running.
 */
 bool CmdContinue::direct( string cmd )
 {
 	printf("Continuing.\n");
+	if( cmd=="&" )
+	{
+		run_background();
+		return true;
+	}
 	int i = strtoul( cmd.c_str(), 0, 0);
 	
+	gSession.bpmgr()->sync_target();
 	gSession.target()->run_to_bp(i);
 	gSession.bpmgr()->stopped(gSession.target()->read_PC());
 	gSession.contextmgr()->set_context( gSession.target()->read_PC() );
 	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
 	return true;
 }
 
@@ -302,16 +543,18 @@ bool CmdContinue::direct( string cmd )
 bool CmdContinue::directnoarg()
 {
 	printf("Continuing.\n");
+	gSession.bpmgr()->sync_target();
 	gSession.target()->run_to_bp();
 //	bp_mgr.stopped( target->read_PC() );
 	gSession.contextmgr()->set_context( gSession.target()->read_PC() );
 	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
 	return true;
 }
 
 /** Reset the target abnd reload the breakpoints as necessary
 */
-bool CmdRun::directnoarg()
+static void reset_for_run()
 {
 	gSession.target()->stop();
 	gSession.target()->disconnect();
@@ -321,36 +564,91 @@ bool CmdRun::directnoarg()
 	
 	if(gSession.bpmgr()->set_breakpoint("main",true)==BP_ID_INVALID)
 		cout <<" failed to set main breakpoint!"<<endl;
+}
+
+/** `run &' starts from reset in the background.
+*/
+bool CmdRun::direct( string cmd )
+{
+	if( cmd!="&" )
+		return false;
+	reset_for_run();
+	run_background();
+	return true;
+}
 
+bool CmdRun::directnoarg()
+{
+	reset_for_run();
+	gSession.bpmgr()->sync_target();
 	gSession.target()->run_to_bp();
 	ADDR addr = gSession.target()->read_PC();
 	gSession.bpmgr()->stopped(addr);
 	gSession.contextmgr()->set_context(addr);
 	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
 	return true; 
 }
 
 
 /** open a new cdb file for debugging
 	all associated files must be in the same directory
+	Opening the file already loaded again, after a rebuild, only reparses
+	the modules that changed and keeps the breakpoints.
 */	
 bool CmdFile::direct( string cmd)
 {
-	gSession.modulemgr()->reset();
-	gSession.symtab()->clear();
-	gSession.symtree()->clear();	
-	gSession.bpmgr()->clear_all();
+	CmdCoverage::reset();
 
 	// disconnect and reconnect to make sure data is valid (fixes bug where
 	//   data reads are wrong after loading new file)
 	gSession.target()->disconnect();
 	gSession.target()->connect();
 	CdbFile cdbfile(&gSession);
-	cdbfile.open( cmd+".cdb" );
+	if( !cdbfile.reload( cmd+".cdb" ) )
+	{
+		gSession.modulemgr()->reset();
+		gSession.symtab()->clear();
+		gSession.symtree()->clear();	
+		gSession.bpmgr()->clear_all();
+		cdbfile.open( cmd+".cdb" );
+	}
 	return gSession.target()->load_file(cmd+".ihx");
 }
 
 
+/** compare-sections
+	Disassembly and listings read CODE from the loaded image, this checks
+	the target really holds it.
+*/
+bool CmdCompareSections::directnoarg()
+{
+	ADDR start, end;
+	if( !gSession.target()->image_range( start, end ) )
+	{
+		cout << "No file loaded." << endl;
+		return true;
+	}
+	if( !gSession.target()->is_connected() )
+	{
+		cout << "Target not connected." << endl;
+		return true;
+	}
+	// only what the file sets, the flash between its segments is left alone
+	const Target::IMAGE_SEG_VEC &segs = gSession.target()->image_segments();
+	for( size_t i=0; i<segs.size(); i++ )
+	{
+		start = segs[i].start;
+		end = segs[i].end;
+		bool same = gSession.target()->verify_code( start, end-start+1,
+										gSession.target()->image()+start );
+		printf( "Section CODE, range 0x%04x -- 0x%04x: %s\n", start, end+1,
+				same ? "matched." : "MIS-MATCHED!" );
+	}
+	return true;
+}
+
+
 /** list a section of the program
 	list linenum
 list function
@@ -476,6 +774,20 @@ bool CmdPrompt::set( string cmd )
 	return true;
 }
 
+/** Stop a target running in the background and show where it stopped.
+*/
+bool CmdInterrupt::directnoarg()
+{
+	if( !target_running() )
+	{
+		cout << "The program is not being run." << endl;
+		return true;
+	}
+	interrupt_target();
+	report_stop( true );
+	return true;
+}
+
 bool CmdStop::directnoarg()
 {
 	cout << "Stopping target" << endl;
@@ -483,11 +795,72 @@ bool CmdStop::directnoarg()
 	return true;
 }
 
+/** Continue running until just after the current function returns.
+	The return address is found on the stack, the top bytes that
+	Target::read_cpu_context() keeps are searched downwards for the first
+	address following a call to the current function, so registers pushed
+	by the function are skipped.  A breakpoint is placed on it and the
+	target run.
+*/
 bool CmdFinish::directnoarg()
 {
-	cout << "Finishing current function" << endl;
-	// @fixme set a breakpoint at the end of the current function
-	//bp_mgr.set_breakpoint(
+	string file, func;
+	int32_t func_start = -1, func_end;
+	const Target::CPU_CONTEXT &c = gSession.target()->read_cpu_context();
+	ADDR pc = c.pc;
+
+	if( gSession.bpmgr()->free_bps()==0 )
+	{
+		cout << "No breakpoint left for finish, delete one first." << endl;
+		return true;
+	}
+	if( gSession.symtab()->get_c_function( pc, file, func ) )
+		gSession.symtab()->get_addr( func, func_start, func_end );
+	// the top of the stack, read with the registers
+	const uint8_t *stack = c.stack;
+	int base = c.stack_base;
+	for( int p=c.sp; p>base; p-- )
+	{
+		// calls push the low byte first
+		ADDR ret = (stack[p-base]<<8) | stack[p-1-base];
+		if( is_return_addr( ret, func_start ) )
+		{
+			cout << "Run till exit from " << func << endl;
+			ADDR addr = run_to_return( ret, p-2 );
+			gSession.bpmgr()->stopped(addr);
+			gSession.contextmgr()->set_context(addr);
+			gSession.contextmgr()->dump();
+			CmdDisplay::show_all();
+			return true;
+		}
+	}
+	cout << "\"finish\" not meaningful in the outermost frame." << endl;
+	return true;
+}
+
+/** `backtrace [N]'
+		Print a line per frame of the call stack, innermost first, or only
+		the innermost N frames.  The stack is read with one transfer and
+		unwound on the host.
+*/
+bool CmdBacktrace::direct( string cmd )
+{
+	Backtrace bt( &gSession );
+	Backtrace::FRAME_VEC frames;
+	uint32_t max = Backtrace::MAX_FRAMES;
+	if( cmd.length()>0 )
+	{
+		char *end;
+		max = strtoul( cmd.c_str(), &end, 0 );
+		if( *end!=0 || max==0 )
+		{
+			cout << "Invalid frame count \"" << cmd << "\"." << endl;
+			return true;
+		}
+	}
+	if( !bt.unwind( frames, max ) )
+		cout << "Cannot access the stack." << endl;
+	bt.print( frames );
 	return true;
 }
 
@@ -515,51 +888,561 @@ bool CmdFinish::directnoarg()
 	rather than `print'.   Examining the Symbol Table Symbols.
 
 
-	\NOTE expr currently must be a variable name.  indexing into arrays is not yet supported, just displaying the entire array.
+	\NOTE expr currently must be a variable name optionally followed by
+	constant array indexes and structure members, eg cfg.ports[2].mode
 
 	\param expr	expression to display
 */
 bool CmdPrint::direct( string expr )
 {
-	string sym_name = expr;
 	char format = 0;
 
+	// optional /F format, the expression follows it
+	if( expr.length()>=2 && expr[0]=='/' )
+	{
+		format = expr[1];
+		size_t pos = expr.find_first_of(" \t");
+		expr = pos==string::npos ? "" : expr.substr(pos+1);
+	}
+
+	// compiled once per expression and context, repeats only read memory
+	ContextMgr::Context c = gSession.contextmgr()->get_current();
+	gSession.symtab()->get_expression( expr, c )->print( format );
+	return true;
+}
+
+CmdDisplay::DISPLAY_LIST	CmdDisplay::displays;
+int							CmdDisplay::next_num = 1;
+
+/** `display EXPR'
+	`display/FMT EXPR'
+		Add EXPR to the list of expressions to display each time the
+		program stops, and display it immediately.
+*/
+bool CmdDisplay::direct( string cmd )
+{
+	DISPLAY d;
+	d.format = 0;
+	if( cmd.length()>=2 && cmd[0]=='/' )
+	{
+		d.format = cmd[1];
+		size_t pos = cmd.find_first_of(" \t");
+		cmd = pos==string::npos ? "" : cmd.substr(pos+1);
+	}
+	if( cmd.empty() )
+		return directnoarg();
+	d.num = next_num++;
+	d.expr = cmd;
+	show( displays.insert( displays.end(), d ) );
+	return true;
+}
+
+/** `display'
+		Display the current values of the expressions on the list, just as
+		is done when the program stops.
+*/
+bool CmdDisplay::directnoarg()
+{
+	show_all();
+	return true;
+}
+
+bool CmdDisplay::info( string cmd )
+{
+	if( displays.empty() )
+	{
+		cout << "There are no auto-display expressions now." << endl;
+		return true;
+	}
+	cout << "Auto-display expressions now in effect:" << endl
+		 << "Num Enb Expression" << endl;
+	DISPLAY_LIST::iterator it;
+	for( it=displays.begin(); it!=displays.end(); ++it )
+	{
+		cout << it->num << ":   y  ";
+		if( it->format )
+			cout << '/' << it->format << ' ';
+		cout << it->expr << endl;
+	}
+	return true;
+}
+
+void CmdDisplay::show_all()
+{
+	show( displays.begin() );
+}
+
+/** Print the display expressions from first to the end of the list.
+	The ranges of all the expressions are collected first and read together,
+	merged per memory area, so the formatting only touches host memory.
+*/
+void CmdDisplay::show( DISPLAY_LIST::iterator first )
+{
+	SymTypeTree::FETCH_LIST ranges;
+	vector<Expression*> exprs;
+	DISPLAY_LIST::iterator it;
+
+	if( first==displays.end() )
+		return;
+	ContextMgr::Context c = gSession.contextmgr()->get_current();
+	for( it=first; it!=displays.end(); ++it )
+	{
+		Expression *e = gSession.symtab()->get_expression( it->expr, c );
+		exprs.push_back( e );
+		if( e->valid() )
+			ranges.push_back( SymTypeTree::FETCH_RANGE( e->addr(), e->length() ) );
+	}
+	gSession.symtree()->prefetch( ranges );
+	int i = 0;
+	for( it=first; it!=displays.end(); ++it, i++ )
+	{
+		cout << it->num << ": ";
+		if( it->format )
+			cout << '/' << it->format << ' ';
+		cout << it->expr << " = " << exprs[i]->value( it->format ) << endl;
+	}
+	gSession.symtree()->end_prefetch();
+}
+
+bool CmdDisplay::remove( int num )
+{
+	DISPLAY_LIST::iterator it;
+	for( it=displays.begin(); it!=displays.end(); ++it )
+	{
+		if( it->num==num )
+		{
+			displays.erase( it );
+			return true;
+		}
+	}
+	return false;
+}
 
-	// split up into a list
-	typedef boost::tokenizer<boost::char_separator<char> > 
-			tokenizer;
-	boost::char_separator<char> sep(" \t");
-	tokenizer tokens(expr, sep);
-	int cnt=0;
-	for( tokenizer::iterator it = tokens.begin();
-			it != tokens.end(); ++it )
+/** `undisplay DNUMS...'
+		Remove item numbers DNUMS from the list of expressions to display.
+*/
+bool CmdUndisplay::direct( string cmd )
+{
+	TOKEN token;
+	string::size_type pos = 0;
+	while( next_token( cmd, pos, token, " \t," ) )
 	{
-		cnt++;
-		if( (*it)[0]=='/' && it->length()==2  )
+		bool ok;
+		int num = token_ul( token, 10, &ok );
+		if( !ok )
 		{
-			format = (*it)[1];
+			cout << "Arguments must be display numbers." << endl;
+			return true;
 		}
-		// last token in the symbol name
-		sym_name = (*it);
+		if( !CmdDisplay::remove( num ) )
+			cout << "No display number " << num << "." << endl;
 	}
+	return true;
+}
 
-	int seperator_pos = sym_name.find_first_of(".[");
-	if( seperator_pos!=-1 )
-		sym_name = sym_name.substr(0,seperator_pos);
+/** `undisplay'
+		Remove all auto-display expressions.
+*/
+bool CmdUndisplay::directnoarg()
+{
+	CmdDisplay::clear();
+	return true;
+}
 
-	// figure out where we are
-	SymTab::SYMLIST::iterator it;
-	Symbol::SCOPE scope;
+static Sampler profile_sampler( &gSession );
 
-	ContextMgr::Context c = gSession.contextmgr()->get_current();
-	if( gSession.symtab()->getSymbol( sym_name, c, it ) )
-		it->print(format,expr.substr(expr.find(' ')+1));
+/** `profile [COUNT [INTERVAL]]'
+		Run the target taking COUNT PC samples (default 1000) INTERVAL
+		milliseconds apart (default 10), then print the flat profile.
+		Stops early on a breakpoint or when the target is stopped.
+	`profile save FILE'
+		Write the last profile to FILE as collapsed stacks for flamegraph.pl.
+*/
+bool CmdProfile::direct( string cmd )
+{
+	vector<string> tokens;
+	Tokenize( cmd, tokens, " \t" );
+	if( tokens.size()>0 && tokens[0]=="save" )
+	{
+		if( tokens.size()!=2 )
+			cout << "Argument required (file name)." << endl;
+		else if( profile_sampler.samples()==0 )
+			cout << "No profile to save." << endl;
+		else if( !profile_sampler.write_collapsed( tokens[1] ) )
+			cout << "Can't write \"" << tokens[1] << "\"." << endl;
+		else
+			cout << "Profile saved to \"" << tokens[1] << "\"." << endl;
+		return true;
+	}
+	uint32_t count = tokens.size()>0 ? strtoul( tokens[0].c_str(), 0, 0 ) : 1000;
+	uint32_t interval = tokens.size()>1 ? strtoul( tokens[1].c_str(), 0, 0 ) : 10;
+	if( count==0 )
+	{
+		cout << "Sample count must be greater than zero." << endl;
+		return true;
+	}
+	printf( "Profiling, %u samples %u ms apart.\n", count, interval );
+	if( !profile_sampler.run( count, interval*1000 ) )
+	{
+		cout << "Target doesn't support PC sampling." << endl;
+		return true;
+	}
+	ADDR addr = gSession.target()->read_PC();
+	gSession.bpmgr()->stopped(addr);
+	gSession.contextmgr()->set_context(addr);
+	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
+	profile_sampler.print_flat();
+	return true;
+}
+
+/** `info profile'
+		Print the flat profile of the last run again.
+*/
+bool CmdProfile::info( string cmd )
+{
+	profile_sampler.print_flat();
+	return true;
+}
+
+static VarMonitor var_monitor( &gSession );
+
+/** `monitor[/FMT] EXPR... every MS [count N] [log FILE]'
+		Run the target and every MS milliseconds halt it just long enough to
+		read all the expressions, in one batch, and set it running again.
+		The samples go to FILE, as CSV or binary if FILE ends in .bin, or to
+		the console as CSV.  Runs until N samples have been taken, the target
+		stops on a breakpoint or is stopped, then reports how long the target
+		was halted.
+*/
+bool CmdMonitor::direct( string cmd )
+{
+	vector<string> tokens, exprs;
+	char format = 0;
+	Tokenize( cmd, tokens, " \t" );
+	size_t i = 0;
+	if( tokens.size()>0 && tokens[0][0]=='/' )
+	{
+		format = tokens[0].length()>1 ? tokens[0][1] : 0;
+		i++;
+	}
+	for( ; i<tokens.size() && tokens[i]!="every"; i++ )
+		exprs.push_back( tokens[i] );
+	if( exprs.empty() || i+1>=tokens.size() )
+	{
+		cout << "Usage: monitor[/FMT] EXPR... every MS [count N] [log FILE]" << endl;
+		return true;
+	}
+	uint32_t interval = strtoul( tokens[++i].c_str(), 0, 0 );
+	uint32_t count = 0;
+	string log;
+	for( i++; i+1<tokens.size(); i+=2 )
+	{
+		if( tokens[i]=="count" )
+			count = strtoul( tokens[i+1].c_str(), 0, 0 );
+		else if( tokens[i]=="log" )
+			log = tokens[i+1];
+		else
+			break;
+	}
+	if( i<tokens.size() )
+	{
+		cout << "Unexpected \"" << tokens[i] << "\"." << endl;
+		return true;
+	}
+	if( !var_monitor.run( exprs, format, count, interval*1000, log ) )
+	{
+		cout << var_monitor.error() << endl;
+		return true;
+	}
+	ADDR addr = gSession.target()->read_PC();
+	gSession.bpmgr()->stopped(addr);
+	gSession.contextmgr()->set_context(addr);
+	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
+	var_monitor.print_stats();
+	return true;
+}
+
+/** Range step line by line until the len bytes at flat_addr differ from
+	value, each line costs one run and one minimal uncached read.
+	\returns true if they changed, value then holds the new bytes, false if
+	the target stopped on a breakpoint or was stopped.
+*/
+static bool watch_exact( uint32_t flat_addr, uint32_t len, vector<uint8_t> &value )
+{
+	vector<uint8_t> cur( len );
+	while( true )
+	{
+		ADDR addr = range_step( true );
+		gSession.target()->read_memory_uncached( flat_addr, len, &cur[0] );
+		if( cur!=value )
+		{
+			value = cur;
+			return true;
+		}
+		// range_step() only stops short of a line for a breakpoint or a stop
+		if( gSession.bpmgr()->active_bp_at( addr ) ||
+			!is_c_line( addr ) ||
+			gSession.target()->check_stop_forced() )
+			return false;
+	}
+}
+
+/** `watch [-exact] EXPR [every MS]'
+		Run until the value of EXPR changes, then print the old and new
+		values.  By default the target is halted every MS milliseconds
+		(default 0, as fast as possible) just long enough to read the bytes
+		of EXPR, so it stops some way past the write.  With -exact it is
+		range stepped a C line at a time instead, stopping on the line after
+		the write, much slower but exact.  Either way each check reads only
+		the bytes of EXPR.
+*/
+bool CmdWatch::direct( string cmd )
+{
+	vector<string> tokens;
+	Tokenize( cmd, tokens, " \t" );
+	bool exact = false;
+	size_t i = 0;
+	string expr;
+	if( tokens.size()>0 && tokens[0]=="-exact" )
+	{
+		exact = true;
+		i++;
+	}
+	for( ; i<tokens.size() && tokens[i]!="every"; i++ )
+		expr += (expr.empty() ? "" : " ") + tokens[i];
+	uint32_t interval = 0;
+	if( i<tokens.size() )
+	{
+		if( exact || i+2!=tokens.size() )
+			expr = "";
+		else
+			interval = strtoul( tokens[i+1].c_str(), 0, 0 );
+	}
+	if( expr.empty() )
+	{
+		cout << "Usage: watch [-exact] EXPR [every MS]" << endl;
+		return true;
+	}
+
+	Expression *e = gSession.symtab()->get_expression(
+						expr, gSession.contextmgr()->get_current() );
+	if( !e->valid() )
+	{
+		cout << e->error() << endl;
+		return true;
+	}
+	uint32_t len = e->length();
+	FLAT_ADDR flat_addr = e->addr();
+	char area;
+	if( len==0 || MemRemap::target( flat_addr, area )==INVALID_ADDR )
+	{
+		cout << "Cannot watch \"" << expr << "\", it has no address." << endl;
+		return true;
+	}
+	vector<uint8_t> value( len );
+	gSession.target()->read_memory_uncached( flat_addr, len, &value[0] );
+	string old_value = e->value( 0 );
+
+	bool changed;
+	printf( "Watching %s, %s.\n", expr.c_str(),
+			exact ? "stepping each line" : "sampling" );
+	if( exact )
+		changed = watch_exact( flat_addr, len, value );
+	else
+	{
+		VarMonitor::WATCH_RESULT r =
+			var_monitor.watch( flat_addr, len, interval*1000, value );
+		if( r==VarMonitor::WATCH_FAILED )
+		{
+			cout << var_monitor.error() << endl;
+			return true;
+		}
+		changed = r==VarMonitor::WATCH_CHANGED;
+	}
+	if( changed )
+		cout << "\nWatchpoint: " << expr << "\n\n"
+			 << "Old value = " << old_value << "\n"
+			 << "New value = " << e->value( 0 ) << endl;
+	ADDR addr = gSession.target()->read_PC();
+	gSession.bpmgr()->stopped(addr);
+	gSession.contextmgr()->set_context(addr);
+	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
+	if( !exact )
+		var_monitor.print_stats();
+	return true;
+}
+
+static Snapshots snapshots( &gSession );
+
+/** `snapshot save NAME'
+		Read all of DATA, IDATA, the SFR pages and XDATA and keep it as NAME.
+	`snapshot diff A B'
+		Print every byte that changed from snapshot A to B with the symbol
+		it belongs to.
+	`snapshot list'
+		List the snapshots and the memory they take, as info snapshot does.
+*/
+bool CmdSnapshot::direct( string cmd )
+{
+	vector<string> tokens;
+	Tokenize( cmd, tokens, " \t" );
+	if( tokens.size()==2 && tokens[0]=="save" )
+	{
+		if( snapshots.save( tokens[1] ) )
+			cout << "Snapshot \"" << tokens[1] << "\" saved." << endl;
+		else
+			cout << snapshots.error() << endl;
+	}
+	else if( tokens.size()==3 && tokens[0]=="diff" )
+	{
+		if( !snapshots.diff( tokens[1], tokens[2] ) )
+			cout << snapshots.error() << endl;
+	}
+	else if( tokens.size()==1 && tokens[0]=="list" )
+		snapshots.list();
 	else
-		cout << "No symbol \""<<expr<<"\" in current context."<<endl;
+		cout << "Usage: snapshot save NAME | snapshot diff A B | snapshot list"
+			 << endl;
+	return true;
+}
+
+bool CmdSnapshot::info( string cmd )
+{
+	snapshots.list();
+	return true;
+}
+
+static Recorder trace_recorder( &gSession );
+
+/** `record [COUNT]'
+		Single step COUNT instructions (default 1000) adding each PC to the
+		trace buffer, the context is only shown once at the end.
+	`record size ENTRIES'
+		Set the number of instructions the trace buffer holds and clear it.
+*/
+bool CmdRecord::direct( string cmd )
+{
+	vector<string> tokens;
+	Tokenize( cmd, tokens, " \t" );
+	if( tokens.size()>0 && tokens[0]=="size" )
+	{
+		if( tokens.size()!=2 )
+			cout << "Argument required (number of entries)." << endl;
+		else
+			trace_recorder.set_size( strtoul( tokens[1].c_str(), 0, 0 ) );
+		return true;
+	}
+	uint32_t count = tokens.size()>0 ? strtoul( tokens[0].c_str(), 0, 0 ) : 1000;
+	uint32_t n = trace_recorder.record( count );
+	printf( "Recorded %u instructions.\n", n );
+	ADDR addr = gSession.target()->read_PC();
+	gSession.bpmgr()->stopped(addr);
+	gSession.contextmgr()->set_context(addr);
+	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
+	return true;
+}
+
+/** `info record'
+		Show how much of the trace buffer is in use.
+*/
+bool CmdRecord::info( string cmd )
+{
+	printf( "%llu instructions recorded, the last %u are held, buffer size %u.\n",
+			(unsigned long long)trace_recorder.total(),
+			trace_recorder.count(), trace_recorder.size() );
+	return true;
+}
+
+/** `trace [N]'
+		Print the last N recorded instructions (default 20) with their
+		function and line.
+	`trace save FILE'
+		Write the whole trace buffer to FILE.
+*/
+bool CmdTrace::direct( string cmd )
+{
+	vector<string> tokens;
+	Tokenize( cmd, tokens, " \t" );
+	if( tokens.size()>0 && tokens[0]=="save" )
+	{
+		if( tokens.size()!=2 )
+			cout << "Argument required (file name)." << endl;
+		else if( !trace_recorder.write( tokens[1] ) )
+			cout << "Can't write \"" << tokens[1] << "\"." << endl;
+		else
+			cout << "Trace saved to \"" << tokens[1] << "\"." << endl;
+		return true;
+	}
+	trace_recorder.print( tokens.size()>0 ?
+						  strtoul( tokens[0].c_str(), 0, 0 ) : 20 );
+	return true;
+}
+
+static Coverage coverage( &gSession );
+
+/** `coverage [SLICE]'
+		Run the target collecting C line coverage.  Breakpoints are moved
+		to other unhit lines when none of theirs is reached within SLICE
+		milliseconds (default 1000).
+	`coverage reset'
+		Forget the lines hit so far.
+	`coverage save FILE'
+		Write the coverage to FILE as an lcov tracefile.
+*/
+bool CmdCoverage::direct( string cmd )
+{
+	vector<string> tokens;
+	Tokenize( cmd, tokens, " \t" );
+	if( tokens.size()>0 && tokens[0]=="reset" )
+	{
+		reset();
+		return true;
+	}
+	if( tokens.size()>0 && tokens[0]=="save" )
+	{
+		if( tokens.size()!=2 )
+			cout << "Argument required (file name)." << endl;
+		else if( coverage.lines()==0 )
+			cout << "No coverage to save." << endl;
+		else if( !coverage.write_lcov( tokens[1] ) )
+			cout << "Can't write \"" << tokens[1] << "\"." << endl;
+		else
+			cout << "Coverage saved to \"" << tokens[1] << "\"." << endl;
+		return true;
+	}
+	uint32_t slice = tokens.size()>0 ? strtoul( tokens[0].c_str(), 0, 0 ) : 1000;
+	if( !coverage.run( slice ) )
+	{
+		cout << coverage.error() << endl;
+		return true;
+	}
+	ADDR addr = gSession.target()->read_PC();
+	gSession.bpmgr()->stopped(addr);
+	gSession.contextmgr()->set_context(addr);
+	gSession.contextmgr()->dump();
+	CmdDisplay::show_all();
+	coverage.print_summary();
+	return true;
+}
 
+/** `info coverage'
+		Print the lines hit per module.
+*/
+bool CmdCoverage::info( string cmd )
+{
+	coverage.print_summary();
 	return true;
 }
 
+void CmdCoverage::reset()
+{
+	coverage.reset();
+}
+
 bool CmdRegisters::info( string cmd )
 {
 	if( cmd.length()==0 )
@@ -574,45 +1457,27 @@ bool CmdRegisters::info( string cmd )
 				SP  : 0x07
 				PSW : 0x00 | CY : 0 | AC : 0 | OV : 0 | P : 0
 		*/
-		unsigned char reg_psw, reg_acc, reg_b, reg_dpl, reg_dph, reg_sp;
-		unsigned char reg_set[8], reg_bank;
-		uint16_t reg_dptr;
-		gSession.target()->read_sfr(0xd0,1,&reg_psw);
-		reg_bank = (reg_psw>>3)&0x03;
-		printf("PC  : 0x%04x  RegisterBank %i:\n",
-			   gSession.target()->read_PC(), reg_bank );
+		const Target::CPU_CONTEXT &c = gSession.target()->read_cpu_context();
+		uint16_t reg_dptr = (uint16_t(c.dph)<<8) | c.dpl;
+		printf("PC  : 0x%04x  RegisterBank %i:\n", c.pc, (c.psw>>3)&0x03 );
 		
 		// dump the regs
-		gSession.target()->read_data( reg_bank*8, 8, reg_set );
 		printf("R0-7:");
 		for(int i=0; i<8;i++)
-			printf(" 0x%02x",reg_set[i]);
+			printf(" 0x%02x",c.r[i]);
 		printf("\n");
 		
-		// ACC
-		gSession.target()->read_sfr(0xe0,1,&reg_acc);
-		printf("ACC : 0x%02x %i %c\n", reg_acc,reg_acc, isprint(reg_acc) ? reg_acc : '.'  );
-		
-		// B
-		gSession.target()->read_sfr(0xf0,1,&reg_b);
-		printf("B   : 0x%02x %i %c\n", reg_b,reg_b,isprint(reg_b) ? reg_b : '.' );
-		
-		// DPTR
-		gSession.target()->read_sfr(0x82,1,&reg_dpl);
-		gSession.target()->read_sfr(0x83,1,&reg_dph);
-		reg_dptr = (uint16_t(reg_dph)<<8) | reg_dpl;
+		printf("ACC : 0x%02x %i %c\n", c.acc,c.acc, isprint(c.acc) ? c.acc : '.'  );
+		printf("B   : 0x%02x %i %c\n", c.b,c.b,isprint(c.b) ? c.b : '.' );
 		printf("DPTR: 0x%04x %i\n", reg_dptr, reg_dptr );
-		
-		// SP
-		gSession.target()->read_sfr(0x81,1,&reg_sp);
-		printf("SP  : 0x%02x\n", reg_sp );
+		printf("SP  : 0x%02x\n", c.sp );
 		
 		printf("PSW : 0x%02x | CY : %i | AC : %i | OV : %i | P : %i\n",
-			   reg_psw,
-			   (reg_psw>>7)&1,	// CY
-			   (reg_psw>>6)&1,	// AC
-			   (reg_psw>>2)&1,	// OV
-			   reg_psw&1);		// P
+			   c.psw,
+			   (c.psw>>7)&1,	// CY
+			   (c.psw>>6)&1,	// AC
+			   (c.psw>>2)&1,	// OV
+			   c.psw&1);		// P
 		return true;
 	}
 	return false;
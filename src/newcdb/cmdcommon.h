@@ -19,6 +19,7 @@
  ***************************************************************************/
 #ifndef CMDCOMMON_H
 #define CMDCOMMON_H
+#include <list>
 #include "parsecmd.h"
 
 /**
@@ -121,6 +122,15 @@ class CmdFile : public CmdShowSetInfoHelp
 		bool direct( string cmd);
 };
 
+/** Check the target's CODE against the image loaded by file.
+*/
+class CmdCompareSections : public CmdShowSetInfoHelp
+{
+public:
+	CmdCompareSections()	{ name="COMPARE-sections"; }
+	virtual bool directnoarg();
+};
+
 class CmdList : public CmdShowSetInfoHelp
 {
 	public:
@@ -168,6 +178,14 @@ class CmdRun : public CmdShowSetInfoHelp
 {
 	public:
 		CmdRun()		{ name="Run"; }
+		bool direct( string cmd );
+		bool directnoarg();
+};
+
+class CmdInterrupt : public CmdShowSetInfoHelp
+{
+	public:
+		CmdInterrupt()	{ name="INTerrupt"; }
 		bool directnoarg();
 };
 
@@ -185,6 +203,17 @@ class CmdFinish : public CmdShowSetInfoHelp
 		bool directnoarg();
 };
 
+/** Call stack of the halted target, see Backtrace.
+	Registered as backtrace, bt and where.
+*/
+class CmdBacktrace : public CmdShowSetInfoHelp
+{
+public:
+	CmdBacktrace( const char *n="BAcktrace" )	{ name=n; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg()		{ return direct(""); }
+};
+
 class CmdPrint : public CmdShowSetInfoHelp
 {
 public:
@@ -192,6 +221,114 @@ public:
 	virtual bool direct( string cmd );
 };
 
+/** gdb style auto-display list, every expression is printed after each stop.
+	The memory of all the expressions is fetched in one pass before any of
+	them are formatted.
+*/
+class CmdDisplay : public CmdShowSetInfoHelp
+{
+public:
+	CmdDisplay()	{ name="DISPlay"; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg();
+	virtual bool info( string cmd );
+	static void show_all();
+	static bool remove( int num );
+	static void clear()				{ displays.clear(); }
+
+protected:
+	typedef struct
+	{
+		int		num;
+		char	format;
+		string	expr;
+	} DISPLAY;
+	typedef list<DISPLAY> DISPLAY_LIST;
+	static DISPLAY_LIST	displays;
+	static int			next_num;
+	static void show( DISPLAY_LIST::iterator first );
+};
+
+class CmdUndisplay : public CmdShowSetInfoHelp
+{
+public:
+	CmdUndisplay()	{ name="UNDISPlay"; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg();
+};
+
+/** Statistical profiler, see Sampler.
+*/
+class CmdProfile : public CmdShowSetInfoHelp
+{
+public:
+	CmdProfile()	{ name="PROFile"; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg()		{ return direct(""); }
+	virtual bool info( string cmd );
+};
+
+/** Live variable monitor, see VarMonitor.
+*/
+class CmdMonitor : public CmdShowSetInfoHelp
+{
+public:
+	CmdMonitor()	{ name="MONitor"; }
+	virtual bool direct( string cmd );
+};
+
+/** Data watchpoint emulated by sampling or by range stepping.
+*/
+class CmdWatch : public CmdShowSetInfoHelp
+{
+public:
+	CmdWatch()		{ name="WAtch"; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg()		{ return direct(""); }
+};
+
+/** Memory snapshots and the difference between them, see Snapshots.
+*/
+class CmdSnapshot : public CmdShowSetInfoHelp
+{
+public:
+	CmdSnapshot()	{ name="SNAPshot"; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg()		{ return direct(""); }
+	virtual bool info( string cmd );
+};
+
+/** Instruction trace recording, see Recorder.
+*/
+class CmdRecord : public CmdShowSetInfoHelp
+{
+public:
+	CmdRecord()		{ name="RECord"; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg()		{ return direct(""); }
+	virtual bool info( string cmd );
+};
+
+class CmdTrace : public CmdShowSetInfoHelp
+{
+public:
+	CmdTrace()		{ name="TRACE"; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg()		{ return direct(""); }
+};
+
+/** Line coverage using the target breakpoints, see Coverage.
+*/
+class CmdCoverage : public CmdShowSetInfoHelp
+{
+public:
+	CmdCoverage()	{ name="COVerage"; }
+	virtual bool direct( string cmd );
+	virtual bool directnoarg()		{ return direct(""); }
+	virtual bool info( string cmd );
+	static void reset();
+};
+
 class CmdRegisters : public CmdShowSetInfoHelp
 {
 	public:
@@ -199,5 +336,22 @@ class CmdRegisters : public CmdShowSetInfoHelp
 		virtual bool info( string cmd );
 };
 
+/** \returns true while the target runs in the background after
+	`continue &' or `run &'.
+*/
+bool target_running();
+
+/** Ask a target running in the background to stop, report_stop() waits
+	for it.
+*/
+void interrupt_target();
+
+/** Show where a target running in the background stopped and end the run.
+	\param wait	Wait for the target to halt, otherwise only report a halt
+				that has already happened.
+	\returns true if a stop was reported.
+*/
+bool report_stop( bool wait );
+
 #endif
 
@@ -19,6 +19,7 @@
  ***************************************************************************/
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <iostream>
 #include <stdio.h>
 #include "types.h"
@@ -28,9 +29,15 @@
 #include "cmddisassemble.h"
 #include "memremap.h"
 #include "target.h"
+#include "disasm8051.h"
 #include "newcdb.h"
+#include "outformat.h"
+#include "expression.h"
+#include "contextmgr.h"
 
 static bool print_asm_line( ADDR start, ADDR end, string function );
+/// decoded instructions are kept until code memory changes
+static Disasm8051 disasm;
 
 
 /** Disassemble commend
@@ -72,58 +79,91 @@ bool CmdDisassemble::direct( string cmd )
 		return false;
 }
 
+/** Append " <sym>" or " <sym+off>" for a jump or call destination, from
+	the nearest function starting at or below it.
+*/
+static void put_dest( ADDR dest, string &out )
+{
+	char buf[16];
+	int32_t start, end;
+	if( dest<0 )
+		return;
+	string sym = gSession.symtab()->get_symbol_name_closest( MemRemap::flat( dest, 'c' ) );
+	if( sym.empty() || !gSession.symtab()->get_addr( sym, start, end ) ||
+		start>dest )
+		return;
+	out += " <" + sym;
+	if( dest>start )
+	{
+		snprintf( buf, sizeof(buf), "+%d", dest-start );
+		out += buf;
+	}
+	out += '>';
+}
+
+/** Append the SDCC listing line for the instruction at addr as a comment,
+	it still has the symbolic operands the decoder can't know.
+*/
+static void put_listing( ADDR addr, string &out )
+{
+	const ModuleMgr::ADDR_LINE *src = gSession.modulemgr()->find_addr( addr );
+	const char *p;
+	size_t len;
+	if( !src || !src->asm_module ||
+		!(p = src->asm_module->get_asm_src( src->asm_line, len )) )
+		return;
+	while( len>0 && isspace(*p) )
+	{
+		p++;
+		len--;
+	}
+	while( len>0 && isspace(p[len-1]) )
+		len--;
+	if( len==0 )
+		return;
+	out += "\t; ";
+	for( size_t i=0; i<len; i++ )
+		out += p[i]=='\t' ? ' ' : p[i];
+}
+
+/** Print the instructions from start to end, limited to function if one
+	is given.  The whole range comes from the CODE shadow in one read and the
+	decoded instructions are kept until code memory changes.  Jump and call
+	destinations are shown with their symbol and each instruction with the
+	line of the SDCC listing it came from.
+	\returns true if anything was printed.
+*/
 static bool print_asm_line( ADDR start, ADDR end, string function )
 {
-	uint32_t asm_lines;
-	ADDR delta;
-	ADDR sym_addr;
-	ADDR last_addr;
-	string sym_name;
-	bool printedLine=false;
-	
-	string module;
-	LINE_NUM line;
-	gSession.modulemgr()->get_asm_addr( start,module, line );
-	Module &m = gSession.modulemgr()->module(module);
-	
-	asm_lines = m.get_asm_num_lines();
-	last_addr = start+1;
-	sym_addr = start;
-	sym_name.clear();
+	ADDR sym_addr = start;
 
-	sym_addr = start;
-	sym_name = function;
-	int32_t i,j;
-	for ( j=0, i=1; i <= asm_lines; i++ ) 
+	if( !function.empty() )
 	{
-		if ( start >= 0 && m.get_asm_addr(i) < start)
-		{
-			continue;
-		}
-		if ( end >= 0 && m.get_asm_addr(i) > end)
-		{
-			continue;
-		}
-		if( !function.empty() )
-		{
-			ADDR sfunc,efunc;
-			gSession.symtab()->get_addr( function, sfunc, efunc );
-			if( m.get_asm_addr(i) < sfunc ||
-				m.get_asm_addr(i) > efunc )
-				continue;
-		}
-		delta = m.get_asm_addr(i) - sym_addr;
-		if ( delta >= 0 )
+		ADDR sfunc, efunc;
+		if( gSession.symtab()->get_addr( function, sfunc, efunc ) )
 		{
-			j++;
-			last_addr = m.get_asm_addr(i);
-			printf( "0x%08x <%s", last_addr, sym_name.c_str() );
-			printf( "+%5d", delta );
-			printf( ">:\t%s\n", m.get_asm_src(i).c_str() );
-			printedLine=true;
+			sym_addr = sfunc;
+			if( start<sfunc )
+				start = sfunc;
+			if( end<0 || end>efunc )
+				end = efunc;
 		}
 	}
-	return printedLine;
+	if( end<0 )
+		end = start;	// no function to bound it, just the one instruction
+
+	Disasm8051::INST_VEC insts;
+	string text;
+	disasm.disassemble( gSession.target(), start, end, insts );
+	for( int i=0; i<insts.size(); i++ )
+	{
+		text = insts[i].text;
+		put_dest( insts[i].dest, text );
+		put_listing( insts[i].addr, text );
+		printf( "0x%08x <%s+%5d>:\t%s\n", insts[i].addr, function.c_str(),
+				insts[i].addr-sym_addr, text.c_str() );
+	}
+	return !insts.empty();
 }
 
 
@@ -133,106 +173,88 @@ static bool print_asm_line( ADDR start, ADDR end, string function )
 	Examine memory: x/FMT ADDRESS.
 	ADDRESS is an expression for the memory address to examine.
 	FMT is a repeat count followed by a format letter and a size letter.
-	Format letters are o(octal), x(hex), d(decimal), u(unsigned decimal),
-	t(binary), f(float), a(address), i(instruction), c(char) and s(string).
+	Format letters are o(octal), x(hex), z(zero padded hex), d(decimal),
+	u(unsigned decimal), t(binary), f(float), a(address), i(instruction),
+	c(char) and s(string).
 	Size letters are b(byte), h(halfword), w(word), g(giant, 8 bytes).
 	The specified number of objects of the specified size are printed
 	according to the format.
 	
 	Defaults for format and size letters are those previously used.
 	Default count is 1.  Default address is following last thing printed
-	with this command or "print".
+	with this command.
 
 	example format strings
+		x/16xb 0x20000000	16 bytes of XDATA in hex
+		x/4dh arr			4 ints from the address of arr
+		x					the next unit after the last x
 
-
-
-
+	Walking forward through memory with repeated x commands is spotted by
+	Target::read_ahead(), which reads the following block into the cache
+	once the current one is shown, so the next x doesn't wait for the
+	target.
 
 	@TOD add support for $sp $pc $fp and $ps
 */
 bool CmdX::direct( string cmd )
 {
 	vector<string> tokens;
-	vector<string>::iterator it;
 	Tokenize(cmd, tokens);
 	uint32_t flat_addr;
+	int count = 1;
+	int arg = 0;
 	if( tokens.size()<1)
 		return false;
-	if( tokens[0][0]!='/' )
+	if( tokens[0][0]=='/' )
 	{
-		// no format or size information, use defaults.
-		flat_addr = strtoul(tokens[0].c_str(),0,0);
+		if( !parseFormat( tokens[0], count ) )
+			return false;
+		arg = 1;
 	}
-	else if( parseFormat( tokens[0] ) && (tokens.size()>1))
+	if( arg<tokens.size() )
 	{
-		flat_addr = strtoul(tokens[1].c_str(),0,0);
-	}
-	else
-		return false;
-	
-	for( int num=0; num<num_units; num++ )
-	{
-		char area;
-		ADDR addr = MemRemap::target( flat_addr, area );
-		
-		switch(format)
+		if( !parseAddress( tokens[arg], flat_addr ) )
 		{
-			case 'i':	// instruction
-				if( area !='c' )
-				{
-					printf("ERROR: can't print out in instruction format for non code memory areas\n");
-				}
-				else {
-					if (print_asm_line( addr, addr+ (num_units - num)*unit_size, string())) {
-						// return, since print_asm_line prints all relevant lines
-						return true;
-					}
-				}
-				break;
-			case 'x':	// hex
-				// read memory in one big chunk to reduce communication
-				//  overhead on large reads
-				unsigned int readByteLength;
-				
-				readByteLength = unit_size * num_units;
-				unsigned char readValues[1000];
-				
-				(void )readMem( flat_addr, readByteLength, readValues);
-				for( int i=0; i<num_units; i++ ) {
-					printf("0x");
-					for(int j=0; j < unit_size; j++ )
-					{
-						//printf ("%d %d %d %d",i,j,num_units,unit_size);
-						printf("%02x",readValues[i*unit_size + j]);
-					}
-					printf("\n");
-				}
-				return true;
-			case 's':	// string
-				printf("string here\n");
-				break;
+			cout << "No symbol \"" << tokens[arg] << "\" in current context." << endl;
+			return true;
 		}
-		flat_addr += unit_size;
 	}
+	else if( next_addr==MemRemap::INVALID_FLAT_ADDR )
+	{
+		cout << "Argument required (starting display address)." << endl;
+		return true;
+	}
+	else
+		flat_addr = next_addr;
+	examine( flat_addr, count );
+	return true;
+}
+
+/// x on its own continues from where the last one left off
+bool CmdX::directnoarg()
+{
+	if( next_addr==MemRemap::INVALID_FLAT_ADDR )
+		cout << "Argument required (starting display address)." << endl;
+	else
+		examine( next_addr, 1 );
 	return true;
 }
 
 /** parse the /nfu token
 	must begin with '/' or it isn't a format specifier and we return false.
 
-	n = number of unit outputs to show
-	f = 's' / 'i' / 'x'	or not present for default
-	u = 'b' / 'h' / 'w' / 'g'	number of bytes in word, optional
+	n = number of unit outputs to show, returned in count
+	f = format letter, see direct(), kept for the next x
+	u = 'b' / 'h' / 'w' / 'g'	number of bytes in word, kept for the next x
 */
-bool CmdX::parseFormat(string token)
+bool CmdX::parseFormat( string token, int &count )
 {
 	int repeatNumber=0;
 	int numberOfDigits=0;
 	bool parsedLetter=false;
+	bool sized=false;
 	
 	token = token.substr(1);
-	//cout << "tt" << token << endl;
 	for( int i=0; i<token.size(); i++)
 	{
 		// for each char
@@ -249,49 +271,206 @@ bool CmdX::parseFormat(string token)
 		else
 		{
 			parsedLetter=true;
-			switch(token[i])
+			if( strchr( "oxzdutfaics", token[i] ) )
+				format = token[i];
+			else
 			{
-				case 's':
-				case 'i':
-				case 'x':
-					format = token[i];
-					break;
-				case 'b': unit_size = 1; break;
-				case 'h': unit_size = 2; break;
-				case 'w': unit_size = 4; break;
-				case 'g': unit_size = 8; break;
-				default:
-					return false;	// invalid format
+				switch(token[i])
+				{
+					case 'b': unit_size = 1; break;
+					case 'h': unit_size = 2; break;
+					case 'w': unit_size = 4; break;
+					case 'g': unit_size = 8; break;
+					default:
+						return false;	// invalid format
+				}
+				sized = true;
 			}
 		}
 	}
+	if( !sized )
+	{
+		// formats with a natural size on the 8051
+		if( format=='c' || format=='s' )	unit_size = 1;
+		else if( format=='a' )				unit_size = 2;
+		else if( format=='f' )				unit_size = 4;
+	}
 	if (repeatNumber) {
-		num_units = repeatNumber;
+		count = repeatNumber;
 	}
 	return true;
 }
 
+/** An address is a number, already a MemRemap flat address, or the name
+	of a variable to start at.
+*/
+bool CmdX::parseAddress( string token, uint32_t &flat_addr )
+{
+	char *end;
+	flat_addr = strtoul( token.c_str(), &end, 0 );
+	if( !token.empty() && *end==0 )
+		return true;
+	Expression *e = gSession.symtab()->get_expression( token,
+								gSession.contextmgr()->get_current() );
+	if( !e->valid() )
+		return false;
+	flat_addr = e->addr();
+	return true;
+}
+
+/// "0x20000010 <buf+16>:" for the start of each line
+static void put_label( uint32_t flat_addr, string &out )
+{
+	char buf[16];
+	uint32_t offset;
+	snprintf( buf, sizeof(buf), "0x%08x", flat_addr );
+	out += buf;
+	string sym = gSession.symtab()->get_symbol_covering( flat_addr, offset );
+	if( !sym.empty() )
+	{
+		out += " <" + sym;
+		if( offset )
+		{
+			snprintf( buf, sizeof(buf), "+%u", offset );
+			out += buf;
+		}
+		out += '>';
+	}
+	out += ':';
+}
+
+/** Print count units from flat_addr in the current format and size.
+	Everything is read in one go and formatted into one string.
+*/
+void CmdX::examine( uint32_t flat_addr, int count )
+{
+	char area;
+	ADDR addr = MemRemap::target( flat_addr, area );
+	string out;
+	
+	if( addr==INVALID_ADDR )
+	{
+		printf( "Cannot access memory at address 0x%x\n", flat_addr );
+		return;
+	}
+	if( format=='i' )
+	{
+		if( area!='c' )
+		{
+			printf("ERROR: can't print out in instruction format for non code memory areas\n");
+			return;
+		}
+		Disasm8051::INST_VEC insts;
+		// 3 bytes is the longest 8051 instruction
+		disasm.disassemble( gSession.target(), addr, addr+count*3, insts );
+		for( int i=0; i<insts.size() && i<count; i++ )
+		{
+			out.clear();
+			put_label( insts[i].addr, out );
+			out += '\t';
+			out += insts[i].text;
+			put_dest( insts[i].dest, out );
+			put_listing( insts[i].addr, out );
+			printf( "%s\n", out.c_str() );
+			next_addr = insts[i].addr + insts[i].len;
+		}
+		return;
+	}
+	if( format=='s' )
+	{
+		// one NUL terminated string per count, bytes come from the cache
+		for( int i=0; i<count; i++ )
+		{
+			unsigned char c;
+			OutFormat of( &gSession );
+			put_label( flat_addr, out );
+			out += "\t\"";
+			for( int n=0; n<200; n++ )
+			{
+				if( !readMem( flat_addr++, 1, &c ) || c==0 )
+					break;
+				of.format( 's', &c, 1, flat_addr-1, out );
+			}
+			out += "\"\n";
+		}
+		fputs( out.c_str(), stdout );
+		next_addr = flat_addr;
+		return;
+	}
+	if( unit_size==8 && format!='x' && format!='z' )
+	{
+		printf("ERROR: giant units can only be examined in hex\n");
+		return;
+	}
+	
+	uint32_t len = count * unit_size;
+	std::vector<unsigned char> buf( len );
+	if( !readMem( flat_addr, len, &buf[0] ) )
+		return;
+	int per_line = unit_size<=2 ? 8 : unit_size==4 ? 4 : 2;
+	OutFormat of( &gSession );
+	out.reserve( count*(unit_size*2+4) + (count/per_line+1)*32 );
+	for( int i=0; i<count; i++ )
+	{
+		const unsigned char *p = &buf[i*unit_size];
+		uint32_t a = flat_addr + i*unit_size;
+		if( i%per_line==0 )
+		{
+			if( i>0 )
+				out += '\n';
+			put_label( a, out );
+		}
+		out += '\t';
+		if( unit_size==8 )
+		{
+			// high word then low, little endian like every other size
+			of.format( 'z', p+4, 4, a, out );
+			of.format( 'z', p, 4, a, out );
+			out.erase( out.size()-10, 2 );	// the second "0x"
+		}
+		else if( format=='x' )
+			of.format( 'z', p, unit_size, a, out );	// gdb pads x output
+		else if( format=='a' )
+		{
+			// the unit holds a code address
+			uint32_t v = 0;
+			for( int j=unit_size-1; j>=0; j-- )
+				v = (v<<8) | p[j];
+			out += "0x";
+			of.format( 'a', p, unit_size, v, out );
+		}
+		else
+			of.format( format, p, unit_size, a, out );
+	}
+	out += '\n';
+	fputs( out.c_str(), stdout );
+	next_addr = flat_addr + len;
+	if( !gSession.target()->is_running() )
+		gSession.target()->read_ahead( flat_addr, len );
+}
+
 
 bool CmdX::readMem( uint32_t flat_addr, unsigned int readByteLength, unsigned char* returnPointer )
 {
-	unsigned char b;
 	char area;
 	uint8_t pageNumber = 0;
 	ADDR addr = MemRemap::target( flat_addr, area );
 	switch( area)
 	{
 		case 'c':
-			gSession.target()->read_code( addr, readByteLength, returnPointer );
+			gSession.target()->read_code_cache( addr, readByteLength, returnPointer );
 			return true;
 		case 'd':
-			gSession.target()->read_data( addr, readByteLength, returnPointer );
-			return true;
-		case 'x':
-			gSession.target()->read_xdata( addr, readByteLength, returnPointer );
-			return true;
 		case 'i':
-			gSession.target()->read_data( addr+0x100, readByteLength, returnPointer );	// @FIXME: the offset is incorrect and we probably need a target function for accessing idata
-			return true;
+		case 'x':
+			// cached while stopped, so paging forward is served by
+			// read_ahead().  Both see anything held by the write back buffer.
+			if( gSession.target()->is_running() )
+				return gSession.target()->read_memory_uncached( flat_addr,
+															   readByteLength,
+															   returnPointer );
+			return gSession.target()->read_memory( flat_addr, readByteLength,
+												   returnPointer );
 		case 's':
 			// extract the SFR page number from the flat address
 			// @FIXME: should properly implement in memremap...
@@ -306,34 +485,32 @@ bool CmdX::readMem( uint32_t flat_addr, unsigned int readByteLength, unsigned ch
 
 bool CmdChange::direct( string cmd )
 {
-	vector<string> tokens;
-	vector<string>::iterator it;
-	Tokenize(cmd, tokens);
+	TOKEN tokens[3];
 	uint32_t flat_addr;
 	uint16_t intValue;
 	unsigned char charValue;
 	
-	if(( tokens.size()!=3)||(strcmp("=",tokens[1].c_str()))) {
+	if(( Tokenize(cmd, tokens, 3)!=3)||(!token_is(tokens[1],"="))) {
 		printf("ERROR: format must be $register/memory = value\n");
 		return false;
 	}
 	// figure out value to assign
-	intValue = (uint16_t) strtoul (tokens[2].c_str(),NULL,0);
-	charValue = (unsigned char) strtoul (tokens[2].c_str(),NULL,0);
+	intValue = (uint16_t) token_ul (tokens[2]);
+	charValue = (unsigned char) token_ul (tokens[2]);
 	
 	// check if the target is a register
-	if (tokens[0][0] == '$') {
-		if (strcmp(tokens[0].c_str(),"$a")==0) {
+	if (tokens[0].start[0] == '$') {
+		if (token_is(tokens[0],"$a")) {
 			printf ("setting acc to %d\n",charValue);
 			gSession.target()->write_sfr(0xe0,0,1,&charValue);
 			return true;
 		}
-		else if (strcmp(tokens[0].c_str(),"$pc")==0) {
+		else if (token_is(tokens[0],"$pc")) {
 			printf ("setting pc to %d\n",intValue);
 			gSession.target()->write_PC(intValue);
 			return true;
 		}
-		else if (strcmp(tokens[0].c_str(),"$dptr")==0) {
+		else if (token_is(tokens[0],"$dptr")) {
 			printf ("setting dptr to %d\n",intValue);
 			// set DPL
 			charValue = intValue % 256;
@@ -347,7 +524,7 @@ bool CmdChange::direct( string cmd )
 	}
 	
 	// target isn't a register, so try and figure out memory location
-	flat_addr = strtoul(tokens[0].c_str(),0,0);
+	flat_addr = token_ul(tokens[0]);
 	return writeMem (flat_addr, 1, &charValue);
 }
 
@@ -364,11 +541,9 @@ bool CmdChange::writeMem( uint32_t flat_addr, unsigned int byteLength, unsigned
 			printf("ERROR: can't write to code area\n");
 			return false;
 		case 'd':
-			gSession.target()->write_data( addr, byteLength, writePointer );
-			return true;
 		case 'x':
-			gSession.target()->write_xdata( addr, byteLength, writePointer );
-			return true;
+			return gSession.target()->write_memory( flat_addr, byteLength,
+													writePointer );
 		case 'i':
 			gSession.target()->write_data( addr+0x100, byteLength, writePointer );	// @FIXME: the offset is incorrect and we probably need a target function for accessing idata
 			return true;
@@ -20,6 +20,7 @@
 #ifndef CMDDISASSEMBLE_H
 #define CMDDISASSEMBLE_H
 #include "parsecmd.h"
+#include "memremap.h"
 
 
 class CmdX : public CmdShowSetInfoHelp
@@ -29,17 +30,20 @@ public:
 	{
 		name="X";
 		unit_size = 4;
-		num_units = 1;
 		format ='x';
+		next_addr = MemRemap::INVALID_FLAT_ADDR;
 	}
 	bool direct( string cmd );
+	bool directnoarg();
 	
 protected:
-	bool parseFormat(string token);
+	bool parseFormat( string token, int &count );
+	bool parseAddress( string token, uint32_t &flat_addr );
+	void examine( uint32_t flat_addr, int count );
 	bool readMem( uint32_t flat_addr, unsigned int readByteLength, unsigned char* returnPointer );
 	int unit_size;		///< size of the units to print out in bytes
-	int num_units;		///< number of unit sized object to output
 	char format;		///< Format specifier
+	uint32_t next_addr;	///< just past the last thing examined, for x with no address
 };
 
 class CmdChange : public CmdShowSetInfoHelp
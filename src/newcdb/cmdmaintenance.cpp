@@ -23,6 +23,7 @@ using namespace std;
 #include "module.h"
 #include "symtab.h"
 #include "symtypetree.h"
+#include "target.h"
 #include "newcdb.h"
 
 /** This command provides similar functionality to that of GDB
@@ -65,6 +66,53 @@ bool CmdMaintenance::direct( string cmd )
 			return false;
 		return true;
 	}
+	else if( match(s,"flush") && tokens.size()==2 && match(tokens[1],"code-cache") )
+	{
+		gSession.target()->invalidate_code_cache();
+		return true;
+	}
+	else if( match(s,"flush") && tokens.size()==2 && match(tokens[1],"writes") )
+	{
+		gSession.target()->flush_writes();
+		return true;
+	}
+	else if( match(s,"write-back") && tokens.size()<=2 )
+	{
+		if( tokens.size()==2 )
+		{
+			if( tokens[1]!="on" && tokens[1]!="off" )
+				return false;
+			gSession.target()->set_write_back( tokens[1]=="on" );
+		}
+		cout << "Write back is "
+			 << (gSession.target()->write_back() ? "on" : "off") << "."<<endl;
+		return true;
+	}
+	else if( match(s,"trace") && tokens.size()==2 )
+	{
+		bool ok;
+		if( match(tokens[1],"dump") )
+			ok = gSession.target()->dump_trace();
+		else if( tokens[1]=="on" || tokens[1]=="off" || tokens[1]=="on-error" )
+			ok = gSession.target()->set_trace( tokens[1]!="off",
+											   tokens[1]=="on-error" );
+		else
+			return false;
+		if( !ok )
+			cout << "Target '"<<gSession.target()->target_name()
+				 <<"' doesn't keep a trace."<<endl;
+		return true;
+	}
+	else if( match(s,"stats") )
+	{
+		bool reset = tokens.size()==2 && match(tokens[1],"reset");
+		if( tokens.size()>2 || (tokens.size()==2 && !reset) )
+			return false;
+		if( !gSession.target()->print_stats( reset ) )
+			cout << "Target '"<<gSession.target()->target_name()
+				 <<"' doesn't keep statistics."<<endl;
+		return true;
+	}
 	return false;
 }
 
@@ -28,6 +28,7 @@
 #include <cstdlib>
 #include <list>
 #include <signal.h>
+#include <unistd.h>
 #include <getopt.h>
 #include <iostream>
 #include <fstream>
@@ -38,8 +39,11 @@
 #include "cmdbreakpoints.h"
 #include "cmddisassemble.h"
 #include "cmdmaintenance.h"
+#include "cmdbatch.h"
 #include "targetsilabs.h"
 #include "targets51.h"
+#include "breakpointmgr.h"
+#include "stopprefetch.h"
 #include "newcdb.h"
 
 
@@ -93,51 +97,378 @@
 
 using namespace std;
 
-ParseCmd::List cmdlist;
+CmdRegistry cmdlist;
 string prompt;
 
 DbgSession gSession;
+static StopPrefetch stop_prefetch( &gSession );
 
 void sig_int_handler(int)
 {
-	gSession.target()->stop();
+	if( target_running() )
+		interrupt_target();		// the stop is reported before the next command
+	else if( !stop_prefetch.busy() )	// halted, and the target is in use
+		gSession.target()->stop();
 	cout << endl << prompt;
 }
 
+/// halt a target left running in the background before we let go of it
+void stop_background()
+{
+	if( target_running() )
+	{
+		interrupt_target();
+		report_stop( true );
+	}
+}
+
 void quit()
 {
+	stop_background();
 	gSession.target()->stop();
 	gSession.target()->disconnect();
 }
 
+/** Commands that only use the host side of the session, so they can run
+	while the target runs in the background.  Breakpoint changes reach the
+	target at the next run.  Without an argument break, tbreak and clear
+	work on the PC and delete clears the target's breakpoints, so those
+	forms wait for the target to stop.
+*/
+static bool allowed_while_running( const string &ln )
+{
+	static const char *cmds[] =
+	{
+		"interrupt", "int", "break", "b", "tbreak", "delete", "d", "enable",
+		"disable", "clear", "list", "l", "pwd", "help", "version", "show",
+		"quit", 0
+	};
+	static const char *need_arg[] =
+	{
+		"break", "b", "tbreak", "delete", "d", "clear", 0
+	};
+	static const char *infos[] =
+	{
+		"breakpoints", "break", "b", "files", "sources", "source", "line",
+		"profile", "record", "coverage", "display", 0
+	};
+	vector<string> tokens;
+	size_t b = 0, e;
+	while( tokens.size()<2 && (b = ln.find_first_not_of( " \t", b ))!=string::npos )
+	{
+		e = ln.find_first_of( " \t", b );
+		tokens.push_back( ln.substr( b, e==string::npos ? e : e-b ) );
+		b = e;
+	}
+	if( tokens.empty() )
+		return true;
+	const char **list = cmds;
+	string word = tokens[0];
+	if( word=="info" || word=="i" )
+	{
+		if( tokens.size()<2 )
+			return false;
+		list = infos;
+		word = tokens[1];
+	}
+	if( list==cmds && tokens.size()<2 )
+	{
+		for( int i=0; need_arg[i]; i++ )
+			if( word==need_arg[i] )
+				return false;
+	}
+	for( int i=0; list[i]; i++ )
+		if( word==list[i] )
+			return true;
+	return false;
+}
+
+/** Check whether ln may run now.
+	First reports a background run that has stopped.
+	\param wait	if the target is still running and ln needs it, wait for
+				it to stop instead of refusing the command.
+	\returns false if ln must not run.
+*/
+bool check_running( const string &ln, bool wait )
+{
+	report_stop( false );
+	if( !target_running() || allowed_while_running( ln ) )
+		return true;
+	if( wait )
+	{
+		report_stop( true );
+		return true;
+	}
+	cout << "The program is running.  Use \"interrupt\" or wait for it to stop." << endl;
+	return false;
+}
+
+#ifdef HAVE_LIBREADLINE
+/** Called by readline while it waits for input, report a background run
+	that has stopped without waiting for the next command.
+*/
+static int stop_event_hook()
+{
+	if( target_running() && report_stop( false ) )
+	{
+		rl_on_new_line();
+		rl_redisplay();
+	}
+	return 0;
+}
+
+static vector<string> completions;
+
+/// Hands the matches found by complete_line() to readline one at a time.
+static char *completion_match( const char *text, int state )
+{
+	static size_t next;
+	if( state==0 )
+		next = 0;
+	if( next<completions.size() )
+		return strdup( completions[next++].c_str() );
+	return 0;
+}
+
+/** Completion for readline.
+	The first word, or the one after set / show / info / help, completes
+	command names.  The argument of file and source completes file names,
+	anything else symbols, functions, file:function and source files.
+*/
+static char **complete_line( const char *text, int start, int end )
+{
+	string ln( rl_line_buffer, start );
+	ParseCmd::TOKEN tokens[2];
+	int n = ParseCmd::Tokenize( ln, tokens, 2 );
+	string first = n>0 ? ParseCmd::token_str( tokens[0] ) : "";
+	
+	completions.clear();
+	rl_attempted_completion_over = 1;	// no file names if nothing matches
+	if( n==0 || ( n==1 && ( first=="set" || first=="show" ||
+							first=="info" || first=="help" ) ) )
+		cmdlist.complete( text, completions );
+	else if( first=="file" || first=="source" )
+	{
+		rl_attempted_completion_over = 0;
+		return 0;		// readline's own file name completion
+	}
+	else
+		gSession.symtab()->complete( text, SymTab::COMPLETE_SYMBOLS |
+											 SymTab::COMPLETE_FUNCTIONS |
+											 SymTab::COMPLETE_FILES,
+									 completions );
+	return rl_completion_matches( text, completion_match );
+}
+#endif
+
 
 bool parse_cmd( string ln )
 {
 	if( ln.compare("quit")==0 )
 	{
+		stop_background();
 		gSession.target()->disconnect();
 		exit(0);
 	}
-	ParseCmd::List::iterator it;
-	for( it=cmdlist.begin(); it!=cmdlist.end(); ++it)
+	if( cmdlist.parse(ln) )
+		return true;
+	return ln.length()==0;	// anything left with length >0 is bad.
+}
+
+/** MI commands understood, with the CLI command each maps to.
+	Anything else starting with '-' is rejected, plain CLI commands are
+	accepted as gdb does.  What a command prints is passed on as console
+	stream records.
+*/
+static const struct
+{
+	const char *mi;
+	const char *cli;
+	bool		running;	///< reply ^running before the command executes
+} mi_cmds[] =
+{
+	{ "-exec-run",				"run",			true },
+	{ "-exec-continue",			"continue",		true },
+	{ "-exec-step",				"step",			true },
+	{ "-exec-next",				"next",			true },
+	{ "-exec-step-instruction",	"stepi",		true },
+	{ "-exec-next-instruction",	"nexti",		true },
+	{ "-exec-finish",			"finish",		true },
+	{ "-exec-interrupt",		"interrupt",	false },
+	{ "-break-insert",			"break",		false },
+	{ "-break-delete",			"delete",		false },
+	{ "-break-enable",			"enable",		false },
+	{ "-break-disable",			"disable",		false },
+	{ "-file-exec-and-symbols",	"file",			false },
+	{ "-target-select",			"target",		false },
+	{ "-data-list-register-values", "info registers", false },
+	{ "-stack-list-frames",		"backtrace",	false },
+	{ 0, 0, false }
+};
+
+static FILE *mi_capture = 0;
+static int mi_stdout = -1;
+
+/** Send stdout to a temporary file until mi_capture_end(), the commands
+	print with both cout and printf so it is caught below both.
+*/
+static void mi_capture_begin()
+{
+	cout.flush();
+	fflush( stdout );
+	mi_capture = tmpfile();
+	if( !mi_capture )
+		return;		// nothing wrapped then, but nothing lost either
+	mi_stdout = dup( STDOUT_FILENO );
+	dup2( fileno( mi_capture ), STDOUT_FILENO );
+}
+
+/** Restore stdout and print what was captured as ~"..." console records.
+	Stop records from ContextMgr::dump_mi() are passed on as they are.
+*/
+static void mi_capture_end()
+{
+	string ln;
+	int c;
+	if( !mi_capture )
+		return;
+	cout.flush();
+	fflush( stdout );
+	dup2( mi_stdout, STDOUT_FILENO );
+	close( mi_stdout );
+	rewind( mi_capture );
+	do
+	{
+		c = fgetc( mi_capture );
+		if( c!=EOF )
+			ln += (char)c;
+		if( (c=='\n' || c==EOF) && !ln.empty() )
+		{
+			if( ln[0]=='*' || ln[0]=='=' )
+				cout << ln;
+			else
+				cout << '~' << DbgSession::mi_quote( ln ) << endl;
+			ln.clear();
+		}
+	} while( c!=EOF );
+	cout.flush();
+	fclose( mi_capture );
+	mi_capture = 0;
+}
+
+/** -break-insert [-t] location, setting the breakpoint directly so the
+	reply can describe it.
+	\param[out] result	receives ",bkpt={...}"
+*/
+static bool mi_break_insert( string args, string &result )
+{
+	ParseCmd::TOKEN tokens[16];
+	int n = ParseCmd::Tokenize( args, tokens, 16 );
+	bool temporary = false;
+	string loc;
+	for( int i=0; i<n; i++ )
+	{
+		string t = ParseCmd::token_str( tokens[i] );
+		if( t=="-t" )
+			temporary = true;
+		else if( t[0]!='-' )
+			loc += (loc.empty() ? "" : " ") + t;	// other options don't apply
+	}
+	if( loc.empty() )
+		return false;
+	BP_ID id = gSession.bpmgr()->set_breakpoint( loc, temporary );
+	if( id==BP_ID_INVALID )
+		return false;
+	result = "," + gSession.bpmgr()->mi_bkpt( id );
+	return true;
+}
+
+/** Execute one line in MI mode, replying with a result record.
+	\returns false if the line asked us to exit.
+*/
+bool parse_mi_cmd( string ln )
+{
+	// optional numeric token echoed back in the result
+	size_t n = 0;
+	while( n<ln.length() && isdigit(ln[n]) )
+		n++;
+	string token = ln.substr( 0, n ), cmd = ln.substr( n );
+	if( cmd.length()==0 )
+		return true;
+	if( cmd=="-gdb-exit" || cmd=="quit" )
+	{
+		cout << token << "^exit" << endl;
+		return false;
+	}
+	bool running = false, ok;
+	string name, args, result;
+	if( cmd[0]=='-' )
 	{
-		if( (*it)->parse(ln) )
+		size_t sp = cmd.find(' ');
+		name = cmd.substr( 0, sp );
+		args = sp==string::npos ? "" : cmd.substr( sp );
+		int i;
+		for( i=0; mi_cmds[i].mi && name!=mi_cmds[i].mi; i++ )
+			;
+		if( mi_cmds[i].mi==0 )
+		{
+			cout << token << "^error,msg=\"Undefined MI command: "
+				 << name.substr(1) << "\"" << endl;
 			return true;
+		}
+		running = mi_cmds[i].running;
+		cmd = mi_cmds[i].cli + args;
 	}
-	return ln.length()==0;	// anything left with length >0 is bad.
+	if( !check_running( cmd, false ) )
+	{
+		cout << token << "^error,msg=\"The program is running\"" << endl;
+		return true;
+	}
+	if( running )
+		cout << token << "^running" << endl;
+	mi_capture_begin();
+	if( name=="-break-insert" )
+		ok = mi_break_insert( args, result );
+	else
+		ok = parse_cmd( cmd );
+	mi_capture_end();
+	if( ok )
+	{
+		if( !running )
+			cout << token << "^done" << result << endl;
+		return true;
+	}
+	cout << token << "^error,msg=\"Bad command\"" << endl;
+	return true;
 }
 
-bool process_cmd_file( string filename )
+/** Run the commands in a file.
+	\param batch	If set memory operations are queued on it and the lines
+					aren't echoed, a quit line ends the file.
+*/
+bool process_cmd_file( string filename, BatchQueue *batch=0 )
 {
 	string line;
 	ifstream cmdlist( filename.c_str() );
 	if( !cmdlist.is_open() )
 		return false;	// failed to open command list file
 
+	int line_no = 0;
 	while( !cmdlist.eof() )
 	{
 		std::getline(cmdlist, line);
-		cout << line << endl;
+		line_no++;
+		if( batch )
+		{
+			if( batch->queue( line, line_no ) )
+				continue;
+			batch->flush();		// the command may depend on the queue
+			if( line.compare("quit")==0 )
+				break;
+		}
+		else
+			cout << line << endl;
+		check_running( line, true );
 		if( !parse_cmd(line) )
 			cout << "Bad Command" << endl;
 	}
@@ -159,41 +490,56 @@ int main(int argc, char *argv[])
 	CdbFile f(&gSession);
 
 	// add commands to list
-	cmdlist.push_back( new CmdShowSetInfoHelp() );
-	cmdlist.push_back( new CmdVersion() );
-	cmdlist.push_back( new CmdWarranty() );
-	cmdlist.push_back( new CmdCopying() );
-	cmdlist.push_back( new CmdHelp() );
-	cmdlist.push_back( new CmdPrompt() );
-	cmdlist.push_back( new CmdBreakpoints() );
-	cmdlist.push_back( new CmdBreak() );
-	cmdlist.push_back( new CmdTBreak() );
-	cmdlist.push_back( new CmdDelete() );
-	cmdlist.push_back( new CmdEnable() );
-	cmdlist.push_back( new CmdDisable() );
-	cmdlist.push_back( new CmdClear() );
-	cmdlist.push_back( new CmdTarget() );
-	cmdlist.push_back( new CmdStep() );
-	cmdlist.push_back( new CmdStepi() );
-	cmdlist.push_back( new CmdNext() );
-	cmdlist.push_back( new CmdNexti() );
-	cmdlist.push_back( new CmdContinue() );
-	cmdlist.push_back( new CmdFile() );
-	cmdlist.push_back( new CmdFiles() );
-	cmdlist.push_back( new CmdList() );
-	cmdlist.push_back( new CmdPWD() );
-	cmdlist.push_back( new CmdSource() );
-	cmdlist.push_back( new CmdSources() );
-	cmdlist.push_back( new CmdLine() );
-	cmdlist.push_back( new CmdRun() );
-	cmdlist.push_back( new CmdStop() );
-	cmdlist.push_back( new CmdFinish() );
-	cmdlist.push_back( new CmdDisassemble() );
-	cmdlist.push_back( new CmdX() );
-	cmdlist.push_back( new CmdChange() );
-	cmdlist.push_back( new CmdMaintenance() );
-	cmdlist.push_back( new CmdPrint() );
-	cmdlist.push_back( new CmdRegisters() );
+	cmdlist.add( new CmdShowSetInfoHelp() );
+	cmdlist.add( new CmdVersion() );
+	cmdlist.add( new CmdWarranty() );
+	cmdlist.add( new CmdCopying() );
+	cmdlist.add( new CmdHelp() );
+	cmdlist.add( new CmdPrompt() );
+	cmdlist.add( new CmdBreakpoints() );
+	cmdlist.add( new CmdBreak() );
+	cmdlist.add( new CmdTBreak() );
+	cmdlist.add( new CmdDelete() );
+	cmdlist.add( new CmdEnable() );
+	cmdlist.add( new CmdDisable() );
+	cmdlist.add( new CmdClear() );
+	cmdlist.add( new CmdTarget() );
+	cmdlist.add( new CmdStep() );
+	cmdlist.add( new CmdStepi() );
+	cmdlist.add( new CmdNext() );
+	cmdlist.add( new CmdNexti() );
+	cmdlist.add( new CmdContinue() );
+	cmdlist.add( new CmdFile() );
+	cmdlist.add( new CmdCompareSections() );
+	cmdlist.add( new CmdFiles() );
+	cmdlist.add( new CmdList() );
+	cmdlist.add( new CmdPWD() );
+	cmdlist.add( new CmdSource() );
+	cmdlist.add( new CmdSources() );
+	cmdlist.add( new CmdLine() );
+	cmdlist.add( new CmdRun() );
+	cmdlist.add( new CmdStop() );
+	cmdlist.add( new CmdInterrupt() );
+	cmdlist.add( new CmdFinish() );
+	cmdlist.add( new CmdBacktrace() );
+	cmdlist.add( new CmdBacktrace("BT") );
+	cmdlist.add( new CmdBacktrace("WHERE") );
+	cmdlist.add( new CmdDisassemble() );
+	cmdlist.add( new CmdX() );
+	cmdlist.add( new CmdChange() );
+	cmdlist.add( new CmdMaintenance() );
+	cmdlist.add( new CmdPrint() );
+	cmdlist.add( new CmdDisplay() );
+	cmdlist.add( new CmdUndisplay() );
+	cmdlist.add( new CmdProfile() );
+	cmdlist.add( new CmdMonitor() );
+	cmdlist.add( new CmdWatch() );
+	cmdlist.add( new CmdSnapshot() );
+	cmdlist.add( new CmdRecord() );
+	cmdlist.add( new CmdTrace() );
+	cmdlist.add( new CmdCoverage() );
+	cmdlist.add( new CmdRegisters() );
+	cmdlist.add( new CmdCheck() );
 	string ln;
 	prompt = "(newcdb) ";
 	FILE *badcmd = 0;
@@ -201,6 +547,11 @@ int main(int argc, char *argv[])
 	int help_flag = 0;
 	int debug_badcmd_flag = 0;
 	int fullname_flag = 0;
+	int mi_registers_flag = 0;
+	int batch_flag = 0;
+	int json_flag = 0;
+	bool mi = false;
+	list<string> scripts;
 	while (1)
 	{
 		// command line option parsing
@@ -208,8 +559,15 @@ int main(int argc, char *argv[])
 		{
 			{"command", required_argument, 0, 'c'},
 			{"ex", required_argument, 0, 'e'},
+			{"x", required_argument, 0, 'x'},
+			{"batch", no_argument, &batch_flag, 1},
+			{"json", no_argument, &json_flag, 1},
 			{"dbg-badcmd", required_argument, 0, 'b'},
+			{"load-threads", required_argument, 0, 't'},
+			{"no-symbol-cache", no_argument, 0, 'n'},
 			{"fullname", no_argument, &fullname_flag, 1},
+			{"interpreter", required_argument, 0, 'i'},
+			{"mi-registers", no_argument, &mi_registers_flag, 1},
 			{"q", no_argument, &quiet_flag, 1},
 			{"help", no_argument, &help_flag, 1},
 			{0, 0, 0, 0}
@@ -248,12 +606,34 @@ int main(int argc, char *argv[])
 					}
 				}	
 				break;
+			case 't':
+				CdbFile::set_load_threads( atoi(optarg) );
+				break;
+			case 'n':
+				CdbFile::set_use_cache( false );
+				break;
+			case 'i':
+				if( strcmp( optarg, "mi" )==0 )
+				{
+					mi = true;
+					gSession.set_output_mode( DbgSession::OUT_MI );
+				}
+				else if( strcmp( optarg, "console" )!=0 )
+				{
+					cerr << "ERROR: unknown interpreter '"<<optarg<<"'"<<endl;
+					exit(1);
+				}
+				break;
 			case 'c':
 				// Command file
 				cout << "Processing command file '" << optarg << "'" << endl;
 				if( process_cmd_file(optarg) )
 					cout << "ERROR coulden't open command file" << endl;
 				break;
+			case 'x':
+				// script, run once the file arguments are loaded
+				scripts.push_back( optarg );
+				break;
 			case 'e':
 				// Command file
 				cout << "Executing command " << optarg << endl;
@@ -287,49 +667,90 @@ int main(int argc, char *argv[])
 			<< "\t                  starts.  You can have multiple -ex options\n"
 			<< "\t                  and they will be executed in order left to\n"
 			<< "\t                  right.\n"
+			<< "\t-x <file>         Execute the commands in file once any file\n"
+			<< "\t                  arguments have been loaded.\n"
+			<< "\t-batch            Exit after the -x scripts.  Memory reads,\n"
+			<< "\t                  writes and checks are grouped into bulk\n"
+			<< "\t                  transfers and reported at the end, the exit\n"
+			<< "\t                  status is 1 if any check failed.\n"
+			<< "\t-json             With -batch report each result as a line\n"
+			<< "\t                  of JSON as soon as it's known\n"
 			<< "\t-fullname         Sets the line number output format to two `\\032'\n"
 			<< "\t                  characters, followed by the file name, line number\n"
 			<< "\t                  and character position separated by colons, and a newline.\n"
+			<< "\t-interpreter=mi   Report stops as GDB/MI records and reply\n"
+			<< "\t                  to each command with ^done / ^error\n"
+			<< "\t-mi-registers     Include the registers in MI stop records\n"
 			<< "\t-q                Suppress the startup banner\n"
 			<< "\t--dbg-badcmd=file Log all bad commands to file\n"
+			<< "\t--load-threads=n  Use n threads to load large cdb files\n"
+			<< "\t--no-symbol-cache Always parse the cdb file, don't read or\n"
+			<< "\t                  write name.cdb.cache\n"
 			<< "\t--help            Display this help"
 			<< endl << endl;
 		exit(0);
 	}
 
-	if( !quiet_flag )
+	gSession.contextmgr()->set_mi_registers( mi_registers_flag );
+	if( mi )
+		prompt = "(gdb) \n";
+	else if( !quiet_flag && !batch_flag )
 	{
 		cout << "newcdb, new ec2cdb based on c++ source code" << endl;
 	}
 
+	BatchQueue batch;
+	batch.set_json( json_flag );
+	for( list<string>::iterator it=scripts.begin(); it!=scripts.end(); ++it )
+	{
+		if( !process_cmd_file( *it, batch_flag ? &batch : 0 ) )
+			cout << "ERROR coulden't open command file '" << *it << "'" << endl;
+	}
+	if( batch_flag )
+	{
+		int failures = batch.report();
+		gSession.target()->disconnect();
+		return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 
+#ifdef HAVE_LIBREADLINE
+	rl_event_hook = stop_event_hook;
+	rl_attempted_completion_function = complete_line;
+#endif
 	while(1)
 	{
 		bool ok=false;
+		// the registers, stack and locals are usually asked for next, read
+		// them while waiting
+		if( !target_running() )
+			stop_prefetch.start();
 		char *line = readline( prompt.c_str() );
+		stop_prefetch.yield();
 		if(*line!=0)
 			add_history(line);
 		ln = line;
 		free(line);
 		if(badcmd)
 			fwrite((ln+'\n').c_str(),1,ln.length()+1, badcmd);
+		if( mi )
+		{
+			if( parse_mi_cmd( ln ) )
+				continue;
+			ln = "quit";
+		}
 		if( ln.compare("quit")==0 )
 		{
 			signal( SIGINT, old_sig_int_handler );
+			stop_background();
 			gSession.target()->disconnect();
 			if(badcmd)
 				fclose(badcmd);
 			return 0;
 		}
-		ParseCmd::List::iterator it;
-		for( it=cmdlist.begin(); it!=cmdlist.end(); ++it)
-		{
-			if( (*it)->parse(ln) )
-			{
-				ok = true;
-				break;
-			}
-		}
+		if( !check_running( ln, false ) )
+			continue;
+		ok = cmdlist.parse(ln);
 		if( !ok && (ln.length()>0))
 		{
 			cout <<"bad command ["<<ln<<"]"<<endl;
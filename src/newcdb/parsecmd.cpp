@@ -18,6 +18,10 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include <iostream>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
 using namespace std;
 #include "types.h"
 #include "parsecmd.h"
@@ -55,6 +59,56 @@ void ParseCmd::Tokenize( const string& str,
 	}
 }
 
+int ParseCmd::Tokenize( const string &str, TOKEN *tokens, int max,
+						const char *delimiters )
+{
+	string::size_type pos = 0;
+	TOKEN tok;
+	int n = 0;
+	while( next_token( str, pos, tok, delimiters ) )
+	{
+		if( n==max )
+			return max+1;
+		tokens[n++] = tok;
+	}
+	return n;
+}
+
+bool ParseCmd::next_token( const string &str, string::size_type &pos,
+						   TOKEN &tok, const char *delimiters )
+{
+	pos = str.find_first_not_of( delimiters, pos );
+	if( pos==string::npos )
+		return false;
+	string::size_type end = str.find_first_of( delimiters, pos );
+	if( end==string::npos )
+		end = str.length();
+	tok.start = str.c_str()+pos;
+	tok.len = end-pos;
+	pos = end;
+	return true;
+}
+
+bool ParseCmd::token_is( const TOKEN &tok, const char *s )
+{
+	return strlen(s)==tok.len && strncmp( tok.start, s, tok.len )==0;
+}
+
+uint32_t ParseCmd::token_ul( const TOKEN &tok, int base, bool *ok )
+{
+	// a token always ends at a delimiter or the end of the string so
+	// strtoul() can't run on into the next one unless it's a number too
+	char buf[24];
+	size_t n = tok.len<sizeof(buf)-1 ? tok.len : sizeof(buf)-1;
+	char *endptr;
+	memcpy( buf, tok.start, n );
+	buf[n] = 0;
+	uint32_t v = strtoul( buf, &endptr, base );
+	if( ok )
+		*ok = tok.len>0 && tok.len==n && *endptr==0;
+	return v;
+}
+
 bool ParseCmd::match( const string &token, const string &mask )
 {
 	return token.compare(mask)==0;
@@ -169,3 +223,149 @@ int CmdShowSetInfoHelp::compare_name( string s )
 	return s.length();
 }
 
+
+CmdRegistry::CmdRegistry()
+{
+	m_trie.push_back( NODE() );
+}
+
+CmdRegistry::~CmdRegistry()
+{
+}
+
+void CmdRegistry::add( ParseCmd *cmd )
+{
+	ENTRY ent;
+	ent.cmd = cmd;
+	ent.min_len = 0;
+	int idx = m_cmds.size();
+	CmdShowSetInfoHelp *named = dynamic_cast<CmdShowSetInfoHelp*>( cmd );
+	if( named )
+	{
+		const string &name = named->command_name();
+		while( ent.min_len<name.length() && isupper(name[ent.min_len]) )
+			ent.min_len++;
+		int node = 0;
+		m_trie[0].cmds.push_back( idx );
+		for( size_t i=0; i<name.length(); i++ )
+		{
+			char c = tolower( name[i] );
+			ent.name += c;
+			std::map<char,int>::iterator it = m_trie[node].next.find( c );
+			if( it==m_trie[node].next.end() )
+			{
+				m_trie.push_back( NODE() );
+				it = m_trie[node].next.insert(
+						make_pair( c, int(m_trie.size()-1) ) ).first;
+			}
+			node = it->second;
+			m_trie[node].cmds.push_back( idx );
+		}
+	}
+	else
+		m_plain.push_back( idx );
+	m_cmds.push_back( ent );
+}
+
+/** \returns the node for the lower case of word, -1 if no name starts
+	with it.
+*/
+int CmdRegistry::find_node( const char *word, size_t len )
+{
+	int node = 0;
+	for( size_t i=0; i<len && node!=-1; i++ )
+	{
+		std::map<char,int>::iterator it =
+			m_trie[node].next.find( tolower( word[i] ) );
+		node = it==m_trie[node].next.end() ? -1 : it->second;
+	}
+	return node;
+}
+
+/** Add the commands that accept word as their name to out, see
+	CmdShowSetInfoHelp::compare_name().
+*/
+void CmdRegistry::candidates( const char *word, size_t len, vector<int> &out )
+{
+	int node = find_node( word, len );
+	if( node==-1 )
+		return;
+	for( int i=0; i<m_trie[node].cmds.size(); i++ )
+	{
+		int idx = m_trie[node].cmds[i];
+		if( len>=m_cmds[idx].min_len )
+			out.push_back( idx );
+	}
+}
+
+/// length of the word at ofs, it ends at a space or a '/' like a name does
+size_t CmdRegistry::word_len( const string &ln, size_t ofs )
+{
+	size_t e = ln.find_first_of( " /", ofs );
+	return e==string::npos ? ln.length()-ofs : e-ofs;
+}
+
+/** If the word at ofs is the start of only one command's name but too
+	short to be accepted by it, offer the line with the name in full.
+*/
+bool CmdRegistry::try_unique( const string &ln, size_t ofs, size_t len )
+{
+	if( len==0 )
+		return false;
+	int node = find_node( ln.c_str()+ofs, len );
+	if( node==-1 || m_trie[node].cmds.size()!=1 )
+		return false;
+	ENTRY &ent = m_cmds[ m_trie[node].cmds[0] ];
+	if( len>=ent.min_len )
+		return false;	// already offered
+	string full = ln.substr( 0, ofs ) + ent.name + ln.substr( ofs+len );
+	return ent.cmd->parse( full );
+}
+
+/// lines starting with these name a command in the following word
+static const char *modes[] = { "set ", "show ", "info ", "help " };
+
+bool CmdRegistry::parse( const string &ln )
+{
+	vector<int> cand( m_plain );
+	size_t mode_ofs = 0, i;
+	size_t len = word_len( ln, 0 );
+	
+	candidates( ln.c_str(), len, cand );
+	for( i=0; i<sizeof(modes)/sizeof(modes[0]); i++ )
+	{
+		if( ln.compare( 0, strlen(modes[i]), modes[i] )==0 )
+		{
+			mode_ofs = strlen(modes[i]);
+			candidates( ln.c_str()+mode_ofs, word_len( ln, mode_ofs ), cand );
+			break;
+		}
+	}
+	// earlier commands first, as when each was offered the line in turn
+	sort( cand.begin(), cand.end() );
+	cand.erase( unique( cand.begin(), cand.end() ), cand.end() );
+	for( i=0; i<cand.size(); i++ )
+	{
+		if( m_cmds[cand[i]].cmd->parse( ln ) )
+			return true;
+	}
+	if( mode_ofs && try_unique( ln, mode_ofs, word_len( ln, mode_ofs ) ) )
+		return true;
+	return try_unique( ln, 0, len );
+}
+
+void CmdRegistry::complete( const string &prefix, vector<string> &names )
+{
+	int node = find_node( prefix.c_str(), prefix.length() );
+	size_t first = names.size();
+	for( int i=0; node!=-1 && i<m_trie[node].cmds.size(); i++ )
+		names.push_back( m_cmds[ m_trie[node].cmds[i] ].name );
+	for( size_t i=0; i<sizeof(modes)/sizeof(modes[0]); i++ )
+	{
+		string mode( modes[i], strlen(modes[i])-1 );
+		if( mode.compare( 0, prefix.length(), prefix )==0 )
+			names.push_back( mode );
+	}
+	sort( names.begin()+first, names.end() );
+	names.erase( unique( names.begin()+first, names.end() ), names.end() );
+}
@@ -22,6 +22,7 @@
 #include <list>
 #include <string>
 #include <vector>
+#include <map>
 #include "types.h"
 #include "newcdb.h"
 using namespace std;
@@ -42,6 +43,37 @@ public:
 	void Tokenize( const string& str,
 				  vector<string>& tokens,
 				  const string& delimiters = " ");
+	
+	/// A token of a command, a range of the string it was found in.
+	typedef struct
+	{
+		const char	*start;
+		size_t		len;
+	} TOKEN;
+	
+	/** Split str up like the vector version, without copying the tokens.
+		The tokens point into str and are only valid while it is.
+		\param tokens	receives up to max tokens
+		\returns the number of tokens, max+1 if there were more than max.
+	*/
+	static int Tokenize( const string &str, TOKEN *tokens, int max,
+						 const char *delimiters = " " );
+	/** Find the next token in str from pos on, for any number of them.
+		\param pos		where to start, receives the position after the token.
+		\returns false if there are no more.
+	*/
+	static bool next_token( const string &str, string::size_type &pos,
+							TOKEN &tok, const char *delimiters = " " );
+	/// \returns true if the token is exactly s.
+	static bool token_is( const TOKEN &tok, const char *s );
+	/** Convert a token to a number like strtoul().
+		\param ok	if given, set to false unless the whole token was used.
+	*/
+	static uint32_t token_ul( const TOKEN &tok, int base=0, bool *ok=0 );
+	static string token_str( const TOKEN &tok )
+	{
+		return string( tok.start, tok.len );
+	}
 	bool match( const string &token, const string &mask );
 };
 
@@ -51,6 +83,8 @@ public:
 	CmdShowSetInfoHelp();
 	~CmdShowSetInfoHelp();
 	virtual bool parse( string cmd );
+	/// the command's name, upper case letters are the shortest abbreviation
+	const string &command_name() const		{ return name; }
 	
 protected:
 	string name;
@@ -64,4 +98,49 @@ protected:
 	virtual bool directnoarg()				{ return false; }
 };
 
+/** The commands of the debugger, picks the ones that may accept a line by
+	its first word, or the word after set / show / info / help, so a line
+	isn't offered to every command in turn.
+	Names are held in a prefix tree.  An abbreviation is accepted as the
+	commands always have, at least the upper case part of the name, and
+	where several commands accept a line the one added first wins.  A
+	shorter prefix than that is also accepted when it's the start of only
+	one command's name, as gdb does.
+*/
+class CmdRegistry
+{
+public:
+	CmdRegistry();
+	~CmdRegistry();
+	/// Add a command, it must stay valid as long as the registry.
+	void add( ParseCmd *cmd );
+	/// \returns true if a command accepted ln.
+	bool parse( const string &ln );
+	/// Add the command names, and set etc, that start with prefix to names.
+	void complete( const string &prefix, vector<string> &names );
+
+protected:
+	typedef struct
+	{
+		ParseCmd	*cmd;
+		string		name;		///< lower case name
+		size_t		min_len;	///< shortest abbreviation accepted
+	} ENTRY;
+	vector<ENTRY>	m_cmds;		///< in the order added
+	vector<int>		m_plain;	///< commands without a name, offered every line
+	
+	/// node of the prefix tree, the root is m_trie[0]
+	typedef struct
+	{
+		std::map<char,int>	next;	///< child for the next letter
+		vector<int>			cmds;	///< commands whose name starts here
+	} NODE;
+	vector<NODE>	m_trie;
+	
+	int find_node( const char *word, size_t len );
+	void candidates( const char *word, size_t len, vector<int> &out );
+	bool try_unique( const string &ln, size_t ofs, size_t len );
+	static size_t word_len( const string &ln, size_t ofs );
+};
+
 #endif